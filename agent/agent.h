@@ -37,6 +37,7 @@
 #include "../common/sysutils.h" /* (gnupg_fd_t) */
 #include "../common/session-env.h"
 #include "../common/shareddefs.h"
+#include "../common/metrics.h"
 
 /* To convey some special hash algorithms we use algorithm numbers
    reserved for application use. */
@@ -140,12 +141,20 @@ struct
    * profiles which lock the use of --enable-extended-key-format. */
   int enable_extended_key_format;
 
+  /* If set all private keys are stored in a single file instead of
+   * one file per key.  See keystore.c.  */
+  int use_key_container;
+
   int running_detached; /* We are running detached from the tty. */
 
   /* If this global option is true, the passphrase cache is ignored
      for signing operations.  */
   int ignore_cache_for_signing;
 
+  /* If this global option is true, unprotected keys are kept in the
+     cache along with their passphrases.  */
+  int cache_unprotected_keys;
+
   /* If this global option is true, the user is allowed to
      interactively mark certificate in trustlist.txt as trusted. */
   int allow_mark_trusted;
@@ -248,6 +257,9 @@ struct server_control_s
   /* The current pinentry mode.  */
   pinentry_mode_t pinentry_mode;
 
+  /* The trace id set by the client or an empty string.  */
+  char trace_id[GNUPG_TRACE_ID_LEN+1];
+
   /* The TTL used for the --preset option of certain commands.  */
   int cache_ttl_opt_preset;
 
@@ -411,6 +423,8 @@ gpg_error_t agent_print_status (ctrl_t ctrl, const char *keyword,
      GPGRT_ATTR_PRINTF(3,4);
 void bump_key_eventcounter (void);
 void bump_card_eventcounter (void);
+void get_card_eventcounters (unsigned int *r_card,
+                             unsigned int *r_maybe_key_change);
 void start_command_handler (ctrl_t, gnupg_fd_t, gnupg_fd_t);
 gpg_error_t pinentry_loopback (ctrl_t, const char *keyword,
                                unsigned char **buffer, size_t *size,
@@ -468,6 +482,15 @@ gpg_error_t agent_delete_key (ctrl_t ctrl, const char *desc_text,
                               const unsigned char *grip,
                               int force, int only_stubs);
 
+/*-- keystore.c --*/
+gpg_error_t agent_keystore_get (const unsigned char *grip,
+                                unsigned char **r_image, size_t *r_imagelen);
+int agent_keystore_has (const unsigned char *grip);
+gpg_error_t agent_keystore_put (const unsigned char *grip,
+                                const void *image, size_t imagelen);
+gpg_error_t agent_keystore_delete (const unsigned char *grip);
+gpg_error_t agent_keystore_list (unsigned char **r_grips, size_t *r_count);
+
 /*-- call-pinentry.c --*/
 void initialize_module_call_pinentry (void);
 void agent_query_dump_state (void);
@@ -500,6 +523,11 @@ void agent_flush_cache (int pincache_only);
 int agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
                      const char *data, int ttl);
 char *agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode);
+void agent_put_cache_key (ctrl_t ctrl, const char *key,
+                          cache_mode_t cache_mode, const unsigned char *skey);
+unsigned char *agent_get_cache_key (ctrl_t ctrl, const char *key,
+                                    cache_mode_t cache_mode);
+void agent_flush_cache_key (const char *key);
 void agent_store_cache_hit (const char *key);
 
 
@@ -512,11 +540,21 @@ gpg_error_t agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 gpg_error_t agent_pksign (ctrl_t ctrl, const char *cache_nonce,
                           const char *desc_text,
                           membuf_t *outbuf, cache_mode_t cache_mode);
+gpg_error_t agent_pksign_multi (ctrl_t ctrl, const char *cache_nonce,
+                                const char *desc_text,
+                                const unsigned char *digests, size_t ndigests,
+                                membuf_t *outbuf, cache_mode_t cache_mode);
 
 /*-- pkdecrypt.c --*/
 int agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
                      const unsigned char *ciphertext, size_t ciphertextlen,
                      membuf_t *outbuf, int *r_padding);
+gpg_error_t agent_pkdecrypt_multi (ctrl_t ctrl,
+                                   const unsigned char *grips, size_t ngrips,
+                                   const unsigned char *ciphertext,
+                                   size_t ciphertextlen,
+                                   membuf_t *outbuf, int *r_padding,
+                                   size_t *r_idx);
 
 /*-- genkey.c --*/
 int check_passphrase_constraints (ctrl_t ctrl, const char *pw, int no_empty,
@@ -529,6 +567,9 @@ int agent_genkey (ctrl_t ctrl, const char *cache_nonce, time_t timestamp,
                   int preset, membuf_t *outbuf);
 gpg_error_t agent_protect_and_store (ctrl_t ctrl, gcry_sexp_t s_skey,
                                      char **passphrase_addr);
+gpg_error_t agent_pregen_add (const char *spec);
+void agent_pregen_start (void);
+gpg_error_t agent_pregen_request (const char *keyparam, size_t keyparamlen);
 
 /*-- protect.c --*/
 void set_s2k_calibration_time (unsigned int milliseconds);
@@ -536,6 +577,7 @@ unsigned long get_calibrated_s2k_count (void);
 unsigned long get_standard_s2k_count (void);
 unsigned char get_standard_s2k_count_rfc4880 (void);
 unsigned long get_standard_s2k_time (void);
+void agent_flush_kek_cache (void);
 int agent_protect (const unsigned char *plainkey, const char *passphrase,
                    unsigned char **result, size_t *resultlen,
 		   unsigned long s2k_count, int use_ocb);
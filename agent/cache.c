@@ -26,6 +26,8 @@
 #include <npth.h>
 
 #include "agent.h"
+#include "../common/timerwheel.h"
+#include "../common/metrics.h"
 
 /* The default TTL for DATA items.  This has no configure
  * option because it is expected that clients provide a TTL.  */
@@ -34,6 +36,9 @@
 /* The size of the encryption key in bytes.  */
 #define ENCRYPTION_KEYSIZE (128/8)
 
+/* The number of buckets of the hash table with the cache items.  */
+#define CACHE_TABLE_SIZE 1021
+
 /* A mutex used to serialize access to the cache.  */
 static npth_mutex_t cache_lock;
 /* The encryption context.  This is the only place where the
@@ -56,23 +61,49 @@ struct secret_data_s {
 /* The cache object.  */
 typedef struct cache_item_s *ITEM;
 struct cache_item_s {
-  ITEM next;
+  ITEM next;        /* The next item in the same hash bucket.  */
   time_t created;
   time_t accessed;  /* Not updated for CACHE_MODE_DATA */
   int ttl;  /* max. lifetime given in seconds, -1 one means infinite */
   struct secret_data_s *pw;
+  struct secret_data_s *skey;  /* NULL or the unprotected key.  */
   cache_mode_t cache_mode;
   int restricted;  /* The value of ctrl->restricted is part of the key.  */
+  time_t expires;  /* Time housekeeping needs to look at the item.  */
+  int heapidx;     /* Index in EXPIRY_HEAP or -1 if it never expires.  */
   char key[1];
 };
 
-/* The cache himself.  */
-static ITEM thecache;
+/* The cache himself.  This is a hash table indexed by the hash of
+ * the key.  */
+static ITEM thecache[CACHE_TABLE_SIZE];
+
+/* The number of items in the cache.  */
+static int cache_nitems;
+
+/* A binary min-heap of the items ordered by their EXPIRES field.
+ * There is always room for all items so that an item can be put
+ * into the heap without an allocation.  */
+static ITEM *expiry_heap;
+static int expiry_heap_used;
+static int expiry_heap_size;
+
+/* The values of the max-cache-ttl options used to compute the
+ * EXPIRES fields.  */
+static unsigned long expiry_max_cache_ttl;
+static unsigned long expiry_max_cache_ttl_ssh;
+
+/* The timer to run the housekeeping when the top item of the expiry
+ * heap expires.  */
+static struct gnupg_timer_s expiry_timer;
 
 /* NULL or the last cache key stored by agent_store_cache_hit.  */
 static char *last_stored_cache_key;
 
 
+static void expiry_timer_cb (void *opaque);
+
+
 /* This function must be called once to initialize this module. It
    has to be done before a second thread is spawned.  */
 void
@@ -84,6 +115,8 @@ initialize_module_cache (void)
 
   if (err)
     log_fatal ("error initializing cache module: %s\n", strerror (err));
+
+  gnupg_timer_init (&expiry_timer, expiry_timer_cb, NULL);
 }
 
 
@@ -143,12 +176,23 @@ release_data (struct secret_data_s *data)
    xfree (data);
 }
 
+/* Release the passphrase and the unprotected key of item R.  */
+static void
+release_secrets (ITEM r)
+{
+  release_data (r->pw);
+  r->pw = NULL;
+  release_data (r->skey);
+  r->skey = NULL;
+}
+
+
+/* Encrypt the LENGTH bytes at DATA and store them at R_DATA.  */
 static gpg_error_t
-new_data (const char *string, struct secret_data_s **r_data)
+new_data (const void *data, size_t length, struct secret_data_s **r_data)
 {
   gpg_error_t err;
   struct secret_data_s *d, *d_enc;
-  size_t length;
   int total;
 
   *r_data = NULL;
@@ -157,8 +201,6 @@ new_data (const char *string, struct secret_data_s **r_data)
   if (err)
     return err;
 
-  length = strlen (string) + 1;
-
   /* We pad the data to 32 bytes so that it get more complicated
      finding something out by watching allocation patterns.  This is
      usually not possible but we better assume nothing about our secure
@@ -169,7 +211,7 @@ new_data (const char *string, struct secret_data_s **r_data)
   d = xtrymalloc_secure (sizeof *d + total - 1);
   if (!d)
     return gpg_error_from_syserror ();
-  memcpy (d->data, string, length);
+  memcpy (d->data, data, length);
 
   d_enc = xtrymalloc (sizeof *d_enc + total - 1);
   if (!d_enc)
@@ -193,80 +235,290 @@ new_data (const char *string, struct secret_data_s **r_data)
 }
 
 
+/* Decrypt DATA into a newly allocated buffer in secure memory which
+ * is stored at R_VALUE.  */
+static gpg_error_t
+decrypt_data (struct secret_data_s *data, char **r_value)
+{
+  gpg_error_t err;
+  char *value;
 
-/* Check whether there are items to expire.  */
-static void
-housekeeping (void)
+  *r_value = NULL;
+  if (data->totallen < 32)
+    return gpg_error (GPG_ERR_INV_LENGTH);
+  if ((err = init_encryption ()))
+    return err;
+  if (!(value = xtrymalloc_secure (data->totallen - 8)))
+    return gpg_error_from_syserror ();
+  err = gcry_cipher_decrypt (encryption_handle,
+                             value, data->totallen - 8,
+                             data->data, data->totallen);
+  if (err)
+    xfree (value);
+  else
+    *r_value = value;
+  return err;
+}
+
+
+
+/* Return the hash bucket for KEY.  */
+static unsigned int
+hash_key (const char *key)
 {
-  ITEM r, rprev;
-  time_t current = gnupg_get_time ();
+  unsigned int hash = 2166136261u;  /* FNV-1a.  */
+
+  for (; *key; key++)
+    hash = (hash ^ *(const unsigned char *)key) * 16777619u;
+  return hash % CACHE_TABLE_SIZE;
+}
+
 
-  /* First expire the actual data */
-  for (r=thecache; r; r = r->next)
+/* Return the time at which housekeeping needs to expire or remove
+ * item R or 0 if that won't happen.  */
+static time_t
+item_expires (ITEM r)
+{
+  time_t expires;
+  unsigned long maxttl;
+  int have = 0;
+
+  if (r->pw)
     {
       if (r->cache_mode == CACHE_MODE_PIN)
-        ; /* Don't let it expire - scdaemon explicitly flushes them.  */
-      else if (r->pw && r->ttl >= 0 && r->accessed + r->ttl < current)
+        return 0;  /* Don't let it expire.  */
+      if (r->ttl >= 0)
         {
-          if (DBG_CACHE)
-            log_debug ("  expired '%s'.%d (%ds after last access)\n",
-                       r->key, r->restricted, r->ttl);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = current;
+          expires = r->accessed + r->ttl;
+          have = 1;
         }
+      if (r->cache_mode != CACHE_MODE_DATA)
+        {
+          if (r->cache_mode == CACHE_MODE_SSH)
+            maxttl = opt.max_cache_ttl_ssh;
+          else
+            maxttl = opt.max_cache_ttl;
+          if (!have || r->created + maxttl < expires)
+            expires = r->created + maxttl;
+          have = 1;
+        }
+    }
+  else if (r->ttl >= 0)
+    {
+      expires = r->accessed + 60*30;
+      have = 1;
+    }
+
+  /* The item is expired when the current time is past the value.  */
+  return have? expires + 1 : 0;
+}
+
+
+static void
+heap_swap (int a, int b)
+{
+  ITEM tmp = expiry_heap[a];
+
+  expiry_heap[a] = expiry_heap[b];
+  expiry_heap[b] = tmp;
+  expiry_heap[a]->heapidx = a;
+  expiry_heap[b]->heapidx = b;
+}
+
+
+static void
+heap_up (int idx)
+{
+  int parent;
+
+  while (idx)
+    {
+      parent = (idx - 1) / 2;
+      if (expiry_heap[parent]->expires <= expiry_heap[idx]->expires)
+        break;
+      heap_swap (parent, idx);
+      idx = parent;
+    }
+}
+
+
+static void
+heap_down (int idx)
+{
+  int child;
+
+  for (;;)
+    {
+      child = 2 * idx + 1;
+      if (child >= expiry_heap_used)
+        break;
+      if (child + 1 < expiry_heap_used
+          && (expiry_heap[child + 1]->expires
+              < expiry_heap[child]->expires))
+        child++;
+      if (expiry_heap[idx]->expires <= expiry_heap[child]->expires)
+        break;
+      heap_swap (idx, child);
+      idx = child;
     }
+}
 
-  /* Second, make sure that we also remove them based on the created
-   * stamp so that the user has to enter it from time to time.  We
-   * don't do this for data items which are used to storage secrets in
-   * meory and are not user entered passphrases etc.  */
-  for (r=thecache; r; r = r->next)
+
+/* Remove item R from the expiry heap.  */
+static void
+heap_remove (ITEM r)
+{
+  int idx = r->heapidx;
+
+  if (idx < 0)
+    return;
+  r->heapidx = -1;
+  expiry_heap_used--;
+  if (idx != expiry_heap_used)
     {
-      unsigned long maxttl;
+      expiry_heap[idx] = expiry_heap[expiry_heap_used];
+      expiry_heap[idx]->heapidx = idx;
+      heap_down (idx);
+      heap_up (idx);
+    }
+}
 
-      switch (r->cache_mode)
+
+/* Make sure that the expiry heap has room for one more item.  */
+static gpg_error_t
+heap_reserve (void)
+{
+  ITEM *newheap;
+  int newsize;
+
+  if (cache_nitems < expiry_heap_size)
+    return 0;
+  newsize = expiry_heap_size? 2 * expiry_heap_size : 64;
+  newheap = xtryrealloc (expiry_heap, newsize * sizeof *newheap);
+  if (!newheap)
+    return gpg_error_from_syserror ();
+  expiry_heap = newheap;
+  expiry_heap_size = newsize;
+  return 0;
+}
+
+
+/* Set the expiry timer to the time of the top item of the expiry
+ * heap.  */
+static void
+update_expiry_timer (void)
+{
+  if (!expiry_heap_used)
+    gnupg_timer_cancel (&expiry_timer);
+  else if (!gnupg_timer_pending (&expiry_timer)
+           || expiry_timer.deadline != expiry_heap[0]->expires)
+    gnupg_timer_set (&expiry_timer, expiry_heap[0]->expires);
+}
+
+
+/* Recompute the expiration time of item R after it has been changed
+ * and update the expiry heap.  */
+static void
+update_expiry (ITEM r)
+{
+  r->expires = item_expires (r);
+  if (!r->expires)
+    heap_remove (r);
+  else if (r->heapidx < 0)
+    {
+      log_assert (expiry_heap_used < expiry_heap_size);
+      r->heapidx = expiry_heap_used++;
+      expiry_heap[r->heapidx] = r;
+      heap_up (r->heapidx);
+    }
+  else
+    {
+      heap_down (r->heapidx);
+      heap_up (r->heapidx);
+    }
+  update_expiry_timer ();
+}
+
+
+/* Unlink item R from the cache and release it.  */
+static void
+remove_item (ITEM r)
+{
+  ITEM *rp;
+
+  heap_remove (r);
+  for (rp = &thecache[hash_key (r->key)]; *rp; rp = &(*rp)->next)
+    if (*rp == r)
+      {
+        *rp = r->next;
+        break;
+      }
+  release_secrets (r);
+  xfree (r);
+  cache_nitems--;
+  update_expiry_timer ();
+}
+
+
+/* Check whether there are items to expire.  Only the items at the
+ * top of the expiry heap need to be looked at.  */
+static void
+housekeeping (void)
+{
+  ITEM r;
+  time_t current = gnupg_get_time ();
+  int idx;
+
+  /* The options may have been changed by a reload.  */
+  if (expiry_max_cache_ttl != opt.max_cache_ttl
+      || expiry_max_cache_ttl_ssh != opt.max_cache_ttl_ssh)
+    {
+      expiry_max_cache_ttl = opt.max_cache_ttl;
+      expiry_max_cache_ttl_ssh = opt.max_cache_ttl_ssh;
+      for (idx = 0; idx < CACHE_TABLE_SIZE; idx++)
+        for (r = thecache[idx]; r; r = r->next)
+          update_expiry (r);
+    }
+
+  while (expiry_heap_used && expiry_heap[0]->expires <= current)
+    {
+      r = expiry_heap[0];
+      if (r->pw && r->ttl >= 0 && r->accessed + r->ttl < current)
         {
-        case CACHE_MODE_DATA:
-        case CACHE_MODE_PIN:
-          continue;  /* No MAX TTL here.  */
-        case CACHE_MODE_SSH: maxttl = opt.max_cache_ttl_ssh; break;
-        default: maxttl = opt.max_cache_ttl; break;
+          /* First expire the actual data.  */
+          if (DBG_CACHE)
+            log_debug ("  expired '%s'.%d (%ds after last access)\n",
+                       r->key, r->restricted, r->ttl);
+          release_secrets (r);
+          r->accessed = current;
+          update_expiry (r);
         }
-      if (r->pw && r->created + maxttl < current)
+      else if (r->pw)
         {
+          /* Second, make sure that we also remove them based on the
+           * created stamp so that the user has to enter it from time
+           * to time.  We don't do this for data items which are used
+           * to storage secrets in meory and are not user entered
+           * passphrases etc.  item_expires takes care of this.  */
           if (DBG_CACHE)
             log_debug ("  expired '%s'.%d (%lus after creation)\n",
                        r->key, r->restricted, opt.max_cache_ttl);
-          release_data (r->pw);
-          r->pw = NULL;
+          release_secrets (r);
           r->accessed = current;
+          update_expiry (r);
         }
-    }
-
-  /* Third, make sure that we don't have too many items in the list.
-   * Expire old and unused entries after 30 minutes.  */
-  for (rprev=NULL, r=thecache; r; )
-    {
-      if (!r->pw && r->ttl >= 0 && r->accessed + 60*30 < current)
+      else
         {
-          ITEM r2 = r->next;
+          /* Third, make sure that we don't have too many items in
+           * the list.  Expire old and unused entries after 30
+           * minutes.  */
           if (DBG_CACHE)
             log_debug ("  removed '%s'.%d (mode %d) (slot not used for 30m)\n",
                        r->key, r->restricted, r->cache_mode);
-          xfree (r);
-          if (!rprev)
-            thecache = r2;
-          else
-            rprev->next = r2;
-          r = r2;
-        }
-      else
-        {
-          rprev = r;
-          r = r->next;
+          remove_item (r);
         }
     }
+  update_expiry_timer ();
 }
 
 
@@ -290,11 +542,21 @@ agent_cache_housekeeping (void)
 }
 
 
+/* The callback for EXPIRY_TIMER.  */
+static void
+expiry_timer_cb (void *opaque)
+{
+  (void)opaque;
+
+  agent_cache_housekeeping ();
+}
+
+
 void
 agent_flush_cache (int pincache_only)
 {
   ITEM r;
-  int res;
+  int res, idx;
 
   if (DBG_CACHE)
     log_debug ("agent_flush_cache%s\n", pincache_only?" (pincache only)":"");
@@ -303,19 +565,23 @@ agent_flush_cache (int pincache_only)
   if (res)
     log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
 
-  for (r=thecache; r; r = r->next)
-    {
-      if (pincache_only && r->cache_mode != CACHE_MODE_PIN)
-        continue;
-      if (r->pw)
-        {
-          if (DBG_CACHE)
-            log_debug ("  flushing '%s'.%d\n", r->key, r->restricted);
-          release_data (r->pw);
-          r->pw = NULL;
-          r->accessed = 0;
-        }
-    }
+  for (idx = 0; idx < CACHE_TABLE_SIZE; idx++)
+    for (r = thecache[idx]; r; r = r->next)
+      {
+        if (pincache_only && r->cache_mode != CACHE_MODE_PIN)
+          continue;
+        if (r->pw)
+          {
+            if (DBG_CACHE)
+              log_debug ("  flushing '%s'.%d\n", r->key, r->restricted);
+            release_secrets (r);
+            r->accessed = 0;
+            update_expiry (r);
+          }
+      }
+
+  if (!pincache_only)
+    agent_flush_kek_cache ();
 
   res = npth_mutex_unlock (&cache_lock);
   if (res)
@@ -373,7 +639,7 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
   if ((!ttl && data) || cache_mode == CACHE_MODE_IGNORE)
     goto out;
 
-  for (r=thecache; r; r = r->next)
+  for (r = thecache[hash_key (key)]; r; r = r->next)
     {
       if (cache_mode == CACHE_MODE_PIN && data)
         {
@@ -397,40 +663,43 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
     }
   if (r) /* Replace.  */
     {
-      if (r->pw)
-        {
-          release_data (r->pw);
-          r->pw = NULL;
-        }
+      release_secrets (r);
       if (data)
         {
           r->created = r->accessed = gnupg_get_time ();
           r->ttl = ttl;
           r->cache_mode = cache_mode;
-          err = new_data (data, &r->pw);
+          err = new_data (data, strlen (data) + 1, &r->pw);
           if (err)
             log_error ("error replacing cache item: %s\n", gpg_strerror (err));
         }
+      update_expiry (r);
     }
   else if (data) /* Insert.  */
     {
-      r = xtrycalloc (1, sizeof *r + strlen (key));
-      if (!r)
+      err = heap_reserve ();
+      r = err? NULL : xtrycalloc (1, sizeof *r + strlen (key));
+      if (err)
+        ;
+      else if (!r)
         err = gpg_error_from_syserror ();
       else
         {
           strcpy (r->key, key);
+          r->heapidx = -1;
           r->restricted = restricted;
           r->created = r->accessed = gnupg_get_time ();
           r->ttl = ttl;
           r->cache_mode = cache_mode;
-          err = new_data (data, &r->pw);
+          err = new_data (data, strlen (data) + 1, &r->pw);
           if (err)
             xfree (r);
           else
             {
-              r->next = thecache;
-              thecache = r;
+              r->next = thecache[hash_key (key)];
+              thecache[hash_key (key)] = r;
+              cache_nitems++;
+              update_expiry (r);
             }
         }
       if (err)
@@ -446,6 +715,32 @@ agent_put_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
 }
 
 
+/* Return the item with a passphrase for KEY, CACHE_MODE and
+ * RESTRICTED or NULL.  */
+static ITEM
+find_item (const char *key, cache_mode_t cache_mode, int restricted)
+{
+  ITEM r;
+
+  for (r = thecache[hash_key (key)]; r; r = r->next)
+    {
+      if (cache_mode == CACHE_MODE_PIN)
+        {
+          if (r->pw && !strcmp (r->key, key))
+            return r;
+        }
+      else if (r->pw
+               && ((cache_mode != CACHE_MODE_USER
+                    && cache_mode != CACHE_MODE_NONCE)
+                   || cache_mode_equal (r->cache_mode, cache_mode))
+               && r->restricted == restricted
+               && !strcmp (r->key, key))
+        return r;
+    }
+  return NULL;
+}
+
+
 /* Try to find an item in the cache.  Returns NULL if not found or an
  * malloced string with the value.  */
 char *
@@ -457,7 +752,6 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
   int res;
   int last_stored = 0;
   int restricted = ctrl? ctrl->restricted : -1;
-  int yes;
 
   if (cache_mode == CACHE_MODE_IGNORE)
     return NULL;
@@ -480,53 +774,29 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
                last_stored? " (stored cache key)":"");
   housekeeping ();
 
-  for (r=thecache; r; r = r->next)
+  r = find_item (key, cache_mode, restricted);
+  if (r)
     {
-      if (cache_mode == CACHE_MODE_PIN)
-        yes = (r->pw && !strcmp (r->key, key));
-      else if (r->pw
-               && ((cache_mode != CACHE_MODE_USER
-                    && cache_mode != CACHE_MODE_NONCE)
-                   || cache_mode_equal (r->cache_mode, cache_mode))
-               && r->restricted == restricted
-               && !strcmp (r->key, key))
-        yes = 1;
-      else
-        yes = 0;
-
-      if (yes)
+      /* Note: To avoid races KEY may not be accessed anymore below.
+       * Note also that we don't update the accessed time for data
+       * items.  */
+      if (r->cache_mode != CACHE_MODE_DATA)
         {
-          /* Note: To avoid races KEY may not be accessed anymore
-           * below.  Note also that we don't update the accessed time
-           * for data items.  */
-          if (r->cache_mode != CACHE_MODE_DATA)
-            r->accessed = gnupg_get_time ();
-          if (DBG_CACHE)
-            log_debug ("... hit\n");
-          if (r->pw->totallen < 32)
-            err = gpg_error (GPG_ERR_INV_LENGTH);
-          else if ((err = init_encryption ()))
-            ;
-          else if (!(value = xtrymalloc_secure (r->pw->totallen - 8)))
-            err = gpg_error_from_syserror ();
-          else
-            {
-              err = gcry_cipher_decrypt (encryption_handle,
-                                         value, r->pw->totallen - 8,
-                                         r->pw->data, r->pw->totallen);
-            }
-          if (err)
-            {
-              xfree (value);
-              value = NULL;
-              log_error ("retrieving cache entry '%s'.%d failed: %s\n",
-                         key, restricted, gpg_strerror (err));
-            }
-          break;
+          r->accessed = gnupg_get_time ();
+          update_expiry (r);
         }
+      if (DBG_CACHE)
+        log_debug ("... hit\n");
+      err = decrypt_data (r->pw, &value);
+      if (err)
+        log_error ("retrieving cache entry '%s'.%d failed: %s\n",
+                   key, restricted, gpg_strerror (err));
     }
   if (DBG_CACHE && value == NULL)
     log_debug ("... miss\n");
+  gnupg_metric_add (gnupg_metric_get (GNUPG_METRIC_COUNTER, "cache_lookups",
+                                      value? "result=\"hit\""
+                                      /**/ : "result=\"miss\""), 1);
 
  out:
   res = npth_mutex_unlock (&cache_lock);
@@ -537,6 +807,119 @@ agent_get_cache (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
 }
 
 
+/* Attach the unprotected secret key SKEY, given as canonical
+ * S-expression, to the item with the passphrase for KEY.  Nothing is
+ * done if there is no such item.  The key is released together with
+ * the passphrase and thus has the same lifetime.  */
+void
+agent_put_cache_key (ctrl_t ctrl, const char *key, cache_mode_t cache_mode,
+                     const unsigned char *skey)
+{
+  gpg_error_t err;
+  ITEM r;
+  int res;
+  int restricted = ctrl? ctrl->restricted : -1;
+  size_t skeylen;
+
+  skeylen = gcry_sexp_canon_len (skey, 0, NULL, NULL);
+  if (!skeylen || cache_mode == CACHE_MODE_IGNORE)
+    return;
+
+  res = npth_mutex_lock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
+  r = find_item (key, cache_mode, restricted);
+  if (r && !r->skey)
+    {
+      if (DBG_CACHE)
+        log_debug ("agent_put_cache_key '%s'.%d (mode %d)\n",
+                   key, restricted, cache_mode);
+      err = new_data (skey, skeylen, &r->skey);
+      if (err)
+        log_error ("error caching the unprotected key: %s\n",
+                   gpg_strerror (err));
+    }
+
+  res = npth_mutex_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+}
+
+
+/* Return the unprotected key attached to the passphrase for KEY as
+ * canonical S-expression in secure memory or NULL if there is
+ * none.  This counts as a use of the passphrase.  */
+unsigned char *
+agent_get_cache_key (ctrl_t ctrl, const char *key, cache_mode_t cache_mode)
+{
+  gpg_error_t err;
+  ITEM r;
+  char *value = NULL;
+  int res;
+  int restricted = ctrl? ctrl->restricted : -1;
+
+  if (cache_mode == CACHE_MODE_IGNORE)
+    return NULL;
+
+  res = npth_mutex_lock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
+  housekeeping ();
+
+  r = find_item (key, cache_mode, restricted);
+  if (r && r->skey)
+    {
+      if (r->cache_mode != CACHE_MODE_DATA)
+        {
+          r->accessed = gnupg_get_time ();
+          update_expiry (r);
+        }
+      err = decrypt_data (r->skey, &value);
+      if (err)
+        log_error ("retrieving cached key '%s'.%d failed: %s\n",
+                   key, restricted, gpg_strerror (err));
+    }
+  if (DBG_CACHE)
+    log_debug ("agent_get_cache_key '%s'.%d (mode %d) ... %s\n",
+               key, restricted, cache_mode, value? "hit" : "miss");
+
+  res = npth_mutex_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+
+  return (unsigned char *)value;
+}
+
+
+/* Release all unprotected keys attached to passphrases for KEY.
+ * This needs to be called when the key file changes.  */
+void
+agent_flush_cache_key (const char *key)
+{
+  ITEM r;
+  int res;
+
+  res = npth_mutex_lock (&cache_lock);
+  if (res)
+    log_fatal ("failed to acquire cache mutex: %s\n", strerror (res));
+
+  for (r = thecache[hash_key (key)]; r; r = r->next)
+    if (r->skey && !strcmp (r->key, key))
+      {
+        if (DBG_CACHE)
+          log_debug ("agent_flush_cache_key '%s'.%d\n", key, r->restricted);
+        release_data (r->skey);
+        r->skey = NULL;
+      }
+
+  res = npth_mutex_unlock (&cache_lock);
+  if (res)
+    log_fatal ("failed to release cache mutex: %s\n", strerror (res));
+}
+
+
 /* Store the key for the last successful cache hit.  That value is
    used by agent_get_cache if the requested KEY is given as NULL.
    NULL may be used to remove that key. */
@@ -161,6 +161,8 @@ wait_child_thread (void *arg)
 #endif /*!HAVE_W32_SYSTEM*/
 
   agent_flush_cache (1);  /* Flush the PIN cache.  */
+  if (type == DAEMON_SCD)
+    bump_card_eventcounter ();  /* The card state is not known anymore.  */
 
   err = npth_mutex_lock (&start_daemon_lock);
   if (err)
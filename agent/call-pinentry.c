@@ -69,6 +69,9 @@ static struct
 /* A mutex used to serialize access to the pinentry. */
 static npth_mutex_t entry_lock;
 
+/* The time the current owner of ENTRY_LOCK started to wait for it.  */
+static unsigned long long entry_start;
+
 /* The thread ID of the popup working thread. */
 static npth_t  popup_tid;
 
@@ -177,6 +180,8 @@ unlock_pinentry (ctrl_t ctrl, gpg_error_t rc)
 
   if (--ctrl->pinentry_active == 0)
     {
+      gnupg_trace_span (ctrl->trace_id, GPG_AGENT_NAME, "pinentry",
+                        entry_start);
       entry_ctx = NULL;
       err = npth_mutex_unlock (&entry_lock);
       if (err)
@@ -301,6 +306,7 @@ start_pinentry (ctrl_t ctrl)
   struct timespec abstime;
   char *flavor_version;
   int err;
+  unsigned long long t0;
 
   if (ctrl->pinentry_active)
     {
@@ -310,6 +316,7 @@ start_pinentry (ctrl_t ctrl)
       return 0;
     }
 
+  t0 = gnupg_metrics_now ();
   npth_clock_gettime (&abstime);
   abstime.tv_sec += LOCK_TIMEOUT;
   err = npth_mutex_timedlock (&entry_lock, &abstime);
@@ -323,6 +330,7 @@ start_pinentry (ctrl_t ctrl)
                  gpg_strerror (rc));
       return rc;
     }
+  entry_start = t0;
 
   if (entry_ctx)
     return 0;
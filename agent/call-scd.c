@@ -94,7 +94,19 @@ struct inq_needpin_parm_s
 static int
 start_scd (ctrl_t ctrl)
 {
-  return daemon_start (DAEMON_SCD, ctrl);
+  int rc;
+  char line[ASSUAN_LINELENGTH];
+
+  rc = daemon_start (DAEMON_SCD, ctrl);
+  if (!rc && *ctrl->trace_id)
+    {
+      /* Pass on the trace id of our client.  Errors are ignored so
+       * that an older scdaemon can still be used.  */
+      snprintf (line, sizeof line, "OPTION trace-id=%s", ctrl->trace_id);
+      assuan_transact (daemon_type_ctx (DAEMON_SCD, ctrl), line,
+                       NULL, NULL, NULL, NULL, NULL, NULL);
+    }
+  return rc;
 }
 
 
@@ -478,6 +490,7 @@ agent_card_pksign (ctrl_t ctrl,
   char line[ASSUAN_LINELENGTH];
   membuf_t data;
   struct inq_needpin_parm_s inqparm;
+  unsigned long long t0;
 
   *r_buf = NULL;
   rc = start_scd (ctrl);
@@ -513,10 +526,13 @@ agent_card_pksign (ctrl_t ctrl,
   else
     snprintf (line, sizeof line, "PKSIGN %s %s",
               hash_algo_option (mdalgo), keyid);
+  t0 = gnupg_metrics_now ();
   rc = assuan_transact (daemon_ctx (ctrl), line,
                         put_membuf_cb, &data,
                         inq_needpin, &inqparm,
                         pincache_put_cb, NULL);
+  gnupg_trace_span (ctrl->trace_id, GPG_AGENT_NAME,
+                    ctrl->use_auth_call? "scd-PKAUTH" : "scd-PKSIGN", t0);
 
   if (rc)
     {
@@ -572,6 +588,7 @@ agent_card_pkdecrypt (ctrl_t ctrl,
   membuf_t data;
   struct inq_needpin_parm_s inqparm;
   size_t len;
+  unsigned long long t0;
 
   *r_buf = NULL;
   *r_padding = -1; /* Unknown.  */
@@ -606,10 +623,12 @@ agent_card_pkdecrypt (ctrl_t ctrl,
   inqparm.keydata = NULL;
   inqparm.keydatalen = 0;
   snprintf (line, DIM(line), "PKDECRYPT %s", keyid);
+  t0 = gnupg_metrics_now ();
   rc = assuan_transact (daemon_ctx (ctrl), line,
                         put_membuf_cb, &data,
                         inq_needpin, &inqparm,
                         padding_info_cb, r_padding);
+  gnupg_trace_span (ctrl->trace_id, GPG_AGENT_NAME, "scd-PKDECRYPT", t0);
 
   if (rc)
     {
@@ -227,6 +227,43 @@ struct ssh_control_file_s
 };
 
 
+/* An item of the in-memory copy of the sshcontrol file.  */
+struct control_index_item_s
+{
+  int lnr;             /* The line number of the item.  */
+  int disabled;        /* The item is disabled.  */
+  int ttl;             /* The TTL of the item.   */
+  int confirm;         /* The confirm flag is set.  */
+  char hexgrip[40+1];  /* The hexgrip of the item (uppercase).  */
+
+  /* The identity of the key as sent by request_identities; i.e. the
+     key blob and the comment in the wire format.  This is only valid
+     as long as the key file has the modification time KEY_MTIME and
+     the size KEY_SIZE.  NULL if not yet known.  */
+  void *ident;
+  size_t identlen;
+  time_t key_mtime;
+  off_t key_size;
+};
+
+/* The in-memory copy of the sshcontrol file.  Parsing the file is
+   only done again if its modification time or size changes.  The
+   object is reference counted because a connection may be
+   interrupted while using it and another connection may meanwhile
+   load a new version.  */
+struct control_index_s
+{
+  unsigned int refcount;
+  char *fname;    /* The name of the file.  */
+  time_t mtime;   /* The modification time of the file.  */
+  off_t size;     /* The size of the file.  */
+  int nitems;     /* The number of items.  */
+  struct control_index_item_s *items;   /* The items in file order.  */
+  struct control_index_item_s **sorted; /* Sorted by hexgrip.  */
+};
+typedef struct control_index_s *control_index_t;
+
+
 /* Prototypes.  */
 static gpg_error_t ssh_handler_request_identities (ctrl_t ctrl,
 						   estream_t request,
@@ -369,6 +406,26 @@ static const ssh_key_type_spec_t ssh_key_types[] =
     }
   };
 
+
+/* The current in-memory copy of the sshcontrol file or NULL.  */
+static control_index_t the_control_index;
+
+/* The SSH blobs of the card keys as sent by the last request for the
+ * identities along with the card event counters at the time of the
+ * scan.  As long as the counters do not change no card has been
+ * inserted or removed and we can skip the round-trips to scdaemon.
+ * This relies on scdaemon's event signal; thus it is only used in
+ * server mode.  */
+static struct
+{
+  int valid;
+  unsigned int card;
+  unsigned int maybe_key_change;
+  u32 count;      /* The number of keys in BLOBS.  */
+  void *blobs;
+  size_t blobslen;
+} card_keys_cache;
+
 
 
 
@@ -1060,6 +1117,226 @@ search_control_file (ssh_control_file_t cf, const char *hexgrip,
 
 
 
+/* Release a reference to the control index CI.  */
+static void
+release_control_index (control_index_t ci)
+{
+  int i;
+
+  if (!ci)
+    return;
+  log_assert (ci->refcount);
+  if (--ci->refcount)
+    return;
+  for (i=0; i < ci->nitems; i++)
+    xfree (ci->items[i].ident);
+  xfree (ci->items);
+  xfree (ci->sorted);
+  xfree (ci->fname);
+  xfree (ci);
+}
+
+
+/* Forget the current control index so that the next lookup reads
+   the file again.  */
+static void
+flush_control_index (void)
+{
+  release_control_index (the_control_index);
+  the_control_index = NULL;
+}
+
+
+/* qsort helper to sort the items by hexgrip; items with the same
+   hexgrip are kept in file order.  */
+static int
+compare_control_index_items (const void *a_arg, const void *b_arg)
+{
+  const struct control_index_item_s *a, *b;
+  int cmp;
+
+  a = *(const struct control_index_item_s **)a_arg;
+  b = *(const struct control_index_item_s **)b_arg;
+  cmp = strcmp (a->hexgrip, b->hexgrip);
+  if (!cmp)
+    cmp = a->lnr - b->lnr;
+  return cmp;
+}
+
+
+/* Return the first item of the control index CI with HEXGRIP or NULL
+   if there is no such item.  */
+static struct control_index_item_s *
+find_control_index_item (control_index_t ci, const char *hexgrip)
+{
+  int lo, hi, mid, cmp;
+  struct control_index_item_s *found = NULL;
+
+  lo = 0;
+  hi = ci->nitems - 1;
+  while (lo <= hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      cmp = strcmp (hexgrip, ci->sorted[mid]->hexgrip);
+      if (cmp < 0)
+        hi = mid - 1;
+      else if (cmp > 0)
+        lo = mid + 1;
+      else
+        {
+          found = ci->sorted[mid];
+          hi = mid - 1;  /* Look for an earlier one.  */
+        }
+    }
+  return found;
+}
+
+
+/* Parse the control file into a new control index.  As with a
+   sequential scan of the file, parsing stops at the first invalid
+   line.  The identities cached in the control index OLD are taken
+   over.  */
+static gpg_error_t
+load_control_index (control_index_t old, control_index_t *r_ci)
+{
+  gpg_error_t err;
+  ssh_control_file_t cf;
+  control_index_t ci;
+  struct control_index_item_s *item, *olditem;
+  struct stat st;
+  int i, nalloced;
+
+  *r_ci = NULL;
+
+  err = open_control_file (&cf, 0);
+  if (err)
+    return err;
+
+  ci = xtrycalloc (1, sizeof *ci);
+  if (!ci)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  ci->refcount = 1;
+  ci->fname = xtrystrdup (cf->fname);
+  if (!ci->fname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  /* Take the file's state before reading so that a concurrent change
+     leads to another reload.  */
+  if (fstat (fileno (cf->fp), &st))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  ci->mtime = st.st_mtime;
+  ci->size = st.st_size;
+
+  nalloced = 0;
+  while (!read_control_file_item (cf))
+    {
+      if (!cf->item.valid)
+        continue; /* Should not happen.  */
+      if (ci->nitems == nalloced)
+        {
+          nalloced = nalloced? nalloced * 2 : 16;
+          item = xtryreallocarray (ci->items, ci->nitems, nalloced,
+                                   sizeof *item);
+          if (!item)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+          ci->items = item;
+        }
+      item = ci->items + ci->nitems++;
+      memset (item, 0, sizeof *item);
+      item->lnr = cf->lnr;
+      item->disabled = cf->item.disabled;
+      item->ttl = cf->item.ttl;
+      item->confirm = cf->item.confirm;
+      strcpy (item->hexgrip, cf->item.hexgrip);
+    }
+
+  if (ci->nitems)
+    {
+      ci->sorted = xtrycalloc (ci->nitems, sizeof *ci->sorted);
+      if (!ci->sorted)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      for (i=0; i < ci->nitems; i++)
+        ci->sorted[i] = ci->items + i;
+      qsort (ci->sorted, ci->nitems, sizeof *ci->sorted,
+             compare_control_index_items);
+    }
+
+  for (i=0; old && i < ci->nitems; i++)
+    {
+      item = ci->items + i;
+      olditem = find_control_index_item (old, item->hexgrip);
+      if (!olditem || !olditem->ident)
+        continue;
+      item->ident = xtrymalloc (olditem->identlen);
+      if (!item->ident)
+        continue; /* Not important.  */
+      memcpy (item->ident, olditem->ident, olditem->identlen);
+      item->identlen = olditem->identlen;
+      item->key_mtime = olditem->key_mtime;
+      item->key_size = olditem->key_size;
+    }
+
+ leave:
+  close_control_file (cf);
+  if (err)
+    release_control_index (ci);
+  else
+    *r_ci = ci;
+  return err;
+}
+
+
+/* Return a reference to the current control index at R_CI.  The
+   file is parsed again only if it has been changed.  The caller
+   needs to release the index using release_control_index.  */
+static gpg_error_t
+get_control_index (control_index_t *r_ci)
+{
+  gpg_error_t err;
+  control_index_t ci = the_control_index;
+  struct stat st;
+
+  *r_ci = NULL;
+
+  if (ci && !stat (ci->fname, &st)
+      && st.st_mtime == ci->mtime && st.st_size == ci->size)
+    {
+      ci->refcount++;
+      *r_ci = ci;
+      return 0;
+    }
+
+  /* Keep the old index while loading; another connection may replace
+     THE_CONTROL_INDEX meanwhile.  */
+  if (ci)
+    ci->refcount++;
+  err = load_control_index (ci, r_ci);
+  release_control_index (ci);
+  if (err)
+    return err;
+
+  flush_control_index ();
+  the_control_index = *r_ci;
+  the_control_index->refcount++;
+  return 0;
+}
+
+
 /* Add an entry to the control file to mark the key with the keygrip
    HEXGRIP as usable for SSH; i.e. it will be returned when ssh asks
    for it.  FMTFPR is the fingerprint string.  This function is in
@@ -1108,7 +1385,8 @@ add_control_entry (ctrl_t ctrl, ssh_key_type_spec_t *spec,
                1900+tp->tm_year, tp->tm_mon+1, tp->tm_mday,
                tp->tm_hour, tp->tm_min, tp->tm_sec,
                fpr_md5, fpr_sha256, hexgrip, ttl, confirm? " confirm":"");
-
+      /* The mtime might not change within the same second.  */
+      flush_control_index ();
     }
  out:
   xfree (fpr_md5);
@@ -1118,48 +1396,54 @@ add_control_entry (ctrl_t ctrl, ssh_key_type_spec_t *spec,
 }
 
 
-/* Scan the sshcontrol file and return the TTL.  */
+/* Look up the sshcontrol file and return the TTL.  */
 static int
 ttl_from_sshcontrol (const char *hexgrip)
 {
-  ssh_control_file_t cf;
-  int disabled, ttl;
+  control_index_t ci;
+  struct control_index_item_s *item;
+  int ttl;
 
   if (!hexgrip || strlen (hexgrip) != 40)
     return 0;  /* Wrong input: Use global default.  */
 
-  if (open_control_file (&cf, 0))
+  if (get_control_index (&ci))
     return 0; /* Error: Use the global default TTL.  */
 
-  if (search_control_file (cf, hexgrip, &disabled, &ttl, NULL)
-      || disabled)
+  item = find_control_index_item (ci, hexgrip);
+  if (!item || item->disabled)
     ttl = 0;  /* Use the global default if not found or disabled.  */
+  else
+    ttl = item->ttl;
 
-  close_control_file (cf);
+  release_control_index (ci);
 
   return ttl;
 }
 
 
-/* Scan the sshcontrol file and return the confirm flag.  */
+/* Look up the sshcontrol file and return the confirm flag.  */
 static int
 confirm_flag_from_sshcontrol (const char *hexgrip)
 {
-  ssh_control_file_t cf;
-  int disabled, confirm;
+  control_index_t ci;
+  struct control_index_item_s *item;
+  int confirm;
 
   if (!hexgrip || strlen (hexgrip) != 40)
     return 1;  /* Wrong input: Better ask for confirmation.  */
 
-  if (open_control_file (&cf, 0))
+  if (get_control_index (&ci))
     return 1; /* Error: Better ask for confirmation.  */
 
-  if (search_control_file (cf, hexgrip, &disabled, NULL, &confirm)
-      || disabled)
+  item = find_control_index_item (ci, hexgrip);
+  if (!item || item->disabled)
     confirm = 0;  /* If not found or disabled, there is no reason to
                      ask for confirmation.  */
+  else
+    confirm = item->confirm;
 
-  close_control_file (cf);
+  release_control_index (ci);
 
   return confirm;
 }
@@ -2436,6 +2720,133 @@ card_key_available (ctrl_t ctrl, const struct card_key_info_s *keyinfo,
 
 
 
+/* Scan the cards for authentication keys and store their SSH blobs
+   at R_BLOBS and their number at R_COUNT.  The caller must release
+   R_BLOBS using es_free.  */
+static gpg_error_t
+scan_card_keys (ctrl_t ctrl, void **r_blobs, size_t *r_blobslen,
+                u32 *r_count)
+{
+  gpg_error_t err;
+  char *serialno;
+  struct card_key_info_s *keyinfo_list;
+  struct card_key_info_s *keyinfo;
+  gcry_sexp_t key_public;
+  estream_t blobs;
+  u32 count = 0;
+
+  *r_blobs = NULL;
+  *r_blobslen = 0;
+  *r_count = 0;
+
+  /* Scan device(s), and get list of KEYGRIP.  */
+  err = agent_card_serialno (ctrl, &serialno, NULL);
+  if (err)
+    return err;
+  xfree (serialno);
+  err = agent_card_keyinfo (ctrl, NULL, GCRY_PK_USAGE_AUTH, &keyinfo_list);
+  if (err)
+    return err;
+
+  blobs = es_fopenmem (0, "w+b");
+  if (!blobs)
+    {
+      err = gpg_error_from_syserror ();
+      agent_card_free_keyinfo (keyinfo_list);
+      return err;
+    }
+
+  for (keyinfo = keyinfo_list; keyinfo; keyinfo = keyinfo->next)
+    {
+      char *cardsn;
+
+      if (card_key_available (ctrl, keyinfo, &key_public, &cardsn))
+        continue;
+
+      err = ssh_send_key_public (blobs, key_public, cardsn);
+      if (err && opt.verbose)
+        gcry_log_debugsxp ("pubkey", key_public);
+      gcry_sexp_release (key_public);
+      xfree (cardsn);
+      if (err)
+        {
+          agent_card_free_keyinfo (keyinfo_list);
+          es_fclose (blobs);
+          return err;
+        }
+
+      count++;
+    }
+  agent_card_free_keyinfo (keyinfo_list);
+
+  if (es_fclose_snatch (blobs, r_blobs, r_blobslen))
+    return gpg_error_from_syserror ();
+  *r_count = count;
+  return 0;
+}
+
+
+/* Write the SSH blobs of the card keys to STREAM and add their number
+   to R_COUNT.  Errors accessing the cards are not returned because we
+   want to list the keys from sshcontrol anyway.  */
+static gpg_error_t
+send_card_keys (ctrl_t ctrl, estream_t stream, u32 *r_count)
+{
+  gpg_error_t err;
+  unsigned int card, maybe_key_change;
+  void *blobs;
+  size_t blobslen;
+  u32 count;
+
+  get_card_eventcounters (&card, &maybe_key_change);
+  if (opt.sigusr2_enabled && card_keys_cache.valid
+      && card_keys_cache.card == card
+      && card_keys_cache.maybe_key_change == maybe_key_change)
+    {
+      if (DBG_IPC)
+        log_debug ("ssh: using cached card keys\n");
+      if (card_keys_cache.blobslen
+          && es_write (stream, card_keys_cache.blobs,
+                       card_keys_cache.blobslen, NULL))
+        return gpg_error_from_syserror ();
+      *r_count += card_keys_cache.count;
+      return 0;
+    }
+
+  err = scan_card_keys (ctrl, &blobs, &blobslen, &count);
+  if (err)
+    {
+      if (opt.verbose)
+        log_info (_("error getting list of cards: %s\n"),
+                  gpg_strerror (err));
+      return 0;
+    }
+
+  if (blobslen && es_write (stream, blobs, blobslen, NULL))
+    {
+      err = gpg_error_from_syserror ();
+      es_free (blobs);
+      return err;
+    }
+  *r_count += count;
+
+  /* We store the counters from before the scan so that a change
+   * while we were talking to scdaemon leads to a new scan.  Only
+   * successful scans are cached because a missing card or reader
+   * does not necessarily lead to an event.  */
+  es_free (card_keys_cache.blobs);
+  card_keys_cache.blobs = blobs;
+  card_keys_cache.blobslen = blobslen;
+  card_keys_cache.count = count;
+  card_keys_cache.card = card;
+  card_keys_cache.maybe_key_change = maybe_key_change;
+  card_keys_cache.valid = 1;
+  return 0;
+}
+
+
+
+
 /*
 
   Request handler.  Each handler is provided with a CTRL context, a
@@ -2445,6 +2856,89 @@ card_key_available (ctrl_t ctrl, const struct card_key_info_s *keyinfo,
 */
 
 
+/* Make sure that the control index ITEM has the identity of its key
+   cached.  If the key can't be read, the reason is stored at
+   R_KEYERR and 0 is returned.  */
+static gpg_error_t
+update_control_index_ident (ctrl_t ctrl, struct control_index_item_s *item,
+                            gpg_error_t *r_keyerr)
+{
+  gpg_error_t err;
+  char hexgrip[40+4+1];
+  unsigned char grip[20];
+  char *fname;
+  struct stat st;
+  int have_st;
+  gcry_sexp_t key_public = NULL;
+  estream_t stream = NULL;
+  void *ident;
+  size_t identlen;
+
+  *r_keyerr = 0;
+
+  strcpy (hexgrip, item->hexgrip);
+  strcpy (hexgrip+40, ".key");
+  fname = make_filename_try (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
+                             hexgrip, NULL);
+  if (!fname)
+    return gpg_error_from_syserror ();
+  have_st = !stat (fname, &st);
+  xfree (fname);
+
+  if (have_st && item->ident
+      && st.st_mtime == item->key_mtime && st.st_size == item->key_size)
+    return 0;  /* The cached identity is still valid.  */
+
+  log_assert (strlen (item->hexgrip) == 40);
+  hex2bin (item->hexgrip, grip, sizeof (grip));
+  err = agent_public_key_from_file (ctrl, grip, &key_public);
+  if (err)
+    {
+      *r_keyerr = err;
+      return 0;
+    }
+
+  stream = es_fopenmem (0, "r+b");
+  if (!stream)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  err = ssh_send_key_public (stream, key_public, NULL);
+  if (err)
+    goto leave;
+  if (es_fclose_snatch (stream, &ident, &identlen))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  stream = NULL;
+
+  /* Store it in the standard heap so that release_control_index does
+     not need to know about es_free.  */
+  xfree (item->ident);
+  item->ident = xtrymalloc (identlen);
+  if (!item->ident)
+    {
+      err = gpg_error_from_syserror ();
+      es_free (ident);
+      goto leave;
+    }
+  memcpy (item->ident, ident, identlen);
+  item->identlen = identlen;
+  es_free (ident);
+  /* Without the file's state we can't tell whether the key has been
+     changed; thus use it only this time.  */
+  item->key_mtime = have_st? st.st_mtime : (time_t)(-1);
+  item->key_size  = have_st? st.st_size : (off_t)(-1);
+
+ leave:
+  es_fclose (stream);
+  gcry_sexp_release (key_public);
+  return err;
+}
+
+
 /* Handler for the "request_identities" command.  */
 static gpg_error_t
 ssh_handler_request_identities (ctrl_t ctrl,
@@ -2452,17 +2946,16 @@ ssh_handler_request_identities (ctrl_t ctrl,
 {
   u32 key_counter;
   estream_t key_blobs;
-  gcry_sexp_t key_public;
-  gpg_error_t err;
-  int ret;
-  ssh_control_file_t cf = NULL;
+  gpg_error_t err, keyerr;
+  int ret, i;
+  control_index_t ci = NULL;
+  struct control_index_item_s *item;
   gpg_error_t ret_err;
 
   (void)request;
 
   /* Prepare buffer stream.  */
 
-  key_public = NULL;
   key_counter = 0;
 
   key_blobs = es_fopenmem (0, "r+b");
@@ -2478,83 +2971,38 @@ ssh_handler_request_identities (ctrl_t ctrl,
 
   if (!opt.disable_daemon[DAEMON_SCD])
     {
-      char *serialno;
-      struct card_key_info_s *keyinfo_list;
-      struct card_key_info_s *keyinfo;
-
-      /* Scan device(s), and get list of KEYGRIP.  */
-      err = agent_card_serialno (ctrl, &serialno, NULL);
-      if (!err)
-        {
-          xfree (serialno);
-          err = agent_card_keyinfo (ctrl, NULL, GCRY_PK_USAGE_AUTH,
-                                    &keyinfo_list);
-        }
-
+      err = send_card_keys (ctrl, key_blobs, &key_counter);
       if (err)
-        {
-          if (opt.verbose)
-            log_info (_("error getting list of cards: %s\n"),
-                      gpg_strerror (err));
-          goto scd_out;
-        }
-
-      for (keyinfo = keyinfo_list; keyinfo; keyinfo = keyinfo->next)
-        {
-          char *cardsn;
-
-          if (card_key_available (ctrl, keyinfo, &key_public, &cardsn))
-            continue;
-
-          err = ssh_send_key_public (key_blobs, key_public, cardsn);
-          if (err && opt.verbose)
-            gcry_log_debugsxp ("pubkey", key_public);
-          gcry_sexp_release (key_public);
-          key_public = NULL;
-          xfree (cardsn);
-          if (err)
-            {
-              agent_card_free_keyinfo (keyinfo_list);
-              goto out;
-            }
-
-          key_counter++;
-        }
-
-      agent_card_free_keyinfo (keyinfo_list);
+        goto out;
     }
 
- scd_out:
   /* Then look at all the registered and non-disabled keys. */
-  err = open_control_file (&cf, 0);
+  err = get_control_index (&ci);
   if (err)
     goto out;
 
-  while (!read_control_file_item (cf))
+  for (i=0; i < ci->nitems; i++)
     {
-      unsigned char grip[20];
-
-      if (!cf->item.valid)
-        continue; /* Should not happen.  */
-      if (cf->item.disabled)
+      item = ci->items + i;
+      if (item->disabled)
         continue;
-      log_assert (strlen (cf->item.hexgrip) == 40);
-      hex2bin (cf->item.hexgrip, grip, sizeof (grip));
 
-      err = agent_public_key_from_file (ctrl, grip, &key_public);
+      err = update_control_index_ident (ctrl, item, &keyerr);
       if (err)
+        goto out;
+      if (keyerr)
         {
           log_error ("%s:%d: key '%s' skipped: %s\n",
-                     cf->fname, cf->lnr, cf->item.hexgrip,
-                     gpg_strerror (err));
+                     ci->fname, item->lnr, item->hexgrip,
+                     gpg_strerror (keyerr));
           continue;
         }
 
-      err = ssh_send_key_public (key_blobs, key_public, NULL);
-      if (err)
-        goto out;
-      gcry_sexp_release (key_public);
-      key_public = NULL;
+      if (es_write (key_blobs, item->ident, item->identlen, NULL))
+        {
+          err = gpg_error_from_syserror ();
+          goto out;
+        }
 
       key_counter++;
     }
@@ -2570,8 +3018,6 @@ ssh_handler_request_identities (ctrl_t ctrl,
  out:
   /* Send response.  */
 
-  gcry_sexp_release (key_public);
-
   if (!err)
     {
       ret_err = stream_write_byte (response, SSH_RESPONSE_IDENTITIES_ANSWER);
@@ -2588,7 +3034,7 @@ ssh_handler_request_identities (ctrl_t ctrl,
     }
 
   es_fclose (key_blobs);
-  close_control_file (cf);
+  release_control_index (ci);
 
   return ret_err;
 }
@@ -3346,6 +3792,8 @@ ssh_request_process (ctrl_t ctrl, estream_t stream_sock)
   unsigned char *request_data = NULL;
   u32 request_data_size;
   u32 response_size;
+  void *response_data = NULL;
+  size_t response_len;
 
   /* Create memory streams for request/response data.  The entire
      request will be stored in secure memory, since it might contain
@@ -3410,6 +3858,11 @@ ssh_request_process (ctrl_t ctrl, estream_t stream_sock)
       err = gpg_error_from_syserror ();
       goto out;
     }
+  /* Reserve space for the length so that we can send the entire
+     response with one write; the socket stream is not buffered.  */
+  err = stream_write_uint32 (response, 0);
+  if (err)
+    goto out;
 
   if (opt.verbose)
     log_info ("ssh request handler for %s (%u) started\n",
@@ -3433,7 +3886,7 @@ ssh_request_process (ctrl_t ctrl, estream_t stream_sock)
       goto out;
     }
 
-  response_size = es_ftell (response);
+  response_size = es_ftell (response) - 4;
   if (opt.verbose > 1)
     log_info ("sending ssh response of length %u\n",
               (unsigned int)response_size);
@@ -3445,14 +3898,22 @@ ssh_request_process (ctrl_t ctrl, estream_t stream_sock)
       goto out;
     }
 
-  err = stream_write_uint32 (stream_sock, response_size);
+  err = stream_write_uint32 (response, response_size);
   if (err)
     {
       send_err = 1;
       goto out;
     }
 
-  err = stream_copy (stream_sock, response);
+  if (es_fclose_snatch (response, &response_data, &response_len))
+    {
+      err = gpg_error_from_syserror ();
+      send_err = 1;
+      goto out;
+    }
+  response = NULL;
+
+  err = stream_write_data (stream_sock, response_data, response_len);
   if (err)
     goto out;
 
@@ -3468,12 +3929,12 @@ ssh_request_process (ctrl_t ctrl, estream_t stream_sock)
 
   if (send_err)
     {
+      static const unsigned char failure[5] =
+        { 0, 0, 0, 1, SSH_RESPONSE_FAILURE };
+
       if (opt.verbose > 1)
         log_info ("sending ssh error response\n");
-      err = stream_write_uint32 (stream_sock, 1);
-      if (err)
-	goto leave;
-      err = stream_write_byte (stream_sock, SSH_RESPONSE_FAILURE);
+      err = stream_write_data (stream_sock, failure, sizeof failure);
       if (err)
 	goto leave;
     }
@@ -3482,6 +3943,7 @@ ssh_request_process (ctrl_t ctrl, estream_t stream_sock)
 
   es_fclose (request);
   es_fclose (response);
+  es_free (response_data);
   xfree (request_data);
 
   return !!err;
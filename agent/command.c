@@ -41,6 +41,7 @@
 #include "../common/ssh-utils.h"
 #include "../common/asshelp.h"
 #include "../common/server-help.h"
+#include "../common/metrics.h"
 
 
 /* Maximum allowed size of the inquired ciphertext.  */
@@ -51,6 +52,10 @@
 #define MAXLEN_KEYDATA 8192
 /* Maximum length of a secret to store under one key.  */
 #define MAXLEN_PUT_SECRET 4096
+/* Maximum allowed size of the hash values inquired by PKSIGN --multi.  */
+#define MAXLEN_MULTI_HASHES (64*1024)
+/* Maximum allowed size of the keygrips inquired by PKDECRYPT --multi.  */
+#define MAXLEN_MULTI_KEYGRIPS (256*41)
 /* The size of the import/export KEK key (in bytes).  */
 #define KEYWRAP_KEYSIZE (128/8)
 
@@ -94,6 +99,9 @@ struct server_local_s
   /* Flag indicating whether pinentry notifications shall be done. */
   unsigned int allow_pinentry_notify : 1;
 
+  /* The time the current command started for the metrics.  */
+  unsigned long long cmd_start;
+
   /* An allocated description for the next key operation.  This is
      used if a pinnetry needs to be popped up.  */
   char *keydesc;
@@ -495,6 +503,18 @@ bump_card_eventcounter (void)
 }
 
 
+/* Store the counters which indicate a change of the cards at R_CARD
+ * and R_MAYBE_KEY_CHANGE.  This function is assured not to do any
+ * context switches.  */
+void
+get_card_eventcounters (unsigned int *r_card,
+                        unsigned int *r_maybe_key_change)
+{
+  *r_card = eventcounter.card;
+  *r_maybe_key_change = eventcounter.maybe_key_change;
+}
+
+
 
 
 static const char hlp_istrusted[] =
@@ -837,10 +857,16 @@ cmd_sethash (assuan_context_t ctx, char *line)
 
 
 static const char hlp_pksign[] =
-  "PKSIGN [<options>] [<cache_nonce>]\n"
+  "PKSIGN [--multi] [<cache_nonce>]\n"
   "\n"
   "Perform the actual sign operation.  Neither input nor output are\n"
-  "sensitive to eavesdropping.";
+  "sensitive to eavesdropping.\n"
+  "\n"
+  "With --multi the hash value given by SETHASH is not signed but\n"
+  "only its algorithm and length are used.  The server then inquires\n"
+  "HASHES which are the concatenated hash values to sign with the\n"
+  "same key.  The returned data are the concatenated signatures,\n"
+  "each a canonical S-expression.";
 static gpg_error_t
 cmd_pksign (assuan_context_t ctx, char *line)
 {
@@ -850,7 +876,11 @@ cmd_pksign (assuan_context_t ctx, char *line)
   membuf_t outbuf;
   char *cache_nonce = NULL;
   char *p;
+  int opt_multi;
+  unsigned char *digests = NULL;
+  size_t digestslen = 0;
 
+  opt_multi = has_option (line, "--multi");
   line = skip_options (line);
 
   for (p=line; *p && *p != ' ' && *p != '\t'; p++)
@@ -864,15 +894,44 @@ cmd_pksign (assuan_context_t ctx, char *line)
   else if (!ctrl->server_local->use_cache_for_signing)
     cache_mode = CACHE_MODE_IGNORE;
 
+  if (opt_multi)
+    {
+      if (ctrl->digest.data || !ctrl->digest.valuelen)
+        {
+          err = set_error (GPG_ERR_ASS_PARAMETER,
+                           "--multi requires a hash value set by SETHASH");
+          goto leave;
+        }
+      err = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u",
+                                 MAXLEN_MULTI_HASHES);
+      if (!err)
+        err = assuan_inquire (ctx, "HASHES", &digests, &digestslen,
+                              MAXLEN_MULTI_HASHES);
+      if (err)
+        goto leave;
+      if (!digestslen || (digestslen % ctrl->digest.valuelen))
+        {
+          err = set_error (GPG_ERR_ASS_PARAMETER, "invalid length of hashes");
+          goto leave;
+        }
+    }
+
   init_membuf (&outbuf, 512);
 
-  err = agent_pksign (ctrl, cache_nonce, ctrl->server_local->keydesc,
-                      &outbuf, cache_mode);
+  if (opt_multi)
+    err = agent_pksign_multi (ctrl, cache_nonce, ctrl->server_local->keydesc,
+                              digests, digestslen / ctrl->digest.valuelen,
+                              &outbuf, cache_mode);
+  else
+    err = agent_pksign (ctrl, cache_nonce, ctrl->server_local->keydesc,
+                        &outbuf, cache_mode);
   if (err)
     clear_outbuf (&outbuf);
   else
     err = write_and_clear_outbuf (ctx, &outbuf);
 
+ leave:
+  xfree (digests);
   xfree (cache_nonce);
   xfree (ctrl->server_local->keydesc);
   ctrl->server_local->keydesc = NULL;
@@ -880,11 +939,68 @@ cmd_pksign (assuan_context_t ctx, char *line)
 }
 
 
+/* Parse the hex encoded keygrips delimited by white space in STRING
+ * of LENGTH and store them concatenated in a new buffer at R_GRIPS and their
+ * number at R_NGRIPS.  */
+static gpg_error_t
+parse_keygrip_list (assuan_context_t ctx, const char *string, size_t length,
+                    unsigned char **r_grips, size_t *r_ngrips)
+{
+  unsigned char *grips;
+  size_t ngrips = 0;
+  const char *s, *end;
+
+  *r_grips = NULL;
+  *r_ngrips = 0;
+
+  grips = xtrymalloc (length / (2*KEYGRIP_LEN) * KEYGRIP_LEN + 1);
+  if (!grips)
+    return gpg_error_from_syserror ();
+
+  for (s = string, end = string + length; s < end; )
+    {
+      if (spacep (s) || *s == '\n' || *s == '\r')
+        {
+          s++;
+          continue;
+        }
+      if (end - s < 2*KEYGRIP_LEN
+          || hex2bin (s, grips + ngrips * KEYGRIP_LEN, KEYGRIP_LEN) < 0
+          || (end - s > 2*KEYGRIP_LEN
+              && !spacep (s + 2*KEYGRIP_LEN)
+              && s[2*KEYGRIP_LEN] != '\n' && s[2*KEYGRIP_LEN] != '\r'))
+        {
+          xfree (grips);
+          return set_error (GPG_ERR_ASS_PARAMETER, "invalid keygrip");
+        }
+      s += 2*KEYGRIP_LEN;
+      ngrips++;
+    }
+  if (!ngrips)
+    {
+      xfree (grips);
+      return set_error (GPG_ERR_ASS_PARAMETER, "no keygrips given");
+    }
+
+  *r_grips = grips;
+  *r_ngrips = ngrips;
+  return 0;
+}
+
+
 static const char hlp_pkdecrypt[] =
-  "PKDECRYPT [<options>]\n"
+  "PKDECRYPT [--multi]\n"
   "\n"
   "Perform the actual decrypt operation.  Input is not\n"
-  "sensitive to eavesdropping.";
+  "sensitive to eavesdropping.\n"
+  "\n"
+  "With --multi the key set by SETKEY is not used.  The server\n"
+  "inquires KEYGRIPS which is a list of keygrips delimited by white\n"
+  "space and tries those keys which can be used without a pinentry\n"
+  "in the given order.  The keygrip of the first key which decrypted\n"
+  "the ciphertext is returned with the status line\n"
+  "\"KEYGRIP <hexstring_with_keygrip>\".  If none of the keys could\n"
+  "be used the error code is GPG_ERR_NO_SECKEY.";
 static gpg_error_t
 cmd_pkdecrypt (assuan_context_t ctx, char *line)
 {
@@ -894,8 +1010,30 @@ cmd_pkdecrypt (assuan_context_t ctx, char *line)
   size_t valuelen;
   membuf_t outbuf;
   int padding;
+  int opt_multi;
+  unsigned char *grips = NULL;
+  size_t ngrips = 0;
+  size_t idx;
 
-  (void)line;
+  opt_multi = has_option (line, "--multi");
+
+  if (opt_multi)
+    {
+      unsigned char *list;
+      size_t listlen;
+
+      rc = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u",
+                                MAXLEN_MULTI_KEYGRIPS);
+      if (!rc)
+        rc = assuan_inquire (ctx, "KEYGRIPS", &list, &listlen,
+                             MAXLEN_MULTI_KEYGRIPS);
+      if (rc)
+        return rc;
+      rc = parse_keygrip_list (ctx, (char*)list, listlen, &grips, &ngrips);
+      xfree (list);
+      if (rc)
+        return leave_cmd (ctx, rc);
+    }
 
   /* First inquire the data to decrypt */
   rc = print_assuan_status (ctx, "INQUIRE_MAXLEN", "%u", MAXLEN_CIPHERTEXT);
@@ -903,24 +1041,39 @@ cmd_pkdecrypt (assuan_context_t ctx, char *line)
     rc = assuan_inquire (ctx, "CIPHERTEXT",
 			&value, &valuelen, MAXLEN_CIPHERTEXT);
   if (rc)
-    return rc;
+    {
+      xfree (grips);
+      return rc;
+    }
 
   init_membuf (&outbuf, 512);
 
-  rc = agent_pkdecrypt (ctrl, ctrl->server_local->keydesc,
-                        value, valuelen, &outbuf, &padding);
+  if (opt_multi)
+    rc = agent_pkdecrypt_multi (ctrl, grips, ngrips, value, valuelen,
+                                &outbuf, &padding, &idx);
+  else
+    rc = agent_pkdecrypt (ctrl, ctrl->server_local->keydesc,
+                          value, valuelen, &outbuf, &padding);
   xfree (value);
   if (rc)
     clear_outbuf (&outbuf);
   else
     {
-      if (padding != -1)
+      if (opt_multi)
+        {
+          char hexgrip[2*KEYGRIP_LEN+1];
+
+          bin2hex (grips + idx * KEYGRIP_LEN, KEYGRIP_LEN, hexgrip);
+          rc = print_assuan_status (ctx, "KEYGRIP", "%s", hexgrip);
+        }
+      if (!rc && padding != -1)
         rc = print_assuan_status (ctx, "PADDING", "%d", padding);
-      else
-        rc = 0;
       if (!rc)
         rc = write_and_clear_outbuf (ctx, &outbuf);
+      if (rc)
+        clear_outbuf (&outbuf);
     }
+  xfree (grips);
   xfree (ctrl->server_local->keydesc);
   ctrl->server_local->keydesc = NULL;
   return leave_cmd (ctx, rc);
@@ -929,7 +1082,7 @@ cmd_pkdecrypt (assuan_context_t ctx, char *line)
 
 static const char hlp_genkey[] =
   "GENKEY [--no-protection] [--preset] [--timestamp=<isodate>]\n"
-  "       [--inq-passwd] [--passwd-nonce=<s>] [<cache_nonce>]\n"
+  "       [--inq-passwd] [--passwd-nonce=<s>] [--pregen] [<cache_nonce>]\n"
   "\n"
   "Generate a new key, store the secret part and return the public\n"
   "part.  Here is an example transaction:\n"
@@ -948,7 +1101,12 @@ static const char hlp_genkey[] =
   "new key.  If a --passwd-nonce is used, the corresponding cached\n"
   "passphrase is used to protect the new key.  If --timestamp is given\n"
   "its value is recorded as the key's creation time; the value is\n"
-  "expected in ISO format (e.g. \"20030316T120000\").";
+  "expected in ISO format (e.g. \"20030316T120000\").\n"
+  "\n"
+  "With --pregen only the KEYPARAM is inquired and a key with these\n"
+  "parameters is generated in the background; a later GENKEY with the\n"
+  "same parameters will then return faster.  Nothing is returned and\n"
+  "no key is stored.";
 static gpg_error_t
 cmd_genkey (assuan_context_t ctx, char *line)
 {
@@ -963,6 +1121,7 @@ cmd_genkey (assuan_context_t ctx, char *line)
   char *passwd_nonce = NULL;
   int opt_preset;
   int opt_inq_passwd;
+  int opt_pregen;
   size_t n;
   char *p, *pend;
   const char *s;
@@ -975,6 +1134,7 @@ cmd_genkey (assuan_context_t ctx, char *line)
   no_protection = has_option (line, "--no-protection");
   opt_preset = has_option (line, "--preset");
   opt_inq_passwd = has_option (line, "--inq-passwd");
+  opt_pregen = has_option (line, "--pregen");
   passwd_nonce = option_value (line, "--passwd-nonce");
   if (passwd_nonce)
     {
@@ -1023,6 +1183,15 @@ cmd_genkey (assuan_context_t ctx, char *line)
   if (rc)
     return rc;
 
+  if (opt_pregen)
+    {
+      rc = agent_pregen_request ((char*)value, valuelen);
+      xfree (value);
+      xfree (cache_nonce);
+      xfree (passwd_nonce);
+      return leave_cmd (ctx, rc);
+    }
+
   init_membuf (&outbuf, 512);
 
   /* If requested, ask for the password to be used for the key.  If
@@ -1371,6 +1540,7 @@ cmd_keyinfo (assuan_context_t ctx, char *line)
   int err;
   unsigned char grip[20];
   DIR *dir = NULL;
+  unsigned char *grips = NULL;
   int list_mode;
   int opt_data, opt_ssh_fpr, opt_with_ssh;
   ssh_control_file_t cf = NULL;
@@ -1455,36 +1625,58 @@ cmd_keyinfo (assuan_context_t ctx, char *line)
     {
       char *dirname;
       struct dirent *dir_entry;
+      size_t gripidx, ngrips = 0;
 
       if (ctrl->restricted)
         return leave_cmd (ctx, gpg_error (GPG_ERR_FORBIDDEN));
 
-      dirname = make_filename_try (gnupg_homedir (),
-                                   GNUPG_PRIVATE_KEYS_DIR, NULL);
-      if (!dirname)
+      if (opt.use_key_container)
         {
-          err = gpg_error_from_syserror ();
-          goto leave;
+          err = agent_keystore_list (&grips, &ngrips);
+          if (err)
+            goto leave;
         }
-      dir = opendir (dirname);
-      if (!dir)
+      else
         {
-          err = gpg_error_from_syserror ();
+          dirname = make_filename_try (gnupg_homedir (),
+                                       GNUPG_PRIVATE_KEYS_DIR, NULL);
+          if (!dirname)
+            {
+              err = gpg_error_from_syserror ();
+              goto leave;
+            }
+          dir = opendir (dirname);
+          if (!dir)
+            {
+              err = gpg_error_from_syserror ();
+              xfree (dirname);
+              goto leave;
+            }
           xfree (dirname);
-          goto leave;
         }
-      xfree (dirname);
 
-      while ( (dir_entry = readdir (dir)) )
+      for (gripidx = 0; ; gripidx++)
         {
-          if (strlen (dir_entry->d_name) != 44
-              || strcmp (dir_entry->d_name + 40, ".key"))
-            continue;
-          strncpy (hexgrip, dir_entry->d_name, 40);
-          hexgrip[40] = 0;
+          if (grips)
+            {
+              if (gripidx >= ngrips)
+                break;
+              memcpy (grip, grips + gripidx * 20, 20);
+              bin2hex (grip, 20, hexgrip);
+            }
+          else
+            {
+              if (!(dir_entry = readdir (dir)))
+                break;
+              if (strlen (dir_entry->d_name) != 44
+                  || strcmp (dir_entry->d_name + 40, ".key"))
+                continue;
+              strncpy (hexgrip, dir_entry->d_name, 40);
+              hexgrip[40] = 0;
 
-          if ( hex2bin (hexgrip, grip, 20) < 0 )
-            continue; /* Bad hex string.  */
+              if ( hex2bin (hexgrip, grip, 20) < 0 )
+                continue; /* Bad hex string.  */
+            }
 
           disabled = ttl = confirm = is_ssh = 0;
           if (opt_with_ssh)
@@ -1538,6 +1730,7 @@ cmd_keyinfo (assuan_context_t ctx, char *line)
   ssh_close_control_file (cf);
   if (dir)
     closedir (dir);
+  xfree (grips);
   if (err && gpg_err_code (err) != GPG_ERR_NOT_FOUND)
     leave_cmd (ctx, err);
   return err;
@@ -3350,6 +3543,15 @@ cmd_reloadagent (assuan_context_t ctx, char *line)
 
 
 
+/* Collector for the metrics.  */
+static void
+collect_metrics (void)
+{
+  gnupg_metric_set (gnupg_metric_gauge ("connections"),
+                    get_agent_active_connection_count ());
+}
+
+
 static const char hlp_getinfo[] =
   "GETINFO <what>\n"
   "\n"
@@ -3369,6 +3571,7 @@ static const char hlp_getinfo[] =
   "  std_startup_env - List the standard startup environment.\n"
   "  getenv NAME     - Return value of envvar NAME.\n"
   "  connections     - Return number of active connections.\n"
+  "  metrics         - Return the metrics in the Prometheus text format.\n"
   "  jent_active     - Returns OK if Libgcrypt's JENT is active.\n"
   "  restricted      - Returns OK if the connection is in restricted mode.\n"
   "  cmd_has_option CMD OPT\n"
@@ -3529,6 +3732,20 @@ cmd_getinfo (assuan_context_t ctx, char *line)
                 get_agent_active_connection_count ());
       rc = assuan_send_data (ctx, numbuf, strlen (numbuf));
     }
+  else if (!strcmp (line, "metrics"))
+    {
+      char *buf;
+
+      gnupg_metrics_add_collector (collect_metrics);
+      buf = gnupg_metrics_format ("gpg_agent");
+      if (!buf)
+        rc = gpg_error_from_syserror ();
+      else
+        {
+          rc = assuan_send_data (ctx, buf, strlen (buf));
+          xfree (buf);
+        }
+    }
   else if (!strcmp (line, "jent_active"))
     {
 #if GCRYPT_VERSION_NUMBER >= 0x010800
@@ -3588,6 +3805,12 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
       err = gpg_error (GPG_ERR_FORBIDDEN);
     }
   /* All options below are not allowed in restricted mode.  */
+  else if (!strcmp (key, "trace-id"))
+    {
+      /* Log the timings of the commands and the calls to the
+       * daemons with this id.  */
+      err = gnupg_trace_set_id (ctrl->trace_id, value);
+    }
   else if (!strcmp (key, "putenv"))
     {
       /* Change the session's environment to be used for the
@@ -3686,6 +3909,19 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 
 
 
+/* Called by libassuan before all commands.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)cmd;
+
+  ctrl->server_local->cmd_start = gnupg_metrics_now ();
+  return 0;
+}
+
+
 /* Called by libassuan after all commands. ERR is the error from the
    last assuan operation and not the one returned from the command. */
 static void
@@ -3697,6 +3933,12 @@ post_cmd_notify (assuan_context_t ctx, gpg_error_t err)
 
   /* Switch off any I/O monitor controlled logging pausing. */
   ctrl->server_local->pause_io_logging = 0;
+
+  gnupg_metrics_command_done (assuan_get_command_name (ctx),
+                              ctrl->server_local->cmd_start);
+  gnupg_trace_span (ctrl->trace_id, GPG_AGENT_NAME,
+                    assuan_get_command_name (ctx),
+                    ctrl->server_local->cmd_start);
 }
 
 
@@ -3761,6 +4003,11 @@ command_has_option (const char *cmd, const char *cmdopt)
       if (!strcmp (cmdopt, "newsymkey"))
         return 1;
     }
+  else if (!strcmp (cmd, "GENKEY"))
+    {
+      if (!strcmp (cmdopt, "pregen"))
+        return 1;
+    }
 
   return 0;
 }
@@ -3823,6 +4070,7 @@ register_commands (assuan_context_t ctx)
       if (rc)
         return rc;
     }
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
   assuan_register_post_cmd_notify (ctx, post_cmd_notify);
   assuan_register_reset_notify (ctx, reset_notify);
   assuan_register_option_handler (ctx, option_handler);
@@ -32,6 +32,51 @@
 #include "../common/sexp-parse.h"
 
 
+/* The keygrip of the last key found on a card by ask_for_card along
+ * with the card event counters at that time.  As long as the
+ * counters do not change the card has not been removed and we can
+ * skip the SERIALNO and KEYINFO round-trips to scdaemon.  This
+ * relies on scdaemon's event signal; thus it is only used in server
+ * mode.  */
+static struct
+{
+  char hexgrip[41];
+  unsigned int card;
+  unsigned int maybe_key_change;
+} last_card_key;
+
+
+/* Return true if the key with HEXGRIP is known to be on a card.  */
+static int
+card_key_is_known (const char *hexgrip)
+{
+  unsigned int card, maybe_key_change;
+
+  if (!opt.sigusr2_enabled || !*last_card_key.hexgrip)
+    return 0;
+  get_card_eventcounters (&card, &maybe_key_change);
+  return (card == last_card_key.card
+          && maybe_key_change == last_card_key.maybe_key_change
+          && !strcmp (last_card_key.hexgrip, hexgrip));
+}
+
+
+/* Remember that the key with HEXGRIP has been found on a card.  A
+ * NULL for HEXGRIP forgets the key.  */
+static void
+set_known_card_key (const char *hexgrip)
+{
+  if (!hexgrip)
+    {
+      *last_card_key.hexgrip = 0;
+      return;
+    }
+  strcpy (last_card_key.hexgrip, hexgrip);
+  get_card_eventcounters (&last_card_key.card,
+                          &last_card_key.maybe_key_change);
+}
+
+
 static gpg_error_t
 ask_for_card (ctrl_t ctrl, const unsigned char *shadow_info,
               const unsigned char *grip, char **r_kid)
@@ -55,6 +100,17 @@ ask_for_card (ctrl_t ctrl, const unsigned char *shadow_info,
   else
     want_sn = NULL;
 
+  if (card_key_is_known (hexgrip))
+    {
+      if (DBG_IPC)
+        log_debug ("card with key %s has not been removed\n", hexgrip);
+      xfree (want_sn);
+      if ((*r_kid = xtrystrdup (hexgrip)))
+        return 0;
+      else
+        return gpg_error_from_syserror ();
+    }
+
   len = want_sn? strlen (want_sn) : 0;
   if (len == 32 && !strncmp (want_sn, "D27600012401", 12))
     {
@@ -87,6 +143,7 @@ ask_for_card (ctrl_t ctrl, const unsigned char *shadow_info,
             {
               /* Key for GRIP found, use it directly.  */
               agent_card_free_keyinfo (keyinfo);
+              set_known_card_key (hexgrip);
               xfree (want_sn);
               if ((*r_kid = xtrystrdup (hexgrip)))
                 return 0;
@@ -471,6 +528,8 @@ divert_pksign (ctrl_t ctrl, const char *desc_text, const unsigned char *grip,
       *r_sig = sigval;
       *r_siglen = siglen;
     }
+  else
+    set_known_card_key (NULL);  /* Scan again the next time.  */
 
   xfree (kid);
 
@@ -588,6 +647,8 @@ divert_pkdecrypt (ctrl_t ctrl, const char *desc_text,
       *r_buf = plaintext;
       *r_len = plaintextlen;
     }
+  else
+    set_known_card_key (NULL);  /* Scan again the next time.  */
   xfree (kid);
   return rc;
 }
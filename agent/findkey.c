@@ -50,6 +50,134 @@ struct try_unprotect_arg_s
 };
 
 
+/* The number of buckets of the key info cache and the maximum
+ * number of items.  */
+#define KEYINFO_CACHE_SIZE  509
+#define KEYINFO_CACHE_MAX   8192
+
+/* An item of the key info cache.  This caches the information
+ * returned by agent_key_info_from_file so that listing many keys
+ * does not need to read and parse each key file again.  An item is
+ * valid as long as the file's inode, size and mtime do not change.  */
+struct keyinfo_item_s
+{
+  struct keyinfo_item_s *next;
+  unsigned char grip[KEYGRIP_LEN];
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  int keytype;
+  unsigned char *shadow_info;   /* NULL or the shadow info.  */
+  unsigned char *shadow_type;   /* NULL or the shadow info type.  */
+};
+typedef struct keyinfo_item_s *keyinfo_item_t;
+
+static keyinfo_item_t keyinfo_cache[KEYINFO_CACHE_SIZE];
+static unsigned int keyinfo_cache_count;
+
+
+static keyinfo_item_t *
+keyinfo_cache_bucket (const unsigned char *grip)
+{
+  return &keyinfo_cache[((grip[0] << 8) | grip[1]) % KEYINFO_CACHE_SIZE];
+}
+
+
+/* Remove the item for GRIP from the key info cache.  */
+static void
+keyinfo_cache_forget (const unsigned char *grip)
+{
+  keyinfo_item_t item, *itemp;
+
+  for (itemp = keyinfo_cache_bucket (grip); (item = *itemp);
+       itemp = &item->next)
+    if (!memcmp (item->grip, grip, KEYGRIP_LEN))
+      {
+        *itemp = item->next;
+        xfree (item->shadow_info);
+        xfree (item->shadow_type);
+        xfree (item);
+        keyinfo_cache_count--;
+        return;
+      }
+}
+
+
+/* Remove all items from the key info cache.  */
+static void
+keyinfo_cache_flush (void)
+{
+  keyinfo_item_t item;
+  int idx;
+
+  for (idx = 0; idx < KEYINFO_CACHE_SIZE; idx++)
+    while ((item = keyinfo_cache[idx]))
+      {
+        keyinfo_cache[idx] = item->next;
+        xfree (item->shadow_info);
+        xfree (item->shadow_type);
+        xfree (item);
+      }
+  keyinfo_cache_count = 0;
+}
+
+
+/* Return the item for GRIP if it matches the file status ST.  */
+static keyinfo_item_t
+keyinfo_cache_lookup (const unsigned char *grip, struct stat *st)
+{
+  keyinfo_item_t item;
+
+  for (item = *keyinfo_cache_bucket (grip); item; item = item->next)
+    if (!memcmp (item->grip, grip, KEYGRIP_LEN))
+      break;
+  if (!item)
+    return NULL;
+  if (item->ino != st->st_ino || item->size != st->st_size
+      || item->mtime != st->st_mtime)
+    {
+      keyinfo_cache_forget (grip);
+      return NULL;
+    }
+  return item;
+}
+
+
+/* Store the info for GRIP with the file status ST in the key info
+ * cache.  Ownership of SHADOW_INFO and SHADOW_TYPE is taken.  Errors
+ * are ignored because it is just a cache.  */
+static void
+keyinfo_cache_put (const unsigned char *grip, struct stat *st, int keytype,
+                   unsigned char *shadow_info, unsigned char *shadow_type)
+{
+  keyinfo_item_t item, *bucket;
+
+  keyinfo_cache_forget (grip);
+  if (keyinfo_cache_count >= KEYINFO_CACHE_MAX)
+    keyinfo_cache_flush ();
+
+  item = xtrycalloc (1, sizeof *item);
+  if (!item)
+    {
+      xfree (shadow_info);
+      xfree (shadow_type);
+      return;
+    }
+  memcpy (item->grip, grip, KEYGRIP_LEN);
+  item->ino = st->st_ino;
+  item->size = st->st_size;
+  item->mtime = st->st_mtime;
+  item->keytype = keytype;
+  item->shadow_info = shadow_info;
+  item->shadow_type = shadow_type;
+  bucket = keyinfo_cache_bucket (grip);
+  item->next = *bucket;
+  *bucket = item;
+  keyinfo_cache_count++;
+}
+
+
+
 /* Repalce all linefeeds in STRING by "%0A" and return a new malloced
  * string.  May return NULL on memory error.  */
 static char *
@@ -80,9 +208,55 @@ linefeed_to_percent0A (const char *string)
 }
 
 
+/* Finish writing the key GRIP which has been written to FP.  FP is
+ * either the opened key file FNAME or, with the key container, a
+ * memory stream which is then stored in the container.  FP is closed
+ * in all cases.  */
+static gpg_error_t
+close_key_stream (const unsigned char *grip, const char *fname, estream_t fp)
+{
+  gpg_error_t err;
+  void *image;
+  size_t imagelen;
+  off_t len;
+
+  if (opt.use_key_container)
+    {
+      /* The stream may have had a longer old image.  */
+      len = es_ftello (fp);
+      if (es_fclose_snatch (fp, &image, &imagelen))
+        {
+          err = gpg_error_from_syserror ();
+          es_fclose (fp);
+          return err;
+        }
+      err = agent_keystore_put (grip, image, len < 0? 0 : len);
+      wipememory (image, imagelen);
+      xfree (image);
+      return err;
+    }
+
+  if (ftruncate (es_fileno (fp), es_ftello (fp)))
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error truncating '%s': %s\n", fname, gpg_strerror (err));
+      es_fclose (fp);
+      return err;
+    }
+  if (es_fclose (fp))
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("error closing '%s': %s\n", fname, gpg_strerror (err));
+      return err;
+    }
+  return 0;
+}
+
+
 /* Note: Ownership of FNAME and FP are moved to this function.  */
 static gpg_error_t
-write_extended_private_key (char *fname, estream_t fp, int update, int newkey,
+write_extended_private_key (const unsigned char *grip,
+                            char *fname, estream_t fp, int update, int newkey,
                             const void *buf, size_t len,
                             const char *serialno, const char *keyref,
                             time_t timestamp)
@@ -180,29 +354,19 @@ write_extended_private_key (char *fname, estream_t fp, int update, int newkey,
       goto leave;
     }
 
-  if (ftruncate (es_fileno (fp), es_ftello (fp)))
-    {
-      err = gpg_error_from_syserror ();
-      log_error ("error truncating '%s': %s\n", fname, gpg_strerror (err));
-      remove = 1;
-      goto leave;
-    }
-
-  if (es_fclose (fp))
+  err = close_key_stream (grip, fname, fp);
+  fp = NULL;
+  if (err)
     {
-      err = gpg_error_from_syserror ();
-      log_error ("error closing '%s': %s\n", fname, gpg_strerror (err));
       remove = 1;
       goto leave;
     }
-  else
-    fp = NULL;
 
   bump_key_eventcounter ();
 
  leave:
   es_fclose (fp);
-  if (remove)
+  if (remove && !opt.use_key_container)
     gnupg_remove (fname);
   xfree (fname);
   gcry_sexp_release (key);
@@ -226,8 +390,11 @@ agent_write_private_key (const unsigned char *grip,
   char *fname;
   estream_t fp;
   char hexgrip[40+4+1];
+  int existing = 0;
 
   bin2hex (grip, 20, hexgrip);
+  agent_flush_cache_key (hexgrip);
+  keyinfo_cache_forget (grip);
   strcpy (hexgrip+40, ".key");
 
   fname = make_filename (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
@@ -236,15 +403,51 @@ agent_write_private_key (const unsigned char *grip,
   /* FIXME: Write to a temp file first so that write failures during
      key updates won't lead to a key loss.  */
 
-  if (!force && !access (fname, F_OK))
+  if (opt.use_key_container)
+    {
+      /* With the container we work on a memory stream which is
+       * stored by close_key_stream; the update is atomic.  */
+      gpg_error_t tmperr;
+      unsigned char *image;
+      size_t imagelen;
+
+      tmperr = agent_keystore_get (grip, &image, &imagelen);
+      if (!tmperr && !force)
+        {
+          log_error ("secret key '%s' already exists\n", hexgrip);
+          wipememory (image, imagelen);
+          xfree (image);
+          xfree (fname);
+          return gpg_error (GPG_ERR_EEXIST);
+        }
+      if (!tmperr)
+        {
+          fp = es_fopenmem_init (0, "r+b", image, imagelen);
+          wipememory (image, imagelen);
+          xfree (image);
+          existing = 1;
+        }
+      else if (gpg_err_code (tmperr) == GPG_ERR_ENOENT)
+        fp = es_fopenmem (0, "w+b");
+      else
+        {
+          xfree (fname);
+          return tmperr;
+        }
+      if (!fp)
+        {
+          tmperr = gpg_error_from_syserror ();
+          xfree (fname);
+          return tmperr;
+        }
+    }
+  else if (!force && !access (fname, F_OK))
     {
       log_error ("secret key file '%s' already exists\n", fname);
       xfree (fname);
       return gpg_error (GPG_ERR_EEXIST);
     }
-
-  fp = es_fopen (fname, force? "rb+,mode=-rw" : "wbx,mode=-rw");
-  if (!fp)
+  else if (!(fp = es_fopen (fname, force? "rb+,mode=-rw" : "wbx,mode=-rw")))
     {
       gpg_error_t tmperr = gpg_error_from_syserror ();
 
@@ -262,6 +465,9 @@ agent_write_private_key (const unsigned char *grip,
         }
     }
   else if (force)
+    existing = 1;
+
+  if (existing)
     {
       gpg_error_t rc;
       char first;
@@ -289,19 +495,21 @@ agent_write_private_key (const unsigned char *grip,
       if (first != '(')
         {
           /* Key is already in the extended format.  */
-          return write_extended_private_key (fname, fp, 1, 0, buffer, length,
+          return write_extended_private_key (grip, fname, fp, 1, 0,
+                                             buffer, length,
                                              serialno, keyref, timestamp);
         }
       if (first == '(' && opt.enable_extended_key_format)
         {
           /* Key is in the old format - but we want the extended format.  */
-          return write_extended_private_key (fname, fp, 0, 0, buffer, length,
+          return write_extended_private_key (grip, fname, fp, 0, 0,
+                                             buffer, length,
                                              serialno, keyref, timestamp);
         }
     }
 
   if (opt.enable_extended_key_format)
-    return write_extended_private_key (fname, fp, 0, 1, buffer, length,
+    return write_extended_private_key (grip, fname, fp, 0, 1, buffer, length,
                                        serialno, keyref, timestamp);
 
   if (es_fwrite (buffer, length, 1, fp) != 1)
@@ -309,30 +517,24 @@ agent_write_private_key (const unsigned char *grip,
       gpg_error_t tmperr = gpg_error_from_syserror ();
       log_error ("error writing '%s': %s\n", fname, gpg_strerror (tmperr));
       es_fclose (fp);
-      gnupg_remove (fname);
-      xfree (fname);
-      return tmperr;
-    }
-
-  /* When force is given, the file might have to be truncated.  */
-  if (force && ftruncate (es_fileno (fp), es_ftello (fp)))
-    {
-      gpg_error_t tmperr = gpg_error_from_syserror ();
-      log_error ("error truncating '%s': %s\n", fname, gpg_strerror (tmperr));
-      es_fclose (fp);
-      gnupg_remove (fname);
+      if (!opt.use_key_container)
+        gnupg_remove (fname);
       xfree (fname);
       return tmperr;
     }
 
-  if (es_fclose (fp))
-    {
-      gpg_error_t tmperr = gpg_error_from_syserror ();
-      log_error ("error closing '%s': %s\n", fname, gpg_strerror (tmperr));
-      gnupg_remove (fname);
-      xfree (fname);
-      return tmperr;
-    }
+  /* When force is given, the file might have to be truncated; this is
+   * done by close_key_stream.  */
+  {
+    gpg_error_t tmperr = close_key_stream (grip, fname, fp);
+    if (tmperr)
+      {
+        if (!opt.use_key_container)
+          gnupg_remove (fname);
+        xfree (fname);
+        return tmperr;
+      }
+  }
   bump_key_eventcounter ();
   xfree (fname);
   return 0;
@@ -820,6 +1022,7 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
   struct stat st;
   unsigned char *buf;
   size_t buflen, erroff;
+  size_t imagelen = 0;
   gcry_sexp_t s_skey;
   char hexgrip[40+4+1];
   char first;
@@ -833,10 +1036,26 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
 
   fname = make_filename (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
                          hexgrip, NULL);
-  fp = es_fopen (fname, "rb");
+  if (opt.use_key_container)
+    {
+      unsigned char *image;
+
+      err = agent_keystore_get (grip, &image, &imagelen);
+      if (err)
+        {
+          xfree (fname);
+          return err;
+        }
+      fp = es_fopenmem_init (0, "rb", image, imagelen);
+      if (!fp)
+        err = gpg_error_from_syserror ();
+      wipememory (image, imagelen);
+      xfree (image);
+    }
+  else if (!(fp = es_fopen (fname, "rb")))
+    err = gpg_error_from_syserror ();
   if (!fp)
     {
-      err = gpg_error_from_syserror ();
       if (gpg_err_code (err) != GPG_ERR_ENOENT)
         log_error ("can't open '%s': %s\n", fname, gpg_strerror (err));
       xfree (fname);
@@ -892,7 +1111,9 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
       return err;
     }
 
-  if (fstat (es_fileno (fp), &st))
+  if (opt.use_key_container)
+    buflen = imagelen;
+  else if (fstat (es_fileno (fp), &st))
     {
       err = gpg_error_from_syserror ();
       log_error ("can't stat '%s': %s\n", fname, gpg_strerror (err));
@@ -900,8 +1121,8 @@ read_key_file (const unsigned char *grip, gcry_sexp_t *result, nvc_t *r_keymeta)
       es_fclose (fp);
       return err;
     }
-
-  buflen = st.st_size;
+  else
+    buflen = st.st_size;
   buf = xtrymalloc (buflen+1);
   if (!buf)
     {
@@ -951,10 +1172,21 @@ remove_key_file (const unsigned char *grip)
   char hexgrip[40+4+1];
 
   bin2hex (grip, 20, hexgrip);
+  agent_flush_cache_key (hexgrip);
+  keyinfo_cache_forget (grip);
   strcpy (hexgrip+40, ".key");
   fname = make_filename (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
                          hexgrip, NULL);
-  if (gnupg_remove (fname))
+  if (opt.use_key_container)
+    {
+      err = agent_keystore_delete (grip);
+      /* Also remove a key file left over from the time before the
+       * container was used.  */
+      if ((!err || gpg_err_code (err) == GPG_ERR_ENOENT)
+          && !gnupg_remove (fname))
+        err = 0;
+    }
+  else if (gnupg_remove (fname))
     err = gpg_error_from_syserror ();
   xfree (fname);
   return err;
@@ -975,7 +1207,9 @@ remove_key_file (const unsigned char *grip)
    R_PASSPHRASE is not NULL, the function succeeded and the key was
    protected the used passphrase (entered or from the cache) is stored
    there; if not NULL will be stored.  The caller needs to free the
-   returned passphrase.   */
+   returned passphrase.  With --cache-unprotected-keys the unprotected
+   key is kept with the cached passphrase and used instead of the key
+   file as long as the passphrase is cached.  */
 gpg_error_t
 agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
                      const char *desc_text,
@@ -989,6 +1223,7 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
   gcry_sexp_t s_skey;
   nvc_t keymeta = NULL;
   char *desc_text_buffer = NULL;  /* Used in case we extend DESC_TEXT.  */
+  char hexgrip[40+1];
 
   *result = NULL;
   if (shadow_info)
@@ -996,6 +1231,14 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
   if (r_passphrase)
     *r_passphrase = NULL;
 
+  bin2hex (grip, 20, hexgrip);
+  if (opt.cache_unprotected_keys && !r_passphrase)
+    {
+      buf = agent_get_cache_key (ctrl, hexgrip, cache_mode);
+      if (buf)
+        goto scan_key;
+    }
+
   err = read_key_file (grip, &s_skey, &keymeta);
   if (err)
     {
@@ -1083,6 +1326,8 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
 	    if (err)
 	      log_error ("failed to unprotect the secret key: %s\n",
 			 gpg_strerror (err));
+            else if (opt.cache_unprotected_keys)
+              agent_put_cache_key (ctrl, hexgrip, cache_mode, buf);
 	  }
 
 	xfree (desc_text_final);
@@ -1134,6 +1379,7 @@ agent_key_from_file (ctrl_t ctrl, const char *cache_nonce,
       return err;
     }
 
+ scan_key:
   err = sexp_sscan_private_key (result, &erroff, buf);
   xfree (buf);
   nvc_release (keymeta);
@@ -1319,6 +1565,9 @@ agent_key_available (const unsigned char *grip)
   char *fname;
   char hexgrip[40+4+1];
 
+  if (opt.use_key_container)
+    return agent_keystore_has (grip)? 0 : -1;
+
   bin2hex (grip, 20, hexgrip);
   strcpy (hexgrip+40, ".key");
 
@@ -1331,26 +1580,21 @@ agent_key_available (const unsigned char *grip)
 
 
 
-/* Return the information about the secret key specified by the binary
-   keygrip GRIP.  If the key is a shadowed one the shadow information
-   will be stored at the address R_SHADOW_INFO as an allocated
-   S-expression.  */
-gpg_error_t
-agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
-                          int *r_keytype, unsigned char **r_shadow_info,
-                          unsigned char **r_shadow_info_type)
+/* Read the key file for GRIP and return its type and for shadowed
+ * keys the shadow info and its type.  */
+static gpg_error_t
+key_info_from_file (const unsigned char *grip, int *r_keytype,
+                    unsigned char **r_shadow_info,
+                    unsigned char **r_shadow_info_type)
 {
   gpg_error_t err;
   unsigned char *buf;
   size_t len;
   int keytype;
 
-  (void)ctrl;
-
-  if (r_keytype)
-    *r_keytype = PRIVATE_KEY_UNKNOWN;
-  if (r_shadow_info)
-    *r_shadow_info = NULL;
+  *r_keytype = PRIVATE_KEY_UNKNOWN;
+  *r_shadow_info = NULL;
+  *r_shadow_info_type = NULL;
 
   {
     gcry_sexp_t sexp;
@@ -1380,30 +1624,36 @@ agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
          from such a key. */
       break;
     case PRIVATE_KEY_SHADOWED:
-      if (r_shadow_info)
-        {
-          const unsigned char *s;
-          size_t n;
+      {
+        const unsigned char *s;
+        size_t n;
 
-          err = agent_get_shadow_info_type (buf, &s, r_shadow_info_type);
-          if (!err)
-            {
-              n = gcry_sexp_canon_len (s, 0, NULL, NULL);
-              log_assert (n);
-              *r_shadow_info = xtrymalloc (n);
-              if (!*r_shadow_info)
-                err = gpg_error_from_syserror ();
-              else
-                memcpy (*r_shadow_info, s, n);
-            }
-        }
+        err = agent_get_shadow_info_type (buf, &s, r_shadow_info_type);
+        if (!err)
+          {
+            n = gcry_sexp_canon_len (s, 0, NULL, NULL);
+            log_assert (n);
+            *r_shadow_info = xtrymalloc (n);
+            if (!*r_shadow_info)
+              err = gpg_error_from_syserror ();
+            else
+              memcpy (*r_shadow_info, s, n);
+          }
+        if (err)
+          {
+            xfree (*r_shadow_info);
+            *r_shadow_info = NULL;
+            xfree (*r_shadow_info_type);
+            *r_shadow_info_type = NULL;
+          }
+      }
       break;
     default:
       err = gpg_error (GPG_ERR_BAD_SECKEY);
       break;
     }
 
-  if (!err && r_keytype)
+  if (!err)
     *r_keytype = keytype;
 
   xfree (buf);
@@ -1411,7 +1661,115 @@ agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
 }
 
 
-
+/* Return the information about the secret key specified by the binary
+   keygrip GRIP.  If the key is a shadowed one the shadow information
+   will be stored at the address R_SHADOW_INFO as an allocated
+   S-expression.  */
+gpg_error_t
+agent_key_info_from_file (ctrl_t ctrl, const unsigned char *grip,
+                          int *r_keytype, unsigned char **r_shadow_info,
+                          unsigned char **r_shadow_info_type)
+{
+  gpg_error_t err;
+  char *fname;
+  char hexgrip[40+4+1];
+  struct stat st;
+  int have_stat;
+  keyinfo_item_t item;
+  int keytype;
+  unsigned char *shadow_info, *shadow_type;
+
+  (void)ctrl;
+
+  if (r_keytype)
+    *r_keytype = PRIVATE_KEY_UNKNOWN;
+  if (r_shadow_info)
+    *r_shadow_info = NULL;
+
+  /* The container has its own index; a read of the key is cheap.  */
+  if (opt.use_key_container)
+    have_stat = 0;
+  else
+    {
+      bin2hex (grip, 20, hexgrip);
+      strcpy (hexgrip+40, ".key");
+      fname = make_filename (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR,
+                             hexgrip, NULL);
+      have_stat = !stat (fname, &st);
+      if (!have_stat && errno == ENOENT)
+        {
+          keyinfo_cache_forget (grip);
+          xfree (fname);
+          return gpg_error (GPG_ERR_NOT_FOUND);
+        }
+      xfree (fname);
+    }
+
+  item = have_stat? keyinfo_cache_lookup (grip, &st) : NULL;
+  if (item)
+    {
+      keytype = item->keytype;
+      shadow_info = shadow_type = NULL;
+      if (item->shadow_info)
+        {
+          size_t n = gcry_sexp_canon_len (item->shadow_info, 0, NULL, NULL);
+
+          shadow_info = xtrymalloc (n);
+          if (!shadow_info)
+            return gpg_error_from_syserror ();
+          memcpy (shadow_info, item->shadow_info, n);
+        }
+      if (item->shadow_type && !(shadow_type = xtrystrdup (item->shadow_type)))
+        {
+          err = gpg_error_from_syserror ();
+          xfree (shadow_info);
+          return err;
+        }
+    }
+  else
+    {
+      err = key_info_from_file (grip, &keytype, &shadow_info, &shadow_type);
+      if (err)
+        return err;
+      if (have_stat)
+        {
+          unsigned char *p = NULL, *q = NULL;
+          size_t n;
+
+          /* Store copies in the cache.  */
+          if (shadow_info)
+            {
+              n = gcry_sexp_canon_len (shadow_info, 0, NULL, NULL);
+              if ((p = xtrymalloc (n)))
+                memcpy (p, shadow_info, n);
+            }
+          if (shadow_type)
+            q = xtrystrdup (shadow_type);
+          if ((!shadow_info || p) && (!shadow_type || q))
+            keyinfo_cache_put (grip, &st, keytype, p, q);
+          else
+            {
+              xfree (p);
+              xfree (q);
+            }
+        }
+    }
+
+  if (r_keytype)
+    *r_keytype = keytype;
+  if (r_shadow_info)
+    *r_shadow_info = shadow_info;
+  else
+    xfree (shadow_info);
+  if (r_shadow_info_type && keytype == PRIVATE_KEY_SHADOWED && r_shadow_info)
+    *r_shadow_info_type = shadow_type;
+  else
+    xfree (shadow_type);
+  return 0;
+}
+
+
+
 /* Delete the key with GRIP from the disk after having asked for
  * confirmation using DESC_TEXT.  If FORCE is set the function won't
  * require a confirmation via Pinentry or warns if the key is also
@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#include <npth.h>
 
 #include "agent.h"
 #include "../common/i18n.h"
@@ -419,6 +420,335 @@ agent_ask_new_passphrase (ctrl_t ctrl, const char *prompt,
 
 
 
+/* The pool of pregenerated keys.  For each configured key
+ * parameter a list of ready keys is kept; a background thread refills
+ * the lists.  The keys are held as S-expressions returned by
+ * gcry_pk_genkey and thus their secret parts are in secure memory.
+ * The lists are only accessed while holding PREGEN_LOCK.  Pools are
+ * also created on request of a client (GENKEY --pregen); those keys
+ * are not replaced after use.  */
+#define PREGEN_MAX_KEYS  16
+#define PREGEN_MAX_POOLS 16
+
+struct pregen_key_s
+{
+  struct pregen_key_s *next;
+  gcry_sexp_t s_key;
+};
+
+struct pregen_pool_s
+{
+  struct pregen_pool_s *next;
+  gcry_sexp_t s_keyparam;      /* The parameters for gcry_pk_genkey.  */
+  unsigned int wanted;         /* The number of keys to keep ready.  */
+  unsigned int requested;      /* The number of keys requested once.  */
+  unsigned int count;          /* The number of keys in KEYS.  */
+  struct pregen_key_s *keys;
+  size_t keyparamlen;
+  char keyparam[1];            /* KEYPARAM in canonical format.  */
+};
+typedef struct pregen_pool_s *pregen_pool_t;
+
+static pregen_pool_t pregen_pools;
+static unsigned int pregen_npools;
+static npth_mutex_t pregen_lock;
+static npth_cond_t pregen_cond;
+static int pregen_started;
+
+
+/* Return a new pool for S_KEYPARAM.  On success S_KEYPARAM is owned
+ * by the pool.  The caller needs to link the pool.  */
+static pregen_pool_t
+pregen_new_pool (gcry_sexp_t s_keyparam)
+{
+  pregen_pool_t pool;
+  size_t len;
+
+  len = gcry_sexp_sprint (s_keyparam, GCRYSEXP_FMT_CANON, NULL, 0);
+  pool = xtrycalloc (1, sizeof *pool + len);
+  if (!pool)
+    return NULL;
+  pool->keyparamlen = gcry_sexp_sprint (s_keyparam, GCRYSEXP_FMT_CANON,
+                                        pool->keyparam, len);
+  pool->s_keyparam = s_keyparam;
+  return pool;
+}
+
+
+/* Return the pool for S_KEYPARAM or NULL.  */
+static pregen_pool_t
+pregen_find_pool (gcry_sexp_t s_keyparam)
+{
+  pregen_pool_t pool;
+  char buffer[256];
+  size_t len;
+
+  len = gcry_sexp_sprint (s_keyparam, GCRYSEXP_FMT_CANON, NULL, 0);
+  if (len > sizeof buffer)
+    return NULL;
+  len = gcry_sexp_sprint (s_keyparam, GCRYSEXP_FMT_CANON, buffer, len);
+
+  for (pool = pregen_pools; pool; pool = pool->next)
+    if (pool->keyparamlen == len && !memcmp (pool->keyparam, buffer, len))
+      return pool;
+  return NULL;
+}
+
+
+/* Add the algorithm SPEC to the pool of pregenerated keys.  SPEC has
+ * the form "rsaNBITS[:COUNT]" with COUNT being the number of keys to
+ * keep ready, default 2.  This must be called before
+ * agent_pregen_start.  */
+gpg_error_t
+agent_pregen_add (const char *spec)
+{
+  gpg_error_t err;
+  unsigned long nbits, count = 2;
+  const char *s;
+  char *endp;
+  gcry_sexp_t s_keyparam;
+  pregen_pool_t pool;
+
+  if (ascii_strncasecmp (spec, "rsa", 3) || !digitp (spec + 3))
+    return gpg_error (GPG_ERR_PUBKEY_ALGO);
+  nbits = strtoul (spec + 3, &endp, 10);
+  s = endp;
+  if (*s == ':')
+    {
+      if (!digitp (s + 1))
+        return gpg_error (GPG_ERR_INV_VALUE);
+      count = strtoul (s + 1, &endp, 10);
+      s = endp;
+    }
+  if (*s || nbits < 1024 || nbits > 16384 || (nbits % 8)
+      || !count || count > PREGEN_MAX_KEYS)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  err = gcry_sexp_build (&s_keyparam, NULL,
+                         "(genkey(rsa(nbits %u)))", (unsigned int)nbits);
+  if (err)
+    return err;
+  if ((pool = pregen_find_pool (s_keyparam)))
+    {
+      gcry_sexp_release (s_keyparam);
+      pool->wanted = count;
+      return 0;
+    }
+  if (pregen_npools >= PREGEN_MAX_POOLS)
+    {
+      gcry_sexp_release (s_keyparam);
+      return gpg_error (GPG_ERR_TOO_MANY);
+    }
+  pool = pregen_new_pool (s_keyparam);
+  if (!pool)
+    {
+      err = gpg_error_from_syserror ();
+      gcry_sexp_release (s_keyparam);
+      return err;
+    }
+  pool->wanted = count;
+  pool->next = pregen_pools;
+  pregen_pools = pool;
+  pregen_npools++;
+  return 0;
+}
+
+
+/* Return a pool which needs another key or NULL.  */
+static pregen_pool_t
+pregen_find_short_pool (void)
+{
+  pregen_pool_t pool;
+
+  for (pool = pregen_pools; pool; pool = pool->next)
+    if (pool->count < pool->wanted + pool->requested)
+      return pool;
+  return NULL;
+}
+
+
+/* The thread to fill the pools.  */
+static void *
+pregen_thread (void *arg)
+{
+  gpg_error_t err;
+  pregen_pool_t pool;
+  struct pregen_key_s *key;
+  gcry_sexp_t s_key;
+
+  (void)arg;
+
+  for (;;)
+    {
+      npth_mutex_lock (&pregen_lock);
+      while (!(pool = pregen_find_short_pool ()))
+        npth_cond_wait (&pregen_cond, &pregen_lock);
+      npth_mutex_unlock (&pregen_lock);
+
+      /* Let the connection threads run while we do the heavy work.
+       * Libgcrypt is thread-safe and S_KEYPARAM is never changed.  */
+      npth_unprotect ();
+      err = gcry_pk_genkey (&s_key, pool->s_keyparam);
+      npth_protect ();
+      if (err)
+        {
+          log_error ("key pregeneration failed: %s\n", gpg_strerror (err));
+          npth_sleep (60);
+          continue;
+        }
+
+      key = xtrycalloc (1, sizeof *key);
+      if (!key)
+        {
+          log_error ("key pregeneration failed: %s\n",
+                     gpg_strerror (gpg_error_from_syserror ()));
+          gcry_sexp_release (s_key);
+          npth_sleep (60);
+          continue;
+        }
+      key->s_key = s_key;
+      npth_mutex_lock (&pregen_lock);
+      key->next = pool->keys;
+      pool->keys = key;
+      pool->count++;
+      npth_mutex_unlock (&pregen_lock);
+      if (DBG_CRYPTO)
+        log_debug ("pregenerated key added to pool (%u of %u)\n",
+                   pool->count, pool->wanted + pool->requested);
+
+      /* Give a waiting client a chance before the next key.  */
+      npth_sleep (1);
+    }
+
+  return NULL;
+}
+
+
+/* Start the thread if not yet done.  Returns true if the thread is
+ * running.  */
+static int
+pregen_start_thread (void)
+{
+  npth_attr_t tattr;
+  npth_t thread;
+  int rc;
+
+  if (pregen_started)
+    return 1;
+
+  rc = npth_mutex_init (&pregen_lock, NULL);
+  if (!rc)
+    rc = npth_cond_init (&pregen_cond, NULL);
+  if (!rc)
+    rc = npth_attr_init (&tattr);
+  if (rc)
+    {
+      log_error ("error initializing key pregeneration: %s\n", strerror (rc));
+      return 0;
+    }
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  rc = npth_create (&thread, &tattr, pregen_thread, NULL);
+  if (rc)
+    log_error ("error spawning key pregeneration thread: %s\n",
+               strerror (rc));
+  else
+    pregen_started = 1;
+  npth_attr_destroy (&tattr);
+  return pregen_started;
+}
+
+
+/* Start the thread to fill the pools of pregenerated keys.  Does
+ * nothing if no pool has been configured.  */
+void
+agent_pregen_start (void)
+{
+  if (pregen_pools)
+    pregen_start_thread ();
+}
+
+
+/* Ask for one key with the parameters KEYPARAM to be generated in the
+ * background.  A later GENKEY with the same parameters will use that
+ * key.  */
+gpg_error_t
+agent_pregen_request (const char *keyparam, size_t keyparamlen)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_keyparam;
+  pregen_pool_t pool;
+
+  err = gcry_sexp_sscan (&s_keyparam, NULL, keyparam, keyparamlen);
+  if (err)
+    {
+      log_error ("failed to convert keyparam: %s\n", gpg_strerror (err));
+      return gpg_error (GPG_ERR_INV_DATA);
+    }
+  if (!pregen_start_thread ())
+    {
+      gcry_sexp_release (s_keyparam);
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+
+  npth_mutex_lock (&pregen_lock);
+  if ((pool = pregen_find_pool (s_keyparam)))
+    gcry_sexp_release (s_keyparam);
+  else if (pregen_npools >= PREGEN_MAX_POOLS)
+    {
+      gcry_sexp_release (s_keyparam);
+      err = gpg_error (GPG_ERR_TOO_MANY);
+    }
+  else if (!(pool = pregen_new_pool (s_keyparam)))
+    {
+      err = gpg_error_from_syserror ();
+      gcry_sexp_release (s_keyparam);
+    }
+  else
+    {
+      pool->next = pregen_pools;
+      pregen_pools = pool;
+      pregen_npools++;
+    }
+  if (!err)
+    {
+      if (pool->wanted + pool->requested < PREGEN_MAX_KEYS)
+        pool->requested++;
+      npth_cond_signal (&pregen_cond);
+    }
+  npth_mutex_unlock (&pregen_lock);
+  return err;
+}
+
+
+/* Return a pregenerated key for S_KEYPARAM or NULL if none is
+ * available.  The key is removed from the pool.  */
+static gcry_sexp_t
+pregen_take (gcry_sexp_t s_keyparam)
+{
+  pregen_pool_t pool;
+  struct pregen_key_s *key;
+  gcry_sexp_t s_key = NULL;
+
+  if (!pregen_started)
+    return NULL;
+
+  npth_mutex_lock (&pregen_lock);
+  pool = pregen_find_pool (s_keyparam);
+  if (pool && (key = pool->keys))
+    {
+      pool->keys = key->next;
+      pool->count--;
+      if (pool->requested)
+        pool->requested--;
+      s_key = key->s_key;
+      xfree (key);
+      npth_cond_signal (&pregen_cond);
+    }
+  npth_mutex_unlock (&pregen_lock);
+  return s_key;
+}
+
+
 /* Generate a new keypair according to the parameters given in
    KEYPARAM.  If CACHE_NONCE is given first try to lookup a passphrase
    using the cache nonce.  If NO_PROTECTION is true the key will not
@@ -469,7 +799,15 @@ agent_genkey (ctrl_t ctrl, const char *cache_nonce, time_t timestamp,
       passphrase = passphrase_buffer;
     }
 
-  rc = gcry_pk_genkey (&s_key, s_keyparam );
+  s_key = pregen_take (s_keyparam);
+  if (s_key)
+    {
+      if (opt.verbose)
+        log_info ("using a pregenerated key\n");
+      rc = 0;
+    }
+  else
+    rc = gcry_pk_genkey (&s_key, s_keyparam );
   gcry_sexp_release (s_keyparam);
   if (rc)
     {
@@ -60,6 +60,7 @@
 #include "../common/exechelp.h"
 #include "../common/asshelp.h"
 #include "../common/init.h"
+#include "../common/timerwheel.h"
 
 
 enum cmd_and_opt_values
@@ -114,6 +115,8 @@ enum cmd_and_opt_values
   oEnablePassphraseHistory,
   oDisableExtendedKeyFormat,
   oEnableExtendedKeyFormat,
+  oPrivateKeyStore,
+  oPregenerateKey,
   oUseStandardSocket,
   oNoUseStandardSocket,
   oExtraSocket,
@@ -121,6 +124,7 @@ enum cmd_and_opt_values
   oFakedSystemTime,
 
   oIgnoreCacheForSigning,
+  oCacheUnprotectedKeys,
   oAllowMarkTrusted,
   oNoAllowMarkTrusted,
   oAllowPresetPassphrase,
@@ -221,6 +225,8 @@ static gpgrt_opt_t opts[] = {
                 ),
   ARGPARSE_s_n (oDisableExtendedKeyFormat, "disable-extended-key-format", "@"),
   ARGPARSE_s_n (oEnableExtendedKeyFormat, "enable-extended-key-format", "@"),
+  ARGPARSE_s_s (oPrivateKeyStore, "private-key-store", "@"),
+  ARGPARSE_s_s (oPregenerateKey, "pregenerate-key", "@"),
   ARGPARSE_s_i (oListenBacklog, "listen-backlog", "@"),
   ARGPARSE_op_u (oAutoExpandSecmem, "auto-expand-secmem", "@"),
   ARGPARSE_s_s (oFakedSystemTime, "faked-system-time", "@"),
@@ -238,6 +244,7 @@ static gpgrt_opt_t opts[] = {
                 /* */     N_("|N|set maximum SSH key lifetime to N seconds")),
   ARGPARSE_s_n (oIgnoreCacheForSigning, "ignore-cache-for-signing",
                 /* */    N_("do not use the PIN cache when signing")),
+  ARGPARSE_s_n (oCacheUnprotectedKeys, "cache-unprotected-keys", "@"),
   ARGPARSE_s_n (oNoAllowExternalCache,  "no-allow-external-cache",
                 /* */    N_("disallow the use of an external password cache")),
   ARGPARSE_s_n (oNoAllowMarkTrusted, "no-allow-mark-trusted",
@@ -322,9 +329,11 @@ static struct debug_flags_s debug_flags [] =
 /* The timer tick used for housekeeping stuff.  Note that on Windows
  * we use a SetWaitableTimer seems to signal earlier than about 2
  * seconds.  Thus we use 4 seconds on all platforms except for
- * Windowsce.  CHECK_OWN_SOCKET_INTERVAL defines how often we check
- * our own socket in standard socket mode.  If that value is 0 we
- * don't check at all.  All values are in seconds. */
+ * Windowsce.  The tick is only used if there is something to poll
+ * for; other housekeeping is scheduled with the timer wheel.
+ * CHECK_OWN_SOCKET_INTERVAL defines how often we check our own
+ * socket in standard socket mode.  If that value is 0 we don't check
+ * at all.  All values are in seconds. */
 #if defined(HAVE_W32CE_SYSTEM)
 # define TIMERTICK_INTERVAL         (60)
 # define CHECK_OWN_SOCKET_INTERVAL   (0)  /* Never */
@@ -443,6 +452,18 @@ static int have_homedir_inotify;
  * works reliable.  */
 static int reliable_homedir_inotify;
 
+/* The timers for handle_tick and for checking our own socket.  */
+static struct gnupg_timer_s tick_timer;
+#if CHECK_OWN_SOCKET_INTERVAL > 0
+static struct gnupg_timer_s own_socket_timer;
+#endif
+
+#ifndef HAVE_W32_SYSTEM
+/* A pipe used to wake up the main loop if a timer has been set to an
+ * earlier time.  */
+static int wakeup_pipe[2] = { -1, -1 };
+#endif
+
 /* Number of active connections.  */
 static int active_connections;
 
@@ -858,6 +879,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       opt.enable_passphrase_history = 0;
       opt.enable_extended_key_format = 1;
       opt.ignore_cache_for_signing = 0;
+      opt.cache_unprotected_keys = 0;
       opt.allow_mark_trusted = 1;
       opt.allow_external_cache = 1;
       opt.allow_loopback_pinentry = 1;
@@ -940,6 +962,7 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       break;
 
     case oIgnoreCacheForSigning: opt.ignore_cache_for_signing = 1; break;
+    case oCacheUnprotectedKeys: opt.cache_unprotected_keys = 1; break;
 
     case oAllowMarkTrusted: opt.allow_mark_trusted = 1; break;
     case oNoAllowMarkTrusted: opt.allow_mark_trusted = 0; break;
@@ -1275,6 +1298,22 @@ main (int argc, char **argv)
           listen_backlog = pargs.r.ret_int;
           break;
 
+        case oPrivateKeyStore:
+          if (!strcmp (pargs.r.ret_str, "container"))
+            opt.use_key_container = 1;
+          else if (!strcmp (pargs.r.ret_str, "files"))
+            opt.use_key_container = 0;
+          else
+            log_error (_("invalid value for option '%s'\n"),
+                       "--private-key-store");
+          break;
+
+        case oPregenerateKey:
+          if ((err = agent_pregen_add (pargs.r.ret_str)))
+            log_error (_("invalid value for option '%s'\n"),
+                       "--pregenerate-key");
+          break;
+
         case oDebugQuickRandom:
           /* Only used by the first stage command line parser.  */
           break;
@@ -2351,13 +2390,11 @@ create_directories (void)
 /* This is the worker for the ticker.  It is called every few seconds
    and may only do fast operations. */
 static void
-handle_tick (void)
+handle_tick (void *opaque)
 {
-  static time_t last_minute;
   struct stat statbuf;
 
-  if (!last_minute)
-    last_minute = time (NULL);
+  (void)opaque;
 
   /* If we are running as a child of another process, check whether
      the parent is still alive and shutdown if not. */
@@ -2375,18 +2412,6 @@ handle_tick (void)
     }
 #endif /*HAVE_W32_SYSTEM*/
 
-  /* Code to be run from time to time.  */
-#if CHECK_OWN_SOCKET_INTERVAL > 0
-  if (last_minute + CHECK_OWN_SOCKET_INTERVAL <= time (NULL))
-    {
-      check_own_socket ();
-      last_minute = time (NULL);
-    }
-#endif
-
-  /* Need to check for expired cache entries.  */
-  agent_cache_housekeeping ();
-
   /* Check whether the homedir is still available.  */
   if (!shutdown_pending
       && (!have_homedir_inotify || !reliable_homedir_inotify)
@@ -2395,9 +2420,42 @@ handle_tick (void)
       shutdown_pending = 1;
       log_info ("homedir has been removed - shutting down\n");
     }
+
+  gnupg_timer_set (&tick_timer, gnupg_get_time () + TIMERTICK_INTERVAL);
 }
 
 
+#if CHECK_OWN_SOCKET_INTERVAL > 0
+/* The timer callback to check our own socket.  */
+static void
+handle_own_socket_tick (void *opaque)
+{
+  (void)opaque;
+
+  check_own_socket ();
+  gnupg_timer_set (&own_socket_timer,
+                   gnupg_get_time () + CHECK_OWN_SOCKET_INTERVAL);
+}
+#endif
+
+
+#ifndef HAVE_W32_SYSTEM
+/* The notify callback for the timer wheel.  It is called if the main
+ * loop needs to wake up earlier than it is planning to.  */
+static void
+wakeup_main_loop (void)
+{
+  int rc;
+
+  if (wakeup_pipe[1] == -1)
+    return;
+  /* An EAGAIN means that there is already a wakeup pending.  */
+  rc = write (wakeup_pipe[1], "", 1);
+  (void)rc;
+}
+#endif
+
+
 /* A global function which allows us to call the reload stuff from
    other places too.  This is only used when build for W32.  */
 void
@@ -2408,6 +2466,8 @@ agent_sighup_action (void)
 
   agent_flush_cache (0);
   reread_configuration ();
+  /* Pick up changed cache TTLs.  */
+  agent_cache_housekeeping ();
   agent_reload_trustlist ();
   /* We flush the module name cache so that after installing a
      "pinentry" binary that one can be used in case the
@@ -2811,9 +2871,8 @@ handle_connections (gnupg_fd_t listen_fd,
   gnupg_fd_t fd;
   int nfd;
   int saved_errno;
-  struct timespec abstime;
-  struct timespec curtime;
   struct timespec timeout;
+  long nextevent;
 #ifdef HAVE_W32_SYSTEM
   HANDLE events[2];
   unsigned int events_set;
@@ -2898,6 +2957,9 @@ handle_connections (gnupg_fd_t listen_fd,
      notifications.  */
   opt.sigusr2_enabled = 1;
 
+  /* Start filling the pools of pregenerated keys.  */
+  agent_pregen_start ();
+
   FD_ZERO (&fdset);
   FD_SET (FD2INT (listen_fd), &fdset);
   nfd = FD2INT (listen_fd);
@@ -2937,8 +2999,37 @@ handle_connections (gnupg_fd_t listen_fd,
   listentbl[2].l_fd = listen_fd_browser;
   listentbl[3].l_fd = listen_fd_ssh;
 
-  npth_clock_gettime (&abstime);
-  abstime.tv_sec += TIMERTICK_INTERVAL;
+#ifndef HAVE_W32_SYSTEM
+  if (pipe (wakeup_pipe))
+    {
+      log_error ("error creating wakeup pipe: %s\n", strerror (errno));
+      wakeup_pipe[0] = wakeup_pipe[1] = -1;
+    }
+  else
+    {
+      fcntl (wakeup_pipe[0], F_SETFL, O_NONBLOCK);
+      fcntl (wakeup_pipe[1], F_SETFL, O_NONBLOCK);
+      FD_SET (wakeup_pipe[0], &fdset);
+      if (wakeup_pipe[0] > nfd)
+        nfd = wakeup_pipe[0];
+      gnupg_timer_set_notify (wakeup_main_loop);
+    }
+#endif
+
+  /* The tick is only needed to poll the parent and the homedir.  */
+  gnupg_timer_init (&tick_timer, handle_tick, NULL);
+#ifdef HAVE_W32_SYSTEM
+  gnupg_timer_set (&tick_timer, gnupg_get_time () + TIMERTICK_INTERVAL);
+#else
+  if (parent_pid != (pid_t)(-1)
+      || !have_homedir_inotify || !reliable_homedir_inotify)
+    gnupg_timer_set (&tick_timer, gnupg_get_time () + TIMERTICK_INTERVAL);
+#endif
+#if CHECK_OWN_SOCKET_INTERVAL > 0
+  gnupg_timer_init (&own_socket_timer, handle_own_socket_tick, NULL);
+  gnupg_timer_set (&own_socket_timer,
+                   gnupg_get_time () + CHECK_OWN_SOCKET_INTERVAL);
+#endif
 
   for (;;)
     {
@@ -2968,24 +3059,40 @@ handle_connections (gnupg_fd_t listen_fd,
               if (home_inotify_fd > nfd)
                 nfd = home_inotify_fd;
             }
+#ifndef HAVE_W32_SYSTEM
+          if (wakeup_pipe[0] != -1)
+            {
+              FD_SET (wakeup_pipe[0], &fdset);
+              if (wakeup_pipe[0] > nfd)
+                nfd = wakeup_pipe[0];
+            }
+#endif
 	}
 
       /* POSIX says that fd_set should be implemented as a structure,
          thus a simple assignment is fine to copy the entire set.  */
       read_fdset = fdset;
 
-      npth_clock_gettime (&curtime);
-      if (!(npth_timercmp (&curtime, &abstime, <)))
-	{
-	  /* Timeout.  */
-	  handle_tick ();
-	  npth_clock_gettime (&abstime);
-	  abstime.tv_sec += TIMERTICK_INTERVAL;
-	}
-      npth_timersub (&abstime, &curtime, &timeout);
+      /* Run the due timers and sleep until the next one.  While
+       * shutting down we need to poll for the end of the connections.
+       * On Windows we have no way to wake up the loop for a new
+       * timer; thus we use the tick there as an upper limit.  */
+      gnupg_timer_run (gnupg_get_time ());
+      nextevent = gnupg_timer_next (gnupg_get_time ());
+#ifdef HAVE_W32_SYSTEM
+      if (nextevent < 0 || nextevent > TIMERTICK_INTERVAL)
+        nextevent = TIMERTICK_INTERVAL;
+#else
+      if (shutdown_pending
+          && (nextevent < 0 || nextevent > TIMERTICK_INTERVAL))
+        nextevent = TIMERTICK_INTERVAL;
+#endif
+      timeout.tv_sec = nextevent < 0? 0 : nextevent;
+      timeout.tv_nsec = 0;
 
 #ifndef HAVE_W32_SYSTEM
-      ret = npth_pselect (nfd+1, &read_fdset, NULL, NULL, &timeout,
+      ret = npth_pselect (nfd+1, &read_fdset, NULL, NULL,
+                          nextevent < 0? NULL : &timeout,
                           npth_sigev_sigmask ());
       saved_errno = errno;
 
@@ -3038,6 +3145,17 @@ handle_connections (gnupg_fd_t listen_fd,
           log_info ("homedir has been removed - shutting down\n");
         }
 
+#ifndef HAVE_W32_SYSTEM
+      if (wakeup_pipe[0] != -1 && FD_ISSET (wakeup_pipe[0], &read_fdset))
+        {
+          char buf[16];
+
+          /* The timers are run at the top of the loop.  */
+          while (read (wakeup_pipe[0], buf, sizeof buf) > 0)
+            ;
+        }
+#endif
+
       if (!shutdown_pending)
         {
           int idx;
@@ -0,0 +1,878 @@
+/* keystore.c - Store all private keys in a single file
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* With --private-key-store=container the private keys are kept in a
+ * single file instead of one file per key in private-keys-v1.d.  On
+ * a networked home directory this avoids an open, a lock and an
+ * fsync for each key.  The file starts with a magic line followed by
+ * records of this format:
+ *
+ *   u32  Length of the image or 0xffffffff for a deleted key.
+ *   20   The keygrip.
+ *   u32  CRC-32 over the keygrip and the image.
+ *   n    The image; this is exactly the content of the key file.
+ *
+ * Records are only appended and an index with the offset of the last
+ * record for each keygrip is kept in memory.  Thus reading a key is
+ * a single seek and read and updating a key is a single write and
+ * fsync.  A partly written record at the end of the file is removed
+ * when the file is opened.  If most of the file is taken by replaced
+ * records the file is rewritten to a temporary file which is then
+ * renamed.  The image of a replaced or deleted key is overwritten
+ * with zeroes right away so that no old secret key material is left
+ * in the file.  When the file is created, all key files from
+ * private-keys-v1.d are moved into it.
+ *
+ * Only raw system calls are used so that no other nPth thread can
+ * run while the file or the index is being modified.
+ */
+
+#include <config.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <dirent.h>
+
+#include "agent.h"
+#include "../common/host2net.h"
+#include "../common/sysutils.h"
+
+#if defined(HAVE_DOSISH_SYSTEM) || defined(__CYGWIN__)
+#define MY_O_BINARY  O_BINARY
+#else
+#define MY_O_BINARY  0
+#endif
+
+#define KEYSTORE_FILENAME "private-keys-v1.kst"
+
+/* The magic at the start of the file.  */
+#define KEYSTORE_MAGIC    "GnuPG-KeyStore1\n"
+#define KEYSTORE_MAGICLEN 16
+
+/* The length of a record header and the length value used for a
+ * deleted key.  */
+#define RECHDRLEN     (4 + KEYGRIP_LEN + 4)
+#define DELETED_MARK  0xffffffff
+
+/* The maximum length of an image; this is only a sanity limit.  */
+#define MAX_IMAGELEN  (1024*1024)
+
+/* The number of buckets of the index.  */
+#define INDEX_SIZE  1021
+
+/* The file is rewritten if replaced records take up more than half
+ * of the file and at least this many bytes.  */
+#define COMPACT_MIN_GARBAGE (256*1024)
+
+
+/* An item of the index.  */
+struct index_item_s
+{
+  struct index_item_s *next;
+  unsigned char grip[KEYGRIP_LEN];
+  off_t off;        /* The offset of the image.  */
+  size_t len;       /* The length of the image.  */
+};
+typedef struct index_item_s *index_item_t;
+
+static index_item_t keystore_index[INDEX_SIZE];
+static unsigned int keystore_nitems;
+
+/* The fd of the open file or -1, its name and its size.  */
+static int keystore_fd = -1;
+static char *keystore_fname;
+static off_t keystore_end;
+
+/* The number of bytes in the file taken by replaced records.  */
+static off_t keystore_garbage;
+
+
+
+static index_item_t *
+index_bucket (const unsigned char *grip)
+{
+  return &keystore_index[buf32_to_uint (grip) % INDEX_SIZE];
+}
+
+
+/* Return the index item for GRIP or NULL.  */
+static index_item_t
+index_lookup (const unsigned char *grip)
+{
+  index_item_t item;
+
+  for (item = *index_bucket (grip); item; item = item->next)
+    if (!memcmp (item->grip, grip, KEYGRIP_LEN))
+      break;
+  return item;
+}
+
+
+/* Remove the item for GRIP from the index.  */
+static void
+index_remove (const unsigned char *grip)
+{
+  index_item_t item, *itemp;
+
+  for (itemp = index_bucket (grip); (item = *itemp); itemp = &item->next)
+    if (!memcmp (item->grip, grip, KEYGRIP_LEN))
+      {
+        *itemp = item->next;
+        keystore_garbage += RECHDRLEN + item->len;
+        keystore_nitems--;
+        xfree (item);
+        return;
+      }
+}
+
+
+/* Record that the image for GRIP is at OFF with length LEN.  */
+static gpg_error_t
+index_set (const unsigned char *grip, off_t off, size_t len)
+{
+  index_item_t item, *bucket;
+
+  item = index_lookup (grip);
+  if (item)
+    keystore_garbage += RECHDRLEN + item->len;
+  else
+    {
+      item = xtrycalloc (1, sizeof *item);
+      if (!item)
+        return gpg_error_from_syserror ();
+      memcpy (item->grip, grip, KEYGRIP_LEN);
+      bucket = index_bucket (grip);
+      item->next = *bucket;
+      *bucket = item;
+      keystore_nitems++;
+    }
+  item->off = off;
+  item->len = len;
+  return 0;
+}
+
+
+/* Release the index.  */
+static void
+index_release (void)
+{
+  index_item_t item;
+  int idx;
+
+  for (idx = 0; idx < INDEX_SIZE; idx++)
+    while ((item = keystore_index[idx]))
+      {
+        keystore_index[idx] = item->next;
+        xfree (item);
+      }
+  keystore_nitems = 0;
+  keystore_garbage = 0;
+}
+
+
+/* Compute the checksum of a record.  IMAGE may be NULL for a deleted
+ * key.  */
+static u32
+record_crc (const unsigned char *grip, const void *image, size_t len)
+{
+  gcry_md_hd_t md;
+  u32 crc;
+
+  if (gcry_md_open (&md, GCRY_MD_CRC32, 0))
+    return 0;
+  gcry_md_write (md, grip, KEYGRIP_LEN);
+  if (image)
+    gcry_md_write (md, image, len);
+  crc = buf32_to_u32 (gcry_md_read (md, GCRY_MD_CRC32));
+  gcry_md_close (md);
+  return crc;
+}
+
+
+/* Read LEN bytes at offset OFF of FD into BUFFER.  */
+static gpg_error_t
+read_at (int fd, off_t off, void *buffer, size_t len)
+{
+  char *p = buffer;
+  ssize_t n;
+
+  if (lseek (fd, off, SEEK_SET) == (off_t)(-1))
+    return gpg_error_from_syserror ();
+  while (len)
+    {
+      n = read (fd, p, len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        return gpg_error_from_syserror ();
+      if (!n)
+        return gpg_error (GPG_ERR_EOF);
+      p += n;
+      len -= n;
+    }
+  return 0;
+}
+
+
+/* Write LEN bytes from BUFFER to FD.  */
+static gpg_error_t
+write_all (int fd, const void *buffer, size_t len)
+{
+  const char *p = buffer;
+  ssize_t n;
+
+  while (len)
+    {
+      n = write (fd, p, len);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        return gpg_error_from_syserror ();
+      p += n;
+      len -= n;
+    }
+  return 0;
+}
+
+
+/* Flush the file FD to the disk.  */
+static gpg_error_t
+sync_file (int fd)
+{
+#ifdef HAVE_W32_SYSTEM
+  if (!FlushFileBuffers ((HANDLE)_get_osfhandle (fd)))
+    return gpg_error (GPG_ERR_EIO);
+#elif defined(HAVE_FSYNC)
+  if (fsync (fd))
+    return gpg_error_from_syserror ();
+#else
+  (void)fd;
+#endif
+  return 0;
+}
+
+
+/* Write a record for GRIP with IMAGE of length LEN to FD at offset
+ * OFF.  IMAGE is NULL to write a deletion record.  */
+static gpg_error_t
+write_record (int fd, off_t off, const unsigned char *grip,
+              const void *image, size_t len)
+{
+  gpg_error_t err;
+  unsigned char *buffer;
+  size_t n;
+
+  n = RECHDRLEN + (image? len : 0);
+  buffer = xtrymalloc (n);
+  if (!buffer)
+    return gpg_error_from_syserror ();
+  ulongtobuf (buffer, image? (unsigned long)len : DELETED_MARK);
+  memcpy (buffer + 4, grip, KEYGRIP_LEN);
+  ulongtobuf (buffer + 4 + KEYGRIP_LEN, record_crc (grip, image, len));
+  if (image)
+    memcpy (buffer + RECHDRLEN, image, len);
+
+  if (lseek (fd, off, SEEK_SET) == (off_t)(-1))
+    err = gpg_error_from_syserror ();
+  else
+    err = write_all (fd, buffer, n);
+  wipememory (buffer, n);
+  xfree (buffer);
+  return err;
+}
+
+
+/* Overwrite the image of the superseded record for GRIP at offset
+ * OFF with length LEN with zeroes.  The record keeps a valid
+ * checksum and is ignored when the index is loaded because a later
+ * record for GRIP exists.  Errors are logged but not returned
+ * because the new record has already been written.  */
+static void
+wipe_record (const unsigned char *grip, off_t off, size_t len)
+{
+  gpg_error_t err;
+  unsigned char *zeroes;
+
+  zeroes = xtrycalloc (1, len + 1);
+  if (!zeroes)
+    err = gpg_error_from_syserror ();
+  else
+    {
+      err = write_record (keystore_fd, off - RECHDRLEN, grip, zeroes, len);
+      if (!err)
+        err = sync_file (keystore_fd);
+      xfree (zeroes);
+    }
+  if (err)
+    log_error ("error wiping old key in '%s': %s\n",
+               keystore_fname, gpg_strerror (err));
+}
+
+
+/* Remove a partly written record from the end of the file.  */
+static void
+truncate_keystore (void)
+{
+  if (ftruncate (keystore_fd, keystore_end))
+    log_error ("error truncating '%s': %s\n",
+               keystore_fname, strerror (errno));
+}
+
+
+/* Read all records of the open file and build the index.  A damaged
+ * record at the end of the file is removed.  */
+static gpg_error_t
+load_index (void)
+{
+  gpg_error_t err;
+  unsigned char hdr[RECHDRLEN];
+  unsigned char *image = NULL;
+  size_t imagesize = 0;
+  unsigned long len;
+  off_t off, size;
+
+  size = lseek (keystore_fd, 0, SEEK_END);
+  if (size == (off_t)(-1))
+    return gpg_error_from_syserror ();
+
+  for (off = KEYSTORE_MAGICLEN; off < size; )
+    {
+      if (read_at (keystore_fd, off, hdr, RECHDRLEN))
+        break;
+      len = buf32_to_ulong (hdr);
+      if (len == DELETED_MARK)
+        {
+          if (buf32_to_u32 (hdr + 4 + KEYGRIP_LEN)
+              != record_crc (hdr + 4, NULL, 0))
+            break;
+          index_remove (hdr + 4);
+          keystore_garbage += RECHDRLEN;
+          off += RECHDRLEN;
+          continue;
+        }
+      if (len > MAX_IMAGELEN)
+        break;
+      if (len > imagesize)
+        {
+          if (image)
+            wipememory (image, imagesize);
+          xfree (image);
+          imagesize = len;
+          image = xtrymalloc (imagesize);
+          if (!image)
+            {
+              err = gpg_error_from_syserror ();
+              return err;
+            }
+        }
+      if (read_at (keystore_fd, off + RECHDRLEN, image, len))
+        break;
+      if (buf32_to_u32 (hdr + 4 + KEYGRIP_LEN)
+          != record_crc (hdr + 4, image, len))
+        {
+          if (off + RECHDRLEN + len == size)
+            break;
+          /* Not the last record; thus this is a superseded record
+           * whose wiping has been interrupted.  */
+          keystore_garbage += RECHDRLEN + len;
+          off += RECHDRLEN + len;
+          continue;
+        }
+      err = index_set (hdr + 4, off + RECHDRLEN, len);
+      if (err)
+        {
+          wipememory (image, imagesize);
+          xfree (image);
+          return err;
+        }
+      off += RECHDRLEN + len;
+    }
+  if (image)
+    wipememory (image, imagesize);
+  xfree (image);
+
+  if (off < size)
+    {
+      log_info ("removing damaged data at offset %llu of '%s'\n",
+                (unsigned long long)off, keystore_fname);
+      if (ftruncate (keystore_fd, off))
+        {
+          err = gpg_error_from_syserror ();
+          log_error ("error truncating '%s': %s\n",
+                     keystore_fname, gpg_strerror (err));
+          return err;
+        }
+    }
+  keystore_end = off;
+  return 0;
+}
+
+
+/* Copy all key files from the private keys directory to the new
+ * file FD with name FNAME.  Only the keys are read; errors are
+ * logged but ignored.  The names of the copied files are stored at
+ * R_COPIED.  */
+static gpg_error_t
+import_key_files (int fd, const char *fname, off_t *r_end,
+                  strlist_t *r_copied)
+{
+  gpg_error_t err;
+  char *dirname, *keyfname;
+  DIR *dir;
+  struct dirent *dir_entry;
+  unsigned char grip[KEYGRIP_LEN];
+  char hexgrip[41];
+  struct stat st;
+  unsigned char *image;
+  unsigned int count = 0;
+  int kfd;
+
+  dirname = make_filename_try (gnupg_homedir (), GNUPG_PRIVATE_KEYS_DIR, NULL);
+  if (!dirname)
+    return gpg_error_from_syserror ();
+  dir = opendir (dirname);
+  if (!dir)
+    {
+      xfree (dirname);
+      return 0;  /* No keys yet.  */
+    }
+
+  err = 0;
+  while (!err && (dir_entry = readdir (dir)))
+    {
+      if (strlen (dir_entry->d_name) != 44
+          || strcmp (dir_entry->d_name + 40, ".key"))
+        continue;
+      strncpy (hexgrip, dir_entry->d_name, 40);
+      hexgrip[40] = 0;
+      if (hex2bin (hexgrip, grip, KEYGRIP_LEN) < 0)
+        continue;
+
+      keyfname = make_filename_try (dirname, dir_entry->d_name, NULL);
+      if (!keyfname)
+        {
+          err = gpg_error_from_syserror ();
+          break;
+        }
+      kfd = open (keyfname, O_RDONLY | MY_O_BINARY);
+      if (kfd == -1 || fstat (kfd, &st))
+        {
+          log_info ("skipping '%s': %s\n", keyfname, strerror (errno));
+          if (kfd != -1)
+            close (kfd);
+          xfree (keyfname);
+          continue;
+        }
+      if (st.st_size > MAX_IMAGELEN)
+        {
+          log_info ("skipping '%s': %s\n", keyfname, "too long");
+          close (kfd);
+          xfree (keyfname);
+          continue;
+        }
+      image = xtrymalloc (st.st_size + 1);
+      if (!image)
+        err = gpg_error_from_syserror ();
+      else if (read_at (kfd, 0, image, st.st_size))
+        log_info ("error reading '%s'\n", keyfname);
+      else
+        {
+          err = write_record (fd, *r_end, grip, image, st.st_size);
+          if (!err && !add_to_strlist_try (r_copied, keyfname))
+            err = gpg_error_from_syserror ();
+          if (!err)
+            {
+              *r_end += RECHDRLEN + st.st_size;
+              count++;
+            }
+        }
+      if (image)
+        wipememory (image, st.st_size);
+      xfree (image);
+      close (kfd);
+      xfree (keyfname);
+    }
+  closedir (dir);
+  xfree (dirname);
+
+  if (!err && count)
+    log_info ("%u keys copied to '%s'\n", count, fname);
+  return err;
+}
+
+
+/* Create a new key store file NAME.  The key files copied into it
+ * are removed.  */
+static gpg_error_t
+create_keystore (const char *fname)
+{
+  gpg_error_t err;
+  char *tmpfname;
+  off_t end = KEYSTORE_MAGICLEN;
+  strlist_t copied = NULL;
+  strlist_t sl;
+  int fd;
+
+  tmpfname = strconcat (fname, ".tmp", NULL);
+  if (!tmpfname)
+    return gpg_error_from_syserror ();
+  fd = open (tmpfname, O_RDWR | O_CREAT | O_TRUNC | MY_O_BINARY,
+             S_IRUSR | S_IWUSR);
+  if (fd == -1)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("can't create '%s': %s\n", tmpfname, gpg_strerror (err));
+      xfree (tmpfname);
+      return err;
+    }
+  err = write_all (fd, KEYSTORE_MAGIC, KEYSTORE_MAGICLEN);
+  if (!err)
+    err = import_key_files (fd, fname, &end, &copied);
+  if (!err)
+    err = sync_file (fd);
+  if (close (fd) && !err)
+    err = gpg_error_from_syserror ();
+  if (!err)
+    err = gnupg_rename_file (tmpfname, fname, NULL);
+  if (err)
+    {
+      log_error ("error creating '%s': %s\n", fname, gpg_strerror (err));
+      gnupg_remove (tmpfname);
+    }
+  else
+    {
+      /* The keys are now safely in the container; do not leave
+       * copies which would not be updated or deleted anymore.  */
+      for (sl = copied; sl; sl = sl->next)
+        if (gnupg_remove (sl->d))
+          log_error ("error removing '%s': %s\n",
+                     sl->d, gpg_strerror (gpg_error_from_syserror ()));
+    }
+  free_strlist (copied);
+  xfree (tmpfname);
+  return err;
+}
+
+
+/* Open the key store file if not yet done.  */
+static gpg_error_t
+open_keystore (void)
+{
+  gpg_error_t err;
+  char magic[KEYSTORE_MAGICLEN];
+
+  if (keystore_fd != -1)
+    return 0;
+
+  if (!keystore_fname)
+    {
+      keystore_fname = make_filename_try (gnupg_homedir (),
+                                          KEYSTORE_FILENAME, NULL);
+      if (!keystore_fname)
+        return gpg_error_from_syserror ();
+    }
+
+  keystore_fd = open (keystore_fname, O_RDWR | MY_O_BINARY);
+  if (keystore_fd == -1 && errno == ENOENT)
+    {
+      err = create_keystore (keystore_fname);
+      if (err)
+        return err;
+      keystore_fd = open (keystore_fname, O_RDWR | MY_O_BINARY);
+    }
+  if (keystore_fd == -1)
+    {
+      err = gpg_error_from_syserror ();
+      log_error ("can't open '%s': %s\n", keystore_fname, gpg_strerror (err));
+      return err;
+    }
+
+  if (read_at (keystore_fd, 0, magic, KEYSTORE_MAGICLEN)
+      || memcmp (magic, KEYSTORE_MAGIC, KEYSTORE_MAGICLEN))
+    {
+      log_error ("'%s' is not a key store file\n", keystore_fname);
+      err = gpg_error (GPG_ERR_INV_KEYRING);
+    }
+  else
+    err = load_index ();
+  if (err)
+    {
+      index_release ();
+      close (keystore_fd);
+      keystore_fd = -1;
+    }
+  return err;
+}
+
+
+/* Rewrite the file without the replaced records if that is worth
+ * it.  Errors are logged but are not returned because the file is
+ * still usable.  */
+static void
+maybe_compact (void)
+{
+  gpg_error_t err;
+  char *tmpfname;
+  index_item_t item;
+  unsigned char *buffer = NULL;
+  size_t buffersize = 0;
+  off_t end = KEYSTORE_MAGICLEN;
+  int idx, fd;
+
+  if (keystore_garbage < COMPACT_MIN_GARBAGE
+      || keystore_garbage < keystore_end / 2)
+    return;
+
+  tmpfname = strconcat (keystore_fname, ".tmp", NULL);
+  if (!tmpfname)
+    return;
+  fd = open (tmpfname, O_RDWR | O_CREAT | O_TRUNC | MY_O_BINARY,
+             S_IRUSR | S_IWUSR);
+  if (fd == -1)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  /* Copy the current records verbatim.  */
+  err = write_all (fd, KEYSTORE_MAGIC, KEYSTORE_MAGICLEN);
+  for (idx = 0; !err && idx < INDEX_SIZE; idx++)
+    for (item = keystore_index[idx]; !err && item; item = item->next)
+      {
+        if (RECHDRLEN + item->len > buffersize)
+          {
+            if (buffer)
+              wipememory (buffer, buffersize);
+            xfree (buffer);
+            buffersize = RECHDRLEN + item->len;
+            buffer = xtrymalloc (buffersize);
+            if (!buffer)
+              {
+                err = gpg_error_from_syserror ();
+                break;
+              }
+          }
+        err = read_at (keystore_fd, item->off - RECHDRLEN,
+                       buffer, RECHDRLEN + item->len);
+        if (!err && lseek (fd, end, SEEK_SET) == (off_t)(-1))
+          err = gpg_error_from_syserror ();
+        if (!err)
+          err = write_all (fd, buffer, RECHDRLEN + item->len);
+        end += RECHDRLEN + item->len;
+      }
+  if (!err)
+    err = sync_file (fd);
+  if (close (fd) && !err)
+    err = gpg_error_from_syserror ();
+  if (err)
+    {
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+
+  /* Switch to the new file.  The old file needs to be closed first
+   * so that it can be replaced on Windows.  If the rename fails the
+   * old file is opened again.  */
+  close (keystore_fd);
+  keystore_fd = -1;
+  index_release ();
+  err = gnupg_rename_file (tmpfname, keystore_fname, NULL);
+  if (err)
+    gnupg_remove (tmpfname);
+  else if (opt.verbose)
+    log_info ("'%s' compacted from %llu to %llu bytes\n", keystore_fname,
+              (unsigned long long)keystore_end, (unsigned long long)end);
+  if (open_keystore () && !err)
+    err = gpg_error (GPG_ERR_GENERAL);
+
+ leave:
+  if (err)
+    log_error ("error compacting '%s': %s\n",
+               keystore_fname, gpg_strerror (err));
+  if (buffer)
+    wipememory (buffer, buffersize);
+  xfree (buffer);
+  xfree (tmpfname);
+}
+
+
+
+/* Return the image of the key GRIP at R_IMAGE and its length at
+ * R_IMAGELEN.  The caller must free the image.  Returns
+ * GPG_ERR_ENOENT if the key is not in the store.  */
+gpg_error_t
+agent_keystore_get (const unsigned char *grip,
+                    unsigned char **r_image, size_t *r_imagelen)
+{
+  gpg_error_t err;
+  index_item_t item;
+  unsigned char *image;
+
+  *r_image = NULL;
+  *r_imagelen = 0;
+
+  err = open_keystore ();
+  if (err)
+    return err;
+  item = index_lookup (grip);
+  if (!item)
+    return gpg_error (GPG_ERR_ENOENT);
+
+  image = xtrymalloc (item->len + 1);
+  if (!image)
+    return gpg_error_from_syserror ();
+  err = read_at (keystore_fd, item->off, image, item->len);
+  if (err)
+    {
+      log_error ("error reading '%s': %s\n",
+                 keystore_fname, gpg_strerror (err));
+      xfree (image);
+      return err;
+    }
+  *r_image = image;
+  *r_imagelen = item->len;
+  return 0;
+}
+
+
+/* Return true if the key GRIP is in the store.  */
+int
+agent_keystore_has (const unsigned char *grip)
+{
+  if (open_keystore ())
+    return 0;
+  return !!index_lookup (grip);
+}
+
+
+/* Store IMAGE of length IMAGELEN as the new image of the key GRIP.
+ * The update is atomic.  The old image, for example the key
+ * protected with the old passphrase, is wiped.  */
+gpg_error_t
+agent_keystore_put (const unsigned char *grip,
+                    const void *image, size_t imagelen)
+{
+  gpg_error_t err;
+  index_item_t item;
+  off_t oldoff = 0;
+  size_t oldlen = 0;
+
+  if (imagelen > MAX_IMAGELEN)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+  err = open_keystore ();
+  if (err)
+    return err;
+  if ((item = index_lookup (grip)))
+    {
+      oldoff = item->off;
+      oldlen = item->len;
+    }
+
+  err = write_record (keystore_fd, keystore_end, grip, image, imagelen);
+  if (!err)
+    err = sync_file (keystore_fd);
+  if (!err)
+    err = index_set (grip, keystore_end + RECHDRLEN, imagelen);
+  if (err)
+    {
+      log_error ("error writing '%s': %s\n",
+                 keystore_fname, gpg_strerror (err));
+      truncate_keystore ();
+      return err;
+    }
+  keystore_end += RECHDRLEN + imagelen;
+  if (oldoff)
+    wipe_record (grip, oldoff, oldlen);
+  maybe_compact ();
+  return 0;
+}
+
+
+/* Delete the key GRIP from the store.  Returns GPG_ERR_ENOENT if the
+ * key is not in the store.  */
+gpg_error_t
+agent_keystore_delete (const unsigned char *grip)
+{
+  gpg_error_t err;
+  index_item_t item;
+  off_t oldoff;
+  size_t oldlen;
+
+  err = open_keystore ();
+  if (err)
+    return err;
+  if (!(item = index_lookup (grip)))
+    return gpg_error (GPG_ERR_ENOENT);
+  oldoff = item->off;
+  oldlen = item->len;
+
+  err = write_record (keystore_fd, keystore_end, grip, NULL, 0);
+  if (!err)
+    err = sync_file (keystore_fd);
+  if (err)
+    {
+      log_error ("error writing '%s': %s\n",
+                 keystore_fname, gpg_strerror (err));
+      truncate_keystore ();
+      return err;
+    }
+  keystore_end += RECHDRLEN;
+  index_remove (grip);
+  keystore_garbage += RECHDRLEN;
+  wipe_record (grip, oldoff, oldlen);
+  maybe_compact ();
+  return 0;
+}
+
+
+/* Return the keygrips of all keys in the store as an array of
+ * KEYGRIP_LEN byte items at R_GRIPS and the number of items at
+ * R_COUNT.  The caller must free the array.  */
+gpg_error_t
+agent_keystore_list (unsigned char **r_grips, size_t *r_count)
+{
+  gpg_error_t err;
+  index_item_t item;
+  unsigned char *grips;
+  size_t n = 0;
+  int idx;
+
+  *r_grips = NULL;
+  *r_count = 0;
+
+  err = open_keystore ();
+  if (err)
+    return err;
+
+  grips = xtrymalloc ((keystore_nitems + 1) * KEYGRIP_LEN);
+  if (!grips)
+    return gpg_error_from_syserror ();
+  for (idx = 0; idx < INDEX_SIZE; idx++)
+    for (item = keystore_index[idx]; item; item = item->next)
+      memcpy (grips + KEYGRIP_LEN * n++, item->grip, KEYGRIP_LEN);
+  *r_grips = grips;
+  *r_count = n;
+  return 0;
+}
@@ -25,6 +25,7 @@
 #include <ctype.h>
 #include <unistd.h>
 #include <sys/stat.h>
+#include <npth.h>
 
 #include "agent.h"
 
@@ -143,3 +144,85 @@ agent_pkdecrypt (ctrl_t ctrl, const char *desc_text,
   xfree (shadow_info);
   return rc;
 }
+
+
+/* Return true if the key GRIP can be used without asking the user.
+ * That is the case for an unprotected key and for a protected key
+ * whose passphrase is in the cache.  */
+static int
+usable_without_pinentry (ctrl_t ctrl, const unsigned char *grip)
+{
+  char hexgrip[2*KEYGRIP_LEN+1];
+  int keytype;
+  char *pw;
+
+  if (agent_key_info_from_file (ctrl, grip, &keytype, NULL, NULL))
+    return 0;
+  if (keytype == PRIVATE_KEY_CLEAR || keytype == PRIVATE_KEY_OPENPGP_NONE)
+    return 1;
+  if (keytype != PRIVATE_KEY_PROTECTED)
+    return 0;
+
+  bin2hex (grip, KEYGRIP_LEN, hexgrip);
+  pw = agent_get_cache (ctrl, hexgrip, CACHE_MODE_NORMAL);
+  xfree (pw);
+  return !!pw;
+}
+
+
+/* Try to decrypt CIPHERTEXT with the NGRIPS keys whose keygrips are
+ * concatenated in GRIPS.  Only keys which can be used without a
+ * pinentry are tried, in the given order.  On the first successful
+ * decryption the result is written to OUTBUF and the index of the key
+ * is stored at R_IDX.  Because the agent can't tell whether the
+ * decrypted value is the right one, the caller needs to check this
+ * and may ask again with the remaining keys.  Other threads may run
+ * between two tries.  */
+gpg_error_t
+agent_pkdecrypt_multi (ctrl_t ctrl,
+                       const unsigned char *grips, size_t ngrips,
+                       const unsigned char *ciphertext, size_t ciphertextlen,
+                       membuf_t *outbuf, int *r_padding, size_t *r_idx)
+{
+  gpg_error_t err = gpg_error (GPG_ERR_NO_SECKEY);
+  unsigned char saved_keygrip[KEYGRIP_LEN];
+  int saved_have_keygrip;
+  size_t idx;
+  int ntried = 0;
+
+  *r_padding = -1;
+  *r_idx = 0;
+
+  saved_have_keygrip = ctrl->have_keygrip;
+  memcpy (saved_keygrip, ctrl->keygrip, KEYGRIP_LEN);
+
+  for (idx = 0; idx < ngrips; idx++)
+    {
+      const unsigned char *grip = grips + idx * KEYGRIP_LEN;
+
+      if (!usable_without_pinentry (ctrl, grip))
+        continue;
+
+      /* The threads are not preemptive; thus let the other
+       * connections run between the tries.  */
+      if (ntried++)
+        npth_usleep (0);
+
+      memcpy (ctrl->keygrip, grip, KEYGRIP_LEN);
+      ctrl->have_keygrip = 1;
+      err = agent_pkdecrypt (ctrl, NULL, ciphertext, ciphertextlen,
+                             outbuf, r_padding);
+      if (!err)
+        {
+          *r_idx = idx;
+          break;
+        }
+      if (gpg_err_code (err) == GPG_ERR_FULLY_CANCELED)
+        break;
+      err = gpg_error (GPG_ERR_NO_SECKEY);
+    }
+
+  memcpy (ctrl->keygrip, saved_keygrip, KEYGRIP_LEN);
+  ctrl->have_keygrip = saved_have_keygrip;
+  return err;
+}
@@ -25,6 +25,7 @@
 #include <string.h>
 #include <ctype.h>
 #include <sys/stat.h>
+#include <npth.h>
 
 #include "agent.h"
 #include "../common/i18n.h"
@@ -268,6 +269,84 @@ do_encode_raw_pkcs1 (const byte *md, size_t mdlen, unsigned int nbits,
 
 
 
+/* Sign DATA of DATALEN bytes with the secret key S_SKEY of type ALGO
+ * using the digest parameters from CTRL.  The signature is stored at
+ * R_SIG.  */
+static gpg_error_t
+sign_with_skey (ctrl_t ctrl, gcry_sexp_t s_skey, int algo,
+                const unsigned char *data, int datalen, gcry_sexp_t *r_sig)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_hash = NULL;
+  gcry_sexp_t s_sig = NULL;
+
+  *r_sig = NULL;
+
+  /* Put the hash into a sexp */
+  if (algo == GCRY_PK_EDDSA)
+    err = do_encode_eddsa (gcry_pk_get_nbits (s_skey), data, datalen,
+                           &s_hash);
+  else if (ctrl->digest.algo == MD_USER_TLS_MD5SHA1)
+    err = do_encode_raw_pkcs1 (data, datalen,
+                               gcry_pk_get_nbits (s_skey),
+                               &s_hash);
+  else if (algo == GCRY_PK_DSA || algo == GCRY_PK_ECC)
+    err = do_encode_dsa (data, datalen,
+                         algo, s_skey,
+                         &s_hash);
+  else if (ctrl->digest.is_pss)
+    {
+      log_info ("signing with rsaPSS is currently only supported"
+                " for (some) smartcards\n");
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  else
+    err = do_encode_md (data, datalen,
+                        ctrl->digest.algo,
+                        &s_hash,
+                        ctrl->digest.raw_value);
+  if (err)
+    goto leave;
+
+  if (DBG_CRYPTO)
+    {
+      gcry_log_debugsxp ("skey", s_skey);
+      gcry_log_debugsxp ("hash", s_hash);
+    }
+
+  /* sign */
+  err = gcry_pk_sign (&s_sig, s_hash, s_skey);
+  if (err)
+    {
+      log_error ("signing failed: %s\n", gpg_strerror (err));
+      goto leave;
+    }
+
+  if (DBG_CRYPTO)
+    gcry_log_debugsxp ("rslt", s_sig);
+
+  /* Check that the signature verification worked.  Because Libgcrypt
+   * 1.7 does this for RSA internally there is no need to do it here
+   * again.  */
+  if (algo == GCRY_PK_RSA && GCRYPT_VERSION_NUMBER < 0x010700)
+    {
+      err = gcry_pk_verify (s_sig, s_hash, s_skey);
+      if (err)
+        {
+          log_error (_("checking created signature failed: %s\n"),
+                     gpg_strerror (err));
+          gcry_sexp_release (s_sig);
+          s_sig = NULL;
+        }
+    }
+
+ leave:
+  gcry_sexp_release (s_hash);
+  *r_sig = s_sig;
+  return err;
+}
+
+
 /* SIGN whatever information we have accumulated in CTRL and return
  * the signature S-expression.  LOOKUP is an optional function to
  * provide a way for lower layers to ask for the caching TTL.  If a
@@ -484,62 +563,15 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
   else
     {
       /* No smartcard, but a private key (in S_SKEY). */
-
-      /* Put the hash into a sexp */
-      if (algo == GCRY_PK_EDDSA)
-        err = do_encode_eddsa (gcry_pk_get_nbits (s_skey), data, datalen,
-                               &s_hash);
-      else if (ctrl->digest.algo == MD_USER_TLS_MD5SHA1)
-        err = do_encode_raw_pkcs1 (data, datalen,
-                                   gcry_pk_get_nbits (s_skey),
-                                   &s_hash);
-      else if (algo == GCRY_PK_DSA || algo == GCRY_PK_ECC)
-        err = do_encode_dsa (data, datalen,
-                             algo, s_skey,
-                             &s_hash);
-      else if (ctrl->digest.is_pss)
-        {
-          log_info ("signing with rsaPSS is currently only supported"
-                    " for (some) smartcards\n");
-          err = gpg_error (GPG_ERR_NOT_SUPPORTED);
-        }
-      else
-        err = do_encode_md (data, datalen,
-                            ctrl->digest.algo,
-                            &s_hash,
-                            ctrl->digest.raw_value);
+      err = sign_with_skey (ctrl, s_skey, algo, data, datalen, &s_sig);
       if (err)
         goto leave;
-
-      if (algo == GCRY_PK_RSA && GCRYPT_VERSION_NUMBER < 0x010700)
-        {
-          /* It's RSA and Libgcrypt < 1.7 */
-          check_signature = 1;
-        }
-
-      if (DBG_CRYPTO)
-        {
-          gcry_log_debugsxp ("skey", s_skey);
-          gcry_log_debugsxp ("hash", s_hash);
-        }
-
-      /* sign */
-      err = gcry_pk_sign (&s_sig, s_hash, s_skey);
-      if (err)
-        {
-          log_error ("signing failed: %s\n", gpg_strerror (err));
-          goto leave;
-        }
-
-      if (DBG_CRYPTO)
-        gcry_log_debugsxp ("rslt", s_sig);
     }
 
   /* Check that the signature verification worked and nothing is
    * fooling us e.g. by a bug in the signature create code or by
-   * deliberately introduced faults.  Because Libgcrypt 1.7 does this
-   * for RSA internally there is no need to do it here again.  We do
-   * this always for card based RSA keys, though.  */
+   * deliberately introduced faults.  We do this always for card based
+   * RSA keys; sign_with_skey takes care of the other keys.  */
   if (check_signature)
     {
       gcry_sexp_t sexp_key = s_pkey? s_pkey: s_skey;
@@ -585,6 +617,26 @@ agent_pksign_do (ctrl_t ctrl, const char *cache_nonce,
 }
 
 
+/* Append the signature S_SIG in canonical format to OUTBUF.  */
+static gpg_error_t
+put_signature (membuf_t *outbuf, gcry_sexp_t s_sig)
+{
+  char *buf;
+  size_t len;
+
+  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, NULL, 0);
+  log_assert (len);
+  buf = xtrymalloc (len);
+  if (!buf)
+    return gpg_error_from_syserror ();
+  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, buf, len);
+  log_assert (len);
+  put_membuf (outbuf, buf, len);
+  xfree (buf);
+  return 0;
+}
+
+
 /* SIGN whatever information we have accumulated in CTRL and write it
  * back to OUTFP.  If a CACHE_NONCE is given that cache item is first
  * tried to get a passphrase.  */
@@ -594,29 +646,83 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce, const char *desc_text,
 {
   gpg_error_t err;
   gcry_sexp_t s_sig = NULL;
-  char *buf = NULL;
-  size_t len = 0;
 
   err = agent_pksign_do (ctrl, cache_nonce, desc_text, &s_sig, cache_mode,
                          NULL, NULL, 0);
-  if (err)
-    goto leave;
+  if (!err)
+    err = put_signature (outbuf, s_sig);
 
-  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, NULL, 0);
-  log_assert (len);
-  buf = xtrymalloc (len);
-  if (!buf)
+  gcry_sexp_release (s_sig);
+  return err;
+}
+
+
+/* Sign each of the NDIGESTS digests concatenated in DIGESTS and
+ * append the signatures to OUTBUF.  The hash algorithm and the length
+ * of each digest are taken from CTRL as set by SETHASH.  The secret
+ * key is read and unprotected only once for all digests.  Keys on a
+ * smartcard are used for each digest in turn.  Other threads may run
+ * between two signatures.  */
+gpg_error_t
+agent_pksign_multi (ctrl_t ctrl, const char *cache_nonce,
+                    const char *desc_text,
+                    const unsigned char *digests, size_t ndigests,
+                    membuf_t *outbuf, cache_mode_t cache_mode)
+{
+  gpg_error_t err;
+  gcry_sexp_t s_skey = NULL;
+  gcry_sexp_t s_sig = NULL;
+  unsigned char *shadow_info = NULL;
+  int datalen = ctrl->digest.valuelen;
+  int algo;
+  size_t n;
+
+  if (!ctrl->have_keygrip)
+    return gpg_error (GPG_ERR_NO_SECKEY);
+  if (ctrl->digest.data || !datalen)
+    return gpg_error (GPG_ERR_INV_STATE);
+
+  err = agent_key_from_file (ctrl, cache_nonce, desc_text, ctrl->keygrip,
+                             &shadow_info, cache_mode, NULL,
+                             &s_skey, NULL);
+  if (shadow_info || gpg_err_code (err) == GPG_ERR_NO_SECKEY)
     {
-      err = gpg_error_from_syserror ();
+      /* Let agent_pksign_do divert each operation to the card.  */
+      for (n = 0, err = 0; !err && n < ndigests; n++)
+        {
+          err = agent_pksign_do (ctrl, cache_nonce, desc_text, &s_sig,
+                                 cache_mode, NULL,
+                                 digests + n * datalen, datalen);
+          if (!err)
+            err = put_signature (outbuf, s_sig);
+          gcry_sexp_release (s_sig);
+          s_sig = NULL;
+        }
+      goto leave;
+    }
+  else if (err)
+    {
+      log_error ("failed to read the secret key\n");
       goto leave;
     }
-  len = gcry_sexp_sprint (s_sig, GCRYSEXP_FMT_CANON, buf, len);
-  log_assert (len);
-  put_membuf (outbuf, buf, len);
 
- leave:
-  gcry_sexp_release (s_sig);
-  xfree (buf);
+  algo = get_pk_algo_from_key (s_skey);
+  for (n = 0; !err && n < ndigests; n++)
+    {
+      /* The threads are not preemptive; thus let the other
+       * connections run between the signatures of a large batch.  */
+      if (n)
+        npth_usleep (0);
+      err = sign_with_skey (ctrl, s_skey, algo,
+                            digests + n * datalen, datalen, &s_sig);
+      if (!err)
+        err = put_signature (outbuf, s_sig);
+      gcry_sexp_release (s_sig);
+      s_sig = NULL;
+    }
 
+ leave:
+  gcry_sexp_release (s_skey);
+  xfree (shadow_info);
   return err;
 }
@@ -76,6 +76,30 @@ static unsigned int s2k_calibration_time = AGENT_S2K_CALIBRATION;
 static unsigned long s2k_calibrated_count;
 
 
+/* The number of keys derived from a passphrase we keep for
+ * do_decryption.  Unprotecting the same key again with the same
+ * passphrase - for example for an export or a preset passphrase -
+ * does then not need to run the iterated S2K again.  */
+#define KEK_CACHE_SIZE 16
+#define KEK_CACHE_MAXKEYLEN 32
+
+/* An item of the KEK cache.  The ID is the SHA-256 hash over all
+ * input data of the S2K function; the passphrase is not stored.  */
+struct kek_cache_item_s
+{
+  time_t created;  /* Zero if the item is not used.  */
+  unsigned char id[32];
+  size_t keylen;
+  unsigned char key[KEK_CACHE_MAXKEYLEN];
+};
+
+/* The KEK cache in secure memory, allocated on first use.  */
+static struct kek_cache_item_s *kek_cache;
+
+/* The index of the next item to replace.  */
+static unsigned int kek_cache_next;
+
+
 /* A helper object for time measurement.  */
 struct calibrate_time_s
 {
@@ -768,6 +792,106 @@ agent_protect (const unsigned char *plainkey, const char *passphrase,
 
 
 
+/* Compute the ID of the S2K function for the KEK cache.  */
+static void
+kek_cache_id (const char *passphrase, const unsigned char *s2ksalt,
+              unsigned long s2kcount, size_t keylen, unsigned char *r_id)
+{
+  unsigned char buf[8];
+  gcry_buffer_t iov[3];
+
+  buf[0] = s2kcount >> 24;
+  buf[1] = s2kcount >> 16;
+  buf[2] = s2kcount >> 8;
+  buf[3] = s2kcount;
+  buf[4] = keylen >> 24;
+  buf[5] = keylen >> 16;
+  buf[6] = keylen >> 8;
+  buf[7] = keylen;
+  memset (iov, 0, sizeof iov);
+  iov[0].data = buf;
+  iov[0].len  = sizeof buf;
+  iov[1].data = (void *)s2ksalt;
+  iov[1].len  = 8;
+  iov[2].data = (void *)passphrase;
+  iov[2].len  = strlen (passphrase);
+  gcry_md_hash_buffers (GCRY_MD_SHA256, GCRY_MD_FLAG_SECURE, r_id, iov, 3);
+}
+
+
+/* Same as hash_passphrase with the mode 3 and SHA-1 but take the key
+ * from the KEK cache if possible.  */
+static int
+hash_passphrase_cached (const char *passphrase,
+                        const unsigned char *s2ksalt, unsigned long s2kcount,
+                        unsigned char *key, size_t keylen)
+{
+  unsigned char id[32];
+  struct kek_cache_item_s *item;
+  time_t now;
+  int i, rc;
+
+  if (!passphrase || !*passphrase || keylen > KEK_CACHE_MAXKEYLEN
+      || !opt.def_cache_ttl)
+    return hash_passphrase (passphrase, GCRY_MD_SHA1,
+                            3, s2ksalt, s2kcount, key, keylen);
+
+  if (!kek_cache)
+    {
+      kek_cache = gcry_calloc_secure (KEK_CACHE_SIZE, sizeof *kek_cache);
+      if (!kek_cache)
+        return hash_passphrase (passphrase, GCRY_MD_SHA1,
+                                3, s2ksalt, s2kcount, key, keylen);
+    }
+
+  kek_cache_id (passphrase, s2ksalt, s2kcount, keylen, id);
+  now = gnupg_get_time ();
+  for (i=0; i < KEK_CACHE_SIZE; i++)
+    {
+      item = kek_cache + i;
+      if (!item->created)
+        continue;
+      if (item->created + opt.def_cache_ttl < now)
+        {
+          wipememory (item, sizeof *item);
+          continue;
+        }
+      if (item->keylen == keylen && !memcmp (item->id, id, sizeof id))
+        {
+          memcpy (key, item->key, keylen);
+          wipememory (id, sizeof id);
+          if (DBG_CACHE)
+            log_debug ("KEK cache hit\n");
+          return 0;
+        }
+    }
+
+  rc = hash_passphrase (passphrase, GCRY_MD_SHA1,
+                        3, s2ksalt, s2kcount, key, keylen);
+  if (!rc)
+    {
+      item = kek_cache + kek_cache_next;
+      kek_cache_next = (kek_cache_next + 1) % KEK_CACHE_SIZE;
+      item->created = now;
+      memcpy (item->id, id, sizeof id);
+      item->keylen = keylen;
+      memcpy (item->key, key, keylen);
+    }
+  wipememory (id, sizeof id);
+  return rc;
+}
+
+
+/* Flush the KEK cache.  */
+void
+agent_flush_kek_cache (void)
+{
+  if (kek_cache)
+    wipememory (kek_cache, KEK_CACHE_SIZE * sizeof *kek_cache);
+  kek_cache_next = 0;
+}
+
+
 /* Do the actual decryption and check the return list for consistency.  */
 static gpg_error_t
 do_decryption (const unsigned char *aad_begin, size_t aad_len,
@@ -821,8 +945,8 @@ do_decryption (const unsigned char *aad_begin, size_t aad_len,
         rc = out_of_core ();
       else
         {
-          rc = hash_passphrase (passphrase, GCRY_MD_SHA1,
-                                3, s2ksalt, s2kcount, key, prot_cipher_keylen);
+          rc = hash_passphrase_cached (passphrase, s2ksalt, s2kcount,
+                                       key, prot_cipher_keylen);
           if (!rc)
             rc = gcry_cipher_setkey (hd, key, prot_cipher_keylen);
           xfree (key);
@@ -52,8 +52,14 @@ typedef struct trustitem_s trustitem_t;
 /* Malloced table and its allocated size with all trust items. */
 static trustitem_t *trusttable;
 static size_t trusttablesize;
-/* A mutex used to protect the table. */
-static npth_mutex_t trusttable_lock;
+/* Malloced index into the table sorted by fingerprint.  For
+   duplicate fingerprints only the first item is indexed as that is
+   the one a linear search would find. */
+static trustitem_t **trustindex;
+static size_t trustindexsize;
+/* A lock used to protect the table.  Lookups take it shared; reading
+   the files needs it exclusive. */
+static npth_rwlock_t trusttable_lock;
 
 
 static const char headerblurb[] =
@@ -84,9 +90,9 @@ initialize_module_trustlist (void)
 
   if (!initialized)
     {
-      err = npth_mutex_init (&trusttable_lock, NULL);
+      err = npth_rwlock_init (&trusttable_lock, NULL);
       if (err)
-        log_fatal ("failed to init mutex in %s: %s\n", __FILE__,strerror (err));
+        log_fatal ("failed to init lock in %s: %s\n", __FILE__,strerror (err));
       initialized = 1;
     }
 }
@@ -99,9 +105,31 @@ lock_trusttable (void)
 {
   int err;
 
-  err = npth_mutex_lock (&trusttable_lock);
+  err = npth_rwlock_wrlock (&trusttable_lock);
   if (err)
-    log_fatal ("failed to acquire mutex in %s: %s\n", __FILE__, strerror (err));
+    log_fatal ("failed to acquire lock in %s: %s\n", __FILE__, strerror (err));
+}
+
+
+/* Lock the trusttable for reading.  If the table has not yet been
+   read, the lock is taken exclusive so that the caller may read
+   it.  */
+static void
+lock_trusttable_shared (void)
+{
+  int err;
+
+  err = npth_rwlock_rdlock (&trusttable_lock);
+  if (err)
+    log_fatal ("failed to acquire lock in %s: %s\n", __FILE__, strerror (err));
+  if (!trusttable)
+    {
+      err = npth_rwlock_unlock (&trusttable_lock);
+      if (err)
+        log_fatal ("failed to release lock in %s: %s\n",
+                   __FILE__, strerror (err));
+      lock_trusttable ();
+    }
 }
 
 
@@ -110,9 +138,9 @@ unlock_trusttable (void)
 {
   int err;
 
-  err = npth_mutex_unlock (&trusttable_lock);
+  err = npth_rwlock_unlock (&trusttable_lock);
   if (err)
-    log_fatal ("failed to release mutex in %s: %s\n", __FILE__, strerror (err));
+    log_fatal ("failed to release lock in %s: %s\n", __FILE__, strerror (err));
 }
 
 
@@ -124,6 +152,35 @@ clear_trusttable (void)
   xfree (trusttable);
   trusttable = NULL;
   trusttablesize = 0;
+  xfree (trustindex);
+  trustindex = NULL;
+  trustindexsize = 0;
+}
+
+
+/* Sort helper for the trustindex.  Items with the same fingerprint
+   are kept in the order of the table.  */
+static int
+compare_trustitems (const void *a, const void *b)
+{
+  const trustitem_t *ia = *(const trustitem_t * const *)a;
+  const trustitem_t *ib = *(const trustitem_t * const *)b;
+  int cmp;
+
+  cmp = memcmp (ia->fpr, ib->fpr, 20);
+  if (!cmp)
+    cmp = ia < ib? -1 : ia > ib;
+  return cmp;
+}
+
+
+/* Search helper for the trustindex.  */
+static int
+compare_trustindex_fpr (const void *key, const void *elem)
+{
+  const trustitem_t *ti = *(const trustitem_t * const *)elem;
+
+  return memcmp (key, ti->fpr, 20);
 }
 
 
@@ -332,8 +389,9 @@ read_trustfiles (void)
 {
   gpg_error_t err;
   trustitem_t *table, *ti;
+  trustitem_t **index;
   int tableidx;
-  size_t tablesize;
+  size_t tablesize, n, idx;
   char *fname;
   int allow_include = 1;
 
@@ -380,7 +438,6 @@ read_trustfiles (void)
       return err;
     }
 
-  /* Fixme: we should drop duplicates and sort the table. */
   ti = xtryrealloc (table, (tableidx?tableidx:1) * sizeof *table);
   if (!ti)
     {
@@ -389,10 +446,27 @@ read_trustfiles (void)
       return err;
     }
 
+  /* Build the index and drop duplicates from it.  */
+  index = xtrycalloc (tableidx?tableidx:1, sizeof *index);
+  if (!index)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (ti);
+      return err;
+    }
+  for (idx=0; idx < tableidx; idx++)
+    index[idx] = ti + idx;
+  qsort (index, tableidx, sizeof *index, compare_trustitems);
+  for (idx=n=0; idx < tableidx; idx++)
+    if (!n || memcmp (index[n-1]->fpr, index[idx]->fpr, 20))
+      index[n++] = index[idx];
+
   /* Replace the trusttable.  */
-  xfree (trusttable);
+  clear_trusttable ();
   trusttable = ti;
   trusttablesize = tableidx;
+  trustindex = index;
+  trustindexsize = n;
   return 0;
 }
 
@@ -406,8 +480,8 @@ istrusted_internal (ctrl_t ctrl, const char *fpr, int *r_disabled,
 {
   gpg_error_t err = 0;
   int locked = already_locked;
-  trustitem_t *ti;
-  size_t len;
+  trustitem_t **tip;
+  int disabled;
   unsigned char fprbin[20];
 
   if (r_disabled)
@@ -421,7 +495,7 @@ istrusted_internal (ctrl_t ctrl, const char *fpr, int *r_disabled,
 
   if (!already_locked)
     {
-      lock_trusttable ();
+      lock_trusttable_shared ();
       locked = 1;
     }
 
@@ -435,35 +509,37 @@ istrusted_internal (ctrl_t ctrl, const char *fpr, int *r_disabled,
         }
     }
 
-  if (trusttable)
+  if (trusttable
+      && (tip = bsearch (fprbin, trustindex, trustindexsize,
+                         sizeof *trustindex, compare_trustindex_fpr)))
     {
-      for (ti=trusttable, len = trusttablesize; len; ti++, len--)
-        if (!memcmp (ti->fpr, fprbin, 20))
-          {
-            if (ti->flags.disabled && r_disabled)
-              *r_disabled = 1;
-
-            /* Print status messages only if we have not been called
-               in a locked state.  */
-            if (already_locked)
-              ;
-            else if (ti->flags.relax)
-              {
-                unlock_trusttable ();
-                locked = 0;
-                err = agent_write_status (ctrl, "TRUSTLISTFLAG", "relax", NULL);
-              }
-            else if (ti->flags.cm)
-              {
-                unlock_trusttable ();
-                locked = 0;
-                err = agent_write_status (ctrl, "TRUSTLISTFLAG", "cm", NULL);
-              }
-
-            if (!err)
-              err = ti->flags.disabled? gpg_error (GPG_ERR_NOT_TRUSTED) : 0;
-            goto leave;
-          }
+      trustitem_t *ti = *tip;
+
+      /* Don't access TI after unlocking.  */
+      disabled = ti->flags.disabled;
+      if (disabled && r_disabled)
+        *r_disabled = 1;
+
+      /* Print status messages only if we have not been called in a
+         locked state.  */
+      if (already_locked)
+        ;
+      else if (ti->flags.relax)
+        {
+          unlock_trusttable ();
+          locked = 0;
+          err = agent_write_status (ctrl, "TRUSTLISTFLAG", "relax", NULL);
+        }
+      else if (ti->flags.cm)
+        {
+          unlock_trusttable ();
+          locked = 0;
+          err = agent_write_status (ctrl, "TRUSTLISTFLAG", "cm", NULL);
+        }
+
+      if (!err)
+        err = disabled? gpg_error (GPG_ERR_NOT_TRUSTED) : 0;
+      goto leave;
     }
   err = gpg_error (GPG_ERR_NOT_TRUSTED);
 
@@ -492,7 +568,7 @@ agent_listtrusted (void *assuan_context)
   gpg_error_t err;
   size_t len;
 
-  lock_trusttable ();
+  lock_trusttable_shared ();
   if (!trusttable)
     {
       err = read_trustfiles ();
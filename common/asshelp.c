@@ -315,7 +315,10 @@ unlock_spawning (lock_spawn_t *lock, const char *name)
  * wait.  SOCKNAME is the name of the socket to connect.  VERBOSE is
  * the usual verbose flag.  CTX is the assuan context.  CONNECT_FLAGS
  * are the assuan connect flags.  DID_SUCCESS_MSG will be set to 1 if
- * a success messages has been printed.
+ * a success messages has been printed.  The first connect is tried
+ * right away: On Unix the daemons create their listening socket
+ * before the launching process exits and thus the socket is usually
+ * ready when we get here.
  */
 static gpg_error_t
 wait_for_sock (int secs, int module_name_id, const char *sockname,
@@ -334,8 +337,24 @@ wait_for_sock (int secs, int module_name_id, const char *sockname,
   int lastalert = secs+1;
   int secsleft;
 
-  while (elapsed_us < target_us)
+  for (;;)
     {
+      err = assuan_socket_connect (ctx, sockname, 0, connect_flags);
+      if (!err)
+        {
+          if (verbose)
+            {
+              log_info (module_name_id == GNUPG_MODULE_NAME_DIRMNGR?
+                        _("connection to the dirmngr established\n"):
+                        module_name_id == GNUPG_MODULE_NAME_KEYBOXD?
+                        _("connection to the keyboxd established\n"):
+                        _("connection to the agent established\n"));
+              *did_success_msg = 1;
+            }
+          break;
+        }
+      if (elapsed_us >= target_us)
+        break;
       if (verbose)
         {
           secsleft = (target_us - elapsed_us + 999999)/1000000;
@@ -355,20 +374,6 @@ wait_for_sock (int secs, int module_name_id, const char *sockname,
         }
       gnupg_usleep (next_sleep_us);
       elapsed_us += next_sleep_us;
-      err = assuan_socket_connect (ctx, sockname, 0, connect_flags);
-      if (!err)
-        {
-          if (verbose)
-            {
-              log_info (module_name_id == GNUPG_MODULE_NAME_DIRMNGR?
-                        _("connection to the dirmngr established\n"):
-                        module_name_id == GNUPG_MODULE_NAME_KEYBOXD?
-                        _("connection to the keyboxd established\n"):
-                        _("connection to the agent established\n"));
-              *did_success_msg = 1;
-            }
-          break;
-        }
       next_sleep_us *= 2;
       if (next_sleep_us > 1000000)
         next_sleep_us = 1000000;
@@ -197,6 +197,20 @@ my_fputs (const char *string, struct b64state *state)
 }
 
 
+/* Write LENGTH bytes from BUFFER to the stream of STATE.  Returns 0
+   on success.  */
+static int
+my_fwrite (const void *buffer, size_t length, struct b64state *state)
+{
+  if (!length)
+    return 0;
+  if (state->stream)
+    return es_write (state->stream, buffer, length, NULL);
+  else
+    return fwrite (buffer, length, 1, state->fp) != 1;
+}
+
+
 /* Write NBYTES from BUFFER to the Base 64 stream identified by
    STATE. With BUFFER and NBYTES being 0, merely do a fflush on the
    stream. */
@@ -206,6 +220,8 @@ b64enc_write (struct b64state *state, const void *buffer, size_t nbytes)
   unsigned char radbuf[4];
   int idx, quad_count;
   const unsigned char *p;
+  char outbuf[256 + 5];
+  size_t outlen = 0;
 
   if (state->lasterr)
     return state->lasterr;
@@ -249,42 +265,36 @@ b64enc_write (struct b64state *state, const void *buffer, size_t nbytes)
       state->crc = (crc & 0x00ffffff);
     }
 
+  /* The encoded data is collected in OUTBUF so that we do not need
+     to call putc for each character.  */
   for (p=buffer; nbytes; p++, nbytes--)
     {
       radbuf[idx++] = *p;
       if (idx > 2)
         {
-          char tmp[4];
-
-          tmp[0] = bintoasc[(*radbuf >> 2) & 077];
-          tmp[1] = bintoasc[(((*radbuf<<4)&060)|((radbuf[1] >> 4)&017))&077];
-          tmp[2] = bintoasc[(((radbuf[1]<<2)&074)|((radbuf[2]>>6)&03))&077];
-          tmp[3] = bintoasc[radbuf[2]&077];
-          if (state->stream)
-            {
-              for (idx=0; idx < 4; idx++)
-                es_putc (tmp[idx], state->stream);
-              idx = 0;
-              if (es_ferror (state->stream))
-                goto write_error;
-            }
-          else
-            {
-              for (idx=0; idx < 4; idx++)
-                putc (tmp[idx], state->fp);
-              idx = 0;
-              if (ferror (state->fp))
-                goto write_error;
-            }
+          outbuf[outlen++] = bintoasc[(*radbuf >> 2) & 077];
+          outbuf[outlen++] = bintoasc[(((*radbuf<<4)&060)
+                                       |((radbuf[1] >> 4)&017))&077];
+          outbuf[outlen++] = bintoasc[(((radbuf[1]<<2)&074)
+                                       |((radbuf[2]>>6)&03))&077];
+          outbuf[outlen++] = bintoasc[radbuf[2]&077];
+          idx = 0;
           if (++quad_count >= (64/4))
             {
               quad_count = 0;
-              if (!(state->flags & B64ENC_NO_LINEFEEDS)
-                  && my_fputs ("\n", state) == EOF)
+              if (!(state->flags & B64ENC_NO_LINEFEEDS))
+                outbuf[outlen++] = '\n';
+            }
+          if (outlen > sizeof outbuf - 5)
+            {
+              if (my_fwrite (outbuf, outlen, state))
                 goto write_error;
+              outlen = 0;
             }
         }
     }
+  if (my_fwrite (outbuf, outlen, state))
+    goto write_error;
   memcpy (state->radbuf, radbuf, idx);
   state->idx = idx;
   state->quad_count = quad_count;
@@ -0,0 +1,82 @@
+/* bench-dotlock.c - Microbenchmark for dotlock.c
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "bench-support.h"
+
+#define PGM "bench-dotlock"
+
+/* The file to lock; it is created in the current directory.  */
+#define LOCKFILE "bench-dotlock.tmp"
+
+
+static void
+bench_take_release (void *opaque, unsigned long count)
+{
+  dotlock_t h = opaque;
+
+  while (count--)
+    {
+      if (dotlock_take (h, -1))
+        log_fatal ("dotlock_take failed\n");
+      if (dotlock_release (h))
+        log_fatal ("dotlock_release failed\n");
+    }
+}
+
+
+static void
+bench_create_destroy (void *opaque, unsigned long count)
+{
+  dotlock_t h;
+
+  (void)opaque;
+  while (count--)
+    {
+      h = dotlock_create (LOCKFILE, 0);
+      if (!h)
+        log_fatal ("dotlock_create failed: %s\n", strerror (errno));
+      dotlock_destroy (h);
+    }
+}
+
+
+int
+main (int argc, char **argv)
+{
+  dotlock_t h;
+
+  bench_init (PGM, &argc, &argv);
+
+  h = dotlock_create (LOCKFILE, 0);
+  if (!h)
+    log_fatal ("dotlock_create failed: %s\n", strerror (errno));
+
+  bench_run ("dotlock-take-release", bench_take_release, h, 0);
+  bench_run ("dotlock-create-destroy", bench_create_destroy, NULL, 0);
+
+  dotlock_destroy (h);
+  return 0;
+}
@@ -0,0 +1,168 @@
+/* bench-encoding.c - Microbenchmark for the encoding functions
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* This covers the base64 coder from b64enc.c and b64dec.c, the
+ * percent escaping from percent.c and the zbase32 encoder.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "zb32.h"
+#include "bench-support.h"
+
+#define PGM "bench-encoding"
+
+/* The amount of data processed by one operation.  */
+#define DATALEN (16 * 1024)
+
+struct encode_parm_s
+{
+  char *data;          /* DATALEN bytes of binary data.  */
+  estream_t sink;      /* Memory stream for the encoder.  */
+  char *encoded;       /* The base64 encoded data.  */
+  size_t encodedlen;
+  char *escaped;       /* The percent escaped data.  */
+  char *work;          /* Buffer for the in-place decoders.  */
+};
+
+
+static void
+bench_b64enc (void *opaque, unsigned long count)
+{
+  struct encode_parm_s *parm = opaque;
+  struct b64state state;
+
+  while (count--)
+    {
+      es_rewind (parm->sink);
+      if (b64enc_start_es (&state, parm->sink, "PGP MESSAGE")
+          || b64enc_write (&state, parm->data, DATALEN)
+          || b64enc_finish (&state))
+        log_fatal ("b64enc failed\n");
+    }
+}
+
+
+static void
+bench_b64dec (void *opaque, unsigned long count)
+{
+  struct encode_parm_s *parm = opaque;
+  struct b64state state;
+  size_t n;
+
+  while (count--)
+    {
+      memcpy (parm->work, parm->encoded, parm->encodedlen);
+      if (b64dec_start (&state, "")
+          || b64dec_proc (&state, parm->work, parm->encodedlen, &n))
+        log_fatal ("b64dec failed\n");
+      b64dec_finish (&state);
+      if (n != DATALEN)
+        log_fatal ("b64dec returned %zu bytes\n", n);
+    }
+}
+
+
+static void
+bench_percent_escape (void *opaque, unsigned long count)
+{
+  struct encode_parm_s *parm = opaque;
+
+  while (count--)
+    xfree (percent_data_escape (0, NULL, parm->data, DATALEN));
+}
+
+
+static void
+bench_percent_unescape (void *opaque, unsigned long count)
+{
+  struct encode_parm_s *parm = opaque;
+
+  while (count--)
+    {
+      strcpy (parm->work, parm->escaped);
+      if (percent_unescape_inplace (parm->work, 0) != DATALEN)
+        log_fatal ("percent_unescape_inplace failed\n");
+    }
+}
+
+
+static void
+bench_zb32 (void *opaque, unsigned long count)
+{
+  struct encode_parm_s *parm = opaque;
+
+  while (count--)
+    xfree (zb32_encode (parm->data, DATALEN * 8));
+}
+
+
+int
+main (int argc, char **argv)
+{
+  struct encode_parm_s parm;
+  struct b64state state;
+  void *p;
+  size_t n;
+
+  bench_init (PGM, &argc, &argv);
+
+  parm.data = bench_make_data (DATALEN, 0);
+  /* The escaped data may be up to three times larger.  */
+  parm.work = xmalloc (3 * DATALEN + 1);
+  parm.sink = es_fopenmem (0, "w+b");
+  if (!parm.sink)
+    log_fatal ("es_fopenmem failed\n");
+
+  /* Create the input for the decoders.  */
+  if (b64enc_start_es (&state, parm.sink, "PGP MESSAGE")
+      || b64enc_write (&state, parm.data, DATALEN)
+      || b64enc_finish (&state))
+    log_fatal ("b64enc failed\n");
+  es_fflush (parm.sink);
+  if (es_fclose_snatch (parm.sink, &p, &n))
+    log_fatal ("es_fclose_snatch failed\n");
+  parm.encoded = p;
+  parm.encodedlen = n;
+  parm.work = xrealloc (parm.work, 3 * DATALEN + n + 1);
+  parm.escaped = percent_data_escape (0, NULL, parm.data, DATALEN);
+  if (!parm.escaped)
+    log_fatal ("percent_data_escape failed\n");
+
+  parm.sink = es_fopenmem (0, "w+b");
+  if (!parm.sink)
+    log_fatal ("es_fopenmem failed\n");
+
+  bench_run ("b64enc", bench_b64enc, &parm, DATALEN);
+  bench_run ("b64dec", bench_b64dec, &parm, DATALEN);
+  bench_run ("percent-escape", bench_percent_escape, &parm, DATALEN);
+  bench_run ("percent-unescape", bench_percent_unescape, &parm, DATALEN);
+  bench_run ("zb32-encode", bench_zb32, &parm, DATALEN);
+
+  es_fclose (parm.sink);
+  xfree (parm.escaped);
+  es_free (parm.encoded);
+  xfree (parm.work);
+  xfree (parm.data);
+  return 0;
+}
@@ -0,0 +1,164 @@
+/* bench-iobuf.c - Microbenchmark for iobuf.c
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "iobuf.h"
+#include "bench-support.h"
+
+#define PGM "bench-iobuf"
+
+/* The amount of data processed by one operation.  */
+#define DATALEN (64 * 1024)
+
+struct chain_parm_s
+{
+  const char *data;
+  int nfilters;
+};
+
+
+/* A filter which copies the data unchanged.  */
+static int
+copy_filter (void *opaque, int control, iobuf_t chain, byte *buf, size_t *len)
+{
+  int rc = 0;
+  int n;
+
+  (void)opaque;
+
+  if (control == IOBUFCTRL_DESC)
+    mem2str ((char*)buf, "copy_filter", *len);
+  else if (control == IOBUFCTRL_UNDERFLOW)
+    {
+      n = iobuf_read (chain, buf, *len);
+      if (n == -1)
+        {
+          *len = 0;
+          rc = -1;
+        }
+      else
+        *len = n;
+    }
+  else if (control == IOBUFCTRL_FLUSH)
+    rc = iobuf_write (chain, buf, *len);
+
+  return rc;
+}
+
+
+/* Write DATALEN bytes through a chain of filters into a temp iobuf.  */
+static void
+bench_write (void *opaque, unsigned long count)
+{
+  struct chain_parm_s *parm = opaque;
+  iobuf_t a;
+  int i;
+
+  while (count--)
+    {
+      a = iobuf_temp ();
+      for (i=0; i < parm->nfilters; i++)
+        iobuf_push_filter (a, copy_filter, NULL);
+      if (iobuf_write (a, parm->data, DATALEN))
+        log_fatal ("iobuf_write failed\n");
+      iobuf_close (a);
+    }
+}
+
+
+/* Read DATALEN bytes through a chain of filters from a temp iobuf.  */
+static void
+bench_read (void *opaque, unsigned long count)
+{
+  struct chain_parm_s *parm = opaque;
+  char buffer[4096];
+  size_t total;
+  iobuf_t a;
+  int i, n;
+
+  while (count--)
+    {
+      a = iobuf_temp_with_content (parm->data, DATALEN);
+      for (i=0; i < parm->nfilters; i++)
+        iobuf_push_filter (a, copy_filter, NULL);
+      total = 0;
+      while ((n = iobuf_read (a, buffer, sizeof buffer)) != -1)
+        total += n;
+      if (total != DATALEN)
+        log_fatal ("iobuf_read returned %zu bytes\n", total);
+      iobuf_close (a);
+    }
+}
+
+
+/* Read DATALEN bytes byte by byte using iobuf_get.  */
+static void
+bench_get (void *opaque, unsigned long count)
+{
+  struct chain_parm_s *parm = opaque;
+  size_t total;
+  iobuf_t a;
+  int i;
+
+  while (count--)
+    {
+      a = iobuf_temp_with_content (parm->data, DATALEN);
+      for (i=0; i < parm->nfilters; i++)
+        iobuf_push_filter (a, copy_filter, NULL);
+      total = 0;
+      while (iobuf_get (a) != -1)
+        total++;
+      if (total != DATALEN)
+        log_fatal ("iobuf_get returned %zu bytes\n", total);
+      iobuf_close (a);
+    }
+}
+
+
+int
+main (int argc, char **argv)
+{
+  struct chain_parm_s parm;
+  static int chains[] = { 0, 1, 4 };
+  char name[50];
+  int i;
+
+  bench_init (PGM, &argc, &argv);
+
+  parm.data = bench_make_data (DATALEN, 0);
+  for (i=0; i < DIM (chains); i++)
+    {
+      parm.nfilters = chains[i];
+      snprintf (name, sizeof name, "iobuf-write-%d", chains[i]);
+      bench_run (name, bench_write, &parm, DATALEN);
+      snprintf (name, sizeof name, "iobuf-read-%d", chains[i]);
+      bench_run (name, bench_read, &parm, DATALEN);
+      snprintf (name, sizeof name, "iobuf-get-%d", chains[i]);
+      bench_run (name, bench_get, &parm, DATALEN);
+    }
+
+  xfree ((char*)parm.data);
+  return 0;
+}
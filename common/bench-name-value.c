@@ -0,0 +1,145 @@
+/* bench-name-value.c - Microbenchmark for name-value.c
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "membuf.h"
+#include "name-value.h"
+#include "bench-support.h"
+
+#define PGM "bench-name-value"
+
+/* The number of entries in the test data.  */
+#define NENTRIES 50
+
+struct nv_parm_s
+{
+  char *text;
+  size_t textlen;
+  nvc_t nvc;
+};
+
+
+/* Build a private key like file with NENTRIES entries, some of them
+ * with continuation lines.  */
+static char *
+make_text (size_t *r_length)
+{
+  membuf_t mb;
+  char *data;
+  int i;
+
+  init_membuf (&mb, 4096);
+  put_membuf_str (&mb, "# A comment line\n");
+  data = bench_make_data (60, 1);
+  for (i=0; i < NENTRIES; i++)
+    {
+      put_membuf_printf (&mb, "Name%d: value %d\n", i, i);
+      if (!(i % 5))
+        put_membuf_printf (&mb, "  %s\n  %s\n", data, data);
+    }
+  xfree (data);
+  put_membuf_str (&mb, "Key: (private-key (ecc (curve Ed25519)))\n");
+
+  data = get_membuf (&mb, r_length);
+  if (!data)
+    log_fatal ("get_membuf failed\n");
+  return data;
+}
+
+
+static void
+bench_parse (void *opaque, unsigned long count)
+{
+  struct nv_parm_s *parm = opaque;
+  estream_t stream;
+  nvc_t nvc;
+  int errline;
+
+  while (count--)
+    {
+      stream = es_fopenmem_init (0, "rb", parm->text, parm->textlen);
+      if (!stream)
+        log_fatal ("es_fopenmem_init failed\n");
+      if (nvc_parse (&nvc, &errline, stream))
+        log_fatal ("nvc_parse failed at line %d\n", errline);
+      es_fclose (stream);
+      nvc_release (nvc);
+    }
+}
+
+
+static void
+bench_lookup (void *opaque, unsigned long count)
+{
+  struct nv_parm_s *parm = opaque;
+
+  while (count--)
+    if (!nvc_get_string (parm->nvc, "Key:"))
+      log_fatal ("nvc_get_string failed\n");
+}
+
+
+static void
+bench_write (void *opaque, unsigned long count)
+{
+  struct nv_parm_s *parm = opaque;
+  estream_t stream;
+
+  stream = es_fopenmem (0, "w+b");
+  if (!stream)
+    log_fatal ("es_fopenmem failed\n");
+  while (count--)
+    {
+      es_rewind (stream);
+      if (nvc_write (parm->nvc, stream))
+        log_fatal ("nvc_write failed\n");
+    }
+  es_fclose (stream);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  struct nv_parm_s parm;
+  estream_t stream;
+  int errline;
+
+  bench_init (PGM, &argc, &argv);
+
+  parm.text = make_text (&parm.textlen);
+  stream = es_fopenmem_init (0, "rb", parm.text, parm.textlen);
+  if (!stream || nvc_parse (&parm.nvc, &errline, stream))
+    log_fatal ("nvc_parse failed\n");
+  es_fclose (stream);
+
+  bench_run ("nvc-parse", bench_parse, &parm, parm.textlen);
+  bench_run ("nvc-lookup", bench_lookup, &parm, 0);
+  bench_run ("nvc-write", bench_write, &parm, parm.textlen);
+
+  nvc_release (parm.nvc);
+  xfree (parm.text);
+  return 0;
+}
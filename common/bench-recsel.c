@@ -0,0 +1,120 @@
+/* bench-recsel.c - Microbenchmark for recsel.c
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "recsel.h"
+#include "bench-support.h"
+
+#define PGM "bench-recsel"
+
+/* An expression as used with --import-filter.  */
+static const char *expr[] = {
+  "uid =~ Alfa",
+  "&& uid !~ Test",
+  "&& keyid -n",
+  "|| mbox =~ example.org",
+  "|| expired -z",
+  "|| algostr = ed25519"
+};
+
+/* A record with the properties used by the expression.  */
+struct record_s
+{
+  const char *name;
+  const char *value;
+};
+
+/* The number of matching records; this keeps the compiler from
+ * optimizing the select away.  */
+static unsigned long nmatches;
+
+static struct record_s record[] = {
+  { "uid",     "Alfa Bravo <alfa@example.net>" },
+  { "mbox",    "alfa@example.net" },
+  { "keyid",   "0123456789ABCDEF" },
+  { "expired", "1" },
+  { "algostr", "nistp256" }
+};
+
+
+static const char *
+record_getval (void *cookie, const char *name)
+{
+  struct record_s *rec = cookie;
+  int i;
+
+  for (i=0; i < DIM (record); i++)
+    if (!strcmp (rec[i].name, name))
+      return rec[i].value;
+  return NULL;
+}
+
+
+static void
+bench_parse (void *opaque, unsigned long count)
+{
+  recsel_expr_t se;
+  int i;
+
+  (void)opaque;
+  while (count--)
+    {
+      se = NULL;
+      for (i=0; i < DIM (expr); i++)
+        if (recsel_parse_expr (&se, expr[i]))
+          log_fatal ("recsel_parse_expr failed\n");
+      recsel_release (se);
+    }
+}
+
+
+static void
+bench_select (void *opaque, unsigned long count)
+{
+  recsel_expr_t se = opaque;
+
+  while (count--)
+    nmatches += recsel_select (se, record_getval, record);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  recsel_expr_t se = NULL;
+  int i;
+
+  bench_init (PGM, &argc, &argv);
+
+  for (i=0; i < DIM (expr); i++)
+    if (recsel_parse_expr (&se, expr[i]))
+      log_fatal ("recsel_parse_expr failed\n");
+
+  bench_run ("recsel-parse", bench_parse, NULL, 0);
+  bench_run ("recsel-select", bench_select, se, 0);
+
+  recsel_release (se);
+  return 0;
+}
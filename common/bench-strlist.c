@@ -0,0 +1,113 @@
+/* bench-strlist.c - Microbenchmark for strlist.c
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "bench-support.h"
+
+#define PGM "bench-strlist"
+
+/* The number of items in a list.  */
+#define NITEMS 1000
+
+static char *items[NITEMS];
+static strlist_t the_list;
+
+
+static void
+bench_add (void *opaque, unsigned long count)
+{
+  strlist_t list;
+  int i;
+
+  (void)opaque;
+  while (count--)
+    {
+      list = NULL;
+      for (i=0; i < NITEMS; i++)
+        add_to_strlist (&list, items[i]);
+      free_strlist (list);
+    }
+}
+
+
+static void
+bench_append (void *opaque, unsigned long count)
+{
+  strlist_t list;
+  int i;
+
+  (void)opaque;
+  while (count--)
+    {
+      list = NULL;
+      for (i=0; i < NITEMS; i++)
+        append_to_strlist (&list, items[i]);
+      free_strlist (list);
+    }
+}
+
+
+static void
+bench_find (void *opaque, unsigned long count)
+{
+  (void)opaque;
+  while (count--)
+    if (!strlist_find (the_list, items[0]))
+      log_fatal ("strlist_find failed\n");
+}
+
+
+static void
+bench_copy (void *opaque, unsigned long count)
+{
+  (void)opaque;
+  while (count--)
+    free_strlist (strlist_copy (the_list));
+}
+
+
+int
+main (int argc, char **argv)
+{
+  int i;
+
+  bench_init (PGM, &argc, &argv);
+
+  for (i=0; i < NITEMS; i++)
+    {
+      items[i] = xasprintf ("item-%d@example.org", i);
+      add_to_strlist (&the_list, items[i]);
+    }
+
+  bench_run ("strlist-add-1000", bench_add, NULL, 0);
+  bench_run ("strlist-append-1000", bench_append, NULL, 0);
+  bench_run ("strlist-find-1000", bench_find, NULL, 0);
+  bench_run ("strlist-copy-1000", bench_copy, NULL, 0);
+
+  free_strlist (the_list);
+  for (i=0; i < NITEMS; i++)
+    xfree (items[i]);
+  return 0;
+}
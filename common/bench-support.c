@@ -0,0 +1,214 @@
+/* bench-support.c - Helper for the microbenchmarks
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The bench-* programs measure the speed of some of the primitives
+ * in common/.  Each program runs a couple of benchmarks and prints
+ * one line per benchmark:
+ *
+ *   NAME  NS ns/op  NS ns/B  CYCLES c/B  ALLOCS allocs/op
+ *
+ * The cycles are computed from the time and the clock rate given
+ * with --cpu-mhz; without that option "-" is printed.  The
+ * allocations are counted by installing an allocation handler into
+ * Libgcrypt; this catches xmalloc and friends as well as the
+ * allocations done by estream.  Any non-option arguments restrict
+ * the benchmarks to those whose name contains one of the
+ * arguments.  */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "init.h"
+#include "metrics.h"
+#include "bench-support.h"
+
+
+/* The default minimum run time of a benchmark in milliseconds.  */
+#define DEFAULT_MIN_MSEC 200
+
+static const char *bench_pgm;
+static unsigned int cpu_mhz;
+static unsigned int min_msec = DEFAULT_MIN_MSEC;
+static char **patterns;
+static int npatterns;
+
+/* The number of allocations since the last reset.  */
+static unsigned long alloc_count;
+
+
+
+static void *
+count_alloc (size_t n)
+{
+  alloc_count++;
+  return malloc (n);
+}
+
+static int
+count_is_secure (const void *a)
+{
+  (void)a;
+  return 0;
+}
+
+static void *
+count_realloc (void *a, size_t n)
+{
+  alloc_count++;
+  return realloc (a, n);
+}
+
+static void
+count_free (void *a)
+{
+  free (a);
+}
+
+
+void
+bench_init (const char *pgm, int *argcp, char ***argvp)
+{
+  int argc = *argcp;
+  char **argv = *argvp;
+  int last_argc = -1;
+
+  bench_pgm = pgm;
+  /* This must be done before anything is allocated by Libgcrypt.  */
+  gcry_set_allocation_handler (count_alloc, count_alloc, count_is_secure,
+                               count_realloc, count_free);
+  log_set_prefix (pgm, GPGRT_LOG_WITH_PREFIX);
+  init_common_subsystems (&argc, &argv);
+
+  if (argc)
+    { argc--; argv++; }
+  while (argc && last_argc != argc )
+    {
+      last_argc = argc;
+      if (!strcmp (*argv, "--"))
+        {
+          argc--; argv++;
+          break;
+        }
+      else if (!strcmp (*argv, "--help"))
+        {
+          printf ("usage: %s [options] [names]\n"
+                  "Options:\n"
+                  "  --cpu-mhz N     print cycles for a clock of N MHz\n"
+                  "  --min-msec N    run each benchmark at least N ms\n",
+                  pgm);
+          exit (0);
+        }
+      else if (!strcmp (*argv, "--cpu-mhz") && argc > 1)
+        {
+          cpu_mhz = atoi (argv[1]);
+          argc -= 2; argv += 2;
+        }
+      else if (!strcmp (*argv, "--min-msec") && argc > 1)
+        {
+          min_msec = atoi (argv[1]);
+          if (!min_msec)
+            min_msec = DEFAULT_MIN_MSEC;
+          argc -= 2; argv += 2;
+        }
+      else if (!strncmp (*argv, "--", 2))
+        {
+          log_error ("unknown option '%s'\n", *argv);
+          exit (2);
+        }
+    }
+
+  patterns = argv;
+  npatterns = argc;
+  *argcp = argc;
+  *argvp = argv;
+}
+
+
+void
+bench_run (const char *name, bench_fnc_t fnc, void *opaque, size_t nbytes)
+{
+  unsigned long long start, elapsed;
+  unsigned long count, allocs;
+  double nsecs;
+  int i;
+
+  if (npatterns)
+    {
+      for (i=0; i < npatterns; i++)
+        if (strstr (name, patterns[i]))
+          break;
+      if (i == npatterns)
+        return;
+    }
+
+  /* Warm up the caches.  */
+  fnc (opaque, 1);
+
+  for (count = 1; ; count *= 2)
+    {
+      alloc_count = 0;
+      start = gnupg_metrics_now ();
+      fnc (opaque, count);
+      elapsed = gnupg_metrics_now () - start;
+      allocs = alloc_count;
+      if (elapsed >= min_msec * 1000ULL || count >= (1UL << 30))
+        break;
+    }
+  if (!elapsed)
+    elapsed = 1;
+
+  nsecs = (double)elapsed * 1000.0 / count;
+  printf ("%-28s %12.1f ns/op", name, nsecs);
+  if (nbytes)
+    printf (" %10.2f ns/B", nsecs / nbytes);
+  else
+    printf (" %10s ns/B", "-");
+  if (nbytes && cpu_mhz)
+    printf (" %10.2f c/B", nsecs * cpu_mhz / 1000.0 / nbytes);
+  else
+    printf (" %10s c/B", "-");
+  printf (" %8.1f allocs/op\n", (double)allocs / count);
+  fflush (stdout);
+}
+
+
+char *
+bench_make_data (size_t length, int printable)
+{
+  static const char digits[] =
+    "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ0123456789";
+  unsigned int seed = 4711;
+  char *buffer;
+  size_t n;
+
+  buffer = xmalloc (length + 1);
+  for (n=0; n < length; n++)
+    {
+      /* A simple LCG is good enough to get data without patterns.  */
+      seed = seed * 1103515245 + 12345;
+      buffer[n] = printable? digits[(seed >> 16) % (DIM (digits) - 1)]
+                           : (seed >> 16);
+    }
+  buffer[length] = 0;
+  return buffer;
+}
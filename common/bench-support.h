@@ -0,0 +1,42 @@
+/* bench-support.h - Helper for the microbenchmarks
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_COMMON_BENCH_SUPPORT_H
+#define GNUPG_COMMON_BENCH_SUPPORT_H 1
+
+/* A benchmark function which runs COUNT operations.  */
+typedef void (*bench_fnc_t) (void *opaque, unsigned long count);
+
+/* Initialize the benchmark program PGM and parse its options.  This
+ * needs to be called first thing in main.  */
+void bench_init (const char *pgm, int *argcp, char ***argvp);
+
+/* Run the benchmark NAME and print its result line.  FNC is called
+ * with OPAQUE and an increasing count until the run takes long
+ * enough.  NBYTES is the number of bytes processed by one operation
+ * or 0 if a per byte figure makes no sense.  */
+void bench_run (const char *name, bench_fnc_t fnc, void *opaque,
+                size_t nbytes);
+
+/* Return a malloced buffer with LENGTH bytes of pseudo random data.
+ * If PRINTABLE is set, only letters and digits are used.  */
+char *bench_make_data (size_t length, int printable);
+
+#endif /*GNUPG_COMMON_BENCH_SUPPORT_H*/
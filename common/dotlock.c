@@ -93,6 +93,16 @@
    is to check at runtime whether link(2) works for a specific lock
    file.
 
+   Waiting for a lock held by another process is done by polling with
+   increasing intervals.  To avoid the latency of this, a process
+   holding a lock on a system with open file description locks
+   (F_OFD_SETLK) additionally puts a write lock on the lock file.  A
+   process waiting without a timeout for a lock held on the same node
+   then blocks on a read lock of that file and retries right after the
+   lock has been released.  The lock file protocol is still the only
+   thing which provides the mutual exclusion and thus processes not
+   using these fcntl locks can still be mixed with those which do.
+
 
    How to use:
    ===========
@@ -407,6 +417,8 @@ struct dotlock_handle
   char *tname;         /* Name of the lockfile template.        */
   size_t nodename_off; /* Offset in TNAME of the nodename part. */
   size_t nodename_len; /* Length of the nodename part.          */
+  int lockfd;          /* FD of the held lockfile with an OFD lock
+                          or -1.                                 */
 #endif /*!HAVE_DOSISH_SYSTEM */
 };
 
@@ -638,6 +650,86 @@ use_hardlinks_p (const char *tname)
 
 
 
+#if defined(HAVE_POSIX_SYSTEM) && defined(F_OFD_SETLKW)
+# ifndef O_CLOEXEC
+#  define O_CLOEXEC 0
+# endif
+/* Put an open file description lock on the lockfile of H which we
+   just took.  Processes waiting for the lock block on it and are thus
+   woken up right when we release the lock.  This is only an addition
+   to the lockfile protocol and thus errors are ignored.  */
+static void
+ofd_lock_held (dotlock_t h)
+{
+  struct flock fl;
+  int fd;
+
+  do
+    fd = open (h->lockname, O_RDWR|O_CLOEXEC);
+  while (fd == -1 && errno == EINTR);
+  if (fd == -1)
+    return;
+
+  memset (&fl, 0, sizeof fl);
+  fl.l_type = F_WRLCK;
+  fl.l_whence = SEEK_SET;
+  if (fcntl (fd, F_OFD_SETLK, &fl))
+    close (fd);
+  else
+    h->lockfd = fd;
+}
+
+
+/* Release the lock taken by ofd_lock_held.  This must be called
+   after the lockfile has been removed.  */
+static void
+ofd_unlock_held (dotlock_t h)
+{
+  if (h->lockfd != -1)
+    {
+      close (h->lockfd);
+      h->lockfd = -1;
+    }
+}
+
+
+/* Wait until the process holding the lockfile of H releases it.
+   Returns true if the caller shall retry at once.  Returns false if
+   the owner does not use an OFD lock or on error; the caller then
+   needs to poll.  */
+static int
+ofd_wait_released (dotlock_t h)
+{
+  struct flock fl;
+  int fd, rc;
+  int retry = 0;
+
+  do
+    fd = open (h->lockname, O_RDONLY|O_CLOEXEC);
+  while (fd == -1 && errno == EINTR);
+  if (fd == -1)
+    return errno == ENOENT;  /* Already released.  */
+
+  memset (&fl, 0, sizeof fl);
+  fl.l_type = F_RDLCK;
+  fl.l_whence = SEEK_SET;
+  if (fcntl (fd, F_OFD_SETLK, &fl) && (errno == EAGAIN || errno == EACCES))
+    {
+      do
+        rc = fcntl (fd, F_OFD_SETLKW, &fl);
+      while (rc == -1 && errno == EINTR);
+      retry = !rc;
+    }
+  close (fd);
+  return retry;
+}
+#else /*!F_OFD_SETLKW*/
+# define ofd_lock_held(h)      do { } while (0)
+# define ofd_unlock_held(h)    do { } while (0)
+# define ofd_wait_released(h)  (0)
+#endif /*!F_OFD_SETLKW*/
+
+
 #ifdef  HAVE_POSIX_SYSTEM
 /* Locking core for Unix.  It used a temporary file and the link
    system call to make locking an atomic operation. */
@@ -652,6 +744,7 @@ dotlock_create_unix (dotlock_t h, const char *file_to_lock)
   struct utsname utsbuf;
   size_t tnamelen;
 
+  h->lockfd = -1;
   snprintf (pidstr, sizeof pidstr, "%10d\n", (int)getpid() );
 
   /* Create a temporary file. */
@@ -938,6 +1031,7 @@ dotlock_destroy_unix (dotlock_t h)
 {
   if (h->locked && h->lockname)
     unlink (h->lockname);
+  ofd_unlock_held (h);
   if (h->tname && !h->use_o_excl)
     unlink (h->tname);
   xfree (h->tname);
@@ -1051,6 +1145,7 @@ dotlock_take_unix (dotlock_t h, long timeout)
               && !close (fd))
             {
               h->locked = 1;
+              ofd_lock_held (h);
               return 0;
             }
           /* Write error.  */
@@ -1085,6 +1180,7 @@ dotlock_take_unix (dotlock_t h, long timeout)
       if (sb.st_nlink == 2)
         {
           h->locked = 1;
+          ofd_lock_held (h);
           return 0; /* Okay.  */
         }
     }
@@ -1122,6 +1218,11 @@ dotlock_take_unix (dotlock_t h, long timeout)
     lastpid = pid;
   ownerchanged = (pid != lastpid);
 
+  /* Without a timeout we can block until a holder on this node using
+     an OFD lock releases the lock.  */
+  if (timeout < 0 && same_node && ofd_wait_released (h))
+    goto again;
+
   if (timeout)
     {
       struct timeval tv;
@@ -1287,6 +1388,7 @@ dotlock_release_unix (dotlock_t h)
       my_set_errno (saveerrno);
       return -1;
     }
+  ofd_unlock_held (h);
   /* Fixme: As an extra check we could check whether the link count is
      now really at 1. */
   return 0;
@@ -35,6 +35,10 @@
 #include <stdarg.h>
 #include <errno.h>
 #include <assert.h>
+#ifdef HAVE_SPLICE
+# include <fcntl.h>
+# include <sys/stat.h>
+#endif
 #include <gpg-error.h>
 
 #include <assuan.h>
@@ -195,21 +199,38 @@ read_and_log_stderr (read_and_log_buffer_t *state, es_poll_t *fderr)
 
 
 
+/* The initial and the maximum size of a copy buffer.  The buffer
+ * grows while the reads fill it completely.  */
+#define COPY_BUFFER_MIN  4096
+#define COPY_BUFFER_MAX  (64*1024)
+
+/* The maximum number of bytes moved by one splice call.  */
+#define SPLICE_CHUNK     (256*1024)
+
 /* A buffer to copy from one stream to another.  */
 struct copy_buffer
 {
-  char buffer[4096];
+  char *buffer;
+  size_t size;         /* The allocated size of BUFFER.  */
   char *writep;
   size_t nread;
+  int full;            /* The last read filled the buffer.  */
+  int eof;             /* EOF has been seen by splice.  */
+  int splice_state;    /* 0 = not yet known, 1 = use splice, -1 = don't.  */
 };
 
 
-/* Initialize a copy buffer.  */
-static void
+/* Initialize a copy buffer.  C must have been allocated zeroed.  */
+static gpg_error_t
 copy_buffer_init (struct copy_buffer *c)
 {
+  c->buffer = xtrymalloc (COPY_BUFFER_MIN);
+  if (!c->buffer)
+    return my_error_from_syserror ();
+  c->size = COPY_BUFFER_MIN;
   c->writep = c->buffer;
   c->nread = 0;
+  return 0;
 }
 
 
@@ -219,12 +240,104 @@ copy_buffer_shred (struct copy_buffer *c)
 {
   if (c == NULL)
     return;
-  wipememory (c->buffer, sizeof c->buffer);
+  if (c->buffer)
+    {
+      wipememory (c->buffer, c->size);
+      xfree (c->buffer);
+    }
+  c->buffer = NULL;
   c->writep = NULL;
   c->nread = ~0U;
 }
 
 
+/* Double the size of the empty copy buffer C.  On error the old
+ * buffer is kept.  We do not use realloc because the old buffer
+ * needs to be wiped.  */
+static void
+copy_buffer_grow (struct copy_buffer *c)
+{
+  char *newbuf;
+
+  log_assert (!c->nread);
+  newbuf = xtrymalloc (2 * c->size);
+  if (!newbuf)
+    return;
+  wipememory (c->buffer, c->size);
+  xfree (c->buffer);
+  c->buffer = c->writep = newbuf;
+  c->size *= 2;
+}
+
+
+/* Return true if all data has been read from SOURCE.  */
+static int
+copy_buffer_eof (struct copy_buffer *c, estream_t source)
+{
+  return c->eof || es_feof (source);
+}
+
+
+#ifdef HAVE_SPLICE
+/* Return true if FD may be used with splice.  Regular files are
+ * only allowed if ALLOW_FILE is set.  */
+static int
+splice_capable_fd (int fd, int allow_file)
+{
+  struct stat st;
+
+  if (fd == -1 || fstat (fd, &st))
+    return 0;
+  return (S_ISFIFO (st.st_mode) || S_ISSOCK (st.st_mode)
+          || (allow_file && S_ISREG (st.st_mode)));
+}
+
+
+/* Try to move data from SOURCE to SINK within the kernel.  Returns
+ * GPG_ERR_NOT_SUPPORTED if the streams can't be used for this.  A
+ * memory stream has no file descriptor and an estream writing to a
+ * regular file would not know about the new file position; they are
+ * thus not supported.  Data still buffered by the estreams is always
+ * processed first.  */
+static gpg_error_t
+copy_buffer_splice (struct copy_buffer *c, estream_t source, estream_t sink)
+{
+  ssize_t n;
+
+  if (c->splice_state == -1 || !sink)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (!c->splice_state)
+    c->splice_state = (splice_capable_fd (es_fileno (source), 1)
+                       && splice_capable_fd (es_fileno (sink), 0))? 1 : -1;
+  if (c->splice_state == -1 || c->nread || es_pending (source))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  if (es_fflush (sink))
+    return my_error_from_syserror ();
+
+  /* We do not use SPLICE_F_NONBLOCK so that the O_NONBLOCK flag of
+   * each file decides whether we block like es_write would do.  */
+  n = splice (es_fileno (source), NULL, es_fileno (sink), NULL,
+              SPLICE_CHUNK, SPLICE_F_MOVE);
+  if (n > 0)
+    return 0;
+  if (!n)
+    {
+      c->eof = 1;
+      return 0;
+    }
+  if (errno == EINVAL || errno == ENOSYS)
+    {
+      /* Not supported for these files (e.g. O_APPEND or an old
+       * kernel).  Fall back to copying.  */
+      c->splice_state = -1;
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  return my_error_from_syserror ();
+}
+#endif /*HAVE_SPLICE*/
+
+
 /* Copy data from SOURCE to SINK using copy buffer C.  */
 static gpg_error_t
 copy_buffer_do_copy (struct copy_buffer *c, estream_t source, estream_t sink)
@@ -232,10 +345,20 @@ copy_buffer_do_copy (struct copy_buffer *c, estream_t source, estream_t sink)
   gpg_error_t err;
   size_t nwritten = 0;
 
+#ifdef HAVE_SPLICE
+  err = copy_buffer_splice (c, source, sink);
+  if (gpg_err_code (err) == GPG_ERR_EAGAIN)
+    return 0;	/* We will just retry next time.  */
+  if (gpg_err_code (err) != GPG_ERR_NOT_SUPPORTED)
+    return err;
+#endif
+
   if (c->nread == 0)
     {
+      if (c->full && c->size < COPY_BUFFER_MAX)
+        copy_buffer_grow (c);
       c->writep = c->buffer;
-      if (es_read (source, c->buffer, sizeof c->buffer, &c->nread))
+      if (es_read (source, c->buffer, c->size, &c->nread))
         {
           err = my_error_from_syserror ();
           if (gpg_err_code (err) == GPG_ERR_EAGAIN)
@@ -244,7 +367,8 @@ copy_buffer_do_copy (struct copy_buffer *c, estream_t source, estream_t sink)
           return err;
         }
 
-      log_assert (c->nread <= sizeof c->buffer);
+      log_assert (c->nread <= c->size);
+      c->full = (c->nread == c->size);
     }
 
   if (c->nread == 0)
@@ -259,7 +383,7 @@ copy_buffer_do_copy (struct copy_buffer *c, estream_t source, estream_t sink)
   log_assert (nwritten <= c->nread);
   c->writep += nwritten;
   c->nread -= nwritten;
-  log_assert (c->writep - c->buffer <= sizeof c->buffer);
+  log_assert (c->writep - c->buffer <= c->size);
 
   if (err)
     {
@@ -289,7 +413,7 @@ copy_buffer_flush (struct copy_buffer *c, estream_t sink)
   log_assert (nwritten <= c->nread);
   c->writep += nwritten;
   c->nread -= nwritten;
-  log_assert (c->writep - c->buffer <= sizeof c->buffer);
+  log_assert (c->writep - c->buffer <= c->size);
 
   if (err)
     return err;
@@ -344,29 +468,35 @@ gnupg_exec_tool_stream (const char *pgmname, const char *argv[],
    * diagnostics.  */
   quiet = (argv && argv[0] && !strcmp (argv[0], "--quiet"));
 
-  cpbuf_in = xtrymalloc (sizeof *cpbuf_in);
+  cpbuf_in = xtrycalloc (1, sizeof *cpbuf_in);
   if (cpbuf_in == NULL)
     {
       err = my_error_from_syserror ();
       goto leave;
     }
-  copy_buffer_init (cpbuf_in);
+  err = copy_buffer_init (cpbuf_in);
+  if (err)
+    goto leave;
 
-  cpbuf_out = xtrymalloc (sizeof *cpbuf_out);
+  cpbuf_out = xtrycalloc (1, sizeof *cpbuf_out);
   if (cpbuf_out == NULL)
     {
       err = my_error_from_syserror ();
       goto leave;
     }
-  copy_buffer_init (cpbuf_out);
+  err = copy_buffer_init (cpbuf_out);
+  if (err)
+    goto leave;
 
-  cpbuf_extra = xtrymalloc (sizeof *cpbuf_extra);
+  cpbuf_extra = xtrycalloc (1, sizeof *cpbuf_extra);
   if (cpbuf_extra == NULL)
     {
       err = my_error_from_syserror ();
       goto leave;
     }
-  copy_buffer_init (cpbuf_extra);
+  err = copy_buffer_init (cpbuf_extra);
+  if (err)
+    goto leave;
 
   fderrstate.pgmname = pgmname;
   fderrstate.quiet = quiet;
@@ -467,7 +597,7 @@ gnupg_exec_tool_stream (const char *pgmname, const char *argv[],
               goto leave;
             }
 
-          if (es_feof (input))
+          if (copy_buffer_eof (cpbuf_in, input))
             {
               err = copy_buffer_flush (cpbuf_in, fds[0].stream);
               if (gpg_err_code (err) == GPG_ERR_EAGAIN)
@@ -495,7 +625,7 @@ gnupg_exec_tool_stream (const char *pgmname, const char *argv[],
               goto leave;
             }
 
-          if (es_feof (inextra))
+          if (copy_buffer_eof (cpbuf_extra, inextra))
             {
               err = copy_buffer_flush (cpbuf_extra, fds[3].stream);
               if (gpg_err_code (err) == GPG_ERR_EAGAIN)
@@ -522,7 +652,7 @@ gnupg_exec_tool_stream (const char *pgmname, const char *argv[],
               goto leave;
             }
 
-          if (es_feof (fds[1].stream))
+          if (copy_buffer_eof (cpbuf_out, fds[1].stream))
             {
               err = copy_buffer_flush (cpbuf_out, output);
               if (err)
@@ -40,6 +40,14 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <unistd.h>
+#include <time.h>
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+# include <sys/mman.h>
+# ifndef MAP_FAILED
+#  define MAP_FAILED ((void*)-1)
+# endif
+# define USE_IOBUF_MMAP 1
+#endif
 #ifdef HAVE_W32_SYSTEM
 # ifdef HAVE_WINSOCK2_H
 #  include <winsock2.h>
@@ -72,6 +80,15 @@
  * iobuf_set_buffer_size function.  */
 static unsigned int iobuf_buffer_size = DEFAULT_IOBUF_BUFFER_SIZE;
 
+/* Each filter in a chain has its own buffer of IOBUF_BUFFER_SIZE.
+ * To avoid allocating them again for each message we keep a few
+ * released buffers of that size in a pool.  The buffers are wiped
+ * before they are put into the pool.  */
+#define BUFFER_POOL_SIZE 16
+static byte *buffer_pool[BUFFER_POOL_SIZE];
+static int buffer_pool_count;
+GPGRT_LOCK_DEFINE (buffer_pool_lock);
+
 
 #ifdef HAVE_W32_SYSTEM
 # ifdef HAVE_W32CE_SYSTEM
@@ -96,6 +113,10 @@ typedef struct
   int eof_seen;
   int delayed_rc;
   int print_only_name; /* Flags indicating that fname is not a real file.  */
+#ifdef USE_IOBUF_MMAP
+  void *map;           /* If not NULL the memory mapped file.  */
+  size_t maplen;       /* The length of MAP.  */
+#endif
   char fname[1];       /* Name of the file.  */
 } file_filter_ctx_t;
 
@@ -124,6 +145,7 @@ typedef struct close_cache_s *close_cache_t;
 static close_cache_t close_cache;
 
 int iobuf_debug_mode;
+int iobuf_stats_mode;
 
 
 #ifdef HAVE_W32_SYSTEM
@@ -596,6 +618,10 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
       a->delayed_rc = 0;
       a->keep_open = 0;
       a->no_cache = 0;
+#ifdef USE_IOBUF_MMAP
+      a->map = NULL;
+      a->maplen = 0;
+#endif
     }
   else if (control == IOBUFCTRL_DESC)
     {
@@ -603,6 +629,15 @@ file_filter (void *opaque, int control, iobuf_t chain, byte * buf,
     }
   else if (control == IOBUFCTRL_FREE)
     {
+#ifdef USE_IOBUF_MMAP
+      if (a->map)
+        {
+          if (DBG_IOBUF)
+            log_debug ("%s: unmap %zu bytes\n", a->fname, a->maplen);
+          munmap (a->map, a->maplen);
+          a->map = NULL;
+        }
+#endif
       if (f != FD_FOR_STDIN && f != FD_FOR_STDOUT)
 	{
 	  if (DBG_IOBUF)
@@ -1129,7 +1164,12 @@ iobuf_set_buffer_size (unsigned int kilobyte)
       else if (kilobyte > 16*1024)
         kilobyte = 16*1024;
 
+      /* The pooled buffers have the old size.  */
+      gpgrt_lock_lock (&buffer_pool_lock);
+      while (buffer_pool_count)
+        xfree (buffer_pool[--buffer_pool_count]);
       iobuf_buffer_size = kilobyte * 1024;
+      gpgrt_lock_unlock (&buffer_pool_lock);
       used = 1;
     }
   return iobuf_buffer_size / 1024;
@@ -1170,6 +1210,90 @@ print_chain (iobuf_t a)
     }
 }
 
+/* Allocate a buffer of SIZE for an iobuf.  */
+static byte *
+buffer_alloc (size_t size)
+{
+  byte *buf = NULL;
+
+  if (size == iobuf_buffer_size)
+    {
+      gpgrt_lock_lock (&buffer_pool_lock);
+      if (buffer_pool_count)
+        buf = buffer_pool[--buffer_pool_count];
+      gpgrt_lock_unlock (&buffer_pool_lock);
+    }
+  return buf? buf : xmalloc (size);
+}
+
+
+/* Release the buffer BUF of SIZE allocated by buffer_alloc.  If WIPE
+ * is set the buffer is wiped even if it is not kept in the pool.  */
+static void
+buffer_free (byte *buf, size_t size, int wipe)
+{
+  if (!buf)
+    return;
+  if (size == iobuf_buffer_size)
+    {
+      memset (buf, 0, size);
+      gpgrt_lock_lock (&buffer_pool_lock);
+      if (buffer_pool_count < BUFFER_POOL_SIZE)
+        {
+          buffer_pool[buffer_pool_count++] = buf;
+          buf = NULL;
+        }
+      gpgrt_lock_unlock (&buffer_pool_lock);
+      if (!buf)
+        return;
+    }
+  else if (wipe)
+    memset (buf, 0, size);
+  xfree (buf);
+}
+
+
+/* Return a timestamp in nanoseconds for the filter statistics.  */
+static unsigned long long
+stats_now (void)
+{
+#ifdef HAVE_CLOCK_GETTIME
+  struct timespec ts;
+
+  if (!clock_gettime (CLOCK_MONOTONIC, &ts))
+    return ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+#endif
+  return 0;
+}
+
+
+/* Account a call of the filter of A which started at T0 and
+ * transferred NBYTES.  */
+static void
+update_stats (iobuf_t a, unsigned long long t0, size_t nbytes)
+{
+  a->stats.ncalls++;
+  a->stats.nbytes += nbytes;
+  a->stats.nsecs += stats_now () - t0;
+}
+
+
+/* Log the statistics of the filter of A.  This needs to be called
+ * before the filter is told to free itself.  */
+static void
+print_stats (iobuf_t a)
+{
+  byte desc[MAX_IOBUF_DESC];
+
+  if (!iobuf_stats_mode || !a->filter)
+    return;
+  log_debug ("iobuf-%d.%d: %-16s %8lu calls %12llu bytes %8llu.%03llu ms\n",
+            a->no, a->subno, iobuf_desc (a, desc),
+            a->stats.ncalls, a->stats.nbytes,
+            a->stats.nsecs / 1000000, (a->stats.nsecs / 1000) % 1000);
+}
+
+
 int
 iobuf_print_chain (iobuf_t a)
 {
@@ -1177,12 +1301,28 @@ iobuf_print_chain (iobuf_t a)
   return 0;
 }
 
-iobuf_t
-iobuf_alloc (int use, size_t bufsize)
+/* Create a new iobuf object for USE with the buffer BUF of size
+ * BUFSIZE.  The iobuf takes ownership of BUF.  */
+static iobuf_t
+alloc_with_buffer (int use, byte *buf, size_t bufsize)
 {
   iobuf_t a;
   static int number = 0;
 
+  a = xcalloc (1, sizeof *a);
+  a->use = use;
+  a->d.buf = buf;
+  a->d.size = bufsize;
+  a->no = ++number;
+  a->subno = 0;
+  a->real_fname = NULL;
+  return a;
+}
+
+
+iobuf_t
+iobuf_alloc (int use, size_t bufsize)
+{
   assert (use == IOBUF_INPUT || use == IOBUF_INPUT_TEMP
 	  || use == IOBUF_OUTPUT || use == IOBUF_OUTPUT_TEMP);
   if (bufsize == 0)
@@ -1191,14 +1331,7 @@ iobuf_alloc (int use, size_t bufsize)
       bufsize = iobuf_buffer_size;
     }
 
-  a = xcalloc (1, sizeof *a);
-  a->use = use;
-  a->d.buf = xmalloc (bufsize);
-  a->d.size = bufsize;
-  a->no = ++number;
-  a->subno = 0;
-  a->real_fname = NULL;
-  return a;
+  return alloc_with_buffer (use, buffer_alloc (bufsize), bufsize);
 }
 
 int
@@ -1222,6 +1355,7 @@ iobuf_close (iobuf_t a)
 	log_debug ("iobuf-%d.%d: close '%s'\n",
 		   a->no, a->subno, iobuf_desc (a, desc));
 
+      print_stats (a);
       if (a->filter && (rc2 = a->filter (a->filter_ov, IOBUFCTRL_FREE,
 					 a->chain, NULL, &dummy_len)))
 	log_error ("IOBUFCTRL_FREE failed on close: %s\n", gpg_strerror (rc));
@@ -1231,11 +1365,7 @@ iobuf_close (iobuf_t a)
 	rc = rc2;
 
       xfree (a->real_fname);
-      if (a->d.buf)
-	{
-	  memset (a->d.buf, 0, a->d.size);	/* erase the buffer */
-	  xfree (a->d.buf);
-	}
+      buffer_free (a->d.buf, a->d.size, 1);  /* erase the buffer */
       xfree (a);
     }
   return rc;
@@ -1316,6 +1446,18 @@ iobuf_temp_with_content (const char *buffer, size_t length)
 }
 
 
+iobuf_t
+iobuf_temp_with_buffer (void *buffer, size_t length)
+{
+  iobuf_t a;
+
+  a = alloc_with_buffer (IOBUF_INPUT_TEMP, buffer, length);
+  a->d.len = length;
+
+  return a;
+}
+
+
 int
 iobuf_is_pipe_filename (const char *fname)
 {
@@ -1371,6 +1513,15 @@ do_open (const char *fname, int special_filenames,
 	return NULL;
     }
 
+#ifdef HAVE_POSIX_FADVISE
+  /* Tell the kernel that we read the file sequentially.  It then
+   * reads ahead further so that the next read is served from the
+   * cache while we are still processing the data.  Errors, like
+   * ESPIPE for stdin, don't matter.  */
+  if (use == IOBUF_INPUT)
+    posix_fadvise (FD2INT (fp), 0, 0, POSIX_FADV_SEQUENTIAL);
+#endif
+
   a = iobuf_alloc (use, iobuf_buffer_size);
   fcx = xmalloc (sizeof *fcx + strlen (fname));
   fcx->fp = fp;
@@ -1501,6 +1652,76 @@ iobuf_sockopen (int fd, const char *mode)
   return a;
 }
 
+/* Implementation of IOBUF_IOCTL_MMAP_VIEW for the file filter A.
+   Maps the underlying file, stores the not yet consumed part of it
+   at VIEW and marks that part as consumed.  Returns 0 on success or
+   -1 if the file can't be mapped.  */
+static int
+file_filter_mmap_view (iobuf_t a, iobuf_mmap_view_t view)
+{
+#ifdef USE_IOBUF_MMAP
+  file_filter_ctx_t *b = a->filter_ov;
+  struct stat st;
+  off_t pos;
+  size_t buffered;
+
+  if (b->eof_seen || (b->delayed_rc && b->delayed_rc != -1))
+    return -1;
+  if (fstat (b->fp, &st) || !S_ISREG (st.st_mode))
+    return -1;
+  if ((off_t)(size_t)st.st_size != st.st_size)
+    return -1;  /* Too large for our address space.  */
+
+  /* The data still in our buffer has already been read from the file
+     but not yet consumed; the view needs to start with it.  */
+  buffered = a->d.len - a->d.start;
+  pos = lseek (b->fp, 0, SEEK_CUR);
+  if (pos == (off_t)(-1) || pos < buffered || pos > st.st_size)
+    return -1;
+  pos -= buffered;
+
+  if (!b->map && st.st_size)
+    {
+      void *map;
+
+      map = mmap (NULL, (size_t)st.st_size, PROT_READ, MAP_SHARED, b->fp, 0);
+      if (map == MAP_FAILED)
+        {
+          if (DBG_IOBUF)
+            log_debug ("%s: mmap failed: %s\n", b->fname, strerror (errno));
+          return -1;
+        }
+#ifdef HAVE_POSIX_MADVISE
+      posix_madvise (map, (size_t)st.st_size, POSIX_MADV_SEQUENTIAL);
+#endif
+      b->map = map;
+      b->maplen = (size_t)st.st_size;
+    }
+  if (pos > b->maplen)
+    return -1;  /* The file has grown since we mapped it.  */
+
+  view->buf = b->map? ((const byte *)b->map + pos) : NULL;
+  view->len = b->maplen - pos;
+
+  if (DBG_IOBUF)
+    log_debug ("iobuf-%d.%d: mmap view of %zu bytes at offset %lld\n",
+               a->no, a->subno, view->len, (long long)pos);
+
+  /* Mark the data as consumed.  */
+  a->nbytes += view->len;
+  a->d.start = a->d.len = 0;
+  b->delayed_rc = 0;
+  b->eof_seen = 1;
+  lseek (b->fp, 0, SEEK_END);
+  return 0;
+#else /*!USE_IOBUF_MMAP*/
+  (void)a;
+  (void)view;
+  return -1;
+#endif /*!USE_IOBUF_MMAP*/
+}
+
+
 int
 iobuf_ioctl (iobuf_t a, iobuf_ioctl_t cmd, int intval, void *ptrval)
 {
@@ -1578,6 +1799,18 @@ iobuf_ioctl (iobuf_t a, iobuf_ioctl_t cmd, int intval, void *ptrval)
           return fd_cache_synchronize (ptrval);
         }
     }
+  else if (cmd == IOBUF_IOCTL_MMAP_VIEW)
+    {
+      /* Only a pipeline which consists of just the file filter can be
+         mapped; any other filter would need to see the data.  */
+      if (DBG_IOBUF)
+        log_debug ("iobuf-%d.%d: ioctl '%s' mmap_view\n",
+                   a ? a->no : -1, a ? a->subno : -1, iobuf_desc (a, desc));
+      if (a && !a->chain && a->filter == file_filter
+          && a->use == IOBUF_INPUT && !a->nofast && !a->filter_eof
+          && ptrval)
+        return file_filter_mmap_view (a, ptrval);
+    }
 
 
   return -1;
@@ -1705,7 +1938,7 @@ iobuf_push_filter2 (iobuf_t a,
      the new filter (A) means that data that has read from (B), but
      not yet read from the pipeline won't be processed by the new
      filter (A)!  That's certainly not what we want.  */
-  a->d.buf = xmalloc (a->d.size);
+  a->d.buf = buffer_alloc (a->d.size);
   a->d.len = 0;
   a->d.start = 0;
 
@@ -1764,7 +1997,7 @@ iobuf_pop_filter (iobuf_t a, int (*f) (void *opaque, int control,
     {				/* this is simple */
       b = a->chain;
       assert (b);
-      xfree (a->d.buf);
+      buffer_free (a->d.buf, a->d.size, 0);
       xfree (a->real_fname);
       memcpy (a, b, sizeof *a);
       xfree (b);
@@ -1784,6 +2017,7 @@ iobuf_pop_filter (iobuf_t a, int (*f) (void *opaque, int control,
       return rc;
     }
   /* and tell the filter to free it self */
+  print_stats (b);
   if (b->filter && (rc = b->filter (b->filter_ov, IOBUFCTRL_FREE, b->chain,
 				    NULL, &dummy_len)))
     {
@@ -1806,7 +2040,7 @@ iobuf_pop_filter (iobuf_t a, int (*f) (void *opaque, int control,
        * a flush has been done on the to be removed entry
        */
       b = a->chain;
-      xfree (a->d.buf);
+      buffer_free (a->d.buf, a->d.size, 0);
       xfree (a->real_fname);
       memcpy (a, b, sizeof *a);
       xfree (b);
@@ -1887,7 +2121,7 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
 	  if (DBG_IOBUF)
 	    log_debug ("iobuf-%d.%d: filter popped (pending EOF returned)\n",
 		       a->no, a->subno);
-	  xfree (a->d.buf);
+	  buffer_free (a->d.buf, a->d.size, 0);
 	  xfree (a->real_fname);
 	  memcpy (a, b, sizeof *a);
 	  xfree (b);
@@ -1923,6 +2157,14 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
 	/* There is no space for more data.  Don't bother calling
 	   A->FILTER.  */
 	rc = 0;
+      else if (iobuf_stats_mode)
+        {
+          unsigned long long t0 = stats_now ();
+
+          rc = a->filter (a->filter_ov, IOBUFCTRL_UNDERFLOW, a->chain,
+                          &a->d.buf[a->d.len], &len);
+          update_stats (a, t0, len);
+        }
       else
 	rc = a->filter (a->filter_ov, IOBUFCTRL_UNDERFLOW, a->chain,
 			&a->d.buf[a->d.len], &len);
@@ -1942,6 +2184,7 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
 	  size_t dummy_len = 0;
 
 	  /* Tell the filter to free itself */
+	  print_stats (a);
 	  if ((rc = a->filter (a->filter_ov, IOBUFCTRL_FREE, a->chain,
 			       NULL, &dummy_len)))
 	    log_error ("IOBUFCTRL_FREE failed: %s\n", gpg_strerror (rc));
@@ -1966,7 +2209,7 @@ underflow_target (iobuf_t a, int clear_pending_eof, size_t target)
 	      if (DBG_IOBUF)
 		log_debug ("iobuf-%d.%d: pop in underflow (nothing buffered, got EOF)\n",
 			   a->no, a->subno);
-	      xfree (a->d.buf);
+	      buffer_free (a->d.buf, a->d.size, 0);
 	      xfree (a->real_fname);
 	      memcpy (a, b, sizeof *a);
 	      xfree (b);
@@ -2023,7 +2266,15 @@ filter_flush (iobuf_t a)
   else if (!a->filter)
     log_bug ("filter_flush: no filter\n");
   len = a->d.len;
-  rc = a->filter (a->filter_ov, IOBUFCTRL_FLUSH, a->chain, a->d.buf, &len);
+  if (iobuf_stats_mode)
+    {
+      unsigned long long t0 = stats_now ();
+
+      rc = a->filter (a->filter_ov, IOBUFCTRL_FLUSH, a->chain, a->d.buf, &len);
+      update_stats (a, t0, len);
+    }
+  else
+    rc = a->filter (a->filter_ov, IOBUFCTRL_FLUSH, a->chain, a->d.buf, &len);
   if (!rc && len != a->d.len)
     {
       log_info ("filter_flush did not write all!\n");
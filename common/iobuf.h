@@ -116,9 +116,20 @@ typedef enum
     IOBUF_IOCTL_KEEP_OPEN        = 1, /* Uses intval.  */
     IOBUF_IOCTL_INVALIDATE_CACHE = 2, /* Uses ptrval.  */
     IOBUF_IOCTL_NO_CACHE         = 3, /* Uses intval.  */
-    IOBUF_IOCTL_FSYNC            = 4  /* Uses ptrval.  */
+    IOBUF_IOCTL_FSYNC            = 4, /* Uses ptrval.  */
+    IOBUF_IOCTL_MMAP_VIEW        = 5  /* Uses ptrval.  */
   } iobuf_ioctl_t;
 
+/* The object returned by IOBUF_IOCTL_MMAP_VIEW.  BUF points to the
+   not yet consumed data of the file and LEN gives its length.  The
+   view is valid until the pipeline is closed.  */
+struct iobuf_mmap_view_s
+{
+  const byte *buf;
+  size_t len;
+};
+typedef struct iobuf_mmap_view_s *iobuf_mmap_view_t;
+
 enum iobuf_use
   {
     /* Pipeline is in input mode.  The data flows from the end to the
@@ -247,10 +258,24 @@ struct iobuf_struct
      This amount of nesting typically indicates corrupted data or an
      active denial of service attack.  */
   int subno;
+
+  /* Statistics about the calls of FILTER to read or write data.
+     They are only collected if iobuf_stats_mode is set.  The time
+     includes the time spent in the following filters.  */
+  struct
+  {
+    unsigned long ncalls;
+    unsigned long long nbytes;
+    unsigned long long nsecs;
+  } stats;
 };
 
 extern int iobuf_debug_mode;
 
+/* If set, collect statistics for each filter and log them when the
+   filter is released.  */
+extern int iobuf_stats_mode;
+
 
 /* Change the default size for all IOBUFs to KILOBYTE.  This needs to
  * be called before any iobufs are used and can only be used once.
@@ -287,6 +312,12 @@ iobuf_t iobuf_temp (void);
 /* Create an input filter that contains some data for reading.  */
 iobuf_t iobuf_temp_with_content (const char *buffer, size_t length);
 
+/* Same as iobuf_temp_with_content but without copying BUFFER.  The
+   iobuf takes ownership of BUFFER, which must have been allocated
+   using xmalloc or get_membuf; it is wiped and released by
+   iobuf_close.  */
+iobuf_t iobuf_temp_with_buffer (void *buffer, size_t length);
+
 /* Create an input file filter that reads from a file.  If FNAME is
    '-', reads from stdin.  If special filenames are enabled
    (iobuf_enable_special_filenames), then interprets special
@@ -332,7 +363,16 @@ iobuf_t iobuf_esopen (estream_t estream, const char *mode, int keep_open,
 iobuf_t iobuf_sockopen (int fd, const char *mode);
 
 /* Set various options / perform different actions on a PIPELINE.  See
-   the IOBUF_IOCTL_* macros above.  */
+   the IOBUF_IOCTL_* macros above.
+
+   IOBUF_IOCTL_MMAP_VIEW expects a pointer to a struct
+   iobuf_mmap_view_s at PTRVAL.  If the pipeline consists only of a
+   file filter reading a regular file, the file is memory mapped, the
+   view is set to the remaining data and that data is marked as
+   consumed; the next read returns EOF.  Returns 0 on success and -1
+   if a memory mapped view is not possible; in the latter case the
+   pipeline is not changed and the caller should use the normal read
+   functions.  */
 int iobuf_ioctl (iobuf_t a, iobuf_ioctl_t cmd, int intval, void *ptrval);
 
 /* Close a pipeline.  The filters in the pipeline are first flushed
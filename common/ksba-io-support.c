@@ -184,6 +184,25 @@ base64_reader_cb (void *cb_value, char *buffer, size_t count, size_t *nread)
   if (!buffer)
     return -1; /* not supported */
 
+  if (parm->identified && !parm->is_pem && !parm->is_base64
+      && !parm->linelen)
+    {
+      /* Once the input is known to be DER encoded there is no need
+       * to go through the line buffer; read straight into the
+       * caller's buffer instead.  */
+      n = es_fread (buffer, 1, count, parm->fp);
+      if (n < count)
+        {
+          parm->eof_seen = 1;
+          if (es_ferror (parm->fp))
+            return -1;
+          if (!n)
+            return -1; /* eof */
+        }
+      *nread = n;
+      return 0;
+    }
+
  next:
   if (!parm->linelen)
     {
@@ -323,6 +342,33 @@ base64_reader_cb (void *cb_value, char *buffer, size_t count, size_t *nread)
 
           while (n < count && parm->readpos < parm->linelen )
             {
+              /* Fast path: decode complete quads of valid characters
+               * at once.  Everything else, including white space,
+               * padding and the END line, is left to the slow path
+               * below.  */
+              if (!idx)
+                {
+                  const unsigned char *s;
+                  unsigned int c0, c1, c3;
+
+                  while (n + 3 <= count && parm->readpos + 4 <= parm->linelen)
+                    {
+                      s = parm->line + parm->readpos;
+                      c0 = asctobin[s[0]];
+                      c1 = asctobin[s[1]];
+                      c2 = asctobin[s[2]];
+                      c3 = asctobin[s[3]];
+                      if (((c0 | c1 | c2 | c3) & 0x80))
+                        break;  /* Not a valid character.  */
+                      buffer[n++] = (c0 << 2) | (c1 >> 4);
+                      buffer[n++] = (c1 << 4) | (c2 >> 2);
+                      buffer[n++] = (c2 << 6) | c3;
+                      parm->readpos += 4;
+                    }
+                  if (n >= count || parm->readpos >= parm->linelen)
+                    break;
+                }
+
               c = parm->line[parm->readpos++];
               if (c == '\n' || c == ' ' || c == '\r' || c == '\t')
                 continue;
@@ -396,25 +442,20 @@ simple_reader_cb (void *cb_value, char *buffer, size_t count, size_t *nread)
 {
   struct reader_cb_parm_s *parm = cb_value;
   size_t n;
-  int c = 0;
 
   *nread = 0;
   if (!buffer)
     return -1; /* not supported */
 
-  for (n=0; n < count; n++)
+  n = es_fread (buffer, 1, count, parm->fp);
+  if (n < count)
     {
-      c = es_getc (parm->fp);
-      if (c == EOF)
-        {
-          parm->eof_seen = 1;
-          if (es_ferror (parm->fp))
-            return -1;
-          if (n)
-            break; /* Return what we have before an EOF.  */
-          return -1;
-        }
-      *(byte *)buffer++ = c;
+      parm->eof_seen = 1;
+      if (es_ferror (parm->fp))
+        return -1;
+      if (!n)
+        return -1;
+      /* Return what we have before an EOF.  */
     }
 
   *nread = n;
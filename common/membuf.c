@@ -97,7 +97,10 @@ put_membuf (membuf_t *mb, const void *buf, size_t len)
     {
       char *p;
 
-      mb->size += len + 1024;
+      /* Grow the buffer at least by half of its size so that
+         appending many small pieces does not copy the accumulated
+         data over and over.  */
+      mb->size += len + 1024 + mb->size / 2;
       p = xtryrealloc (mb->buf, mb->size);
       if (!p)
         {
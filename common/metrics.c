@@ -0,0 +1,372 @@
+/* metrics.c - Counters and histograms for the daemons
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: (LGPL-3.0-or-later OR GPL-2.0-or-later)
+ */
+
+/* This module keeps counters, gauges and latency histograms of a
+ * daemon and formats them for the "GETINFO metrics" command of the
+ * Assuan servers.  The output uses the text format of Prometheus so
+ * that monitoring systems can scrape it directly:
+ *
+ *   # TYPE gpg_agent_connections gauge
+ *   gpg_agent_connections 2
+ *   # TYPE gpg_agent_command_duration_seconds histogram
+ *   gpg_agent_command_duration_seconds_bucket{command="PKSIGN",le="0.001"} 0
+ *   ...
+ *
+ * Like the timer wheel there is one set of metrics per process.  It
+ * is not thread-safe but may be used from all nPth threads because
+ * it never blocks.  Values which are already kept elsewhere, for
+ * example the statistics of a cache, are best copied to a metric by
+ * a collector function registered with gnupg_metrics_add_collector;
+ * the collectors are run right before the metrics are formatted.
+ *
+ * This module also has helpers for tracing a request across
+ * processes.  The requesting process creates a trace id and passes
+ * it to the daemons with "OPTION trace-id=ID" which in turn pass it on
+ * to the daemons they call.  Each process logs the spans of the
+ * request with that id and a timestamp of the monotonic clock which,
+ * on most systems, is shared by all processes.  Thus the lines of all
+ * processes sent to the same log socket (see watchgnupg) can be
+ * merged to a timeline.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#ifdef HAVE_W32_SYSTEM
+# include <windows.h>
+#endif
+
+#include "util.h"
+#include "membuf.h"
+#include "metrics.h"
+
+/* The upper bounds of the histogram buckets in microseconds.  A last
+ * bucket without a bound takes all larger values.  */
+static const struct
+{
+  unsigned long long usecs;
+  const char *le;
+} bucket_bounds[] =
+  {
+    {       100, "0.0001" },
+    {      1000, "0.001" },
+    {     10000, "0.01" },
+    {    100000, "0.1" },
+    {   1000000, "1" },
+    {  10000000, "10" }
+  };
+#define NBUCKETS (DIM (bucket_bounds) + 1)
+
+struct gnupg_metric_s
+{
+  struct gnupg_metric_s *next;
+  enum gnupg_metric_types type;
+  char *name;
+  char *labels;                /* NULL or the labels without braces.  */
+  unsigned long long value;    /* The value or the sum of a histogram.  */
+  unsigned long long count;    /* The number of observations.  */
+  unsigned long long buckets[NBUCKETS];
+};
+
+/* The list of all metrics.  Metrics with the same name are kept
+ * together because the type line is printed only once per name.  */
+static gnupg_metric_t metric_list;
+
+/* A metric returned if we are out of core so that callers do not
+ * need to check the return value.  It is not part of the list.  */
+static struct gnupg_metric_s dummy_metric;
+
+/* The list of collectors.  */
+#define MAX_COLLECTORS 16
+static void (*collectors[MAX_COLLECTORS]) (void);
+static int ncollectors;
+
+
+/* Return the metric of TYPE with NAME and LABELS.  The metric is
+ * created if it does not yet exist.  LABELS is either NULL or a
+ * comma separated list of label assignments without the braces, for
+ * example 'command="GETINFO"'; the caller needs to take care of the
+ * escaping.  NAME should be a valid Prometheus name; the prefix given
+ * to gnupg_metrics_format is prepended to it.  This function never
+ * returns NULL.  */
+gnupg_metric_t
+gnupg_metric_get (enum gnupg_metric_types type,
+                  const char *name, const char *labels)
+{
+  gnupg_metric_t m, last_same = NULL;
+
+  for (m = metric_list; m; m = m->next)
+    if (!strcmp (m->name, name))
+      {
+        if (m->type == type
+            && (labels? (m->labels && !strcmp (m->labels, labels))
+                /**/  : !m->labels))
+          return m;
+        last_same = m;
+      }
+
+  if (last_same && last_same->type != type)
+    {
+      log_bug ("metric '%s' used with different types\n", name);
+      return &dummy_metric; /*NOTREACHED*/
+    }
+
+  m = xtrycalloc (1, sizeof *m);
+  if (!m)
+    return &dummy_metric;
+  m->type = type;
+  m->name = xtrystrdup (name);
+  m->labels = labels? xtrystrdup (labels) : NULL;
+  if (!m->name || (labels && !m->labels))
+    {
+      xfree (m->name);
+      xfree (m->labels);
+      xfree (m);
+      return &dummy_metric;
+    }
+  if (last_same)
+    {
+      m->next = last_same->next;
+      last_same->next = m;
+    }
+  else
+    {
+      m->next = metric_list;
+      metric_list = m;
+    }
+  return m;
+}
+
+
+/* Add N to METRIC which must be a counter or a gauge.  */
+void
+gnupg_metric_add (gnupg_metric_t metric, unsigned long n)
+{
+  metric->value += n;
+}
+
+
+/* Set the value of METRIC to VALUE.  This is mainly used by
+ * collectors.  */
+void
+gnupg_metric_set (gnupg_metric_t metric, unsigned long long value)
+{
+  metric->value = value;
+}
+
+
+/* Add a duration of USECS microseconds to the histogram METRIC.  */
+void
+gnupg_metric_observe (gnupg_metric_t metric, unsigned long long usecs)
+{
+  int i;
+
+  for (i=0; i < DIM (bucket_bounds); i++)
+    if (usecs <= bucket_bounds[i].usecs)
+      break;
+  metric->buckets[i]++;
+  metric->count++;
+  metric->value += usecs;
+}
+
+
+/* Register CB to be called by gnupg_metrics_format before the
+ * metrics are formatted.  A collector already registered is not
+ * added again.  */
+void
+gnupg_metrics_add_collector (void (*cb) (void))
+{
+  int i;
+
+  for (i=0; i < ncollectors; i++)
+    if (collectors[i] == cb)
+      return;
+  if (ncollectors < MAX_COLLECTORS)
+    collectors[ncollectors++] = cb;
+  else
+    log_bug ("too many metric collectors\n");
+}
+
+
+/* Return the metrics as a malloced string in the Prometheus text
+ * format.  PREFIX and an underscore are prepended to all names.
+ * Returns NULL and sets ERRNO on error.  */
+char *
+gnupg_metrics_format (const char *prefix)
+{
+  membuf_t mb;
+  gnupg_metric_t m;
+  const char *lastname = NULL;
+  const char *comma;
+  const char *labels;
+  unsigned long long n;
+  int i;
+
+  for (i=0; i < ncollectors; i++)
+    collectors[i] ();
+
+  init_membuf (&mb, 1024);
+  for (m = metric_list; m; m = m->next)
+    {
+      if (!lastname || strcmp (lastname, m->name))
+        put_membuf_printf (&mb, "# TYPE %s_%s %s\n", prefix, m->name,
+                           m->type == GNUPG_METRIC_COUNTER? "counter" :
+                           m->type == GNUPG_METRIC_GAUGE?   "gauge" :
+                           /* */                            "histogram");
+      lastname = m->name;
+      labels = m->labels? m->labels : "";
+      comma = m->labels? ",":"";
+
+      if (m->type != GNUPG_METRIC_HISTOGRAM)
+        {
+          put_membuf_printf (&mb, "%s_%s%s%s%s %llu\n", prefix, m->name,
+                             m->labels? "{":"", labels, m->labels? "}":"",
+                             m->value);
+          continue;
+        }
+
+      /* The buckets of a histogram are cumulative.  */
+      for (n=0, i=0; i < NBUCKETS; i++)
+        {
+          n += m->buckets[i];
+          put_membuf_printf (&mb, "%s_%s_bucket{%s%sle=\"%s\"} %llu\n",
+                             prefix, m->name, labels, comma,
+                             i < DIM (bucket_bounds)? bucket_bounds[i].le
+                             /**/                   : "+Inf",
+                             n);
+        }
+      put_membuf_printf (&mb, "%s_%s_sum%s%s%s %llu.%06llu\n",
+                         prefix, m->name,
+                         m->labels? "{":"", labels, m->labels? "}":"",
+                         m->value / 1000000, m->value % 1000000);
+      put_membuf_printf (&mb, "%s_%s_count%s%s%s %llu\n",
+                         prefix, m->name,
+                         m->labels? "{":"", labels, m->labels? "}":"",
+                         m->count);
+    }
+  put_membuf (&mb, "", 1);
+  return get_membuf (&mb, NULL);
+}
+
+
+/* Return a monotonic timestamp in microseconds.  */
+unsigned long long
+gnupg_metrics_now (void)
+{
+#ifdef HAVE_W32_SYSTEM
+  return GetTickCount64 () * 1000ULL;
+#else
+# ifdef HAVE_CLOCK_GETTIME
+  struct timespec ts;
+
+  if (!clock_gettime (CLOCK_MONOTONIC, &ts))
+    return ts.tv_sec * 1000000ULL + ts.tv_nsec / 1000;
+# endif
+  return (unsigned long long)time (NULL) * 1000000ULL;
+#endif
+}
+
+
+/* Account an Assuan COMMAND which started at START as returned by
+ * gnupg_metrics_now.  This is meant to be called from the post
+ * command notification of an Assuan server.  */
+void
+gnupg_metrics_command_done (const char *command, unsigned long long start)
+{
+  char name[41];
+  char labels[64];
+  int i;
+
+  if (!command || !*command)
+    return;
+
+  /* Command names consist only of letters, digits and underscores;
+   * we map all other characters so that no escaping is needed.  */
+  for (i=0; command[i] && i < sizeof name - 1; i++)
+    name[i] = (alnump (command+i) || command[i] == '_')? command[i] : '_';
+  name[i] = 0;
+  snprintf (labels, sizeof labels, "command=\"%s\"", name);
+  gnupg_metric_observe (gnupg_metric_get (GNUPG_METRIC_HISTOGRAM,
+                                          "command_duration_seconds",
+                                          labels),
+                        gnupg_metrics_now () - start);
+}
+
+
+
+/* Store a new random trace id at BUFFER which must have space for
+ * GNUPG_TRACE_ID_LEN+1 bytes.  */
+void
+gnupg_trace_new_id (char *buffer)
+{
+  unsigned char nonce[GNUPG_TRACE_ID_LEN/2];
+
+  gcry_create_nonce (nonce, sizeof nonce);
+  bin2hex (nonce, sizeof nonce, buffer);
+}
+
+
+/* Check the trace id VALUE and store it at BUFFER which must have
+ * space for GNUPG_TRACE_ID_LEN+1 bytes.  An empty VALUE disables
+ * tracing.  */
+gpg_error_t
+gnupg_trace_set_id (char *buffer, const char *value)
+{
+  const char *s;
+
+  for (s = value; *s; s++)
+    if (!hexdigitp (s))
+      return gpg_error (GPG_ERR_INV_VALUE);
+  if (s - value > GNUPG_TRACE_ID_LEN)
+    return gpg_error (GPG_ERR_INV_VALUE);
+  strcpy (buffer, value);
+  return 0;
+}
+
+
+/* Log the span NAME of COMPONENT which started at START as returned
+ * by gnupg_metrics_now and ends now.  Nothing is logged if TRACE_ID
+ * is NULL or empty.  */
+void
+gnupg_trace_span (const char *trace_id, const char *component,
+                  const char *name, unsigned long long start)
+{
+  unsigned long long duration;
+
+  if (!trace_id || !*trace_id)
+    return;
+
+  duration = gnupg_metrics_now () - start;
+  log_info ("trace %s: %s %s start=%llu.%06llu duration=%llu.%06llu\n",
+            trace_id, component, name? name : "-",
+            start / 1000000, start % 1000000,
+            duration / 1000000, duration % 1000000);
+}
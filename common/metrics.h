@@ -0,0 +1,78 @@
+/* metrics.h - Definitions for the metrics of the daemons
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: (LGPL-3.0-or-later OR GPL-2.0-or-later)
+ */
+
+#ifndef GNUPG_COMMON_METRICS_H
+#define GNUPG_COMMON_METRICS_H
+
+#include <gpg-error.h> /* We need gpg_error_t.  */
+
+/* The types of metrics.  */
+enum gnupg_metric_types
+  {
+    GNUPG_METRIC_COUNTER,   /* A monotonic increasing value.  */
+    GNUPG_METRIC_GAUGE,     /* A value which may go up and down.  */
+    GNUPG_METRIC_HISTOGRAM  /* A distribution of durations.  */
+  };
+
+/* A metric.  The objects are owned by this module and never
+ * released.  */
+typedef struct gnupg_metric_s *gnupg_metric_t;
+
+gnupg_metric_t gnupg_metric_get (enum gnupg_metric_types type,
+                                 const char *name, const char *labels);
+void gnupg_metric_add (gnupg_metric_t metric, unsigned long n);
+void gnupg_metric_set (gnupg_metric_t metric, unsigned long long value);
+void gnupg_metric_observe (gnupg_metric_t metric, unsigned long long usecs);
+
+void gnupg_metrics_add_collector (void (*cb) (void));
+char *gnupg_metrics_format (const char *prefix);
+
+unsigned long long gnupg_metrics_now (void);
+void gnupg_metrics_command_done (const char *command,
+                                 unsigned long long start);
+
+/* The length of a trace id.  A buffer for a trace id needs to have
+ * space for this many characters plus the terminating zero.  */
+#define GNUPG_TRACE_ID_LEN 32
+
+void gnupg_trace_new_id (char *buffer);
+gpg_error_t gnupg_trace_set_id (char *buffer, const char *value);
+void gnupg_trace_span (const char *trace_id, const char *component,
+                       const char *name, unsigned long long start);
+
+/* Shortcuts to get a metric without labels.  */
+#define gnupg_metric_counter(name) \
+  gnupg_metric_get (GNUPG_METRIC_COUNTER, (name), NULL)
+#define gnupg_metric_gauge(name) \
+  gnupg_metric_get (GNUPG_METRIC_GAUGE, (name), NULL)
+#define gnupg_metric_histogram(name) \
+  gnupg_metric_get (GNUPG_METRIC_HISTOGRAM, (name), NULL)
+
+#endif /*GNUPG_COMMON_METRICS_H*/
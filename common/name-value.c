@@ -83,6 +83,22 @@ my_error (gpg_err_code_t ec)
 }
 
 
+/* Append STRING to the list whose last item is *TAIL or to *LIST if
+ * *TAIL is NULL and update *TAIL.  Values with many lines are common
+ * thus we can't use append_to_strlist_try which walks the entire list
+ * for each line.  Returns NULL on error.  */
+static strlist_t
+append_line (strlist_t *list, strlist_t *tail, const char *string)
+{
+  strlist_t sl;
+
+  sl = append_to_strlist_try (*tail? &(*tail)->next : list, string);
+  if (sl)
+    *tail = sl;
+  return sl;
+}
+
+
 
 
 /* Allocation and deallocation.  */
@@ -171,6 +187,7 @@ assert_raw_value (nve_t entry)
 {
   gpg_error_t err = 0;
   size_t len, offset;
+  strlist_t tail = NULL;
 #define LINELEN	70
   char buf[LINELEN+3];
 
@@ -213,7 +230,7 @@ assert_raw_value (nve_t entry)
 
       snprintf (buf, sizeof buf, " %.*s\n", (int) amount,
 		&entry->value[offset]);
-      if (append_to_strlist_try (&entry->raw_value, buf) == NULL)
+      if (append_line (&entry->raw_value, &tail, buf) == NULL)
 	{
 	  err = my_error_from_syserror ();
 	  goto leave;
@@ -692,6 +709,7 @@ do_nvc_parse (nvc_t *result, int *errlinep, estream_t stream,
   size_t buf_len = 0;
   char *name = NULL;
   strlist_t raw_value = NULL;
+  strlist_t raw_tail = NULL;
 
   *result = for_private_key? nvc_new_private_key () : nvc_new ();
   if (*result == NULL)
@@ -712,7 +730,7 @@ do_nvc_parse (nvc_t *result, int *errlinep, estream_t stream,
       if (name && (spacep (buf) || *p == 0))
 	{
 	  /* A continuation.  */
-	  if (append_to_strlist_try (&raw_value, buf) == NULL)
+	  if (append_line (&raw_value, &raw_tail, buf) == NULL)
 	    {
 	      err = my_error_from_syserror ();
 	      goto leave;
@@ -731,6 +749,7 @@ do_nvc_parse (nvc_t *result, int *errlinep, estream_t stream,
       /* And prepare for the next one.  */
       name = NULL;
       raw_value = NULL;
+      raw_tail = NULL;
 
       if (*p != 0 && *p != '#')
 	{
@@ -755,7 +774,7 @@ do_nvc_parse (nvc_t *result, int *errlinep, estream_t stream,
 	      goto leave;
 	    }
 
-	  if (append_to_strlist_try (&raw_value, value) == NULL)
+	  if (append_line (&raw_value, &raw_tail, value) == NULL)
 	    {
 	      err = my_error_from_syserror ();
 	      goto leave;
@@ -763,7 +782,7 @@ do_nvc_parse (nvc_t *result, int *errlinep, estream_t stream,
 	  continue;
 	}
 
-      if (append_to_strlist_try (&raw_value, buf) == NULL)
+      if (append_line (&raw_value, &raw_tail, buf) == NULL)
 	{
 	  err = my_error_from_syserror ();
 	  goto leave;
@@ -29,6 +29,7 @@
 
 #include <config.h>
 #include <stdlib.h>
+#include <string.h>
 #include <errno.h>
 #include <ctype.h>
 #include <assert.h>
@@ -87,6 +88,45 @@ percent_plus_escape (const char *string)
 }
 
 
+/* State for finding the bytes which need escaping in binary data.
+ * Instead of looking at each byte we let memchr, which is usually
+ * vectorized, find the next Nul and the next percent sign and
+ * remember them until we have passed them.  */
+struct data_scan_s
+{
+  const unsigned char *end;
+  const unsigned char *nul;  /* Next Nul or NULL if there is none.  */
+  const unsigned char *pct;  /* Next '%' or NULL if there is none.  */
+};
+
+
+static void
+data_scan_init (struct data_scan_s *sc, const unsigned char *data,
+                size_t datalen)
+{
+  sc->end = data + datalen;
+  sc->nul = memchr (data, 0, datalen);
+  sc->pct = memchr (data, '%', datalen);
+}
+
+
+/* Return the first byte at or after S which needs escaping or NULL
+ * if there is none.  */
+static const unsigned char *
+data_scan_next (struct data_scan_s *sc, const unsigned char *s)
+{
+  if (sc->nul && sc->nul < s)
+    sc->nul = memchr (s, 0, sc->end - s);
+  if (sc->pct && sc->pct < s)
+    sc->pct = memchr (s, '%', sc->end - s);
+  if (!sc->nul)
+    return sc->pct;
+  if (!sc->pct)
+    return sc->nul;
+  return sc->nul < sc->pct? sc->nul : sc->pct;
+}
+
+
 /* Create a newly malloced string from (DATA,DATALEN) with embedded
  * nuls quoted as %00.  The standard percent unescaping can be used to
  * reverse this encoding.  With PLUS_ESCAPE set plus-escaping (spaces
@@ -99,9 +139,10 @@ percent_data_escape (int plus_escape, const char *prefix,
                      const void *data, size_t datalen)
 {
   char *buffer, *p;
-  const unsigned char *s;
+  const unsigned char *s, *q;
   size_t n;
   size_t length = 1;
+  struct data_scan_s sc;
 
   if (prefix)
     {
@@ -114,12 +155,24 @@ percent_data_escape (int plus_escape, const char *prefix,
         }
     }
 
-  for (s=data, n=datalen; n; s++, n--)
+  if (plus_escape)
     {
-      if (!*s || *s == '%' || (plus_escape && (*s < ' ' || *s == '+')))
-        length += 3;
-      else
-        length++;
+      for (s=data, n=datalen; n; s++, n--)
+        {
+          if (!*s || *s == '%' || *s < ' ' || *s == '+')
+            length += 3;
+          else
+            length++;
+        }
+    }
+  else
+    {
+      /* Only Nul and '%' need escaping; thus copy the runs in
+       * between as a whole.  */
+      data_scan_init (&sc, data, datalen);
+      length += datalen;
+      for (s = data; (q = data_scan_next (&sc, s)); s = q + 1)
+        length += 2;
     }
 
   buffer = p = xtrymalloc (length);
@@ -140,6 +193,22 @@ percent_data_escape (int plus_escape, const char *prefix,
         }
     }
 
+  if (!plus_escape)
+    {
+      data_scan_init (&sc, data, datalen);
+      for (s = data; (q = data_scan_next (&sc, s)); s = q + 1)
+        {
+          memcpy (p, s, q - s);
+          p += q - s;
+          memcpy (p, *q? "%25" : "%00", 3);
+          p += 3;
+        }
+      memcpy (p, s, sc.end - s);
+      p += sc.end - s;
+      *p = 0;
+      return buffer;
+    }
+
   for (s=data, n=datalen; n; s++, n--)
     {
       if (!*s)
@@ -152,11 +221,11 @@ percent_data_escape (int plus_escape, const char *prefix,
           memcpy (p, "%25", 3);
           p += 3;
         }
-      else if (plus_escape && *s == ' ')
+      else if (*s == ' ')
         {
           *p++ = '+';
         }
-      else if (plus_escape && (*s < ' ' || *s == '+'))
+      else if (*s < ' ' || *s == '+')
         {
           snprintf (p, 4, "%%%02X", *s);
           p += 3;
@@ -179,9 +248,18 @@ do_unescape (unsigned char *buffer, const unsigned char *string,
              int withplus, int nulrepl)
 {
   unsigned char *p = buffer;
+  size_t n;
 
   while (*string)
     {
+      /* Copy the run of bytes which need no unescaping at once.  */
+      n = strcspn ((const char *)string, withplus? "%+" : "%");
+      memcpy (p, string, n);
+      p += n;
+      string += n;
+      if (!*string)
+        break;
+
       if (*string == '%' && string[1] && string[2])
         {
           string++;
@@ -207,20 +285,24 @@ do_unescape (unsigned char *buffer, const unsigned char *string,
 static size_t
 count_unescape (const unsigned char *string)
 {
+  const char *s = (const char *)string;
+  const char *pct;
   size_t n = 0;
 
-  while (*string)
+  while ((pct = strchr (s, '%')))
     {
-      if (*string == '%' && string[1] && string[2])
+      n += pct - s;
+      s = pct;
+      if (s[1] && s[2])
         {
-          string++;
-          string++;
+          s++;
+          s++;
         }
-      string++;
+      s++;
       n++;
     }
 
-  return n;
+  return n + strlen (s);
 }
 
 
@@ -269,10 +351,20 @@ static size_t
 do_unescape_inplace (char *string, int withplus, int nulrepl)
 {
   unsigned char *p, *p0;
+  size_t n;
 
   p = p0 = string;
   while (*string)
     {
+      /* Move the run of bytes which need no unescaping at once.  */
+      n = strcspn (string, withplus? "%+" : "%");
+      if (p != (unsigned char *)string)
+        memmove (p, string, n);
+      p += n;
+      string += n;
+      if (!*string)
+        break;
+
       if (*string == '%' && string[1] && string[2])
         {
           string++;
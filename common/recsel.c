@@ -65,6 +65,7 @@ struct recsel_expr_s
   unsigned int disjun:1;/* Start of a disjunction.  */
   unsigned int xcase:1; /* String match is case sensitive.  */
   const char *value;    /* (Points into NAME.)  */
+  size_t valuelen;      /* strlen of VALUE.  */
   long numvalue;        /* strtol of VALUE.  */
   char name[1];         /* Name of the property.  */
 };
@@ -435,6 +436,7 @@ recsel_parse_expr (recsel_expr_t *selector, const char *expression)
       return my_error (GPG_ERR_MISSING_VALUE);
     }
 
+  se->valuelen = strlen (se->value);
   se->numvalue = strtol (se->value, NULL, 0);
 
   if (next_lc)
@@ -505,24 +507,38 @@ recsel_dump (recsel_expr_t selector)
 
 /* Return true if the record RECORD has been selected.  The GETVAL
  * function is called with COOKIE and the NAME of a property used in
- * the expression.  */
+ * the expression.  GETVAL is only called for the properties actually
+ * needed to decide and only once for a property tested by
+ * consecutive expressions; thus it should not have side effects.  */
 int
 recsel_select (recsel_expr_t selector,
                const char *(*getval)(void *cookie, const char *propname),
                void *cookie)
 {
-  recsel_expr_t se;
-  const char *value;
-  size_t selen, valuelen;
-  long numvalue;
+  recsel_expr_t se, lastse;
+  const char *value = NULL;
+  size_t selen, valuelen = 0;
+  long numvalue = 0;
+  int havenum = 0;
   int result = 1;
 
+  lastse = NULL;
   se = selector;
   while (se)
     {
-      value = getval? getval (cookie, se->name) : NULL;
-      if (!value)
-        value = "";
+      /* Only call GETVAL if the property differs from the one used
+       * by the last evaluated expression.  The value returned for
+       * that would still be valid because no other call has been
+       * done meanwhile.  */
+      if (!lastse || strcmp (lastse->name, se->name))
+        {
+          value = getval? getval (cookie, se->name) : NULL;
+          if (!value)
+            value = "";
+          valuelen = strlen (value);
+          havenum = 0;
+        }
+      lastse = se;
 
       if (!*value)
         {
@@ -531,9 +547,13 @@ recsel_select (recsel_expr_t selector,
         }
       else /* Field has a value.  */
         {
-          valuelen = strlen (value);
-          numvalue = strtol (value, NULL, 0);
-          selen = strlen (se->value);
+          selen = se->valuelen;
+          if (!havenum && se->op >= SELECT_ISTRUE && se->op <= SELECT_GT)
+            {
+              /* Convert to a number only for numerical operators.  */
+              numvalue = strtol (value, NULL, 0);
+              havenum = 1;
+            }
 
           switch (se->op)
             {
@@ -390,5 +390,66 @@ main (int argc, char *argv[])
     iobuf_close (iobuf);
   }
 
+  /* Check that a memory mapped view of a file starts at the current
+     read position and that the data is then consumed.  */
+  {
+    const char fname[] = "t-iobuf-mmap.tmp";
+    char content[] = "0123456789abcdefghij";
+    struct iobuf_mmap_view_s view;
+    iobuf_t iobuf;
+    FILE *fp;
+    int c;
+
+    fp = fopen (fname, "wb");
+    assert (fp);
+    assert (fwrite (content, strlen (content), 1, fp) == 1);
+    assert (!fclose (fp));
+
+    iobuf = iobuf_open (fname);
+    assert (iobuf);
+
+    c = iobuf_get (iobuf);
+    assert (c == '0');
+    c = iobuf_get (iobuf);
+    assert (c == '1');
+
+    if (!iobuf_ioctl (iobuf, IOBUF_IOCTL_MMAP_VIEW, 0, &view))
+      {
+        assert (view.len == strlen (content) - 2);
+        assert (!memcmp (view.buf, content + 2, view.len));
+        assert (iobuf_tell (iobuf) == strlen (content));
+        assert (iobuf_get (iobuf) == -1);
+      }
+    else
+      {
+        /* Not supported on this platform; the pipeline must not have
+           been changed.  */
+        c = iobuf_get (iobuf);
+        assert (c == '2');
+      }
+
+    iobuf_close (iobuf);
+    remove (fname);
+  }
+
+  /* Check that iobuf_temp_with_buffer takes over the buffer.  */
+  {
+    char *content = "0123456789abcdefghijklm";
+    char *buffer;
+    char readbuf[64];
+    iobuf_t iobuf;
+    int n;
+
+    buffer = malloc (strlen (content) + 1);
+    assert (buffer);
+    strcpy (buffer, content);
+    iobuf = iobuf_temp_with_buffer (buffer, strlen (content));
+    n = iobuf_read (iobuf, readbuf, sizeof readbuf);
+    assert (n == strlen (content));
+    assert (!memcmp (readbuf, content, n));
+    assert (iobuf_get (iobuf) == -1);
+    iobuf_close (iobuf);
+  }
+
   return 0;
 }
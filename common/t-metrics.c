@@ -0,0 +1,133 @@
+/* t-metrics.c - Regression tests for metrics.c
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute and/or modify this
+ * part of GnuPG under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * GnuPG is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copies of the GNU General Public License
+ * and the GNU Lesser General Public License along with this program;
+ * if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "metrics.h"
+
+#include "t-support.h"
+
+static int verbose;
+static int collected;
+
+
+static void
+collector (void)
+{
+  collected++;
+  gnupg_metric_set (gnupg_metric_gauge ("connections"), 3);
+}
+
+
+/* Return true if TEXT has a line LINE.  */
+static int
+has_line (const char *text, const char *line)
+{
+  size_t n = strlen (line);
+  const char *s;
+
+  for (s = text; (s = strstr (s, line)); s += n)
+    if ((s == text || s[-1] == '\n') && s[n] == '\n')
+      return 1;
+  return 0;
+}
+
+
+static void
+test_metrics (void)
+{
+  gnupg_metric_t m;
+  char *text;
+
+  m = gnupg_metric_counter ("hits");
+  if (m != gnupg_metric_counter ("hits"))
+    fail (1);
+  gnupg_metric_add (m, 2);
+  gnupg_metric_add (gnupg_metric_counter ("hits"), 3);
+  gnupg_metric_add (gnupg_metric_get (GNUPG_METRIC_COUNTER, "hits",
+                                      "cache=\"blob\""), 7);
+
+  m = gnupg_metric_histogram ("latency_seconds");
+  gnupg_metric_observe (m, 50);
+  gnupg_metric_observe (m, 100);
+  gnupg_metric_observe (m, 5000);
+  gnupg_metric_observe (m, 2000000000);
+
+  gnupg_metrics_command_done ("GETINFO", gnupg_metrics_now ());
+  gnupg_metrics_command_done ("BAD-NAME\"", gnupg_metrics_now ());
+
+  gnupg_metrics_add_collector (collector);
+  gnupg_metrics_add_collector (collector);
+
+  text = gnupg_metrics_format ("test");
+  if (!text)
+    fail (2);
+  if (verbose)
+    fputs (text, stdout);
+  if (collected != 1)
+    fail (3);
+  if (!has_line (text, "test_connections 3"))
+    fail (4);
+  if (!has_line (text, "test_hits 5")
+      || !has_line (text, "test_hits{cache=\"blob\"} 7"))
+    fail (5);
+  /* The type line must be printed only once per name.  */
+  if (!strstr (text, "# TYPE test_hits counter\ntest_hits 5\n"
+               "test_hits{cache=\"blob\"} 7\n"))
+    fail (6);
+  if (!has_line (text, "test_latency_seconds_bucket{le=\"0.0001\"} 2")
+      || !has_line (text, "test_latency_seconds_bucket{le=\"0.001\"} 2")
+      || !has_line (text, "test_latency_seconds_bucket{le=\"0.01\"} 3")
+      || !has_line (text, "test_latency_seconds_bucket{le=\"10\"} 3")
+      || !has_line (text, "test_latency_seconds_bucket{le=\"+Inf\"} 4")
+      || !has_line (text, "test_latency_seconds_sum 2000.005150")
+      || !has_line (text, "test_latency_seconds_count 4"))
+    fail (7);
+  if (!has_line (text, "test_command_duration_seconds_count"
+                 "{command=\"GETINFO\"} 1")
+      || !has_line (text, "test_command_duration_seconds_count"
+                    "{command=\"BAD_NAME_\"} 1"))
+    fail (8);
+  xfree (text);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  test_metrics ();
+
+  return 0;
+}
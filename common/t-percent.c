@@ -307,6 +307,82 @@ test_percent_data_escape_plus (void)
 }
 
 
+/* Check the unescaping with long runs of bytes which need no
+ * unescaping and with incomplete escapes.  */
+static void
+test_percent_unescape (void)
+{
+  static struct {
+    const char *string;
+    int withplus;
+    const char *expect;
+  } tbl[] = {
+    { "",            0, "" },
+    { "abc",         0, "abc" },
+    { "a+b",         0, "a+b" },
+    { "a+b",         1, "a b" },
+    { "%41%42c",     0, "ABc" },
+    { "ab%2",        0, "ab%2" },
+    { "ab%",         1, "ab%" },
+    { "+%2B+",       1, " + " },
+    { "x%00y",       0, "x\x01y" },
+    { NULL, 0, NULL }
+  };
+  unsigned char data[1000];
+  char *buf, *buf2;
+  size_t len, n;
+  int i;
+
+  for (i=0; tbl[i].string; i++)
+    {
+      if (tbl[i].withplus)
+        buf = percent_plus_unescape (tbl[i].string, 1);
+      else
+        buf = percent_unescape (tbl[i].string, 1);
+      if (!buf)
+        {
+          fprintf (stderr, "out of core: %s\n", strerror (errno));
+          exit (2);
+        }
+      if (strcmp (buf, tbl[i].expect))
+        fail (i);
+      xfree (buf);
+
+      buf = xstrdup (tbl[i].string);
+      if (tbl[i].withplus)
+        len = percent_plus_unescape_inplace (buf, 1);
+      else
+        len = percent_unescape_inplace (buf, 1);
+      if (len != strlen (tbl[i].expect) || memcmp (buf, tbl[i].expect, len))
+        fail (i);
+      xfree (buf);
+    }
+
+  /* Long runs with a few bytes which need escaping.  */
+  for (n=0; n < sizeof data; n++)
+    data[n] = (n % 97) == 5? 0 : (n % 211) == 7? '%' : 'a' + (n % 26);
+  buf = percent_data_escape (0, NULL, data, sizeof data);
+  if (!buf)
+    {
+      fprintf (stderr, "out of core: %s\n", strerror (errno));
+      exit (2);
+    }
+  buf2 = percent_unescape (buf, 0);
+  if (!buf2)
+    {
+      fprintf (stderr, "out of core: %s\n", strerror (errno));
+      exit (2);
+    }
+  if (memcmp (buf2, data, sizeof data) || buf2[sizeof data])
+    fail (100);
+  len = percent_unescape_inplace (buf, 0);
+  if (len != sizeof data || memcmp (buf, data, sizeof data))
+    fail (101);
+  xfree (buf2);
+  xfree (buf);
+}
+
+
 int
 main (int argc, char **argv)
 {
@@ -317,5 +393,6 @@ main (int argc, char **argv)
   test_percent_plus_escape ();
   test_percent_data_escape ();
   test_percent_data_escape_plus ();
+  test_percent_unescape ();
   return 0;
 }
@@ -384,6 +384,58 @@ run_test_2 (void)
 
 
 
+static int test_3_calls;
+
+static const char *
+test_3_getval (void *cookie, const char *name)
+{
+  (void)cookie;
+
+  test_3_calls++;
+  if (!strcmp (name, "uid"))
+    return "Bravo Test";
+  else if (!strcmp (name, "created"))
+    return "1500";
+  return NULL;
+}
+
+static void
+run_test_3 (void)
+{
+  gpg_error_t err;
+  recsel_expr_t se = NULL;
+
+  /* Properties tested by consecutive expressions are retrieved only
+   * once.  */
+  ADDEXPR ("uid =~ alfa || uid =~ bravo");
+  test_3_calls = 0;
+  if (!recsel_select (se, test_3_getval, NULL))
+    fail (0, 0);
+  if (test_3_calls != 1)
+    fail (0, 0);
+
+  FREEEXPR();
+  ADDEXPR ("uid =~ bravo && created > 1000 && created -le 2000");
+  test_3_calls = 0;
+  if (!recsel_select (se, test_3_getval, NULL))
+    fail (0, 0);
+  if (test_3_calls != 2)
+    fail (0, 0);
+
+  /* Expressions of a false conjunction are not evaluated.  */
+  FREEEXPR();
+  ADDEXPR ("uid =~ alfa && created > 1000 || uid -n");
+  test_3_calls = 0;
+  if (!recsel_select (se, test_3_getval, NULL))
+    fail (0, 0);
+  if (test_3_calls != 1)
+    fail (0, 0);
+
+  FREEEXPR();
+}
+
+
+
 int
 main (int argc, char **argv)
 {
@@ -432,6 +484,7 @@ main (int argc, char **argv)
   run_test_1 ();
   run_test_1b ();
   run_test_2 ();
+  run_test_3 ();
   /* Fixme: We should add test for complex conditions.  */
 
   return 0;
@@ -0,0 +1,219 @@
+/* t-timerwheel.c - Regression tests for timerwheel.c
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute and/or modify this
+ * part of GnuPG under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * GnuPG is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copies of the GNU General Public License
+ * and the GNU Lesser General Public License along with this program;
+ * if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "timerwheel.h"
+
+#include "t-support.h"
+
+#define NTIMERS 500
+
+/* The time the test pretends it is.  */
+static time_t now;
+
+struct item_s
+{
+  struct gnupg_timer_s timer;
+  int fired;
+  time_t fired_at;
+};
+
+static struct item_s items[NTIMERS];
+static int notified;
+
+
+static void
+item_cb (void *opaque)
+{
+  struct item_s *item = opaque;
+
+  item->fired++;
+  item->fired_at = now;
+}
+
+
+static void
+notify_cb (void)
+{
+  notified++;
+}
+
+
+/* Advance the time to T one step at a time the way a main loop would
+ * do it.  */
+static void
+run_until (time_t t)
+{
+  long n;
+
+  for (;;)
+    {
+      gnupg_timer_run (now);
+      n = gnupg_timer_next (now);
+      if (n < 0 || now + n > t)
+        break;
+      now += n? n : 1;
+    }
+  now = t;
+  gnupg_timer_run (now);
+}
+
+
+static void
+test_many (void)
+{
+  time_t start = now;
+  unsigned int seed = 4711;
+  int i;
+
+  for (i=0; i < NTIMERS; i++)
+    {
+      gnupg_timer_init (&items[i].timer, item_cb, &items[i]);
+      items[i].fired = 0;
+      /* Spread the deadlines over all levels and beyond.  */
+      seed = seed * 1103515245 + 12345;
+      gnupg_timer_set (&items[i].timer,
+                       start + ((seed >> 4) % (1L << (4 + (i % 21)))));
+      if (!gnupg_timer_pending (&items[i].timer))
+        fail (1);
+    }
+
+  /* Cancel some of them.  */
+  for (i=0; i < NTIMERS; i += 7)
+    {
+      gnupg_timer_cancel (&items[i].timer);
+      if (gnupg_timer_pending (&items[i].timer))
+        fail (2);
+    }
+
+  run_until (start + (1L << 25));
+
+  for (i=0; i < NTIMERS; i++)
+    {
+      if (!(i % 7))
+        {
+          if (items[i].fired)
+            fail (3);
+          continue;
+        }
+      if (items[i].fired != 1)
+        fail (4);
+      if (items[i].fired_at != items[i].timer.deadline)
+        fail (5);
+      if (gnupg_timer_pending (&items[i].timer))
+        fail (6);
+    }
+  if (gnupg_timer_next (now) != -1)
+    fail (7);
+}
+
+
+/* A callback which re-arms its timer.  */
+static void
+rearm_cb (void *opaque)
+{
+  struct item_s *item = opaque;
+
+  item->fired++;
+  if (item->fired < 10)
+    gnupg_timer_set (&item->timer, now + 5);
+}
+
+
+static void
+test_rearm (void)
+{
+  time_t start = now;
+
+  gnupg_timer_init (&items[0].timer, rearm_cb, &items[0]);
+  items[0].fired = 0;
+  gnupg_timer_set (&items[0].timer, start + 5);
+  if (gnupg_timer_next (now) != 5)
+    fail (1);
+  run_until (start + 100);
+  if (items[0].fired != 10)
+    fail (2);
+  if (gnupg_timer_pending (&items[0].timer))
+    fail (3);
+}
+
+
+static void
+test_notify (void)
+{
+  gnupg_timer_init (&items[0].timer, item_cb, &items[0]);
+  gnupg_timer_init (&items[1].timer, item_cb, &items[1]);
+  items[0].fired = items[1].fired = 0;
+
+  gnupg_timer_set_notify (notify_cb);
+  gnupg_timer_set (&items[0].timer, now + 1000);
+  if (gnupg_timer_next (now) > 1000)
+    fail (1);
+  notified = 0;
+  /* A later deadline does not require a wakeup.  */
+  gnupg_timer_set (&items[1].timer, now + 2000);
+  if (notified)
+    fail (2);
+  /* But an earlier one does.  */
+  gnupg_timer_set (&items[1].timer, now + 10);
+  if (notified != 1)
+    fail (3);
+  if (gnupg_timer_next (now) != 10)
+    fail (4);
+  /* A timer already due must be run at once.  */
+  gnupg_timer_set (&items[1].timer, now - 1);
+  if (gnupg_timer_next (now))
+    fail (5);
+  gnupg_timer_run (now);
+  if (items[1].fired != 1 || items[0].fired)
+    fail (6);
+  gnupg_timer_cancel (&items[0].timer);
+  gnupg_timer_set_notify (NULL);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  (void)argc;
+  (void)argv;
+
+  now = 1500000000 + 4711;
+  gnupg_timer_run (now);
+
+  test_many ();
+  test_rearm ();
+  test_notify ();
+
+  return 0;
+}
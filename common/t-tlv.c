@@ -0,0 +1,152 @@
+/* t-tlv.c - Regression tests for tlv.c
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute and/or modify this
+ * part of GnuPG under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * GnuPG is distributed in the hope that it will be useful, but
+ * WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copies of the GNU General Public License
+ * and the GNU Lesser General Public License along with this program;
+ * if not, see <https://www.gnu.org/licenses/>.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <gpg-error.h>
+
+#include "tlv.h"
+
+#include "t-support.h"
+
+static int verbose;
+
+
+/* An application related data object (6E) as returned by an OpenPGP
+   card with a filler byte, a two byte tag (5F52), a nested
+   constructed DO (73), a tag present twice (C1) and a last object
+   which is longer than the buffer.  */
+static const unsigned char sample[] = {
+  0x6E, 0x2A,
+    0x4F, 0x04, 0xD2, 0x76, 0x00, 0x01,
+    0x00,
+    0x5F, 0x52, 0x02, 0x00, 0x73,
+    0x73, 0x14,
+      0xC0, 0x02, 0x7D, 0x00,
+      0xC1, 0x03, 0x01, 0x08, 0x00,
+      0xC2, 0x03, 0x01, 0x08, 0x00,
+      0xC4, 0x04, 0x00, 0x7F, 0x7F, 0x7F,
+    0xC1, 0x02, 0x12, 0x34,
+    0xC5, 0x04, 0xAA, 0xBB
+};
+
+
+/* Check that the index returns the same as find_tlv for all tags.  */
+static void
+test_index (const unsigned char *buffer, size_t length)
+{
+  gpg_error_t err;
+  tlv_index_t ti;
+  const unsigned char *p1, *p2;
+  size_t n1, n2;
+  int tag;
+
+  err = tlv_index_new (&ti, buffer, length);
+  if (err)
+    fail (1);
+
+  for (tag = 0; tag < 0x10000; tag++)
+    {
+      n1 = n2 = 0;
+      p1 = find_tlv (buffer, length, tag, &n1);
+      p2 = tlv_index_find (ti, tag, &n2);
+      if (p1 != p2 || n1 != n2)
+        {
+          if (verbose)
+            fprintf (stderr, "tag %04X: %p/%zu != %p/%zu\n",
+                     tag, p1, n1, p2, n2);
+          fail (2);
+        }
+
+      n1 = n2 = 0;
+      p1 = find_tlv_unchecked (buffer, length, tag, &n1);
+      p2 = tlv_index_find_unchecked (ti, tag, &n2);
+      if (p1 != p2 || n1 != n2)
+        fail (3);
+    }
+
+  tlv_index_release (ti);
+}
+
+
+static void
+test_lookups (void)
+{
+  gpg_error_t err;
+  tlv_index_t ti;
+  const unsigned char *p;
+  size_t n;
+
+  err = tlv_index_new (&ti, sample, sizeof sample);
+  if (err)
+    fail (1);
+
+  p = tlv_index_find (ti, 0x5F52, &n);
+  if (!p || n != 2 || p[1] != 0x73)
+    fail (2);
+  /* The nested C1 comes first.  */
+  p = tlv_index_find (ti, 0xC1, &n);
+  if (!p || n != 3 || p[0] != 0x01)
+    fail (3);
+  /* C5 exceeds the buffer.  */
+  if (tlv_index_find (ti, 0xC5, &n))
+    fail (4);
+  if (!tlv_index_find_unchecked (ti, 0xC5, &n) || n != 4)
+    fail (5);
+  if (tlv_index_find (ti, 0xC3, &n))
+    fail (6);
+
+  tlv_index_release (ti);
+
+  /* An empty buffer.  */
+  err = tlv_index_new (&ti, sample, 0);
+  if (err)
+    fail (7);
+  if (tlv_index_find (ti, 0x6E, &n))
+    fail (8);
+  tlv_index_release (ti);
+}
+
+
+int
+main (int argc, char **argv)
+{
+  if (argc > 1 && !strcmp (argv[1], "--verbose"))
+    verbose = 1;
+
+  test_lookups ();
+  test_index (sample, sizeof sample);
+  test_index (sample + 2, 12);
+  test_index (sample + 16, 20);
+
+  return !!errcount;
+}
@@ -0,0 +1,307 @@
+/* timerwheel.c - A hierarchical timer wheel
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: (LGPL-3.0-or-later OR GPL-2.0-or-later)
+ */
+
+/* This module keeps the timers of a daemon so that its main loop can
+ * sleep until the next deadline instead of waking up at a fixed
+ * interval.  The resolution is one second.  There is one wheel per
+ * process; it is not thread-safe but may be used from all nPth
+ * threads because it never blocks.  The callbacks are run by
+ * gnupg_timer_run which is expected to be called by the main loop.
+ *
+ * The wheel has WHEEL_LEVELS levels of WHEEL_SLOTS slots each.  A
+ * slot of level L covers WHEEL_SLOTS^L seconds.  A timer is put into
+ * the lowest level which can hold its deadline and moved down to the
+ * next lower level when the time reaches the start of its slot.
+ * Setting and cancelling a timer is thus O(1).  Deadlines beyond the
+ * range of the wheel are put into the last slot of the highest level
+ * and inserted again when that slot is reached.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "util.h"
+#include "timerwheel.h"
+
+#define WHEEL_BITS    6
+#define WHEEL_SLOTS   (1 << WHEEL_BITS)
+#define WHEEL_MASK    (WHEEL_SLOTS - 1)
+#define WHEEL_LEVELS  4
+
+/* The number of seconds covered by one slot of LEVEL.  */
+#define SLOT_SPAN(level) ((time_t)1 << ((level) * WHEEL_BITS))
+
+/* The range of the wheel in seconds.  */
+#define WHEEL_RANGE   SLOT_SPAN (WHEEL_LEVELS)
+
+/* The slots of all levels.  */
+static gnupg_timer_t wheel[WHEEL_LEVELS][WHEEL_SLOTS];
+
+/* The list of timers which are due.  */
+static gnupg_timer_t due_list;
+
+/* The time up to which the wheel has been processed.  0 if the wheel
+ * has not yet been used.  */
+static time_t wheel_time;
+
+/* The deadline returned by the last call to gnupg_timer_next or 0.  */
+static time_t wakeup_time;
+
+/* Set while gnupg_timer_run is active.  */
+static int running;
+
+/* The callback to notify the main loop about an earlier wakeup.  */
+static void (*notify_cb) (void);
+
+
+
+/* Put TIMER into the list at LISTP.  */
+static void
+link_timer (gnupg_timer_t *listp, gnupg_timer_t timer)
+{
+  timer->next = *listp;
+  if (timer->next)
+    timer->next->prevp = &timer->next;
+  timer->prevp = listp;
+  *listp = timer;
+}
+
+
+/* Remove TIMER from its list.  */
+static void
+unlink_timer (gnupg_timer_t timer)
+{
+  *timer->prevp = timer->next;
+  if (timer->next)
+    timer->next->prevp = timer->prevp;
+  timer->next = NULL;
+  timer->prevp = NULL;
+}
+
+
+/* Put the TIMER into the slot for its deadline relative to
+ * WHEEL_TIME.  */
+static void
+insert_timer (gnupg_timer_t timer)
+{
+  time_t expires = timer->deadline;
+  time_t delta;
+  int level;
+
+  if (expires <= wheel_time)
+    {
+      link_timer (&due_list, timer);
+      return;
+    }
+
+  delta = expires - wheel_time;
+  if (delta >= WHEEL_RANGE)
+    {
+      expires = wheel_time + WHEEL_RANGE - 1;
+      delta = WHEEL_RANGE - 1;
+    }
+  for (level = 0; level < WHEEL_LEVELS - 1; level++)
+    if (delta < SLOT_SPAN (level + 1))
+      break;
+  link_timer (&wheel[level][(expires >> (level * WHEEL_BITS)) & WHEEL_MASK],
+              timer);
+}
+
+
+/* Initialize TIMER to call CB with OPAQUE.  */
+void
+gnupg_timer_init (gnupg_timer_t timer, void (*cb) (void *opaque),
+                  void *opaque)
+{
+  memset (timer, 0, sizeof *timer);
+  timer->cb = cb;
+  timer->opaque = opaque;
+}
+
+
+/* Set TIMER to fire at DEADLINE.  A pending timer is moved.  */
+void
+gnupg_timer_set (gnupg_timer_t timer, time_t deadline)
+{
+  if (!wheel_time)
+    wheel_time = gnupg_get_time ();
+
+  if (timer->prevp)
+    unlink_timer (timer);
+  timer->deadline = deadline;
+  insert_timer (timer);
+
+  /* Tell the main loop to wake up earlier.  */
+  if (!running && notify_cb && wakeup_time && deadline < wakeup_time)
+    {
+      wakeup_time = deadline;
+      notify_cb ();
+    }
+}
+
+
+/* Cancel TIMER.  It is fine to cancel a timer which is not
+ * pending.  */
+void
+gnupg_timer_cancel (gnupg_timer_t timer)
+{
+  if (timer->prevp)
+    unlink_timer (timer);
+}
+
+
+/* Return true if TIMER is pending.  */
+int
+gnupg_timer_pending (gnupg_timer_t timer)
+{
+  return !!timer->prevp;
+}
+
+
+/* Register CB which is called if a timer is set to a deadline before
+ * the time the main loop is sleeping for.  */
+void
+gnupg_timer_set_notify (void (*cb) (void))
+{
+  notify_cb = cb;
+}
+
+
+/* Return the next time after WHEEL_TIME the wheel needs to be
+ * processed or 0 if there are no timers.  For higher levels this is
+ * the start of the next used slot and thus earlier than the actual
+ * deadlines.  */
+static time_t
+next_event (void)
+{
+  time_t best = 0;
+  time_t t, base;
+  int level, n, idx;
+
+  if (due_list)
+    return wheel_time;
+
+  for (level = 0; level < WHEEL_LEVELS; level++)
+    {
+      base = wheel_time >> (level * WHEEL_BITS);
+      for (n = 1; n <= WHEEL_SLOTS; n++)
+        {
+          idx = (base + n) & WHEEL_MASK;
+          if (wheel[level][idx])
+            {
+              t = (base + n) << (level * WHEEL_BITS);
+              if (!best || t < best)
+                best = t;
+              break;
+            }
+        }
+    }
+  return best;
+}
+
+
+/* Return the number of seconds from NOW until the main loop needs to
+ * call gnupg_timer_run or -1 if there are no timers.  */
+long
+gnupg_timer_next (time_t now)
+{
+  time_t t;
+
+  if (!wheel_time)
+    wheel_time = now;
+  t = next_event ();
+  wakeup_time = t;
+  if (!t)
+    return -1;
+  return t > now? (long)(t - now) : 0;
+}
+
+
+/* Advance the wheel to NOW and call the callbacks of all due timers.
+ * A callback may set and cancel timers.  */
+void
+gnupg_timer_run (time_t now)
+{
+  gnupg_timer_t list, timer;
+  time_t t;
+  int level, idx;
+
+  if (!wheel_time)
+    wheel_time = now;
+
+  running = 1;
+  while ((t = next_event ()) && t <= now && t > wheel_time)
+    {
+      wheel_time = t;
+
+      /* Move the timers of the higher level slots starting now down
+       * to the lower levels.  This needs to be done from the top so
+       * that a timer moved down more than one level is not missed.  */
+      for (level = 1; level < WHEEL_LEVELS; level++)
+        if ((t & (SLOT_SPAN (level) - 1)))
+          break;
+      while (--level > 0)
+        {
+          idx = (t >> (level * WHEEL_BITS)) & WHEEL_MASK;
+          list = wheel[level][idx];
+          wheel[level][idx] = NULL;
+          if (list)
+            list->prevp = &list;
+          while ((timer = list))
+            {
+              unlink_timer (timer);
+              insert_timer (timer);
+            }
+        }
+
+      idx = t & WHEEL_MASK;
+      while ((timer = wheel[0][idx]))
+        {
+          unlink_timer (timer);
+          link_timer (&due_list, timer);
+        }
+    }
+  if (now > wheel_time)
+    wheel_time = now;
+
+  /* Run the callbacks of the due timers.  Timers which become due
+   * while doing this are run by the next call.  */
+  list = due_list;
+  due_list = NULL;
+  if (list)
+    list->prevp = &list;
+  while ((timer = list))
+    {
+      unlink_timer (timer);
+      timer->cb (timer->opaque);
+    }
+  running = 0;
+}
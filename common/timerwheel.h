@@ -0,0 +1,59 @@
+/* timerwheel.h - Definitions for the timer wheel
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * This file is free software; you can redistribute it and/or modify
+ * it under the terms of either
+ *
+ *   - the GNU Lesser General Public License as published by the Free
+ *     Software Foundation; either version 3 of the License, or (at
+ *     your option) any later version.
+ *
+ * or
+ *
+ *   - the GNU General Public License as published by the Free
+ *     Software Foundation; either version 2 of the License, or (at
+ *     your option) any later version.
+ *
+ * or both in parallel, as here.
+ *
+ * This file is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: (LGPL-3.0-or-later OR GPL-2.0-or-later)
+ */
+
+#ifndef GNUPG_COMMON_TIMERWHEEL_H
+#define GNUPG_COMMON_TIMERWHEEL_H
+
+#include <time.h>
+
+/* A timer.  The object is owned by the caller and usually embedded
+ * in another object or a static variable.  It must be initialized
+ * with gnupg_timer_init and may not be released while it is
+ * pending.  */
+struct gnupg_timer_s
+{
+  struct gnupg_timer_s *next;   /* Internal.  */
+  struct gnupg_timer_s **prevp; /* Internal; NULL if not pending.  */
+  time_t deadline;
+  void (*cb) (void *opaque);
+  void *opaque;
+};
+typedef struct gnupg_timer_s *gnupg_timer_t;
+
+void gnupg_timer_init (gnupg_timer_t timer,
+                       void (*cb) (void *opaque), void *opaque);
+void gnupg_timer_set (gnupg_timer_t timer, time_t deadline);
+void gnupg_timer_cancel (gnupg_timer_t timer);
+int  gnupg_timer_pending (gnupg_timer_t timer);
+void gnupg_timer_set_notify (void (*cb) (void));
+long gnupg_timer_next (time_t now);
+void gnupg_timer_run (time_t now);
+
+#endif /*GNUPG_COMMON_TIMERWHEEL_H*/
@@ -39,60 +39,108 @@
 #include "tlv.h"
 
 
-static const unsigned char *
-do_find_tlv (const unsigned char *buffer, size_t length,
-             int tag, size_t *nbytes, int nestlevel)
+/* An index over the objects of a TLV encoded buffer.  The items are
+ * sorted by tag and, for the same tag, by the order in which
+ * find_tlv would encounter them.  */
+struct tlv_index_item_s
 {
-  const unsigned char *s = buffer;
-  size_t n = length;
+  int tag;
+  unsigned int seqno;  /* The order in which the object was found.  */
+  size_t off;          /* Offset of the value from the buffer start.  */
+  size_t len;          /* Length of the value.  */
+};
+
+struct tlv_index_s
+{
+  const unsigned char *buffer;
+  size_t length;
+  unsigned int nitems;
+  unsigned int nalloced;
+  struct tlv_index_item_s *items;
+};
+
+
+/* Parse the header of the next TLV object in the buffer at BUFFER of
+   SIZE bytes and skip optional filler bytes before it.  On success
+   BUFFER and SIZE are updated to describe the value and 0 is
+   returned.  Returns -1 if no further object is available or its
+   header is not valid.  */
+static int
+parse_simple_tlv_header (const unsigned char **buffer, size_t *size,
+                         int *r_tag, int *r_composite, size_t *r_len)
+{
+  const unsigned char *s = *buffer;
+  size_t n = *size;
   size_t len;
-  int this_tag;
-  int composite;
 
   for (;;)
     {
       if (n < 2)
-        return NULL; /* Buffer definitely too short for tag and length. */
+        return -1; /* Buffer definitely too short for tag and length. */
       if (!*s || *s == 0xff)
         { /* Skip optional filler between TLV objects. */
           s++;
           n--;
           continue;
         }
-      composite = !!(*s & 0x20);
+      break;
+    }
+  *r_composite = !!(*s & 0x20);
+  if ((*s & 0x1f) == 0x1f)
+    { /* more tag bytes to follow */
+      s++;
+      n--;
+      if (n < 2)
+        return -1; /* buffer definitely too short for tag and length. */
       if ((*s & 0x1f) == 0x1f)
-        { /* more tag bytes to follow */
-          s++;
-          n--;
-          if (n < 2)
-            return NULL; /* buffer definitely too short for tag and length. */
-          if ((*s & 0x1f) == 0x1f)
-            return NULL; /* We support only up to 2 bytes. */
-          this_tag = (s[-1] << 8) | (s[0] & 0x7f);
-        }
-      else
-        this_tag = s[0];
-      len = s[1];
+        return -1; /* We support only up to 2 bytes. */
+      *r_tag = (s[-1] << 8) | (s[0] & 0x7f);
+    }
+  else
+    *r_tag = s[0];
+  len = s[1];
+  s += 2; n -= 2;
+  if (len < 0x80)
+    ;
+  else if (len == 0x81)
+    { /* One byte length follows. */
+      if (!n)
+        return -1; /* we expected 1 more bytes with the length. */
+      len = s[0];
+      s++; n--;
+    }
+  else if (len == 0x82)
+    { /* Two byte length follows. */
+      if (n < 2)
+        return -1; /* We expected 2 more bytes with the length. */
+      len = ((size_t)s[0] << 8) | s[1];
       s += 2; n -= 2;
-      if (len < 0x80)
-        ;
-      else if (len == 0x81)
-        { /* One byte length follows. */
-          if (!n)
-            return NULL; /* we expected 1 more bytes with the length. */
-          len = s[0];
-          s++; n--;
-        }
-      else if (len == 0x82)
-        { /* Two byte length follows. */
-          if (n < 2)
-            return NULL; /* We expected 2 more bytes with the length. */
-          len = ((size_t)s[0] << 8) | s[1];
-          s += 2; n -= 2;
-        }
-      else
-        return NULL; /* APDU limit is 65535, thus it does not make
-                        sense to assume longer length fields. */
+    }
+  else
+    return -1; /* APDU limit is 65535, thus it does not make
+                  sense to assume longer length fields. */
+
+  *buffer = s;
+  *size = n;
+  *r_len = len;
+  return 0;
+}
+
+
+static const unsigned char *
+do_find_tlv (const unsigned char *buffer, size_t length,
+             int tag, size_t *nbytes, int nestlevel)
+{
+  const unsigned char *s = buffer;
+  size_t n = length;
+  size_t len;
+  int this_tag;
+  int composite;
+
+  for (;;)
+    {
+      if (parse_simple_tlv_header (&s, &n, &this_tag, &composite, &len))
+        return NULL;
 
       if (composite && nestlevel < 100)
         { /* Dive into this composite DO after checking for a too deep
@@ -149,6 +197,147 @@ find_tlv_unchecked (const unsigned char *buffer, size_t length,
 }
 
 
+/* Add all objects in BUFFER of LENGTH to the index TI in the same
+   order as do_find_tlv visits them.  */
+static gpg_error_t
+do_index_tlv (tlv_index_t ti, const unsigned char *buffer, size_t length,
+              int nestlevel)
+{
+  gpg_error_t err;
+  const unsigned char *s = buffer;
+  size_t n = length;
+  size_t len;
+  int tag;
+  int composite;
+
+  for (;;)
+    {
+      if (parse_simple_tlv_header (&s, &n, &tag, &composite, &len))
+        return 0;
+
+      /* Unlike do_find_tlv we do not dive past the end of the
+         buffer.  */
+      if (composite && nestlevel < 100)
+        {
+          err = do_index_tlv (ti, s, len > n? n : len, nestlevel+1);
+          if (err)
+            return err;
+        }
+
+      if (ti->nitems == ti->nalloced)
+        {
+          struct tlv_index_item_s *tmp;
+
+          tmp = xtryreallocarray (ti->items, ti->nalloced,
+                                  ti->nalloced + 32, sizeof *tmp);
+          if (!tmp)
+            return gpg_error_from_syserror ();
+          ti->items = tmp;
+          ti->nalloced += 32;
+        }
+      ti->items[ti->nitems].tag = tag;
+      ti->items[ti->nitems].seqno = ti->nitems;
+      ti->items[ti->nitems].off = s - ti->buffer;
+      ti->items[ti->nitems].len = len;
+      ti->nitems++;
+
+      if (len > n)
+        return 0; /* Buffer too short to skip to the next tag. */
+      s += len; n -= len;
+    }
+}
+
+
+static int
+compare_tlv_index_items (const void *a_arg, const void *b_arg)
+{
+  const struct tlv_index_item_s *a = a_arg;
+  const struct tlv_index_item_s *b = b_arg;
+
+  if (a->tag != b->tag)
+    return a->tag < b->tag? -1 : 1;
+  return a->seqno < b->seqno? -1 : a->seqno > b->seqno? 1 : 0;
+}
+
+
+/* Parse the TLV encoded BUFFER of LENGTH once and store an index of
+   all its objects at R_INDEX.  BUFFER must not be modified or
+   released as long as the index is used.  */
+gpg_error_t
+tlv_index_new (tlv_index_t *r_index, const unsigned char *buffer,
+               size_t length)
+{
+  gpg_error_t err;
+  tlv_index_t ti;
+
+  *r_index = NULL;
+  ti = xtrycalloc (1, sizeof *ti);
+  if (!ti)
+    return gpg_error_from_syserror ();
+  ti->buffer = buffer;
+  ti->length = length;
+  err = do_index_tlv (ti, buffer, length, 0);
+  if (err)
+    {
+      tlv_index_release (ti);
+      return err;
+    }
+  if (ti->nitems > 1)
+    qsort (ti->items, ti->nitems, sizeof *ti->items,
+           compare_tlv_index_items);
+  *r_index = ti;
+  return 0;
+}
+
+
+void
+tlv_index_release (tlv_index_t ti)
+{
+  if (!ti)
+    return;
+  xfree (ti->items);
+  xfree (ti);
+}
+
+
+/* Same as find_tlv_unchecked but using the index TI.  */
+const unsigned char *
+tlv_index_find_unchecked (tlv_index_t ti, int tag, size_t *nbytes)
+{
+  unsigned int lo, hi, mid;
+
+  /* Find the first item with TAG.  */
+  lo = 0;
+  hi = ti->nitems;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (ti->items[mid].tag < tag)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  if (lo == ti->nitems || ti->items[lo].tag != tag)
+    return NULL;
+
+  *nbytes = ti->items[lo].len;
+  return ti->buffer + ti->items[lo].off;
+}
+
+
+/* Same as find_tlv but using the index TI.  */
+const unsigned char *
+tlv_index_find (tlv_index_t ti, int tag, size_t *nbytes)
+{
+  const unsigned char *p;
+
+  p = tlv_index_find_unchecked (ti, tag, nbytes);
+  if (p && *nbytes > (ti->length - (p - ti->buffer)))
+    p = NULL; /* Object longer than buffer. */
+  return p;
+}
+
+
 /* ASN.1 BER parser: Parse BUFFER of length SIZE and return the tag
    and the length part from the TLV triplet.  Update BUFFER and SIZE
    on success. */
@@ -75,6 +75,9 @@ enum tlv_tag_type {
 struct tlv_builder_s;
 typedef struct tlv_builder_s *tlv_builder_t;
 
+struct tlv_index_s;
+typedef struct tlv_index_s *tlv_index_t;
+
 /*-- tlv.c --*/
 
 /* Locate a TLV encoded data object in BUFFER of LENGTH and return a
@@ -92,6 +95,20 @@ const unsigned char *find_tlv_unchecked (const unsigned char *buffer,
                                          size_t length,
                                          int tag, size_t *nbytes);
 
+/* Build an index over all objects of the TLV encoded BUFFER of
+   LENGTH so that repeated lookups do not need to parse the buffer
+   again.  The index refers to BUFFER which must thus be kept
+   unchanged.  */
+gpg_error_t tlv_index_new (tlv_index_t *r_index,
+                           const unsigned char *buffer, size_t length);
+void tlv_index_release (tlv_index_t ti);
+
+/* Same as find_tlv and find_tlv_unchecked but using an index.  */
+const unsigned char *tlv_index_find (tlv_index_t ti, int tag,
+                                     size_t *nbytes);
+const unsigned char *tlv_index_find_unchecked (tlv_index_t ti, int tag,
+                                               size_t *nbytes);
+
 /* ASN.1 BER parser: Parse BUFFER of length SIZE and return the tag
    and the length part from the TLV triplet.  Update BUFFER and SIZE
    on success. */
@@ -30,11 +30,21 @@
 #include "dirmngr.h"
 #include "misc.h"
 #include "../common/ksba-io-support.h"
+#include "../common/metrics.h"
 #include "crlfetch.h"
 #include "certcache.h"
 
+/* The maximum number of non-permanent certificates used if
+   --max-cached-certs has not yet been parsed.  */
 #define MAX_NONPERM_CACHED_CERTS 1000
 
+/* The number of slots of the secondary indices.  */
+#define CERT_INDEX_SIZE 1024
+
+/* The directory below the cache directory with the persistent store
+ * of intermediate CA certificates fetched from the network.  */
+#define INTERMEDIATE_D "certs.d"
+
 /* Constants used to classify search patterns.  */
 enum pattern_class
   {
@@ -56,16 +66,25 @@ enum pattern_class
 /* A certificate cache item.  This consists of a the KSBA cert object
    and some meta data for easier lookup.  We use a hash table to keep
    track of all items and use the (randomly distributed) first byte of
-   the fingerprint directly as the hash which makes it pretty easy. */
+   the fingerprint directly as the hash which makes it pretty easy.
+   Valid items are also linked into secondary hash tables indexed by
+   the subject DN, the issuer DN, the issuer DN and serial number, and
+   the subject key identifier. */
 struct cert_item_s
 {
   struct cert_item_s *next; /* Next item with the same hash value. */
+  struct cert_item_s *subject_next;   /* Next in SUBJECT_INDEX.  */
+  struct cert_item_s *issuer_next;    /* Next in ISSUER_INDEX.  */
+  struct cert_item_s *sn_next;        /* Next in SN_INDEX.  */
+  struct cert_item_s *ski_next;       /* Next in SKI_INDEX.  */
   ksba_cert_t cert;         /* The KSBA cert object or NULL is this is
                                not a valid item.  */
   unsigned char fpr[20];    /* The fingerprint of this object. */
   char *issuer_dn;          /* The malloced issuer DN.  */
   ksba_sexp_t sn;           /* The malloced serial number  */
   char *subject_dn;         /* The malloced subject DN - maybe NULL.  */
+  ksba_sexp_t ski;          /* The malloced subject key id - maybe NULL. */
+  unsigned int lru;         /* Value of LRU_CLOCK at the last use.  */
 
   /* If this field is set the certificate has been taken from some
    * configuration and shall not be flushed from the cache.  */
@@ -81,6 +100,15 @@ typedef struct cert_item_s *cert_item_t;
    the first byte of the fingerprint.  */
 static cert_item_t cert_cache[256];
 
+/* The secondary indices.  */
+static cert_item_t subject_index[CERT_INDEX_SIZE];
+static cert_item_t issuer_index[CERT_INDEX_SIZE];
+static cert_item_t sn_index[CERT_INDEX_SIZE];
+static cert_item_t ski_index[CERT_INDEX_SIZE];
+
+/* A counter bumped for each use of a certificate.  */
+static unsigned int lru_clock;
+
 /* This is the global cache_lock variable. In general locking is not
    needed but it would take extra efforts to make sure that no
    indirect use of npth functions is done, so we simply lock it
@@ -159,6 +187,54 @@ release_cache_lock (void)
 }
 
 
+/* Return the index slot for the LEN bytes at BUFFER.  */
+static unsigned int
+index_hash (const void *buffer, size_t len)
+{
+  const unsigned char *p = buffer;
+  unsigned int h = 2166136261u; /* FNV-1a */
+
+  for (; len; len--, p++)
+    h = (h ^ *p) * 16777619u;
+  return h % CERT_INDEX_SIZE;
+}
+
+
+/* Return the slot of the subject or issuer index for the DN.  */
+static unsigned int
+dn_hash (const char *dn)
+{
+  return index_hash (dn, strlen (dn));
+}
+
+
+/* Return the slot of the serial number index for ISSUER_DN and the
+   canonical S-expression SERIALNO.  */
+static unsigned int
+sn_hash (const char *issuer_dn, ksba_const_sexp_t serialno)
+{
+  size_t n = gcry_sexp_canon_len (serialno, 0, NULL, NULL);
+
+  return (dn_hash (issuer_dn) + index_hash (serialno, n)) % CERT_INDEX_SIZE;
+}
+
+
+/* Return the slot of the subject key id index for KEYID.  */
+static unsigned int
+ski_hash (ksba_const_sexp_t keyid)
+{
+  return index_hash (keyid, gcry_sexp_canon_len (keyid, 0, NULL, NULL));
+}
+
+
+/* Mark the cache item CI as just used.  */
+static inline void
+touch_item (cert_item_t ci)
+{
+  ci->lru = ++lru_clock;
+}
+
+
 /* Return false if both serial numbers match.  Can't be used for
    sorting. */
 static int
@@ -224,6 +300,77 @@ cert_compute_fpr (ksba_cert_t cert, unsigned char *digest)
 
 
 
+/* Link the valid item CI into the secondary indices.  */
+static void
+link_item (cert_item_t ci)
+{
+  unsigned int h;
+
+  if (ci->subject_dn)
+    {
+      h = dn_hash (ci->subject_dn);
+      ci->subject_next = subject_index[h];
+      subject_index[h] = ci;
+    }
+  h = dn_hash (ci->issuer_dn);
+  ci->issuer_next = issuer_index[h];
+  issuer_index[h] = ci;
+  h = sn_hash (ci->issuer_dn, ci->sn);
+  ci->sn_next = sn_index[h];
+  sn_index[h] = ci;
+  if (ci->ski)
+    {
+      h = ski_hash (ci->ski);
+      ci->ski_next = ski_index[h];
+      ski_index[h] = ci;
+    }
+}
+
+
+/* Remove CI from the secondary indices.  */
+static void
+unlink_item (cert_item_t ci)
+{
+  cert_item_t *cip;
+
+  if (ci->subject_dn)
+    {
+      for (cip = &subject_index[dn_hash (ci->subject_dn)]; *cip;
+           cip = &(*cip)->subject_next)
+        if (*cip == ci)
+          {
+            *cip = ci->subject_next;
+            break;
+          }
+    }
+  for (cip = &issuer_index[dn_hash (ci->issuer_dn)]; *cip;
+       cip = &(*cip)->issuer_next)
+    if (*cip == ci)
+      {
+        *cip = ci->issuer_next;
+        break;
+      }
+  for (cip = &sn_index[sn_hash (ci->issuer_dn, ci->sn)]; *cip;
+       cip = &(*cip)->sn_next)
+    if (*cip == ci)
+      {
+        *cip = ci->sn_next;
+        break;
+      }
+  if (ci->ski)
+    {
+      for (cip = &ski_index[ski_hash (ci->ski)]; *cip;
+           cip = &(*cip)->ski_next)
+        if (*cip == ci)
+          {
+            *cip = ci->ski_next;
+            break;
+          }
+    }
+  ci->subject_next = ci->issuer_next = ci->sn_next = ci->ski_next = NULL;
+}
+
+
 /* Cleanup one slot.  This releases all resourses but keeps the actual
    slot in the cache marked for reuse. */
 static void
@@ -234,12 +381,16 @@ clean_cache_slot (cert_item_t ci)
   if (!ci->cert)
     return; /* Already cleaned.  */
 
+  if (ci->issuer_dn && ci->sn)
+    unlink_item (ci);
   ksba_free (ci->sn);
   ci->sn = NULL;
   ksba_free (ci->issuer_dn);
   ci->issuer_dn = NULL;
   ksba_free (ci->subject_dn);
   ci->subject_dn = NULL;
+  ksba_free (ci->ski);
+  ci->ski = NULL;
   cert = ci->cert;
   ci->cert = NULL;
 
@@ -250,6 +401,58 @@ clean_cache_slot (cert_item_t ci)
 }
 
 
+static int
+compare_lru (const void *a, const void *b)
+{
+  unsigned int x = *(const unsigned int *)a;
+  unsigned int y = *(const unsigned int *)b;
+
+  return x < y? -1 : x > y;
+}
+
+
+/* Drop the least recently used non-permanent certificates from the
+ * cache.  It is assumed that the cache is locked.  */
+static void
+drop_lru_certs (void)
+{
+  unsigned int *stamps;
+  unsigned int n, drop_count, limit;
+  cert_item_t ci;
+  int i;
+
+  drop_count = total_nonperm_certificates / 20;
+  if (drop_count < 2)
+    drop_count = 2;
+
+  stamps = xtrycalloc (total_nonperm_certificates + 1, sizeof *stamps);
+  if (!stamps)
+    return;  /* We will try again with the next certificate.  */
+  n = 0;
+  for (i=0; i < 256; i++)
+    for (ci = cert_cache[i]; ci; ci = ci->next)
+      if (ci->cert && !ci->permanent && n <= total_nonperm_certificates)
+        stamps[n++] = ci->lru;
+  if (!n)
+    {
+      xfree (stamps);
+      return;
+    }
+  qsort (stamps, n, sizeof *stamps, compare_lru);
+  limit = stamps[(drop_count < n? drop_count : n) - 1];
+  xfree (stamps);
+
+  log_info (_("dropping %u certificates from the cache\n"), drop_count);
+  for (i=0; i < 256; i++)
+    for (ci = cert_cache[i]; ci; ci = ci->next)
+      if (ci->cert && !ci->permanent && ci->lru <= limit)
+        {
+          clean_cache_slot (ci);
+          total_nonperm_certificates--;
+        }
+}
+
+
 /* Put the certificate CERT into the cache.  It is assumed that the
  * cache is locked while this function is called.
  *
@@ -272,49 +475,13 @@ put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass,
 
   fpr = fpr_buffer? fpr_buffer : &help_fpr_buffer;
 
-  /* If we already reached the caching limit, drop a couple of certs
-   * from the cache.  Our dropping strategy is simple: We keep a
-   * static index counter and use this to start looking for
-   * certificates, then we drop 5 percent of the oldest certificates
-   * starting at that index.  For a large cache this is a fair way of
-   * removing items.  An LRU strategy would be better of course.
-   * Because we append new entries to the head of the list and we want
-   * to remove old ones first, we need to do this from the tail.  The
-   * implementation is not very efficient but compared to the long
-   * time it takes to retrieve a certificate from an external resource
-   * it seems to be reasonable.  */
-  if (!permanent && total_nonperm_certificates >= MAX_NONPERM_CACHED_CERTS)
-    {
-      static int idx;
-      cert_item_t ci_mark;
-      int i;
-      unsigned int drop_count;
-
-      drop_count = MAX_NONPERM_CACHED_CERTS / 20;
-      if (drop_count < 2)
-        drop_count = 2;
-
-      log_info (_("dropping %u certificates from the cache\n"), drop_count);
-      assert (idx < 256);
-      for (i=idx; drop_count; i = ((i+1)%256))
-        {
-          ci_mark = NULL;
-          for (ci = cert_cache[i]; ci; ci = ci->next)
-            if (ci->cert && !ci->permanent)
-              ci_mark = ci;
-          if (ci_mark)
-            {
-              clean_cache_slot (ci_mark);
-              drop_count--;
-              total_nonperm_certificates--;
-            }
-        }
-      if (i==idx)
-        idx++;
-      else
-        idx = i;
-      idx %= 256;
-    }
+  /* If we already reached the caching limit, drop the 5 percent
+   * least recently used certificates from the cache.  */
+  if (!permanent
+      && total_nonperm_certificates >= (opt.max_cached_certs
+                                        ? opt.max_cached_certs
+                                        : MAX_NONPERM_CACHED_CERTS))
+    drop_lru_certs ();
 
   cert_compute_fpr (cert, fpr);
   for (ci=cert_cache[*fpr]; ci; ci = ci->next)
@@ -344,8 +511,12 @@ put_cert (ksba_cert_t cert, int permanent, unsigned int trustclass,
       return gpg_error (GPG_ERR_INV_CERT_OBJ);
     }
   ci->subject_dn = ksba_cert_get_subject (cert, 0);
+  if (ksba_cert_get_subj_key_id (cert, NULL, &ci->ski))
+    ci->ski = NULL;
   ci->permanent = !!permanent;
   ci->trustclasses = trustclass;
+  touch_item (ci);
+  link_item (ci);
 
   if (permanent)
     any_cert_of_class |= trustclass;
@@ -697,6 +868,236 @@ load_certs_from_system (void)
 }
 
 
+/* Return a malloced string with the file name prefix used for
+ * intermediate certificates with SUBJECT_DN.  This is the hex encoded
+ * start of the SHA-1 hash over the subject DN followed by a dash.
+ * The full name has the hex encoded fingerprint appended.  Returns
+ * NULL on error.  */
+static char *
+intermediate_prefix (const char *subject_dn)
+{
+  unsigned char digest[20];
+  char hexdigest[9];
+
+  gcry_md_hash_buffer (GCRY_MD_SHA1, digest, subject_dn, strlen (subject_dn));
+  bin2hex (digest, 4, hexdigest);
+  return strconcat (hexdigest, "-", NULL);
+}
+
+
+/* Return true if CERT may be kept in the persistent store of
+ * intermediate certificates: It must be a CA certificate which is
+ * not self-signed and not expired.  Note that a certificate from the
+ * store is not trusted; a chain using it needs to be validated as
+ * with certificates fetched from the network.  */
+static int
+is_intermediate_cert (ksba_cert_t cert)
+{
+  char *subject, *issuer;
+  ksba_isotime_t current, not_after;
+  int is_ca, okay;
+
+  if (ksba_cert_is_ca (cert, &is_ca, NULL) || !is_ca)
+    return 0;
+
+  subject = ksba_cert_get_subject (cert, 0);
+  issuer = ksba_cert_get_issuer (cert, 0);
+  okay = (subject && issuer && strcmp (subject, issuer));
+  ksba_free (subject);
+  ksba_free (issuer);
+  if (!okay)
+    return 0;
+
+  gnupg_get_isotime (current);
+  if (!ksba_cert_get_validity (cert, 1, not_after)
+      && *not_after && strcmp (current, not_after) > 0)
+    return 0;
+
+  return 1;
+}
+
+
+/* Read the DER encoded certificate from FNAME and check that it
+ * matches the fingerprint encoded in the file name NAME.  Invalid or
+ * expired certificates are removed from the store.  Returns NULL if
+ * the certificate can't be used.  */
+static ksba_cert_t
+read_intermediate (const char *fname, const char *name)
+{
+  gpg_error_t err;
+  estream_t fp;
+  ksba_reader_t reader;
+  ksba_cert_t cert = NULL;
+  unsigned char fpr[20];
+  char hexfpr[41];
+
+  fp = es_fopen (fname, "rb");
+  if (!fp)
+    return NULL;
+  err = create_estream_ksba_reader (&reader, fp);
+  if (!err)
+    {
+      err = ksba_cert_new (&cert);
+      if (!err)
+        err = ksba_cert_read_der (cert, reader);
+      ksba_reader_release (reader);
+    }
+  es_fclose (fp);
+
+  if (!err
+      && (strlen (name) != 9 + 40 + 4
+          || strncmp (name + 9, bin2hex (cert_compute_fpr (cert, fpr),
+                                         20, hexfpr), 40)))
+    err = gpg_error (GPG_ERR_BAD_CERT);
+  if (!err && !is_intermediate_cert (cert))
+    err = gpg_error (GPG_ERR_CERT_EXPIRED);
+  if (err)
+    {
+      if (opt.verbose)
+        log_info ("removing intermediate certificate '%s': %s\n",
+                  fname, gpg_strerror (err));
+      gnupg_remove (fname);
+      ksba_cert_release (cert);
+      return NULL;
+    }
+  return cert;
+}
+
+
+/* Load the intermediate certificates from the persistent store into
+ * the cache.  If SUBJECT_DN is not NULL only certificates with that
+ * subject are loaded.  The cache must be locked for writing.  Returns
+ * the number of loaded certificates.  */
+static unsigned int
+load_intermediates (const char *subject_dn)
+{
+  char *dname, *fname, *prefix = NULL;
+  DIR *dir;
+  struct dirent *ep;
+  const char *p;
+  size_t n;
+  ksba_cert_t cert;
+  unsigned int count = 0;
+
+  if (subject_dn && !(prefix = intermediate_prefix (subject_dn)))
+    return 0;
+
+  dname = make_filename_try (opt.homedir_cache, INTERMEDIATE_D, NULL);
+  dir = dname? opendir (dname) : NULL;
+  if (!dir)
+    {
+      xfree (dname);
+      xfree (prefix);
+      return 0;  /* Nothing stored yet.  */
+    }
+
+  while ((ep = readdir (dir)))
+    {
+      p = ep->d_name;
+      n = strlen (p);
+      if (n < 5 || strcmp (p+n-4, ".der") || *p == '.')
+        continue;
+      if (prefix && strncmp (p, prefix, strlen (prefix)))
+        continue;
+
+      fname = make_filename_try (dname, p, NULL);
+      if (!fname)
+        break;
+      cert = read_intermediate (fname, p);
+      if (cert && !put_cert (cert, 0, 0, NULL))
+        count++;
+      ksba_cert_release (cert);
+      xfree (fname);
+    }
+
+  closedir (dir);
+  xfree (dname);
+  xfree (prefix);
+  return count;
+}
+
+
+/* Put CERT, which has been fetched from the network, into the
+ * persistent store of intermediate certificates so that other
+ * instances of dirmngr don't need to fetch it again.  Certificates
+ * not suitable for the store are silently ignored.  */
+void
+cert_cache_store_intermediate (ksba_cert_t cert)
+{
+  char *dname = NULL, *fname = NULL, *tmpfname = NULL, *prefix = NULL;
+  char *subject = NULL;
+  unsigned char fpr[20];
+  char hexfpr[41];
+  const unsigned char *image;
+  size_t imagelen;
+  estream_t fp;
+
+  if (!is_intermediate_cert (cert))
+    return;
+  image = ksba_cert_get_image (cert, &imagelen);
+  subject = ksba_cert_get_subject (cert, 0);
+  if (!image || !subject || !(prefix = intermediate_prefix (subject)))
+    goto leave;
+  bin2hex (cert_compute_fpr (cert, fpr), 20, hexfpr);
+
+  dname = make_filename_try (opt.homedir_cache, INTERMEDIATE_D, NULL);
+  if (!dname)
+    goto leave;
+  tmpfname = strconcat (prefix, hexfpr, ".der", NULL);
+  fname = tmpfname? make_filename_try (dname, tmpfname, NULL) : NULL;
+  xfree (tmpfname);
+  tmpfname = fname? strconcat (fname, ".tmp", NULL) : NULL;
+  if (!tmpfname)
+    goto leave;
+  if (!access (fname, F_OK))
+    goto leave;  /* Already stored.  */
+
+  if (access (dname, F_OK) && gnupg_mkdir (dname, "-rwx"))
+    {
+      log_info ("error creating directory '%s': %s\n",
+                dname, gpg_strerror (gpg_error_from_syserror ()));
+      goto leave;
+    }
+
+  fp = es_fopen (tmpfname, "wb");
+  if (!fp)
+    {
+      log_info ("error creating '%s': %s\n",
+                tmpfname, gpg_strerror (gpg_error_from_syserror ()));
+      goto leave;
+    }
+  if (es_fwrite (image, imagelen, 1, fp) != 1)
+    {
+      es_fclose (fp);
+      fp = NULL;
+      gpg_err_set_errno (EIO);
+    }
+  if (!fp || es_fclose (fp))
+    {
+      log_info ("error writing '%s': %s\n",
+                tmpfname, gpg_strerror (gpg_error_from_syserror ()));
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  if (gnupg_rename_file (tmpfname, fname, NULL))
+    {
+      log_info ("error renaming '%s': %s\n",
+                tmpfname, gpg_strerror (gpg_error_from_syserror ()));
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  if (DBG_LOOKUP)
+    log_debug ("%s: stored '%s'\n", __func__, fname);
+
+ leave:
+  ksba_free (subject);
+  xfree (prefix);
+  xfree (tmpfname);
+  xfree (fname);
+  xfree (dname);
+}
+
+
 /* Initialize the certificate cache if not yet done.  */
 void
 cert_cache_init (strlist_t hkp_cacerts)
@@ -733,6 +1134,8 @@ cert_cache_init (strlist_t hkp_cacerts)
   for (sl = hkp_cacerts; sl; sl = sl->next)
     load_certs_from_file (sl->d, CERTTRUST_CLASS_HKP, 0);
 
+  load_intermediates (NULL);
+
   initialization_done = 1;
   release_cache_lock ();
 
@@ -768,6 +1171,10 @@ cert_cache_deinit (int full)
           cert_cache[i] = NULL;
         }
     }
+  memset (subject_index, 0, sizeof subject_index);
+  memset (issuer_index, 0, sizeof issuer_index);
+  memset (sn_index, 0, sizeof sn_index);
+  memset (ski_index, 0, sizeof ski_index);
 
   http_register_cfg_ca (NULL);
 
@@ -829,6 +1236,39 @@ cert_cache_print_stats (void)
 }
 
 
+/* Update the metrics with the number of cached certificates.  */
+void
+cert_cache_collect_metrics (void)
+{
+  cert_item_t ci;
+  int idx;
+  unsigned int n_nonperm = 0;
+  unsigned int n_permanent = 0;
+  unsigned int n_trusted = 0;
+
+  acquire_cache_read_lock ();
+  for (idx = 0; idx < 256; idx++)
+    for (ci=cert_cache[idx]; ci; ci = ci->next)
+      if (ci->cert)
+        {
+          if (ci->permanent)
+            n_permanent++;
+          else
+            n_nonperm++;
+          if (ci->trustclasses)
+            n_trusted++;
+        }
+  release_cache_lock ();
+
+  gnupg_metric_set (gnupg_metric_get (GNUPG_METRIC_GAUGE, "cert_cache_certs",
+                                      "kind=\"permanent\""), n_permanent);
+  gnupg_metric_set (gnupg_metric_get (GNUPG_METRIC_GAUGE, "cert_cache_certs",
+                                      "kind=\"runtime\""), n_nonperm);
+  gnupg_metric_set (gnupg_metric_get (GNUPG_METRIC_GAUGE, "cert_cache_certs",
+                                      "kind=\"trusted\""), n_trusted);
+}
+
+
 /* Return true if any cert of a class in MASK is permanently
  * loaded.  */
 int
@@ -893,6 +1333,7 @@ get_cert_byfpr (const unsigned char *fpr)
   for (ci=cert_cache[*fpr]; ci; ci = ci->next)
     if (ci->cert && !memcmp (ci->fpr, fpr, 20))
       {
+        touch_item (ci);
         ksba_cert_ref (ci->cert);
         release_cache_lock ();
         return ci->cert;
@@ -948,22 +1389,18 @@ get_cert_byhexfpr (const char *string)
 ksba_cert_t
 get_cert_bysn (const char *issuer_dn, ksba_sexp_t serialno)
 {
-  /* Simple and inefficient implementation.   fixme! */
   cert_item_t ci;
-  int i;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && !strcmp (ci->issuer_dn, issuer_dn)
-            && !compare_serialno (ci->sn, serialno))
-          {
-            ksba_cert_ref (ci->cert);
-            release_cache_lock ();
-            return ci->cert;
-          }
-    }
+  for (ci=sn_index[sn_hash (issuer_dn, serialno)]; ci; ci = ci->sn_next)
+    if (!strcmp (ci->issuer_dn, issuer_dn)
+        && !compare_serialno (ci->sn, serialno))
+      {
+        touch_item (ci);
+        ksba_cert_ref (ci->cert);
+        release_cache_lock ();
+        return ci->cert;
+      }
 
   release_cache_lock ();
   return NULL;
@@ -975,22 +1412,18 @@ get_cert_bysn (const char *issuer_dn, ksba_sexp_t serialno)
 ksba_cert_t
 get_cert_byissuer (const char *issuer_dn, unsigned int seq)
 {
-  /* Simple and very inefficient implementation and API.  fixme! */
   cert_item_t ci;
-  int i;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && !strcmp (ci->issuer_dn, issuer_dn))
-          if (!seq--)
-            {
-              ksba_cert_ref (ci->cert);
-              release_cache_lock ();
-              return ci->cert;
-            }
-    }
+  for (ci=issuer_index[dn_hash (issuer_dn)]; ci; ci = ci->issuer_next)
+    if (!strcmp (ci->issuer_dn, issuer_dn))
+      if (!seq--)
+        {
+          touch_item (ci);
+          ksba_cert_ref (ci->cert);
+          release_cache_lock ();
+          return ci->cert;
+        }
 
   release_cache_lock ();
   return NULL;
@@ -1002,26 +1435,21 @@ get_cert_byissuer (const char *issuer_dn, unsigned int seq)
 ksba_cert_t
 get_cert_bysubject (const char *subject_dn, unsigned int seq)
 {
-  /* Simple and very inefficient implementation and API.  fixme! */
   cert_item_t ci;
-  int i;
 
   if (!subject_dn)
     return NULL;
 
   acquire_cache_read_lock ();
-  for (i=0; i < 256; i++)
-    {
-      for (ci=cert_cache[i]; ci; ci = ci->next)
-        if (ci->cert && ci->subject_dn
-            && !strcmp (ci->subject_dn, subject_dn))
-          if (!seq--)
-            {
-              ksba_cert_ref (ci->cert);
-              release_cache_lock ();
-              return ci->cert;
-            }
-    }
+  for (ci=subject_index[dn_hash (subject_dn)]; ci; ci = ci->subject_next)
+    if (!strcmp (ci->subject_dn, subject_dn))
+      if (!seq--)
+        {
+          touch_item (ci);
+          ksba_cert_ref (ci->cert);
+          release_cache_lock ();
+          return ci->cert;
+        }
 
   release_cache_lock ();
   return NULL;
@@ -1421,6 +1849,7 @@ find_cert_bysn (ctrl_t ctrl, const char *issuer_dn, ksba_sexp_t serialno)
           ksba_free (sn);
           ksba_free (issdn);
           cache_cert (cert);
+          cert_cache_store_intermediate (cert);
           if (DBG_LOOKUP)
             log_debug ("   found\n");
           break; /* Ready.  */
@@ -1461,24 +1890,22 @@ find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
     {
       cert_item_t ci;
       cert_ref_t cr;
-      int i;
 
       /* For efficiency reasons we won't use get_cert_bysubject here. */
       acquire_cache_read_lock ();
-      for (i=0; i < 256; i++)
-        for (ci=cert_cache[i]; ci; ci = ci->next)
-          if (ci->cert && ci->subject_dn
-              && !strcmp (ci->subject_dn, subject_dn))
-            for (cr=ctrl->ocsp_certs; cr; cr = cr->next)
-              if (!memcmp (ci->fpr, cr->fpr, 20))
-                {
-                  ksba_cert_ref (ci->cert);
-                  release_cache_lock ();
-                  if (DBG_LOOKUP)
-                    log_debug ("%s: certificate found in the cache"
-                               " via ocsp_certs\n", __func__);
-                  return ci->cert; /* We use this certificate. */
-                }
+      for (ci=subject_index[dn_hash (subject_dn)]; ci; ci = ci->subject_next)
+        if (!strcmp (ci->subject_dn, subject_dn))
+          for (cr=ctrl->ocsp_certs; cr; cr = cr->next)
+            if (!memcmp (ci->fpr, cr->fpr, 20))
+              {
+                touch_item (ci);
+                ksba_cert_ref (ci->cert);
+                release_cache_lock ();
+                if (DBG_LOOKUP)
+                  log_debug ("%s: certificate found in the cache"
+                             " via ocsp_certs\n", __func__);
+                return ci->cert; /* We use this certificate. */
+              }
       release_cache_lock ();
       if (DBG_LOOKUP)
         log_debug ("find_cert_bysubject: certificate not in ocsp_certs\n");
@@ -1508,33 +1935,56 @@ find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
    * by keyid.  */
   if (!subject_dn && keyid)
     {
-      int i;
       cert_item_t ci;
-      ksba_sexp_t ski;
 
       acquire_cache_read_lock ();
-      for (i=0; i < 256; i++)
-        for (ci=cert_cache[i]; ci; ci = ci->next)
-          if (ci->cert && !ksba_cert_get_subj_key_id (ci->cert, NULL, &ski))
-            {
-              if (!cmp_simple_canon_sexp (keyid, ski))
-                {
-                  ksba_free (ski);
-                  ksba_cert_ref (ci->cert);
-                  release_cache_lock ();
-                  if (DBG_LOOKUP)
-                    log_debug ("%s: certificate found in the cache"
-                               " via ski\n", __func__);
-                  return ci->cert;
-                }
-              ksba_free (ski);
-            }
+      for (ci=ski_index[ski_hash (keyid)]; ci; ci = ci->ski_next)
+        if (!cmp_simple_canon_sexp (keyid, ci->ski))
+          {
+            touch_item (ci);
+            ksba_cert_ref (ci->cert);
+            release_cache_lock ();
+            if (DBG_LOOKUP)
+              log_debug ("%s: certificate found in the cache"
+                         " via ski\n", __func__);
+            return ci->cert;
+          }
       release_cache_lock ();
     }
 
   if (DBG_LOOKUP)
     log_debug ("find_cert_bysubject: certificate not in cache\n");
 
+  /* The certificate may have been dropped from the cache but still be
+   * in the persistent store.  */
+  if (subject_dn)
+    {
+      unsigned int count;
+
+      acquire_cache_write_lock ();
+      count = load_intermediates (subject_dn);
+      release_cache_lock ();
+      if (count)
+        {
+          if (DBG_LOOKUP)
+            log_debug ("%s: %u certificate(s) loaded from the store\n",
+                       __func__, count);
+          for (seq=0; (cert = get_cert_bysubject (subject_dn, seq)); seq++)
+            {
+              if (!keyid)
+                return cert;
+              if (!ksba_cert_get_subj_key_id (cert, NULL, &subj)
+                  && !cmp_simple_canon_sexp (keyid, subj))
+                {
+                  xfree (subj);
+                  return cert;
+                }
+              xfree (subj);
+              ksba_cert_release (cert);
+            }
+        }
+    }
+
   /* Ask back to the service requester to return the certificate.
    * This is because we can assume that he already used the
    * certificate while checking for the CRL. */
@@ -1613,6 +2063,7 @@ find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
       if (!keyid)
         {
           cache_cert (cert);
+          cert_cache_store_intermediate (cert);
           if (DBG_LOOKUP)
             log_debug ("   found\n");
           break; /* Ready.  */
@@ -1625,6 +2076,7 @@ find_cert_bysubject (ctrl_t ctrl, const char *subject_dn, ksba_sexp_t keyid)
             {
               ksba_free (subj);
               cache_cert (cert);
+              cert_cache_store_intermediate (cert);
               if (DBG_LOOKUP)
                 log_debug ("   found\n");
               break; /* Ready.  */
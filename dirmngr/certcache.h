@@ -38,6 +38,7 @@ void cert_cache_deinit (int full);
 
 /* Print some statistics to the log file.  */
 void cert_cache_print_stats (void);
+void cert_cache_collect_metrics (void);
 
 /* Return true if any cert of a class in MASK is permanently loaded.  */
 int cert_cache_any_in_class (unsigned int mask);
@@ -52,6 +53,9 @@ gpg_error_t cache_cert (ksba_cert_t cert);
 /* Put CERT into the certificate cache and return the fingerprint. */
 gpg_error_t cache_cert_silent (ksba_cert_t cert, void *fpr_buffer);
 
+/* Put the intermediate CA certificate CERT into the persistent store.  */
+void cert_cache_store_intermediate (ksba_cert_t cert);
+
 /* Return 0 if the certificate is a trusted certificate. Returns
  * GPG_ERR_NOT_TRUSTED if it is not trusted or other error codes in
  * case of systems errors.  TRUSTCLASSES are the bitwise ORed
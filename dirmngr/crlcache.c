@@ -68,6 +68,10 @@
         Field 9:  AuthorityKeyID.issuer, each Name separated by 0x01
         Field 10: AuthorityKeyID.serial
         Field 11: Hex fingerprint of trust anchor if field 1 is 'u'.
+        Field 12: optional URL of the delta CRL as given by the
+                  FreshestCRL extension of the full CRL.
+        Field 13: optional CRL number of the delta CRL which has been
+                  merged into the DB file as a hex string.
 
    2. Layout of the standard CRL Cache DB file:
 
@@ -105,6 +109,7 @@
 #undef mkdir
 #define mkdir(a,b) mkdir(a)
 #endif
+#include <npth.h>
 
 #include "dirmngr.h"
 #include "validate.h"
@@ -113,6 +118,7 @@
 #include "crlfetch.h"
 #include "misc.h"
 #include "cdb.h"
+#include "../common/tlv.h"
 
 /* Change this whenever the format changes */
 #define DBDIR_D "crls.d"
@@ -122,8 +128,14 @@
 /* The number of DB files we may have open at one time.  We need to
    limit this because there is no guarantee that the number of issuers
    has a upper limit.  We are currently using mmap, so it is a good
-   idea anyway to limit the number of opened cache files. */
-#define MAX_OPEN_DB_FILES 5
+   idea anyway to limit the number of opened cache files.  The limit
+   should be large enough for the issuers seen while verifying a batch
+   of mails so that the files are not reopened for each certificate. */
+#define MAX_OPEN_DB_FILES 16
+
+/* The number of CRL items after which we let other threads run while
+   inserting a CRL.  */
+#define CRL_YIELD_INTERVAL 4096
 
 #ifndef O_BINARY
 # define O_BINARY 0
@@ -132,6 +144,8 @@
 static const char oidstr_crlNumber[] = "2.5.29.20";
 /* static const char oidstr_issuingDistributionPoint[] = "2.5.29.28"; */
 static const char oidstr_authorityKeyIdentifier[] = "2.5.29.35";
+static const char oidstr_deltaCRLIndicator[] = "2.5.29.27";
+static const char oidstr_freshestCRL[] = "2.5.29.46";
 
 
 /* Definition of one cached item. */
@@ -155,13 +169,19 @@ struct crl_cache_entry_s
   char *crl_number;
   char *authority_issuer;
   char *authority_serialno;
+  char *delta_url;        /* URL of the delta CRL or NULL.  */
+  char *delta_crl_number; /* Number of the merged delta CRL or NULL.  */
 
   struct cdb *cdb;             /* The cache file handle or NULL if not open. */
 
   unsigned int cdb_use_count;  /* Current use count. */
-  unsigned int cdb_lru_count;  /* Used for LRU purposes. */
+  unsigned int cdb_lru_count;  /* Value of LRU_CLOCK at the last use. */
   int dbfile_checked;          /* Set to true if the dbfile_hash value has
                                   been checked one. */
+  int dbfile_bad;              /* Set to true if that check failed.  */
+
+  time_t prefetch_stamp;        /* Time of the last prefetch attempt.  */
+  unsigned int prefetch_jitter; /* Random offset for the prefetch.  */
 };
 
 
@@ -174,6 +194,19 @@ struct crl_cache_s
 typedef struct crl_cache_s *crl_cache_t;
 
 
+/* A CRL is prefetched by the housekeeping thread up to
+   CRL_PREFETCH_LEAD seconds before it expires.  A random jitter of up
+   to half of that time is added per entry so that the CRLs of one
+   server are not all fetched in the same run.  After an attempt we
+   wait for CRL_PREFETCH_RETRY seconds before the CRL is tried again
+   and at most CRL_PREFETCH_MAX CRLs are fetched per run.  The lead
+   time is larger than the housekeeping interval so that there are
+   several chances to get a CRL before it expires.  */
+#define CRL_PREFETCH_LEAD   (2*3600)
+#define CRL_PREFETCH_RETRY  (1800)
+#define CRL_PREFETCH_MAX    3
+
+
 /* Prototypes.  */
 static crl_cache_entry_t find_entry (crl_cache_entry_t first,
                                      const char *issuer_hash);
@@ -184,6 +217,9 @@ static crl_cache_entry_t find_entry (crl_cache_entry_t first,
    right at startup.  */
 static crl_cache_t current_cache;
 
+/* A counter incremented for each use of a cache file.  */
+static unsigned int lru_clock;
+
 
 
 
@@ -377,6 +413,8 @@ release_one_cache_entry (crl_cache_entry_t entry)
         }
       xfree (entry->release_ptr);
       xfree (entry->check_trust_anchor);
+      xfree (entry->delta_url);
+      xfree (entry->delta_crl_number);
       xfree (entry);
     }
 }
@@ -613,6 +651,14 @@ open_dir (crl_cache_t *r_cache)
                   if (*p)
                     entry->check_trust_anchor = xtrystrdup (p);
                   break;
+                case 12:
+                  if (*p)
+                    entry->delta_url = xtrystrdup (unpercent_string (p));
+                  break;
+                case 13:
+                  if (*p)
+                    entry->delta_crl_number = xtrystrdup (p);
+                  break;
                 default:
                   if (*p)
                     log_info (_("extra field detected in crl record of "
@@ -765,6 +811,14 @@ write_dir_line_crl (estream_t fp, crl_cache_entry_t e)
   es_putc (':', fp);
   if (e->check_trust_anchor && e->user_trust_req)
     es_fputs (e->check_trust_anchor, fp);
+  if (e->delta_url)
+    {
+      es_putc (':', fp);
+      write_percented_string (e->delta_url, fp);
+      es_putc (':', fp);
+      if (e->delta_crl_number)
+        es_fputs (e->delta_crl_number, fp);
+    }
   es_putc ('\n', fp);
 }
 
@@ -988,10 +1042,12 @@ make_db_file_name (const char *issuer_hash)
 
 
 /* Hash the file FNAME and return the MD5 digest in MD5BUFFER. The
-   caller must allocate MD%buffer wityh at least 16 bytes. Returns 0
-   on success. */
+   caller must allocate MD%buffer wityh at least 16 bytes.  If MEM is
+   not NULL the MEMLEN bytes at MEM are hashed instead of reading the
+   file.  Returns 0 on success. */
 static int
-hash_dbfile (const char *fname, unsigned char *md5buffer)
+hash_dbfile (const char *fname, const void *mem, size_t memlen,
+             unsigned char *md5buffer)
 {
   estream_t fp;
   char *buffer;
@@ -1000,8 +1056,8 @@ hash_dbfile (const char *fname, unsigned char *md5buffer)
   gpg_error_t err;
 
   buffer = xtrymalloc (65536);
-  fp = buffer? es_fopen (fname, "rb") : NULL;
-  if (!fp)
+  fp = (buffer && !mem)? es_fopen (fname, "rb") : NULL;
+  if (!buffer || (!mem && !fp))
     {
       log_error (_("can't hash '%s': %s\n"), fname, strerror (errno));
       xfree (buffer);
@@ -1022,22 +1078,28 @@ hash_dbfile (const char *fname, unsigned char *md5buffer)
   sprintf (buffer, "%.100s/%.100s:%d", DBDIR_D, DBDIRFILE, DBDIRVERSION);
   gcry_md_write (md5, buffer, strlen (buffer));
 
-  for (;;)
+  if (mem)
+    gcry_md_write (md5, mem, memlen);
+  else
     {
-      n = es_fread (buffer, 1, 65536, fp);
-      if (n < 65536 && es_ferror (fp))
+      for (;;)
         {
-          log_error (_("error hashing '%s': %s\n"), fname, strerror (errno));
-          xfree (buffer);
-          es_fclose (fp);
-          gcry_md_close (md5);
-          return -1;
+          n = es_fread (buffer, 1, 65536, fp);
+          if (n < 65536 && es_ferror (fp))
+            {
+              log_error (_("error hashing '%s': %s\n"),
+                         fname, strerror (errno));
+              xfree (buffer);
+              es_fclose (fp);
+              gcry_md_close (md5);
+              return -1;
+            }
+          if (!n)
+            break;
+          gcry_md_write (md5, buffer, n);
         }
-      if (!n)
-        break;
-      gcry_md_write (md5, buffer, n);
+      es_fclose (fp);
     }
-  es_fclose (fp);
   xfree (buffer);
   gcry_md_final (md5);
 
@@ -1047,9 +1109,11 @@ hash_dbfile (const char *fname, unsigned char *md5buffer)
 }
 
 /* Compare the file FNAME against the dexified MD5 hash MD5HASH and
-   return 0 if they match. */
+   return 0 if they match.  If CDB is not NULL and the file has been
+   mapped into memory, the mapped data is checked.  */
 static int
-check_dbfile (const char *fname, const char *md5hexvalue)
+check_dbfile (const char *fname, const char *md5hexvalue,
+              const struct cdb *cdb)
 {
   unsigned char buffer1[16], buffer2[16];
 
@@ -1060,7 +1124,12 @@ check_dbfile (const char *fname, const char *md5hexvalue)
     }
   unhexify (buffer1, md5hexvalue);
 
-  if (hash_dbfile (fname, buffer2))
+  if (cdb && cdb->cdb_mem)
+    {
+      if (hash_dbfile (fname, cdb->cdb_mem, cdb->cdb_fsize, buffer2))
+        return -1;
+    }
+  else if (hash_dbfile (fname, NULL, 0, buffer2))
     return -1;
 
   return memcmp (buffer1, buffer2, 16);
@@ -1081,6 +1150,7 @@ lock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
   if (entry->cdb)
     {
       entry->cdb_use_count++;
+      entry->cdb_lru_count = ++lru_clock;
       return entry->cdb;
     }
 
@@ -1128,14 +1198,6 @@ lock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
   if (opt.verbose)
     log_info (_("opening cache file '%s'\n"), fname );
 
-  if (!entry->dbfile_checked)
-    {
-      if (!check_dbfile (fname, entry->dbfile_hash))
-        entry->dbfile_checked = 1;
-      /* Note, in case of an error we don't print an error here but
-         let require the caller to do that check. */
-    }
-
   entry->cdb = xtrycalloc (1, sizeof *entry->cdb);
   if (!entry->cdb)
     {
@@ -1162,10 +1224,23 @@ lock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
       xfree (fname);
       return NULL;
     }
+
+  /* The checksum is computed only once for each loaded CRL, even if
+     it failed, and over the mapped data so that we check exactly
+     what we are going to use. */
+  if (!entry->dbfile_checked && !entry->dbfile_bad)
+    {
+      if (!check_dbfile (fname, entry->dbfile_hash, entry->cdb))
+        entry->dbfile_checked = 1;
+      else
+        entry->dbfile_bad = 1;
+      /* Note, in case of an error we don't print an error here but
+         let require the caller to do that check. */
+    }
   xfree (fname);
 
   entry->cdb_use_count = 1;
-  entry->cdb_lru_count = 0;
+  entry->cdb_lru_count = ++lru_clock;
 
   return entry->cdb;
 }
@@ -1181,7 +1256,6 @@ unlock_db_file (crl_cache_t cache, crl_cache_entry_t entry)
   else
     {
       entry->cdb_use_count--;
-      entry->cdb_lru_count++;
     }
 
   /* If the entry was marked for deletion in the meantime do it now.
@@ -1830,6 +1904,105 @@ abort_sig_check (ksba_crl_t crl, gcry_md_hd_t md)
 }
 
 
+/* The serial numbers listed in a delta CRL.  They are used to skip
+   the corresponding records of the base CRL.  */
+struct delta_serial_s
+{
+  size_t len;
+  unsigned char sn[1];
+};
+typedef struct delta_serial_s *delta_serial_t;
+
+struct delta_set_s
+{
+  size_t count;
+  size_t size;
+  delta_serial_t *items;
+};
+typedef struct delta_set_s *delta_set_t;
+
+
+static void
+release_delta_set (delta_set_t set)
+{
+  size_t n;
+
+  for (n=0; n < set->count; n++)
+    xfree (set->items[n]);
+  xfree (set->items);
+  set->items = NULL;
+  set->count = set->size = 0;
+}
+
+
+/* Add the serial number SN of length LEN to SET.  */
+static gpg_error_t
+add_to_delta_set (delta_set_t set, const unsigned char *sn, size_t len)
+{
+  delta_serial_t item;
+
+  if (set->count == set->size)
+    {
+      size_t newsize = set->size? set->size * 2 : 256;
+      delta_serial_t *tmp;
+
+      tmp = xtryrealloc (set->items, newsize * sizeof *tmp);
+      if (!tmp)
+        return gpg_error_from_syserror ();
+      set->items = tmp;
+      set->size = newsize;
+    }
+  item = xtrymalloc (sizeof *item + len);
+  if (!item)
+    return gpg_error_from_syserror ();
+  item->len = len;
+  memcpy (item->sn, sn, len);
+  set->items[set->count++] = item;
+  return 0;
+}
+
+
+static int
+compare_delta_serials (const void *a_arg, const void *b_arg)
+{
+  const struct delta_serial_s *a = *(const delta_serial_t *)a_arg;
+  const struct delta_serial_s *b = *(const delta_serial_t *)b_arg;
+
+  if (a->len != b->len)
+    return a->len < b->len? -1 : 1;
+  return memcmp (a->sn, b->sn, a->len);
+}
+
+
+/* Return true if the serial number SN of length LEN is in SET.  The
+   set must have been sorted.  */
+static int
+in_delta_set (delta_set_t set, const unsigned char *sn, size_t len)
+{
+  size_t lo = 0;
+  size_t hi = set->count;
+
+  while (lo < hi)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      delta_serial_t item = set->items[mid];
+      int cmp;
+
+      if (item->len != len)
+        cmp = item->len < len? -1 : 1;
+      else
+        cmp = memcmp (item->sn, sn, len);
+      if (!cmp)
+        return 1;
+      if (cmp < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  return 0;
+}
+
+
 /* Workhorse of the CRL loading machinery.  The CRL is read using the
    CRL object and stored in the data base file DB with the name FNAME
    (only used for printing error messages).  That DB should be a
@@ -1843,14 +2016,16 @@ abort_sig_check (ksba_crl_t crl, gcry_md_hd_t md)
    caller should free *R_ISSUER even if the function returns with an
    error.  R_TRUST_ANCHOR is set on exit to NULL or a string with the
    hexified fingerprint of the root certificate, if checking this
-   certificate for trustiness is required.
+   certificate for trustiness is required.  If DELTA is not NULL the
+   CRL is a delta CRL; all its serial numbers are then also stored in
+   DELTA and items with the reason removeFromCRL are not inserted.
 */
 static int
 crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
                   struct cdb_make *cdb, const char *fname,
                   char **r_crlissuer,
                   ksba_isotime_t thisupdate, ksba_isotime_t nextupdate,
-                  char **r_trust_anchor)
+                  char **r_trust_anchor, delta_set_t delta)
 {
   gpg_error_t err;
   ksba_stop_reason_t stopreason;
@@ -1859,6 +2034,7 @@ crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
   int algo = 0;
   int use_pss = 0;
   size_t n;
+  unsigned long nitems = 0;
 
   (void)fname;
 
@@ -1927,9 +2103,21 @@ crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
             p = serial_to_buffer (serial, &n);
             if (!p)
               BUG ();
+            if (delta)
+              {
+                err = add_to_delta_set (delta, p, n);
+                if (err)
+                  {
+                    ksba_free (serial);
+                    goto failure;
+                  }
+              }
             record[0] = (reason & 0xff);
             memcpy (record+1, rdate, 15);
-            rc = cdb_make_add (cdb, p, n, record, 1+15);
+            if (delta && (reason & KSBA_CRLREASON_REMOVE_FROM_CRL))
+              rc = 0;  /* The certificate is not revoked anymore.  */
+            else
+              rc = cdb_make_add (cdb, p, n, record, 1+15);
             if (rc)
               {
                 err = gpg_error_from_errno (errno);
@@ -1940,6 +2128,18 @@ crl_parse_insert (ctrl_t ctrl, ksba_crl_t crl,
               }
 
             ksba_free (serial);
+
+            /* A large CRL which has already been downloaded or is
+               loaded from a file would block all other connections
+               for a long time; thus we let them run and check
+               whether the client is still there.  */
+            if (!(++nitems % CRL_YIELD_INTERVAL))
+              {
+                npth_usleep (0);
+                err = dirmngr_tick (ctrl);
+                if (err)
+                  goto failure;
+              }
           }
           break;
 
@@ -2127,6 +2327,202 @@ get_auth_key_id (ksba_crl_t crl, char **serialno)
 }
 
 
+/* Return the first usable URL from the FreshestCRL extension of CRL
+   as an allocated string or NULL if there is none.  The extension
+   has the syntax of the CRLDistributionPoints extension; we only
+   look at the fullName form.  */
+static char *
+get_delta_url (ksba_crl_t crl)
+{
+  int idx, crit;
+  const char *oid;
+  const unsigned char *der;
+  size_t derlen;
+
+  for (idx=0; !ksba_crl_get_extension (crl, idx, &oid, &crit, &der, &derlen);
+       idx++)
+    {
+      int class, tag, cons, ndef;
+      size_t len, hdr, dplen, gnlen;
+
+      if (strcmp (oid, oidstr_freshestCRL))
+        continue;
+
+      /* SEQUENCE OF DistributionPoint.  */
+      if (parse_ber_header (&der, &derlen, &class, &tag, &cons, &ndef,
+                            &len, &hdr)
+          || class != CLASS_UNIVERSAL || tag != TAG_SEQUENCE || ndef
+          || len > derlen)
+        return NULL;
+      derlen = len;
+      while (derlen)
+        {
+          /* DistributionPoint.  */
+          if (parse_ber_header (&der, &derlen, &class, &tag, &cons, &ndef,
+                                &dplen, &hdr)
+              || class != CLASS_UNIVERSAL || tag != TAG_SEQUENCE || ndef
+              || dplen > derlen)
+            return NULL;
+          derlen -= dplen;
+          /* [0] DistributionPointName and [0] fullName.  */
+          if (parse_ber_header (&der, &dplen, &class, &tag, &cons, &ndef,
+                                &len, &hdr)
+              || class != CLASS_CONTEXT || tag != 0 || ndef || len > dplen
+              || parse_ber_header (&der, &dplen, &class, &tag, &cons, &ndef,
+                                   &gnlen, &hdr)
+              || class != CLASS_CONTEXT || tag != 0 || ndef || gnlen > dplen)
+            {
+              der += dplen;
+              continue;
+            }
+          dplen -= gnlen;
+          while (gnlen)
+            {
+              if (parse_ber_header (&der, &gnlen, &class, &tag, &cons, &ndef,
+                                    &len, &hdr)
+                  || ndef || len > gnlen)
+                return NULL;
+              /* [6] uniformResourceIdentifier.  */
+              if (class == CLASS_CONTEXT && tag == 6 && !cons
+                  && ((len > 5 && !strncmp ((const char *)der, "http:", 5))
+                      || (len > 6 && !strncmp ((const char *)der,
+                                               "https:", 6))
+                      || (len > 5 && !strncmp ((const char *)der,
+                                               "ldap:", 5))))
+                {
+                  char *url = xtrymalloc (len + 1);
+
+                  if (url)
+                    {
+                      memcpy (url, der, len);
+                      url[len] = 0;
+                    }
+                  return url;
+                }
+              der += len;
+              gnlen -= len;
+            }
+          der += dplen;
+        }
+      return NULL;
+    }
+  return NULL;
+}
+
+
+/* Return true if CRL is a delta CRL.  The BaseCRLNumber is then
+   stored as an allocated hex string at R_BASE; it may be NULL if the
+   extension could not be parsed.  */
+static int
+get_delta_base_number (ksba_crl_t crl, char **r_base)
+{
+  int idx, crit;
+  const char *oid;
+  const unsigned char *der;
+  size_t derlen;
+
+  *r_base = NULL;
+  for (idx=0; !ksba_crl_get_extension (crl, idx, &oid, &crit, &der, &derlen);
+       idx++)
+    {
+      int class, tag, cons, ndef;
+      size_t len, hdr;
+
+      if (strcmp (oid, oidstr_deltaCRLIndicator))
+        continue;
+
+      if (!parse_ber_header (&der, &derlen, &class, &tag, &cons, &ndef,
+                             &len, &hdr)
+          && class == CLASS_UNIVERSAL && tag == TAG_INTEGER && !cons
+          && !ndef && len && len <= derlen)
+        *r_base = bin2hex (der, len, NULL);
+      return 1;
+    }
+  return 0;
+}
+
+
+/* Compare the CRL numbers A and B given as hex strings.  Returns -1,
+   0 or 1 like strcmp.  */
+static int
+compare_crl_numbers (const char *a, const char *b)
+{
+  size_t alen, blen;
+
+  while (*a == '0')
+    a++;
+  while (*b == '0')
+    b++;
+  alen = strlen (a);
+  blen = strlen (b);
+  if (alen != blen)
+    return alen < blen? -1 : 1;
+  return ascii_strcasecmp (a, b);
+}
+
+
+/* Copy all records of the cached CRL BASE which are not listed in
+   the delta CRL's serial numbers DELTA to CDB.  */
+static gpg_error_t
+copy_base_records (crl_cache_t cache, crl_cache_entry_t base,
+                   delta_set_t delta, struct cdb_make *cdb)
+{
+  gpg_error_t err = 0;
+  struct cdb *basecdb;
+  struct cdb_find cdbfp;
+  unsigned char keyrecord[256];
+  unsigned char record[16];
+  cdbi_t n;
+  int rc;
+
+  basecdb = lock_db_file (cache, base);
+  if (!basecdb)
+    return gpg_error (GPG_ERR_GENERAL);
+
+  qsort (delta->items, delta->count, sizeof *delta->items,
+         compare_delta_serials);
+
+  rc = cdb_findinit (&cdbfp, basecdb, NULL, 0);
+  while (!rc && (rc = cdb_findnext (&cdbfp)) > 0)
+    {
+      rc = 0;
+      n = cdb_keylen (basecdb);
+      if (cdb_datalen (basecdb) != 16 || n > sizeof keyrecord)
+        {
+          log_error (_(" WARNING: invalid cache record length\n"));
+          err = gpg_error (GPG_ERR_INV_CRL);
+          break;
+        }
+      if (cdb_read (basecdb, keyrecord, n, cdb_keypos (basecdb))
+          || cdb_read (basecdb, record, 16, cdb_datapos (basecdb)))
+        {
+          err = gpg_error_from_syserror ();
+          log_error (_("problem reading cache record: %s\n"),
+                     gpg_strerror (err));
+          break;
+        }
+      if (in_delta_set (delta, keyrecord, n))
+        continue;
+      if (cdb_make_add (cdb, keyrecord, n, record, 16))
+        {
+          err = gpg_error_from_syserror ();
+          log_error (_("error inserting item into "
+                       "temporary cache file: %s\n"),
+                     gpg_strerror (err));
+          break;
+        }
+    }
+  if (rc && !err)
+    {
+      err = gpg_error (GPG_ERR_INV_CRL);
+      log_error (_("error reading cache entry from db: %s\n"), strerror (rc));
+    }
+
+  unlock_db_file (cache, base);
+  return err;
+}
+
+
 
 /* Insert the CRL retrieved using URL into the cache specified by
    CACHE.  The CRL itself will be read from the stream FP and is
@@ -2142,9 +2538,15 @@ get_auth_key_id (ksba_crl_t crl, char **serialno)
       cmd_loadcrl
       --fetch-crl
 
+   If BASE_HASH is not NULL the CRL is expected to be a delta CRL for
+   the cached CRL of the issuer with that hash.  The records of the
+   cached CRL are then merged with those of the delta CRL and the
+   cache entry keeps the URL and CRL number of the cached CRL.
+
  */
-gpg_error_t
-crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
+static gpg_error_t
+insert_crl (ctrl_t ctrl, const char *url, ksba_reader_t reader,
+            const char *base_hash)
 {
   crl_cache_t cache = get_current_cache ();
   gpg_error_t err, err2;
@@ -2165,6 +2567,11 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   const char *oid;
   int critical;
   char *trust_anchor = NULL;
+  struct delta_set_s delta = { 0, 0, NULL };
+  char *delta_base = NULL;
+  char *base_url = NULL;
+  char *base_number = NULL;
+  char *base_delta_url = NULL;
 
   /* FIXME: We should acquire a mutex for the URL, so that we don't
      simultaneously enter the same CRL twice.  However this needs to be
@@ -2237,7 +2644,8 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   cdb_make_start(&cdb, fd_cdb);
 
   err = crl_parse_insert (ctrl, crl, &cdb, fname,
-                          &issuer, thisupdate, nextupdate, &trust_anchor);
+                          &issuer, thisupdate, nextupdate, &trust_anchor,
+                          base_hash? &delta : NULL);
   if (err)
     {
       log_error (_("crl_parse_insert failed: %s\n"), gpg_strerror (err));
@@ -2246,6 +2654,40 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
       goto leave;
     }
 
+  /* Create an hex encoded SHA-1 hash of the issuer DN to be
+     used as the key for the cache. */
+  issuer_hash = hashify_data (issuer, strlen (issuer));
+
+  if (base_hash)
+    {
+      crl_cache_entry_t base;
+
+      /* Merge the cached CRL.  The delta CRL may only be applied to a
+         CRL of the same issuer whose number is at least the
+         BaseCRLNumber of the delta.  */
+      base = find_entry (cache->entries, base_hash);
+      if (!get_delta_base_number (crl, &delta_base) || !delta_base
+          || strcmp (issuer_hash, base_hash)
+          || !base || base->invalid || !base->crl_number
+          || compare_crl_numbers (base->crl_number, delta_base) < 0)
+        {
+          log_info ("CRL at '%s' is not a usable delta CRL\n", url);
+          err = gpg_error (GPG_ERR_INV_CRL);
+        }
+      else if (!(base_url = xtrystrdup (base->url))
+               || !(base_number = xtrystrdup (base->crl_number))
+               || (base->delta_url
+                   && !(base_delta_url = xtrystrdup (base->delta_url))))
+        err = gpg_error_from_syserror ();
+      else
+        err = copy_base_records (cache, base, &delta, &cdb);
+      if (err)
+        {
+          cdb_make_finish (&cdb);
+          goto leave;
+        }
+    }
+
   /* Finish the database. */
   if (cdb_make_finish (&cdb))
     {
@@ -2268,7 +2710,7 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   {
     unsigned char md5buf[16];
 
-    if (hash_dbfile (fname, md5buf))
+    if (hash_dbfile (fname, NULL, 0, md5buf))
       {
         err = gpg_error (GPG_ERR_CHECKSUM);
         goto leave;
@@ -2300,7 +2742,8 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
     {
       if (!critical
           || !strcmp (oid, oidstr_authorityKeyIdentifier)
-          || !strcmp (oid, oidstr_crlNumber) )
+          || !strcmp (oid, oidstr_crlNumber)
+          || (base_hash && !strcmp (oid, oidstr_deltaCRLIndicator)))
         continue;
       log_error (_("unknown critical CRL extension %s\n"), oid);
       if (!err2)
@@ -2316,10 +2759,14 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
       err = gpg_error (GPG_ERR_INV_CRL);
     }
 
-
-  /* Create an hex encoded SHA-1 hash of the issuer DN to be
-     used as the key for the cache. */
-  issuer_hash = hashify_data (issuer, strlen (issuer));
+  /* A delta CRL which can't be used must not replace the cached CRL;
+     the caller falls back to loading the full CRL.  */
+  if (base_hash && (err || err2))
+    {
+      if (!err)
+        err = err2;
+      goto leave;
+    }
 
   /* Create an ENTRY. */
   entry = xtrycalloc (1, sizeof *entry);
@@ -2328,6 +2775,8 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
       err = gpg_error_from_syserror ();
       goto leave;
     }
+  if (base_url)
+    url = base_url;
   entry->release_ptr = xtrymalloc (strlen (issuer_hash) + 1
                                    + strlen (issuer) + 1
                                    + strlen (url) + 1
@@ -2347,12 +2796,27 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   gnupg_copy_time (entry->this_update, thisupdate);
   gnupg_copy_time (entry->next_update, nextupdate);
   gnupg_copy_time (entry->last_refresh, current_time);
-  entry->crl_number = get_crl_number (crl);
+  if (base_hash)
+    {
+      entry->crl_number = base_number;
+      base_number = NULL;
+      entry->delta_url = base_delta_url;
+      base_delta_url = NULL;
+      entry->delta_crl_number = get_crl_number (crl);
+    }
+  else
+    {
+      entry->crl_number = get_crl_number (crl);
+      entry->delta_url = get_delta_url (crl);
+    }
   entry->authority_issuer = get_auth_key_id (crl, &entry->authority_serialno);
   entry->invalid = invalidate_crl;
   entry->user_trust_req = !!trust_anchor;
   entry->check_trust_anchor = trust_anchor;
   trust_anchor = NULL;
+  /* We just computed the checksum of the file; there is no need to
+     hash it again when it is opened for the first time.  */
+  entry->dbfile_checked = 1;
 
   /* Check whether we already have an entry for this issuer and mark
      it as deleted. We better use a loop, just in case duplicates got
@@ -2430,10 +2894,24 @@ crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
   xfree (issuer_hash);
   xfree (checksum);
   xfree (trust_anchor);
+  release_delta_set (&delta);
+  xfree (delta_base);
+  xfree (base_url);
+  xfree (base_number);
+  xfree (base_delta_url);
   return err ? err : err2;
 }
 
 
+/* Insert the CRL retrieved using URL into the cache.  The CRL itself
+   will be read from READER and is expected in binary format.  */
+gpg_error_t
+crl_cache_insert (ctrl_t ctrl, const char *url, ksba_reader_t reader)
+{
+  return insert_crl (ctrl, url, reader, NULL);
+}
+
+
 /* Print one cached entry E in a human readable format to stream
    FP. Return 0 on success. */
 static gpg_error_t
@@ -2452,6 +2930,9 @@ list_one_crl_entry (crl_cache_t cache, crl_cache_entry_t e, estream_t fp)
   es_fprintf (fp, " This Update:\t%s\n", e->this_update );
   es_fprintf (fp, " Next Update:\t%s\n", e->next_update );
   es_fprintf (fp, " CRL Number :\t%s\n", e->crl_number? e->crl_number: "none");
+  if (e->delta_url)
+    es_fprintf (fp, " Delta CRL  :\t%s (%s)\n", e->delta_url,
+                e->delta_crl_number? e->delta_crl_number : "not loaded");
   es_fprintf (fp, " AuthKeyId  :\t%s\n",
               e->authority_serialno? e->authority_serialno:"none");
   if (e->authority_serialno && e->authority_issuer)
@@ -2604,6 +3085,63 @@ crl_cache_load (ctrl_t ctrl, const char *filename)
 }
 
 
+/* Try to update the cached CRL of the issuer of CERT using the delta
+   CRL announced by that CRL.  Returns 0 if the cache has been
+   updated.  */
+static gpg_error_t
+try_delta_crl (ctrl_t ctrl, ksba_cert_t cert)
+{
+  crl_cache_t cache = get_current_cache ();
+  gpg_error_t err;
+  crl_cache_entry_t entry;
+  ksba_reader_t reader = NULL;
+  char *issuer, *issuer_hash, *url;
+
+  issuer = ksba_cert_get_issuer (cert, 0);
+  if (!issuer)
+    return gpg_error (GPG_ERR_INV_CERT_OBJ);
+  issuer_hash = hashify_data (issuer, strlen (issuer));
+  ksba_free (issuer);
+
+  entry = find_entry (cache->entries, issuer_hash);
+  if (!entry || entry->invalid || !entry->delta_url || !entry->crl_number)
+    {
+      xfree (issuer_hash);
+      return gpg_error (GPG_ERR_NOT_FOUND);
+    }
+  if ((!strncmp (entry->delta_url, "ldap", 4) && opt.ignore_ldap_dp)
+      || (!strncmp (entry->delta_url, "http", 4) && opt.ignore_http_dp))
+    {
+      xfree (issuer_hash);
+      return gpg_error (GPG_ERR_NOT_SUPPORTED);
+    }
+  /* ENTRY may go away while we are fetching the delta CRL.  */
+  url = xtrystrdup (entry->delta_url);
+  if (!url)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (issuer_hash);
+      return err;
+    }
+
+  if (opt.verbose)
+    log_info ("fetching delta CRL from '%s'\n", url);
+  err = crl_fetch (ctrl, url, &reader);
+  if (!err)
+    err = insert_crl (ctrl, url, reader, issuer_hash);
+  if (err)
+    log_info ("loading delta CRL from '%s' failed: %s\n",
+              url, gpg_strerror (err));
+  else if (opt.verbose)
+    log_info ("cached CRL updated by delta CRL\n");
+
+  crl_close_reader (reader);
+  xfree (url);
+  xfree (issuer_hash);
+  return err;
+}
+
+
 /* Locate the corresponding CRL for the certificate CERT, read and
    verify the CRL and store it in the cache.  */
 gpg_error_t
@@ -2618,6 +3156,13 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
   char *issuername_uri = NULL;
   int any_dist_point = 0;
   int seq;
+  strlist_t urls = NULL;
+  gpg_error_t insert_err = 0;
+
+  /* A delta CRL is much smaller than the full CRL; thus try it first
+     and load the full CRL only if that fails.  */
+  if (!try_delta_crl (ctrl, cert))
+    return 0;
 
   /* Loop over all distribution points, get the CRLs and put them into
      the cache. */
@@ -2643,7 +3188,9 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
       xfree (issuername_uri); issuername_uri = NULL;
 
       /* Get the URIs.  We do this in a loop to iterate over all names
-         in the crlDP. */
+         in the crlDP.  All names are locations of the same CRL; thus
+         we fetch from all of them at once and take the first CRL
+         which can be inserted.  */
       for (name_seq=0; ksba_name_enum (distpoint, name_seq); name_seq++)
         {
           xfree (distpoint_uri); distpoint_uri = NULL;
@@ -2667,30 +3214,39 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
             continue; /* Skip unknown schemes. */
 
           any_dist_point = 1;
-
-          if (opt.verbose)
-            log_info ("fetching CRL from '%s'\n", distpoint_uri);
-          err = crl_fetch (ctrl, distpoint_uri, &reader);
-          if (err)
+          if (!append_to_strlist_try (&urls, distpoint_uri))
             {
-              log_error (_("crl_fetch via DP failed: %s\n"),
-                         gpg_strerror (err));
-              last_err = err;
-              continue; /* with the next name. */
+              err = gpg_error_from_syserror ();
+              goto leave;
             }
+        }
 
-          if (opt.verbose)
-            log_info ("inserting CRL (reader %p)\n", reader);
-          err = crl_cache_insert (ctrl, distpoint_uri, reader);
-          if (err)
+      if (urls)
+        {
+          crl_race_t race;
+          ksba_reader_t racereader;
+          const char *url;
+
+          last_err = crl_race_start (ctrl, urls, &race);
+          while (!last_err
+                 && !(last_err = crl_race_next (race, &racereader, &url)))
             {
+              if (opt.verbose)
+                log_info ("inserting CRL from '%s'\n", url);
+              last_err = crl_cache_insert (ctrl, url, racereader);
+              if (!last_err)
+                break; /* Ready. */
               log_error (_("crl_cache_insert via DP failed: %s\n"),
-                         gpg_strerror (err));
-              last_err = err;
-              continue; /* with the next name. */
+                         gpg_strerror (last_err));
+              insert_err = last_err;
+              last_err = 0; /* Try the next one.  */
             }
-          last_err = 0;
-          break; /* Ready. */
+          crl_race_end (race);
+          free_strlist (urls);
+          urls = NULL;
+          if (gpg_err_code (last_err) == GPG_ERR_EOF)
+            last_err = insert_err;
+          insert_err = 0;
         }
       if (last_err)
         {
@@ -2704,10 +3260,6 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
          code for documentation. */
       issuername_uri =  ksba_name_get_uri (issuername, 0);
       ksba_name_release (issuername); issuername = NULL;
-
-      /* Close the reader.  */
-      crl_close_reader (reader);
-      reader = NULL;
     }
   if (gpg_err_code (err) == GPG_ERR_EOF)
     err = 0;
@@ -2752,6 +3304,7 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
 
  leave:
   crl_close_reader (reader);
+  free_strlist (urls);
   xfree (distpoint_uri);
   xfree (issuername_uri);
   ksba_name_release (distpoint);
@@ -2759,3 +3312,101 @@ crl_cache_reload_crl (ctrl_t ctrl, ksba_cert_t cert)
   ksba_free (issuer);
   return err;
 }
+
+
+/* Return true if the CRL of entry E shall be prefetched at
+   CURTIME.  */
+static int
+prefetch_due_p (crl_cache_entry_t e, time_t curtime)
+{
+  time_t nextupd, due;
+
+  if (e->deleted || e->invalid || !e->url || !*e->url || !*e->next_update)
+    return 0;
+  if ((!strncmp (e->url, "ldap", 4)
+       && (opt.ignore_ldap_dp || opt.disable_ldap))
+      || (!strncmp (e->url, "http", 4)
+          && (opt.ignore_http_dp || opt.disable_http)))
+    return 0;
+  if (e->prefetch_stamp && e->prefetch_stamp + CRL_PREFETCH_RETRY > curtime)
+    return 0;
+
+  nextupd = isotime2epoch (e->next_update);
+  if (nextupd == (time_t)(-1))
+    return 0;
+  if (!e->prefetch_jitter)
+    {
+      gcry_create_nonce (&e->prefetch_jitter, sizeof e->prefetch_jitter);
+      e->prefetch_jitter = e->prefetch_jitter % (CRL_PREFETCH_LEAD / 2) + 1;
+    }
+
+  /* A CRL which expired long ago is likely not used anymore; it will
+     be fetched on demand.  */
+  due = nextupd - CRL_PREFETCH_LEAD + e->prefetch_jitter;
+  return curtime >= due && curtime < nextupd + CRL_PREFETCH_LEAD;
+}
+
+
+/* Fetch the CRLs which are about to expire so that a verification
+   does not need to wait for the download.  This is called by the
+   housekeeping thread; the CRLs are fetched one after the other.  */
+void
+crl_cache_prefetch (ctrl_t ctrl, time_t curtime)
+{
+  gpg_error_t err;
+  crl_cache_entry_t e;
+  ksba_reader_t reader;
+  ksba_isotime_t old_next_update;
+  strlist_t tried = NULL;
+  char *url, *issuer_hash;
+  int count;
+
+  for (count = 0; count < CRL_PREFETCH_MAX && current_cache; count++)
+    {
+      /* The list may change while we are fetching; thus we need to
+         restart the scan after each fetch.  */
+      for (e = current_cache->entries; e; e = e->next)
+        if (!strlist_find (tried, e->issuer_hash)
+            && prefetch_due_p (e, curtime))
+          break;
+      if (!e)
+        break;
+
+      e->prefetch_stamp = curtime;
+      url = xtrystrdup (e->url);
+      issuer_hash = url? xtrystrdup (e->issuer_hash) : NULL;
+      if (!issuer_hash || !add_to_strlist_try (&tried, issuer_hash))
+        {
+          log_error ("prefetching CRLs failed: %s\n",
+                     gpg_strerror (gpg_error_from_syserror ()));
+          xfree (url);
+          xfree (issuer_hash);
+          break;
+        }
+      gnupg_copy_time (old_next_update, e->next_update);
+
+      if (opt.verbose)
+        log_info ("prefetching CRL from '%s'\n", url);
+      reader = NULL;
+      err = crl_fetch (ctrl, url, &reader);
+      if (!err)
+        err = crl_cache_insert (ctrl, url, reader);
+      crl_close_reader (reader);
+      if (err)
+        log_info ("prefetching CRL from '%s' failed: %s\n",
+                  url, gpg_strerror (err));
+      else if (current_cache
+               && (e = find_entry (current_cache->entries, issuer_hash))
+               && !strcmp (e->next_update, old_next_update))
+        {
+          /* The server has not yet published a new CRL.  Delay the
+             next attempt.  */
+          e->prefetch_stamp = curtime;
+        }
+
+      xfree (url);
+      xfree (issuer_hash);
+    }
+
+  free_strlist (tried);
+}
@@ -252,6 +252,302 @@ crl_fetch (ctrl_t ctrl, const char *url, ksba_reader_t *reader)
 }
 
 
+/* The state of a race between fetches of the same CRL from several
+ * URLs.  All fetches are started at once; the caller takes the
+ * readers in the order the fetches succeeded and the fetches which
+ * are still running when the caller is done are abandoned.  An
+ * abandoned fetch closes its reader itself.  Each fetch uses its own
+ * control object because it may outlive the caller's session.  The
+ * fields are protected by CRL_RACE_LOCK.  */
+struct crl_race_item_s
+{
+  struct crl_race_item_s *next;
+  struct crl_race_s *race;
+  ctrl_t ctrl;                 /* Either the caller's or CTRLBUF.  */
+  struct server_control_s ctrlbuf;
+  ksba_reader_t reader;
+  char url[1];
+};
+
+struct crl_race_s
+{
+  int refcount;                /* One for the caller and each fetch.  */
+  int done;                    /* The caller does not take more readers.  */
+  int pending;                 /* Number of running fetches.  */
+  gpg_error_t last_err;        /* Error of the last failed fetch.  */
+  struct crl_race_item_s *ready;  /* Successful fetches, oldest first.  */
+  struct crl_race_item_s *current;  /* Item handed out to the caller.  */
+  npth_cond_t cond;            /* Signaled when a fetch has finished.  */
+};
+
+static npth_mutex_t crl_race_lock = NPTH_MUTEX_INITIALIZER;
+
+
+static void
+lock_crl_race (void)
+{
+  int res = npth_mutex_lock (&crl_race_lock);
+  if (res)
+    log_fatal ("failed to acquire the CRL race lock: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+}
+
+static void
+unlock_crl_race (void)
+{
+  int res = npth_mutex_unlock (&crl_race_lock);
+  if (res)
+    log_fatal ("failed to release the CRL race lock: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+}
+
+
+/* Close the reader of ITEM and release ITEM.  */
+static void
+release_crl_race_item (struct crl_race_item_s *item)
+{
+  if (!item)
+    return;
+  crl_close_reader (item->reader);
+  if (item->ctrl == &item->ctrlbuf)
+    {
+#if USE_LDAP
+      ldap_wrapper_connection_cleanup (item->ctrl);
+#endif
+      dirmngr_deinit_default_ctrl (item->ctrl);
+    }
+  xfree (item);
+}
+
+
+/* Release a reference to RACE.  Must be called with the lock
+ * held.  */
+static void
+unref_crl_race (struct crl_race_s *race)
+{
+  if (--race->refcount)
+    return;
+  npth_cond_destroy (&race->cond);
+  xfree (race);
+}
+
+
+/* Run the fetch of ITEM and hand the result to the race.  This is
+ * also used as the thread function.  */
+static void *
+crl_race_fetch (void *arg)
+{
+  struct crl_race_item_s *item = arg;
+  struct crl_race_s *race = item->race;
+  struct crl_race_item_s **itemp;
+  gpg_error_t err;
+
+  if (opt.verbose)
+    log_info ("fetching CRL from '%s'\n", item->url);
+  err = crl_fetch (item->ctrl, item->url, &item->reader);
+  if (err)
+    log_error (_("crl_fetch via DP failed: %s\n"), gpg_strerror (err));
+
+  lock_crl_race ();
+  race->pending--;
+  if (err)
+    race->last_err = err;
+  else if (!race->done)
+    {
+      for (itemp = &race->ready; *itemp; itemp = &(*itemp)->next)
+        ;
+      *itemp = item;
+      item = NULL;
+    }
+  npth_cond_signal (&race->cond);
+  unlock_crl_race ();
+
+  /* ITEM is still set if the fetch failed or has been abandoned.  */
+  release_crl_race_item (item);
+
+  lock_crl_race ();
+  unref_crl_race (race);
+  unlock_crl_race ();
+  return NULL;
+}
+
+
+/* Start fetching the same CRL from all URLS.  On success a new race
+ * object is stored at R_RACE; the readers are then taken using
+ * crl_race_next and the object is released using crl_race_end.  */
+gpg_error_t
+crl_race_start (ctrl_t ctrl, strlist_t urls, crl_race_t *r_race)
+{
+  gpg_error_t err;
+  struct crl_race_s *race;
+  struct crl_race_item_s *item;
+  npth_attr_t tattr;
+  strlist_t sl;
+  int res;
+
+  *r_race = NULL;
+
+  race = xtrycalloc (1, sizeof *race);
+  if (!race)
+    return gpg_error_from_syserror ();
+  res = npth_cond_init (&race->cond, NULL);
+  if (res)
+    {
+      err = gpg_error_from_errno (res);
+      xfree (race);
+      return err;
+    }
+  race->refcount = 1;
+  race->last_err = gpg_error (GPG_ERR_NOT_FOUND);
+
+  /* With only one URL there is no need for a thread.  */
+  if (urls && !urls->next)
+    {
+      item = xtrycalloc (1, sizeof *item + strlen (urls->d));
+      if (!item)
+        {
+          err = gpg_error_from_syserror ();
+          unref_crl_race (race);
+          return err;
+        }
+      strcpy (item->url, urls->d);
+      item->race = race;
+      item->ctrl = ctrl;
+      race->refcount++;
+      race->pending++;
+      crl_race_fetch (item);
+      *r_race = race;
+      return 0;
+    }
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  for (sl = urls; sl; sl = sl->next)
+    {
+      npth_t thread;
+
+      item = xtrycalloc (1, sizeof *item + strlen (sl->d));
+      if (!item)
+        {
+          race->last_err = gpg_error_from_syserror ();
+          break;
+        }
+      strcpy (item->url, sl->d);
+      item->race = race;
+      item->ctrl = &item->ctrlbuf;
+      dirmngr_init_default_ctrl (item->ctrl);
+      item->ctrl->timeout = ctrl->timeout;
+      xfree (item->ctrl->http_proxy);
+      item->ctrl->http_proxy = (ctrl->http_proxy
+                                ? xtrystrdup (ctrl->http_proxy) : NULL);
+
+      lock_crl_race ();
+      race->refcount++;
+      race->pending++;
+      unlock_crl_race ();
+      res = npth_create (&thread, &tattr, crl_race_fetch, item);
+      if (res)
+        {
+          log_error ("error spawning CRL fetch: %s\n", strerror (res));
+          lock_crl_race ();
+          race->refcount--;
+          race->pending--;
+          race->last_err = gpg_error_from_errno (res);
+          unlock_crl_race ();
+          release_crl_race_item (item);
+          continue;
+        }
+      npth_setname_np (thread, "crl-fetch");
+    }
+  npth_attr_destroy (&tattr);
+
+  *r_race = race;
+  return 0;
+}
+
+
+/* Wait for the next successful fetch of RACE and store its reader at
+ * R_READER and its URL at R_URL.  Both are valid until the next call
+ * or until crl_race_end.  Returns the error of the last failed fetch
+ * or GPG_ERR_EOF if no more readers are available.  */
+gpg_error_t
+crl_race_next (crl_race_t race, ksba_reader_t *r_reader, const char **r_url)
+{
+  gpg_error_t err = 0;
+  int res;
+
+  *r_reader = NULL;
+  *r_url = NULL;
+
+  release_crl_race_item (race->current);
+  race->current = NULL;
+
+  lock_crl_race ();
+  while (!race->ready && race->pending)
+    {
+      res = npth_cond_wait (&race->cond, &crl_race_lock);
+      if (res)
+        {
+          err = gpg_error_from_errno (res);
+          break;
+        }
+    }
+  if (!err)
+    {
+      if (race->ready)
+        {
+          race->current = race->ready;
+          race->ready = race->current->next;
+          race->current->next = NULL;
+        }
+      else
+        {
+          err = race->last_err;
+          race->last_err = gpg_error (GPG_ERR_EOF);
+        }
+    }
+  unlock_crl_race ();
+
+  if (race->current)
+    {
+      *r_reader = race->current->reader;
+      *r_url = race->current->url;
+    }
+  return err;
+}
+
+
+/* Release RACE.  Fetches which are still running are abandoned.  */
+void
+crl_race_end (crl_race_t race)
+{
+  struct crl_race_item_s *ready;
+
+  if (!race)
+    return;
+
+  release_crl_race_item (race->current);
+  race->current = NULL;
+
+  lock_crl_race ();
+  race->done = 1;
+  ready = race->ready;
+  race->ready = NULL;
+  unlock_crl_race ();
+
+  while (ready)
+    {
+      struct crl_race_item_s *tmp = ready->next;
+      release_crl_race_item (ready);
+      ready = tmp;
+    }
+
+  lock_crl_race ();
+  unref_crl_race (race);
+  unlock_crl_race ();
+}
+
+
 /* Fetch CRL for ISSUER using a default server. Return the entire CRL
    as a newly opened stream returned in R_FP. */
 gpg_error_t
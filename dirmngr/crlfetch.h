@@ -26,10 +26,19 @@
 struct cert_fetch_context_s;
 typedef struct cert_fetch_context_s *cert_fetch_context_t;
 
+struct crl_race_s;
+typedef struct crl_race_s *crl_race_t;
+
 
 /* Fetch CRL from URL. */
 gpg_error_t crl_fetch (ctrl_t ctrl, const char* url, ksba_reader_t *reader);
 
+/* Fetch the same CRL from several URLs at once.  */
+gpg_error_t crl_race_start (ctrl_t ctrl, strlist_t urls, crl_race_t *r_race);
+gpg_error_t crl_race_next (crl_race_t race, ksba_reader_t *r_reader,
+                           const char **r_url);
+void crl_race_end (crl_race_t race);
+
 /* Fetch CRL for ISSUER using default server. */
 gpg_error_t crl_fetch_default (ctrl_t ctrl,
                                const char* issuer, ksba_reader_t *reader);
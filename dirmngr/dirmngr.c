@@ -75,6 +75,8 @@
 #include "../common/gc-opt-flags.h"
 #include "dns-stuff.h"
 #include "http-common.h"
+#include "http-cache.h"
+#include "ocsp.h"
 
 #ifndef ENAMETOOLONG
 # define ENAMETOOLONG EINVAL
@@ -132,6 +134,9 @@ enum cmd_and_opt_values {
   oOCSPMaxPeriod,
   oOCSPCurrentPeriod,
   oMaxReplies,
+  oMaxCachedCerts,
+  oMaxConnections,
+  oMaxQueuedConnections,
   oHkpCaCert,
   oFakedSystemTime,
   oForce,
@@ -210,6 +215,9 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_i (oListenBacklog, "listen-backlog", "@"),
   ARGPARSE_s_i (oMaxReplies, "max-replies",
                 N_("|N|do not return more than N items in one query")),
+  ARGPARSE_s_u (oMaxCachedCerts, "max-cached-certs", "@"),
+  ARGPARSE_s_u (oMaxConnections, "max-connections", "@"),
+  ARGPARSE_s_u (oMaxQueuedConnections, "max-queued-connections", "@"),
   ARGPARSE_s_u (oFakedSystemTime, "faked-system-time", "@"), /*(epoch time)*/
   ARGPARSE_s_n (oDisableCheckOwnSocket, "disable-check-own-socket", "@"),
   ARGPARSE_s_s (oIgnoreCertExtension,"ignore-cert-extension", "@"),
@@ -317,6 +325,9 @@ static struct debug_flags_s debug_flags [] =
   };
 
 #define DEFAULT_MAX_REPLIES 10
+#define DEFAULT_MAX_CACHED_CERTS 1000
+#define DEFAULT_MAX_CONNECTIONS 64
+#define DEFAULT_MAX_QUEUED_CONNECTIONS 256
 #define DEFAULT_LDAP_TIMEOUT 15  /* seconds */
 
 #define DEFAULT_CONNECT_TIMEOUT       (15*1000)  /* 15 seconds */
@@ -368,6 +379,32 @@ static enum
 /* Counter for the active connections.  */
 static int active_connections;
 
+/* The number of connection handler threads.  This is limited by
+ * --max-connections.  */
+static unsigned int connection_threads;
+
+/* Accepted connections waiting for a handler thread.  A handler
+ * thread takes the next connection from the head of this queue
+ * before it terminates.  The queue is limited by
+ * --max-queued-connections; if it is full no more connections are
+ * accepted and the clients wait in the listen backlog.  */
+struct conn_queue_item_s
+{
+  struct conn_queue_item_s *next;
+  gnupg_fd_t fd;
+};
+static struct conn_queue_item_s *conn_queue_head;
+static struct conn_queue_item_s *conn_queue_tail;
+static unsigned int conn_queue_len;
+
+/* Statistics about the connection queue.  */
+static struct
+{
+  unsigned int max_len;   /* Largest length of the queue.  */
+  unsigned long queued;   /* Number of queued connections.  */
+  unsigned long paused;   /* Number of times accepting was paused.  */
+} conn_queue_stats;
+
 /* This flag is set by any network access and used by the housekeeping
  * thread to run background network tasks.  */
 static int network_activity_seen;
@@ -648,6 +685,9 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
       opt.ocsp_max_period = 90 * 86400;       /* 90 days.  */
       opt.ocsp_current_period = 3 * 60 * 60;  /* 3 hours. */
       opt.max_replies = DEFAULT_MAX_REPLIES;
+      opt.max_cached_certs = DEFAULT_MAX_CACHED_CERTS;
+      opt.max_connections = DEFAULT_MAX_CONNECTIONS;
+      opt.max_queued_connections = DEFAULT_MAX_QUEUED_CONNECTIONS;
       while (opt.ocsp_signer)
         {
           fingerprint_list_t tmp = opt.ocsp_signer->next;
@@ -724,6 +764,19 @@ parse_rereadable_options (gpgrt_argparse_t *pargs, int reread)
     case oOCSPCurrentPeriod: opt.ocsp_current_period = pargs->r.ret_int; break;
 
     case oMaxReplies: opt.max_replies = pargs->r.ret_int; break;
+    case oMaxCachedCerts:
+      opt.max_cached_certs = pargs->r.ret_ulong;
+      if (opt.max_cached_certs < 20)
+        opt.max_cached_certs = 20;
+      break;
+    case oMaxConnections:
+      opt.max_connections = pargs->r.ret_ulong;
+      if (!opt.max_connections)
+        opt.max_connections = 1;
+      break;
+    case oMaxQueuedConnections:
+      opt.max_queued_connections = pargs->r.ret_ulong;
+      break;
 
     case oHkpCaCert:
       {
@@ -1207,6 +1260,7 @@ main (int argc, char **argv)
       cert_cache_init (hkp_cacert_filenames);
       crl_cache_init ();
       ks_hkp_init ();
+      domaininfo_load ();
       http_register_netactivity_cb (netactivity_action);
       handle_connections (3);
       shutdown_reaper ();
@@ -1429,6 +1483,7 @@ main (int argc, char **argv)
       cert_cache_init (hkp_cacert_filenames);
       crl_cache_init ();
       ks_hkp_init ();
+      domaininfo_load ();
       http_register_netactivity_cb (netactivity_action);
       handle_connections (fd);
       shutdown_reaper ();
@@ -1848,6 +1903,13 @@ dirmngr_sighup_action (void)
   crl_cache_init ();
   reload_dns_stuff (0);
   ks_hkp_reload ();
+#if USE_LDAP
+  ks_ldap_reload ();
+#endif
+  http_cache_flush ();
+  http_verified_cache_flush ();
+  http_conn_pool_flush ();
+  ocsp_cache_flush ();
 }
 
 
@@ -1937,11 +1999,15 @@ housekeeping_thread (void *arg)
 
   dns_stuff_housekeeping ();
   ks_hkp_housekeeping (curtime);
+#if USE_LDAP
+  ks_ldap_housekeeping (curtime);
+#endif
   if (network_activity_seen)
     {
       network_activity_seen = 0;
       if (opt.allow_version_check)
         dirmngr_load_swdb (&ctrlbuf, 0);
+      crl_cache_prefetch (&ctrlbuf, curtime);
       workqueue_run_global_tasks (&ctrlbuf, 1);
     }
   else
@@ -2041,26 +2107,23 @@ check_nonce (assuan_fd_t fd, assuan_sock_nonce_t *nonce)
 }
 
 
-/* Helper to call a connection's main function. */
-static void *
-start_connection_thread (void *arg)
+/* Run the command handler for the connection FD.  */
+static void
+serve_connection (gnupg_fd_t fd)
 {
   static unsigned int last_session_id;
   unsigned int session_id;
   union int_and_ptr_u argval;
-  gnupg_fd_t fd;
-
-  memset (&argval, 0, sizeof argval);
-  argval.aptr = arg;
-  fd = argval.afd;
 
   if (check_nonce (fd, &socket_nonce))
     {
       log_error ("handler nonce check FAILED\n");
-      return NULL;
+      return;
     }
 
 #ifndef HAVE_W32_SYSTEM
+  memset (&argval, 0, sizeof argval);
+  argval.afd = fd;
   npth_setspecific (my_tlskey_current_fd, argval.aptr);
 #endif
 
@@ -2083,11 +2146,89 @@ start_connection_thread (void *arg)
   argval.afd = ASSUAN_INVALID_FD;
   npth_setspecific (my_tlskey_current_fd, argval.aptr);
 #endif
+}
+
+
+/* Helper to call a connection's main function.  The thread then
+ * serves the queued connections until the queue is empty.  */
+static void *
+start_connection_thread (void *arg)
+{
+  union int_and_ptr_u argval;
+  struct conn_queue_item_s *item;
+  gnupg_fd_t fd;
 
+  memset (&argval, 0, sizeof argval);
+  argval.aptr = arg;
+  fd = argval.afd;
+
+  for (;;)
+    {
+      serve_connection (fd);
+
+      item = conn_queue_head;
+      if (!item)
+        break;
+      conn_queue_head = item->next;
+      if (!conn_queue_head)
+        conn_queue_tail = NULL;
+      conn_queue_len--;
+      fd = item->fd;
+      xfree (item);
+    }
+
+  connection_threads--;
   return NULL;
 }
 
 
+/* Append the connection FD to the queue of waiting connections.  */
+static void
+queue_connection (gnupg_fd_t fd)
+{
+  struct conn_queue_item_s *item;
+
+  item = xtrymalloc (sizeof *item);
+  if (!item)
+    {
+      log_error ("error queuing connection: %s\n",
+                 gpg_strerror (gpg_error_from_syserror ()));
+      assuan_sock_close (fd);
+      return;
+    }
+  item->next = NULL;
+  item->fd = fd;
+  if (conn_queue_tail)
+    conn_queue_tail->next = item;
+  else
+    conn_queue_head = item;
+  conn_queue_tail = item;
+  conn_queue_len++;
+  conn_queue_stats.queued++;
+  if (conn_queue_len > conn_queue_stats.max_len)
+    conn_queue_stats.max_len = conn_queue_len;
+  if (opt.verbose > 1)
+    log_info ("connection fd=%d queued (%u waiting)\n",
+              FD2INT (fd), conn_queue_len);
+}
+
+
+/* Return statistics about the connections for GETINFO.  */
+void
+dirmngr_get_connection_stats (unsigned int *r_threads,
+                              unsigned int *r_queued,
+                              unsigned int *r_max_queued,
+                              unsigned long *r_total_queued,
+                              unsigned long *r_paused)
+{
+  *r_threads = connection_threads;
+  *r_queued = conn_queue_len;
+  *r_max_queued = conn_queue_stats.max_len;
+  *r_total_queued = conn_queue_stats.queued;
+  *r_paused = conn_queue_stats.paused;
+}
+
+
 #ifdef HAVE_INOTIFY_INIT
 /* Read an inotify event and return true if it matches NAME.  */
 static int
@@ -2135,6 +2276,7 @@ handle_connections (assuan_fd_t listen_fd)
   struct timespec timeout;
   int saved_errno;
   int my_inotify_fd = -1;
+  int paused = 0;
 
   npth_attr_init (&tattr);
   npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
@@ -2194,7 +2336,7 @@ handle_connections (assuan_fd_t listen_fd)
       /* Shutdown test.  */
       if (shutdown_pending)
         {
-          if (!active_connections)
+          if (!active_connections && !connection_threads)
             break; /* ready */
 
           /* Do not accept new connections but keep on running the
@@ -2215,8 +2357,23 @@ handle_connections (assuan_fd_t listen_fd)
             }
 	}
 
-      /* Take a copy of the fdset.  */
+      /* Take a copy of the fdset.  If too many connections are
+       * waiting we stop accepting new ones.  */
       read_fdset = fdset;
+      if (!shutdown_pending
+          && conn_queue_len >= opt.max_queued_connections)
+        {
+          if (!paused)
+            {
+              paused = 1;
+              conn_queue_stats.paused++;
+              log_info ("too many waiting connections"
+                        " - not accepting new ones\n");
+            }
+          FD_CLR (FD2INT (listen_fd), &read_fdset);
+        }
+      else
+        paused = 0;
 
       npth_clock_gettime (&curtime);
       if (!(npth_timercmp (&curtime, &abstime, <)))
@@ -2230,6 +2387,12 @@ handle_connections (assuan_fd_t listen_fd)
                              : TIMERTICK_INTERVAL);
 	}
       npth_timersub (&abstime, &curtime, &timeout);
+      if (paused && timeout.tv_sec >= 1)
+        {
+          /* Check the queue again soon.  */
+          timeout.tv_sec = 1;
+          timeout.tv_nsec = 0;
+        }
 
 #ifndef HAVE_W32_SYSTEM
       ret = npth_pselect (nfd+1, &read_fdset, NULL, NULL, &timeout,
@@ -2284,6 +2447,8 @@ handle_connections (assuan_fd_t listen_fd)
 	    {
 	      log_error ("accept failed: %s\n", strerror (errno));
 	    }
+          else if (connection_threads >= opt.max_connections)
+            queue_connection (fd);
           else
             {
               char threadname[50];
@@ -2295,12 +2460,14 @@ handle_connections (assuan_fd_t listen_fd)
               snprintf (threadname, sizeof threadname,
                         "conn fd=%d", FD2INT(fd));
 
+              connection_threads++;
               ret = npth_create (&thread, &tattr,
                                  start_connection_thread, argval.aptr);
 	      if (ret)
                 {
                   log_error ("error spawning connection handler: %s\n",
                              strerror (ret) );
+                  connection_threads--;
                   assuan_sock_close (fd);
                 }
 	      npth_setname_np (thread, threadname);
@@ -2315,6 +2482,7 @@ handle_connections (assuan_fd_t listen_fd)
   npth_attr_destroy (&tattr);
   if (listen_fd != GNUPG_INVALID_FD)
     assuan_sock_close (listen_fd);
+  domaininfo_save ();
   cleanup ();
   log_info ("%s %s stopped\n", gpgrt_strusage(11), gpgrt_strusage(13));
 }
@@ -125,6 +125,9 @@ struct
   int allow_ocsp;     /* Allow using OCSP. */
 
   int max_replies;
+  unsigned int max_cached_certs; /* Limit of non-permanent cached certs. */
+  unsigned int max_connections;  /* Limit of connection handler threads. */
+  unsigned int max_queued_connections; /* Limit of waiting connections.  */
   unsigned int ldaptimeout;
 
   ldap_server_t ldapservers;
@@ -215,12 +218,19 @@ void dirmngr_init_default_ctrl (ctrl_t ctrl);
 void dirmngr_deinit_default_ctrl (ctrl_t ctrl);
 void dirmngr_sighup_action (void);
 const char* dirmngr_get_current_socket_name (void);
+void dirmngr_get_connection_stats (unsigned int *r_threads,
+                                   unsigned int *r_queued,
+                                   unsigned int *r_max_queued,
+                                   unsigned long *r_total_queued,
+                                   unsigned long *r_paused);
 int dirmngr_use_tor (void);
 
 /*-- Various housekeeping functions.  --*/
 void ks_hkp_housekeeping (time_t curtime);
 void ks_hkp_reload (void);
 void ks_hkp_init (void);
+void ks_ldap_housekeeping (time_t curtime);
+void ks_ldap_reload (void);
 
 /*-- server.c --*/
 ldap_server_t get_ldapservers_from_ctrl (ctrl_t ctrl);
@@ -255,6 +265,10 @@ void domaininfo_set_no_name (const char *domain);
 void domaininfo_set_wkd_supported (const char *domain);
 void domaininfo_set_wkd_not_supported (const char *domain);
 void domaininfo_set_wkd_not_found (const char *domain);
+int  domaininfo_is_mbox_not_found (const char *local, const char *domain);
+void domaininfo_set_mbox_not_found (const char *local, const char *domain);
+void domaininfo_save (void);
+void domaininfo_load (void);
 
 /*-- workqueue.c --*/
 typedef const char *(*wqtask_t)(ctrl_t ctrl, const char *args);
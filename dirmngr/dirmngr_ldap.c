@@ -72,6 +72,13 @@ static void npth_protect (void) { }
 
 #define DEFAULT_LDAP_TIMEOUT 15 /* Arbitrary long timeout. */
 
+#if defined(HAVE_LDAP_CREATE_PAGE_CONTROL) \
+    && defined(HAVE_LDAP_PARSE_PAGERESPONSE_CONTROL)
+# define USE_LDAP_PAGING 1
+/* The number of search results we ask for at once.  */
+# define LDAP_PAGE_SIZE 100
+#endif
+
 
 /* Constants for the options.  */
 enum
@@ -382,9 +389,11 @@ set_timeout (my_opt_t myopt)
 }
 
 
-/* Helper for fetch_ldap().  */
+/* Helper for fetch_ldap().  Sets R_ANY if something has been
+   printed.  Returns -1 on a write error.  */
 static int
-print_ldap_entries (my_opt_t myopt, LDAP *ld, LDAPMessage *msg, char *want_attr)
+print_ldap_entries (my_opt_t myopt, LDAP *ld, LDAPMessage *msg,
+                    char *want_attr, int *r_any)
 {
   LDAPMessage *item;
   int any = 0;
@@ -546,7 +555,9 @@ print_ldap_entries (my_opt_t myopt, LDAP *ld, LDAPMessage *msg, char *want_attr)
   if (myopt->verbose > 1 && any)
     log_info ("result has been printed\n");
 
-  return any?0:-1;
+  if (any)
+    *r_any = 1;
+  return 0;
 }
 
 
@@ -562,6 +573,13 @@ fetch_ldap (my_opt_t myopt, const char *url, const LDAPURLDesc *ludp)
   int port;
   int ret;
   int usetls;
+  int any = 0;
+#ifdef USE_LDAP_PAGING
+  struct berval cookie = { 0, NULL };
+  LDAPControl *pagectrl, *serverctrls[2], **resctrls, *ctrl;
+  ber_int_t estimate;
+  int errcode;
+#endif
 
   host     = myopt->host?   myopt->host   : ludp->lud_host;
   port     = myopt->port?   myopt->port   : ludp->lud_port;
@@ -707,37 +725,108 @@ fetch_ldap (my_opt_t myopt, const char *url, const LDAPURLDesc *ludp)
       return -1;
     }
 
-  set_timeout (myopt);
-  npth_unprotect ();
-  rc = ldap_search_st (ld, dn, ludp->lud_scope, filter,
-                       myopt->multi && !myopt->attr && ludp->lud_attrs?
-                       ludp->lud_attrs:attrs,
-                       0,
-                       &myopt->timeout, &msg);
-  npth_protect ();
-  if (rc == LDAP_SIZELIMIT_EXCEEDED && myopt->multi)
+  /* With paged results (RFC-2696) each page is printed before the
+   * next one is requested so that the caller gets the first results
+   * early and we don't need to keep all results in memory.  The
+   * control is not critical; thus a server without paging support
+   * returns all results at once.  */
+  do
     {
-      if (es_fwrite ("E\0\0\0\x09truncated", 14, 1, myopt->outstream) != 1)
+      msg = NULL;
+      set_timeout (myopt);
+#ifdef USE_LDAP_PAGING
+      rc = ldap_create_page_control (ld, LDAP_PAGE_SIZE, &cookie, 0,
+                                     &pagectrl);
+      if (rc)
         {
-          log_error (_("error writing to stdout: %s\n"), strerror (errno));
-          return -1;
+          log_error ("creating the paging control failed: %s\n",
+                     ldap_err2string (rc));
+          rc = -1;
+          break;
         }
-    }
-  else if (rc)
-    {
-      log_error (_("searching '%s' failed: %s\n"),
-                 url, ldap_err2string (rc));
-      if (rc != LDAP_NO_SUCH_OBJECT)
+      serverctrls[0] = pagectrl;
+      serverctrls[1] = NULL;
+      npth_unprotect ();
+      rc = ldap_search_ext_s (ld, dn, ludp->lud_scope, filter,
+                              myopt->multi && !myopt->attr && ludp->lud_attrs?
+                              ludp->lud_attrs:attrs,
+                              0, serverctrls, NULL,
+                              &myopt->timeout, LDAP_NO_LIMIT, &msg);
+      npth_protect ();
+      ldap_control_free (pagectrl);
+      ber_memfree (cookie.bv_val);
+      cookie.bv_val = NULL;
+      cookie.bv_len = 0;
+#else
+      npth_unprotect ();
+      rc = ldap_search_st (ld, dn, ludp->lud_scope, filter,
+                           myopt->multi && !myopt->attr && ludp->lud_attrs?
+                           ludp->lud_attrs:attrs,
+                           0,
+                           &myopt->timeout, &msg);
+      npth_protect ();
+#endif
+      if (rc == LDAP_SIZELIMIT_EXCEEDED && myopt->multi)
         {
-          /* FIXME: Need deinit (ld)?  */
-          /* Hmmm: Do we need to released MSG in case of an error? */
-          return -1;
+          if (es_fwrite ("E\0\0\0\x09truncated", 14, 1,
+                         myopt->outstream) != 1)
+            {
+              log_error (_("error writing to stdout: %s\n"),
+                         strerror (errno));
+              ldap_msgfree (msg);
+              rc = -1;
+              break;
+            }
+        }
+      else if (rc)
+        {
+          log_error (_("searching '%s' failed: %s\n"),
+                     url, ldap_err2string (rc));
+          if (rc != LDAP_NO_SUCH_OBJECT)
+            {
+              /* FIXME: Need deinit (ld)?  */
+              ldap_msgfree (msg);
+              rc = -1;
+              break;
+            }
+        }
+
+      if (print_ldap_entries (myopt, ld, msg, myopt->multi? NULL:attr, &any))
+        {
+          ldap_msgfree (msg);
+          rc = -1;
+          break;
         }
+
+#ifdef USE_LDAP_PAGING
+      /* Get the cookie for the next page.  */
+      resctrls = NULL;
+      if (!rc
+          && !ldap_parse_result (ld, msg, &errcode, NULL, NULL, NULL,
+                                 &resctrls, 0)
+          && resctrls
+          && (ctrl = ldap_control_find (LDAP_CONTROL_PAGEDRESULTS,
+                                        resctrls, NULL))
+          && ldap_parse_pageresponse_control (ld, ctrl, &estimate, &cookie))
+        {
+          cookie.bv_val = NULL;
+          cookie.bv_len = 0;
+        }
+      if (resctrls)
+        ldap_controls_free (resctrls);
+#endif
+      ldap_msgfree (msg);
     }
+#ifdef USE_LDAP_PAGING
+  while (!rc && cookie.bv_len);
+  ber_memfree (cookie.bv_val);
+#else
+  while (0);
+#endif
 
-  rc = print_ldap_entries (myopt, ld, msg, myopt->multi? NULL:attr);
+  if (rc != -1)
+    rc = any? 0 : -1;
 
-  ldap_msgfree (msg);
   ldap_unbind (ld);
   return rc;
 }
@@ -185,6 +185,8 @@ static int libdns_tor_port;
 void
 enable_standard_resolver (int yes)
 {
+  if (standard_resolver != yes)
+    flush_dns_cache ();
   standard_resolver = yes;
 }
 
@@ -235,7 +237,12 @@ enable_dns_tormode (int new_circuit)
       gpgrt_snprintf (tor_socks_password, sizeof tor_socks_password,
                       "p%u", counter);
       counter++;
+      /* Answers received over the old circuit shall not be used
+       * anymore.  */
+      flush_dns_cache ();
     }
+  if (!tor_mode)
+    flush_dns_cache ();
   tor_mode = 1;
 }
 
@@ -244,6 +251,8 @@ enable_dns_tormode (int new_circuit)
 void
 disable_dns_tormode (void)
 {
+  if (tor_mode)
+    flush_dns_cache ();
   tor_mode = 0;
 }
 
@@ -320,6 +329,267 @@ free_dns_addrinfo (dns_addrinfo_t ai)
 }
 
 
+/* The DNS answer cache.
+ *
+ * Keyservers and WKD servers are looked up again and again.  To avoid
+ * a round trip to the nameserver for each request we keep the answers
+ * of resolve_dns_name, get_dns_srv, and get_dns_cert for a short
+ * time.  Neither the system resolver nor the addrinfo interface of
+ * libdns tell us the TTL of the records and thus we use fixed
+ * lifetimes which are short enough to track changes in the DNS.
+ * Answers telling that the name or record does not exist are cached
+ * for a shorter time.  All other errors are not cached.  Because nPth
+ * threads are not preempted and the cache functions do not block, no
+ * lock is required.  */
+#define DNS_CACHE_TTL           300
+#define DNS_CACHE_NEGATIVE_TTL   60
+#define DNS_CACHE_MAX_ITEMS     256
+
+struct dns_cache_item_s;
+typedef struct dns_cache_item_s *dns_cache_item_t;
+struct dns_cache_item_s
+{
+  dns_cache_item_t next;
+  time_t expires;
+  gpg_error_t err;            /* The cached error or 0.  */
+  dns_addrinfo_t dai;         /* The answer of resolve_dns_name.  */
+  char *canonname;
+  struct srventry *srvs;      /* The answer of get_dns_srv.  */
+  unsigned int srvcount;
+  void *key;                  /* The answer of get_dns_cert.  */
+  size_t keylen;
+  unsigned char *fpr;
+  size_t fprlen;
+  char *url;
+  char query[1];              /* The lookup key.  */
+};
+
+/* The list of items with the most recently used first.  */
+static dns_cache_item_t dns_cache;
+static unsigned int dns_cache_count;
+
+static struct
+{
+  unsigned long hits;
+  unsigned long misses;
+} dns_cache_stats;
+
+
+static void
+release_dns_cache_item (dns_cache_item_t item)
+{
+  if (!item)
+    return;
+  free_dns_addrinfo (item->dai);
+  xfree (item->canonname);
+  xfree (item->srvs);
+  xfree (item->key);
+  xfree (item->fpr);
+  xfree (item->url);
+  xfree (item);
+}
+
+
+/* Remove the item at *ITEMP from the cache.  */
+static void
+dns_cache_unlink (dns_cache_item_t *itemp)
+{
+  dns_cache_item_t item = *itemp;
+
+  *itemp = item->next;
+  dns_cache_count--;
+  release_dns_cache_item (item);
+}
+
+
+/* Remove all items from the DNS cache.  */
+void
+flush_dns_cache (void)
+{
+  while (dns_cache)
+    dns_cache_unlink (&dns_cache);
+}
+
+
+/* Store statistics about the DNS cache at the provided addresses.  */
+void
+get_dns_cache_stats (unsigned int *r_items,
+                     unsigned long *r_hits, unsigned long *r_misses)
+{
+  *r_items = dns_cache_count;
+  *r_hits = dns_cache_stats.hits;
+  *r_misses = dns_cache_stats.misses;
+}
+
+
+/* Remove all expired items from the DNS cache.  */
+static void
+dns_cache_purge (void)
+{
+  dns_cache_item_t *itemp;
+  time_t now = gnupg_get_time ();
+
+  for (itemp = &dns_cache; *itemp; )
+    if ((*itemp)->expires <= now)
+      dns_cache_unlink (itemp);
+    else
+      itemp = &(*itemp)->next;
+}
+
+
+/* Return a malloced lookup key for a query of type KIND for NAME and
+ * the query parameters A to C.  Returns NULL if out of core in which
+ * case the cache is not used.  */
+static char *
+make_cache_query (int kind, const char *name, int a, int b, int c)
+{
+  char *query;
+
+  query = xtryasprintf ("%c:%d:%d:%d:%s", kind, a, b, c, name);
+  if (query)
+    ascii_strlwr (query);
+  return query;
+}
+
+
+/* Return the cached item for QUERY or NULL if there is no usable
+ * item.  The returned item is owned by the cache.  */
+static dns_cache_item_t
+dns_cache_lookup (const char *query)
+{
+  dns_cache_item_t item, *itemp;
+
+  if (!query)
+    return NULL;
+
+  for (itemp = &dns_cache; (item = *itemp); itemp = &item->next)
+    if (!strcmp (item->query, query))
+      break;
+  if (item && item->expires <= gnupg_get_time ())
+    {
+      dns_cache_unlink (itemp);
+      item = NULL;
+    }
+  if (!item)
+    {
+      dns_cache_stats.misses++;
+      return NULL;
+    }
+
+  /* Move to the head.  */
+  *itemp = item->next;
+  item->next = dns_cache;
+  dns_cache = item;
+
+  dns_cache_stats.hits++;
+  if (opt_debug)
+    log_debug ("dns: using cached answer for '%s'\n", query);
+  return item;
+}
+
+
+/* Return a new cache item for QUERY with the result ERR or NULL if
+ * the result shall not be cached.  */
+static dns_cache_item_t
+dns_cache_new_item (const char *query, gpg_error_t err)
+{
+  dns_cache_item_t item;
+  int ttl;
+
+  if (!query)
+    return NULL;
+  switch (gpg_err_code (err))
+    {
+    case 0:
+      ttl = DNS_CACHE_TTL;
+      break;
+    case GPG_ERR_NO_NAME:
+    case GPG_ERR_NO_DATA:
+    case GPG_ERR_NOT_FOUND:
+      ttl = DNS_CACHE_NEGATIVE_TTL;
+      break;
+    default:
+      return NULL;
+    }
+
+  item = xtrycalloc (1, sizeof *item + strlen (query));
+  if (!item)
+    return NULL;
+  strcpy (item->query, query);
+  item->err = err;
+  item->expires = gnupg_get_time () + ttl;
+  return item;
+}
+
+
+/* Insert ITEM into the cache replacing an item with the same query.  */
+static void
+dns_cache_insert (dns_cache_item_t item)
+{
+  dns_cache_item_t *itemp;
+
+  for (itemp = &dns_cache; *itemp; itemp = &(*itemp)->next)
+    if (!strcmp ((*itemp)->query, item->query))
+      {
+        dns_cache_unlink (itemp);
+        break;
+      }
+  if (dns_cache_count >= DNS_CACHE_MAX_ITEMS)
+    {
+      for (itemp = &dns_cache; (*itemp)->next; itemp = &(*itemp)->next)
+        ;
+      dns_cache_unlink (itemp);
+    }
+
+  item->next = dns_cache;
+  dns_cache = item;
+  dns_cache_count++;
+}
+
+
+/* Store a copy of the list DAI at R_DAI.  */
+static gpg_error_t
+copy_dns_addrinfo (dns_addrinfo_t dai, dns_addrinfo_t *r_dai)
+{
+  dns_addrinfo_t *tailp = r_dai;
+
+  *r_dai = NULL;
+  for (; dai; dai = dai->next)
+    {
+      *tailp = xtrymalloc (sizeof *dai);
+      if (!*tailp)
+        {
+          gpg_error_t err = gpg_error_from_syserror ();
+          free_dns_addrinfo (*r_dai);
+          *r_dai = NULL;
+          return err;
+        }
+      memcpy (*tailp, dai, sizeof *dai);
+      (*tailp)->next = NULL;
+      tailp = &(*tailp)->next;
+    }
+  return 0;
+}
+
+
+/* Store a malloced copy of the LEN bytes at BUFFER at R_COPY.  */
+static gpg_error_t
+copy_buffer (const void *buffer, size_t len, void *r_copy)
+{
+  void *p;
+
+  *(void **)r_copy = NULL;
+  if (!buffer)
+    return 0;
+  p = xtrymalloc (len? len : 1);
+  if (!p)
+    return gpg_error_from_syserror ();
+  memcpy (p, buffer, len);
+  *(void **)r_copy = p;
+  return 0;
+}
+
+
 #ifndef HAVE_W32_SYSTEM
 /* Return H_ERRNO mapped to a gpg-error code.  Will never return 0. */
 static gpg_error_t
@@ -696,8 +966,10 @@ reload_dns_stuff (int force)
   (void)force;
 #endif
 
-  /* We also flush the IPv4/v6 support flag cache.  */
+  /* We also flush the IPv4/v6 support flag cache and the DNS
+   * cache.  */
   cached_inet_support.valid = 0;
+  flush_dns_cache ();
 }
 
 
@@ -710,6 +982,8 @@ dns_stuff_housekeeping (void)
    * later than 10 minutes after it changed.  This way the user does
    * not need a reload.  */
   cached_inet_support.valid = 0;
+
+  dns_cache_purge ();
 }
 
 
@@ -1099,6 +1373,32 @@ resolve_dns_name (ctrl_t ctrl, const char *name, unsigned short port,
                   dns_addrinfo_t *r_ai, char **r_canonname)
 {
   gpg_error_t err;
+  char *query = NULL;
+  dns_cache_item_t item;
+
+  *r_ai = NULL;
+  if (r_canonname)
+    *r_canonname = NULL;
+
+  /* There is no need to cache numerical addresses.  */
+  if (!is_ip_address (name))
+    query = make_cache_query ('a', name, port,
+                              want_family * 2 + !!r_canonname,
+                              want_socktype);
+  if ((item = dns_cache_lookup (query)))
+    {
+      err = item->err;
+      if (!err)
+        err = copy_dns_addrinfo (item->dai, r_ai);
+      if (!err && r_canonname && item->canonname
+          && !(*r_canonname = xtrystrdup (item->canonname)))
+        {
+          err = gpg_error_from_syserror ();
+          free_dns_addrinfo (*r_ai);
+          *r_ai = NULL;
+        }
+      goto leave;
+    }
 
 #ifdef USE_LIBDNS
   if (!standard_resolver)
@@ -1113,12 +1413,135 @@ resolve_dns_name (ctrl_t ctrl, const char *name, unsigned short port,
 #endif /*USE_LIBDNS*/
     err = resolve_name_standard (ctrl, name, port, want_family, want_socktype,
                                  r_ai, r_canonname);
+
+  if ((item = dns_cache_new_item (query, err)))
+    {
+      if (!err
+          && (copy_dns_addrinfo (*r_ai, &item->dai)
+              || (r_canonname && *r_canonname
+                  && !(item->canonname = xtrystrdup (*r_canonname)))))
+        release_dns_cache_item (item);
+      else
+        dns_cache_insert (item);
+    }
+
+ leave:
   if (opt_debug)
     log_debug ("dns: resolve_dns_name(%s): %s\n", name, gpg_strerror (err));
+  xfree (query);
   return err;
 }
 
 
+/* The maximum number of threads used by resolve_dns_names.  */
+#define MAX_RESOLVE_THREADS 16
+
+/* The state shared by the threads of resolve_dns_names.  */
+struct resolve_names_s
+{
+  ctrl_t ctrl;
+  const char **names;
+  int nnames;
+  int next;               /* Index of the next name to resolve.  */
+  unsigned short port;
+  int want_family;
+  int want_socktype;
+  dns_addrinfo_t *dais;
+  gpg_error_t *errs;
+};
+
+
+/* Resolve names from the list ARG until all have been resolved.  This
+ * is also used as the thread function.  */
+static void *
+resolve_names_worker (void *arg)
+{
+  struct resolve_names_s *parm = arg;
+  int idx;
+
+  /* NPth switches threads only while waiting for the network; thus
+   * taking the next index does not need a lock.  */
+  while (parm->next < parm->nnames)
+    {
+      idx = parm->next++;
+      parm->errs[idx] = resolve_dns_name (parm->ctrl, parm->names[idx],
+                                          parm->port, parm->want_family,
+                                          parm->want_socktype,
+                                          &parm->dais[idx], NULL);
+    }
+  return NULL;
+}
+
+
+/* Resolve the NNAMES host names in NAMES concurrently.  The results
+ * are stored in the arrays R_DAIS and R_ERRS which must have room for
+ * NNAMES items; the other args are as with resolve_dns_name.  The
+ * caller must release each item of R_DAIS.  This lets the queries
+ * for, say, all targets of an SRV record wait for the network at the
+ * same time.  */
+void
+resolve_dns_names (ctrl_t ctrl, const char **names, int nnames,
+                   unsigned short port, int want_family, int want_socktype,
+                   dns_addrinfo_t *r_dais, gpg_error_t *r_errs)
+{
+  struct resolve_names_s parm;
+  int i;
+#ifdef USE_NPTH
+  npth_attr_t tattr;
+  npth_t threads[MAX_RESOLVE_THREADS];
+  int nthreads = 0;
+  int res;
+#endif
+
+  for (i=0; i < nnames; i++)
+    {
+      r_dais[i] = NULL;
+      r_errs[i] = gpg_error (GPG_ERR_NOT_FOUND);
+    }
+
+  parm.ctrl = ctrl;
+  parm.names = names;
+  parm.nnames = nnames;
+  parm.next = 0;
+  parm.port = port;
+  parm.want_family = want_family;
+  parm.want_socktype = want_socktype;
+  parm.dais = r_dais;
+  parm.errs = r_errs;
+
+#ifdef USE_NPTH
+  /* With only one name there is no need for a thread.  */
+  if (nnames > 1)
+    {
+      npth_attr_init (&tattr);
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+      for (; nthreads < nnames && nthreads < MAX_RESOLVE_THREADS; nthreads++)
+        {
+          res = npth_create (&threads[nthreads], &tattr,
+                             resolve_names_worker, &parm);
+          if (res)
+            {
+              log_error ("error spawning resolver thread: %s\n",
+                         strerror (res));
+              break;
+            }
+          npth_setname_np (threads[nthreads], "dns-resolve");
+        }
+      npth_attr_destroy (&tattr);
+    }
+#endif /*USE_NPTH*/
+
+  /* Take part in the work; this also covers the case that no thread
+   * could be started.  */
+  resolve_names_worker (&parm);
+
+#ifdef USE_NPTH
+  for (i=0; i < nthreads; i++)
+    npth_join (threads[i], NULL);
+#endif
+}
+
+
 #ifdef USE_LIBDNS
 /* Resolve an address using libdns.  */
 static gpg_error_t
@@ -1820,6 +2243,8 @@ get_dns_cert (ctrl_t ctrl, const char *name, int want_certtype,
               unsigned char **r_fpr, size_t *r_fprlen, char **r_url)
 {
   gpg_error_t err;
+  char *query;
+  dns_cache_item_t item;
 
   if (r_key)
     *r_key = NULL;
@@ -1829,6 +2254,37 @@ get_dns_cert (ctrl_t ctrl, const char *name, int want_certtype,
   *r_fprlen = 0;
   *r_url = NULL;
 
+  query = make_cache_query ('c', name, want_certtype, !!r_key, 0);
+  if ((item = dns_cache_lookup (query)))
+    {
+      err = item->err;
+      if (!err && r_key)
+        {
+          err = copy_buffer (item->key, item->keylen, r_key);
+          if (!err && r_keylen)
+            *r_keylen = item->keylen;
+        }
+      if (!err)
+        {
+          err = copy_buffer (item->fpr, item->fprlen, r_fpr);
+          if (!err)
+            *r_fprlen = item->fprlen;
+        }
+      if (!err && item->url && !(*r_url = xtrystrdup (item->url)))
+        err = gpg_error_from_syserror ();
+      if (err)
+        {
+          if (r_key)
+            {
+              xfree (*r_key);
+              *r_key = NULL;
+            }
+          xfree (*r_fpr);
+          *r_fpr = NULL;
+        }
+      goto leave;
+    }
+
 #ifdef USE_LIBDNS
   if (!standard_resolver)
     {
@@ -1843,8 +2299,27 @@ get_dns_cert (ctrl_t ctrl, const char *name, int want_certtype,
     err = get_dns_cert_standard (name, want_certtype, r_key, r_keylen,
                                  r_fpr, r_fprlen, r_url);
 
+  if ((item = dns_cache_new_item (query, err)))
+    {
+      if (!err
+          && ((r_key && copy_buffer (*r_key, r_keylen? *r_keylen : 0,
+                                     &item->key))
+              || copy_buffer (*r_fpr, *r_fprlen, &item->fpr)
+              || (*r_url && !(item->url = xtrystrdup (*r_url)))))
+        release_dns_cache_item (item);
+      else
+        {
+          if (r_key && r_keylen)
+            item->keylen = *r_keylen;
+          item->fprlen = *r_fprlen;
+          dns_cache_insert (item);
+        }
+    }
+
+ leave:
   if (opt_debug)
     log_debug ("dns: get_dns_cert(%s): %s\n", name, gpg_strerror (err));
+  xfree (query);
   return err;
 }
 
@@ -2104,6 +2579,8 @@ get_dns_srv (ctrl_t ctrl,
 {
   gpg_error_t err;
   char *namebuffer = NULL;
+  char *query;
+  dns_cache_item_t item;
   unsigned int srvcount;
   int i;
 
@@ -2124,17 +2601,46 @@ get_dns_srv (ctrl_t ctrl,
       name = namebuffer;
     }
 
-
-#ifdef USE_LIBDNS
-  if (!standard_resolver)
+  query = make_cache_query ('s', name, 0, 0, 0);
+  if ((item = dns_cache_lookup (query)))
     {
-      err = getsrv_libdns (ctrl, name, list, &srvcount);
-      if (err && libdns_switch_port_p (err))
-        err = getsrv_libdns (ctrl, name, list, &srvcount);
+      err = item->err;
+      if (!err)
+        {
+          err = copy_buffer (item->srvs,
+                             item->srvcount * sizeof (struct srventry), list);
+          if (!err)
+            srvcount = item->srvcount;
+        }
     }
   else
+    {
+#ifdef USE_LIBDNS
+      if (!standard_resolver)
+        {
+          err = getsrv_libdns (ctrl, name, list, &srvcount);
+          if (err && libdns_switch_port_p (err))
+            err = getsrv_libdns (ctrl, name, list, &srvcount);
+        }
+      else
 #endif /*USE_LIBDNS*/
-    err = getsrv_standard (name, list, &srvcount);
+        err = getsrv_standard (name, list, &srvcount);
+
+      /* Cache the records before they are shuffled below.  */
+      if ((item = dns_cache_new_item (query, err)))
+        {
+          if (!err && copy_buffer (*list,
+                                   srvcount * sizeof (struct srventry),
+                                   &item->srvs))
+            release_dns_cache_item (item);
+          else
+            {
+              item->srvcount = err? 0 : srvcount;
+              dns_cache_insert (item);
+            }
+        }
+    }
+  xfree (query);
 
   if (err)
     {
@@ -137,6 +137,13 @@ void reload_dns_stuff (int force);
 /* Housekeeping for this module.  */
 void dns_stuff_housekeeping (void);
 
+/* Remove all answers from the DNS cache.  */
+void flush_dns_cache (void);
+
+/* Return statistics about the DNS cache.  */
+void get_dns_cache_stats (unsigned int *r_items,
+                          unsigned long *r_hits, unsigned long *r_misses);
+
 void free_dns_addrinfo (dns_addrinfo_t ai);
 
 /* Function similar to getaddrinfo.  */
@@ -145,6 +152,12 @@ gpg_error_t resolve_dns_name (ctrl_t ctrl,
                               int want_family, int want_socktype,
                               dns_addrinfo_t *r_dai, char **r_canonname);
 
+/* Resolve several names concurrently.  */
+void resolve_dns_names (ctrl_t ctrl, const char **names, int nnames,
+                        unsigned short port,
+                        int want_family, int want_socktype,
+                        dns_addrinfo_t *r_dais, gpg_error_t *r_errs);
+
 /* Function similar to getnameinfo.  */
 gpg_error_t resolve_dns_addr (ctrl_t ctrl,
                               const struct sockaddr_storage *addr, int addrlen,
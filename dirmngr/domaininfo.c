@@ -24,6 +24,9 @@
 #include <string.h>
 
 #include "dirmngr.h"
+#include "../common/host2net.h"
+#include "../common/sysutils.h"
+#include "../common/mbox-util.h"
 
 
 /* Number of bucket for the hash array and limit for the length of a
@@ -38,6 +41,19 @@
 #define NO_OF_DOMAINBUCKETS  103
 #define MAX_DOMAINBUCKET_LEN  20
 
+/* The same for the mailbox addresses for which no key was found.  */
+#define NO_OF_MBOXBUCKETS  103
+#define MAX_MBOXBUCKET_LEN  20
+
+/* The number of seconds we remember that no key was found for a
+ * mailbox address.  */
+#define MBOX_NOT_FOUND_TTL  3600
+
+/* The name of the file with the snapshot of the domain information
+ * and the maximum age of a domain item taken from it.  */
+#define SNAPSHOT_FILENAME  "domaininfo.txt"
+#define SNAPSHOT_MAX_AGE   (86400*7)
+
 
 /* Object to keep track of a domain name.  */
 struct domaininfo_s
@@ -48,6 +64,7 @@ struct domaininfo_s
   unsigned int wkd_supported:1;      /* One WKD entry was found.          */
   unsigned int wkd_not_supported:1;  /* Definitely does not support WKD.  */
   unsigned int keepmark:1;           /* Private to insert_or_update().    */
+  time_t updated;                    /* Time of the last update.          */
   char name[1];
 };
 typedef struct domaininfo_s *domaininfo_t;
@@ -56,6 +73,21 @@ typedef struct domaininfo_s *domaininfo_t;
 static domaininfo_t domainbuckets[NO_OF_DOMAINBUCKETS];
 
 
+/* Object to keep track of a mailbox address for which a WKD query
+ * did not return a key.  To avoid storing the addresses we only keep
+ * the SHA-1 hash of the addrspec.  */
+struct mboxinfo_s
+{
+  struct mboxinfo_s *next;
+  time_t expires;                    /* Remove the item after this time.  */
+  unsigned char digest[20];
+};
+typedef struct mboxinfo_s *mboxinfo_t;
+
+/* And the hashed array.  */
+static mboxinfo_t mboxbuckets[NO_OF_MBOXBUCKETS];
+
+
 /* The hash function we use.  Must not call a system function.  */
 static inline u32
 hash_domain (const char *domain)
@@ -117,6 +149,16 @@ domaininfo_print_stats (void)
             minlen > 0? minlen : 0,
             maxlen,
             no_name, wkd_not_found, wkd_not_supported, wkd_supported);
+
+  count = 0;
+  for (bidx = 0; bidx < NO_OF_MBOXBUCKETS; bidx++)
+    {
+      mboxinfo_t mi;
+
+      for (mi = mboxbuckets[bidx]; mi; mi = mi->next)
+        count++;
+    }
+  log_info ("domaininfo: mbox_not_found=%d\n", count);
 }
 
 
@@ -150,12 +192,14 @@ insert_or_update (const char *domain,
   int ndropped = 0;
   u32 hash;
   int count;
+  time_t now = gnupg_get_time ();
 
   hash = hash_domain (domain);
   for (di = domainbuckets[hash]; di; di = di->next)
     if (!strcmp (di->name, domain))
       {
         callback (di, 0);  /* Update */
+        di->updated = now;
         return;
       }
 
@@ -170,6 +214,7 @@ insert_or_update (const char *domain,
     if (!strcmp (di->name, domain))
       {
         callback (di, 0);  /* Update */
+        di->updated = now;
         xfree (di_new);
         return;
       }
@@ -263,6 +308,7 @@ insert_or_update (const char *domain,
   /* Insert */
   callback (di_new, 1);
   di = di_new;
+  di->updated = now;
   di->next = domainbuckets[hash];
   domainbuckets[hash] = di;
 
@@ -376,3 +422,275 @@ domaininfo_set_wkd_not_found (const char *domain)
 {
   insert_or_update (domain, set_wkd_not_found_cb);
 }
+
+
+
+/* Compute the SHA-1 hash of the addrspec LOCAL@DOMAIN and store it
+ * at DIGEST.  */
+static void
+mbox_digest (const char *local, const char *domain, unsigned char *digest)
+{
+  gcry_buffer_t iov[3];
+
+  memset (iov, 0, sizeof iov);
+  iov[0].data = (void*)local;
+  iov[0].len = strlen (local);
+  iov[1].data = (void*)"@";
+  iov[1].len = 1;
+  iov[2].data = (void*)domain;
+  iov[2].len = strlen (domain);
+  gcry_md_hash_buffers (GCRY_MD_SHA1, 0, digest, iov, 3);
+}
+
+
+/* Return true if a WKD query for the mailbox LOCAL@DOMAIN recently
+ * did not return a key.  DOMAIN is expected to be lowercase.  */
+int
+domaininfo_is_mbox_not_found (const char *local, const char *domain)
+{
+  unsigned char digest[20];
+  mboxinfo_t mi;
+
+  mbox_digest (local, domain, digest);
+  for (mi = mboxbuckets[buf32_to_u32 (digest) % NO_OF_MBOXBUCKETS];
+       mi; mi = mi->next)
+    if (!memcmp (mi->digest, digest, 20))
+      return mi->expires > gnupg_get_time ();
+
+  return 0;
+}
+
+
+/* Insert the mailbox with DIGEST which expires at EXPIRES.  */
+static void
+insert_mbox (const unsigned char *digest, time_t expires)
+{
+  mboxinfo_t mi, *mip;
+  mboxinfo_t mi_new;
+  mboxinfo_t drop = NULL;
+  time_t now = gnupg_get_time ();
+  u32 hash;
+  int count;
+
+  mi_new = xtrycalloc (1, sizeof *mi_new);
+  if (!mi_new)
+    return;  /* Out of core - we ignore this.  */
+  memcpy (mi_new->digest, digest, 20);
+  mi_new->expires = expires;
+
+  /* Update an existing item and remove expired items.  */
+  hash = buf32_to_u32 (digest) % NO_OF_MBOXBUCKETS;
+  for (count = 0, mip = &mboxbuckets[hash]; (mi = *mip); )
+    {
+      if (!memcmp (mi->digest, digest, 20))
+        {
+          mi->expires = expires;
+          drop = mi_new;
+          goto leave;
+        }
+      if (mi->expires <= now)
+        {
+          *mip = mi->next;
+          mi->next = drop;
+          drop = mi;
+        }
+      else
+        {
+          count++;
+          mip = &mi->next;
+        }
+    }
+
+  /* The newest items are at the head; thus we drop the last items if
+   * the chain gets too long.  */
+  if (count >= MAX_MBOXBUCKET_LEN)
+    {
+      for (count = 0, mip = &mboxbuckets[hash];
+           *mip && count < MAX_MBOXBUCKET_LEN - 1;
+           mip = &(*mip)->next)
+        count++;
+      mi = *mip;
+      *mip = NULL;
+      while (mi)
+        {
+          mboxinfo_t tmp = mi->next;
+          mi->next = drop;
+          drop = mi;
+          mi = tmp;
+        }
+    }
+
+  mi_new->next = mboxbuckets[hash];
+  mboxbuckets[hash] = mi_new;
+
+ leave:
+  while (drop)
+    {
+      mi = drop->next;
+      xfree (drop);
+      drop = mi;
+    }
+}
+
+
+/* Remember that a WKD query for the mailbox LOCAL@DOMAIN did not
+ * return a key.  DOMAIN is expected to be lowercase.  */
+void
+domaininfo_set_mbox_not_found (const char *local, const char *domain)
+{
+  unsigned char digest[20];
+
+  mbox_digest (local, domain, digest);
+  insert_mbox (digest, gnupg_get_time () + MBOX_NOT_FOUND_TTL);
+}
+
+
+
+/* Write a snapshot of the domain information to the cache directory
+ * so that it can be read by the next dirmngr process. The file is a
+ * simple text file with these lines:
+ *
+ *   d <updated> <flags> <domain>
+ *   m <expires> <hexdigest>
+ *
+ * FLAGS are the letters 'N' (no_name), 'F' (wkd_not_found), 'S'
+ * (wkd_supported), and 'U' (wkd_not_supported) or '-' for none.  */
+void
+domaininfo_save (void)
+{
+  char *fname, *tmpfname;
+  estream_t fp;
+  domaininfo_t di;
+  mboxinfo_t mi;
+  time_t now = gnupg_get_time ();
+  char hexdigest[41];
+  int bidx;
+
+  fname = make_filename (opt.homedir_cache, SNAPSHOT_FILENAME, NULL);
+  tmpfname = strconcat (fname, ".tmp", NULL);
+  if (!tmpfname)
+    {
+      xfree (fname);
+      return;
+    }
+  fp = es_fopen (tmpfname, "w");
+  if (!fp)
+    {
+      log_info ("error creating '%s': %s\n",
+                tmpfname, gpg_strerror (gpg_error_from_syserror ()));
+      goto leave;
+    }
+
+  es_fputs ("# Snapshot of the dirmngr domain information.\n"
+            "# Written by dirmngr - do not edit.\n", fp);
+  for (bidx = 0; bidx < NO_OF_DOMAINBUCKETS; bidx++)
+    for (di = domainbuckets[bidx]; di; di = di->next)
+      es_fprintf (fp, "d %lu %s%s%s%s%s %s\n",
+                  (unsigned long)di->updated,
+                  di->no_name? "N":"",
+                  di->wkd_not_found? "F":"",
+                  di->wkd_supported? "S":"",
+                  di->wkd_not_supported? "U":"",
+                  (di->no_name || di->wkd_not_found || di->wkd_supported
+                   || di->wkd_not_supported)? "":"-",
+                  di->name);
+  for (bidx = 0; bidx < NO_OF_MBOXBUCKETS; bidx++)
+    for (mi = mboxbuckets[bidx]; mi; mi = mi->next)
+      if (mi->expires > now)
+        es_fprintf (fp, "m %lu %s\n", (unsigned long)mi->expires,
+                    bin2hex (mi->digest, 20, hexdigest));
+
+  if (es_fclose (fp))
+    {
+      log_info ("error writing '%s': %s\n",
+                tmpfname, gpg_strerror (gpg_error_from_syserror ()));
+      gnupg_remove (tmpfname);
+      goto leave;
+    }
+  if (gnupg_rename_file (tmpfname, fname, NULL))
+    {
+      log_info ("error renaming '%s': %s\n",
+                tmpfname, gpg_strerror (gpg_error_from_syserror ()));
+      gnupg_remove (tmpfname);
+    }
+
+ leave:
+  xfree (tmpfname);
+  xfree (fname);
+}
+
+
+/* Read the snapshot written by domaininfo_save.  This must only be
+ * called at startup before any other thread uses this module.  */
+void
+domaininfo_load (void)
+{
+  char *fname;
+  estream_t fp;
+  char line[512];
+  const char *fields[4];
+  unsigned char digest[20];
+  domaininfo_t di;
+  time_t now = gnupg_get_time ();
+  time_t tstamp;
+  const char *s;
+  u32 hash;
+  int n, count;
+
+  fname = make_filename (opt.homedir_cache, SNAPSHOT_FILENAME, NULL);
+  fp = es_fopen (fname, "r");
+  if (!fp)
+    goto leave;
+
+  while (es_fgets (line, sizeof line, fp))
+    {
+      n = strlen (line);
+      if (!n || line[n-1] != '\n')
+        break;  /* Line too long - stop reading.  */
+      line[n-1] = 0;
+      if (*line == '#')
+        continue;
+      n = split_fields (line, fields, DIM (fields));
+      if (n < 3)
+        continue;
+      tstamp = (time_t)strtoul (fields[1], NULL, 10);
+
+      if (!strcmp (fields[0], "m") && n == 3)
+        {
+          if (tstamp > now && tstamp <= now + MBOX_NOT_FOUND_TTL
+              && hex2bin (fields[2], digest, 20) == 40)
+            insert_mbox (digest, tstamp);
+        }
+      else if (!strcmp (fields[0], "d") && n == 4)
+        {
+          if (tstamp + SNAPSHOT_MAX_AGE < now
+              || !is_valid_domain_name (fields[3]))
+            continue;
+          hash = hash_domain (fields[3]);
+          for (count = 0, di = domainbuckets[hash]; di; di = di->next)
+            count++;
+          if (count >= MAX_DOMAINBUCKET_LEN)
+            continue;
+          di = xtrycalloc (1, sizeof *di + strlen (fields[3]));
+          if (!di)
+            break;
+          strcpy (di->name, fields[3]);
+          di->updated = tstamp;
+          for (s = fields[2]; *s; s++)
+            switch (*s)
+              {
+              case 'N': di->no_name = 1; break;
+              case 'F': di->wkd_not_found = 1; break;
+              case 'S': di->wkd_supported = 1; break;
+              case 'U': di->wkd_not_supported = 1; break;
+              default: break;
+              }
+          di->next = domainbuckets[hash];
+          domainbuckets[hash] = di;
+        }
+    }
+  es_fclose (fp);
+
+ leave:
+  xfree (fname);
+}
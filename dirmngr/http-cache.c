@@ -0,0 +1,324 @@
+/* http-cache.c - In-memory cache for HTTP responses
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* This module caches the bodies of successful HTTP GET responses
+ * keyed by the URL.  It implements a small subset of RFC-7234 for a
+ * private cache: A response is stored only if it has a Content-Length
+ * and either a max-age or a validator (ETag or Last-Modified).  A
+ * fresh item is used without asking the server; a stale item is
+ * revalidated with a conditional request.  Responses with a Vary
+ * header or Cache-Control: no-store are not cached.  The total size
+ * of the cache is limited and the least recently used items are
+ * removed first.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dirmngr.h"
+#include "http-cache.h"
+
+/* The maximum size of a single body and of all bodies.  */
+#define HTTP_CACHE_MAX_ITEMSIZE  (256*1024)
+#define HTTP_CACHE_MAX_SIZE      (4*1024*1024)
+
+
+/* An item of the cache.  The item is reference counted because a
+ * caller may hold it while waiting for the network.  */
+struct http_cache_item_s
+{
+  struct http_cache_item_s *next;
+  int refcount;            /* One reference is held by the list.  */
+  time_t expires;          /* The item is fresh until this time.  */
+  char *etag;              /* The ETag or NULL.  Malloced.  */
+  char *last_modified;     /* The Last-Modified value or NULL.  Malloced. */
+  size_t datalen;
+  unsigned char *data;     /* The body.  Malloced.  */
+  char url[1];
+};
+
+/* The list of items with the most recently used first and the total
+ * size of all bodies.  */
+static http_cache_item_t cache_list;
+static size_t cache_size;
+
+
+
+/* Release a reference to ITEM.  */
+void
+http_cache_release (http_cache_item_t item)
+{
+  if (!item)
+    return;
+  if (--item->refcount)
+    return;
+  xfree (item->etag);
+  xfree (item->last_modified);
+  xfree (item->data);
+  xfree (item);
+}
+
+
+/* Remove the item at *ITEMP from the list.  */
+static void
+unlink_item (http_cache_item_t *itemp)
+{
+  http_cache_item_t item = *itemp;
+
+  *itemp = item->next;
+  item->next = NULL;
+  cache_size -= item->datalen;
+  http_cache_release (item);
+}
+
+
+/* Remove all items from the cache.  */
+void
+http_cache_flush (void)
+{
+  while (cache_list)
+    unlink_item (&cache_list);
+}
+
+
+/* Return the item for URL with a new reference or NULL if there is
+ * no usable item.  The caller must release the item.  */
+http_cache_item_t
+http_cache_lookup (const char *url)
+{
+  http_cache_item_t item, *itemp;
+
+  for (itemp = &cache_list; (item = *itemp); itemp = &item->next)
+    if (!strcmp (item->url, url))
+      break;
+  if (!item)
+    return NULL;
+
+  if (!item->etag && !item->last_modified && !http_cache_is_fresh (item))
+    {
+      /* A stale item without a validator is of no use anymore.  */
+      unlink_item (itemp);
+      return NULL;
+    }
+
+  /* Move to the head.  */
+  *itemp = item->next;
+  item->next = cache_list;
+  cache_list = item;
+
+  item->refcount++;
+  return item;
+}
+
+
+/* Return true if ITEM may be used without asking the server.  */
+int
+http_cache_is_fresh (http_cache_item_t item)
+{
+  return item->expires > gnupg_get_time ();
+}
+
+
+/* Write the headers for a conditional request for ITEM to FP.  */
+gpg_error_t
+http_cache_write_validators (http_cache_item_t item, estream_t fp)
+{
+  if (item->etag)
+    es_fprintf (fp, "If-None-Match: %s\r\n", item->etag);
+  if (item->last_modified)
+    es_fprintf (fp, "If-Modified-Since: %s\r\n", item->last_modified);
+  return es_ferror (fp)? gpg_error_from_syserror () : 0;
+}
+
+
+/* Return a new memory stream with the body of ITEM at R_FP.  */
+static gpg_error_t
+make_stream (http_cache_item_t item, estream_t *r_fp)
+{
+  gpg_error_t err;
+  estream_t fp;
+
+  *r_fp = NULL;
+  fp = es_fopenmem (0, "w+b");
+  if (!fp)
+    return gpg_error_from_syserror ();
+  if (es_fwrite (item->data, item->datalen, 1, fp) != 1 && item->datalen)
+    {
+      err = gpg_error_from_syserror ();
+      es_fclose (fp);
+      return err;
+    }
+  es_rewind (fp);
+  *r_fp = fp;
+  return 0;
+}
+
+
+/* Return a new memory stream with the cached body of ITEM at
+ * R_FP.  */
+gpg_error_t
+http_cache_open (http_cache_item_t item, estream_t *r_fp)
+{
+  if (DBG_NETWORK)
+    log_debug ("http-cache: using cached response for '%s'\n", item->url);
+  return make_stream (item, r_fp);
+}
+
+
+/* Return the freshness lifetime in seconds as given by the response
+ * headers of HTTP.  Returns -1 if the response must not be
+ * stored.  */
+static long
+get_max_age (http_t http)
+{
+  const char *s, *cc;
+  long maxage = 0;
+
+  if (http_get_header (http, "Vary"))
+    return -1;
+  cc = http_get_header (http, "Cache-Control");
+  if (!cc)
+    return 0;
+
+  for (s = cc; s && *s; s = strchr (s, ','))
+    {
+      if (*s == ',')
+        s++;
+      while (*s == ' ' || *s == '\t')
+        s++;
+      if (!ascii_strncasecmp (s, "no-store", 8))
+        return -1;
+      else if (!ascii_strncasecmp (s, "no-cache", 8))
+        return 0;
+      else if (!ascii_strncasecmp (s, "max-age=", 8))
+        maxage = atol (s + 8);
+    }
+  return maxage > 0? maxage : 0;
+}
+
+
+/* Update ITEM from the headers of a 304 response in HTTP.  */
+void
+http_cache_update (http_cache_item_t item, http_t http)
+{
+  long maxage = get_max_age (http);
+  const char *s;
+  char *p;
+
+  item->expires = maxage > 0? gnupg_get_time () + maxage : 0;
+  s = http_get_header (http, "Etag");
+  if (s && (p = xtrystrdup (s)))
+    {
+      xfree (item->etag);
+      item->etag = p;
+    }
+}
+
+
+/* Store the successful response from HTTP for URL whose body is read
+ * from INFP in the cache.  If the response has been stored, a memory
+ * stream with the body is stored at R_FP and the caller must close
+ * INFP.  Otherwise NULL is stored at R_FP and INFP may still be
+ * used.  */
+gpg_error_t
+http_cache_store (const char *url, http_t http, estream_t infp,
+                  estream_t *r_fp)
+{
+  gpg_error_t err;
+  http_cache_item_t item, *itemp;
+  const char *etag, *lastmod, *s;
+  unsigned long long length;
+  size_t nread;
+  long maxage;
+
+  *r_fp = NULL;
+
+  maxage = get_max_age (http);
+  etag = http_get_header (http, "Etag");
+  lastmod = http_get_header (http, "Last-Modified");
+  s = http_get_header (http, "Content-Length");
+  if (maxage < 0 || (!maxage && !etag && !lastmod) || !s)
+    return 0;
+  length = strtoull (s, NULL, 10);
+  if (length > HTTP_CACHE_MAX_ITEMSIZE)
+    return 0;
+
+  item = xtrycalloc (1, sizeof *item + strlen (url));
+  if (!item)
+    return gpg_error_from_syserror ();
+  strcpy (item->url, url);
+  item->refcount = 1;
+  item->expires = maxage > 0? gnupg_get_time () + maxage : 0;
+  if ((etag && !(item->etag = xtrystrdup (etag)))
+      || (lastmod && !(item->last_modified = xtrystrdup (lastmod)))
+      || !(item->data = xtrymalloc (length + 1)))
+    {
+      err = gpg_error_from_syserror ();
+      http_cache_release (item);
+      return err;
+    }
+
+  /* Read one extra byte to detect a wrong Content-Length.  */
+  if (es_read (infp, item->data, length + 1, &nread))
+    {
+      err = gpg_error_from_syserror ();
+      http_cache_release (item);
+      return err;
+    }
+  item->datalen = nread;
+  if (nread != length)
+    {
+      /* We have already consumed the data; thus we can't fall back to
+       * returning INFP.  */
+      log_info ("http-cache: response for '%s' has a wrong length\n", url);
+      err = make_stream (item, r_fp);
+      http_cache_release (item);
+      return err;
+    }
+
+  err = make_stream (item, r_fp);
+  if (err)
+    {
+      http_cache_release (item);
+      return err;
+    }
+
+  /* Replace an old item for URL and make room.  */
+  for (itemp = &cache_list; *itemp; itemp = &(*itemp)->next)
+    if (!strcmp ((*itemp)->url, url))
+      {
+        unlink_item (itemp);
+        break;
+      }
+  while (cache_list && cache_size + item->datalen > HTTP_CACHE_MAX_SIZE)
+    {
+      for (itemp = &cache_list; (*itemp)->next; itemp = &(*itemp)->next)
+        ;
+      unlink_item (itemp);
+    }
+  item->next = cache_list;
+  cache_list = item;
+  cache_size += item->datalen;
+  if (DBG_NETWORK)
+    log_debug ("http-cache: stored response for '%s'\n", url);
+  return 0;
+}
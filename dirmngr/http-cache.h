@@ -0,0 +1,40 @@
+/* http-cache.h - Definitions for the HTTP response cache
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef DIRMNGR_HTTP_CACHE_H
+#define DIRMNGR_HTTP_CACHE_H
+
+#include "http.h"
+
+struct http_cache_item_s;
+typedef struct http_cache_item_s *http_cache_item_t;
+
+http_cache_item_t http_cache_lookup (const char *url);
+void http_cache_release (http_cache_item_t item);
+int http_cache_is_fresh (http_cache_item_t item);
+gpg_error_t http_cache_write_validators (http_cache_item_t item,
+                                         estream_t fp);
+gpg_error_t http_cache_open (http_cache_item_t item, estream_t *r_fp);
+void http_cache_update (http_cache_item_t item, http_t http);
+gpg_error_t http_cache_store (const char *url, http_t http, estream_t infp,
+                              estream_t *r_fp);
+void http_cache_flush (void);
+
+#endif /*DIRMNGR_HTTP_CACHE_H*/
@@ -48,6 +48,8 @@ gnupg_http_tls_verify_cb (void *opaque,
   ksba_cert_t hostcert = NULL;
   unsigned int validate_flags;
   const char *hostname;
+  const unsigned char *image = NULL;
+  size_t imagelen = 0;
 
   (void)http;
   (void)session;
@@ -77,11 +79,24 @@ gnupg_http_tls_verify_cb (void *opaque,
 
   validate_flags = VALIDATE_FLAG_TLS;
 
+  /* Skip the validation if we recently verified the same
+   * certificate for this host.  */
+  hostname = ntbtls_get_hostname (tls);
+  if (hostname)
+    image = ksba_cert_get_image (hostcert, &imagelen);
+  if (image && http_verified_cache_lookup (hostname, http_flags,
+                                           image, imagelen))
+    {
+      if (opt.verbose > 1)
+        log_info ("certificate of '%s' already verified\n", hostname);
+      err = 0;
+      goto leave;
+    }
+
   /* If we are using the standard hkps:// pool use the dedicated root
    * certificate.  Note that this differes from the GnuTLS
    * implementation which uses this special certificate only if no
    * other certificates are configured. */
-  hostname = ntbtls_get_hostname (tls);
   if (hostname
       && !ascii_strcasecmp (hostname, get_default_keyserver (1)))
     {
@@ -107,6 +122,8 @@ gnupg_http_tls_verify_cb (void *opaque,
     validate_flags |= VALIDATE_FLAG_NOCRLCHECK;
 
   err = validate_cert_chain (ctrl, hostcert, NULL, validate_flags, NULL);
+  if (!err && image)
+    http_verified_cache_put (hostname, http_flags, image, imagelen);
 
  leave:
   ksba_cert_release (hostcert);
@@ -128,6 +128,7 @@
 
 #define HTTP_PROXY_ENV           "http_proxy"
 #define MAX_LINELEN 20000  /* Max. length of a HTTP header line. */
+#define CONNECT_ATTEMPT_DELAY 250  /* Delay in ms between racing connects. */
 #define VALID_URI_CHARS "abcdefghijklmnopqrstuvwxyz"   \
                         "ABCDEFGHIJKLMNOPQRSTUVWXYZ"   \
                         "01234567890@"                 \
@@ -152,7 +153,7 @@ static uri_tuple_t parse_tuple (char *string);
 static gpg_error_t send_request (ctrl_t ctrl, http_t hd, const char *httphost,
                                  const char *auth,const char *proxy,
 				 const char *srvtag, unsigned int timeout,
-                                 strlist_t headers);
+                                 strlist_t headers, int no_pool);
 static char *build_rel_path (parsed_uri_t uri);
 static gpg_error_t parse_response (http_t hd);
 
@@ -208,6 +209,14 @@ struct cookie_s
      the content length.  */
   uint64_t content_length;
   unsigned int content_length_valid:1;
+
+  /* The number of bytes received so far.  */
+  uint64_t received;
+
+  /* The key of the connection pool or NULL.  If set the connection
+   * is put into the pool when the stream is closed after exactly the
+   * body of the response has been read.  Malloced.  */
+  char *pool_key;
 };
 typedef struct cookie_s *cookie_t;
 
@@ -262,6 +271,10 @@ struct http_session_s
 
 #ifdef HTTP_USE_GNUTLS
   gnutls_certificate_credentials_t certcred;
+
+  /* The "servername:port" key for the resumption cache or NULL if the
+   * TLS session shall not be resumed.  Malloced.  */
+  char *resume_key;
 #endif /*HTTP_USE_GNUTLS*/
 };
 
@@ -284,6 +297,20 @@ typedef struct header_s *header_t;
 
 
 /* Our handle context. */
+/* The arguments of send_request saved to repeat a GET request on a
+ * new connection if the reused connection turns out to be dead.  */
+struct send_args_s
+{
+  ctrl_t ctrl;
+  unsigned int timeout;
+  char *httphost;
+  char *auth;
+  char *srvtag;
+  strlist_t headers;
+};
+typedef struct send_args_s *send_args_t;
+
+
 struct http_context_s
 {
   unsigned long magic;
@@ -302,6 +329,12 @@ struct http_context_s
   size_t buffer_size;
   unsigned int flags;
   header_t headers;      /* Received headers. */
+  char *pool_key;        /* Key for the connection pool or NULL.  */
+  unsigned int reused:1; /* The connection was taken from the pool.  */
+  http_session_t saved_session; /* The caller's session while the
+                                 * session of a reused connection is
+                                 * in use.  */
+  send_args_t send_args; /* Saved to retry a GET request or NULL.  */
 };
 
 
@@ -323,6 +356,76 @@ static strlist_t cfg_ca_certlist;
 /* The global callback for net activity.  */
 static void (*netactivity_cb)(void);
 
+#ifdef HTTP_USE_GNUTLS
+/* The maximum number of items in the TLS resumption cache and the
+ * time in seconds after which an item is not used anymore.  */
+#define RESUME_CACHE_SIZE 32
+#define RESUME_CACHE_TTL  3600
+
+/* An item of the TLS resumption cache.  The data of a closed TLS
+ * session is kept here so that the next connection to the same
+ * server can resume the session instead of doing a full handshake.
+ * The server's certificate is part of the data and thus verified
+ * again as usual.  */
+struct resume_cache_s
+{
+  struct resume_cache_s *next;
+  time_t created;
+  gnutls_datum_t data;
+  char key[1];
+};
+static struct resume_cache_s *resume_cache;
+#endif /*HTTP_USE_GNUTLS*/
+
+/* The maximum number of items in the cache of verified server
+ * certificates and the time in seconds an item is used.  */
+#define VERIFIED_CACHE_SIZE 32
+#define VERIFIED_CACHE_TTL  300
+
+/* The flags which change the result of a verification.  */
+#define VERIFIED_CACHE_FLAGS (HTTP_FLAG_TRUST_DEF | HTTP_FLAG_TRUST_SYS \
+                              | HTTP_FLAG_TRUST_CFG | HTTP_FLAG_NO_CRL)
+
+/* An item of the cache of verified server certificates.  If the same
+ * certificate is presented again by the same host and the same trust
+ * flags are used, the certificate is accepted without verifying the
+ * chain again.  CERTHASH is the SHA-256 hash of the certificate.  */
+struct verified_cache_s
+{
+  struct verified_cache_s *next;
+  time_t created;
+  unsigned int flags;
+  unsigned char certhash[32];
+  char host[1];
+};
+static struct verified_cache_s *verified_cache;
+
+/* The maximum number of idle connections kept for reuse and the time
+ * in seconds an idle connection is kept.  The time is below the
+ * keep-alive timeout of common servers (Apache uses 5 seconds) so
+ * that we rarely try to use a connection the server just closed.  */
+#define CONN_POOL_SIZE 8
+#define CONN_POOL_TTL  4
+
+/* An item of the pool of idle keep-alive connections.  SESSION is
+ * NULL for plain HTTP connections.  KEY identifies the server, the
+ * name used for the Host header and SNI and the trust flags.  */
+struct conn_pool_s
+{
+  struct conn_pool_s *next;
+  time_t created;
+  my_socket_t sock;
+  http_session_t session;
+  char key[1];
+};
+static struct conn_pool_s *conn_pool;
+
+/* Statistics for the connection pool.  */
+static struct {
+  unsigned long hits;
+  unsigned long misses;
+} conn_pool_stats;
+
 
 
 #if defined(HAVE_W32_SYSTEM) && !defined(HTTP_NO_WSASTARTUP)
@@ -646,6 +749,178 @@ notify_netactivity (void)
 
 
 
+#ifdef HTTP_USE_GNUTLS
+/* Release the resumption cache item C.  */
+static void
+release_resume_cache_item (struct resume_cache_s *c)
+{
+  if (c)
+    {
+      gnutls_free (c->data.data);
+      xfree (c);
+    }
+}
+
+
+/* Remove the item for KEY from the resumption cache and return it.
+ * Expired items are also removed.  Returns NULL if no item was
+ * found.  */
+static struct resume_cache_s *
+resume_cache_take (const char *key)
+{
+  struct resume_cache_s *c, **cp, *found = NULL;
+  time_t now = gnupg_get_time ();
+
+  for (cp = &resume_cache; (c = *cp); )
+    {
+      if (!found && !strcmp (c->key, key))
+        {
+          *cp = c->next;
+          found = c;
+        }
+      else if (c->created + RESUME_CACHE_TTL < now)
+        {
+          *cp = c->next;
+          release_resume_cache_item (c);
+        }
+      else
+        cp = &c->next;
+    }
+  if (found && found->created + RESUME_CACHE_TTL < now)
+    {
+      release_resume_cache_item (found);
+      found = NULL;
+    }
+  return found;
+}
+
+
+/* Store the data of the TLS session of SESS in the resumption
+ * cache.  */
+static void
+resume_cache_put (http_session_t sess)
+{
+  struct resume_cache_s *c, **cp;
+  int n, rc;
+
+  c = xtrycalloc (1, sizeof *c + strlen (sess->resume_key));
+  if (!c)
+    return;
+  strcpy (c->key, sess->resume_key);
+  rc = gnutls_session_get_data2 (sess->tls_session, &c->data);
+  if (rc < 0 || !c->data.size)
+    {
+      if (opt_debug)
+        log_debug ("http.c:resume_cache_put: no session data: %s\n",
+                   rc < 0? gnutls_strerror (rc) : "empty");
+      release_resume_cache_item (c);
+      return;
+    }
+  c->created = gnupg_get_time ();
+
+  /* Remove an old item for this server and the oldest item if the
+   * cache is full.  New items are inserted at the head.  */
+  for (n = 0, cp = &resume_cache; *cp; )
+    {
+      if (!strcmp ((*cp)->key, c->key) || ++n >= RESUME_CACHE_SIZE)
+        {
+          struct resume_cache_s *tmp = *cp;
+          *cp = tmp->next;
+          release_resume_cache_item (tmp);
+        }
+      else
+        cp = &(*cp)->next;
+    }
+  c->next = resume_cache;
+  resume_cache = c;
+}
+#endif /*HTTP_USE_GNUTLS*/
+
+
+/* Remove all items from the cache of verified server
+ * certificates.  */
+void
+http_verified_cache_flush (void)
+{
+  struct verified_cache_s *c;
+
+  while ((c = verified_cache))
+    {
+      verified_cache = c->next;
+      xfree (c);
+    }
+}
+
+
+/* Return true if the server certificate CERT of length CERTLEN has
+ * recently been verified for HOST using FLAGS.  */
+int
+http_verified_cache_lookup (const char *host, unsigned int flags,
+                            const void *cert, size_t certlen)
+{
+  struct verified_cache_s *c, **cp;
+  unsigned char certhash[32];
+  time_t now = gnupg_get_time ();
+
+  flags &= VERIFIED_CACHE_FLAGS;
+  gcry_md_hash_buffer (GCRY_MD_SHA256, certhash, cert, certlen);
+  for (cp = &verified_cache; (c = *cp); )
+    {
+      if (c->created + VERIFIED_CACHE_TTL < now)
+        {
+          *cp = c->next;
+          xfree (c);
+        }
+      else if (c->flags == flags
+               && !memcmp (c->certhash, certhash, sizeof certhash)
+               && !ascii_strcasecmp (c->host, host))
+        return 1;
+      else
+        cp = &c->next;
+    }
+  return 0;
+}
+
+
+/* Store the fact that the server certificate CERT of length CERTLEN
+ * has been verified for HOST using FLAGS.  */
+void
+http_verified_cache_put (const char *host, unsigned int flags,
+                         const void *cert, size_t certlen)
+{
+  struct verified_cache_s *c, **cp;
+  int n;
+
+  c = xtrycalloc (1, sizeof *c + strlen (host));
+  if (!c)
+    return;
+  strcpy (c->host, host);
+  c->flags = flags & VERIFIED_CACHE_FLAGS;
+  gcry_md_hash_buffer (GCRY_MD_SHA256, c->certhash, cert, certlen);
+  c->created = gnupg_get_time ();
+
+  /* Remove an old item for this host and certificate and the oldest
+   * item if the cache is full.  New items are inserted at the
+   * head.  */
+  for (n = 0, cp = &verified_cache; *cp; )
+    {
+      if (((*cp)->flags == c->flags
+           && !memcmp ((*cp)->certhash, c->certhash, sizeof c->certhash)
+           && !ascii_strcasecmp ((*cp)->host, host))
+          || ++n >= VERIFIED_CACHE_SIZE)
+        {
+          struct verified_cache_s *tmp = *cp;
+          *cp = tmp->next;
+          xfree (tmp);
+        }
+      else
+        cp = &(*cp)->next;
+    }
+  c->next = verified_cache;
+  verified_cache = c;
+}
+
+
 /* Free the TLS session associated with SESS, if any.  */
 static void
 close_tls_session (http_session_t sess)
@@ -661,6 +936,10 @@ close_tls_session (http_session_t sess)
 #elif HTTP_USE_GNUTLS
       my_socket_t sock = gnutls_transport_get_ptr (sess->tls_session);
       my_socket_unref (sock, NULL, NULL);
+      if (sess->resume_key)
+        resume_cache_put (sess);
+      xfree (sess->resume_key);
+      sess->resume_key = NULL;
       gnutls_deinit (sess->tls_session);
       if (sess->certcred)
         gnutls_certificate_free_credentials (sess->certcred);
@@ -703,6 +982,154 @@ http_session_release (http_session_t sess)
 }
 
 
+/* Release the pool item C and close its connection.  We do not send
+ * a TLS close notify because this would wait for the server's
+ * reply; closing an idle connection is fine for HTTP.  */
+static void
+release_conn_pool_item (struct conn_pool_s *c)
+{
+  if (c)
+    {
+      http_session_unref (c->session);
+      my_socket_unref (c->sock, NULL, NULL);
+      xfree (c);
+    }
+}
+
+
+/* Return true if the idle connection of pool item C is still usable.
+ * An idle connection must not have anything to read; if the socket
+ * is readable the server has closed it or sent garbage.  */
+static int
+conn_pool_item_alive (struct conn_pool_s *c)
+{
+  fd_set rfds;
+  struct timeval tv;
+
+  if (c->created + CONN_POOL_TTL < gnupg_get_time ())
+    return 0;
+#if HTTP_USE_GNUTLS
+  if (c->session && (!c->session->tls_session
+                     || gnutls_record_check_pending (c->session->tls_session)))
+    return 0;
+#endif /*HTTP_USE_GNUTLS*/
+
+  FD_ZERO (&rfds);
+  FD_SET (FD2INT (c->sock->fd), &rfds);
+  tv.tv_sec = 0;
+  tv.tv_usec = 0;
+  return !my_select (FD2INT (c->sock->fd)+1, &rfds, NULL, NULL, &tv);
+}
+
+
+/* Remove the most recently used idle connection for KEY from the
+ * pool and return it.  Dead and expired items are removed as well.
+ * Returns NULL if no usable connection was found.  */
+static struct conn_pool_s *
+conn_pool_take (const char *key)
+{
+  struct conn_pool_s *c, **cp, *found = NULL;
+
+  for (cp = &conn_pool; (c = *cp); )
+    {
+      if (!found && !strcmp (c->key, key))
+        {
+          *cp = c->next;
+          found = c;
+        }
+      else if (c->created + CONN_POOL_TTL < gnupg_get_time ())
+        {
+          *cp = c->next;
+          release_conn_pool_item (c);
+        }
+      else
+        cp = &c->next;
+    }
+  if (found && !conn_pool_item_alive (found))
+    {
+      if (opt_debug)
+        log_debug ("http.c:conn_pool: connection for '%s' is gone\n", key);
+      release_conn_pool_item (found);
+      found = NULL;
+    }
+  if (found)
+    conn_pool_stats.hits++;
+  else
+    conn_pool_stats.misses++;
+  return found;
+}
+
+
+/* Put the idle connection SOCK with the TLS session SESS (or NULL
+ * for plain HTTP) into the pool using KEY.  The caller keeps its
+ * references.  */
+static void
+conn_pool_put (const char *key, my_socket_t sock, http_session_t sess)
+{
+  struct conn_pool_s *c, **cp;
+  int n;
+
+  if (sess && !sess->tls_session)
+    return;  /* The server already terminated the TLS session.  */
+
+  c = xtrycalloc (1, sizeof *c + strlen (key));
+  if (!c)
+    return;
+  strcpy (c->key, key);
+  c->sock = my_socket_ref (sock);
+  c->session = http_session_ref (sess);
+  c->created = gnupg_get_time ();
+
+  /* Remove the oldest item if the pool is full.  New items are
+   * inserted at the head.  */
+  for (n = 0, cp = &conn_pool; *cp; )
+    {
+      if (++n >= CONN_POOL_SIZE)
+        {
+          struct conn_pool_s *tmp = *cp;
+          *cp = tmp->next;
+          release_conn_pool_item (tmp);
+        }
+      else
+        cp = &(*cp)->next;
+    }
+  c->next = conn_pool;
+  conn_pool = c;
+  if (opt_debug)
+    log_debug ("http.c:conn_pool: keeping connection for '%s'\n", key);
+}
+
+
+/* Close all idle connections.  */
+void
+http_conn_pool_flush (void)
+{
+  struct conn_pool_s *c;
+
+  while ((c = conn_pool))
+    {
+      conn_pool = c->next;
+      release_conn_pool_item (c);
+    }
+}
+
+
+/* Return statistics about the connection pool.  */
+void
+http_get_conn_pool_stats (unsigned int *r_items,
+                          unsigned long *r_hits, unsigned long *r_misses)
+{
+  struct conn_pool_s *c;
+  unsigned int n;
+
+  for (n = 0, c = conn_pool; c; c = c->next)
+    n++;
+  *r_items = n;
+  *r_hits = conn_pool_stats.hits;
+  *r_misses = conn_pool_stats.misses;
+}
+
+
 /* Create a new session object which is currently used to enable TLS
  * support.  It may eventually allow reusing existing connections.
  * Valid values for FLAGS are:
@@ -931,6 +1358,74 @@ http_session_set_timeout (http_session_t sess, unsigned int timeout)
 
 
 
+/* Release the saved send_request arguments ARGS.  */
+static void
+release_send_args (send_args_t args)
+{
+  if (!args)
+    return;
+  xfree (args->httphost);
+  xfree (args->auth);
+  xfree (args->srvtag);
+  free_strlist (args->headers);
+  xfree (args);
+}
+
+
+/* Save the arguments of send_request in HD so that the request can
+ * be repeated by http_wait_response.  On malloc failure nothing is
+ * saved and the request won't be repeated.  */
+static void
+save_send_args (http_t hd, ctrl_t ctrl, const char *httphost,
+                const char *auth, const char *srvtag, unsigned int timeout,
+                strlist_t headers)
+{
+  send_args_t args;
+
+  args = xtrycalloc (1, sizeof *args);
+  if (!args)
+    return;
+  args->ctrl = ctrl;
+  args->timeout = timeout;
+  if ((httphost && !(args->httphost = xtrystrdup (httphost)))
+      || (auth && !(args->auth = xtrystrdup (auth)))
+      || (srvtag && !(args->srvtag = xtrystrdup (srvtag))))
+    {
+      release_send_args (args);
+      return;
+    }
+  args->headers = strlist_copy (headers);
+  hd->send_args = args;
+}
+
+
+/* Close the streams and the reused connection of HD after a failure
+ * and switch back to the caller's session so that the request can be
+ * sent again on a new connection.  */
+static void
+drop_reused_connection (http_t hd)
+{
+  if (hd->fp_read)
+    es_fclose (hd->fp_read);
+  hd->fp_read = NULL;
+  hd->read_cookie = NULL;
+  if (hd->fp_write)
+    es_fclose (hd->fp_write);
+  hd->fp_write = NULL;
+  hd->write_cookie = NULL;
+  my_socket_unref (hd->sock, NULL, NULL);
+  hd->sock = NULL;
+  if (hd->saved_session)
+    {
+      http_session_unref (hd->session);
+      hd->session = hd->saved_session;
+      hd->saved_session = NULL;
+    }
+  hd->in_data = 0;
+  hd->reused = 0;
+}
+
+
 /* Start a HTTP retrieval and on success store at R_HD a context
    pointer for completing the request and to wait for the response.
    If HTTPHOST is not NULL it is used for the Host header instead of a
@@ -943,6 +1438,7 @@ http_open (ctrl_t ctrl, http_t *r_hd, http_req_t reqtype, const char *url,
 {
   gpg_error_t err;
   http_t hd;
+  unsigned int timeout;
 
   *r_hd = NULL;
 
@@ -960,9 +1456,24 @@ http_open (ctrl_t ctrl, http_t *r_hd, http_req_t reqtype, const char *url,
 
   err = parse_uri (&hd->uri, url, 0, !!(flags & HTTP_FLAG_FORCE_TLS));
   if (!err)
-    err = send_request (ctrl, hd, httphost, auth, proxy, srvtag,
-                        hd->session? hd->session->connect_timeout : 0,
-                        headers);
+    {
+      timeout = hd->session? hd->session->connect_timeout : 0;
+      err = send_request (ctrl, hd, httphost, auth, proxy, srvtag,
+                          timeout, headers, 0);
+      if (err && hd->reused)
+        {
+          /* The server closed the idle connection; try once more on
+           * a new connection.  */
+          if (opt_debug)
+            log_debug ("http.c:conn_pool: retrying request: %s\n",
+                       gpg_strerror (err));
+          drop_reused_connection (hd);
+          err = send_request (ctrl, hd, httphost, auth, proxy, srvtag,
+                              timeout, headers, 1);
+        }
+      else if (!err && hd->reused && reqtype == HTTP_REQ_GET)
+        save_send_args (hd, ctrl, httphost, auth, srvtag, timeout, headers);
+    }
 
   if (err)
     {
@@ -972,6 +1483,9 @@ http_open (ctrl_t ctrl, http_t *r_hd, http_req_t reqtype, const char *url,
       if (hd->fp_write)
         es_fclose (hd->fp_write);
       http_session_unref (hd->session);
+      http_session_unref (hd->saved_session);
+      release_send_args (hd->send_args);
+      xfree (hd->pool_key);
       xfree (hd);
     }
   else
@@ -1118,7 +1632,9 @@ http_wait_response (http_t hd)
   gpg_error_t err;
   cookie_t cookie;
   int use_tls;
+  send_args_t args;
 
+ again:
   /* Make sure that we are in the data. */
   http_start_data (hd);
 
@@ -1162,6 +1678,23 @@ http_wait_response (http_t hd)
     }
 
   err = parse_response (hd);
+  if (err && hd->reused && hd->send_args && !cookie->received)
+    {
+      /* The server closed the reused connection before it sent
+       * anything.  Send the request again on a new connection.  */
+      if (opt_debug)
+        log_debug ("http.c:conn_pool: retrying request: %s\n",
+                   gpg_strerror (err));
+      args = hd->send_args;
+      hd->send_args = NULL;
+      drop_reused_connection (hd);
+      err = send_request (args->ctrl, hd, args->httphost, args->auth, NULL,
+                          args->srvtag, args->timeout, args->headers, 1);
+      release_send_args (args);
+      if (!err)
+        goto again;
+      return err;
+    }
 
   if (!err)
     err = es_onclose (hd->fp_read, 1, fp_onclose_notification, hd);
@@ -1216,6 +1749,8 @@ http_close (http_t hd, int keep_read_stream)
   if (hd->fp_write)
     es_fclose (hd->fp_write);
   http_session_unref (hd->session);
+  http_session_unref (hd->saved_session);
+  release_send_args (hd->send_args);
   hd->magic = 0xdeadbeef;
   http_release_parsed_uri (hd->uri);
   while (hd->headers)
@@ -1225,6 +1760,7 @@ http_close (http_t hd, int keep_read_stream)
       xfree (hd->headers);
       hd->headers = tmp;
     }
+  xfree (hd->pool_key);
   xfree (hd->buffer);
   xfree (hd);
 }
@@ -1753,7 +2289,7 @@ is_hostname_port (const char *string)
 static gpg_error_t
 send_request (ctrl_t ctrl, http_t hd, const char *httphost, const char *auth,
 	      const char *proxy, const char *srvtag, unsigned int timeout,
-              strlist_t headers)
+              strlist_t headers, int no_pool)
 {
   gpg_error_t err;
   const char *server;
@@ -1764,6 +2300,7 @@ send_request (ctrl_t ctrl, http_t hd, const char *httphost, const char *auth,
   char *authstr = NULL;
   assuan_fd_t sock;
   int have_http_proxy = 0;
+  const char *envproxy;
 
   if (hd->uri->use_tls && !hd->session)
     {
@@ -1802,6 +2339,45 @@ send_request (ctrl_t ctrl, http_t hd, const char *httphost, const char *auth,
   server = *hd->uri->host ? hd->uri->host : "localhost";
   port = hd->uri->port ? hd->uri->port : 80;
 
+  /* Ask for a persistent connection and reuse an idle one to the same
+   * server if we have one.  This is not done with proxies or Tor and
+   * if the sending end shall be closed.  With NO_POOL set a new
+   * connection is always used.  */
+  if (!(hd->flags & (HTTP_FLAG_FORCE_TOR | HTTP_FLAG_SHUTDOWN))
+      && !(proxy && *proxy)
+      && !((hd->flags & HTTP_FLAG_TRY_PROXY)
+           && (envproxy = getenv (HTTP_PROXY_ENV)) && *envproxy)
+#if HTTP_USE_NTBTLS
+      && !hd->uri->use_tls
+#endif
+      )
+    {
+      struct conn_pool_s *c;
+
+      xfree (hd->pool_key);
+      hd->pool_key = xtryasprintf ("%s://%s:%hu/%s/%u",
+                                   hd->uri->use_tls? "https" : "http",
+                                   server, port, httphost? httphost : server,
+                                   ((hd->flags
+                                     | (hd->session? hd->session->flags : 0))
+                                    & VERIFIED_CACHE_FLAGS));
+      if (hd->pool_key && !no_pool && (c = conn_pool_take (hd->pool_key)))
+        {
+          if (opt_debug)
+            log_debug ("http.c:conn_pool: reusing connection for '%s'\n",
+                       hd->pool_key);
+          hd->sock = c->sock;
+          hd->reused = 1;
+          if (c->session)
+            {
+              hd->saved_session = hd->session;
+              hd->session = c->session;
+            }
+          xfree (c);
+          goto connected;
+        }
+    }
+
   /* Try to use SNI.  */
   if (hd->uri->use_tls)
     {
@@ -2116,6 +2692,7 @@ send_request (ctrl_t ctrl, http_t hd, const char *httphost, const char *auth,
   if (hd->uri->use_tls)
     {
       int rc;
+      char *resume_key = NULL;
 
       my_socket_ref (hd->sock);
       gnutls_transport_set_ptr (hd->session->tls_session, hd->sock);
@@ -2124,6 +2701,26 @@ send_request (ctrl_t ctrl, http_t hd, const char *httphost, const char *auth,
       gnutls_transport_set_push_function (hd->session->tls_session,
                                           my_gnutls_write);
 
+      /* Try to resume a former session with this server.  We don't do
+       * this for Tor because it would allow the server to link the
+       * connections.  */
+      if (!(hd->flags & HTTP_FLAG_FORCE_TOR) && !hd->session->resume_key
+          && (resume_key = xtryasprintf ("%s:%hu",
+                                         hd->session->servername, port)))
+        {
+          struct resume_cache_s *c = resume_cache_take (resume_key);
+
+          if (c)
+            {
+              rc = gnutls_session_set_data (hd->session->tls_session,
+                                            c->data.data, c->data.size);
+              if (rc < 0)
+                log_info ("gnutls_session_set_data failed: %s\n",
+                          gnutls_strerror (rc));
+              release_resume_cache_item (c);
+            }
+        }
+
     handshake_again:
       do
         {
@@ -2152,10 +2749,14 @@ send_request (ctrl_t ctrl, http_t hd, const char *httphost, const char *auth,
             }
           else
             log_info ("TLS handshake failed: %s\n", gnutls_strerror (rc));
+          xfree (resume_key);
           xfree (proxy_authstr);
           return gpg_err_make (default_errsource, GPG_ERR_NETWORK);
         }
 
+      if (opt_debug && gnutls_session_is_resumed (hd->session->tls_session))
+        log_debug ("TLS session resumed\n");
+
       hd->session->verify.done = 0;
       if (tls_callback)
         err = tls_callback (hd, hd->session, 0);
@@ -2165,13 +2766,19 @@ send_request (ctrl_t ctrl, http_t hd, const char *httphost, const char *auth,
         {
           log_info ("TLS connection authentication failed: %s\n",
                     gpg_strerror (err));
+          xfree (resume_key);
           xfree (proxy_authstr);
           return err;
         }
+
+      /* Only a verified session may be resumed later.  */
+      if (resume_key)
+        hd->session->resume_key = resume_key;
     }
 
 #endif /*HTTP_USE_GNUTLS*/
 
+ connected:
   if (auth || hd->uri->auth)
     {
       char *myauth;
@@ -2233,13 +2840,14 @@ send_request (ctrl_t ctrl, http_t hd, const char *httphost, const char *auth,
         snprintf (portstr, sizeof portstr, ":%u", port);
 
       request = es_bsprintf
-        ("%s %s%s HTTP/1.0\r\nHost: %s%s\r\n%s",
+        ("%s %s%s HTTP/1.0\r\nHost: %s%s\r\n%s%s",
          hd->req_type == HTTP_REQ_GET ? "GET" :
          hd->req_type == HTTP_REQ_HEAD ? "HEAD" :
          hd->req_type == HTTP_REQ_POST ? "POST" : "OOPS",
          *p == '/' ? "" : "/", p,
          httphost? httphost : server,
          portstr,
+         hd->pool_key? "Connection: keep-alive\r\n" : "",
          authstr? authstr:"");
     }
   xfree (p);
@@ -2504,6 +3112,28 @@ http_get_header_names (http_t hd)
 }
 
 
+/* Return true if the comma separated list of a header value VALUE
+ * has the token TOKEN.  The comparison is case-insensitive.  */
+static int
+has_token (const char *value, const char *token)
+{
+  size_t toklen = strlen (token);
+  size_t n;
+
+  while (*value)
+    {
+      value += strspn (value, " \t,");
+      n = strcspn (value, ",");
+      while (n && (value[n-1] == ' ' || value[n-1] == '\t'))
+        n--;
+      if (n == toklen && !ascii_strncasecmp (value, token, n))
+        return 1;
+      value += strcspn (value, ",");
+    }
+  return 0;
+}
+
+
 /*
  * Parse the response from a server.
  * Returns: Errorcode and sets some files in the handle
@@ -2515,6 +3145,9 @@ parse_response (http_t hd)
   size_t maxlen, len;
   cookie_t cookie = hd->read_cookie;
   const char *s;
+  uint64_t hdrlen = 0;
+  int truncated = 0;
+  int keep_alive;
 
   /* Delete old header lines.  */
   while (hd->headers)
@@ -2537,6 +3170,7 @@ parse_response (http_t hd)
 	return GPG_ERR_TRUNCATED; /* Line has been truncated. */
       if (!len)
 	return GPG_ERR_EOF;
+      hdrlen += len;
 
       if (opt_debug || (hd->flags & HTTP_FLAG_LOG_RESP))
         log_debug_string (line, "http.c:response:\n");
@@ -2580,6 +3214,9 @@ parse_response (http_t hd)
       /* Note, that we can silently ignore truncated lines. */
       if (!len)
 	return GPG_ERR_EOF;
+      hdrlen += len;
+      if (!maxlen)
+        truncated = 1;
       /* Trim line endings of empty lines. */
       if ((*line == '\r' && line[1] == '\n') || *line == '\n')
 	*line = 0;
@@ -2595,6 +3232,12 @@ parse_response (http_t hd)
     }
   while (len && *line);
 
+  /* We ask for a persistent connection using an HTTP/1.0 request
+   * and thus the server needs to confirm it.  */
+  s = http_get_header (hd, "Connection");
+  keep_alive = (hd->pool_key && s && has_token (s, "keep-alive")
+                && !has_token (s, "close"));
+
   cookie->content_length_valid = 0;
   if (!(hd->flags & HTTP_FLAG_IGNORE_CL))
     {
@@ -2603,7 +3246,32 @@ parse_response (http_t hd)
         {
           cookie->content_length_valid = 1;
           cookie->content_length = string_to_u64 (s);
+
+          /* Account for the part of the body which has already been
+           * read into the stream's buffer.  We can't do this if a
+           * header line was truncated because we do not know its
+           * length.  */
+          if (truncated)
+            keep_alive = 0;
+          else if (cookie->received - hdrlen > cookie->content_length)
+            {
+              /* The server sent more than the body.  */
+              cookie->content_length = 0;
+              keep_alive = 0;
+            }
+          else
+            cookie->content_length -= cookie->received - hdrlen;
         }
+      else
+        keep_alive = 0;
+    }
+  else
+    keep_alive = 0;
+
+  if (keep_alive)
+    {
+      cookie->pool_key = hd->pool_key;
+      hd->pool_key = NULL;
     }
 
   return 0;
@@ -2898,6 +3566,270 @@ connect_with_timeout (assuan_fd_t sock,
 }
 
 
+#ifndef HAVE_W32_SYSTEM
+/* Return the current time in milliseconds.  */
+static unsigned long
+get_msec (void)
+{
+  struct timeval tv;
+
+  gettimeofday (&tv, NULL);
+  return (unsigned long)tv.tv_sec * 1000 + tv.tv_usec / 1000;
+}
+
+
+/* Create a non-blocking socket for AI, store it at R_SOCK and start
+ * to connect.  On success R_PENDING is set if the connection has not
+ * yet been established.  */
+static gpg_error_t
+start_connect (dns_addrinfo_t ai, assuan_fd_t *r_sock, int *r_pending)
+{
+  gpg_error_t err;
+  assuan_fd_t sock;
+
+  *r_sock = ASSUAN_INVALID_FD;
+  *r_pending = 0;
+  sock = my_sock_new_for_addr (ai->addr, ai->socktype, ai->protocol);
+  if (sock == ASSUAN_INVALID_FD)
+    return gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+  if (fcntl (sock, F_SETFL, fcntl (sock, F_GETFL, 0) | O_NONBLOCK))
+    {
+      err = gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+      assuan_sock_close (sock);
+      return err;
+    }
+  if (assuan_sock_connect (sock, (struct sockaddr *)ai->addr, ai->addrlen))
+    {
+      err = gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+      if (gpg_err_code (err) != GPG_ERR_EINPROGRESS)
+        {
+          assuan_sock_close (sock);
+          return err;
+        }
+      *r_pending = 1;
+    }
+  *r_sock = sock;
+  return 0;
+}
+
+
+/* Connect to the NADDRS addresses at ADDRS concurrently as described
+ * by RFC-8305: The attempts are started in the given order, each
+ * CONNECT_ATTEMPT_DELAY milliseconds after the former one or as soon
+ * as all pending attempts failed.  The first established connection
+ * wins and all other attempts are cancelled.  TIMEOUT is the timeout
+ * in milliseconds for each attempt and must not be 0.  On success the
+ * socket is stored at R_SOCK, the index of its address at R_IDX and
+ * the time it took to connect at R_MSEC.  This function can't be
+ * used with SOCKS.  */
+static gpg_error_t
+connect_racing (dns_addrinfo_t *addrs, int naddrs, unsigned int timeout,
+                assuan_fd_t *r_sock, int *r_idx, unsigned int *r_msec)
+{
+  gpg_error_t err;
+  gpg_error_t last_err;
+  assuan_fd_t *socks;
+  unsigned long *started;
+  unsigned long now, wait;
+  unsigned long last_start = 0;
+  int next = 0;
+  int npending = 0;
+  int winner = -1;
+  int i, n, maxfd, pending;
+  fd_set wset;
+  struct timeval tval;
+
+  *r_sock = ASSUAN_INVALID_FD;
+  *r_idx = -1;
+  *r_msec = 0;
+
+  socks = xtrymalloc (naddrs * sizeof *socks);
+  started = xtrycalloc (naddrs, sizeof *started);
+  if (!socks || !started)
+    {
+      err = gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+      xfree (socks);
+      xfree (started);
+      return err;
+    }
+  for (i=0; i < naddrs; i++)
+    socks[i] = ASSUAN_INVALID_FD;
+
+  last_err = gpg_err_make (default_errsource, GPG_ERR_ETIMEDOUT);
+  while (winner == -1)
+    {
+      now = get_msec ();
+
+      /* Start the next attempt if it is due.  */
+      if (next < naddrs
+          && (!npending || now - last_start >= CONNECT_ATTEMPT_DELAY))
+        {
+          i = next++;
+          if (opt_debug)
+            log_debug ("http.c:connect_racing: attempt %d of %d\n",
+                       i+1, naddrs);
+          err = start_connect (addrs[i], &socks[i], &pending);
+          if (err)
+            {
+              last_err = err;
+              continue;
+            }
+          started[i] = last_start = now;
+          if (!pending)
+            winner = i;
+          else
+            npending++;
+          continue;
+        }
+      if (!npending)
+        break;  /* All attempts failed.  */
+
+      /* Cancel the timed out attempts and figure out how long to
+       * wait for the others.  */
+      wait = (next < naddrs)? CONNECT_ATTEMPT_DELAY - (now - last_start)
+                            : timeout;
+      FD_ZERO (&wset);
+      maxfd = -1;
+      for (i=0; i < next; i++)
+        {
+          if (socks[i] == ASSUAN_INVALID_FD)
+            continue;
+          if (now - started[i] >= timeout)
+            {
+              assuan_sock_close (socks[i]);
+              socks[i] = ASSUAN_INVALID_FD;
+              npending--;
+              last_err = gpg_err_make (default_errsource, GPG_ERR_ETIMEDOUT);
+              continue;
+            }
+          if (timeout - (now - started[i]) < wait)
+            wait = timeout - (now - started[i]);
+          FD_SET (FD2INT (socks[i]), &wset);
+          if (FD2INT (socks[i]) > maxfd)
+            maxfd = FD2INT (socks[i]);
+        }
+      if (maxfd == -1)
+        continue;
+
+      tval.tv_sec = wait / 1000;
+      tval.tv_usec = (wait % 1000) * 1000;
+      n = my_select (maxfd+1, NULL, &wset, NULL, &tval);
+      if (n < 0)
+        {
+          if (errno == EINTR)
+            continue;
+          last_err = gpg_err_make (default_errsource,
+                                   gpg_err_code_from_syserror ());
+          break;
+        }
+
+      for (i=0; n > 0 && i < next; i++)
+        {
+          int syserr;
+          socklen_t slen = sizeof syserr;
+
+          if (socks[i] == ASSUAN_INVALID_FD
+              || !FD_ISSET (FD2INT (socks[i]), &wset))
+            continue;
+          n--;
+          if (getsockopt (FD2INT (socks[i]), SOL_SOCKET, SO_ERROR,
+                          (void*)&syserr, &slen) < 0)
+            err = gpg_err_make (default_errsource,
+                                gpg_err_code_from_syserror ());
+          else if (syserr)
+            err = gpg_err_make (default_errsource,
+                                gpg_err_code_from_errno (syserr));
+          else
+            {
+              winner = i;
+              break;
+            }
+          if (opt_debug)
+            log_debug ("http.c:connect_racing: attempt %d failed: %s\n",
+                       i+1, gpg_strerror (err));
+          last_err = err;
+          assuan_sock_close (socks[i]);
+          socks[i] = ASSUAN_INVALID_FD;
+          npending--;
+        }
+    }
+
+  for (i=0; i < next; i++)
+    if (i != winner && socks[i] != ASSUAN_INVALID_FD)
+      assuan_sock_close (socks[i]);
+
+  if (winner == -1)
+    err = last_err;
+  else
+    {
+      err = 0;
+      fcntl (socks[winner], F_SETFL,
+             fcntl (socks[winner], F_GETFL, 0) & ~O_NONBLOCK);
+      *r_sock = socks[winner];
+      *r_idx = winner;
+      *r_msec = get_msec () - started[winner];
+      if (opt_debug)
+        log_debug ("http.c:connect_racing: attempt %d won after %ums\n",
+                   winner+1, *r_msec);
+    }
+  xfree (socks);
+  xfree (started);
+  return err;
+}
+
+
+/* Return a malloced array with the usable addresses of the list
+ * AIBUF at R_ADDRS and their number at R_NADDRS.  As recommended by
+ * RFC-8305 the address families are interleaved, starting with the
+ * family of the first address.  FLAGS and the V4_VALID and V6_VALID
+ * flags tell which families may be used.  */
+static gpg_error_t
+interleave_addresses (dns_addrinfo_t aibuf, unsigned int flags,
+                      int v4_valid, int v6_valid,
+                      dns_addrinfo_t **r_addrs, int *r_naddrs)
+{
+  dns_addrinfo_t ai, *addrs, *v4list, *v6list;
+  int nv4 = 0;
+  int nv6 = 0;
+  int n = 0;
+  int i4, i6, want6;
+
+  *r_addrs = NULL;
+  *r_naddrs = 0;
+  for (ai = aibuf; ai; ai = ai->next)
+    n++;
+  addrs = xtrycalloc (3 * n + 1, sizeof *addrs);
+  if (!addrs)
+    return gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+  v4list = addrs + n;
+  v6list = v4list + n;
+
+  want6 = (aibuf && aibuf->family == AF_INET6);
+  for (ai = aibuf; ai; ai = ai->next)
+    {
+      if (ai->family == AF_INET
+          && !(flags & HTTP_FLAG_IGNORE_IPv4) && v4_valid)
+        v4list[nv4++] = ai;
+      else if (ai->family == AF_INET6
+               && !(flags & HTTP_FLAG_IGNORE_IPv6) && v6_valid)
+        v6list[nv6++] = ai;
+    }
+
+  for (i4 = i6 = n = 0; i4 < nv4 || i6 < nv6; want6 = !want6)
+    {
+      if ((want6 && i6 < nv6) || i4 >= nv4)
+        addrs[n++] = v6list[i6++];
+      else
+        addrs[n++] = v4list[i4++];
+    }
+
+  *r_addrs = addrs;
+  *r_naddrs = n;
+  return 0;
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
 /* Actually connect to a server.  On success 0 is returned and the
  * file descriptor for the socket is stored at R_SOCK; on error an
  * error code is returned and ASSUAN_INVALID_FD is stored at R_SOCK.
@@ -3002,6 +3934,49 @@ connect_server (ctrl_t ctrl, const char *server, unsigned short port,
         }
       hostfound = 1;
 
+#ifndef HAVE_W32_SYSTEM
+      /* If the host has several addresses and we have a timeout we
+       * try them concurrently so that an unreachable address does
+       * not delay us for the entire timeout.  */
+      if (timeout && aibuf && aibuf->next && !use_socks (aibuf->addr))
+        {
+          dns_addrinfo_t *addrs;
+          int naddrs, idx;
+          unsigned int msec;
+
+          err = interleave_addresses (aibuf, flags, v4_valid, v6_valid,
+                                      &addrs, &naddrs);
+          if (err)
+            {
+              free_dns_addrinfo (aibuf);
+              xfree (serverlist);
+              return err;
+            }
+          if (naddrs > 1)
+            {
+              if (sock != ASSUAN_INVALID_FD)
+                {
+                  assuan_sock_close (sock);
+                  sock = ASSUAN_INVALID_FD;
+                }
+              anyhostaddr = 1;
+              err = connect_racing (addrs, naddrs, timeout,
+                                    &sock, &idx, &msec);
+              if (err)
+                last_err = err;
+              else
+                {
+                  connected = 1;
+                  notify_netactivity ();
+                }
+              xfree (addrs);
+              free_dns_addrinfo (aibuf);
+              continue;
+            }
+          xfree (addrs);
+        }
+#endif /*!HAVE_W32_SYSTEM*/
+
       for (ai = aibuf; ai && !connected; ai = ai->next)
         {
           if (ai->family == AF_INET
@@ -3081,6 +4056,112 @@ connect_server (ctrl_t ctrl, const char *server, unsigned short port,
 }
 
 
+/* Connect concurrently to the NHOSTS servers given by the numerical
+ * addresses at HOSTS and the ports at PORTS.  The index of the first
+ * server which accepted the connection is stored at R_IDX and the
+ * time in milliseconds it took to connect at R_MSEC.  The connection
+ * is closed right away; the purpose of this function is to select a
+ * working and fast server.  FLAGS may have HTTP_FLAG_IGNORE_IPv4 and
+ * HTTP_FLAG_IGNORE_IPv6 set.  TIMEOUT is the connect timeout in
+ * milliseconds and must not be 0.  GPG_ERR_NOT_SUPPORTED is returned
+ * if this is not possible, for example in Tor mode.  */
+gpg_error_t
+http_race_hosts (ctrl_t ctrl, const char **hosts, const unsigned short *ports,
+                 int nhosts, unsigned int flags, unsigned int timeout,
+                 int *r_idx, unsigned int *r_msec)
+{
+#ifdef HAVE_W32_SYSTEM
+  (void)ctrl;
+  (void)hosts;
+  (void)ports;
+  (void)nhosts;
+  (void)flags;
+  (void)timeout;
+  *r_idx = -1;
+  *r_msec = 0;
+  return gpg_err_make (default_errsource, GPG_ERR_NOT_SUPPORTED);
+#else /*!HAVE_W32_SYSTEM*/
+  gpg_error_t err;
+  dns_addrinfo_t *aibufs, *addrs, ai;
+  int *tags;
+  int i, naddrs, idx, v4_valid, v6_valid;
+  assuan_fd_t sock;
+  char name[50];
+  size_t n;
+
+  *r_idx = -1;
+  *r_msec = 0;
+  if (!timeout || nhosts < 1)
+    return gpg_err_make (default_errsource, GPG_ERR_NOT_SUPPORTED);
+
+  check_inet_support (&v4_valid, &v6_valid);
+  aibufs = xtrycalloc (2 * nhosts, sizeof *aibufs);
+  tags = xtrycalloc (nhosts, sizeof *tags);
+  if (!aibufs || !tags)
+    {
+      err = gpg_err_make (default_errsource, gpg_err_code_from_syserror ());
+      xfree (aibufs);
+      xfree (tags);
+      return err;
+    }
+  addrs = aibufs + nhosts;
+
+  /* Take the first usable address of each host.  */
+  for (i = naddrs = 0; i < nhosts; i++)
+    {
+      n = strlen (hosts[i]);
+      if (*hosts[i] == '[' && n > 2 && hosts[i][n-1] == ']'
+          && n - 2 < sizeof name)
+        mem2str (name, hosts[i] + 1, n - 1);
+      else if (n < sizeof name)
+        strcpy (name, hosts[i]);
+      else
+        continue;
+      if (!is_ip_address (name)
+          || resolve_dns_name (ctrl, name, ports[i], 0, SOCK_STREAM,
+                               &aibufs[i], NULL))
+        continue;
+      for (ai = aibufs[i]; ai; ai = ai->next)
+        {
+          if (ai->family == AF_INET
+              && ((flags & HTTP_FLAG_IGNORE_IPv4) || !v4_valid))
+            continue;
+          if (ai->family == AF_INET6
+              && ((flags & HTTP_FLAG_IGNORE_IPv6) || !v6_valid))
+            continue;
+          break;
+        }
+      if (!ai)
+        continue;
+      if (use_socks (ai->addr))
+        {
+          naddrs = 0;
+          break;
+        }
+      addrs[naddrs] = ai;
+      tags[naddrs++] = i;
+    }
+
+  if (!naddrs)
+    err = gpg_err_make (default_errsource, GPG_ERR_NOT_SUPPORTED);
+  else
+    err = connect_racing (addrs, naddrs, timeout, &sock, &idx, r_msec);
+  if (!err)
+    {
+      notify_netactivity ();
+      assuan_sock_close (sock);
+      *r_idx = tags[idx];
+    }
+
+  for (i=0; i < nhosts; i++)
+    free_dns_addrinfo (aibufs[i]);
+  xfree (aibufs);
+  xfree (tags);
+  return err;
+#endif /*!HAVE_W32_SYSTEM*/
+}
+
+
 /* Helper to read from a socket.  This handles npth things and
  * EINTR.  */
 static gpgrt_ssize_t
@@ -3234,6 +4315,9 @@ cookie_read (void *cookie, void *buffer, size_t size)
       nread = read_server (c->sock->fd, buffer, size);
     }
 
+  if (nread > 0)
+    c->received += nread;
+
   if (c->content_length_valid && nread > 0)
     {
       if (nread < c->content_length)
@@ -3374,6 +4458,11 @@ cookie_close (void *cookie)
   if (!c)
     return 0;
 
+  /* Keep the connection if the response has been read completely.  */
+  if (c->pool_key && c->sock && c->content_length_valid && !c->content_length)
+    conn_pool_put (c->pool_key, c->sock, c->use_tls? c->session : NULL);
+  xfree (c->pool_key);
+
 #if HTTP_USE_NTBTLS
   if (c->use_tls && c->session && c->session->tls_session)
     {
@@ -3425,6 +4514,18 @@ http_verify_server_credentials (http_session_t sess)
       return gpg_error (GPG_ERR_GENERAL);
     }
 
+  hostname = sess->servername;
+  certlist = gnutls_certificate_get_peers (sess->tls_session, &certlistlen);
+  if (certlistlen && hostname
+      && http_verified_cache_lookup (hostname, sess->flags,
+                                     certlist[0].data, certlist[0].size))
+    {
+      if (opt_debug)
+        log_debug ("http.c: certificate of '%s' already verified\n",
+                   hostname);
+      goto leave;
+    }
+
   rc = gnutls_certificate_verify_peers2 (sess->tls_session, &status);
   if (rc)
     {
@@ -3453,7 +4554,6 @@ http_verify_server_credentials (http_session_t sess)
         err = gpg_error (GPG_ERR_GENERAL);
     }
 
-  hostname = sess->servername;
   if (!hostname || !strchr (hostname, '.'))
     {
       log_error ("%s: %s\n", errprefix, "hostname missing");
@@ -3461,7 +4561,6 @@ http_verify_server_credentials (http_session_t sess)
         err = gpg_error (GPG_ERR_GENERAL);
     }
 
-  certlist = gnutls_certificate_get_peers (sess->tls_session, &certlistlen);
   if (!certlistlen)
     {
       log_error ("%s: %s\n", errprefix, "server did not send a certificate");
@@ -3500,6 +4599,11 @@ http_verify_server_credentials (http_session_t sess)
 
   gnutls_x509_crt_deinit (cert);
 
+  if (!err)
+    http_verified_cache_put (hostname, sess->flags,
+                             certlist[0].data, certlist[0].size);
+
+ leave:
   if (!err)
     sess->verify.rc = 0;
 
@@ -134,6 +134,16 @@ void http_register_tls_ca (const char *fname);
 void http_register_cfg_ca (const char *fname);
 void http_register_netactivity_cb (void (*cb)(void));
 
+void http_verified_cache_flush (void);
+int http_verified_cache_lookup (const char *host, unsigned int flags,
+                                const void *cert, size_t certlen);
+void http_verified_cache_put (const char *host, unsigned int flags,
+                              const void *cert, size_t certlen);
+
+void http_conn_pool_flush (void);
+void http_get_conn_pool_stats (unsigned int *r_items,
+                               unsigned long *r_hits, unsigned long *r_misses);
+
 
 gpg_error_t http_session_new (http_session_t *r_session,
                               const char *intended_hostname,
@@ -160,6 +170,12 @@ gpg_error_t http_raw_connect (ctrl_t ctrl, http_t *r_hd,
                               unsigned int flags, const char *srvtag,
                               unsigned int timeout);
 
+gpg_error_t http_race_hosts (ctrl_t ctrl,
+                             const char **hosts, const unsigned short *ports,
+                             int nhosts, unsigned int flags,
+                             unsigned int timeout,
+                             int *r_idx, unsigned int *r_msec);
+
 gpg_error_t http_open (ctrl_t ctrl, http_t *r_hd, http_req_t reqtype,
                        const char *url,
                        const char *httphost,
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <npth.h>
 
 #include "dirmngr.h"
 #include "misc.h"
@@ -34,6 +35,33 @@
 # include "ldap-parse-uri.h"
 #endif
 
+/* The maximum number of concurrent requests ks_action_get sends to
+ * one HKP keyserver.  */
+#define MAX_GET_CONCURRENCY 4
+
+/* The maximum number of HKP keyservers which are asked at once for
+ * the same keys.  */
+#define MAX_RACE_KEYSERVERS 4
+
+/* A job for the worker threads of ks_action_get.  */
+struct get_job_s
+{
+  const char *pattern;
+  estream_t fp;         /* Memory stream with the result or NULL.  */
+  gpg_error_t err;      /* The error from the keyserver.  */
+  gpg_error_t copyerr;  /* An error while reading the result.  */
+};
+
+/* The parameter block shared by the worker threads.  */
+struct get_parm_s
+{
+  ctrl_t ctrl;
+  parsed_uri_t uri;
+  struct get_job_s *jobs;
+  int njobs;
+  int next;             /* Index of the next job to run.  */
+};
+
 /* Called by the engine's help functions to print the actual help.  */
 gpg_error_t
 ks_print_help (ctrl_t ctrl, const char *text)
@@ -136,6 +164,288 @@ ks_action_resolve (ctrl_t ctrl, uri_item_t keyservers)
 }
 
 
+/* The state of a race between several HKP keyservers answering the
+ * same request.  One request is sent to each keyserver at once and
+ * the first successful answer is used; the requests still running
+ * when the caller is done are abandoned and release themselves.
+ * Each request uses its own control object and its own copy of the
+ * URI because it may outlive the caller's session.  The fields are
+ * protected by KS_RACE_LOCK.  */
+struct ks_race_item_s
+{
+  struct ks_race_s *race;
+  int idx;                     /* Index of the keyserver in the list.  */
+  struct server_control_s ctrlbuf;
+  parsed_uri_t uri;
+  estream_t fp;                /* Memory stream with the answer.  */
+};
+
+struct ks_race_s
+{
+  int refcount;                /* One for the caller and each request.  */
+  int done;                    /* The caller does not take an answer.  */
+  int pending;                 /* Number of running requests.  */
+  int search;                  /* Use ks_hkp_search instead of ks_hkp_get.  */
+  char *pattern;
+  struct ks_race_item_s *winner;  /* The first successful request.  */
+  gpg_error_t *errs;           /* The error of each keyserver.  */
+  npth_cond_t cond;            /* Signaled when a request has finished.  */
+};
+
+static npth_mutex_t ks_race_lock = NPTH_MUTEX_INITIALIZER;
+
+
+static void
+lock_ks_race (void)
+{
+  int res = npth_mutex_lock (&ks_race_lock);
+  if (res)
+    log_fatal ("failed to acquire the keyserver race lock: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+}
+
+static void
+unlock_ks_race (void)
+{
+  int res = npth_mutex_unlock (&ks_race_lock);
+  if (res)
+    log_fatal ("failed to release the keyserver race lock: %s\n",
+               gpg_strerror (gpg_error_from_errno (res)));
+}
+
+
+/* Release ITEM and the answer stored in it.  */
+static void
+release_ks_race_item (struct ks_race_item_s *item)
+{
+  if (!item)
+    return;
+  es_fclose (item->fp);
+  http_release_parsed_uri (item->uri);
+  dirmngr_deinit_default_ctrl (&item->ctrlbuf);
+  xfree (item);
+}
+
+
+/* Release a reference to RACE.  Must be called with the lock
+ * held.  */
+static void
+unref_ks_race (struct ks_race_s *race)
+{
+  if (--race->refcount)
+    return;
+  npth_cond_destroy (&race->cond);
+  xfree (race->errs);
+  xfree (race->pattern);
+  xfree (race);
+}
+
+
+/* The thread function sending the request of ITEM.  */
+static void *
+ks_race_request (void *arg)
+{
+  struct ks_race_item_s *item = arg;
+  struct ks_race_s *race = item->race;
+  unsigned int http_status = 0;
+  estream_t infp = NULL;
+  gpg_error_t err;
+
+  if (race->search)
+    err = ks_hkp_search (&item->ctrlbuf, item->uri, race->pattern,
+                         &infp, &http_status);
+  else
+    err = ks_hkp_get (&item->ctrlbuf, item->uri, race->pattern, &infp);
+  if (!err)
+    {
+      item->fp = es_fopenmem (0, "w+b");
+      if (!item->fp)
+        err = gpg_error_from_syserror ();
+      else
+        err = copy_stream (infp, item->fp);
+      es_fclose (infp);
+    }
+
+  lock_ks_race ();
+  race->pending--;
+  if (err)
+    {
+      /* A search which found nothing is not an error of the server.  */
+      if (race->search && gpg_err_code (err) == GPG_ERR_NO_DATA
+          && http_status == 404)
+        err = 0;
+      race->errs[item->idx] = err;
+    }
+  else if (!race->done && !race->winner)
+    {
+      race->winner = item;
+      item = NULL;
+    }
+  npth_cond_signal (&race->cond);
+  unlock_ks_race ();
+
+  /* ITEM is still set if the request failed or was too late.  */
+  release_ks_race_item (item);
+
+  lock_ks_race ();
+  unref_ks_race (race);
+  unlock_ks_race ();
+  return NULL;
+}
+
+
+/* Return true if KEYSERVERS consists of at least two HKP keyservers
+ * and nothing else.  */
+static int
+want_ks_race (uri_item_t keyservers)
+{
+  uri_item_t uri;
+
+  if (!keyservers || !keyservers->next)
+    return 0;
+  for (uri = keyservers; uri; uri = uri->next)
+    if (strcmp (uri->parsed_uri->scheme, "hkp")
+        && strcmp (uri->parsed_uri->scheme, "hkps"))
+      return 0;
+  return 1;
+}
+
+
+/* Send the request for PATTERN to up to MAX_RACE_KEYSERVERS of the
+ * HKP keyservers in KEYSERVERS at once and write the first successful
+ * answer to OUTFP.  If SEARCH is set a search is done, otherwise the
+ * keys are retrieved.  If no keyserver answered, the error of the
+ * first keyserver in the list is returned or GPG_ERR_NO_DATA if none
+ * returned an error besides not finding anything.  */
+static gpg_error_t
+ks_race (ctrl_t ctrl, uri_item_t keyservers, int search,
+         const char *pattern, estream_t outfp)
+{
+  gpg_error_t err = 0;
+  struct ks_race_s *race;
+  struct ks_race_item_s *item;
+  struct ks_race_item_s *winner = NULL;
+  npth_attr_t tattr;
+  uri_item_t uri;
+  int nerrs = 0;
+  int idx;
+  int res;
+
+  race = xtrycalloc (1, sizeof *race);
+  if (!race)
+    return gpg_error_from_syserror ();
+  race->search = search;
+  race->pattern = xtrystrdup (pattern);
+  race->errs = xtrycalloc (MAX_RACE_KEYSERVERS, sizeof *race->errs);
+  if (!race->pattern || !race->errs)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (race->pattern);
+      xfree (race->errs);
+      xfree (race);
+      return err;
+    }
+  res = npth_cond_init (&race->cond, NULL);
+  if (res)
+    {
+      err = gpg_error_from_errno (res);
+      xfree (race->pattern);
+      xfree (race->errs);
+      xfree (race);
+      return err;
+    }
+  race->refcount = 1;
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+  for (idx = 0, uri = keyservers;
+       uri && idx < MAX_RACE_KEYSERVERS; uri = uri->next, idx++)
+    {
+      npth_t thread;
+
+      nerrs++;
+      item = xtrycalloc (1, sizeof *item);
+      if (!item)
+        {
+          race->errs[idx] = gpg_error_from_syserror ();
+          continue;
+        }
+      item->race = race;
+      item->idx = idx;
+      dirmngr_init_default_ctrl (&item->ctrlbuf);
+      item->ctrlbuf.timeout = ctrl->timeout;
+      item->ctrlbuf.http_no_crl = ctrl->http_no_crl;
+      xfree (item->ctrlbuf.http_proxy);
+      item->ctrlbuf.http_proxy = (ctrl->http_proxy
+                                  ? xtrystrdup (ctrl->http_proxy) : NULL);
+      race->errs[idx] = http_parse_uri (&item->uri,
+                                        uri->parsed_uri->original, 1);
+      if (race->errs[idx])
+        {
+          release_ks_race_item (item);
+          continue;
+        }
+
+      lock_ks_race ();
+      race->refcount++;
+      race->pending++;
+      unlock_ks_race ();
+      res = npth_create (&thread, &tattr, ks_race_request, item);
+      if (res)
+        {
+          log_error ("error spawning keyserver request: %s\n",
+                     strerror (res));
+          lock_ks_race ();
+          race->refcount--;
+          race->pending--;
+          race->errs[idx] = gpg_error_from_errno (res);
+          unlock_ks_race ();
+          release_ks_race_item (item);
+          continue;
+        }
+      npth_setname_np (thread, "ks-race");
+    }
+  npth_attr_destroy (&tattr);
+
+  lock_ks_race ();
+  while (!race->winner && race->pending)
+    {
+      res = npth_cond_wait (&race->cond, &ks_race_lock);
+      if (res)
+        {
+          err = gpg_error_from_errno (res);
+          break;
+        }
+    }
+  winner = race->winner;
+  race->winner = NULL;
+  race->done = 1;
+  if (!err && !winner)
+    {
+      err = gpg_error (GPG_ERR_NO_DATA);
+      for (idx = 0; idx < nerrs; idx++)
+        if (race->errs[idx])
+          {
+            err = race->errs[idx];
+            break;
+          }
+    }
+  unref_ks_race (race);
+  unlock_ks_race ();
+
+  if (winner)
+    {
+      /* The status of the request went to the winner's own control
+       * object; thus tell the client which keyserver answered.  */
+      dirmngr_status (ctrl, "SOURCE", winner->uri->original, NULL);
+      es_rewind (winner->fp);
+      err = copy_stream (winner->fp, outfp);
+      release_ks_race_item (winner);
+    }
+  return err;
+}
+
+
 /* Search all configured keyservers for keys matching PATTERNS and
    write the result to the provided output stream.  */
 gpg_error_t
@@ -151,6 +461,11 @@ ks_action_search (ctrl_t ctrl, uri_item_t keyservers,
   if (!patterns)
     return gpg_error (GPG_ERR_NO_USER_ID);
 
+  /* With several HKP keyservers all are asked at once and the first
+     answer is used.  */
+  if (want_ks_race (keyservers))
+    return ks_race (ctrl, keyservers, 1, patterns->d, outfp);
+
   /* FIXME: We only take care of the first pattern.  To fully support
      multiple patterns we might either want to run several queries in
      parallel and merge them.  We also need to decide what to do with
@@ -173,13 +488,19 @@ ks_action_search (ctrl_t ctrl, uri_item_t keyservers,
           any_server = 1;
 #if USE_LDAP
 	  if (is_ldap)
-	    err = ks_ldap_search (ctrl, uri->parsed_uri, patterns->d, &infp);
-	  else
-#endif
 	    {
-	      err = ks_hkp_search (ctrl, uri->parsed_uri, patterns->d,
-                                   &infp, &http_status);
+              /* The results are written to OUTFP while they arrive.  */
+	      err = ks_ldap_search (ctrl, uri->parsed_uri, patterns->d, outfp);
+              if (!err)
+                {
+                  any_results = 1;
+                  break;
+                }
+              continue;
 	    }
+#endif
+          err = ks_hkp_search (ctrl, uri->parsed_uri, patterns->d,
+                               &infp, &http_status);
 
           if (err == gpg_error (GPG_ERR_NO_DATA)
               && http_status == 404 /* not found */)
@@ -207,6 +528,108 @@ ks_action_search (ctrl_t ctrl, uri_item_t keyservers,
 }
 
 
+/* The worker thread for get_hkp_concurrently.  It runs jobs from
+ * the parameter block ARG until there are no more jobs.  */
+static void *
+get_worker_thread (void *arg)
+{
+  struct get_parm_s *parm = arg;
+  struct get_job_s *job;
+  estream_t infp;
+
+  /* nPth switches threads only in blocking functions; thus we don't
+   * need a lock to take the next job.  */
+  while (parm->next < parm->njobs)
+    {
+      job = parm->jobs + parm->next++;
+      job->err = ks_hkp_get (parm->ctrl, parm->uri, job->pattern, &infp);
+      if (job->err)
+        continue;
+      job->fp = es_fopenmem (0, "w+b");
+      if (!job->fp)
+        job->copyerr = gpg_error_from_syserror ();
+      else
+        job->copyerr = copy_stream (infp, job->fp);
+      es_fclose (infp);
+    }
+  return NULL;
+}
+
+
+/* Get the keys matching PATTERNS from the HKP keyserver URI using
+ * several requests in parallel and write them in the order of
+ * PATTERNS to OUTFP.  R_ANY_DATA and R_FIRST_ERR are updated like in
+ * the sequential loop of ks_action_get.  */
+static gpg_error_t
+get_hkp_concurrently (ctrl_t ctrl, parsed_uri_t uri, strlist_t patterns,
+                      estream_t outfp,
+                      int *r_any_data, gpg_error_t *r_first_err)
+{
+  gpg_error_t err = 0;
+  struct get_parm_s parm;
+  npth_t threads[MAX_GET_CONCURRENCY - 1];
+  npth_attr_t tattr;
+  int nthreads = 0;
+  strlist_t sl;
+  int i;
+
+  memset (&parm, 0, sizeof parm);
+  parm.ctrl = ctrl;
+  parm.uri = uri;
+  for (sl = patterns; sl; sl = sl->next)
+    parm.njobs++;
+  parm.jobs = xtrycalloc (parm.njobs, sizeof *parm.jobs);
+  if (!parm.jobs)
+    return gpg_error_from_syserror ();
+  for (i = 0, sl = patterns; sl; sl = sl->next)
+    parm.jobs[i++].pattern = sl->d;
+
+  /* Run the first job alone so that the host table is set up and a
+   * dead host has been detected before the other threads start.  */
+  i = parm.njobs;
+  parm.njobs = 1;
+  get_worker_thread (&parm);
+  parm.njobs = i;
+
+  if (parm.next < parm.njobs && !npth_attr_init (&tattr))
+    {
+      while (nthreads < DIM (threads) && nthreads + 1 < parm.njobs
+             && !npth_create (&threads[nthreads], &tattr,
+                              get_worker_thread, &parm))
+        nthreads++;
+      npth_attr_destroy (&tattr);
+    }
+  get_worker_thread (&parm);
+  for (i = 0; i < nthreads; i++)
+    npth_join (threads[i], NULL);
+
+  for (i = 0; i < parm.njobs; i++)
+    {
+      struct get_job_s *job = parm.jobs + i;
+
+      if (job->err)
+        {
+          /* See the comment in ks_action_get.  */
+          *r_first_err = job->err;
+        }
+      else if (!err)
+        {
+          err = job->copyerr;
+          if (!err)
+            {
+              es_rewind (job->fp);
+              err = copy_stream (job->fp, outfp);
+            }
+          if (!err)
+            *r_any_data = 1;
+        }
+      es_fclose (job->fp);
+    }
+  xfree (parm.jobs);
+  return err;
+}
+
+
 /* Get the requested keys (matching PATTERNS) using all configured
    keyservers and write the result to the provided output stream.  */
 gpg_error_t
@@ -224,6 +647,11 @@ ks_action_get (ctrl_t ctrl, uri_item_t keyservers,
   if (!patterns)
     return gpg_error (GPG_ERR_NO_USER_ID);
 
+  /* A single key is requested from several HKP keyservers at once and
+     the first answer is used.  */
+  if (!patterns->next && want_ks_race (keyservers))
+    return ks_race (ctrl, keyservers, 0, patterns->d, outfp);
+
   /* FIXME: We only take care of the first keyserver.  To fully
      support multiple keyservers we need to track the result for each
      pattern and use the next keyserver if one key was not found.  The
@@ -244,7 +672,15 @@ ks_action_get (ctrl_t ctrl, uri_item_t keyservers,
 		 || strcmp (uri->parsed_uri->scheme, "ldapi") == 0);
 #endif
 
-      if (is_hkp_s || is_http_s || is_ldap)
+      if (is_hkp_s && patterns->next)
+        {
+          /* Several keys from an HKP server are requested in
+             parallel.  */
+          any_server = 1;
+          err = get_hkp_concurrently (ctrl, uri->parsed_uri, patterns,
+                                      outfp, &any_data, &first_err);
+        }
+      else if (is_hkp_s || is_http_s || is_ldap)
         {
           any_server = 1;
           for (sl = patterns; !err && sl; sl = sl->next)
@@ -258,7 +694,8 @@ ks_action_get (ctrl_t ctrl, uri_item_t keyservers,
                 err = ks_hkp_get (ctrl, uri->parsed_uri, sl->d, &infp);
               else if (is_http_s)
                 err = ks_http_fetch (ctrl, uri->parsed_uri->original,
-                                     KS_HTTP_FETCH_NOCACHE,
+                                     (KS_HTTP_FETCH_NOCACHE
+                                      | KS_HTTP_FETCH_CACHE),
                                      &infp);
               else
                 BUG ();
@@ -299,9 +736,10 @@ ks_action_get (ctrl_t ctrl, uri_item_t keyservers,
 
 /* Retrieve keys from URL and write the result to the provided output
  * stream OUTFP.  If OUTFP is NULL the data is written to the bit
- * bucket. */
+ * bucket.  FLAGS are the KS_HTTP_FETCH flags used for http URLs.  */
 gpg_error_t
-ks_action_fetch (ctrl_t ctrl, const char *url, estream_t outfp)
+ks_action_fetch (ctrl_t ctrl, const char *url, unsigned int flags,
+                 estream_t outfp)
 {
   gpg_error_t err = 0;
   estream_t infp;
@@ -316,7 +754,7 @@ ks_action_fetch (ctrl_t ctrl, const char *url, estream_t outfp)
 
   if (parsed_uri->is_http)
     {
-      err = ks_http_fetch (ctrl, url, KS_HTTP_FETCH_NOCACHE, &infp);
+      err = ks_http_fetch (ctrl, url, flags, &infp);
       if (!err)
         {
           err = copy_stream (infp, outfp);
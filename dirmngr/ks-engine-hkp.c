@@ -41,6 +41,7 @@
 #include "../common/userids.h"
 #include "dns-stuff.h"
 #include "ks-engine.h"
+#include "http-cache.h"
 
 /* Substitutes for missing Mingw macro.  The EAI_SYSTEM mechanism
    seems not to be available (probably because there is only one set
@@ -71,6 +72,14 @@
 /* Number of retries done in case of transient errors.  */
 #define SEND_REQUEST_EXTRA_RETRIES 5
 
+/* Number of pool members we connect to concurrently to select a
+   host.  */
+#define RACE_POOL_HOSTS 3
+
+/* A host is not selected from a pool if its connect time is more
+   than this factor larger than the one of the fastest host.  */
+#define RTT_SLOW_FACTOR 3
+
 
 enum ks_protocol { KS_PROTOCOL_HKP, KS_PROTOCOL_HKPS, KS_PROTOCOL_MAX };
 
@@ -99,6 +108,8 @@ struct hostinfo_s
                                      lookup.  */
   time_t died_at;    /* The time the host was marked dead.  If this is
                         0 the host has been manually marked dead.  */
+  unsigned int rtt;  /* Smoothed connect time in milliseconds or 0 if
+                        not known.  */
   char *cname;       /* Canonical name of the host.  Only set if this
                         is a pool or NAME has a numerical IP address.  */
   char *iporname;    /* Numeric IP address or name for printing.  */
@@ -222,35 +233,62 @@ host_in_pool_p (hostinfo_t hi, int tblidx)
 }
 
 
-/* Select a random host.  Consult HI->pool which indices into the global
-   hosttable.  Returns index into HI->pool or -1 if no host could be
-   selected.  */
-static int
-select_random_host (hostinfo_t hi)
+/* Store a malloced table with the indices of the currently alive
+   hosts of the pool HI into the global hosttable at R_TBL and return
+   the number of hosts.  Hosts which are known to be much slower than
+   the fastest known host are not included.  */
+static size_t
+get_alive_hosts (hostinfo_t hi, int **r_tbl)
 {
   int *tbl;
   size_t tblsize;
+  unsigned int best = 0;
   int pidx, idx;
 
-  /* We create a new table so that we randomly select only from
-     currently alive hosts.  */
+  *r_tbl = NULL;
   for (idx = 0, tblsize = 0;
        idx < hi->pool_len && (pidx = hi->pool[idx]) != -1;
        idx++)
     if (hosttable[pidx] && !hosttable[pidx]->dead)
-      tblsize++;
+      {
+        tblsize++;
+        if (hosttable[pidx]->rtt && (!best || hosttable[pidx]->rtt < best))
+          best = hosttable[pidx]->rtt;
+      }
   if (!tblsize)
-    return -1; /* No hosts.  */
+    return 0; /* No hosts.  */
 
   tbl = xtrymalloc (tblsize * sizeof *tbl);
   if (!tbl)
-    return -1;
+    return 0;
   for (idx = 0, tblsize = 0;
        idx < hi->pool_len && (pidx = hi->pool[idx]) != -1;
        idx++)
-    if (hosttable[pidx] && !hosttable[pidx]->dead)
+    if (hosttable[pidx] && !hosttable[pidx]->dead
+        && hosttable[pidx]->rtt <= best * RTT_SLOW_FACTOR)
       tbl[tblsize++] = pidx;
 
+  *r_tbl = tbl;
+  return tblsize;
+}
+
+
+/* Select a random host.  Consult HI->pool which indices into the global
+   hosttable.  Returns index into HI->pool or -1 if no host could be
+   selected.  */
+static int
+select_random_host (hostinfo_t hi)
+{
+  int *tbl;
+  size_t tblsize;
+  int pidx;
+
+  /* We create a new table so that we randomly select only from
+     currently alive hosts.  */
+  tblsize = get_alive_hosts (hi, &tbl);
+  if (!tblsize)
+    return -1;
+
   if (tblsize == 1)  /* Save a get_uint_nonce.  */
     pidx = tbl[0];
   else
@@ -261,6 +299,76 @@ select_random_host (hostinfo_t hi)
 }
 
 
+/* Select a host from the pool HI by connecting concurrently to up to
+   RACE_POOL_HOSTS randomly chosen alive hosts and taking the first
+   one which accepts the connection.  This way an unresponsive host
+   does not cost us the entire connect timeout.  The connect time of
+   the selected host is recorded.  DEFAULT_PORT is used for hosts
+   without a known port for PROTOCOL.  Returns the index into the
+   hosttable or -1 if no host could be selected this way.  */
+static int
+race_pool_hosts (ctrl_t ctrl, hostinfo_t hi, enum ks_protocol protocol,
+                 unsigned short default_port)
+{
+  gpg_error_t err;
+  const char *hosts[RACE_POOL_HOSTS];
+  unsigned short ports[RACE_POOL_HOSTS];
+  int *tbl;
+  size_t tblsize;
+  int i, j, tmp, n, pidx;
+  unsigned int msec;
+  hostinfo_t host;
+
+  /* Connect times over Tor say nothing about the host.  */
+  if (dirmngr_use_tor () || !ctrl->timeout)
+    return -1;
+
+  tblsize = get_alive_hosts (hi, &tbl);
+  if (tblsize < 2)
+    {
+      xfree (tbl);
+      return -1;
+    }
+
+  /* Move N random hosts to the front of the table.  */
+  n = tblsize < RACE_POOL_HOSTS? tblsize : RACE_POOL_HOSTS;
+  for (i = 0; i < n; i++)
+    {
+      j = i + get_uint_nonce () % (tblsize - i);
+      tmp = tbl[i];
+      tbl[i] = tbl[j];
+      tbl[j] = tmp;
+      host = hosttable[tbl[i]];
+      hosts[i] = host->name;
+      ports[i] = host->port[protocol]? host->port[protocol] : default_port;
+    }
+
+  err = http_race_hosts (ctrl, hosts, ports, n,
+                         ((opt.disable_ipv4? HTTP_FLAG_IGNORE_IPv4:0)
+                          |(opt.disable_ipv6? HTTP_FLAG_IGNORE_IPv6:0)),
+                         ctrl->timeout, &i, &msec);
+  if (err)
+    {
+      if (gpg_err_code (err) != GPG_ERR_NOT_SUPPORTED)
+        log_info ("no host of pool '%s' answered: %s\n",
+                  hi->name, gpg_strerror (err));
+      xfree (tbl);
+      return -1;
+    }
+
+  pidx = tbl[i];
+  xfree (tbl);
+  host = hosttable[pidx];
+  if (!msec)
+    msec = 1;
+  host->rtt = host->rtt? (7 * host->rtt + msec) / 8 : msec;
+  if (opt.verbose)
+    log_info ("selected host '%s' of pool '%s' (%ums)\n",
+              host->name, hi->name, msec);
+  return pidx;
+}
+
+
 /* Figure out if a set of DNS records looks like a pool.  */
 static int
 arecords_is_pool (dns_addrinfo_t aibuf)
@@ -455,10 +563,12 @@ hostinfo_sort_pool (hostinfo_t hi)
  * receive flags which are to be passed to http_open.  If R_HTTPHOST
  * is not NULL a malloced name of the host is stored there; this might
  * be different from R_HOST in case it has been selected from a
- * pool.  */
+ * pool.  DEFAULT_PORT is the port used to connect to pool members
+ * for which no port is known.  */
 static gpg_error_t
 map_host (ctrl_t ctrl, const char *name, const char *srvtag, int force_reselect,
-          enum ks_protocol protocol, char **r_host, char *r_portstr,
+          enum ks_protocol protocol, unsigned short default_port,
+          char **r_host, char *r_portstr,
           unsigned int *r_httpflags, char **r_httphost)
 {
   gpg_error_t err = 0;
@@ -529,21 +639,45 @@ map_host (ctrl_t ctrl, const char *name, const char *srvtag, int force_reselect,
       if (srvscount > 0)
         {
           int i;
+          const char **targets;
+          dns_addrinfo_t *dais;
+          gpg_error_t *errs;
+
           if (! is_pool)
             is_pool = srvscount > 1;
 
+          /* Resolve all targets at once so that we wait only for the
+           * slowest answer and not for the sum of them.  */
+          targets = xtrycalloc (srvscount, sizeof *targets);
+          dais = xtrycalloc (srvscount, sizeof *dais);
+          errs = xtrycalloc (srvscount, sizeof *errs);
+          if (!targets || !dais || !errs)
+            {
+              err = gpg_error_from_syserror ();
+              xfree (targets);
+              xfree (dais);
+              xfree (errs);
+              xfree (srvs);
+              return err;
+            }
+          for (i = 0; i < srvscount; i++)
+            targets[i] = srvs[i].target;
+          resolve_dns_names (ctrl, targets, srvscount, 0,
+                             AF_UNSPEC, SOCK_STREAM, dais, errs);
+
           for (i = 0; i < srvscount; i++)
             {
-              err = resolve_dns_name (ctrl, srvs[i].target, 0,
-                                      AF_UNSPEC, SOCK_STREAM,
-                                      &ai, &cname);
-              if (err)
+              if (errs[i])
                 continue;
               dirmngr_tick (ctrl);
-              add_host (ctrl, name, is_pool, ai, protocol, srvs[i].port);
+              add_host (ctrl, name, is_pool, dais[i], protocol, srvs[i].port);
               new_hosts = 1;
+              free_dns_addrinfo (dais[i]);
             }
 
+          xfree (targets);
+          xfree (dais);
+          xfree (errs);
           xfree (srvs);
         }
 
@@ -619,7 +753,9 @@ map_host (ctrl_t ctrl, const char *name, const char *srvtag, int force_reselect,
       /* Select a host if needed.  */
       if (hi->poolidx == -1)
         {
-          hi->poolidx = select_random_host (hi);
+          hi->poolidx = race_pool_hosts (ctrl, hi, protocol, default_port);
+          if (hi->poolidx == -1)
+            hi->poolidx = select_random_host (hi);
           if (hi->poolidx == -1)
             {
               log_error ("no alive host found in pool '%s'\n", name);
@@ -868,8 +1004,10 @@ ks_hkp_print_hosttable (ctrl_t ctrl)
   time_t curtime;
   char *p, *died;
   const char *diedstr;
+  char rttbuf[20];
 
-  err = ks_print_help (ctrl, "hosttable (idx, ipv6, ipv4, dead, name, time):");
+  err = ks_print_help (ctrl, "hosttable (idx, ipv6, ipv4, dead, name,"
+                       " rtt, time):");
   if (err)
     return err;
 
@@ -954,7 +1092,11 @@ ks_hkp_print_hosttable (ctrl_t ctrl)
             hi->iporname_valid = 1;
           }
 
-        err = ks_printf_help (ctrl, "%3d %s %s %s %s%s%s%s%s%s%s\n",
+        if (hi->rtt)
+          snprintf (rttbuf, sizeof rttbuf, "  %ums", hi->rtt);
+        else
+          *rttbuf = 0;
+        err = ks_printf_help (ctrl, "%3d %s %s %s %s%s%s%s%s%s%s%s\n",
                               idx,
                               hi->onion? "O" : hi->v6? "6":" ",
                               hi->v4? "4":" ",
@@ -963,6 +1105,7 @@ ks_hkp_print_hosttable (ctrl_t ctrl)
                               hi->iporname? " (":"",
                               hi->iporname? hi->iporname : "",
                               hi->iporname? ")":"",
+                              rttbuf,
                               diedstr? "  (":"",
                               diedstr? diedstr:"",
                               diedstr? ")":""   );
@@ -1076,6 +1219,7 @@ make_host_part (ctrl_t ctrl,
 
   portstr[0] = 0;
   err = map_host (ctrl, host, srvtag, force_reselect, protocol,
+                  port? port : protocol == KS_PROTOCOL_HKPS? 443 : 11371,
                   &hostname, portstr, r_httpflags, r_httphost);
 
   if (npth_mutex_unlock (&hosttable_lock))
@@ -1196,6 +1340,7 @@ ks_hkp_reload (void)
       if (!hi)
         continue;
       hi->iporname_valid = 0;
+      hi->rtt = 0;
       if (!hi->dead)
         continue;
       hi->dead = 0;
@@ -1228,12 +1373,24 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
   estream_t fp = NULL;
   char *request_buffer = NULL;
   parsed_uri_t uri = NULL;
+  http_cache_item_t citem = NULL;
+  const char *cache_url = NULL;
 
   *r_fp = NULL;
 
   err = http_parse_uri (&uri, request, 0);
   if (err)
     goto leave;
+
+  /* We always want the most recent copy from the keyserver; thus a
+   * cached response of a GET request is only used after the server
+   * told us that it has not been modified.  */
+  if (!post_cb)
+    {
+      cache_url = request;
+      citem = http_cache_lookup (cache_url);
+    }
+
   redirinfo.ctrl       = ctrl;
   redirinfo.orig_url   = request;
   redirinfo.orig_onion = uri->onion;
@@ -1273,6 +1430,8 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
          we're good with both HTTP 1.0 and 1.1.  */
       es_fputs ("Pragma: no-cache\r\n"
                 "Cache-Control: no-cache\r\n", fp);
+      if (citem)
+        http_cache_write_validators (citem, fp);
       if (post_cb)
         err = post_cb (post_cb_value, http);
       if (!err)
@@ -1332,9 +1491,23 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
         http = NULL;
         http_session_release (session);
         session = NULL;
+
+        /* The cache item is only valid for the original URL.  */
+        http_cache_release (citem);
+        citem = NULL;
+        cache_url = NULL;
       }
       goto once_more;
 
+    case 304:  /* Not modified */
+      if (!citem)
+        goto unexpected_status;
+      http_cache_update (citem, http);
+      err = http_cache_open (citem, r_fp);
+      if (r_http_status)
+        *r_http_status = 200;  /* Our caller shall see a success.  */
+      goto leave;
+
     case 501:
       err = gpg_error (GPG_ERR_NOT_IMPLEMENTED);
       goto leave;
@@ -1344,6 +1517,7 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
       goto leave;
 
     default:
+    unexpected_status:
       log_error (_("error accessing '%s': http status %u\n"),
                  request, http_get_status_code (http));
       err = gpg_error (GPG_ERR_NO_DATA);
@@ -1361,6 +1535,15 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
       goto leave;
     }
 
+  if (cache_url)
+    {
+      /* If the response has been cached we return a memory stream
+       * and the read stream is closed along with HTTP.  */
+      err = http_cache_store (cache_url, http, fp, r_fp);
+      if (err || *r_fp)
+        goto leave;
+    }
+
   /* Return the read stream and close the HTTP context.  */
   *r_fp = fp;
   http_close (http, 1);
@@ -1369,6 +1552,7 @@ send_request (ctrl_t ctrl, const char *request, const char *hostportstr,
  leave:
   http_close (http, 0);
   http_session_release (session);
+  http_cache_release (citem);
   xfree (request_buffer);
   http_release_parsed_uri (uri);
   return err;
@@ -27,6 +27,7 @@
 #include "dirmngr.h"
 #include "misc.h"
 #include "ks-engine.h"
+#include "http-cache.h"
 
 /* How many redirections do we allow.  */
 #define MAX_REDIRECTS 2
@@ -79,10 +80,21 @@ ks_http_fetch (ctrl_t ctrl, const char *url, unsigned int flags,
   char *request_buffer = NULL;
   parsed_uri_t uri = NULL;
   parsed_uri_t helpuri = NULL;
+  http_cache_item_t citem = NULL;
 
+  *r_fp = NULL;
   err = http_parse_uri (&uri, url, 0);
   if (err)
     goto leave;
+
+  /* A fresh cached response is only used if the caller did not ask
+   * for the most recent copy; a stale one is revalidated.  */
+  if ((flags & KS_HTTP_FETCH_CACHE) && (citem = http_cache_lookup (url))
+      && !(flags & KS_HTTP_FETCH_NOCACHE) && http_cache_is_fresh (citem))
+    {
+      err = http_cache_open (citem, r_fp);
+      goto leave;
+    }
   redirinfo.ctrl       = ctrl;
   redirinfo.orig_url   = url;
   redirinfo.orig_onion = uri->onion;
@@ -129,6 +141,8 @@ ks_http_fetch (ctrl_t ctrl, const char *url, unsigned int flags,
       if ((flags & KS_HTTP_FETCH_NOCACHE))
         es_fputs ("Pragma: no-cache\r\n"
                   "Cache-Control: no-cache\r\n", fp);
+      if (citem)
+        http_cache_write_validators (citem, fp);
       http_start_data (http);
       if (es_ferror (fp))
         err = gpg_error_from_syserror ();
@@ -189,6 +203,11 @@ ks_http_fetch (ctrl_t ctrl, const char *url, unsigned int flags,
         http = NULL;
         http_session_release (session);
         session = NULL;
+
+        /* The cache item is only valid for the original URL.  */
+        http_cache_release (citem);
+        citem = NULL;
+        flags &= ~KS_HTTP_FETCH_CACHE;
       }
       goto once_more;
 
@@ -196,6 +215,14 @@ ks_http_fetch (ctrl_t ctrl, const char *url, unsigned int flags,
       err = gpg_error (GPG_ERR_TOO_LARGE);
       goto leave;
 
+    case 304:  /* Not modified */
+      if (citem)
+        {
+          http_cache_update (citem, http);
+          err = http_cache_open (citem, r_fp);
+          goto leave;
+        }
+      /* fall through */
     default:
       log_error (_("error accessing '%s': http status %u\n"),
                  url, http_get_status_code (http));
@@ -210,6 +237,15 @@ ks_http_fetch (ctrl_t ctrl, const char *url, unsigned int flags,
       goto leave;
     }
 
+  if ((flags & KS_HTTP_FETCH_CACHE))
+    {
+      /* If the response has been cached we return a memory stream
+       * and the read stream is closed along with HTTP.  */
+      err = http_cache_store (url, http, fp, r_fp);
+      if (err || *r_fp)
+        goto leave;
+    }
+
   /* Return the read stream and close the HTTP context.  */
   *r_fp = fp;
   http_close (http, 1);
@@ -218,6 +254,7 @@ ks_http_fetch (ctrl_t ctrl, const char *url, unsigned int flags,
  leave:
   http_close (http, 0);
   http_session_release (session);
+  http_cache_release (citem);
   xfree (request_buffer);
   http_release_parsed_uri (uri);
   http_release_parsed_uri (helpuri);
@@ -30,11 +30,13 @@
 #include <stdlib.h>
 #include <errno.h>
 #include <assert.h>
+#include <npth.h>
 
 #ifdef _WIN32
 # include <winsock2.h>
 # include <winldap.h>
 #else
+# include <sys/socket.h>
 # ifdef NEED_LBER_H
 #  include <lber.h>
 # endif
@@ -52,6 +54,13 @@
 #ifndef HAVE_TIMEGM
 time_t timegm(struct tm *tm);
 #endif
+
+#if defined(HAVE_LDAP_CREATE_PAGE_CONTROL) \
+    && defined(HAVE_LDAP_PARSE_PAGERESPONSE_CONTROL)
+# define USE_LDAP_PAGING 1
+/* The number of search results we ask for at once.  */
+# define LDAP_PAGE_SIZE 100
+#endif
 
 /* Convert an LDAP error to a GPG error.  */
 static int
@@ -746,6 +755,272 @@ my_ldap_connect (parsed_uri_t uri, LDAP **ldap_connp,
   return err;
 }
 
+
+/* To avoid a new connect, TLS handshake and bind for each request we
+   keep a few idle connections.  A connection is only shared by
+   requests for the same server with the same credentials.  */
+#define LDAP_POOL_SIZE 8
+#define LDAP_POOL_IDLE_TIMEOUT 120  /* seconds */
+
+struct ldap_pool_item_s
+{
+  char *key;          /* The server and credentials (malloced).  */
+  LDAP *conn;         /* The connection.  */
+  int in_use;         /* The connection is used by a request.  */
+  time_t stamp;       /* The time the connection was last released.  */
+  char *basedn;       /* Values as returned by my_ldap_connect.  */
+  char *pgpkeyattr;
+  int real_ldap;
+};
+static struct ldap_pool_item_s ldap_pool[LDAP_POOL_SIZE];
+
+/* A mutex used to protect the pool.  */
+static npth_mutex_t ldap_pool_lock = NPTH_MUTEX_INITIALIZER;
+
+
+static void
+lock_ldap_pool (void)
+{
+  if (npth_mutex_lock (&ldap_pool_lock))
+    log_fatal ("failed to acquire mutex\n");
+}
+
+
+static void
+unlock_ldap_pool (void)
+{
+  if (npth_mutex_unlock (&ldap_pool_lock))
+    log_fatal ("failed to release mutex\n");
+}
+
+
+/* Close the connection of the pool item ITEM.  The pool needs to be
+   locked.  */
+static void
+release_ldap_pool_item (struct ldap_pool_item_s *item)
+{
+  if (item->conn)
+    ldap_unbind (item->conn);
+  xfree (item->key);
+  xfree (item->basedn);
+  xfree (item->pgpkeyattr);
+  memset (item, 0, sizeof *item);
+}
+
+
+/* Return true if the idle connection CONN has been closed by the
+   server.  A server may also send a notice of disconnection before
+   closing; thus any pending data means that we can't use it.  */
+static int
+ldap_conn_is_dead (LDAP *conn)
+{
+#if !defined(HAVE_W32_SYSTEM) && defined(HAVE_LDAP_GET_OPTION) \
+    && defined(LDAP_OPT_DESC)
+  int fd;
+  char c;
+  ssize_t n;
+
+  if (ldap_get_option (conn, LDAP_OPT_DESC, &fd) || fd == -1)
+    return 1;
+  n = recv (fd, &c, 1, MSG_PEEK | MSG_DONTWAIT);
+  return !(n == -1 && (errno == EAGAIN || errno == EWOULDBLOCK));
+#else
+  (void)conn;
+  return 0;
+#endif
+}
+
+
+/* Return true if the last error on CONN indicates that the
+   connection can't be used anymore.  */
+static int
+ldap_conn_is_broken (LDAP *conn)
+{
+  int code;
+
+#if defined(HAVE_LDAP_GET_OPTION) && defined(LDAP_OPT_ERROR_NUMBER)
+  if (ldap_get_option (conn, LDAP_OPT_ERROR_NUMBER, &code))
+    return 1;
+#elif defined(HAVE_LDAP_LD_ERRNO)
+  code = conn->ld_errno;
+#else
+  return 1;
+#endif
+  return (code == LDAP_SERVER_DOWN || code == LDAP_TIMEOUT
+          || code == LDAP_CONNECT_ERROR || code == LDAP_LOCAL_ERROR
+          || code == LDAP_ENCODING_ERROR || code == LDAP_DECODING_ERROR);
+}
+
+
+/* Same as my_ldap_connect but take an idle connection from the pool
+   if there is one.  The connection must be released using
+   pooled_ldap_release.  */
+static int
+pooled_ldap_connect (parsed_uri_t uri, LDAP **ldap_connp,
+                     char **basednp, char **pgpkeyattrp, int *real_ldapp)
+{
+  struct uri_tuple_s *password_param = uri_query_lookup (uri, "password");
+  struct ldap_pool_item_s *item, *found = NULL, *unused = NULL;
+  char *key, *basedn, *pgpkeyattr;
+  int real_ldap;
+  time_t now = gnupg_get_time ();
+  int err, idx;
+
+  key = xtryasprintf ("%s://%s:%d/%s?%d?%s?%s", uri->scheme, uri->host,
+                      uri->port, uri->path? uri->path : "", uri->use_tls,
+                      uri->auth? uri->auth : "",
+                      password_param? password_param->value : "");
+  if (!key)
+    return my_ldap_connect (uri, ldap_connp,
+                            basednp, pgpkeyattrp, real_ldapp);
+
+  lock_ldap_pool ();
+  for (idx=0; idx < LDAP_POOL_SIZE; idx++)
+    {
+      item = ldap_pool + idx;
+      if (item->key && !item->in_use
+          && (item->stamp + LDAP_POOL_IDLE_TIMEOUT <= now
+              || item->stamp > now || ldap_conn_is_dead (item->conn)))
+        release_ldap_pool_item (item);
+      if (!item->key)
+        {
+          if (!unused)
+            unused = item;
+        }
+      else if (!found && !item->in_use && !strcmp (item->key, key))
+        found = item;
+    }
+  if (found)
+    {
+      found->in_use = 1;
+      *ldap_connp = found->conn;
+      if (basednp)
+        *basednp = found->basedn? xstrdup (found->basedn) : NULL;
+      if (pgpkeyattrp)
+        *pgpkeyattrp = found->pgpkeyattr? xstrdup (found->pgpkeyattr) : NULL;
+      if (real_ldapp)
+        *real_ldapp = found->real_ldap;
+      unlock_ldap_pool ();
+      xfree (key);
+      log_debug ("ldap_conn: %p (reused)\n", *ldap_connp);
+      return 0;
+    }
+  if (unused)
+    unused->in_use = 1;  /* Reserve the slot.  */
+  unlock_ldap_pool ();
+
+  basedn = pgpkeyattr = NULL;
+  real_ldap = 0;
+  err = my_ldap_connect (uri, ldap_connp, &basedn, &pgpkeyattr, &real_ldap);
+
+  lock_ldap_pool ();
+  if (unused)
+    {
+      unused->in_use = 0;
+      if (!err && basedn)
+        {
+          unused->in_use = 1;
+          unused->key = key;
+          key = NULL;
+          unused->conn = *ldap_connp;
+          unused->basedn = xtrystrdup (basedn);
+          unused->pgpkeyattr = pgpkeyattr? xtrystrdup (pgpkeyattr) : NULL;
+          unused->real_ldap = real_ldap;
+          if (!unused->basedn || (pgpkeyattr && !unused->pgpkeyattr))
+            {
+              /* Don't pool it but keep the connection.  */
+              unused->conn = NULL;
+              release_ldap_pool_item (unused);
+            }
+        }
+    }
+  unlock_ldap_pool ();
+  xfree (key);
+
+  if (!err)
+    {
+      if (basednp)
+        *basednp = basedn;
+      else
+        xfree (basedn);
+      if (pgpkeyattrp)
+        *pgpkeyattrp = pgpkeyattr;
+      else
+        xfree (pgpkeyattr);
+      if (real_ldapp)
+        *real_ldapp = real_ldap;
+    }
+  return err;
+}
+
+
+/* Release the connection CONN as returned by pooled_ldap_connect.  */
+static void
+pooled_ldap_release (LDAP *conn)
+{
+  int idx;
+
+  if (!conn)
+    return;
+
+  lock_ldap_pool ();
+  for (idx=0; idx < LDAP_POOL_SIZE; idx++)
+    if (ldap_pool[idx].key && ldap_pool[idx].conn == conn)
+      break;
+  if (idx < LDAP_POOL_SIZE)
+    {
+      if (ldap_conn_is_broken (conn))
+        release_ldap_pool_item (ldap_pool + idx);
+      else
+        {
+          ldap_pool[idx].in_use = 0;
+          ldap_pool[idx].stamp = gnupg_get_time ();
+        }
+    }
+  else
+    ldap_unbind (conn);
+  unlock_ldap_pool ();
+}
+
+
+/* Close all idle connections.  With CURTIME not 0 close only
+   those which have been idle for too long.  */
+static void
+flush_ldap_pool (time_t curtime)
+{
+  struct ldap_pool_item_s *item;
+  int idx;
+
+  lock_ldap_pool ();
+  for (idx=0; idx < LDAP_POOL_SIZE; idx++)
+    {
+      item = ldap_pool + idx;
+      if (item->key && !item->in_use
+          && (!curtime || item->stamp + LDAP_POOL_IDLE_TIMEOUT <= curtime
+              || item->stamp > curtime))
+        release_ldap_pool_item (item);
+    }
+  unlock_ldap_pool ();
+}
+
+
+/* Housekeeping function called from the housekeeping thread.  It is
+   used to close idle connections.  */
+void
+ks_ldap_housekeeping (time_t curtime)
+{
+  flush_ldap_pool (curtime);
+}
+
+
+/* Reload (SIGHUP) action for this module.  We close all idle
+   connections.  */
+void
+ks_ldap_reload (void)
+{
+  flush_ldap_pool (0);
+}
+
 /* Extract keys from an LDAP reply and write them out to the output
    stream OUTPUT in a format GnuPG can import (either the OpenPGP
    binary format or armored format).  */
@@ -863,7 +1138,8 @@ ks_ldap_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec,
     return (err);
 
   /* Make sure we are talking to an OpenPGP LDAP server.  */
-  ldap_err = my_ldap_connect (uri, &ldap_conn, &basedn, &pgpkeyattr, NULL);
+  ldap_err = pooled_ldap_connect (uri,
+                                  &ldap_conn, &basedn, &pgpkeyattr, NULL);
   if (ldap_err || !basedn)
     {
       if (ldap_err)
@@ -1004,19 +1280,175 @@ ks_ldap_get (ctrl_t ctrl, parsed_uri_t uri, const char *keyspec,
   xfree (pgpkeyattr);
   xfree (basedn);
 
-  if (ldap_conn)
-    ldap_unbind (ldap_conn);
+  pooled_ldap_release (ldap_conn);
 
   xfree (filter);
 
   return err;
 }
 
-/* Search the keyserver identified by URI for keys matching PATTERN.
-   On success R_FP has an open stream to read the data.  */
+/* Write the keys found in the search result RES to FP.  The result
+   has one entry for each user id; the entries with the same certid
+   are written as one key.  Returns the number of keys written.  */
+static int
+write_search_result (LDAP *ldap_conn, LDAPMessage *res, estream_t fp)
+{
+  char **vals;
+  LDAPMessage *each;
+  int count = 0;
+  strlist_t dupelist = NULL;
+
+  for (each = ldap_first_entry (ldap_conn, res);
+       each;
+       each = ldap_next_entry (ldap_conn, each))
+    {
+      char **certid;
+      LDAPMessage *uids;
+
+      certid = ldap_get_values (ldap_conn, each, "pgpcertid");
+      if (! certid || ! certid[0])
+	continue;
+
+      /* Have we seen this certid before? */
+      if (! strlist_find (dupelist, certid[0]))
+	{
+	  add_to_strlist (&dupelist, certid[0]);
+	  count++;
+
+	  es_fprintf (fp, "pub:%s:",certid[0]);
+
+	  vals = ldap_get_values (ldap_conn, each, "pgpkeytype");
+	  if (vals)
+	    {
+	      /* The LDAP server doesn't exactly handle this
+		 well. */
+	      if (strcasecmp (vals[0], "RSA") == 0)
+		es_fputs ("1", fp);
+	      else if (strcasecmp (vals[0], "DSS/DH") == 0)
+		es_fputs ("17", fp);
+	      ldap_value_free (vals);
+	    }
+
+	  es_fputc (':', fp);
+
+	  vals = ldap_get_values (ldap_conn, each, "pgpkeysize");
+	  if (vals)
+	    {
+	      /* Not sure why, but some keys are listed with a
+		 key size of 0.  Treat that like an unknown. */
+	      if (atoi (vals[0]) > 0)
+		es_fprintf (fp, "%d", atoi (vals[0]));
+	      ldap_value_free (vals);
+	    }
+
+	  es_fputc (':', fp);
+
+	  /* YYYYMMDDHHmmssZ */
+
+	  vals = ldap_get_values (ldap_conn, each, "pgpkeycreatetime");
+	  if(vals && strlen (vals[0]) == 15)
+	    {
+	      es_fprintf (fp, "%u",
+			  (unsigned int) ldap2epochtime(vals[0]));
+	      ldap_value_free (vals);
+	    }
+
+	  es_fputc (':', fp);
+
+	  vals = ldap_get_values (ldap_conn, each, "pgpkeyexpiretime");
+	  if (vals && strlen (vals[0]) == 15)
+	    {
+	      es_fprintf (fp, "%u",
+			  (unsigned int) ldap2epochtime (vals[0]));
+	      ldap_value_free (vals);
+	    }
+
+	  es_fputc (':', fp);
+
+	  vals = ldap_get_values (ldap_conn, each, "pgprevoked");
+	  if (vals)
+	    {
+	      if (atoi (vals[0]) == 1)
+		es_fprintf (fp, "r");
+	      ldap_value_free (vals);
+	    }
+
+	  vals = ldap_get_values (ldap_conn, each, "pgpdisabled");
+	  if (vals)
+	    {
+	      if (atoi (vals[0]) ==1)
+		es_fprintf (fp, "d");
+	      ldap_value_free (vals);
+	    }
+
+#if 0
+	  /* This is not yet specified in the keyserver
+	     protocol, but may be someday. */
+	  es_fputc (':', fp);
+
+	  vals = ldap_get_values (ldap_conn, each, "modifytimestamp");
+	  if(vals && strlen (vals[0]) == 15)
+	    {
+	      es_fprintf (fp, "%u",
+			  (unsigned int) ldap2epochtime (vals[0]));
+	      ldap_value_free (vals);
+	    }
+#endif
+
+	  es_fprintf (fp, "\n");
+
+	  /* Now print all the uids that have this certid */
+	  for (uids = ldap_first_entry (ldap_conn, res);
+	       uids;
+	       uids = ldap_next_entry (ldap_conn, uids))
+	    {
+	      vals = ldap_get_values (ldap_conn, uids, "pgpcertid");
+	      if (! vals)
+		continue;
+
+	      if (strcasecmp (certid[0], vals[0]) == 0)
+		{
+		  char **uidvals;
+
+		  es_fprintf (fp, "uid:");
+
+		  uidvals = ldap_get_values (ldap_conn,
+					     uids, "pgpuserid");
+		  if (uidvals)
+		    {
+		      /* Need to escape any colons */
+		      char *quoted = percent_escape (uidvals[0], NULL);
+		      es_fputs (quoted, fp);
+		      xfree (quoted);
+		      ldap_value_free (uidvals);
+		    }
+
+		  es_fprintf (fp, "\n");
+		}
+
+	      ldap_value_free(vals);
+	    }
+	}
+
+	ldap_value_free (certid);
+    }
+
+  free_strlist (dupelist);
+  return count;
+}
+
+
+/* Search the keyserver identified by URI for keys matching PATTERN
+   and write the results to FP.  If the server supports paged results
+   (RFC-2696) each page is written as soon as it has been received;
+   thus the memory used does not depend on the number of results.
+   Because we do not know the number of results in advance, no info
+   line is written unless there are no results at all.  A key whose
+   user ids are returned on different pages is written once per
+   page.  */
 gpg_error_t
 ks_ldap_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
-		estream_t *r_fp)
+		estream_t fp)
 {
   gpg_error_t err;
   int ldap_err;
@@ -1027,8 +1459,6 @@ ks_ldap_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
 
   char *basedn = NULL;
 
-  estream_t fp = NULL;
-
   (void) ctrl;
 
   if (dirmngr_use_tor ())
@@ -1049,7 +1479,7 @@ ks_ldap_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
     }
 
   /* Make sure we are talking to an OpenPGP LDAP server.  */
-  ldap_err = my_ldap_connect (uri, &ldap_conn, &basedn, NULL, NULL);
+  ldap_err = pooled_ldap_connect (uri, &ldap_conn, &basedn, NULL, NULL);
   if (ldap_err || !basedn)
     {
       if (ldap_err)
@@ -1059,19 +1489,15 @@ ks_ldap_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
       goto out;
     }
 
-  /* Even if we have no results, we want to return a stream.  */
-  fp = es_fopenmem(0, "rw");
-  if (!fp)
-    {
-      err = gpg_error_from_syserror ();
-      goto out;
-    }
-
   {
-    char **vals;
-    LDAPMessage *res, *each;
+    LDAPMessage *res;
     int count = 0;
-    strlist_t dupelist = NULL;
+#ifdef USE_LDAP_PAGING
+    struct berval cookie = { 0, NULL };
+    LDAPControl *pagectrl, *serverctrls[2], **resctrls, *ctrl;
+    ber_int_t estimate;
+    int errcode;
+#endif
 
     /* The maximum size of the search, including the optional stuff
        and the trailing \0 */
@@ -1084,215 +1510,101 @@ ks_ldap_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
 
     log_debug ("SEARCH '%s' => '%s' BEGIN\n", pattern, filter);
 
-    ldap_err = ldap_search_s (ldap_conn, basedn,
-			      LDAP_SCOPE_SUBTREE, filter, attrs, 0, &res);
-
-    xfree (filter);
-    filter = NULL;
-
-    if (ldap_err != LDAP_SUCCESS && ldap_err != LDAP_SIZELIMIT_EXCEEDED)
+    do
       {
-	err = ldap_err_to_gpg_err (ldap_err);
-
-	log_error ("SEARCH %s FAILED %d\n", pattern, err);
-	log_error ("gpgkeys: LDAP search error: %s\n",
-		   ldap_err2string (err));
-	goto out;
-    }
-
-    /* The LDAP server doesn't return a real count of unique keys, so we
-       can't use ldap_count_entries here. */
-    for (each = ldap_first_entry (ldap_conn, res);
-	 each;
-	 each = ldap_next_entry (ldap_conn, each))
-      {
-	char **certid = ldap_get_values (ldap_conn, each, "pgpcertid");
-	if (certid && certid[0] && ! strlist_find (dupelist, certid[0]))
+	res = NULL;
+#ifdef USE_LDAP_PAGING
+	/* The control is not critical so that servers without paging
+	   support return all results at once.  */
+	ldap_err = ldap_create_page_control (ldap_conn, LDAP_PAGE_SIZE,
+					     &cookie, 0, &pagectrl);
+	if (ldap_err)
 	  {
-	    add_to_strlist (&dupelist, certid[0]);
-	    count++;
+	    err = ldap_err_to_gpg_err (ldap_err);
+	    log_error ("gpgkeys: LDAP paging error: %s\n",
+		       ldap_err2string (ldap_err));
+	    break;
 	  }
-      }
-
-    if (ldap_err == LDAP_SIZELIMIT_EXCEEDED)
-      {
-	if (count == 1)
-	  log_error ("gpgkeys: search results exceeded server limit."
-		     "  First 1 result shown.\n");
-	else
-	  log_error ("gpgkeys: search results exceeded server limit."
-		     "  First %d results shown.\n", count);
-      }
+	serverctrls[0] = pagectrl;
+	serverctrls[1] = NULL;
+	ldap_err = ldap_search_ext_s (ldap_conn, basedn, LDAP_SCOPE_SUBTREE,
+				      filter, attrs, 0, serverctrls, NULL,
+				      NULL, LDAP_NO_LIMIT, &res);
+	ldap_control_free (pagectrl);
+	ber_memfree (cookie.bv_val);
+	cookie.bv_val = NULL;
+	cookie.bv_len = 0;
+#else
+	ldap_err = ldap_search_s (ldap_conn, basedn,
+				  LDAP_SCOPE_SUBTREE, filter, attrs, 0, &res);
+#endif
 
-    free_strlist (dupelist);
-    dupelist = NULL;
+	if (ldap_err != LDAP_SUCCESS && ldap_err != LDAP_SIZELIMIT_EXCEEDED)
+	  {
+	    err = ldap_err_to_gpg_err (ldap_err);
 
-    if (count < 1)
-      es_fputs ("info:1:0\n", fp);
-    else
-      {
-	es_fprintf (fp, "info:1:%d\n", count);
+	    log_error ("SEARCH %s FAILED %d\n", pattern, err);
+	    log_error ("gpgkeys: LDAP search error: %s\n",
+		       ldap_err2string (err));
+	    if (res)
+	      ldap_msgfree (res);
+	    break;
+	  }
 
-	for (each = ldap_first_entry (ldap_conn, res);
-	     each;
-	     each = ldap_next_entry (ldap_conn, each))
+	count += write_search_result (ldap_conn, res, fp);
+
+#ifdef USE_LDAP_PAGING
+	/* Get the cookie for the next page.  */
+	resctrls = NULL;
+	if (ldap_err == LDAP_SUCCESS
+	    && !ldap_parse_result (ldap_conn, res, &errcode, NULL, NULL, NULL,
+				   &resctrls, 0)
+	    && resctrls
+	    && (ctrl = ldap_control_find (LDAP_CONTROL_PAGEDRESULTS,
+					  resctrls, NULL))
+	    && ldap_parse_pageresponse_control (ldap_conn, ctrl,
+						&estimate, &cookie))
 	  {
-	    char **certid;
-	    LDAPMessage *uids;
-
-	    certid = ldap_get_values (ldap_conn, each, "pgpcertid");
-	    if (! certid || ! certid[0])
-	      continue;
-
-	    /* Have we seen this certid before? */
-	    if (! strlist_find (dupelist, certid[0]))
-	      {
-		add_to_strlist (&dupelist, certid[0]);
-
-		es_fprintf (fp, "pub:%s:",certid[0]);
-
-		vals = ldap_get_values (ldap_conn, each, "pgpkeytype");
-		if (vals)
-		  {
-		    /* The LDAP server doesn't exactly handle this
-		       well. */
-		    if (strcasecmp (vals[0], "RSA") == 0)
-		      es_fputs ("1", fp);
-		    else if (strcasecmp (vals[0], "DSS/DH") == 0)
-		      es_fputs ("17", fp);
-		    ldap_value_free (vals);
-		  }
-
-		es_fputc (':', fp);
-
-		vals = ldap_get_values (ldap_conn, each, "pgpkeysize");
-		if (vals)
-		  {
-		    /* Not sure why, but some keys are listed with a
-		       key size of 0.  Treat that like an unknown. */
-		    if (atoi (vals[0]) > 0)
-		      es_fprintf (fp, "%d", atoi (vals[0]));
-		    ldap_value_free (vals);
-		  }
-
-		es_fputc (':', fp);
-
-		/* YYYYMMDDHHmmssZ */
-
-		vals = ldap_get_values (ldap_conn, each, "pgpkeycreatetime");
-		if(vals && strlen (vals[0]) == 15)
-		  {
-		    es_fprintf (fp, "%u",
-				(unsigned int) ldap2epochtime(vals[0]));
-		    ldap_value_free (vals);
-		  }
-
-		es_fputc (':', fp);
-
-		vals = ldap_get_values (ldap_conn, each, "pgpkeyexpiretime");
-		if (vals && strlen (vals[0]) == 15)
-		  {
-		    es_fprintf (fp, "%u",
-				(unsigned int) ldap2epochtime (vals[0]));
-		    ldap_value_free (vals);
-		  }
-
-		es_fputc (':', fp);
-
-		vals = ldap_get_values (ldap_conn, each, "pgprevoked");
-		if (vals)
-		  {
-		    if (atoi (vals[0]) == 1)
-		      es_fprintf (fp, "r");
-		    ldap_value_free (vals);
-		  }
-
-		vals = ldap_get_values (ldap_conn, each, "pgpdisabled");
-		if (vals)
-		  {
-		    if (atoi (vals[0]) ==1)
-		      es_fprintf (fp, "d");
-		    ldap_value_free (vals);
-		  }
-
-#if 0
-		/* This is not yet specified in the keyserver
-		   protocol, but may be someday. */
-		es_fputc (':', fp);
-
-		vals = ldap_get_values (ldap_conn, each, "modifytimestamp");
-		if(vals && strlen (vals[0]) == 15)
-		  {
-		    es_fprintf (fp, "%u",
-				(unsigned int) ldap2epochtime (vals[0]));
-		    ldap_value_free (vals);
-		  }
+	    cookie.bv_val = NULL;
+	    cookie.bv_len = 0;
+	  }
+	if (resctrls)
+	  ldap_controls_free (resctrls);
 #endif
+	ldap_msgfree (res);
 
-		es_fprintf (fp, "\n");
-
-		/* Now print all the uids that have this certid */
-		for (uids = ldap_first_entry (ldap_conn, res);
-		     uids;
-		     uids = ldap_next_entry (ldap_conn, uids))
-		  {
-		    vals = ldap_get_values (ldap_conn, uids, "pgpcertid");
-		    if (! vals)
-		      continue;
-
-		    if (strcasecmp (certid[0], vals[0]) == 0)
-		      {
-			char **uidvals;
-
-			es_fprintf (fp, "uid:");
-
-			uidvals = ldap_get_values (ldap_conn,
-						   uids, "pgpuserid");
-			if (uidvals)
-			  {
-			    /* Need to escape any colons */
-			    char *quoted = percent_escape (uidvals[0], NULL);
-			    es_fputs (quoted, fp);
-			    xfree (quoted);
-			    ldap_value_free (uidvals);
-			  }
-
-			es_fprintf (fp, "\n");
-		      }
-
-		    ldap_value_free(vals);
-		  }
-	      }
-
-	      ldap_value_free (certid);
+	if (ldap_err == LDAP_SIZELIMIT_EXCEEDED)
+	  {
+	    if (count == 1)
+	      log_error ("gpgkeys: search results exceeded server limit."
+			 "  First 1 result shown.\n");
+	    else
+	      log_error ("gpgkeys: search results exceeded server limit."
+			 "  First %d results shown.\n", count);
 	  }
       }
+#ifdef USE_LDAP_PAGING
+    while (ldap_err == LDAP_SUCCESS && cookie.bv_len);
+    ber_memfree (cookie.bv_val);
+#else
+    while (0);
+#endif
 
-    ldap_msgfree (res);
-    free_strlist (dupelist);
+    xfree (filter);
+    filter = NULL;
+
+    if (!err && count < 1)
+      es_fputs ("info:1:0\n", fp);
+    if (!err && es_ferror (fp))
+      err = gpg_error_from_syserror ();
   }
 
   log_debug ("SEARCH %s END\n", pattern);
 
  out:
-  if (err)
-    {
-      if (fp)
-	es_fclose (fp);
-    }
-  else
-    {
-      /* Return the read stream.  */
-      if (fp)
-	es_fseek (fp, 0, SEEK_SET);
-
-      *r_fp = fp;
-    }
-
   xfree (basedn);
 
-  if (ldap_conn)
-    ldap_unbind (ldap_conn);
+  pooled_ldap_release (ldap_conn);
 
   xfree (filter);
 
@@ -1901,8 +2213,8 @@ ks_ldap_put (ctrl_t ctrl, parsed_uri_t uri,
       return gpg_error (GPG_ERR_NOT_SUPPORTED);
     }
 
-  ldap_err = my_ldap_connect (uri,
-                              &ldap_conn, &basedn, &pgpkeyattr, &real_ldap);
+  ldap_err = pooled_ldap_connect (uri, &ldap_conn,
+                                  &basedn, &pgpkeyattr, &real_ldap);
   if (ldap_err || !basedn)
     {
       if (ldap_err)
@@ -2071,8 +2383,7 @@ ks_ldap_put (ctrl_t ctrl, parsed_uri_t uri,
   if (dump)
     es_fclose (dump);
 
-  if (ldap_conn)
-    ldap_unbind (ldap_conn);
+  pooled_ldap_release (ldap_conn);
 
   xfree (basedn);
   xfree (pgpkeyattr);
@@ -47,6 +47,7 @@ gpg_error_t ks_hkp_put (ctrl_t ctrl, parsed_uri_t uri,
 #define KS_HTTP_FETCH_TRUST_CFG       2  /* Requests HTTP_FLAG_TRUST_CFG.  */
 #define KS_HTTP_FETCH_NO_CRL          4  /* Requests HTTP_FLAG_NO_CRL.     */
 #define KS_HTTP_FETCH_ALLOW_DOWNGRADE 8  /* Allow redirect https -> http.  */
+#define KS_HTTP_FETCH_CACHE          16  /* Use the HTTP response cache.  */
 
 gpg_error_t ks_http_help (ctrl_t ctrl, parsed_uri_t uri);
 gpg_error_t ks_http_fetch (ctrl_t ctrl, const char *url, unsigned int flags,
@@ -64,7 +65,7 @@ gpg_error_t ks_kdns_fetch (ctrl_t ctrl, parsed_uri_t uri, estream_t *r_fp);
 /*-- ks-engine-ldap.c --*/
 gpg_error_t ks_ldap_help (ctrl_t ctrl, parsed_uri_t uri);
 gpg_error_t ks_ldap_search (ctrl_t ctrl, parsed_uri_t uri, const char *pattern,
-			    estream_t *r_fp);
+			    estream_t outfp);
 gpg_error_t ks_ldap_get (ctrl_t ctrl, parsed_uri_t uri,
 			 const char *keyspec, estream_t *r_fp);
 gpg_error_t ks_ldap_put (ctrl_t ctrl, parsed_uri_t uri,
@@ -34,6 +34,9 @@
 /* The maximum size we allow as a response from an OCSP reponder. */
 #define MAX_RESPONSE_SIZE 65536
 
+/* The maximum number of OCSP results we keep in memory.  */
+#define OCSP_CACHE_MAX_ITEMS 1024
+
 
 static const char oidstr_ocsp[] = "1.3.6.1.5.5.7.48.1";
 
@@ -47,6 +50,174 @@ static const char oidstr_ocsp[] = "1.3.6.1.5.5.7.48.1";
 /* static const char oidstr_certHash[] = "1.3.36.8.3.13"; */
 
 
+/* A cached result of an OCSP check.  The results are kept until the
+   nextUpdate time given by the responder; responses without a
+   nextUpdate are not cached.  Because nPth threads are not preempted
+   and the cache functions do not block, no lock is required.  */
+struct ocsp_cache_item_s
+{
+  struct ocsp_cache_item_s *next;
+  time_t expires;
+  gpg_error_t err;        /* 0 or GPG_ERR_CERT_REVOKED.  */
+  char key[1];            /* See make_ocsp_cache_key.  */
+};
+typedef struct ocsp_cache_item_s *ocsp_cache_item_t;
+
+/* The list of items with the most recently used first.  */
+static ocsp_cache_item_t ocsp_cache;
+static unsigned int ocsp_cache_count;
+
+
+
+/* Remove all items from the OCSP cache.  */
+void
+ocsp_cache_flush (void)
+{
+  while (ocsp_cache)
+    {
+      ocsp_cache_item_t tmp = ocsp_cache->next;
+      xfree (ocsp_cache);
+      ocsp_cache = tmp;
+    }
+  ocsp_cache_count = 0;
+}
+
+
+/* Return the cache key for CERT issued by ISSUER_CERT or NULL on
+   error.  Like the CertID of an OCSP request the key identifies the
+   issuer not only by its name but also by its certificate; thus CAs
+   with the same name, for example after a re-key, do not share
+   results.  The key includes the responder mode because the default
+   responder may return a different answer.  */
+static char *
+make_ocsp_cache_key (ksba_cert_t cert, ksba_cert_t issuer_cert,
+                     int default_responder)
+{
+  char *issuer, *issuer_hash, *serial, *key;
+  char issuer_fpr[41];
+  ksba_sexp_t sn;
+  gcry_md_hd_t md;
+
+  if (gcry_md_open (&md, GCRY_MD_SHA1, 0))
+    return NULL;
+  if (ksba_cert_hash (issuer_cert, 0, HASH_FNC, md))
+    {
+      gcry_md_close (md);
+      return NULL;
+    }
+  bin2hex (gcry_md_read (md, GCRY_MD_SHA1), 20, issuer_fpr);
+  gcry_md_close (md);
+
+  issuer = ksba_cert_get_issuer (cert, 0);
+  sn = ksba_cert_get_serial (cert);
+  if (!issuer || !sn)
+    {
+      ksba_free (issuer);
+      ksba_free (sn);
+      return NULL;
+    }
+  issuer_hash = hashify_data (issuer, strlen (issuer));
+  serial = serial_hex (sn);
+  ksba_free (issuer);
+  ksba_free (sn);
+  key = (issuer_hash && serial)? strconcat (default_responder? "d:":"c:",
+                                            issuer_hash, ":", issuer_fpr,
+                                            ":", serial, NULL)
+                               : NULL;
+  xfree (issuer_hash);
+  xfree (serial);
+  return key;
+}
+
+
+/* Look up KEY in the OCSP cache.  Returns true and stores the cached
+   result at R_ERR if a fresh item was found.  */
+static int
+ocsp_cache_lookup (const char *key, gpg_error_t *r_err)
+{
+  ocsp_cache_item_t item, *itemp;
+
+  for (itemp = &ocsp_cache; (item = *itemp); itemp = &item->next)
+    if (!strcmp (item->key, key))
+      break;
+  if (!item)
+    return 0;
+
+  *itemp = item->next;
+  if (item->expires <= gnupg_get_time ())
+    {
+      xfree (item);
+      ocsp_cache_count--;
+      return 0;
+    }
+  /* Move to the head.  */
+  item->next = ocsp_cache;
+  ocsp_cache = item;
+  *r_err = item->err;
+  return 1;
+}
+
+
+/* Store the result ERR for KEY which is valid until the ISO time
+   NEXT_UPDATE in the OCSP cache.  */
+static void
+ocsp_cache_put (const char *key, gpg_error_t err,
+                const ksba_isotime_t next_update)
+{
+  ocsp_cache_item_t item, *itemp;
+  time_t expires;
+
+  expires = *next_update? isotime2epoch (next_update) : (time_t)(-1);
+  if (expires == (time_t)(-1) || expires <= gnupg_get_time ())
+    return;
+
+  for (itemp = &ocsp_cache; (item = *itemp); itemp = &item->next)
+    if (!strcmp (item->key, key))
+      {
+        *itemp = item->next;
+        xfree (item);
+        ocsp_cache_count--;
+        break;
+      }
+  if (ocsp_cache_count >= OCSP_CACHE_MAX_ITEMS)
+    {
+      /* Remove the least recently used item.  */
+      for (itemp = &ocsp_cache; (*itemp)->next; itemp = &(*itemp)->next)
+        ;
+      xfree (*itemp);
+      *itemp = NULL;
+      ocsp_cache_count--;
+    }
+
+  item = xtrymalloc (sizeof *item + strlen (key));
+  if (!item)
+    return;
+  strcpy (item->key, key);
+  item->expires = expires;
+  item->err = err;
+  item->next = ocsp_cache;
+  ocsp_cache = item;
+  ocsp_cache_count++;
+}
+
+
+/* Invalidate the cached validation status of the revoked CERT.  */
+static void
+clear_validated_at (ksba_cert_t cert)
+{
+  gpg_error_t err;
+  time_t validated_at = 0; /* That is: No cached validation available. */
+
+  err = ksba_cert_set_user_data (cert, "validated_at",
+                                 &validated_at, sizeof (validated_at));
+  if (err)
+    log_error ("set_user_data(validated_at) failed: %s\n",
+               gpg_strerror (err));
+  /* The certificate is anyway revoked, and that is a more important
+     message than the failure of our cache.  */
+}
+
+
 
 
 /* Read from FP and return a newly allocated buffer in R_BUFFER with the
@@ -611,6 +782,7 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
   char *oid;
   ksba_name_t name;
   fingerprint_list_t default_signer = NULL;
+  char *cache_key = NULL;
 
   /* Get the certificate.  */
   if (cert)
@@ -643,6 +815,19 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
         }
     }
 
+  /* Use a cached result if we have one.  */
+  cache_key = make_ocsp_cache_key (cert, issuer_cert,
+                                   force_default_responder);
+  if (cache_key && ocsp_cache_lookup (cache_key, &err))
+    {
+      if (opt.verbose)
+        log_info ("using cached OCSP status: %s\n",
+                  err? _("revoked") : _("good"));
+      if (err)
+        clear_validated_at (cert);
+      goto leave;
+    }
+
   /* Create an OCSP instance.  */
   err = ksba_ocsp_new (&ocsp);
   if (err)
@@ -769,19 +954,7 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
   /* In case the certificate has been revoked, we better invalidate
      our cached validation status. */
   if (status == KSBA_STATUS_REVOKED)
-    {
-      time_t validated_at = 0; /* That is: No cached validation available. */
-      err = ksba_cert_set_user_data (cert, "validated_at",
-                                     &validated_at, sizeof (validated_at));
-      if (err)
-        {
-          log_error ("set_user_data(validated_at) failed: %s\n",
-                     gpg_strerror (err));
-          err = 0; /* The certificate is anyway revoked, and that is a
-                      more important message than the failure of our
-                      cache. */
-        }
-    }
+    clear_validated_at (cert);
 
 
   if (opt.verbose)
@@ -863,6 +1036,12 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
         }
     }
 
+  /* Cache good and revoked states so that we do not need to ask the
+     responder again until it has new information.  */
+  if (cache_key
+      && (!err || gpg_err_code (err) == GPG_ERR_CERT_REVOKED))
+    ocsp_cache_put (cache_key, err, next_update);
+
 
  leave:
   gcry_md_close (md);
@@ -872,6 +1051,7 @@ ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
   ksba_cert_release (cert);
   ksba_ocsp_release (ocsp);
   xfree (url_buffer);
+  xfree (cache_key);
   return err;
 }
 
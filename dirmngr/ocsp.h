@@ -25,6 +25,9 @@
 gpg_error_t ocsp_isvalid (ctrl_t ctrl, ksba_cert_t cert, const char *cert_fpr,
                           int force_default_responder);
 
+/* Remove all cached OCSP results.  */
+void ocsp_cache_flush (void);
+
 /* Release the list of OCSP certificates hold in the CTRL object. */
 void release_ctrl_ocsp_certs (ctrl_t ctrl);
 
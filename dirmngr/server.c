@@ -57,6 +57,7 @@
 #include "../common/mbox-util.h"
 #include "../common/zb32.h"
 #include "../common/server-help.h"
+#include "../common/metrics.h"
 
 /* To avoid DoS attacks we limit the size of a certificate to
    something reasonable.  The DoS was actually only an issue back when
@@ -113,6 +114,9 @@ struct server_local_s
   size_t inhibit_data_logging_count;
   unsigned int inhibit_data_logging : 1;
   unsigned int inhibit_data_logging_now : 1;
+
+  /* The time the current command started for the metrics.  */
+  unsigned long long cmd_start;
 };
 
 
@@ -873,7 +877,8 @@ proc_wkd_get (ctrl_t ctrl, assuan_context_t ctx, char *line)
    * support WKD.  */
   if (is_wkd_query)
     {
-      if (domaininfo_is_wkd_not_supported (domain_orig))
+      if (domaininfo_is_wkd_not_supported (domain_orig)
+          || domaininfo_is_mbox_not_found (mbox, domain_orig))
         {
           err = gpg_error (GPG_ERR_NO_DATA);
           dirmngr_status_printf (ctrl, "NOTE", "wkd_cached_result %u", err);
@@ -1053,7 +1058,9 @@ proc_wkd_get (ctrl_t ctrl, assuan_context_t ctx, char *line)
             ctrl->server_local->inhibit_data_logging_now = 0;
             ctrl->server_local->inhibit_data_logging_count = 0;
           }
-        err = ks_action_fetch (ctrl, uri, outfp);
+        /* A WKD response may be taken from the cache as long as the
+         * server considers it fresh.  */
+        err = ks_action_fetch (ctrl, uri, KS_HTTP_FETCH_CACHE, outfp);
         es_fclose (outfp);
         if (ctrl->server_local)
           ctrl->server_local->inhibit_data_logging = 0;
@@ -1075,6 +1082,7 @@ proc_wkd_get (ctrl_t ctrl, assuan_context_t ctx, char *line)
               {
                 /* Mark that and schedule a check.  */
                 domaininfo_set_wkd_not_found (domain_orig);
+                domaininfo_set_mbox_not_found (mbox, domain_orig);
                 workqueue_add_task (task_check_wkd_support, domain_orig,
                                     ctrl->server_local->session_id, 1);
               }
@@ -1508,6 +1516,7 @@ lookup_cert_by_url (assuan_context_t ctx, const char *url)
   gpg_error_t err = 0;
   unsigned char *value = NULL;
   size_t valuelen;
+  ksba_cert_t cert;
 
   /* Fetch single certificate given it's URL.  */
   err = fetch_cert_by_url (ctrl, url, &value, &valuelen);
@@ -1517,6 +1526,16 @@ lookup_cert_by_url (assuan_context_t ctx, const char *url)
       goto leave;
     }
 
+  /* The URL is usually taken from the authorityInfoAccess of a
+   * certificate and thus this is an intermediate certificate which
+   * we keep for our own chain lookups.  */
+  if (!ksba_cert_new (&cert))
+    {
+      if (!ksba_cert_init_from_mem (cert, value, valuelen))
+        cert_cache_store_intermediate (cert);
+      ksba_cert_release (cert);
+    }
+
   /* Send the data, flush the buffer and then send an END. */
   err = assuan_send_data (ctx, value, valuelen);
   if (!err)
@@ -2499,7 +2518,9 @@ cmd_ks_fetch (assuan_context_t ctx, char *line)
       ctrl->server_local->inhibit_data_logging = 1;
       ctrl->server_local->inhibit_data_logging_now = 0;
       ctrl->server_local->inhibit_data_logging_count = 0;
-      err = ks_action_fetch (ctrl, line, outfp);
+      err = ks_action_fetch (ctrl, line,
+                             KS_HTTP_FETCH_NOCACHE | KS_HTTP_FETCH_CACHE,
+                             outfp);
       es_fclose (outfp);
       ctrl->server_local->inhibit_data_logging = 0;
     }
@@ -2598,6 +2619,45 @@ cmd_loadswdb (assuan_context_t ctx, char *line)
 
 
 
+/* Collector for the metrics.  */
+static void
+collect_metrics (void)
+{
+  unsigned int threads, queued, max_queued, items;
+  unsigned long total_queued, paused, hits, misses;
+
+  dirmngr_get_connection_stats (&threads, &queued, &max_queued,
+                                &total_queued, &paused);
+  gnupg_metric_set (gnupg_metric_gauge ("connections"), threads);
+  gnupg_metric_set (gnupg_metric_gauge ("connection_queue_length"), queued);
+  gnupg_metric_set (gnupg_metric_gauge ("connection_queue_max_length"),
+                    max_queued);
+  gnupg_metric_set (gnupg_metric_counter ("connections_queued"),
+                    total_queued);
+  gnupg_metric_set (gnupg_metric_counter ("connection_queue_paused"), paused);
+
+  get_dns_cache_stats (&items, &hits, &misses);
+  gnupg_metric_set (gnupg_metric_gauge ("dns_cache_items"), items);
+  gnupg_metric_set (gnupg_metric_get (GNUPG_METRIC_COUNTER,
+                                      "dns_cache_lookups",
+                                      "result=\"hit\""), hits);
+  gnupg_metric_set (gnupg_metric_get (GNUPG_METRIC_COUNTER,
+                                      "dns_cache_lookups",
+                                      "result=\"miss\""), misses);
+
+  http_get_conn_pool_stats (&items, &hits, &misses);
+  gnupg_metric_set (gnupg_metric_gauge ("http_idle_connections"), items);
+  gnupg_metric_set (gnupg_metric_get (GNUPG_METRIC_COUNTER,
+                                      "http_connection_reuse",
+                                      "result=\"hit\""), hits);
+  gnupg_metric_set (gnupg_metric_get (GNUPG_METRIC_COUNTER,
+                                      "http_connection_reuse",
+                                      "result=\"miss\""), misses);
+
+  cert_cache_collect_metrics ();
+}
+
+
 static const char hlp_getinfo[] =
   "GETINFO <what>\n"
   "\n"
@@ -2608,6 +2668,9 @@ static const char hlp_getinfo[] =
   "pid         - Return the process id of the server.\n"
   "tor         - Return OK if running in Tor mode\n"
   "dnsinfo     - Return info about the DNS resolver\n"
+  "dnscache    - Return statistics about the DNS cache\n"
+  "connections - Return statistics about the connection queue\n"
+  "metrics     - Return the metrics in the Prometheus text format\n"
   "socket_name - Return the name of the socket.\n"
   "session_id  - Return the current session_id.\n"
   "workqueue   - Inspect the work queue\n"
@@ -2674,6 +2737,40 @@ cmd_getinfo (assuan_context_t ctx, char *line)
         }
       err = 0;
     }
+  else if (!strcmp (line, "dnscache"))
+    {
+      unsigned int items;
+      unsigned long hits, misses;
+
+      get_dns_cache_stats (&items, &hits, &misses);
+      snprintf (numbuf, sizeof numbuf, "%u %lu %lu", items, hits, misses);
+      err = assuan_send_data (ctx, numbuf, strlen (numbuf));
+    }
+  else if (!strcmp (line, "connections"))
+    {
+      unsigned int threads, queued, max_queued;
+      unsigned long total_queued, paused;
+
+      dirmngr_get_connection_stats (&threads, &queued, &max_queued,
+                                    &total_queued, &paused);
+      snprintf (numbuf, sizeof numbuf, "%u %u %u %lu %lu",
+                threads, queued, max_queued, total_queued, paused);
+      err = assuan_send_data (ctx, numbuf, strlen (numbuf));
+    }
+  else if (!strcmp (line, "metrics"))
+    {
+      char *buf;
+
+      gnupg_metrics_add_collector (collect_metrics);
+      buf = gnupg_metrics_format ("dirmngr");
+      if (!buf)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = assuan_send_data (ctx, buf, strlen (buf));
+          xfree (buf);
+        }
+    }
   else if (!strcmp (line, "workqueue"))
     {
       workqueue_dump_queue (ctrl);
@@ -2813,6 +2910,32 @@ reset_notify (assuan_context_t ctx, char *line)
 }
 
 
+/* Called by libassuan before all commands.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)cmd;
+
+  ctrl->server_local->cmd_start = gnupg_metrics_now ();
+  return 0;
+}
+
+
+/* Called by libassuan after all commands.  */
+static void
+post_cmd_notify (assuan_context_t ctx, gpg_error_t err)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)err;
+
+  gnupg_metrics_command_done (assuan_get_command_name (ctx),
+                              ctrl->server_local->cmd_start);
+}
+
+
 /* This function is called by our assuan log handler to test whether a
  * log message shall really be printed.  The function must return
  * false to inhibit the logging of MSG.  CAT gives the requested log
@@ -2917,6 +3040,8 @@ start_command_handler (assuan_fd_t fd, unsigned int session_id)
   assuan_set_hello_line (ctx, hello_line);
   assuan_register_option_handler (ctx, option_handler);
   assuan_register_reset_notify (ctx, reset_notify);
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
+  assuan_register_post_cmd_notify (ctx, post_cmd_notify);
 
   ctrl->server_local->session_id = session_id;
 
@@ -504,6 +504,19 @@ write_fake_data (IOBUF out, gcry_mpi_t a)
 }
 
 
+/* Return the number of bytes write_fake_data writes for A.  */
+static unsigned int
+fake_data_length (gcry_mpi_t a)
+{
+  unsigned int n;
+
+  if (!a || !gcry_mpi_get_flag (a, GCRYMPI_FLAG_OPAQUE)
+      || !gcry_mpi_get_opaque (a, &n))
+    return 0;
+  return (n+7)/8;
+}
+
+
 /* Write a ring trust meta packet.  */
 static gpg_error_t
 do_ring_trust (iobuf_t out, PKT_ring_trust *rt)
@@ -577,6 +590,94 @@ do_user_id( IOBUF out, int ctb, PKT_user_id *uid )
 }
 
 
+/* Write the NPKEY public parameters of PK to OUT.  If R_NWRITTEN is
+ * not NULL the number of bytes written is stored there.  To only get
+ * the number of bytes which would be written, NULL may be passed for
+ * OUT.  */
+static gpg_error_t
+write_pubkey_params (iobuf_t out, PKT_public_key *pk, int npkey,
+                     unsigned int *r_nwritten)
+{
+  gpg_error_t err = 0;
+  unsigned int nwritten = 0;
+  unsigned int n, nbits;
+  int i;
+
+  for (i=0; i < npkey && !err; i++ )
+    {
+      n = 0;
+      if (   (pk->pubkey_algo == PUBKEY_ALGO_ECDSA && (i == 0))
+          || (pk->pubkey_algo == PUBKEY_ALGO_EDDSA && (i == 0))
+          || (pk->pubkey_algo == PUBKEY_ALGO_ECDH  && (i == 0 || i == 2)))
+        {
+          if (out)
+            err = gpg_mpi_write_nohdr (out, pk->pkey[i]);
+          else if (!gcry_mpi_get_flag (pk->pkey[i], GCRYMPI_FLAG_OPAQUE))
+            err = gpg_error (GPG_ERR_BAD_MPI);
+          if (!err && gcry_mpi_get_opaque (pk->pkey[i], &nbits))
+            n = (nbits+7)/8;
+        }
+      else if (pk->pubkey_algo == PUBKEY_ALGO_ECDSA
+               || pk->pubkey_algo == PUBKEY_ALGO_EDDSA
+               || pk->pubkey_algo == PUBKEY_ALGO_ECDH)
+        err = sos_write (out, pk->pkey[i], &n);
+      else
+        err = gpg_mpi_write (out, pk->pkey[i], &n);
+      nwritten += n;
+    }
+
+  if (r_nwritten)
+    *r_nwritten = nwritten;
+  return err;
+}
+
+
+/* Serialize the public key PK which has no secret parts.  This is
+ * the common case of do_key.  The length of the body is computed
+ * first so that the packet can be written to OUT without a temporary
+ * buffer.  */
+static int
+do_public_key (iobuf_t out, int ctb, PKT_public_key *pk)
+{
+  gpg_error_t err;
+  int npkey;
+  unsigned int pkbytes = 0;
+  u32 len;
+  int is_v5;
+
+  is_v5 = (pk->version == 5);
+  npkey = pubkey_get_npkey (pk->pubkey_algo);
+
+  /* If we don't have any public parameters the parameters are
+   * stored as one blob in a faked (opaque) MPI; that blob is not
+   * counted as public key material.  */
+  if (!npkey)
+    len = fake_data_length (pk->pkey[0]);
+  else
+    {
+      err = write_pubkey_params (NULL, pk, npkey, &pkbytes);
+      if (err)
+        return err;
+      len = pkbytes;
+    }
+  len += 1; /* version number  */
+  len += 4; /* timestamp  */
+  len += 1; /* algo  */
+  if (is_v5)
+    len += 4; /* public key material count  */
+
+  write_header2 (out, ctb, len, 0);
+  iobuf_put (out, pk->version? pk->version : 4); /* version number  */
+  write_32 (out, pk->timestamp );
+  iobuf_put (out, pk->pubkey_algo);  /* algo */
+  if (is_v5)
+    write_32 (out, pkbytes);        /* public key material count  */
+  if (!npkey)
+    return write_fake_data (out, pk->pkey[0]);
+  return write_pubkey_params (out, pk, npkey, NULL);
+}
+
+
 /* Serialize the key (RFC 4880, Section 5.5) described by PK and write
  * it to OUT.
  *
@@ -605,6 +706,9 @@ do_key (iobuf_t out, int ctb, PKT_public_key *pk)
               || ctb_pkttype (ctb) == PKT_SECRET_KEY
               || ctb_pkttype (ctb) == PKT_SECRET_SUBKEY);
 
+  if (!pk->seckey_info)
+    return do_public_key (out, ctb, pk);
+
   /* The length of the body is stored in the packet's header, which
    * occurs before the body.  Unfortunately, we don't know the length
    * of the packet's body until we've written all of the data!  To
@@ -633,21 +737,10 @@ do_key (iobuf_t out, int ctb, PKT_public_key *pk)
     }
   log_assert (npkey < nskey);
 
-  for (i=0; i < npkey; i++ )
-    {
-      if (   (pk->pubkey_algo == PUBKEY_ALGO_ECDSA && (i == 0))
-          || (pk->pubkey_algo == PUBKEY_ALGO_EDDSA && (i == 0))
-          || (pk->pubkey_algo == PUBKEY_ALGO_ECDH  && (i == 0 || i == 2)))
-        err = gpg_mpi_write_nohdr (a, pk->pkey[i]);
-      else if (pk->pubkey_algo == PUBKEY_ALGO_ECDSA
-               || pk->pubkey_algo == PUBKEY_ALGO_EDDSA
-               || pk->pubkey_algo == PUBKEY_ALGO_ECDH)
-        err = sos_write (a, pk->pkey[i], NULL);
-      else
-        err = gpg_mpi_write (a, pk->pkey[i], NULL);
-      if (err)
-        goto leave;
-    }
+  err = write_pubkey_params (a, pk, npkey, NULL);
+  if (err)
+    goto leave;
+  i = npkey;
 
   /* Record the length of the public key part.  */
   pkbytes = iobuf_get_temp_length (a);
@@ -1404,6 +1497,22 @@ build_attribute_subpkt(PKT_user_id *uid,byte type,
   else
     idx=1;
 
+  /* Stop sharing the data with other copies of UID.  */
+  if (uid->attrib_ref)
+    {
+      if (*uid->attrib_ref > 1)
+        {
+          byte *tmp = xmalloc (uid->attrib_len);
+
+          memcpy (tmp, uid->attrib_data, uid->attrib_len);
+          --*uid->attrib_ref;
+          uid->attrib_data = tmp;
+        }
+      else
+        xfree (uid->attrib_ref);
+      uid->attrib_ref = NULL;
+    }
+
   /* realloc uid->attrib_data to the right size */
 
   uid->attrib_data=xrealloc(uid->attrib_data,
@@ -1732,38 +1841,93 @@ free_notation(struct notation *notation)
     }
 }
 
+/* Write the signature values of SIG to OUT.  If R_NWRITTEN is not
+   NULL the number of bytes written is stored there.  To only get the
+   number of bytes which would be written, NULL may be passed for
+   OUT.  */
+static gpg_error_t
+write_signature_data (IOBUF out, PKT_signature *sig,
+                      unsigned int *r_nwritten)
+{
+  gpg_error_t rc = 0;
+  unsigned int nwritten = 0;
+  unsigned int nn;
+  int n, i;
+
+  n = pubkey_get_nsig( sig->pubkey_algo );
+  if ( !n )
+    {
+      nwritten = fake_data_length (sig->data[0]);
+      if (out)
+        rc = write_fake_data (out, sig->data[0]);
+    }
+  for (i=0; i < n && !rc ; i++ )
+    {
+      nn = 0;
+      if (sig->pubkey_algo == PUBKEY_ALGO_ECDSA
+          || sig->pubkey_algo == PUBKEY_ALGO_EDDSA)
+        rc = sos_write (out, sig->data[i], &nn);
+      else
+        rc = gpg_mpi_write (out, sig->data[i], &nn);
+      nwritten += nn;
+    }
+
+  if (r_nwritten)
+    *r_nwritten = nwritten;
+  return rc;
+}
+
+
 /* Serialize the signature packet (RFC 4880, Section 5.2) described by
-   SIG and write it to OUT.  */
+   SIG and write it to OUT.  The length of the body is computed first
+   so that the packet can be written to OUT without a temporary
+   buffer.  */
 static int
 do_signature( IOBUF out, int ctb, PKT_signature *sig )
 {
-  int rc = 0;
-  int n, i;
-  IOBUF a = iobuf_temp();
+  int rc;
+  unsigned int datalen;
+  u32 len;
 
   log_assert (ctb_pkttype (ctb) == PKT_SIGNATURE);
 
+  rc = write_signature_data (NULL, sig, &datalen);
+  if (rc)
+    return rc;
+
+  len = 1 + 1 + 2 + 2 + datalen; /* Version, class, algos, digest start. */
+  if ( sig->version < 4 )
+    len += 1 + 12;  /* Constant 5, timestamp and keyid.  */
+  else
+    len += 2 + (sig->hashed? sig->hashed->len : 0)
+      +    2 + (sig->unhashed? sig->unhashed->len : 0);
+
+  if ( is_RSA(sig->pubkey_algo) && sig->version < 4 )
+    write_sign_packet_header(out, ctb, len );
+  else
+    write_header(out, ctb, len );
+
   if ( !sig->version || sig->version == 3)
     {
-      iobuf_put( a, 3 );
+      iobuf_put( out, 3 );
 
       /* Version 3 packets don't support subpackets.  */
       log_assert (! sig->hashed);
       log_assert (! sig->unhashed);
     }
   else
-    iobuf_put( a, sig->version );
+    iobuf_put( out, sig->version );
   if ( sig->version < 4 )
-    iobuf_put (a, 5 ); /* Constant used by pre-v4 signatures. */
-  iobuf_put (a, sig->sig_class );
+    iobuf_put (out, 5 ); /* Constant used by pre-v4 signatures. */
+  iobuf_put (out, sig->sig_class );
   if ( sig->version < 4 )
     {
-      write_32(a, sig->timestamp );
-      write_32(a, sig->keyid[0] );
-      write_32(a, sig->keyid[1] );
+      write_32(out, sig->timestamp );
+      write_32(out, sig->keyid[0] );
+      write_32(out, sig->keyid[1] );
     }
-  iobuf_put(a, sig->pubkey_algo );
-  iobuf_put(a, sig->digest_algo );
+  iobuf_put(out, sig->pubkey_algo );
+  iobuf_put(out, sig->digest_algo );
   if ( sig->version >= 4 )
     {
       size_t nn;
@@ -1771,38 +1935,17 @@ do_signature( IOBUF out, int ctb, PKT_signature *sig )
 	 prior to the call of this function, because these subpackets
 	 are hashed. */
       nn = sig->hashed? sig->hashed->len : 0;
-      write_16(a, nn);
+      write_16(out, nn);
       if (nn)
-        iobuf_write( a, sig->hashed->data, nn );
+        iobuf_write( out, sig->hashed->data, nn );
       nn = sig->unhashed? sig->unhashed->len : 0;
-      write_16(a, nn);
+      write_16(out, nn);
       if (nn)
-        iobuf_write( a, sig->unhashed->data, nn );
+        iobuf_write( out, sig->unhashed->data, nn );
     }
-  iobuf_put(a, sig->digest_start[0] );
-  iobuf_put(a, sig->digest_start[1] );
-  n = pubkey_get_nsig( sig->pubkey_algo );
-  if ( !n )
-    write_fake_data( a, sig->data[0] );
-  if (sig->pubkey_algo == PUBKEY_ALGO_ECDSA
-      || sig->pubkey_algo == PUBKEY_ALGO_EDDSA)
-    for (i=0; i < n && !rc ; i++ )
-      rc = sos_write (a, sig->data[i], NULL);
-  else
-    for (i=0; i < n && !rc ; i++ )
-      rc = gpg_mpi_write (a, sig->data[i], NULL);
-
-  if (!rc)
-    {
-      if ( is_RSA(sig->pubkey_algo) && sig->version < 4 )
-        write_sign_packet_header(out, ctb, iobuf_get_temp_length(a) );
-      else
-        write_header(out, ctb, iobuf_get_temp_length(a) );
-      rc = iobuf_write_temp( out, a );
-    }
-
-  iobuf_close(a);
-  return rc;
+  iobuf_put(out, sig->digest_start[0] );
+  iobuf_put(out, sig->digest_start[1] );
+  return write_signature_data (out, sig, NULL);
 }
 
 
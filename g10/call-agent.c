@@ -43,6 +43,7 @@
 #include "../common/shareddefs.h"
 #include "../common/host2net.h"
 #include "../common/ttyio.h"
+#include "../common/metrics.h"
 
 #define CONTROL_D ('D' - 'A' + 1)
 
@@ -50,6 +51,19 @@
 static assuan_context_t agent_ctx = NULL;
 static int did_early_card_test;
 
+/* The trace id passed to the agent if --debug clock is used.  */
+static char trace_id[GNUPG_TRACE_ID_LEN+1];
+
+/* The key encryption keys received from the agent for import [0]
+ * and export [1].  The agent keeps them for the lifetime of the
+ * connection; thus there is no need to ask for a new one for each
+ * keyblock of an import or export.  */
+static struct
+{
+  unsigned char *kek;  /* Secure memory.  */
+  size_t keklen;
+} keywrap_cache[2];
+
 struct confirm_parm_s
 {
   char *desc;
@@ -75,6 +89,13 @@ struct cipher_parm_s
   assuan_context_t ctx;
   unsigned char *ciphertext;
   size_t ciphertextlen;
+  const char *keygrips;
+};
+
+struct pkdecrypt_multi_parm_s
+{
+  int *r_padding;
+  char *r_keygrip;
 };
 
 struct writecert_parm_s
@@ -272,6 +293,20 @@ start_agent (ctrl_t ctrl, int flag_for_card)
              here used to indirectly enable GPG_ERR_FULLY_CANCELED.  */
           assuan_transact (agent_ctx, "OPTION agent-awareness=2.1.0",
                            NULL, NULL, NULL, NULL, NULL, NULL);
+          /* With --debug clock we ask the agent and the daemons it
+           * calls to log the timings of our requests.  Older agents
+           * don't know the option; we trace our spans anyway.  */
+          if (DBG_CLOCK)
+            {
+              char *tmp;
+
+              gnupg_trace_new_id (trace_id);
+              log_info ("using trace id %s\n", trace_id);
+              tmp = xasprintf ("OPTION trace-id=%s", trace_id);
+              assuan_transact (agent_ctx, tmp,
+                               NULL, NULL, NULL, NULL, NULL, NULL);
+              xfree (tmp);
+            }
           /* Pass on the pinentry mode.  */
           if (opt.pinentry_mode)
             {
@@ -475,6 +510,24 @@ get_serialno_cb (void *opaque, const char *line)
 
 
 
+/* Forget the connection to the agent without closing it.  This is
+ * used by a forked process which must not use the connection of its
+ * parent; the next request opens a new connection.  */
+void
+agent_prepare_worker (void)
+{
+  int i;
+
+  agent_ctx = NULL;
+  /* The new connection does not know our key encryption keys.  */
+  for (i=0; i < DIM (keywrap_cache); i++)
+    {
+      xfree (keywrap_cache[i].kek);
+      keywrap_cache[i].kek = NULL;
+    }
+}
+
+
 /* Release the card info structure INFO. */
 void
 agent_release_card_info (struct agent_card_info_s *info)
@@ -2084,6 +2137,28 @@ struct keyinfo_data_parm_s
 };
 
 
+/* Parse the arguments of a KEYINFO status line into DATA:
+ *      0        1        2        3       4          5
+ *   <keygrip> <type> <serialno> <idstr> <cached> <protection>
+ *
+ *      6        7        8
+ *   <sshfpr>  <ttl>  <flags>
+ */
+static void
+parse_keyinfo_fields (const char **fields, struct keyinfo_data_parm_s *data)
+{
+  data->is_smartcard = (fields[1][0] == 'T');
+  if (data->is_smartcard && !data->serialno && strcmp (fields[2], "-"))
+    data->serialno = xtrystrdup (fields[2]);
+  /* '1' for cached */
+  data->passphrase_cached = (fields[4][0] == '1');
+  /* 'P' for protected, 'C' for clear */
+  data->cleartext = (fields[5][0] == 'C');
+  /* 'A' for card is available */
+  data->card_available = (fields[8][0] == 'A');
+}
+
+
 static gpg_error_t
 keyinfo_status_cb (void *opaque, const char *line)
 {
@@ -2092,32 +2167,187 @@ keyinfo_status_cb (void *opaque, const char *line)
 
   if ((s = has_leading_keyword (line, "KEYINFO")) && data)
     {
-      /* Parse the arguments:
-       *      0        1        2        3       4          5
-       *   <keygrip> <type> <serialno> <idstr> <cached> <protection>
-       *
-       *      6        7        8
-       *   <sshfpr>  <ttl>  <flags>
-       */
       const char *fields[9];
 
       if (split_fields (s, fields, DIM (fields)) == 9)
-        {
-          data->is_smartcard = (fields[1][0] == 'T');
-          if (data->is_smartcard && !data->serialno && strcmp (fields[2], "-"))
-            data->serialno = xtrystrdup (fields[2]);
-          /* '1' for cached */
-          data->passphrase_cached = (fields[4][0] == '1');
-          /* 'P' for protected, 'C' for clear */
-          data->cleartext = (fields[5][0] == 'C');
-          /* 'A' for card is available */
-          data->card_available = (fields[8][0] == 'A');
-        }
+        parse_keyinfo_fields (fields, data);
+    }
+  return 0;
+}
+
+
+
+/* While listing many keys we would ask the agent about each key and
+ * subkey.  Between agent_begin_keyinfo_batch and
+ * agent_end_keyinfo_batch we instead ask the agent once for the info
+ * of all its keys and answer the probes from that cache.  The cache
+ * is loaded with the second probe so that looking at a single key
+ * does not need to list all keys.  Because the cached passphrase
+ * state may change, the cache is reloaded after a few seconds.  */
+#define KEYINFO_CACHE_TTL 10
+
+struct keyinfo_cache_item_s
+{
+  unsigned char grip[KEYGRIP_LEN];
+  struct keyinfo_data_parm_s info;  /* The serialno is malloced.  */
+};
+
+static struct
+{
+  int nesting;    /* Nesting level of the batches.  */
+  int nprobes;    /* Number of probes in the current batch.  */
+  int state;      /* 0 = not loaded, 1 = loaded, -1 = not usable.  */
+  time_t loaded;  /* The time the cache has been loaded.  */
+  size_t nitems;
+  size_t allocated;
+  struct keyinfo_cache_item_s *items;  /* Sorted by the grip.  */
+} keyinfo_cache;
+
+
+/* Remove all items from the keyinfo cache.  */
+static void
+keyinfo_cache_flush (void)
+{
+  size_t n;
+
+  for (n=0; n < keyinfo_cache.nitems; n++)
+    xfree (keyinfo_cache.items[n].info.serialno);
+  xfree (keyinfo_cache.items);
+  keyinfo_cache.items = NULL;
+  keyinfo_cache.nitems = keyinfo_cache.allocated = 0;
+  keyinfo_cache.state = 0;
+}
+
+
+static int
+compare_keyinfo_cache_items (const void *a, const void *b)
+{
+  const struct keyinfo_cache_item_s *ia = a;
+  const struct keyinfo_cache_item_s *ib = b;
+
+  return memcmp (ia->grip, ib->grip, KEYGRIP_LEN);
+}
+
+
+/* Status callback for "KEYINFO --list".  */
+static gpg_error_t
+keyinfo_list_status_cb (void *opaque, const char *line)
+{
+  struct keyinfo_cache_item_s *item;
+  const char *fields[9];
+  char *s;
+
+  (void)opaque;
+
+  if (!(s = has_leading_keyword (line, "KEYINFO"))
+      || split_fields (s, fields, DIM (fields)) != 9)
+    return 0;
+
+  if (keyinfo_cache.nitems == keyinfo_cache.allocated)
+    {
+      size_t n = keyinfo_cache.allocated? keyinfo_cache.allocated * 2 : 64;
+
+      item = xtryrealloc (keyinfo_cache.items, n * sizeof *item);
+      if (!item)
+        return gpg_error_from_syserror ();
+      keyinfo_cache.items = item;
+      keyinfo_cache.allocated = n;
     }
+  item = keyinfo_cache.items + keyinfo_cache.nitems;
+  memset (item, 0, sizeof *item);
+  if (hex2bin (fields[0], item->grip, KEYGRIP_LEN) < 0)
+    return 0;  /* Bad keygrip - ignore.  */
+  parse_keyinfo_fields (fields, &item->info);
+  keyinfo_cache.nitems++;
   return 0;
 }
 
 
+/* Ask the agent for the info of all its keys.  */
+static void
+keyinfo_cache_load (ctrl_t ctrl)
+{
+  gpg_error_t err;
+
+  keyinfo_cache_flush ();
+  err = start_agent (ctrl, 0);
+  if (!err)
+    err = assuan_transact (agent_ctx, "KEYINFO --list", NULL, NULL, NULL, NULL,
+                           keyinfo_list_status_cb, NULL);
+  if (err)
+    {
+      /* For example the agent does not allow this in restricted
+       * mode.  Fall back to asking for each key.  */
+      if (opt.verbose)
+        log_info ("listing the agent's keys failed: %s\n", gpg_strerror (err));
+      keyinfo_cache_flush ();
+      keyinfo_cache.state = -1;
+      return;
+    }
+
+  if (keyinfo_cache.nitems > 1)
+    qsort (keyinfo_cache.items, keyinfo_cache.nitems,
+           sizeof *keyinfo_cache.items, compare_keyinfo_cache_items);
+  keyinfo_cache.state = 1;
+  keyinfo_cache.loaded = gnupg_get_time ();
+}
+
+
+/* Look up the key with GRIP in the keyinfo cache.  Returns 1 and
+ * stores the info at R_INFO if the agent has that key, 0 if the agent
+ * does not have that key, and -1 if the cache can't be used.  The
+ * serialno stored at R_INFO belongs to the cache.  */
+static int
+keyinfo_cache_get (ctrl_t ctrl, const unsigned char *grip,
+                   struct keyinfo_data_parm_s *r_info)
+{
+  struct keyinfo_cache_item_s *item;
+
+  if (!keyinfo_cache.nesting)
+    return -1;
+
+  if (keyinfo_cache.state == 1
+      && keyinfo_cache.loaded + KEYINFO_CACHE_TTL < gnupg_get_time ())
+    keyinfo_cache_flush ();
+  if (!keyinfo_cache.state)
+    {
+      if (++keyinfo_cache.nprobes < 2)
+        return -1;
+      keyinfo_cache_load (ctrl);
+    }
+  if (keyinfo_cache.state != 1)
+    return -1;
+
+  item = bsearch (grip, keyinfo_cache.items, keyinfo_cache.nitems,
+                  sizeof *keyinfo_cache.items, compare_keyinfo_cache_items);
+  if (!item)
+    return 0;
+  *r_info = item->info;
+  return 1;
+}
+
+
+/* Start a batch of secret key probes; see above.  Batches may be
+ * nested.  */
+void
+agent_begin_keyinfo_batch (void)
+{
+  keyinfo_cache.nesting++;
+}
+
+
+/* End a batch of secret key probes.  */
+void
+agent_end_keyinfo_batch (void)
+{
+  log_assert (keyinfo_cache.nesting > 0);
+  if (--keyinfo_cache.nesting)
+    return;
+  keyinfo_cache_flush ();
+  keyinfo_cache.nprobes = 0;
+}
+
+
 /* Ask the agent whether a secret key for the given public key is
    available.  Returns 0 if not available.  Bigger value is preferred.  */
 int
@@ -2125,7 +2355,8 @@ agent_probe_secret_key (ctrl_t ctrl, PKT_public_key *pk)
 {
   gpg_error_t err;
   char line[ASSUAN_LINELENGTH];
-  char *hexgrip;
+  unsigned char grip[KEYGRIP_LEN];
+  char hexgrip[2*KEYGRIP_LEN+1];
 
   struct keyinfo_data_parm_s keyinfo;
 
@@ -2135,12 +2366,22 @@ agent_probe_secret_key (ctrl_t ctrl, PKT_public_key *pk)
   if (err)
     return err;
 
-  err = hexkeygrip_from_pk (pk, &hexgrip);
+  err = keygrip_from_pk (pk, grip);
   if (err)
     return err;
 
+  switch (keyinfo_cache_get (ctrl, grip, &keyinfo))
+    {
+    case 0:
+      return 0;
+    case 1:
+      goto leave;
+    default:
+      break;
+    }
+
+  bin2hex (grip, KEYGRIP_LEN, hexgrip);
   snprintf (line, sizeof line, "KEYINFO %s", hexgrip);
-  xfree (hexgrip);
 
   err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
                          keyinfo_status_cb, &keyinfo);
@@ -2148,6 +2389,7 @@ agent_probe_secret_key (ctrl_t ctrl, PKT_public_key *pk)
   if (err)
     return 0;
 
+ leave:
   if (keyinfo.card_available)
     return 4;
 
@@ -2171,11 +2413,31 @@ agent_probe_any_secret_key (ctrl_t ctrl, kbnode_t keyblock)
   kbnode_t kbctx, node;
   int nkeys;
   unsigned char grip[KEYGRIP_LEN];
+  struct keyinfo_data_parm_s keyinfo;
 
   err = start_agent (ctrl, 0);
   if (err)
     return err;
 
+  /* First try the keyinfo cache.  */
+  for (kbctx=NULL, nkeys=0; (node = walk_kbnode (keyblock, &kbctx, 0)); )
+    if (node->pkt->pkttype == PKT_PUBLIC_KEY
+        || node->pkt->pkttype == PKT_PUBLIC_SUBKEY
+        || node->pkt->pkttype == PKT_SECRET_KEY
+        || node->pkt->pkttype == PKT_SECRET_SUBKEY)
+      {
+        err = keygrip_from_pk (node->pkt->pkt.public_key, grip);
+        if (err)
+          return err;
+        nkeys = keyinfo_cache_get (ctrl, grip, &keyinfo);
+        if (nkeys)
+          break;
+      }
+  if (nkeys == 1)
+    return 0;
+  if (!nkeys)
+    return gpg_error (GPG_ERR_NO_SECKEY);
+
   err = gpg_error (GPG_ERR_NO_SECKEY); /* Just in case no key was
                                           found in KEYBLOCK.  */
   p = stpcpy (line, "HAVEKEY");
@@ -2227,6 +2489,8 @@ agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip,
   gpg_error_t err;
   char line[ASSUAN_LINELENGTH];
   struct keyinfo_data_parm_s keyinfo;
+  unsigned char grip[KEYGRIP_LEN];
+  int n;
 
   memset (&keyinfo, 0,sizeof keyinfo);
 
@@ -2239,10 +2503,27 @@ agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip,
   if (!hexkeygrip || strlen (hexkeygrip) != 40)
     return gpg_error (GPG_ERR_INV_VALUE);
 
-  snprintf (line, DIM(line), "KEYINFO %s", hexkeygrip);
+  if (hex2bin (hexkeygrip, grip, KEYGRIP_LEN) < 0)
+    n = -1;
+  else
+    n = keyinfo_cache_get (ctrl, grip, &keyinfo);
+  if (!n)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+  else if (n == 1)
+    {
+      /* The serialno belongs to the cache.  */
+      if (keyinfo.serialno
+          && !(keyinfo.serialno = xtrystrdup (keyinfo.serialno)))
+        return gpg_error_from_syserror ();
+      err = 0;
+    }
+  else
+    {
+      snprintf (line, DIM(line), "KEYINFO %s", hexkeygrip);
 
-  err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
-                         keyinfo_status_cb, &keyinfo);
+      err = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
+                             keyinfo_status_cb, &keyinfo);
+    }
   if (!err && keyinfo.serialno)
     {
       /* Sanity check for bad characters.  */
@@ -2408,6 +2689,40 @@ agent_genkey (ctrl_t ctrl, char **cache_nonce_addr, char **passwd_nonce_addr,
 
 
 
+/* Ask the agent to generate a key with the parameters KEYPARMS in
+   the background so that a later agent_genkey with the same
+   parameters returns faster.  Returns GPG_ERR_NOT_SUPPORTED if the
+   agent does not support this.  */
+gpg_error_t
+agent_pregenkey (ctrl_t ctrl, const char *keyparms)
+{
+  gpg_error_t err;
+  struct genkey_parm_s gk_parm;
+  struct default_inq_parm_s dfltparm;
+
+  memset (&dfltparm, 0, sizeof dfltparm);
+  dfltparm.ctrl = ctrl;
+
+  err = start_agent (ctrl, 0);
+  if (err)
+    return err;
+  dfltparm.ctx = agent_ctx;
+
+  /* An old agent would ignore the option and create a key.  */
+  if (assuan_transact (agent_ctx, "GETINFO cmd_has_option GENKEY pregen",
+                       NULL, NULL, NULL, NULL, NULL, NULL))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  gk_parm.dflt     = &dfltparm;
+  gk_parm.keyparms = keyparms;
+  gk_parm.passphrase = NULL;
+  return assuan_transact (agent_ctx, "GENKEY --pregen",
+                          NULL, NULL, inq_genkey_parms, &gk_parm,
+                          NULL, NULL);
+}
+
+
+
 /* Call the agent to read the public key part for a given keygrip.
  * Values from FROMCARD:
  *   0 - Standard
@@ -2484,6 +2799,7 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce,
   char line[ASSUAN_LINELENGTH];
   membuf_t data;
   struct default_inq_parm_s dfltparm;
+  unsigned long long t0;
 
   memset (&dfltparm, 0, sizeof dfltparm);
   dfltparm.ctrl = ctrl;
@@ -2533,10 +2849,12 @@ agent_pksign (ctrl_t ctrl, const char *cache_nonce,
 
   if (DBG_CLOCK)
     log_clock ("enter signing");
+  t0 = gnupg_metrics_now ();
   err = assuan_transact (agent_ctx, line,
                          put_membuf_cb, &data,
                          default_inq_cb, &dfltparm,
                          NULL, NULL);
+  gnupg_trace_span (trace_id, GPG_NAME, "agent-PKSIGN", t0);
   if (DBG_CLOCK)
     log_clock ("leave signing");
 
@@ -2576,6 +2894,9 @@ inq_ciphertext_cb (void *opaque, const char *line)
                              parm->ciphertext, parm->ciphertextlen);
       assuan_end_confidential (parm->ctx);
     }
+  else if (parm->keygrips && has_leading_keyword (line, "KEYGRIPS"))
+    rc = assuan_send_data (parm->dflt->ctx,
+                           parm->keygrips, strlen (parm->keygrips));
   else
     rc = default_inq_cb (parm->dflt, line);
 
@@ -2599,6 +2920,59 @@ padding_info_cb (void *opaque, const char *line)
 }
 
 
+/* Take the result of a PKDECRYPT command from DATA, strip the
+ * S-expression and store the decrypted value at R_BUF and its length
+ * at R_BUFLEN.  */
+static gpg_error_t
+get_decrypted_value (membuf_t *data, unsigned char **r_buf, size_t *r_buflen)
+{
+  size_t n, len;
+  char *p, *buf, *endp;
+
+  buf = get_membuf (data, &len);
+  if (!buf)
+    return gpg_error_from_syserror ();
+
+  if (len == 0 || *buf != '(')
+    {
+      xfree (buf);
+      return gpg_error (GPG_ERR_INV_SEXP);
+    }
+
+  if (len < 12 || memcmp (buf, "(5:value", 8) ) /* "(5:valueN:D)" */
+    {
+      xfree (buf);
+      return gpg_error (GPG_ERR_INV_SEXP);
+    }
+  while (buf[len-1] == 0)
+    len--;
+  if (buf[len-1] != ')')
+    return gpg_error (GPG_ERR_INV_SEXP);
+  len--; /* Drop the final close-paren. */
+  p = buf + 8; /* Skip leading parenthesis and the value tag. */
+  len -= 8;   /* Count only the data of the second part. */
+
+  n = strtoul (p, &endp, 10);
+  if (!n || *endp != ':')
+    {
+      xfree (buf);
+      return gpg_error (GPG_ERR_INV_SEXP);
+    }
+  endp++;
+  if (endp-p+n > len)
+    {
+      xfree (buf);
+      return gpg_error (GPG_ERR_INV_SEXP); /* Oops: Inconsistent S-Exp. */
+    }
+
+  memmove (buf, endp, n);
+
+  *r_buflen = n;
+  *r_buf = buf;
+  return 0;
+}
+
+
 /* Call the agent to do a decrypt operation using the key identified
    by the hex string KEYGRIP and the input data S_CIPHERTEXT.  On the
    success the decoded value is stored verbatim at R_BUF and its
@@ -2615,8 +2989,7 @@ agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
   gpg_error_t err;
   char line[ASSUAN_LINELENGTH];
   membuf_t data;
-  size_t n, len;
-  char *p, *buf, *endp;
+  size_t len;
   struct default_inq_parm_s dfltparm;
 
   memset (&dfltparm, 0, sizeof dfltparm);
@@ -2659,16 +3032,20 @@ agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
   init_membuf_secure (&data, 1024);
   {
     struct cipher_parm_s parm;
+    unsigned long long t0;
 
     parm.dflt = &dfltparm;
     parm.ctx = agent_ctx;
+    parm.keygrips = NULL;
     err = make_canon_sexp (s_ciphertext, &parm.ciphertext, &parm.ciphertextlen);
     if (err)
       return err;
+    t0 = gnupg_metrics_now ();
     err = assuan_transact (agent_ctx, "PKDECRYPT",
                            put_membuf_cb, &data,
                            inq_ciphertext_cb, &parm,
                            padding_info_cb, r_padding);
+    gnupg_trace_span (trace_id, GPG_NAME, "agent-PKDECRYPT", t0);
     xfree (parm.ciphertext);
   }
   if (err)
@@ -2677,47 +3054,95 @@ agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
       return err;
     }
 
-  buf = get_membuf (&data, &len);
-  if (!buf)
-    return gpg_error_from_syserror ();
+  return get_decrypted_value (&data, r_buf, r_buflen);
+}
 
-  if (len == 0 || *buf != '(')
-    {
-      xfree (buf);
-      return gpg_error (GPG_ERR_INV_SEXP);
-    }
 
-  if (len < 12 || memcmp (buf, "(5:value", 8) ) /* "(5:valueN:D)" */
-    {
-      xfree (buf);
-      return gpg_error (GPG_ERR_INV_SEXP);
-    }
-  while (buf[len-1] == 0)
-    len--;
-  if (buf[len-1] != ')')
-    return gpg_error (GPG_ERR_INV_SEXP);
-  len--; /* Drop the final close-paren. */
-  p = buf + 8; /* Skip leading parenthesis and the value tag. */
-  len -= 8;   /* Count only the data of the second part. */
+/* Status callback for PKDECRYPT --multi.  */
+static gpg_error_t
+pkdecrypt_multi_status_cb (void *opaque, const char *line)
+{
+  struct pkdecrypt_multi_parm_s *parm = opaque;
+  const char *s;
 
-  n = strtoul (p, &endp, 10);
-  if (!n || *endp != ':')
+  if ((s=has_leading_keyword (line, "PADDING")))
+    *parm->r_padding = atoi (s);
+  else if ((s=has_leading_keyword (line, "KEYGRIP")))
     {
-      xfree (buf);
-      return gpg_error (GPG_ERR_INV_SEXP);
+      if (strlen (s) == 40)
+        memcpy (parm->r_keygrip, s, 41);
     }
-  endp++;
-  if (endp-p+n > len)
+
+  return 0;
+}
+
+
+/* Ask the agent to decrypt S_CIPHERTEXT with one of the keys given by
+ * the space delimited hex strings in KEYGRIPS.  The agent only tries
+ * keys which can be used without asking for a passphrase.  On success
+ * the decoded value is stored at R_BUF and its length at R_BUFLEN,
+ * the padding information at R_PADDING, and the keygrip of the used
+ * key at R_KEYGRIP, which needs to have room for 41 bytes.  The
+ * caller must check the value and may call again with the remaining
+ * keys.  GPG_ERR_NO_SECKEY is returned if none of the keys could be
+ * used.  */
+gpg_error_t
+agent_pkdecrypt_multi (ctrl_t ctrl, const char *keygrips,
+                       gcry_sexp_t s_ciphertext,
+                       unsigned char **r_buf, size_t *r_buflen,
+                       int *r_padding, char *r_keygrip)
+{
+  gpg_error_t err;
+  membuf_t data;
+  size_t len;
+  struct default_inq_parm_s dfltparm;
+  struct cipher_parm_s parm;
+  struct pkdecrypt_multi_parm_s stparm;
+
+  memset (&dfltparm, 0, sizeof dfltparm);
+  dfltparm.ctrl = ctrl;
+
+  if (!keygrips || !*keygrips
+      || !s_ciphertext || !r_buf || !r_buflen || !r_padding || !r_keygrip)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  *r_buf = NULL;
+  *r_padding = -1;
+  *r_keygrip = 0;
+
+  err = start_agent (ctrl, 0);
+  if (err)
+    return err;
+  dfltparm.ctx = agent_ctx;
+
+  err = assuan_transact (agent_ctx, "RESET",
+                         NULL, NULL, NULL, NULL, NULL, NULL);
+  if (err)
+    return err;
+
+  parm.dflt = &dfltparm;
+  parm.ctx = agent_ctx;
+  parm.keygrips = keygrips;
+  err = make_canon_sexp (s_ciphertext, &parm.ciphertext, &parm.ciphertextlen);
+  if (err)
+    return err;
+  stparm.r_padding = r_padding;
+  stparm.r_keygrip = r_keygrip;
+  init_membuf_secure (&data, 1024);
+  err = assuan_transact (agent_ctx, "PKDECRYPT --multi",
+                         put_membuf_cb, &data,
+                         inq_ciphertext_cb, &parm,
+                         pkdecrypt_multi_status_cb, &stparm);
+  xfree (parm.ciphertext);
+  if (!err && !*r_keygrip)
+    err = gpg_error (GPG_ERR_INV_RESPONSE);
+  if (err)
     {
-      xfree (buf);
-      return gpg_error (GPG_ERR_INV_SEXP); /* Oops: Inconsistent S-Exp. */
+      xfree (get_membuf (&data, &len));
+      return err;
     }
 
-  memmove (buf, endp, n);
-
-  *r_buflen = n;
-  *r_buf = buf;
-  return 0;
+  return get_decrypted_value (&data, r_buf, r_buflen);
 }
 
 
@@ -2744,6 +3169,19 @@ agent_keywrap_key (ctrl_t ctrl, int forexport, void **r_kek, size_t *r_keklen)
     return err;
   dfltparm.ctx = agent_ctx;
 
+  forexport = !!forexport;
+  if (keywrap_cache[forexport].kek)
+    {
+      buf = xtrymalloc_secure (keywrap_cache[forexport].keklen);
+      if (!buf)
+        return gpg_error_from_syserror ();
+      memcpy (buf, keywrap_cache[forexport].kek,
+              keywrap_cache[forexport].keklen);
+      *r_kek = buf;
+      *r_keklen = keywrap_cache[forexport].keklen;
+      return 0;
+    }
+
   snprintf (line, DIM(line), "KEYWRAP_KEY %s",
             forexport? "--export":"--import");
 
@@ -2760,13 +3198,21 @@ agent_keywrap_key (ctrl_t ctrl, int forexport, void **r_kek, size_t *r_keklen)
   buf = get_membuf (&data, &len);
   if (!buf)
     return gpg_error_from_syserror ();
+
+  /* Remember a copy; failing to do so is not an error.  */
+  if ((keywrap_cache[forexport].kek = xtrymalloc_secure (len)))
+    {
+      memcpy (keywrap_cache[forexport].kek, buf, len);
+      keywrap_cache[forexport].keklen = len;
+    }
+
   *r_kek = buf;
   *r_keklen = len;
   return 0;
 }
 
 
-
+
 /* Handle the inquiry for an IMPORT_KEY command.  */
 static gpg_error_t
 inq_import_key_parms (void *opaque, const char *line)
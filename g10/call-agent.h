@@ -94,6 +94,9 @@ struct keypair_info_s
 };
 typedef struct keypair_info_s *keypair_info_t;
 
+/* Forget the connection in a forked process.  */
+void agent_prepare_worker (void);
+
 /* Release the card info structure. */
 void agent_release_card_info (struct agent_card_info_s *info);
 
@@ -182,6 +185,10 @@ int agent_probe_secret_key (ctrl_t ctrl, PKT_public_key *pk);
    keys (primary or sub) in KEYBLOCK.  Returns 0 if available.  */
 gpg_error_t agent_probe_any_secret_key (ctrl_t ctrl, kbnode_t keyblock);
 
+/* Answer the above probes from one listing of the agent's keys.  */
+void agent_begin_keyinfo_batch (void);
+void agent_end_keyinfo_batch (void);
+
 
 /* Return infos about the secret key with HEXKEYGRIP.  */
 gpg_error_t agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip,
@@ -194,6 +201,9 @@ gpg_error_t agent_genkey (ctrl_t ctrl,
                           const char *passphrase, time_t timestamp,
                           gcry_sexp_t *r_pubkey);
 
+/* Generate a key in the background for a later agent_genkey.  */
+gpg_error_t agent_pregenkey (ctrl_t ctrl, const char *keyparms);
+
 /* Read a public key.  FROMCARD may be 0, 1, or 2. */
 gpg_error_t agent_readkey (ctrl_t ctrl, int fromcard, const char *hexkeygrip,
                            unsigned char **r_pubkey);
@@ -213,6 +223,12 @@ gpg_error_t agent_pkdecrypt (ctrl_t ctrl, const char *keygrip, const char *desc,
                              unsigned char **r_buf, size_t *r_buflen,
                              int *r_padding);
 
+/* Try to decrypt with one of several keys.  */
+gpg_error_t agent_pkdecrypt_multi (ctrl_t ctrl, const char *keygrips,
+                                   gcry_sexp_t s_ciphertext,
+                                   unsigned char **r_buf, size_t *r_buflen,
+                                   int *r_padding, char *r_keygrip);
+
 /* Retrieve a key encryption key.  */
 gpg_error_t agent_keywrap_key (ctrl_t ctrl, int forexport,
                                void **r_kek, size_t *r_keklen);
@@ -628,9 +628,146 @@ ks_get_data_cb (void *opaque, const void *data, size_t datalen)
 }
 
 
+/* State of the stream returned by gpg_dirmngr_ks_get.  The data
+   lines are read from the dirmngr only when the caller reads from the
+   stream; thus the import runs while the keys are still arriving and
+   the memory use does not depend on the number of keys.  */
+struct ks_get_stream_s
+{
+  ctrl_t ctrl;
+  assuan_context_t ctx;    /* The context reserved for this stream.  */
+  struct ks_status_parm_s stparm;
+  unsigned char *buffer;   /* The decoded data of the last D line.  */
+  size_t buflen;           /* Number of bytes in BUFFER.  */
+  size_t bufpos;           /* Number of bytes already returned.  */
+  gpg_error_t err;         /* The final result of the command.  */
+  int eof;                 /* The final OK or ERR has been seen.  */
+};
+
+
+/* Read the response lines from the dirmngr until a D line with data
+   or the final OK or ERR line has been received.  The data is stored
+   in the buffer of ST.  */
+static void
+ks_get_stream_next (struct ks_get_stream_s *st)
+{
+  gpg_error_t err;
+  char *line;
+  size_t linelen, i;
+
+  st->buflen = st->bufpos = 0;
+  while (!st->eof)
+    {
+      err = assuan_read_line (st->ctx, &line, &linelen);
+      if (err)
+        {
+          st->err = err;
+          st->eof = 1;
+        }
+      else if (linelen >= 2 && line[0] == 'D' && line[1] == ' ')
+        {
+          for (i=2; i < linelen; i++)
+            {
+              if (line[i] == '%' && i+2 < linelen)
+                {
+                  st->buffer[st->buflen++] = xtoi_2 (line + i + 1);
+                  i += 2;
+                }
+              else
+                st->buffer[st->buflen++] = line[i];
+            }
+          if (st->buflen)
+            return;
+        }
+      else if (linelen >= 2 && line[0] == 'S' && line[1] == ' ')
+        ks_status_cb (&st->stparm, line + 2);
+      else if (linelen >= 2 && line[0] == 'O' && line[1] == 'K'
+               && (linelen == 2 || line[2] == ' '))
+        st->eof = 1;
+      else if (linelen >= 3 && !strncmp (line, "ERR", 3)
+               && (linelen == 3 || line[3] == ' '))
+        {
+          st->err = linelen > 4? strtoul (line + 4, NULL, 10) : 0;
+          if (!st->err)
+            st->err = gpg_error (GPG_ERR_GENERAL);
+          st->eof = 1;
+        }
+      else if (linelen >= 7 && !strncmp (line, "INQUIRE", 7)
+               && (linelen == 7 || line[7] == ' '))
+        {
+          /* KS_GET does not inquire anything; the dirmngr will reply
+             with an ERR.  */
+          assuan_write_line (st->ctx, "CAN");
+        }
+      /* Comments and END lines are ignored.  */
+    }
+}
+
+
+static gpgrt_ssize_t
+ks_get_stream_read (void *cookie, void *buffer, size_t size)
+{
+  struct ks_get_stream_s *st = cookie;
+  size_t n;
+
+  if (!buffer)
+    return 0;  /* Flush request.  */
+
+  if (st->bufpos == st->buflen)
+    ks_get_stream_next (st);
+  if (st->bufpos == st->buflen)
+    {
+      if (st->err)
+        {
+          log_error ("error receiving keys from dirmngr: %s\n",
+                     gpg_strerror (st->err));
+          gpg_err_set_errno (EIO);
+          return -1;
+        }
+      return 0;  /* EOF */
+    }
+
+  n = st->buflen - st->bufpos;
+  if (n > size)
+    n = size;
+  memcpy (buffer, st->buffer + st->bufpos, n);
+  st->bufpos += n;
+  return n;
+}
+
+
+static int
+ks_get_stream_close (void *cookie)
+{
+  struct ks_get_stream_s *st = cookie;
+
+  /* Skip data not read by the caller so that the context can be used
+     for the next command.  */
+  while (!st->eof)
+    ks_get_stream_next (st);
+  close_context (st->ctrl, st->ctx);
+  xfree (st->buffer);
+  xfree (st->stparm.source);
+  xfree (st);
+  return 0;
+}
+
+
+static es_cookie_io_functions_t ks_get_stream_functions =
+  {
+    ks_get_stream_read,
+    NULL,
+    NULL,
+    ks_get_stream_close
+  };
+
+
 /* Run the KS_GET command using the patterns in the array PATTERN.  On
    success an estream object is returned to retrieve the keys.  On
-   error an error code is returned and NULL stored at R_FP.
+   error an error code is returned and NULL stored at R_FP.  The keys
+   are received from the dirmngr while the caller reads the stream;
+   the caller must thus close the stream before the end of the
+   session.
 
    The pattern may only use search specification which a keyserver can
    use to retrieve keys.  Because we know the format of the pattern we
@@ -654,16 +791,12 @@ gpg_dirmngr_ks_get (ctrl_t ctrl, char **pattern,
 {
   gpg_error_t err;
   assuan_context_t ctx;
-  struct ks_status_parm_s stparm;
-  struct ks_get_parm_s parm;
+  struct ks_get_stream_s *st = NULL;
   char *line = NULL;
   size_t linelen;
   membuf_t mb;
   int idx;
 
-  memset (&stparm, 0, sizeof stparm);
-  memset (&parm, 0, sizeof parm);
-
   *r_fp = NULL;
   if (r_source)
     *r_source = NULL;
@@ -714,30 +847,48 @@ gpg_dirmngr_ks_get (ctrl_t ctrl, char **pattern,
       goto leave;
     }
 
-  parm.memfp = es_fopenmem (0, "rwb");
-  if (!parm.memfp)
+  st = xtrycalloc (1, sizeof *st);
+  if (!st || !(st->buffer = xtrymalloc (ASSUAN_LINELENGTH)))
     {
       err = gpg_error_from_syserror ();
       goto leave;
     }
-  err = assuan_transact (ctx, line, ks_get_data_cb, &parm,
-                         NULL, NULL, ks_status_cb, &stparm);
+  st->ctrl = ctrl;
+  st->ctx = ctx;
+
+  err = assuan_write_line (ctx, line);
   if (err)
     goto leave;
 
-  es_rewind (parm.memfp);
-  *r_fp = parm.memfp;
-  parm.memfp = NULL;
+  /* Wait for the first data so that an error or the source of the
+     data is reported the same way as by the other commands.  */
+  ks_get_stream_next (st);
+  if (r_source && st->stparm.source)
+    *r_source = xtrystrdup (st->stparm.source);
+  if (st->eof && st->err)
+    {
+      err = st->err;
+      goto leave;
+    }
 
+  *r_fp = es_fopencookie (st, "rb", ks_get_stream_functions);
+  if (!*r_fp)
+    {
+      err = gpg_error_from_syserror ();
+      while (!st->eof)
+        ks_get_stream_next (st);
+      goto leave;
+    }
+  st = NULL;
+  ctx = NULL;  /* Now owned by the stream.  */
 
  leave:
-  if (r_source && stparm.source)
+  if (st)
     {
-      *r_source = stparm.source;
-      stparm.source = NULL;
+      xfree (st->buffer);
+      xfree (st->stparm.source);
+      xfree (st);
     }
-  es_fclose (parm.memfp);
-  xfree (stparm.source);
   xfree (line);
   close_context (ctrl, ctx);
   return err;
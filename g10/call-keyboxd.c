@@ -42,10 +42,27 @@
 #include "../common/status.h"
 #include "../kbx/kbx-client-util.h"
 #include "keydb.h"
+#include "objcache.h"
 
 #include "keydb-private.h"  /* For struct keydb_handle_s */
 
 
+/* The initial and the maximum number of keys we request at once
+ * while listing all keys.  The window is doubled with each request
+ * so that a search for just the first key stays cheap.  */
+#define SEARCH_BATCH_INITIAL  8
+#define SEARCH_BATCH_MAX      256
+
+
+/* The PUBKEY_INFO values of a key in a batch.  */
+struct batch_info_s
+{
+  unsigned char ubid[UBID_LEN];
+  int uid_no;
+  int pk_no;
+};
+
+
 /* Data used to keep track of keybox daemon sessions.  This allows us
  * to use several sessions with the keyboxd and also to re-use already
  * established sessions.  Note that gpg.h defines the type
@@ -65,12 +82,35 @@ struct keyboxd_local_s
    * D-lines are used to convey the keyblocks. */
   iobuf_t search_result;
 
+  /* The keys prefetched by a batched search.  Each key in BATCH is
+   * prefixed by its length as a 4 byte number; BATCHOFF is the offset
+   * of the next key.  BATCH_INFO has BATCH_NINFO items with the
+   * related PUBKEY_INFO values; BATCH_NEXT is the index of the next
+   * item.  */
+  char *batch;
+  size_t batchlen;
+  size_t batchoff;
+  struct batch_info_s *batch_info;
+  unsigned int batch_ninfo;
+  unsigned int batch_infosize;
+  unsigned int batch_next;
+
+  /* The number of keys to request with the next batched search.  */
+  unsigned int batch_window;
+
   /* This flag set while an operation is running on this context.  */
   unsigned int is_active : 1;
 
   /* Flag indicating that a search reset is required.  */
   unsigned int need_search_reset : 1;
 
+  /* Flag indicating that the current search lists all keys and thus
+   * batched searches are used.  */
+  unsigned int batch_search : 1;
+
+  /* Flag set by the status callback if the server returned a batch.  */
+  unsigned int batch_seen : 1;
+
 };
 
 
@@ -96,6 +136,8 @@ gpg_keyboxd_deinit_session_data (ctrl_t ctrl)
         {
           kbx_client_data_release (kbl->kcd);
           kbl->kcd = NULL;
+          xfree (kbl->batch);
+          xfree (kbl->batch_info);
           if (kbl->ctx && in_transaction)
             {
               /* This is our hack to commit the changes done during a
@@ -159,6 +201,14 @@ create_new_context (ctrl_t ctrl, assuan_context_t *r_ctx)
     {
       /* Place to emit global options.  */
 
+      /* Ask for change notifications so that we can keep our caches
+       * coherent with changes done by other clients.  Older versions
+       * of keyboxd do not support this.  */
+      if (assuan_transact (ctx, "SUBSCRIBE",
+                           NULL, NULL, NULL, NULL, NULL, NULL)
+          && opt.verbose)
+        log_info ("keyboxd does not send change notifications\n");
+
       if ((opt.import_options & IMPORT_BULK) && !in_transaction)
         {
           err = assuan_transact (ctx, "TRANSACTION begin",
@@ -467,6 +517,7 @@ keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
                          NULL, NULL);
 
  leave:
+  cache_flush_pubkeyblocks (0);
   iobuf_close (iobuf);
   return err;
 }
@@ -518,6 +569,7 @@ keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
                          NULL, NULL);
 
  leave:
+  cache_flush_pubkeyblocks (0);
   iobuf_close (iobuf);
   return err;
 }
@@ -564,6 +616,7 @@ keydb_delete_keyblock (KEYDB_HANDLE hd)
                          NULL, NULL);
 
  leave:
+  cache_flush_pubkeyblocks (0);
   return err;
 }
 
@@ -605,6 +658,57 @@ keydb_search_reset (KEYDB_HANDLE hd)
 
 
 
+/* Drop the prefetched keys of KBL.  */
+static void
+clear_batch (keyboxd_local_t kbl)
+{
+  xfree (kbl->batch);
+  kbl->batch = NULL;
+  kbl->batchlen = 0;
+  kbl->batchoff = 0;
+  kbl->batch_ninfo = 0;
+  kbl->batch_next = 0;
+}
+
+
+/* Make the next prefetched key the search result of HD.  The caller
+ * must have checked that there is such a key.  */
+static gpg_error_t
+next_from_batch (KEYDB_HANDLE hd)
+{
+  keyboxd_local_t kbl = hd->kbl;
+  struct batch_info_s *bi;
+  size_t len;
+
+  log_assert (kbl->batch_next < kbl->batch_ninfo);
+
+  if (kbl->batchlen - kbl->batchoff < 4)
+    goto invalid;
+  len = buf32_to_size_t (kbl->batch + kbl->batchoff);
+  kbl->batchoff += 4;
+  if (len > kbl->batchlen - kbl->batchoff)
+    goto invalid;
+
+  kbl->search_result = iobuf_temp_with_content (kbl->batch + kbl->batchoff,
+                                                len);
+  kbl->batchoff += len;
+
+  bi = kbl->batch_info + kbl->batch_next++;
+  memcpy (hd->last_ubid, bi->ubid, UBID_LEN);
+  hd->last_uid_no = bi->uid_no;
+  hd->last_pk_no = bi->pk_no;
+  hd->last_ubid_valid = 1;
+  if (kbl->batch_next == kbl->batch_ninfo)
+    clear_batch (kbl);
+  return 0;
+
+ invalid:
+  log_error ("invalid batch received from keyboxd\n");
+  clear_batch (kbl);
+  return gpg_error (GPG_ERR_INV_RESPONSE);
+}
+
+
 /* Status callback for SEARCH and NEXT operaions.  */
 static gpg_error_t
 search_status_cb (void *opaque, const char *line)
@@ -647,6 +751,48 @@ search_status_cb (void *opaque, const char *line)
                 }
             }
         }
+
+      if (!err && hd->kbl->batch_search)
+        {
+          keyboxd_local_t kbl = hd->kbl;
+
+          if (kbl->batch_ninfo == kbl->batch_infosize)
+            {
+              struct batch_info_s *tmp;
+              unsigned int newsize;
+
+              newsize = kbl->batch_infosize + SEARCH_BATCH_INITIAL;
+              tmp = xtryrealloc (kbl->batch_info, newsize * sizeof *tmp);
+              if (!tmp)
+                return gpg_error_from_syserror ();
+              kbl->batch_info = tmp;
+              kbl->batch_infosize = newsize;
+            }
+          memcpy (kbl->batch_info[kbl->batch_ninfo].ubid, hd->last_ubid,
+                  UBID_LEN);
+          kbl->batch_info[kbl->batch_ninfo].uid_no = hd->last_uid_no;
+          kbl->batch_info[kbl->batch_ninfo].pk_no = hd->last_pk_no;
+          kbl->batch_ninfo++;
+        }
+    }
+  else if ((s = has_leading_keyword (line, "SEARCH_BATCH")))
+    hd->kbl->batch_seen = 1;
+  else if ((s = has_leading_keyword (line, "KEY_CHANGED")))
+    {
+      unsigned char ubid[UBID_LEN];
+
+      /* Another client changed a keyblock; drop our cached copies.
+       * The generation number is not used.  */
+      while (*s && !spacep (s))
+        s++;
+      while (spacep (s))
+        s++;
+      if (*s == '*')
+        getkey_invalidate_key (NULL);
+      else if (hex2fixedbuf (s, ubid, sizeof ubid))
+        getkey_invalidate_key (ubid);
+      else
+        err = gpg_error (GPG_ERR_INV_VALUE);
     }
 
   return err;
@@ -717,6 +863,13 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   /* Check whether this is a NEXT search.  */
   if (!hd->kbl->need_search_reset)
     {
+      /* Return the next key of a batch if we have one.  */
+      if (hd->kbl->batch_next < hd->kbl->batch_ninfo)
+        {
+          err = next_from_batch (hd);
+          goto leave;
+        }
+
       /* No reset requested thus continue the search.  The keyboxd
        * keeps the context of the search and thus the NEXT operates on
        * the last search pattern.  This is how we always used the
@@ -724,11 +877,17 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
        * search pattern between searches but that is not anymore
        * supported by keyboxd and a cursory check does not show that
        * we actually made used of that misfeature.  */
-      snprintf (line, sizeof line, "NEXT");
+      if (hd->kbl->batch_search)
+        snprintf (line, sizeof line, "NEXT --batch=%u",
+                  hd->kbl->batch_window);
+      else
+        snprintf (line, sizeof line, "NEXT");
       goto do_search;
     }
 
   hd->kbl->need_search_reset = 0;
+  hd->kbl->batch_search = 0;
+  clear_batch (hd->kbl);
 
   if (!ndesc)
     {
@@ -739,8 +898,12 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
     if (desc->mode == KEYDB_SEARCH_MODE_FIRST)
       {
         /* If any description has mode FIRST, this item trumps all
-         * other descriptions.  */
-        snprintf (line, sizeof line, "SEARCH --openpgp");
+         * other descriptions.  This lists all keys and thus we
+         * prefetch them in batches.  */
+        hd->kbl->batch_search = 1;
+        hd->kbl->batch_window = SEARCH_BATCH_INITIAL;
+        snprintf (line, sizeof line, "SEARCH --openpgp --batch=%u",
+                  hd->kbl->batch_window);
         goto do_search;
       }
 
@@ -847,15 +1010,32 @@ keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
 
  do_search:
   hd->last_ubid_valid = 0;
+  hd->kbl->batch_seen = 0;
+  clear_batch (hd->kbl);
   err = kbx_client_data_cmd (hd->kbl->kcd, line, search_status_cb, hd);
   if (!err && !(err = kbx_client_data_wait (hd->kbl->kcd, &buffer, &len)))
     {
-      hd->kbl->search_result = iobuf_temp_with_content (buffer, len);
-      xfree (buffer);
+      if (hd->kbl->batch_seen && hd->kbl->batch_ninfo)
+        {
+          hd->kbl->batch = buffer;
+          hd->kbl->batchlen = len;
+          if (hd->kbl->batch_window < SEARCH_BATCH_MAX)
+            hd->kbl->batch_window *= 2;
+          err = next_from_batch (hd);
+        }
+      else
+        {
+          /* A single key; for example from a server which does not
+           * support batches.  */
+          clear_batch (hd->kbl);
+          hd->kbl->search_result = iobuf_temp_with_buffer (buffer, len);
+        }
       if (DBG_LOOKUP && hd->last_ubid_valid)
         log_printhex (hd->last_ubid, 20, "found UBID (%d,%d):",
                       hd->last_uid_no, hd->last_pk_no);
     }
+  else
+    clear_batch (hd->kbl);
 
  leave:
   if (DBG_CLOCK)
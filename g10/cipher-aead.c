@@ -253,6 +253,69 @@ write_final_chunk (cipher_filter_context_t *cfx, iobuf_t a)
 }
 
 
+/* Encrypt LEN bytes at BUFFER in place and write them to stream A.
+ * If this is the first data of a chunk the nonce is set first.  If
+ * FINALIZE is set the data ends the current chunk and the auth tag
+ * is written.  */
+static gpg_error_t
+encrypt_and_write (cipher_filter_context_t *cfx, iobuf_t a,
+                   byte *buffer, size_t len, int finalize)
+{
+  gpg_error_t err;
+
+  if (DBG_FILTER)
+    log_debug ("encrypting: len=%zu %s\n", len, finalize?"(finalize)":"");
+
+  if (!cfx->chunklen)
+    {
+      if (DBG_FILTER)
+        log_debug ("start encrypting a new chunk\n");
+      err = set_nonce_and_ad (cfx, 0);
+      if (err)
+        return err;
+    }
+
+  if (finalize)
+    gcry_cipher_final (cfx->cipher_hd);
+  if (DBG_FILTER)
+    {
+      if (finalize)
+        log_printhex (buffer, len, "plain(1):");
+      else if (len > 32)
+        log_printhex (buffer + len - 32, 32, "plain(last32):");
+    }
+
+  /* Take care: even with a LEN of zero an encrypt needs to be called
+   * after gcry_cipher_final and before gcry_cipher_gettag - at least
+   * with libgcrypt 1.8 and OCB mode.  */
+  err = gcry_cipher_encrypt (cfx->cipher_hd, buffer, len, NULL, 0);
+  if (err)
+    return err;
+  if (finalize && DBG_FILTER)
+    log_printhex (buffer, len, "ciphr(1):");
+  err = my_iobuf_write (a, buffer, len);
+  if (err)
+    return err;
+  cfx->chunklen += len;
+  cfx->total += len;
+
+  if (finalize)
+    {
+      if (DBG_FILTER)
+        log_debug ("writing tag: chunklen=%ju total=%ju\n",
+                   (uintmax_t)cfx->chunklen, (uintmax_t)cfx->total);
+      err = write_auth_tag (cfx, a);
+      if (err)
+        return err;
+
+      cfx->chunkindex++;
+      cfx->chunklen = 0;
+    }
+
+  return 0;
+}
+
+
 /* The core of the flush sub-function of cipher_filter_aead.   */
 static gpg_error_t
 do_flush (cipher_filter_context_t *cfx, iobuf_t a, byte *buf, size_t size)
@@ -266,6 +329,30 @@ do_flush (cipher_filter_context_t *cfx, iobuf_t a, byte *buf, size_t size)
     log_debug ("flushing %zu bytes (cur buflen=%zu)\n", size, cfx->buflen);
   do
     {
+      /* If nothing is buffered and the caller passed at least a full
+       * buffer we encrypt in place, as much as fits into the current
+       * chunk.  BUF is the iobuf's own buffer and thus may be
+       * modified.  This saves a copy and lets Libgcrypt use its bulk
+       * functions on a large span.  */
+      if (!cfx->buflen && size >= cfx->bufsize)
+        {
+          n = size;
+          if (cfx->chunklen + n >= cfx->chunksize)
+            {
+              n = cfx->chunksize - cfx->chunklen;
+              finalize = 1;
+            }
+          else /* Only the last call of a chunk may have a partial block. */
+            n -= n % 16;
+          err = encrypt_and_write (cfx, a, buf, n, finalize);
+          if (err)
+            goto leave;
+          buf  += n;
+          size -= n;
+          finalize = 0;
+          continue;
+        }
+
       if (cfx->buflen + size < cfx->bufsize)
         n = size;
       else
@@ -290,60 +377,11 @@ do_flush (cipher_filter_context_t *cfx, iobuf_t a, byte *buf, size_t size)
 
       if (cfx->buflen == cfx->bufsize || finalize)
         {
-          if (DBG_FILTER)
-            log_debug ("encrypting: size=%zu buflen=%zu %s n=%zu\n",
-                       size, cfx->buflen, finalize?"(finalize)":"", n);
-
-          if (!cfx->chunklen)
-            {
-              if (DBG_FILTER)
-                log_debug ("start encrypting a new chunk\n");
-              err = set_nonce_and_ad (cfx, 0);
-              if (err)
-                goto leave;
-            }
-
-          if (finalize)
-            gcry_cipher_final (cfx->cipher_hd);
-          if (DBG_FILTER)
-            {
-              if (finalize)
-                log_printhex (cfx->buffer, cfx->buflen, "plain(1):");
-              else if (cfx->buflen > 32)
-                log_printhex (cfx->buffer + cfx->buflen - 32, 32,
-                              "plain(last32):");
-            }
-
-          /* Take care: even with a buflen of zero an encrypt needs to
-           * be called after gcry_cipher_final and before
-           * gcry_cipher_gettag - at least with libgcrypt 1.8 and OCB
-           * mode.  */
-          err = gcry_cipher_encrypt (cfx->cipher_hd, cfx->buffer, cfx->buflen,
-                                     NULL, 0);
+          err = encrypt_and_write (cfx, a, cfx->buffer, cfx->buflen, finalize);
           if (err)
             goto leave;
-          if (finalize && DBG_FILTER)
-            log_printhex (cfx->buffer, cfx->buflen, "ciphr(1):");
-          err = my_iobuf_write (a, cfx->buffer, cfx->buflen);
-          if (err)
-            goto leave;
-          cfx->chunklen += cfx->buflen;
-          cfx->total += cfx->buflen;
           cfx->buflen = 0;
-
-          if (finalize)
-            {
-              if (DBG_FILTER)
-                log_debug ("writing tag: chunklen=%ju total=%ju\n",
-                           (uintmax_t)cfx->chunklen, (uintmax_t)cfx->total);
-              err = write_auth_tag (cfx, a);
-              if (err)
-                goto leave;
-
-              cfx->chunkindex++;
-              cfx->chunklen = 0;
-              finalize = 0;
-            }
+          finalize = 0;
         }
     }
   while (size);
@@ -366,37 +404,9 @@ do_free (cipher_filter_context_t *cfx, iobuf_t a)
     {
       if (DBG_FILTER)
         log_debug ("encrypting last %zu bytes of the last chunk\n",cfx->buflen);
-
-      if (!cfx->chunklen)
-        {
-          if (DBG_FILTER)
-            log_debug ("start encrypting a new chunk\n");
-          err = set_nonce_and_ad (cfx, 0);
-          if (err)
-            goto leave;
-        }
-
-      gcry_cipher_final (cfx->cipher_hd);
-      err = gcry_cipher_encrypt (cfx->cipher_hd, cfx->buffer, cfx->buflen,
-                                 NULL, 0);
-      if (err)
-        goto leave;
-      err = my_iobuf_write (a, cfx->buffer, cfx->buflen);
+      err = encrypt_and_write (cfx, a, cfx->buffer, cfx->buflen, 1);
       if (err)
         goto leave;
-      /* log_printhex (cfx->buffer, cfx->buflen, "wrote:"); */
-      cfx->chunklen += cfx->buflen;
-      cfx->total += cfx->buflen;
-
-      /* Get and write the authentication tag.  */
-      if (DBG_FILTER)
-        log_debug ("writing tag: chunklen=%ju total=%ju\n",
-                   (uintmax_t)cfx->chunklen, (uintmax_t)cfx->total);
-      err = write_auth_tag (cfx, a);
-      if (err)
-        goto leave;
-      cfx->chunkindex++;
-      cfx->chunklen = 0;
     }
 
   /* Write the final chunk.  */
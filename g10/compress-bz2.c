@@ -55,7 +55,9 @@ init_compress( compress_filter_context_t *zfx, bz_stream *bzs )
   if((rc=BZ2_bzCompressInit(bzs,level,0,0))!=BZ_OK)
     log_fatal("bz2lib problem: %d\n",rc);
 
-  zfx->outbufsize = 8192;
+  /* Use buffers of the same size as the iobuf layer so that each
+   * write and read does not need to be split.  */
+  zfx->outbufsize = iobuf_set_buffer_size (0) * 1024;
   zfx->outbuf = xmalloc( zfx->outbufsize );
 }
 
@@ -105,7 +107,7 @@ init_uncompress( compress_filter_context_t *zfx, bz_stream *bzs )
   if((rc=BZ2_bzDecompressInit(bzs,0,opt.bz2_decompress_lowmem))!=BZ_OK)
     log_fatal("bz2lib problem: %d\n",rc);
 
-  zfx->inbufsize = 2048;
+  zfx->inbufsize = iobuf_set_buffer_size (0) * 1024;
   zfx->inbuf = xmalloc( zfx->inbufsize );
   bzs->avail_in = 0;
 }
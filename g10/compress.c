@@ -89,7 +89,9 @@ init_compress( compress_filter_context_t *zfx, z_stream *zs )
 						       "unknown error" );
     }
 
-    zfx->outbufsize = 8192;
+    /* Use buffers of the same size as the iobuf layer so that each
+     * write and read does not need to be split.  */
+    zfx->outbufsize = iobuf_set_buffer_size (0) * 1024;
     zfx->outbuf = xmalloc( zfx->outbufsize );
 }
 
@@ -153,7 +155,7 @@ init_uncompress( compress_filter_context_t *zfx, z_stream *zs )
 						       "unknown error" );
     }
 
-    zfx->inbufsize = 2048;
+    zfx->inbufsize = iobuf_set_buffer_size (0) * 1024;
     zfx->inbuf = xmalloc( zfx->inbufsize );
     zs->avail_in = 0;
 }
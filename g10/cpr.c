@@ -61,6 +61,49 @@ progress_cb (void *ctx, const char *what, int printchar,
 }
 
 
+/* Return true if the status line NO must not be kept in the buffer
+ * even with --buffer-status-output.  These are the lines a frontend
+ * may need to react on before gpg continues.  */
+static int
+status_needs_flush (int no)
+{
+  switch (no)
+    {
+    case STATUS_GET_BOOL:
+    case STATUS_GET_LINE:
+    case STATUS_GET_HIDDEN:
+    case STATUS_GOT_IT:
+    case STATUS_PROGRESS:
+    case STATUS_PINENTRY_LAUNCHED:
+    case STATUS_NEED_PASSPHRASE:
+    case STATUS_NEED_PASSPHRASE_SYM:
+    case STATUS_NEED_PASSPHRASE_PIN:
+    case STATUS_USERID_HINT:
+    case STATUS_INQUIRE_MAXLEN:
+    case STATUS_BEGIN_SIGNING:
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+
+/* Finish the status line NO which has just been written.  Unless
+ * buffering has been requested the line is flushed immediately.  */
+static void
+status_line_done (int no)
+{
+  int failed;
+
+  if (!opt.buffer_status_output || status_needs_flush (no))
+    failed = es_fflush (statusfp);
+  else
+    failed = es_ferror (statusfp);
+  if (failed && opt.exit_on_status_write_error)
+    g10_exit (0);
+}
+
+
 /* Return true if the status message NO may currently be issued.  We
    need this to avoid synchronization problem while auto retrieving a
    key.  There it may happen that a status NODATA is issued for a non
@@ -134,6 +177,79 @@ is_status_enabled ()
 }
 
 
+/* Flush buffered status lines.  Errors are ignored because this is
+ * also used on exit.  */
+void
+write_status_flush (void)
+{
+  if (statusfp)
+    es_fflush (statusfp);
+}
+
+
+/* Collect the status lines in memory instead of writing them to the
+ * status stream.  This is used by worker processes to hand the
+ * status lines over to their parent.  The original stream is not
+ * closed because the parent still uses it.  Does nothing if status
+ * output is disabled.  */
+void
+status_capture_start (void)
+{
+  if (!statusfp)
+    return;
+  es_fflush (statusfp);
+  statusfp = es_fopenmem (0, "w+b");
+  if (!statusfp)
+    log_fatal ("error creating a memory stream: %s\n",
+               gpg_strerror (gpg_error_from_syserror ()));
+}
+
+
+/* Store the status lines collected since status_capture_start or the
+ * last call of this function in a new buffer at R_BUFFER and their
+ * length at R_LENGTH.  */
+gpg_error_t
+status_capture_take (void **r_buffer, size_t *r_length)
+{
+  gpg_error_t err;
+
+  *r_buffer = NULL;
+  *r_length = 0;
+  if (!statusfp)
+    return 0;
+  if (es_fclose_snatch (statusfp, r_buffer, r_length))
+    {
+      err = gpg_error_from_syserror ();
+      statusfp = NULL;
+      return err;
+    }
+  statusfp = es_fopenmem (0, "w+b");
+  if (!statusfp)
+    {
+      err = gpg_error_from_syserror ();
+      xfree (*r_buffer);
+      *r_buffer = NULL;
+      *r_length = 0;
+      return err;
+    }
+  return 0;
+}
+
+
+/* Write the LENGTH bytes of complete status lines in BUFFER as
+ * collected by status_capture_take in a worker.  */
+void
+write_status_captured (const void *buffer, size_t length)
+{
+  if (!statusfp || !length)
+    return;
+  es_write (statusfp, buffer, length, NULL);
+  /* The lines end with FILE_DONE or a similar line which does not
+   * need an immediate flush.  */
+  status_line_done (STATUS_FILE_DONE);
+}
+
+
 void
 write_status ( int no )
 {
@@ -176,8 +292,7 @@ write_status_strings (int no, const char *text, ...)
       va_end (arg_ptr);
     }
   es_putc ('\n', statusfp);
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
-    g10_exit (0);
+  status_line_done (no);
 }
 
 
@@ -218,8 +333,7 @@ write_status_strings2 (ctrl_t dummy, int no, ...)
 
   va_end (arg_ptr);
 
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
-    g10_exit (0);
+  status_line_done (no);
 
   return 0;
 }
@@ -276,8 +390,7 @@ write_status_printf (int no, const char *format, ...)
       va_end (arg_ptr);
     }
   es_putc ('\n', statusfp);
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
-    g10_exit (0);
+  status_line_done (no);
 }
 
 
@@ -290,8 +403,7 @@ write_status_error (const char *where, gpg_error_t err)
 
   es_fprintf (statusfp, "[GNUPG:] %s %s %u\n",
               get_status_string (STATUS_ERROR), where, err);
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
-    g10_exit (0);
+  status_line_done (STATUS_ERROR);
 }
 
 
@@ -304,8 +416,7 @@ write_status_errcode (const char *where, int errcode)
 
   es_fprintf (statusfp, "[GNUPG:] %s %s %u\n",
               get_status_string (STATUS_ERROR), where, gpg_err_code (errcode));
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
-    g10_exit (0);
+  status_line_done (STATUS_ERROR);
 }
 
 
@@ -322,8 +433,7 @@ write_status_failure (const char *where, gpg_error_t err)
   any_failure_printed = 1;
   es_fprintf (statusfp, "[GNUPG:] %s %s %u\n",
               get_status_string (STATUS_FAILURE), where, err);
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
-    g10_exit (0);
+  status_line_done (STATUS_FAILURE);
 }
 
 
@@ -402,8 +512,7 @@ write_status_text_and_buffer (int no, const char *string,
   while (len);
 
   es_putc ('\n',statusfp);
-  if (es_fflush (statusfp) && opt.exit_on_status_write_error)
-    g10_exit (0);
+  status_line_done (no);
 }
 
 
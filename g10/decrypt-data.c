@@ -609,8 +609,10 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
   const size_t size = *ret_len; /* The allocated size of BUF.  */
   gpg_error_t err;
   size_t totallen = 0; /* The number of bytes to return on success or EOF.  */
-  size_t off = 0;      /* The offset into the buffer.  */
-  size_t len;          /* The current number of bytes in BUF+OFF.  */
+  size_t off = 0;      /* The offset into the buffer for the plaintext.  */
+  size_t src = 0;      /* The offset into the buffer for the ciphertext.  */
+  size_t len;          /* The current number of bytes in BUF+SRC.  */
+  size_t limit;        /* The number of bytes to fill BUF with.  */
 
   log_assert (size > 48); /* Our code requires at least this size.  */
 
@@ -632,8 +634,18 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
    * single byte reads in some lower layers.  The outcome is that we
    * have up to 48 extra extra octets which we will later put into the
    * holdback buffer for the next invocation (which handles the EOF
-   * case).  */
-  len = fill_buffer (dfx, a, buf, size, len);
+   * case).
+   *
+   * If a chunk does not fit into BUF we read only up to the end of
+   * the current chunk's tag plus the extra octets.  BUF then holds at
+   * most the tag of the current chunk and we do not need to move the
+   * plaintext of the next chunk over that tag.  This costs at most
+   * one extra call per chunk.  */
+  limit = size;
+  if (dfx->chunksize >= size
+      && dfx->chunksize - dfx->chunklen + 16 + 48 < size)
+    limit = dfx->chunksize - dfx->chunklen + 16 + 48;
+  len = fill_buffer (dfx, a, buf, limit, len);
   if (len < 32)
     {
       /* Not enough data for the last two tags.  */
@@ -660,7 +672,10 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
   /* log_printhex (dfx->holdback, dfx->holdbacklen, "holdback:"); */
 
   /* Decrypt the buffer.  This first requires a loop to handle the
-   * case when a chunk ends within the buffer.  */
+   * case when one or more chunks end within the buffer.  The
+   * ciphertext is decrypted in place at SRC and the plaintext is then
+   * moved down to OFF so that the tags between the chunks are removed
+   * in one pass over the buffer.  */
   if (DBG_FILTER)
     log_debug ("decrypt: chunklen=%ju total=%ju size=%zu len=%zu%s\n",
                dfx->chunklen, dfx->total, size, len,
@@ -682,25 +697,28 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
             goto leave;
         }
 
-      /* log_printhex (buf, n, "ciph:"); */
+      /* log_printhex (buf+src, n, "ciph:"); */
       gcry_cipher_final (dfx->cipher_hd);
-      err = gcry_cipher_decrypt (dfx->cipher_hd, buf+off, n, NULL, 0);
+      err = gcry_cipher_decrypt (dfx->cipher_hd, buf+src, n, NULL, 0);
       if (err)
         {
           log_error ("gcry_cipher_decrypt failed (1): %s\n",
                      gpg_strerror (err));
           goto leave;
         }
-      /* log_printhex (buf, n, "plai:"); */
+      /* log_printhex (buf+src, n, "plai:"); */
+      if (src != off)
+        memmove (buf + off, buf + src, n);
       totallen += n;
       dfx->chunklen += n;
       dfx->total += n;
       off += n;
+      src += n;
       len -= n;
 
       if (DBG_FILTER)
-        log_debug ("ndecrypted: %zu (nchunk=%ju) bytes left: %zu at off=%zu\n",
-                   totallen, dfx->chunklen, len, off);
+        log_debug ("ndecrypted: %zu (nchunk=%ju) bytes left: %zu at src=%zu\n",
+                   totallen, dfx->chunklen, len, src);
 
       /* Check the tag.  */
       if (len < 16)
@@ -708,7 +726,7 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
           /* The tag is not entirely in the buffer.  Read the rest of
            * the tag from the holdback buffer.  Then shift the holdback
            * buffer and fill it up again.  */
-          memcpy (tagbuf, buf+off, len);
+          memcpy (tagbuf, buf+src, len);
           memcpy (tagbuf + len, dfx->holdback, 16 - len);
           dfx->holdbacklen -= 16-len;
           memmove (dfx->holdback, dfx->holdback + (16-len), dfx->holdbacklen);
@@ -739,9 +757,10 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
         }
       else /* We already have the full tag.  */
         {
-          memcpy (tagbuf, buf+off, 16);
-          /* Remove that tag from the output.  */
-          memmove (buf + off, buf + off + 16, len - 16);
+          /* Skip that tag; it will be overwritten by the plaintext of
+           * the next chunk.  */
+          memcpy (tagbuf, buf+src, 16);
+          src += 16;
           len -= 16;
         }
       err = aead_checktag (dfx, 0, tagbuf);
@@ -770,13 +789,15 @@ aead_underflow (decode_filter_ctx_t dfx, iobuf_t a, byte *buf, size_t *ret_len)
            * not be a multiple of the block length.  */
           gcry_cipher_final (dfx->cipher_hd);
         }
-      err = gcry_cipher_decrypt (dfx->cipher_hd, buf + off, len, NULL, 0);
+      err = gcry_cipher_decrypt (dfx->cipher_hd, buf + src, len, NULL, 0);
       if (err)
         {
           log_error ("gcry_cipher_decrypt failed (2): %s\n",
                      gpg_strerror (err));
           goto leave;
         }
+      if (src != off)
+        memmove (buf + off, buf + src, len);
       totallen += len;
       dfx->chunklen += len;
       dfx->total += len;
@@ -908,44 +929,25 @@ mdc_decode_filter (void *opaque, int control, IOBUF a,
       log_assert (a);
       log_assert (size > 44); /* Our code requires at least this size.  */
 
-      /* Get at least 22 bytes and put it ahead in the buffer.  */
-      n = fill_buffer (dfx, a, buf, 44, 22);
-      if (n == 44)
-        {
-          /* We have enough stuff - flush the holdback buffer.  */
-          if ( !dfx->holdbacklen )  /* First time. */
-            {
-              memcpy (buf, buf+22, 22);
-              n = 22;
-	    }
-          else
-            {
-              memcpy (buf, dfx->holdback, 22);
-	    }
-
-          /* Fill up the buffer. */
-          n = fill_buffer (dfx, a, buf, size, n);
-
-          /* Move the trailing 22 bytes back to the holdback buffer.  We
-             have at least 44 bytes thus a memmove is not needed.  */
-          n -= 22;
-          memcpy (dfx->holdback, buf+n, 22 );
-          dfx->holdbacklen = 22;
-	}
-      else if ( !dfx->holdbacklen ) /* EOF seen but empty holdback. */
-        {
-          /* This is bad because it means an incomplete hash. */
-          n -= 22;
-          memcpy (buf, buf+22, n );
+      /* Flush the holdback buffer and fill up the buffer in one go.
+         The trailing 22 bytes are then copied to the holdback buffer
+         because they might be the MDC packet.  */
+      if (dfx->holdbacklen)
+        memcpy (buf, dfx->holdback, 22);
+      n = fill_buffer (dfx, a, buf, size, dfx->holdbacklen);
+      if (n < 22)
+        {
+          /* EOF seen but empty holdback.  This is bad because it
+             means an incomplete hash. */
+          log_assert (!dfx->holdbacklen);
           dfx->eof_seen = 2; /* EOF with incomplete hash.  */
-	}
-      else  /* EOF seen (i.e. read less than 22 bytes). */
+        }
+      else
         {
-          memcpy (buf, dfx->holdback, 22 );
           n -= 22;
-          memcpy (dfx->holdback, buf+n, 22 );
-          dfx->eof_seen = 1; /* Normal EOF. */
-	}
+          memcpy (dfx->holdback, buf+n, 22);
+          dfx->holdbacklen = 22;
+        }
 
       if ( n )
         {
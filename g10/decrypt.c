@@ -177,12 +177,74 @@ decrypt_message_fd (ctrl_t ctrl, int input_fd, int output_fd)
 }
 
 
+/* Decrypt the file FILENAME for decrypt_messages.  OPAQUE is the
+ * progress context.  */
+static gpg_error_t
+decrypt_one_file (ctrl_t ctrl, const char *filename, void *opaque)
+{
+  progress_filter_context_t *pfx = opaque;
+  IOBUF fp;
+  char *p, *output = NULL;
+  gpg_error_t rc = 0;
+
+  print_file_status(STATUS_FILE_START, filename, 3);
+  output = make_outfile_name(filename);
+  if (!output)
+    {
+      rc = gpg_error_from_syserror ();
+      goto next_file;
+    }
+  fp = iobuf_open(filename);
+  if (fp)
+    iobuf_ioctl (fp, IOBUF_IOCTL_NO_CACHE, 1, NULL);
+  if (fp && is_secured_file (iobuf_get_fd (fp)))
+    {
+      iobuf_close (fp);
+      fp = NULL;
+      gpg_err_set_errno (EPERM);
+    }
+  if (!fp)
+    {
+      rc = gpg_error_from_syserror ();
+      log_error(_("can't open '%s'\n"), print_fname_stdin(filename));
+      goto next_file;
+    }
+
+  handle_progress (pfx, fp, filename);
+
+  if (!opt.no_armor)
+    {
+      if (use_armor_filter(fp))
+        {
+          armor_filter_context_t *afx = new_armor_context ();
+          rc = push_armor_filter (afx, fp);
+          if (rc)
+            log_error("failed to push armor filter");
+          release_armor_context (afx);
+        }
+    }
+  rc = proc_packets (ctrl,NULL, fp);
+  iobuf_close(fp);
+  if (rc)
+    log_error("%s: decryption failed: %s\n", print_fname_stdin(filename),
+              gpg_strerror (rc));
+  p = get_last_passphrase();
+  set_next_passphrase(p);
+  xfree (p);
+
+ next_file:
+  /* Note that we emit file_done even after an error. */
+  write_status( STATUS_FILE_DONE );
+  xfree(output);
+  reset_literals_seen();
+  return rc;
+}
+
+
 void
 decrypt_messages (ctrl_t ctrl, int nfiles, char *files[])
 {
-  IOBUF fp;
   progress_filter_context_t *pfx;
-  char *p, *output = NULL;
   int rc=0,use_stdin=0;
   unsigned int lno=0;
 
@@ -194,6 +256,20 @@ decrypt_messages (ctrl_t ctrl, int nfiles, char *files[])
 
   pfx = new_progress_context ();
 
+  if (opt.multifile_jobs > 1)
+    {
+      gpg_error_t first_err;
+
+      rc = multifile_process (ctrl, nfiles, files,
+                              decrypt_one_file, pfx, &first_err);
+      if (rc)
+        log_error ("decryption of the files failed: %s\n",
+                   gpg_strerror (rc));
+      set_next_passphrase (NULL);
+      release_progress_context (pfx);
+      return;
+    }
+
   if(!nfiles)
     use_stdin=1;
 
@@ -229,52 +305,7 @@ decrypt_messages (ctrl_t ctrl, int nfiles, char *files[])
       if(filename==NULL)
 	break;
 
-      print_file_status(STATUS_FILE_START, filename, 3);
-      output = make_outfile_name(filename);
-      if (!output)
-        goto next_file;
-      fp = iobuf_open(filename);
-      if (fp)
-        iobuf_ioctl (fp, IOBUF_IOCTL_NO_CACHE, 1, NULL);
-      if (fp && is_secured_file (iobuf_get_fd (fp)))
-        {
-          iobuf_close (fp);
-          fp = NULL;
-          gpg_err_set_errno (EPERM);
-        }
-      if (!fp)
-        {
-          log_error(_("can't open '%s'\n"), print_fname_stdin(filename));
-          goto next_file;
-        }
-
-      handle_progress (pfx, fp, filename);
-
-      if (!opt.no_armor)
-        {
-          if (use_armor_filter(fp))
-            {
-              armor_filter_context_t *afx = new_armor_context ();
-              rc = push_armor_filter (afx, fp);
-              if (rc)
-                log_error("failed to push armor filter");
-              release_armor_context (afx);
-            }
-        }
-      rc = proc_packets (ctrl,NULL, fp);
-      iobuf_close(fp);
-      if (rc)
-        log_error("%s: decryption failed: %s\n", print_fname_stdin(filename),
-                  gpg_strerror (rc));
-      p = get_last_passphrase();
-      set_next_passphrase(p);
-      xfree (p);
-
-    next_file:
-      /* Note that we emit file_done even after an error. */
-      write_status( STATUS_FILE_DONE );
-      xfree(output);
-      reset_literals_seen();
+      decrypt_one_file (ctrl, filename, pfx);
     }
 
   set_next_passphrase(NULL);
@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "gpg.h"
 #include "options.h"
@@ -39,9 +40,11 @@
 #include "../common/status.h"
 #include "pkglue.h"
 #include "../common/compliance.h"
+#include "worker.h"
 
 
-static int encrypt_simple( const char *filename, int mode, int use_seskey );
+static int encrypt_simple (const char *filename, int mode, int use_seskey,
+                           STRING2KEY *symkey_s2k, DEK *symkey_dek);
 static int write_pubkey_enc_from_list (ctrl_t ctrl,
                                        PK_LIST pk_list, DEK *dek, iobuf_t out);
 
@@ -52,7 +55,7 @@ static int write_pubkey_enc_from_list (ctrl_t ctrl,
 int
 encrypt_symmetric (const char *filename)
 {
-  return encrypt_simple( filename, 1, opt.force_aead);
+  return encrypt_simple (filename, 1, opt.force_aead, NULL, NULL);
 }
 
 
@@ -63,7 +66,7 @@ encrypt_symmetric (const char *filename)
 int
 encrypt_store (const char *filename)
 {
-  return encrypt_simple( filename, 0, 0 );
+  return encrypt_simple (filename, 0, 0, NULL, NULL);
 }
 
 
@@ -257,9 +260,11 @@ use_mdc (pk_list_t pk_list,int algo)
 /* We don't want to use use_seskey yet because older gnupg versions
    can't handle it, and there isn't really any point unless we're
    making a message that can be decrypted by a public key or
-   passphrase. */
+   passphrase.  If SYMKEY_DEK is not NULL it and SYMKEY_S2K are used
+   instead of asking for a passphrase.  */
 static int
-encrypt_simple (const char *filename, int mode, int use_seskey)
+encrypt_simple (const char *filename, int mode, int use_seskey,
+                STRING2KEY *symkey_s2k, DEK *symkey_dek)
 {
   iobuf_t inp, out;
   PACKET pkt;
@@ -321,7 +326,15 @@ encrypt_simple (const char *filename, int mode, int use_seskey)
     {
       aead_algo_t aead_algo;
 
-      rc = setup_symkey (&s2k, &cfx.dek);
+      if (symkey_dek)
+        {
+          s2k = xmalloc (sizeof *s2k);
+          *s2k = *symkey_s2k;
+          cfx.dek = xmalloc_secure (sizeof *cfx.dek);
+          *cfx.dek = *symkey_dek;
+        }
+      else
+        rc = setup_symkey (&s2k, &cfx.dek);
       if (rc)
         {
           iobuf_close (inp);
@@ -1059,19 +1072,17 @@ encrypt_filter (void *opaque, int control,
 }
 
 
-/*
- * Write a pubkey-enc packet for the public key PK to OUT.
- */
-int
-write_pubkey_enc (ctrl_t ctrl,
-                  PKT_public_key *pk, int throw_keyid, DEK *dek, iobuf_t out)
+/* Encrypt the session key DEK for PK and return the new
+ * PUBKEY_ENC packet at R_ENC.  */
+static gpg_error_t
+make_pubkey_enc (PKT_public_key *pk, int throw_keyid, DEK *dek,
+                 PKT_pubkey_enc **r_enc)
 {
-  PACKET pkt;
   PKT_pubkey_enc *enc;
-  int rc;
+  gpg_error_t err;
   gcry_mpi_t frame;
 
-  print_pubkey_algo_note ( pk->pubkey_algo );
+  *r_enc = NULL;
   enc = xmalloc_clear ( sizeof *enc );
   enc->pubkey_algo = pk->pubkey_algo;
   keyid_from_pk( pk, enc->keyid );
@@ -1091,23 +1102,54 @@ write_pubkey_enc (ctrl_t ctrl,
    * build_packet().  */
   frame = encode_session_key (pk->pubkey_algo, dek,
                               pubkey_nbits (pk->pubkey_algo, pk->pkey));
-  rc = pk_encrypt (pk->pubkey_algo, enc->data, frame, pk, pk->pkey);
+  err = pk_encrypt (pk->pubkey_algo, enc->data, frame, pk, pk->pkey);
   gcry_mpi_release (frame);
-  if (rc)
-    log_error ("pubkey_encrypt failed: %s\n", gpg_strerror (rc) );
-  else
+  if (err)
     {
-      if ( opt.verbose )
-        {
-          char *ustr = get_user_id_string_native (ctrl, enc->keyid);
-          log_info (_("%s/%s.%s encrypted for: \"%s\"\n"),
-                    openpgp_pk_algo_name (enc->pubkey_algo),
-                    openpgp_cipher_algo_name (dek->algo),
-                    dek->use_aead? openpgp_aead_algo_name (dek->use_aead)
-                    /**/         : "CFB",
-                    ustr );
-          xfree (ustr);
-        }
+      log_error ("pubkey_encrypt failed: %s\n", gpg_strerror (err) );
+      free_pubkey_enc (enc);
+      return err;
+    }
+  *r_enc = enc;
+  return 0;
+}
+
+
+/* Print the info about the recipient of ENC.  */
+static void
+print_pubkey_enc_info (ctrl_t ctrl, PKT_pubkey_enc *enc, DEK *dek)
+{
+  char *ustr;
+
+  if (!opt.verbose)
+    return;
+  ustr = get_user_id_string_native (ctrl, enc->keyid);
+  log_info (_("%s/%s.%s encrypted for: \"%s\"\n"),
+            openpgp_pk_algo_name (enc->pubkey_algo),
+            openpgp_cipher_algo_name (dek->algo),
+            dek->use_aead? openpgp_aead_algo_name (dek->use_aead)
+            /**/         : "CFB",
+            ustr );
+  xfree (ustr);
+}
+
+
+/*
+ * Write a pubkey-enc packet for the public key PK to OUT.
+ */
+int
+write_pubkey_enc (ctrl_t ctrl,
+                  PKT_public_key *pk, int throw_keyid, DEK *dek, iobuf_t out)
+{
+  PACKET pkt;
+  PKT_pubkey_enc *enc;
+  int rc;
+
+  print_pubkey_algo_note ( pk->pubkey_algo );
+  rc = make_pubkey_enc (pk, throw_keyid, dek, &enc);
+  if (!rc)
+    {
+      print_pubkey_enc_info (ctrl, enc, dek);
       /* And write it. */
       init_packet (&pkt);
       pkt.pkttype = PKT_PUBKEY_ENC;
@@ -1116,12 +1158,216 @@ write_pubkey_enc (ctrl_t ctrl,
       if (rc)
         log_error ("build_packet(pubkey_enc) failed: %s\n",
                    gpg_strerror (rc));
+      free_pubkey_enc(enc);
     }
-  free_pubkey_enc(enc);
   return rc;
 }
 
 
+#ifndef HAVE_W32_SYSTEM
+
+#define MAX_ENCRYPT_JOBS 64
+
+/* A process used by write_pubkey_enc_from_list.  Worker K of N
+ * encrypts the session key for the recipients with the indices K,
+ * K+N, K+2N, ... and returns the serialized PUBKEY_ENC packets in
+ * this order.  Because the parent reads the results in the order of
+ * the recipients, the output is the same as without workers.  */
+struct encrypt_worker_s
+{
+  struct worker_s proc;
+};
+
+/* The parameters for encrypt_worker_main.  */
+struct encrypt_worker_parm_s
+{
+  PK_LIST pk_list;
+  DEK *dek;
+  int k;
+  int nworkers;
+};
+
+
+/* The main function of worker K of NWORKERS.  Each result is the
+ * length of the packet as an u32 followed by the packet or the value
+ * (u32)(-1) followed by an error code.  Note that Libgcrypt's RNGs
+ * detect the fork and reseed; thus the workers do not use the same
+ * random for the Elgamal or ECDH ephemeral keys.  */
+static void
+encrypt_worker_main (void *opaque, int in_fd, int out_fd)
+{
+  struct encrypt_worker_parm_s *parm = opaque;
+  PK_LIST pk_list = parm->pk_list;
+  DEK *dek = parm->dek;
+  int k = parm->k;
+  int nworkers = parm->nworkers;
+  PACKET pkt;
+  PKT_pubkey_enc *enc;
+  iobuf_t tmp;
+  gpg_error_t err;
+  u32 len;
+  int i;
+
+  (void)in_fd;
+
+  for (i=0; pk_list; pk_list = pk_list->next, i++)
+    {
+      if ((i % nworkers) != k)
+        continue;
+
+      tmp = NULL;
+      err = make_pubkey_enc (pk_list->pk,
+                             (opt.throw_keyids || (pk_list->flags&1)),
+                             dek, &enc);
+      if (!err)
+        {
+          tmp = iobuf_temp ();
+          init_packet (&pkt);
+          pkt.pkttype = PKT_PUBKEY_ENC;
+          pkt.pkt.pubkey_enc = enc;
+          err = build_packet (tmp, &pkt);
+          free_pubkey_enc (enc);
+        }
+      if (err)
+        {
+          len = (u32)(-1);
+          if (worker_writen (out_fd, &len, sizeof len)
+              || worker_writen (out_fd, &err, sizeof err))
+            break;
+        }
+      else
+        {
+          len = iobuf_get_temp_length (tmp);
+          if (worker_writen (out_fd, &len, sizeof len)
+              || worker_writen (out_fd, iobuf_get_temp_buffer (tmp), len))
+            break;
+        }
+      if (tmp)
+        iobuf_cancel (tmp);
+    }
+}
+
+
+/* Stop the NWORKERS processes in WORKERS.  */
+static void
+encrypt_stop_workers (struct encrypt_worker_s *workers, int nworkers)
+{
+  int i;
+
+  /* A worker might still be busy; we do not need its results
+   * anymore.  */
+  for (i=0; i < nworkers; i++)
+    worker_stop (&workers[i].proc, 1);
+}
+
+
+/* Start NWORKERS worker processes to encrypt DEK for the keys in
+ * PK_LIST and store them at WORKERS.  */
+static gpg_error_t
+encrypt_start_workers (PK_LIST pk_list, DEK *dek,
+                       struct encrypt_worker_s *workers, int nworkers)
+{
+  gpg_error_t err = 0;
+  struct encrypt_worker_parm_s parm;
+  int i;
+
+  for (i=0; i < nworkers; i++)
+    worker_init (&workers[i].proc);
+
+  parm.pk_list = pk_list;
+  parm.dek = dek;
+  parm.nworkers = nworkers;
+  for (i=0; !err && i < nworkers; i++)
+    {
+      /* The child gets its own copy of PARM.  */
+      parm.k = i;
+      err = worker_start (&workers[i].proc, 0, encrypt_worker_main, &parm);
+    }
+
+  if (err)
+    {
+      log_info ("error starting encrypt worker: %s\n", gpg_strerror (err));
+      encrypt_stop_workers (workers, nworkers);
+    }
+  return err;
+}
+
+
+/* Write the PUBKEY_ENC packets for PK_LIST to OUT using NWORKERS
+ * worker processes.  Returns GPG_ERR_NOT_SUPPORTED if the workers
+ * can't be used; nothing has been written in this case.  */
+static gpg_error_t
+write_pubkey_enc_parallel (ctrl_t ctrl, PK_LIST pk_list, DEK *dek,
+                           iobuf_t out, int nworkers)
+{
+  struct encrypt_worker_s workers[MAX_ENCRYPT_JOBS];
+  gpg_error_t err = 0;
+  byte *buffer = NULL;
+  size_t buffersize = 0;
+  PKT_pubkey_enc enc;
+  u32 len;
+  int i;
+
+  if (nworkers > MAX_ENCRYPT_JOBS)
+    nworkers = MAX_ENCRYPT_JOBS;
+  if (encrypt_start_workers (pk_list, dek, workers, nworkers))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (opt.verbose)
+    log_info ("using %d processes to encrypt the session key\n", nworkers);
+
+  for (i=0; !err && pk_list; pk_list = pk_list->next, i++)
+    {
+      struct encrypt_worker_s *w = workers + (i % nworkers);
+
+      print_pubkey_algo_note (pk_list->pk->pubkey_algo);
+      err = worker_readn (w->proc.from_fd, &len, sizeof len);
+      if (!err && len == (u32)(-1))
+        {
+          gpg_error_t werr;
+
+          /* The worker has already printed a diagnostic.  */
+          err = worker_readn (w->proc.from_fd, &werr, sizeof werr);
+          if (!err)
+            err = werr? werr : gpg_error (GPG_ERR_GENERAL);
+          break;
+        }
+      if (err)
+        {
+          log_error ("error reading from encrypt worker: %s\n",
+                     gpg_strerror (err));
+          break;
+        }
+      if (len > buffersize)
+        {
+          xfree (buffer);
+          buffersize = len;
+          buffer = xmalloc (buffersize);
+        }
+      err = worker_readn (w->proc.from_fd, buffer, len);
+      if (err)
+        {
+          log_error ("error reading from encrypt worker: %s\n",
+                     gpg_strerror (err));
+          break;
+        }
+
+      if (opt.verbose)
+        {
+          memset (&enc, 0, sizeof enc);
+          enc.pubkey_algo = pk_list->pk->pubkey_algo;
+          keyid_from_pk (pk_list->pk, enc.keyid);
+          print_pubkey_enc_info (ctrl, &enc, dek);
+        }
+      err = iobuf_write (out, buffer, len);
+    }
+
+  xfree (buffer);
+  encrypt_stop_workers (workers, nworkers);
+  return err;
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
 /*
  * Write pubkey-enc packets from the list of PKs to OUT.
  */
@@ -1136,6 +1382,21 @@ write_pubkey_enc_from_list (ctrl_t ctrl, PK_LIST pk_list, DEK *dek, iobuf_t out)
       compliance_failure();
     }
 
+#ifndef HAVE_W32_SYSTEM
+  /* Wrapping the session key for many recipients takes a while,
+   * particularly with Elgamal and ECDH keys; thus we may use worker
+   * processes.  */
+  if (opt.encrypt_jobs > 1 && pk_list && pk_list->next)
+    {
+      gpg_error_t err;
+
+      err = write_pubkey_enc_parallel (ctrl, pk_list, dek, out,
+                                       opt.encrypt_jobs);
+      if (gpg_err_code (err) != GPG_ERR_NOT_SUPPORTED)
+        return err;
+    }
+#endif
+
   for ( ; pk_list; pk_list = pk_list->next )
     {
       PKT_public_key *pk = pk_list->pk;
@@ -1148,6 +1409,93 @@ write_pubkey_enc_from_list (ctrl_t ctrl, PK_LIST pk_list, DEK *dek, iobuf_t out)
   return 0;
 }
 
+
+/* The passphrase derived key used by encrypt_symmetric_files.  */
+struct symkey_parm_s
+{
+  STRING2KEY *s2k;
+  DEK *dek;
+  int use_seskey;
+};
+
+
+/* Encrypt the file FNAME for encrypt_symmetric_files with the key
+ * given by the symkey_parm_s OPAQUE.  */
+static gpg_error_t
+encrypt_symmetric_one_file (ctrl_t ctrl, const char *fname, void *opaque)
+{
+  struct symkey_parm_s *parm = opaque;
+  int rc;
+
+  (void)ctrl;
+
+  print_file_status (STATUS_FILE_START, fname, 2);
+  rc = encrypt_simple (fname, 1, parm->use_seskey, parm->s2k, parm->dek);
+  if (rc)
+    log_error (_("symmetric encryption of '%s' failed: %s\n"),
+               print_fname_stdin (fname), gpg_strerror (rc));
+  write_status (STATUS_FILE_DONE);
+  return rc;
+}
+
+
+/* Encrypt the NFILES FILES or the files named on stdin with only the
+ * symmetric cipher.  The passphrase is asked for and hashed only once
+ * for all files.  With AEAD each file gets its own random session
+ * key which is encrypted with the passphrase derived key.  The old
+ * version 4 SKESK encrypts the session key without an IV; thus the
+ * derived key is used directly for each file in this case, which is
+ * safe due to the random prefix of the encrypted data.  */
+void
+encrypt_symmetric_files (ctrl_t ctrl, int nfiles, char **files)
+{
+  struct symkey_parm_s parm;
+  gpg_error_t first_err;
+  int rc;
+
+  if (opt.outfile)
+    {
+      log_error(_("--output doesn't work for this command\n"));
+      return;
+    }
+
+  rc = setup_symkey (&parm.s2k, &parm.dek);
+  if (rc)
+    {
+      log_error (_("error creating passphrase: %s\n"), gpg_strerror (rc));
+      return;
+    }
+  parm.use_seskey = (use_aead (NULL, parm.dek->algo)
+                     && (parm.s2k->mode == 1 || parm.s2k->mode == 3));
+
+  rc = multifile_process (ctrl, nfiles, files,
+                          encrypt_symmetric_one_file, &parm, &first_err);
+  if (rc)
+    log_error ("symmetric encryption of the files failed: %s\n",
+               gpg_strerror (rc));
+  xfree (parm.dek);
+  xfree (parm.s2k);
+}
+
+
+/* Encrypt the file FNAME for encrypt_crypt_files to the keys in the
+ * PK_LIST given by OPAQUE.  */
+static gpg_error_t
+encrypt_one_file (ctrl_t ctrl, const char *fname, void *opaque)
+{
+  PK_LIST pk_list = opaque;
+  int rc;
+
+  print_file_status (STATUS_FILE_START, fname, 2);
+  rc = encrypt_crypt (ctrl, -1, fname, NULL, 0, pk_list, -1);
+  if (rc)
+    log_error ("encryption of '%s' failed: %s\n",
+               print_fname_stdin (fname), gpg_strerror (rc));
+  write_status (STATUS_FILE_DONE);
+  return rc;
+}
+
+
 void
 encrypt_crypt_files (ctrl_t ctrl, int nfiles, char **files, strlist_t remusr)
 {
@@ -1159,6 +1507,28 @@ encrypt_crypt_files (ctrl_t ctrl, int nfiles, char **files, strlist_t remusr)
       return;
     }
 
+  if (opt.multifile_jobs > 1)
+    {
+      PK_LIST pk_list;
+      gpg_error_t first_err;
+
+      /* The recipients are resolved only once and the list is used
+       * by all workers.  */
+      rc = build_pk_list (ctrl, remusr, &pk_list);
+      if (rc)
+        {
+          log_error ("encryption failed: %s\n", gpg_strerror (rc));
+          return;
+        }
+      rc = multifile_process (ctrl, nfiles, files,
+                              encrypt_one_file, pk_list, &first_err);
+      if (rc)
+        log_error ("encryption of the files failed: %s\n",
+                   gpg_strerror (rc));
+      release_pk_list (pk_list);
+      return;
+    }
+
   if (!nfiles)
     {
       char line[2048];
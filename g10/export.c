@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "gpg.h"
 #include "options.h"
@@ -43,6 +44,7 @@
 #include "call-agent.h"
 #include "key-clean.h"
 #include "pkglue.h"
+#include "worker.h"
 
 
 /* An object to keep track of subkeys. */
@@ -1897,6 +1899,330 @@ do_export_one_keyblock (ctrl_t ctrl, kbnode_t keyblock, u32 *keyid,
 }
 
 
+/* Search the next keyblock with DESC and store it at R_KEYBLOCK.  If
+ * ALL is set the search mode is switched to NEXT.  */
+static gpg_error_t
+export_fetch_keyblock (KEYDB_HANDLE kdbhd, KEYDB_SEARCH_DESC *desc,
+                       size_t ndesc, size_t *r_descindex, int all,
+                       kbnode_t *r_keyblock)
+{
+  gpg_error_t err;
+
+  *r_keyblock = NULL;
+  err = keydb_search (kdbhd, desc, ndesc, r_descindex);
+  if (all)
+    desc[0].mode = KEYDB_SEARCH_MODE_NEXT;
+  if (err)
+    return err;
+
+  err = keydb_get_keyblock (kdbhd, r_keyblock);
+  if (err)
+    log_error (_("error reading keyblock: %s\n"), gpg_strerror (err));
+  return err;
+}
+
+
+#ifndef HAVE_W32_SYSTEM
+/* The upper limit for --export-jobs.  */
+#define MAX_EXPORT_JOBS 64
+
+/* A worker process used to check the signatures of the keyblocks
+ * while the main process cleans and writes the previous ones.  The
+ * worker reads the keyblock itself from the key database and returns
+ * the result of the signature checks.  The main process marks the
+ * signatures as checked so that cleaning the keyblock uses the cached
+ * result.  Each worker has at most one keyblock in flight; thus a
+ * round robin dispatch returns the keyblocks in their original
+ * order.  */
+struct export_worker_s
+{
+  struct worker_s proc; /* Requests are the fingerprints.  */
+  kbnode_t keyblock;  /* The keyblock in this slot or NULL.  */
+  size_t descindex;   /* The descindex of the search for KEYBLOCK.  */
+  int dispatched;     /* The worker is checking KEYBLOCK.  */
+};
+
+/* The read ahead queue of do_export_stream.  Slot I of the queue is
+ * processed by worker I.  */
+struct export_pipeline_s
+{
+  int nworkers;
+  int next;           /* The slot with the oldest keyblock.  */
+  int count;          /* The number of keyblocks in the queue.  */
+  int broken;         /* Do not dispatch to the workers anymore.  */
+  int eof;            /* The search returned an error ...  */
+  gpg_error_t eof_err;/* ... with this code.  */
+  struct export_worker_s workers[MAX_EXPORT_JOBS];
+};
+
+/* The result for a signature is its timestamp, the low part of the
+ * signer's keyid, and the flags.  The first two values are used to
+ * detect a different keyblock.  */
+#define EXPORT_SIGFLAG_CHECKED 1
+#define EXPORT_SIGFLAG_VALID   2
+
+
+/* The main loop of a worker process.  A request is the fingerprint
+ * of the primary key as its length as an u32 followed by the
+ * fingerprint.  The result is the number of signatures as an u32
+ * followed by three u32 for each signature or the value (u32)(-1) if
+ * the keyblock could not be read.  OPAQUE is the ctrl object.  */
+static void
+export_worker_main (void *opaque, int in_fd, int out_fd)
+{
+  ctrl_t ctrl = opaque;
+  KEYDB_HANDLE kdbhd;
+  kbnode_t keyblock, node;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  u32 *result = NULL;
+  size_t resultsize = 0;
+  u32 len, nsigs;
+
+  keydb_prepare_worker (ctrl);
+  kdbhd = keydb_new (ctrl);
+  if (!kdbhd)
+    _exit (2);
+
+  while (!worker_readn (in_fd, &len, sizeof len))
+    {
+      if (len > sizeof fpr || worker_readn (in_fd, fpr, len))
+        break;
+
+      keyblock = NULL;
+      if (keydb_search_reset (kdbhd)
+          || keydb_search_fpr (kdbhd, fpr, len)
+          || keydb_get_keyblock (kdbhd, &keyblock))
+        {
+          nsigs = (u32)(-1);
+          if (worker_writen (out_fd, &nsigs, sizeof nsigs))
+            break;
+          continue;
+        }
+
+      /* The self-signatures are checked first so that the key
+       * flags are known when checking the others.  */
+      merge_keys_and_selfsig (ctrl, keyblock);
+      nsigs = 0;
+      for (node = keyblock; node; node = node->next)
+        if (node->pkt->pkttype == PKT_SIGNATURE)
+          {
+            PKT_signature *sig = node->pkt->pkt.signature;
+
+            if (!sig->flags.checked)
+              check_key_signature (ctrl, keyblock, node, NULL);
+            if ((nsigs + 1) * 3 > resultsize)
+              {
+                resultsize += 3 * 256;
+                result = xrealloc (result, resultsize * sizeof *result);
+              }
+            result[nsigs * 3] = sig->timestamp;
+            result[nsigs * 3 + 1] = sig->keyid[1];
+            result[nsigs * 3 + 2] = ((sig->flags.checked
+                                      ? EXPORT_SIGFLAG_CHECKED : 0)
+                                     | (sig->flags.valid
+                                        ? EXPORT_SIGFLAG_VALID : 0));
+            nsigs++;
+          }
+      release_kbnode (keyblock);
+      if (worker_writen (out_fd, &nsigs, sizeof nsigs)
+          || (nsigs && worker_writen (out_fd, result,
+                                      nsigs * 3 * sizeof *result)))
+        break;
+    }
+}
+
+
+/* Stop the workers of PIPELINE and release it.  */
+static void
+export_stop_pipeline (struct export_pipeline_s *pipeline)
+{
+  int i;
+
+  if (!pipeline)
+    return;
+
+  for (i=0; i < pipeline->nworkers; i++)
+    worker_close_requests (&pipeline->workers[i].proc);
+  for (i=0; i < pipeline->nworkers; i++)
+    {
+      struct export_worker_s *wk = pipeline->workers + i;
+
+      worker_stop (&wk->proc, 0);
+      release_kbnode (wk->keyblock);
+      wk->keyblock = NULL;
+    }
+  xfree (pipeline);
+}
+
+
+/* Start NWORKERS worker processes and return a new pipeline.
+ * Returns NULL on error.  */
+static struct export_pipeline_s *
+export_start_pipeline (ctrl_t ctrl, int nworkers)
+{
+  gpg_error_t err;
+  struct export_pipeline_s *pipeline;
+  int i;
+
+  if (nworkers > MAX_EXPORT_JOBS)
+    nworkers = MAX_EXPORT_JOBS;
+
+  pipeline = xtrycalloc (1, sizeof *pipeline);
+  if (!pipeline)
+    {
+      err = gpg_error_from_syserror ();
+      log_info ("error starting export worker: %s\n", gpg_strerror (err));
+      return NULL;
+    }
+  pipeline->nworkers = nworkers;
+  for (i=0; i < nworkers; i++)
+    worker_init (&pipeline->workers[i].proc);
+
+  err = 0;
+  for (i=0; !err && i < nworkers; i++)
+    err = worker_start (&pipeline->workers[i].proc, 1,
+                        export_worker_main, ctrl);
+
+  if (err)
+    {
+      log_info ("error starting export worker: %s\n", gpg_strerror (err));
+      export_stop_pipeline (pipeline);
+      return NULL;
+    }
+  if (opt.verbose)
+    log_info ("using %d processes to check the signatures\n", nworkers);
+  return pipeline;
+}
+
+
+/* Send the fingerprint of the keyblock of WK to its worker.  */
+static gpg_error_t
+export_dispatch_keyblock (struct export_worker_s *wk)
+{
+  gpg_error_t err;
+  kbnode_t node;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  u32 len;
+
+  node = find_kbnode (wk->keyblock, PKT_PUBLIC_KEY);
+  if (!node)
+    return 0;  /* Will be skipped anyway.  */
+  fingerprint_from_pk (node->pkt->pkt.public_key, fpr, &fprlen);
+  len = fprlen;
+  err = worker_writen (wk->proc.to_fd, &len, sizeof len);
+  if (!err)
+    err = worker_writen (wk->proc.to_fd, fpr, len);
+  if (!err)
+    wk->dispatched = 1;
+  return err;
+}
+
+
+/* Wait for the result of WK and mark the checked signatures of its
+ * keyblock.  A result is only used for a signature if it matches.  */
+static gpg_error_t
+export_collect_keyblock (struct export_worker_s *wk)
+{
+  gpg_error_t err;
+  kbnode_t node;
+  u32 nsigs, n;
+  u32 *result = NULL;
+
+  wk->dispatched = 0;
+  err = worker_readn (wk->proc.from_fd, &nsigs, sizeof nsigs);
+  if (err)
+    return err;
+  if (nsigs == (u32)(-1) || !nsigs)
+    return 0;  /* The worker could not read it; we check it later.  */
+  if (nsigs > 0x100000)
+    return gpg_error (GPG_ERR_TOO_LARGE);
+
+  result = xtrymalloc (nsigs * 3 * sizeof *result);
+  if (!result)
+    return gpg_error_from_syserror ();
+  err = worker_readn (wk->proc.from_fd, result, nsigs * 3 * sizeof *result);
+  if (err)
+    goto leave;
+
+  for (n = 0, node = wk->keyblock; node && n < nsigs; node = node->next)
+    if (node->pkt->pkttype == PKT_SIGNATURE)
+      {
+        PKT_signature *sig = node->pkt->pkt.signature;
+
+        if (result[n * 3] != sig->timestamp
+            || result[n * 3 + 1] != sig->keyid[1])
+          break;  /* Not the same keyblock.  */
+        if ((result[n * 3 + 2] & EXPORT_SIGFLAG_CHECKED))
+          {
+            sig->flags.checked = 1;
+            sig->flags.valid = !!(result[n * 3 + 2] & EXPORT_SIGFLAG_VALID);
+          }
+        n++;
+      }
+
+ leave:
+  xfree (result);
+  return err;
+}
+
+
+/* Return the next keyblock like export_fetch_keyblock but read ahead
+ * so that the workers of PIPELINE can check the signatures of the
+ * next keyblocks while the caller exports this one.  */
+static gpg_error_t
+pipeline_fetch_keyblock (struct export_pipeline_s *pipeline,
+                         KEYDB_HANDLE kdbhd, KEYDB_SEARCH_DESC *desc,
+                         size_t ndesc, size_t *r_descindex, int all,
+                         kbnode_t *r_keyblock)
+{
+  gpg_error_t err;
+  struct export_worker_s *wk;
+
+  *r_keyblock = NULL;
+
+  /* Fill the free slots.  */
+  while (!pipeline->eof && pipeline->count < pipeline->nworkers)
+    {
+      wk = pipeline->workers + ((pipeline->next + pipeline->count)
+                                % pipeline->nworkers);
+      err = export_fetch_keyblock (kdbhd, desc, ndesc, &wk->descindex, all,
+                                   &wk->keyblock);
+      if (err)
+        {
+          pipeline->eof = 1;
+          pipeline->eof_err = err;
+          break;
+        }
+      pipeline->count++;
+      if (!pipeline->broken && (err = export_dispatch_keyblock (wk)))
+        {
+          log_info ("error sending keyblock to export worker: %s\n",
+                    gpg_strerror (err));
+          pipeline->broken = 1;
+        }
+    }
+
+  if (!pipeline->count)
+    return pipeline->eof_err;
+
+  wk = pipeline->workers + pipeline->next;
+  if (wk->dispatched && (err = export_collect_keyblock (wk)))
+    {
+      log_info ("error receiving result from export worker: %s\n",
+                gpg_strerror (err));
+      pipeline->broken = 1;
+    }
+  *r_keyblock = wk->keyblock;
+  *r_descindex = wk->descindex;
+  wk->keyblock = NULL;
+  pipeline->next = (pipeline->next + 1) % pipeline->nworkers;
+  pipeline->count--;
+  return 0;
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
 /* Export the keys identified by the list of strings in USERS to the
    stream OUT.  If SECRET is false public keys will be exported.  With
    secret true secret keys will be exported; in this case 1 means the
@@ -1922,6 +2248,9 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
   gcry_cipher_hd_t cipherhd = NULL;
   struct export_stats_s dummystats;
   iobuf_t out_help = NULL;
+#ifndef HAVE_W32_SYSTEM
+  struct export_pipeline_s *pipeline = NULL;
+#endif
 
   if (!stats)
     stats = &dummystats;
@@ -2008,26 +2337,33 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
       kek = NULL;
     }
 
+#ifndef HAVE_W32_SYSTEM
+  /* The workers mark the signatures as checked; thus they are of no
+   * use with --no-sig-cache.  They can't share our connection to the
+   * keyboxd.  */
+  if (opt.export_jobs > 1 && (options & EXPORT_CLEAN) && !secret
+      && !keyblock_out && !opt.no_sig_cache && !opt.use_keyboxd)
+    pipeline = export_start_pipeline (ctrl, opt.export_jobs);
+#endif
+
   for (;;)
     {
       u32 keyid[2];
       PKT_public_key *pk;
 
-      err = keydb_search (kdbhd, desc, ndesc, &descindex);
-      if (!users)
-        desc[0].mode = KEYDB_SEARCH_MODE_NEXT;
-      if (err)
-        break;
-
       /* Read the keyblock. */
       release_kbnode (keyblock);
       keyblock = NULL;
-      err = keydb_get_keyblock (kdbhd, &keyblock);
+#ifndef HAVE_W32_SYSTEM
+      if (pipeline)
+        err = pipeline_fetch_keyblock (pipeline, kdbhd, desc, ndesc,
+                                       &descindex, !users, &keyblock);
+      else
+#endif
+        err = export_fetch_keyblock (kdbhd, desc, ndesc, &descindex, !users,
+                                     &keyblock);
       if (err)
-        {
-          log_error (_("error reading keyblock: %s\n"), gpg_strerror (err));
-          goto leave;
-	}
+        break;
 
       node = find_kbnode (keyblock, PKT_PUBLIC_KEY);
       if (!node)
@@ -2138,6 +2474,9 @@ do_export_stream (ctrl_t ctrl, iobuf_t out, strlist_t users, int secret,
     err = 0;
 
  leave:
+#ifndef HAVE_W32_SYSTEM
+  export_stop_pipeline (pipeline);
+#endif
   iobuf_cancel (out_help);
   gcry_cipher_close (cipherhd);
   xfree(desc);
@@ -115,6 +115,18 @@ free_seckey_enc( PKT_signature *sig )
 }
 
 
+/* Drop a reference to the shared S-expression P.  */
+static void
+release_pk_sexp (struct pk_sexp_s *p)
+{
+  if (p && !--p->ref)
+    {
+      gcry_sexp_release (p->s_pkey);
+      xfree (p);
+    }
+}
+
+
 void
 release_public_key_parts (PKT_public_key *pk)
 {
@@ -136,6 +148,8 @@ release_public_key_parts (PKT_public_key *pk)
       xfree (pk->seckey_info);
       pk->seckey_info = NULL;
     }
+  release_pk_sexp (pk->sexp);
+  pk->sexp = NULL;
   if (pk->prefs)
     {
       xfree (pk->prefs);
@@ -230,6 +244,15 @@ copy_public_key (PKT_public_key *d, PKT_public_key *s)
   d->user_id = scopy_user_id (s->user_id);
   d->prefs = copy_prefs (s->prefs);
 
+  /* Share the S-expression so that a copy taken from the key cache
+   * profits from an earlier verification.  If it has not yet been
+   * built we create the empty container now.  */
+  if (!s->sexp && (s->sexp = xtrycalloc (1, sizeof *s->sexp)))
+    s->sexp->ref = 1;
+  d->sexp = s->sexp;
+  if (d->sexp)
+    d->sexp->ref++;
+
   n = pubkey_get_npkey (s->pubkey_algo);
   i = 0;
   if (!n)
@@ -319,6 +342,51 @@ scopy_user_id (PKT_user_id *s)
 
 
 
+/*
+ * deep copy of the user ID; the reference counter of the copy is 1.
+ * The attribute data is not copied but shared with S.
+ */
+PKT_user_id *
+copy_user_id (PKT_user_id *s)
+{
+  PKT_user_id *d;
+  int i;
+
+  if (s->attrib_data && !s->attrib_ref)
+    {
+      s->attrib_ref = xmalloc (sizeof *s->attrib_ref);
+      *s->attrib_ref = 1;
+    }
+  d = xmalloc (sizeof *d + s->len);
+  memcpy (d, s, sizeof *d + s->len);
+  d->ref = 1;
+  if (s->attrib_data)
+    ++*s->attrib_ref;
+  if (s->attribs)
+    {
+      d->attribs = xmalloc (s->numattribs * sizeof *d->attribs);
+      for (i = 0; i < s->numattribs; i++)
+        {
+          d->attribs[i] = s->attribs[i];
+          if (s->attrib_data)
+            d->attribs[i].data = (d->attrib_data
+                                  + (s->attribs[i].data - s->attrib_data));
+        }
+    }
+  if (s->namehash)
+    {
+      d->namehash = xmalloc (20);
+      memcpy (d->namehash, s->namehash, 20);
+    }
+  d->prefs = copy_prefs (s->prefs);
+  if (s->updateurl)
+    d->updateurl = xstrdup (s->updateurl);
+  if (s->mbox)
+    d->mbox = xstrdup (s->mbox);
+  return d;
+}
+
+
 void
 free_comment( PKT_comment *rem )
 {
@@ -332,11 +400,16 @@ free_attributes(PKT_user_id *uid)
     return;
 
   xfree(uid->attribs);
-  xfree(uid->attrib_data);
+  if (!uid->attrib_ref || !--*uid->attrib_ref)
+    {
+      xfree (uid->attrib_ref);
+      xfree (uid->attrib_data);
+    }
 
   uid->attribs=NULL;
   uid->attrib_data=NULL;
   uid->attrib_len=0;
+  uid->attrib_ref=NULL;
 }
 
 void
@@ -120,15 +120,31 @@ typedef struct keyid_list
 
 
 #if MAX_PK_CACHE_ENTRIES
+/* The public key cache is a hash table indexed by the key id.  All
+ * entries are also linked into a list in the order of their last use
+ * so that the least recently used entry can be evicted.  */
 typedef struct pk_cache_entry
 {
-  struct pk_cache_entry *next;
+  struct pk_cache_entry *next;      /* Next in the hash bucket.  */
+  struct pk_cache_entry *lru_prev;  /* More recently used entry.  */
+  struct pk_cache_entry *lru_next;  /* Less recently used entry.  */
   u32 keyid[2];
   PKT_public_key *pk;
 } *pk_cache_entry_t;
-static pk_cache_entry_t pk_cache;
+static pk_cache_entry_t *pk_cache_table;
+static unsigned int pk_cache_table_size;  /* A power of two.  */
+static pk_cache_entry_t pk_cache_lru;       /* Most recently used.  */
+static pk_cache_entry_t pk_cache_lru_tail;  /* Least recently used.  */
 static int pk_cache_entries;	/* Number of entries in pk cache.  */
+static int pk_cache_max_entries;
 static int pk_cache_disabled;
+static struct
+{
+  unsigned int hits;
+  unsigned int misses;
+  unsigned int added;
+  unsigned int evicted;
+} pk_cache_stats;
 #endif
 
 #if MAX_UID_CACHE_ENTRIES < 5
@@ -162,6 +178,135 @@ print_stats ()
 #endif
 
 
+#if MAX_PK_CACHE_ENTRIES
+/* Return the hash bucket for KEYID.  */
+static pk_cache_entry_t *
+pk_cache_bucket (u32 *keyid)
+{
+  return pk_cache_table + ((keyid[1] ^ keyid[0]) & (pk_cache_table_size - 1));
+}
+
+
+/* Allocate the hash table of the cache.  Returns false if that is not
+ * possible.  */
+static int
+pk_cache_init (void)
+{
+  if (pk_cache_table)
+    return 1;
+
+  pk_cache_max_entries = opt.pk_cache_size;
+  if (pk_cache_max_entries < 2)
+    pk_cache_max_entries = MAX_PK_CACHE_ENTRIES;
+  for (pk_cache_table_size = 16;
+       pk_cache_table_size < pk_cache_max_entries / 2;
+       pk_cache_table_size *= 2)
+    ;
+  pk_cache_table = xtrycalloc (pk_cache_table_size, sizeof *pk_cache_table);
+  if (!pk_cache_table)
+    {
+      pk_cache_table_size = 0;
+      pk_cache_disabled = 1;
+      return 0;
+    }
+  return 1;
+}
+
+
+/* Unlink CE from the LRU list.  */
+static void
+pk_cache_lru_unlink (pk_cache_entry_t ce)
+{
+  if (ce->lru_prev)
+    ce->lru_prev->lru_next = ce->lru_next;
+  else
+    pk_cache_lru = ce->lru_next;
+  if (ce->lru_next)
+    ce->lru_next->lru_prev = ce->lru_prev;
+  else
+    pk_cache_lru_tail = ce->lru_prev;
+}
+
+
+/* Put CE at the head of the LRU list.  */
+static void
+pk_cache_lru_push (pk_cache_entry_t ce)
+{
+  ce->lru_prev = NULL;
+  ce->lru_next = pk_cache_lru;
+  if (pk_cache_lru)
+    pk_cache_lru->lru_prev = ce;
+  else
+    pk_cache_lru_tail = ce;
+  pk_cache_lru = ce;
+}
+
+
+/* Return the cache entry for KEYID or NULL.  The entry is marked as
+ * recently used.  */
+static pk_cache_entry_t
+pk_cache_lookup (u32 *keyid)
+{
+  pk_cache_entry_t ce;
+
+  if (!pk_cache_table)
+    return NULL;
+
+  for (ce = *pk_cache_bucket (keyid); ce; ce = ce->next)
+    if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
+      {
+        if (ce != pk_cache_lru)
+          {
+            pk_cache_lru_unlink (ce);
+            pk_cache_lru_push (ce);
+          }
+        return ce;
+      }
+  return NULL;
+}
+
+
+/* Remove the least recently used entry from the cache.  */
+static void
+pk_cache_evict (void)
+{
+  pk_cache_entry_t ce = pk_cache_lru_tail;
+  pk_cache_entry_t *cep;
+
+  if (!ce)
+    return;
+  pk_cache_lru_unlink (ce);
+  for (cep = pk_cache_bucket (ce->keyid); *cep; cep = &(*cep)->next)
+    if (*cep == ce)
+      {
+        *cep = ce->next;
+        break;
+      }
+  free_public_key (ce->pk);
+  xfree (ce);
+  pk_cache_entries--;
+  pk_cache_stats.evicted++;
+}
+#endif /*MAX_PK_CACHE_ENTRIES*/
+
+
+/* Print statistics about the public key cache.  */
+void
+getkey_dump_stats (void)
+{
+#if MAX_PK_CACHE_ENTRIES
+  unsigned int total = pk_cache_stats.hits + pk_cache_stats.misses;
+
+  log_info ("pk_cache: size=%d/%d hits=%u misses=%u (%u%% hits)\n",
+            pk_cache_entries, pk_cache_max_entries,
+            pk_cache_stats.hits, pk_cache_stats.misses,
+            total? (unsigned int)(100.0 * pk_cache_stats.hits / total) : 0);
+  log_info ("          added=%u evicted=%u\n",
+            pk_cache_stats.added, pk_cache_stats.evicted);
+#endif
+}
+
+
 /* Cache a copy of a public key in the public key cache.  PK is not
  * cached if caching is disabled (via getkey_disable_caches), if
  * PK->FLAGS.DONT_CACHE is set, we don't know how to derive a key id
@@ -178,10 +323,10 @@ void
 cache_public_key (PKT_public_key * pk)
 {
 #if MAX_PK_CACHE_ENTRIES
-  pk_cache_entry_t ce, ce2;
+  pk_cache_entry_t ce, *bucket;
   u32 keyid[2];
 
-  if (pk_cache_disabled)
+  if (pk_cache_disabled || !pk_cache_init ())
     return;
 
   if (pk->flags.dont_cache)
@@ -199,7 +344,8 @@ cache_public_key (PKT_public_key * pk)
   else
     return; /* Don't know how to get the keyid.  */
 
-  for (ce = pk_cache; ce; ce = ce->next)
+  bucket = pk_cache_bucket (keyid);
+  for (ce = *bucket; ce; ce = ce->next)
     if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
       {
 	if (DBG_CACHE)
@@ -207,32 +353,14 @@ cache_public_key (PKT_public_key * pk)
 	return;
       }
 
-  if (pk_cache_entries >= MAX_PK_CACHE_ENTRIES)
-    {
-      int n;
-
-      /* Remove the last 50% of the entries.  */
-      for (ce = pk_cache, n = 0; ce && n < pk_cache_entries/2; n++)
-        ce = ce->next;
-      if (ce && ce != pk_cache && ce->next)
-        {
-          ce2 = ce->next;
-          ce->next = NULL;
-          ce = ce2;
-          for (; ce; ce = ce2)
-            {
-              ce2 = ce->next;
-              free_public_key (ce->pk);
-              xfree (ce);
-              pk_cache_entries--;
-            }
-        }
-      log_assert (pk_cache_entries < MAX_PK_CACHE_ENTRIES);
-    }
+  while (pk_cache_entries >= pk_cache_max_entries)
+    pk_cache_evict ();
   pk_cache_entries++;
+  pk_cache_stats.added++;
   ce = xmalloc (sizeof *ce);
-  ce->next = pk_cache;
-  pk_cache = ce;
+  ce->next = *bucket;
+  *bucket = ce;
+  pk_cache_lru_push (ce);
   ce->pk = copy_public_key (NULL, pk);
   ce->keyid[0] = keyid[0];
   ce->keyid[1] = keyid[1];
@@ -257,8 +385,8 @@ user_id_not_found_utf8 (void)
 
 
 /* Disable and drop the public key cache (which is filled by
-   cache_public_key and get_pubkey).  Note: there is currently no way
-   to re-enable this cache.  */
+   cache_public_key and get_pubkey) and the keyblock cache.  Note:
+   there is currently no way to re-enable these caches.  */
 void
 getkey_disable_caches ()
 {
@@ -266,21 +394,74 @@ getkey_disable_caches ()
   {
     pk_cache_entry_t ce, ce2;
 
-    for (ce = pk_cache; ce; ce = ce2)
+    for (ce = pk_cache_lru; ce; ce = ce2)
       {
-	ce2 = ce->next;
+	ce2 = ce->lru_next;
 	free_public_key (ce->pk);
 	xfree (ce);
       }
     pk_cache_disabled = 1;
     pk_cache_entries = 0;
-    pk_cache = NULL;
+    pk_cache_lru = pk_cache_lru_tail = NULL;
+    xfree (pk_cache_table);
+    pk_cache_table = NULL;
+    pk_cache_table_size = 0;
   }
 #endif
+  cache_flush_pubkeyblocks (1);
   /* fixme: disable user id cache ? */
 }
 
 
+/* Drop everything cached for the keyblock with UBID from the public
+ * key cache and the keyblock cache.  If UBID is NULL all cached keys
+ * are dropped.  Unlike getkey_disable_caches the caches are used
+ * again thereafter.  This is called if keyboxd tells us that another
+ * client changed a keyblock.  */
+void
+getkey_invalidate_key (const byte *ubid)
+{
+#if MAX_PK_CACHE_ENTRIES
+  pk_cache_entry_t ce, ce2, *cep;
+  u32 kid_v4[2], kid_v5[2];
+
+  /* The UBID is the fingerprint or its first 20 octets.  Thus the
+   * keyid of the primary key is at its end for a v4 key and at its
+   * start for a v5 key.  */
+  if (ubid)
+    {
+      kid_v4[0] = buf32_to_u32 (ubid + 12);
+      kid_v4[1] = buf32_to_u32 (ubid + 16);
+      kid_v5[0] = buf32_to_u32 (ubid);
+      kid_v5[1] = buf32_to_u32 (ubid + 4);
+    }
+
+  for (ce = pk_cache_lru; ce; ce = ce2)
+    {
+      ce2 = ce->lru_next;
+      if (ubid
+          && !(ce->pk->main_keyid[0] == kid_v4[0]
+               && ce->pk->main_keyid[1] == kid_v4[1])
+          && !(ce->pk->main_keyid[0] == kid_v5[0]
+               && ce->pk->main_keyid[1] == kid_v5[1]))
+        continue;
+      pk_cache_lru_unlink (ce);
+      for (cep = pk_cache_bucket (ce->keyid); *cep; cep = &(*cep)->next)
+        if (*cep == ce)
+          {
+            *cep = ce->next;
+            break;
+          }
+      free_public_key (ce->pk);
+      xfree (ce);
+      pk_cache_entries--;
+      pk_cache_stats.evicted++;
+    }
+#endif
+  cache_drop_pubkeyblock (ubid);
+}
+
+
 /* Free a list of pubkey_t objects.  */
 void
 pubkeys_free (pubkey_t keys)
@@ -326,8 +507,35 @@ get_pubkey_for_sig (ctrl_t ctrl, PKT_public_key *pk, PKT_signature *sig,
 
   /* First try the ISSUER_FPR info.  */
   fpr = issuer_fpr_raw (sig, &fprlen);
+#if MAX_PK_CACHE_ENTRIES
+  if (fpr && (fprlen == 20 || fprlen == 32))
+    {
+      /* The cache is indexed by the keyid; thus we need to compare
+       * the fingerprint.  */
+      pk_cache_entry_t ce;
+      u32 keyid[2];
+      byte cfpr[MAX_FINGERPRINT_LEN];
+      size_t cfprlen;
+
+      keyid_from_fingerprint (ctrl, fpr, fprlen, keyid);
+      ce = pk_cache_lookup (keyid);
+      if (ce)
+        {
+          fingerprint_from_pk (ce->pk, cfpr, &cfprlen);
+          if (cfprlen == fprlen && !memcmp (cfpr, fpr, fprlen))
+            {
+              pk_cache_stats.hits++;
+              copy_public_key (pk, ce->pk);
+              return 0;
+            }
+        }
+    }
+#endif
   if (fpr && !get_pubkey_byfprint (ctrl, pk, NULL, fpr, fprlen))
-    return 0;
+    {
+      cache_public_key (pk);
+      return 0;
+    }
 
   /* Fallback to use the ISSUER_KEYID.  */
   return get_pubkey (ctrl, pk, sig->keyid);
@@ -367,17 +575,17 @@ get_pubkey (ctrl_t ctrl, PKT_public_key * pk, u32 * keyid)
       /* Try to get it from the cache.  We don't do this when pk is
          NULL as it does not guarantee that the user IDs are
          cached. */
-      pk_cache_entry_t ce;
-      for (ce = pk_cache; ce; ce = ce->next)
-	{
-	  if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1])
-	    /* XXX: We don't check PK->REQ_USAGE here, but if we don't
-	       read from the cache, we do check it!  */
-	    {
-	      copy_public_key (pk, ce->pk);
-	      return 0;
-	    }
-	}
+      pk_cache_entry_t ce = pk_cache_lookup (keyid);
+
+      if (ce)
+        /* XXX: We don't check PK->REQ_USAGE here, but if we don't
+           read from the cache, we do check it!  */
+        {
+          pk_cache_stats.hits++;
+          copy_public_key (pk, ce->pk);
+          return 0;
+        }
+      pk_cache_stats.misses++;
     }
 #endif
   /* More init stuff.  */
@@ -445,6 +653,65 @@ leave:
 }
 
 
+/* Look up the public keys with the N key ids at KEYIDS and store
+ * them in the cache used by get_pubkey and get_pubkey_for_sig.  All
+ * keys are searched with one keydb_search, which is much faster than
+ * one search for each key if there are many signatures in a message.
+ * This is only an optimization and thus errors are ignored.  */
+void
+prefetch_pubkeys (ctrl_t ctrl, u32 (*keyids)[2], int n)
+{
+#if MAX_PK_CACHE_ENTRIES
+  KEYDB_SEARCH_DESC *desc;
+  KEYDB_HANDLE hd;
+  kbnode_t keyblock, found_key;
+  int i, ndesc;
+
+  if (pk_cache_disabled || n < 2 || !pk_cache_init ())
+    return;
+
+  desc = xtrycalloc (n, sizeof *desc);
+  if (!desc)
+    return;
+  for (i=ndesc=0; i < n; i++)
+    if (!pk_cache_lookup (keyids[i]))
+      {
+        desc[ndesc].mode = KEYDB_SEARCH_MODE_LONG_KID;
+        desc[ndesc].u.kid[0] = keyids[i][0];
+        desc[ndesc].u.kid[1] = keyids[i][1];
+        ndesc++;
+      }
+  if (ndesc < 2)
+    goto leave;  /* Nothing to gain.  */
+
+  hd = keydb_new (ctrl);
+  if (!hd)
+    goto leave;
+  while (!keydb_search (hd, desc, ndesc, NULL))
+    {
+      if (keydb_get_keyblock (hd, &keyblock))
+        break;
+      /* Do the same as lookup would do for get_pubkey.  */
+      merge_selfsigs (ctrl, keyblock);
+      found_key = finish_lookup (keyblock, 0, 1, 0, NULL);
+      if (found_key)
+        cache_public_key (found_key->pkt->pkt.public_key);
+      release_kbnode (keyblock);
+      /* See lookup for why we need to disable the keyblock cache.  */
+      keydb_disable_caching (hd);
+    }
+  keydb_release (hd);
+
+ leave:
+  xfree (desc);
+#else
+  (void)ctrl;
+  (void)keyids;
+  (void)n;
+#endif
+}
+
+
 /* Similar to get_pubkey, but it does not take PK->REQ_USAGE into
  * account nor does it merge in the self-signed data.  This function
  * also only considers primary keys.  It is intended to be used as a
@@ -467,20 +734,19 @@ get_pubkey_fast (ctrl_t ctrl, PKT_public_key * pk, u32 * keyid)
 #if MAX_PK_CACHE_ENTRIES
   {
     /* Try to get it from the cache */
-    pk_cache_entry_t ce;
+    pk_cache_entry_t ce = pk_cache_lookup (keyid);
 
-    for (ce = pk_cache; ce; ce = ce->next)
+    if (ce
+        /* Only consider primary keys.  */
+        && ce->pk->keyid[0] == ce->pk->main_keyid[0]
+        && ce->pk->keyid[1] == ce->pk->main_keyid[1])
       {
-	if (ce->keyid[0] == keyid[0] && ce->keyid[1] == keyid[1]
-	    /* Only consider primary keys.  */
-	    && ce->pk->keyid[0] == ce->pk->main_keyid[0]
-	    && ce->pk->keyid[1] == ce->pk->main_keyid[1])
-	  {
-	    if (pk)
-	      copy_public_key (pk, ce->pk);
-	    return 0;
-	  }
+        pk_cache_stats.hits++;
+        if (pk)
+          copy_public_key (pk, ce->pk);
+        return 0;
       }
+    pk_cache_stats.misses++;
   }
 #endif
 
@@ -555,6 +821,10 @@ get_pubkeyblock (ctrl_t ctrl, u32 * keyid)
   int rc = 0;
   KBNODE keyblock = NULL;
 
+  keyblock = cache_get_pubkeyblock (keyid);
+  if (keyblock)
+    return keyblock;
+
   memset (&ctx, 0, sizeof ctx);
   /* No need to set exact here because we want the entire block.  */
   ctx.not_allocated = 1;
@@ -567,6 +837,8 @@ get_pubkeyblock (ctrl_t ctrl, u32 * keyid)
   ctx.items[0].u.kid[1] = keyid[1];
   rc = lookup (ctrl, &ctx, 0, &keyblock, NULL);
   getkey_end (ctrl, &ctx);
+  if (!rc)
+    cache_put_pubkeyblock (keyblock);
 
   return rc ? NULL : keyblock;
 }
@@ -2487,6 +2759,36 @@ sig_to_revoke_info (PKT_signature * sig, struct revoke_info *rinfo)
 }
 
 
+/* Helper for merge_selfsigs_main and merge_selfsigs_subkey: Return
+ * the node of the newest of the NCAND self-signatures in CAND which
+ * verifies or NULL if none does.  Of signatures with the same
+ * timestamp the one last in the keyblock is taken.  Signatures older
+ * than the returned one can't make a difference and are thus not
+ * verified.  Entries which did not verify are set to NULL.  */
+static kbnode_t
+newest_valid_selfsig (ctrl_t ctrl, kbnode_t keyblock,
+                      kbnode_t *cand, int ncand)
+{
+  int i, best;
+
+  for (;;)
+    {
+      best = -1;
+      for (i = 0; i < ncand; i++)
+        if (cand[i]
+            && (best == -1
+                || (cand[i]->pkt->pkt.signature->timestamp
+                    >= cand[best]->pkt->pkt.signature->timestamp)))
+          best = i;
+      if (best == -1)
+        return NULL;
+      if (!check_key_signature (ctrl, keyblock, cand[best], NULL))
+        return cand[best];
+      cand[best] = NULL;  /* Signature did not verify.  */
+    }
+}
+
+
 /* Given a keyblock, parse the key block and extract various pieces of
  * information and save them with the primary key packet and the user
  * id packets.  For instance, some information is stored in signature
@@ -2529,6 +2831,8 @@ merge_selfsigs_main (ctrl_t ctrl, kbnode_t keyblock, int *r_revoked,
   u32 key_expire = 0;
   int key_expire_seen = 0;
   byte sigversion = 0;
+  kbnode_t *cand = NULL;  /* Self-signatures of the current user id.  */
+  int ncand, ncandalloc = 0;
 
   *r_revoked = 0;
   memset (rinfo, 0, sizeof (*rinfo));
@@ -2765,63 +3069,77 @@ merge_selfsigs_main (ctrl_t ctrl, kbnode_t keyblock, int *r_revoked,
   /* According to RFC 4880 section 11.1, user id and attribute packets
    * are in the second section, after the public key packet and before
    * the subkey packets.  */
-  signode = uidnode = NULL;
-  sigdate = 0; /* Helper variable to find the latest signature in one UID. */
-  for (k = keyblock; k && k->pkt->pkttype != PKT_PUBLIC_SUBKEY; k = k->next)
+  uidnode = NULL;
+  ncand = 0;
+  for (k = keyblock; ; k = k->next)
     {
-      if (k->pkt->pkttype == PKT_USER_ID || k->pkt->pkttype == PKT_ATTRIBUTE)
-	{ /* New user id packet.  */
-
-          /* Apply the data from the most recent self-signed packet to
-	   * the preceding user id packet.  */
-	  if (uidnode && signode)
+      if (!k || k->pkt->pkttype == PKT_PUBLIC_SUBKEY
+          || k->pkt->pkttype == PKT_USER_ID
+          || k->pkt->pkttype == PKT_ATTRIBUTE)
+	{
+          /* Apply the data from the most recent valid self-signature
+	   * to the preceding user id packet.  */
+	  if (uidnode && ncand)
 	    {
-	      fixup_uidnode (uidnode, signode, keytimestamp);
-	      pk->flags.valid = 1;
+              signode = newest_valid_selfsig (ctrl, keyblock, cand, ncand);
+              if (signode)
+                {
+                  PKT_signature *sig = signode->pkt->pkt.signature;
+                  int i;
+
+                  if (sig->version > sigversion)
+                    sigversion = sig->version;
+                  /* Only a v3 key may have self-signatures with
+                   * different versions; take the older ones into
+                   * account too.  */
+                  for (i = 0; i < ncand; i++)
+                    if (cand[i] && cand[i] != signode
+                        && cand[i]->pkt->pkt.signature->version > sigversion
+                        && !check_key_signature (ctrl, keyblock,
+                                                 cand[i], NULL))
+                      sigversion = cand[i]->pkt->pkt.signature->version;
+
+                  fixup_uidnode (uidnode, signode, keytimestamp);
+                  pk->flags.valid = 1;
+                }
 	    }
 
-	  /* Clear SIGNODE.  The only relevant self-signed data for
-	   * UIDNODE follows it.  */
+          if (!k || k->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+            break;
+
+	  /* Start a new candidate list.  The only relevant self-signed
+	   * data for UIDNODE follows it.  */
 	  if (k->pkt->pkttype == PKT_USER_ID)
 	    uidnode = k;
 	  else
 	    uidnode = NULL;
-
-	  signode = NULL;
-	  sigdate = 0;
+	  ncand = 0;
 	}
       else if (k->pkt->pkttype == PKT_SIGNATURE && uidnode)
 	{
 	  PKT_signature *sig = k->pkt->pkt.signature;
-	  if (sig->keyid[0] == kid[0] && sig->keyid[1] == kid[1])
+
+	  /* Note: we allow invalidation of cert revocations by a
+	   * newer signature.  An attacker can't use this because a
+	   * key should be revoked with a key revocation.  The reason
+	   * why we have to allow for that is that at one time an
+	   * email address may become invalid but later the same email
+	   * address may become valid again (hired, fired, hired
+	   * again).  */
+	  if (sig->keyid[0] == kid[0] && sig->keyid[1] == kid[1]
+	      && (IS_UID_SIG (sig) || IS_UID_REV (sig)))
 	    {
-	      if (check_key_signature (ctrl, keyblock, k, NULL))
-		;		/* signature did not verify */
-	      else if ((IS_UID_SIG (sig) || IS_UID_REV (sig))
-		       && sig->timestamp >= sigdate)
-		{
-		  /* Note: we allow invalidation of cert revocations
-		   * by a newer signature.  An attacker can't use this
-		   * because a key should be revoked with a key revocation.
-		   * The reason why we have to allow for that is that at
-		   * one time an email address may become invalid but later
-		   * the same email address may become valid again (hired,
-		   * fired, hired again).  */
-
-		  sigdate = sig->timestamp;
-		  signode = k;
-		  signode->pkt->pkt.signature->flags.chosen_selfsig = 0;
-		  if (sig->version > sigversion)
-		    sigversion = sig->version;
-		}
+              if (ncand == ncandalloc)
+                {
+                  ncandalloc = ncandalloc? ncandalloc * 2 : 16;
+                  cand = xrealloc (cand, ncandalloc * sizeof *cand);
+                }
+              sig->flags.chosen_selfsig = 0;
+              cand[ncand++] = k;
 	    }
 	}
     }
-  if (uidnode && signode)
-    {
-      fixup_uidnode (uidnode, signode, keytimestamp);
-      pk->flags.valid = 1;
-    }
+  xfree (cand);
 
   /* If the key isn't valid yet, and we have
    * --allow-non-selfsigned-uid set, then force it valid. */
@@ -3110,8 +3428,10 @@ merge_selfsigs_subkey (ctrl_t ctrl, kbnode_t keyblock, kbnode_t subnode)
   PKT_signature *sig;
   KBNODE k;
   u32 mainkid[2];
-  u32 sigdate = 0;
+  u32 sigdate;
   KBNODE signode;
+  kbnode_t *cand = NULL;  /* The binding signatures.  */
+  int ncand = 0, ncandalloc = 0;
   u32 curtime = make_timestamp ();
   unsigned int key_usage = 0;
   u32 keytimestamp = 0;
@@ -3133,8 +3453,6 @@ merge_selfsigs_subkey (ctrl_t ctrl, kbnode_t keyblock, kbnode_t subnode)
   subpk->main_keyid[1] = mainpk->main_keyid[1];
 
   /* Find the latest key binding self-signature.  */
-  signode = NULL;
-  sigdate = 0; /* Helper to find the latest signature.  */
   for (k = subnode->next; k && k->pkt->pkttype != PKT_PUBLIC_SUBKEY;
        k = k->next)
     {
@@ -3143,9 +3461,27 @@ merge_selfsigs_subkey (ctrl_t ctrl, kbnode_t keyblock, kbnode_t subnode)
 	  sig = k->pkt->pkt.signature;
 	  if (sig->keyid[0] == mainkid[0] && sig->keyid[1] == mainkid[1])
 	    {
-	      if (check_key_signature (ctrl, keyblock, k, NULL))
+	      if (IS_SUBKEY_SIG (sig))
+		{
+		  /* The binding signatures are verified below.  */
+		  if (sig->flags.expired)
+		    ; /* Signature has expired - ignore it.  */
+		  else
+		    {
+		      if (ncand == ncandalloc)
+			{
+			  ncandalloc = ncandalloc? ncandalloc * 2 : 8;
+			  cand = xrealloc (cand, ncandalloc * sizeof *cand);
+			}
+		      sig->flags.chosen_selfsig = 0;
+		      cand[ncand++] = k;
+		    }
+		}
+	      else if (!IS_SUBKEY_REV (sig))
+		; /* Not relevant for the subkey.  */
+	      else if (check_key_signature (ctrl, keyblock, k, NULL))
 		; /* Signature did not verify.  */
-	      else if (IS_SUBKEY_REV (sig))
+	      else
 		{
 		  /* Note that this means that the date on a
 		   * revocation sig does not matter - even if the
@@ -3161,20 +3497,11 @@ merge_selfsigs_subkey (ctrl_t ctrl, kbnode_t keyblock, kbnode_t subnode)
 		   * figure out other information like the old expiration
 		   * time.  */
 		}
-	      else if (IS_SUBKEY_SIG (sig) && sig->timestamp >= sigdate)
-		{
-		  if (sig->flags.expired)
-		    ; /* Signature has expired - ignore it.  */
-		  else
-		    {
-		      sigdate = sig->timestamp;
-		      signode = k;
-		      signode->pkt->pkt.signature->flags.chosen_selfsig = 0;
-		    }
-		}
 	    }
 	}
     }
+  signode = ncand? newest_valid_selfsig (ctrl, keyblock, cand, ncand) : NULL;
+  xfree (cand);
 
   /* No valid key binding.  */
   if (!signode)
@@ -3764,6 +4091,9 @@ lookup (ctrl_t ctrl, getkey_ctx_t ctx, int want_secret,
   if (ret_keyblock)
     *ret_keyblock = NULL;
 
+  if (want_secret)
+    agent_begin_keyinfo_batch ();
+
   for (;;)
     {
       rc = keydb_search (ctx->kr_handle, ctx->items, ctx->nitems, NULL);
@@ -3837,6 +4167,9 @@ lookup (ctrl_t ctrl, getkey_ctx_t ctx, int want_secret,
   else if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
     rc = want_secret? GPG_ERR_NO_SECKEY : GPG_ERR_NO_PUBKEY;
 
+  if (want_secret)
+    agent_end_keyinfo_batch ();
+
   release_kbnode (keyblock);
 
   if (ret_found_key)
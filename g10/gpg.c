@@ -62,6 +62,7 @@
 #include "call-dirmngr.h"
 #include "tofu.h"
 #include "objcache.h"
+#include "sigcache.h"
 #include "../common/init.h"
 #include "../common/mbox-util.h"
 #include "../common/shareddefs.h"
@@ -270,6 +271,7 @@ enum cmd_and_opt_values
     oQuickRandom,
     oNoVerbose,
     oTrustDBName,
+    oTrustDBCacheSize,
     oNoSecmemWarn,
     oRequireSecmem,
     oNoRequireSecmem,
@@ -373,6 +375,14 @@ enum cmd_and_opt_values
     oFixedListMode,
     oLegacyListMode,
     oNoSigCache,
+    oPersistentSigCache,
+    oRebuildJobs,
+    oEncryptJobs,
+    oImportJobs,
+    oExportJobs,
+    oSignJobs,
+    oMultifileJobs,
+    oPKCacheSize,
     oAutoCheckTrustDB,
     oNoAutoCheckTrustDB,
     oPreservePermissions,
@@ -403,6 +413,7 @@ enum cmd_and_opt_values
     oMultifile,
     oKeyidFormat,
     oExitOnStatusWriteError,
+    oBufferStatusOutput,
     oLimitCardInsertTries,
     oReaderPort,
     octapiDriver,
@@ -636,6 +647,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_s (oKeyboxdProgram, "keyboxd-program", "@"),
   ARGPARSE_s_s (oDirmngrProgram, "dirmngr-program", "@"),
   ARGPARSE_s_n (oExitOnStatusWriteError, "exit-on-status-write-error", "@"),
+  ARGPARSE_s_n (oBufferStatusOutput, "buffer-status-output", "@"),
   ARGPARSE_s_i (oLimitCardInsertTries, "limit-card-insert-tries", "@"),
   ARGPARSE_s_n (oEnableProgressFilter, "enable-progress-filter", "@"),
   ARGPARSE_s_s (oTempDir,  "temp-directory", "@"),
@@ -689,6 +701,7 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_i (oMaxCertDepth,	"max-cert-depth", "@" ),
 #ifndef NO_TRUST_MODELS
   ARGPARSE_s_s (oTrustDBName, "trustdb-name", "@"),
+  ARGPARSE_s_i (oTrustDBCacheSize, "trustdb-cache-size", "@"),
   ARGPARSE_s_n (oAutoCheckTrustDB, "auto-check-trustdb", "@"),
   ARGPARSE_s_n (oNoAutoCheckTrustDB, "no-auto-check-trustdb", "@"),
   ARGPARSE_s_s (oForceOwnertrust, "force-ownertrust", "@"),
@@ -858,6 +871,14 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oEnableSpecialFilenames, "enable-special-filenames", "@"),
   ARGPARSE_s_n (oNoRandomSeedFile,  "no-random-seed-file", "@"),
   ARGPARSE_s_n (oNoSigCache,         "no-sig-cache", "@"),
+  ARGPARSE_s_n (oPersistentSigCache, "persistent-sig-cache", "@"),
+  ARGPARSE_s_i (oRebuildJobs,        "rebuild-jobs", "@"),
+  ARGPARSE_s_i (oEncryptJobs,        "encrypt-jobs", "@"),
+  ARGPARSE_s_i (oImportJobs,         "import-jobs", "@"),
+  ARGPARSE_s_i (oExportJobs,         "export-jobs", "@"),
+  ARGPARSE_s_i (oSignJobs,           "sign-jobs", "@"),
+  ARGPARSE_s_i (oMultifileJobs,      "multifile-jobs", "@"),
+  ARGPARSE_s_i (oPKCacheSize,        "pk-cache-size", "@"),
   ARGPARSE_s_n (oIgnoreTimeConflict, "ignore-time-conflict", "@"),
   ARGPARSE_s_n (oIgnoreValidFrom,    "ignore-valid-from", "@"),
   ARGPARSE_s_n (oIgnoreCrcError, "ignore-crc-error", "@"),
@@ -989,6 +1010,7 @@ static struct debug_flags_s debug_flags [] =
     { DBG_TRUST_VALUE  , "trust"   },
     { DBG_HASHING_VALUE, "hashing" },
     { DBG_IPC_VALUE    , "ipc"     },
+    { DBG_IOSTAT_VALUE , "iostat"  },
     { DBG_CLOCK_VALUE  , "clock"   },
     { DBG_LOOKUP_VALUE , "lookup"  },
     { DBG_EXTPROG_VALUE, "extprog" },
@@ -1023,6 +1045,7 @@ static void add_policy_url( const char *string, int which );
 static void add_keyserver_url( const char *string, int which );
 static void emergency_cleanup (void);
 static void read_sessionkey_from_fd (int fd);
+static strlist_t read_fingerprint_list (estream_t fp);
 
 /* NPth wrapper function definitions. */
 ASSUAN_SYSTEM_NPTH_IMPL;
@@ -1335,6 +1358,8 @@ set_debug (const char *level)
     gcry_control (GCRYCTL_SET_DEBUG_FLAGS, 1);
   if ((opt.debug & DBG_IOBUF_VALUE))
     iobuf_debug_mode = 1;
+  if ((opt.debug & DBG_IOSTAT_VALUE))
+    iobuf_stats_mode = 1;
   gcry_control (GCRYCTL_SET_VERBOSITY, (int)opt.verbose);
 
   if (opt.debug)
@@ -2864,6 +2889,9 @@ main (int argc, char **argv)
 
 #ifndef NO_TRUST_MODELS
 	  case oTrustDBName: trustdb_name = pargs.r.ret_str; break;
+          case oTrustDBCacheSize:
+            opt.trustdb_cache_size = pargs.r.ret_int;
+            break;
 
 #endif /*!NO_TRUST_MODELS*/
 	  case oDefaultKey:
@@ -3398,6 +3426,14 @@ main (int argc, char **argv)
             }
             break;
           case oNoSigCache: opt.no_sig_cache = 1; break;
+          case oPersistentSigCache: opt.persistent_sig_cache = 1; break;
+          case oRebuildJobs: opt.rebuild_jobs = pargs.r.ret_int; break;
+          case oEncryptJobs: opt.encrypt_jobs = pargs.r.ret_int; break;
+          case oImportJobs: opt.import_jobs = pargs.r.ret_int; break;
+          case oExportJobs: opt.export_jobs = pargs.r.ret_int; break;
+          case oSignJobs: opt.sign_jobs = pargs.r.ret_int; break;
+          case oMultifileJobs: opt.multifile_jobs = pargs.r.ret_int; break;
+          case oPKCacheSize: opt.pk_cache_size = pargs.r.ret_int; break;
 	  case oAllowNonSelfsignedUID: opt.allow_non_selfsigned_uid = 1; break;
 	  case oNoAllowNonSelfsignedUID: opt.allow_non_selfsigned_uid=0; break;
 	  case oAllowFreeformUID: opt.allow_freeform_uid = 1; break;
@@ -3542,6 +3578,10 @@ main (int argc, char **argv)
             opt.exit_on_status_write_error = 1;
             break;
 
+          case oBufferStatusOutput:
+            opt.buffer_status_output = 1;
+            break;
+
 	  case oLimitCardInsertTries:
             opt.limit_card_insert_tries = pargs.r.ret_int;
             break;
@@ -3929,9 +3969,6 @@ main (int argc, char **argv)
 	  case aDetachedSign:
 	    cmdname="--detach-sign";
 	    break;
-	  case aSym:
-	    cmdname="--symmetric";
-	    break;
 	  case aEncrSym:
 	    cmdname="--symmetric --encrypt";
 	    break;
@@ -4091,21 +4128,28 @@ main (int argc, char **argv)
     if( opt.verbose > 1 )
 	set_packet_list_mode(1);
 
-    /* Add the keyrings, but not for some special commands.  We always
-     * need to add the keyrings if we are running under SELinux, this
-     * is so that the rings are added to the list of secured files.
-     * We do not add any keyring if --no-keyring or --use-keyboxd has
-     * been used.  */
+    /* Add the keyrings, but not for some special commands which
+     * never look at a key.  Registering the keyrings may create or
+     * lock files and is thus worth skipping for these quick commands.
+     * We always need to add the keyrings if we are running under
+     * SELinux, this is so that the rings are added to the list of
+     * secured files.  We do not add any keyring if --no-keyring or
+     * --use-keyboxd has been used.  */
     if (!opt.use_keyboxd
         && default_keyring >= 0
         && (ALWAYS_ADD_KEYRINGS
-            || (cmd != aDeArmor && cmd != aEnArmor && cmd != aGPGConfTest)))
+            || (cmd != aDeArmor && cmd != aEnArmor && cmd != aGPGConfTest
+                && cmd != aPrintMD && cmd != aPrintMDs
+                && cmd != aGenRandom && cmd != aPrimegen
+                && cmd != aListConfig && cmd != aListGcryptConfig)))
       {
 	if (!nrings || default_keyring > 0)  /* Add default ring. */
 	    keydb_add_resource ("pubring" EXTSEP_S GPGEXT_GPG,
                                 KEYDB_RESOURCE_FLAG_DEFAULT);
 	for (sl = nrings; sl; sl = sl->next )
           keydb_add_resource (sl->d, sl->flags);
+        if (DBG_CLOCK)
+          log_clock ("keyrings added");
       }
     FREE_STRLIST(nrings);
 
@@ -4176,6 +4220,8 @@ main (int argc, char **argv)
       log_error (_("failed to initialize the TrustDB: %s\n"),
                  gpg_strerror (rc));
 #endif /*!NO_TRUST_MODELS*/
+    if (DBG_CLOCK)
+      log_clock ("startup done");
 
     switch (cmd)
       {
@@ -4252,6 +4298,11 @@ main (int argc, char **argv)
           }
 	break;
       case aSym: /* encrypt the given file only with the symmetric cipher */
+	if (multifile)
+	  {
+	    encrypt_symmetric_files (ctrl, argc, argv);
+	    break;
+	  }
 	if( argc > 1 )
 	    wrong_args("--symmetric [filename]");
 	if( (rc = encrypt_symmetric(fname)) )
@@ -4437,7 +4488,18 @@ main (int argc, char **argv)
           sl = NULL;
           for( ; argc; argc--, argv++)
 	    append_to_strlist2 (&sl, *argv, utf8_strings);
-          keyedit_quick_sign (ctrl, fpr, sl, locusr, (cmd == aQuickLSignKey));
+          if (!strcmp (fpr, "-"))
+            {
+              /* Read the fingerprints from stdin.  */
+              strlist_t fprs = read_fingerprint_list (es_stdin);
+
+              keyedit_quick_sign_batch (ctrl, fprs, sl, locusr,
+                                        (cmd == aQuickLSignKey));
+              free_strlist (fprs);
+            }
+          else
+            keyedit_quick_sign (ctrl, fpr, sl, locusr,
+                                (cmd == aQuickLSignKey));
           free_strlist (sl);
         }
 	break;
@@ -5246,6 +5308,7 @@ g10_exit( int rc )
    * status line. */
   if (rc)
     write_status_failure ("gpg-exit", gpg_error (GPG_ERR_GENERAL));
+  write_status_flush ();
 
   gcry_control (GCRYCTL_UPDATE_RANDOM_SEED_FILE);
   if (DBG_CLOCK)
@@ -5254,8 +5317,10 @@ g10_exit( int rc )
   if ( (opt.debug & DBG_MEMSTAT_VALUE) )
     {
       keydb_dump_stats ();
+      getkey_dump_stats ();
       sig_check_dump_stats ();
       objcache_dump_stats ();
+      sigcache_dump_stats ();
       gcry_control (GCRYCTL_DUMP_MEMORY_STATS);
       gcry_control (GCRYCTL_DUMP_RANDOM_STATS);
     }
@@ -5611,3 +5676,35 @@ read_sessionkey_from_fd (int fd)
   gpgrt_annotate_leaked_object (line);
   opt.override_session_key = line;
 }
+
+
+/* Read a list of fingerprints, one per line, from FP.  Empty lines
+   and lines starting with a '#' are ignored.  */
+static strlist_t
+read_fingerprint_list (estream_t fp)
+{
+  strlist_t list = NULL;
+  char line[256];
+  char *p;
+
+  while (es_fgets (line, sizeof line, fp))
+    {
+      if (!*line || line[strlen (line)-1] != '\n')
+        {
+          if (!es_feof (fp))
+            {
+              log_error ("fingerprint list: line too long\n");
+              break;
+            }
+        }
+      p = trim_spaces (line);
+      if (!*p || *p == '#')
+        continue;
+      append_to_strlist (&list, p);
+    }
+  if (es_ferror (fp))
+    log_error ("error reading fingerprint list: %s\n",
+               gpg_strerror (gpg_error_from_syserror ()));
+
+  return list;
+}
@@ -71,6 +71,9 @@ typedef struct dirmngr_local_s *dirmngr_local_t;
 /* Object used to describe a keyblock node.  */
 typedef struct kbnode_struct *KBNODE;   /* Deprecated use kbnode_t. */typedef struct kbnode_struct *kbnode_t;
 
+/* An array based index over the nodes of a keyblock.  */
+typedef struct kbnode_index_s *kbnode_index_t;
+
 /* The handle for keydb operations.  */
 typedef struct keydb_handle_s *KEYDB_HANDLE;
 
@@ -701,6 +701,16 @@ agent_probe_any_secret_key (ctrl_t ctrl, kbnode_t keyblock)
   return gpg_error (GPG_ERR_NO_SECKEY);
 }
 
+void
+agent_begin_keyinfo_batch (void)
+{
+}
+
+void
+agent_end_keyinfo_batch (void)
+{
+}
+
 gpg_error_t
 agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip,
                    char **r_serialno, int *r_cleartext)
@@ -812,3 +822,17 @@ get_revocation_reason (PKT_signature *sig, char **r_reason,
     *r_comment = NULL;
   return 0;
 }
+
+gpg_error_t
+multifile_process (ctrl_t ctrl, int nfiles, char **files,
+                   multifile_cb_t cb, void *opaque, gpg_error_t *r_first_err)
+{
+  (void)ctrl;
+  (void)nfiles;
+  (void)files;
+  (void)cb;
+  (void)opaque;
+
+  *r_first_err = 0;
+  return gpg_error (GPG_ERR_NOT_IMPLEMENTED);
+}
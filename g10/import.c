@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "gpg.h"
 #include "options.h"
@@ -42,6 +43,7 @@
 #include "../common/mbox-util.h"
 #include "key-check.h"
 #include "key-clean.h"
+#include "worker.h"
 
 
 struct import_stats_s
@@ -141,6 +143,7 @@ static gpg_error_t append_new_uid (unsigned int options,
                                    int *n_sigs);
 static int append_key (kbnode_t keyblock, kbnode_t node, int *n_sigs);
 static int merge_sigs (kbnode_t dst, kbnode_t src, int *n_sigs);
+static int keyblock_is_subset (kbnode_t keyblock, kbnode_t keyblock_orig);
 static int merge_keysigs (kbnode_t dst, kbnode_t src, int *n_sigs);
 
 
@@ -623,6 +626,314 @@ import_keys_es_stream (ctrl_t ctrl, estream_t fp,
 }
 
 
+#ifndef HAVE_W32_SYSTEM
+/* The upper limit for --import-jobs.  */
+#define MAX_IMPORT_JOBS 64
+
+/* A process used by import to check the self-signatures of the
+ * keyblocks read ahead.  The worker receives a keyblock image and
+ * returns one byte for each signature; the value is 1 if it is a
+ * good self-signature and 0 otherwise.  The parent marks the good
+ * ones as checked so that import_one does not need to verify them
+ * again.  Bad signatures are left for import_one because the key
+ * repair functions may move them to the right place.  Each worker
+ * has at most one keyblock in flight; thus a round robin dispatch
+ * returns the keyblocks in their original order.  */
+struct import_worker_s
+{
+  struct worker_s proc; /* Requests are the keyblock images.  */
+  kbnode_t keyblock;  /* The keyblock in this slot or NULL.  */
+  int v3keys;         /* The v3 keys count from read_block.  */
+  int dispatched;     /* The worker is checking KEYBLOCK.  */
+};
+
+/* The read ahead queue of import.  Slot I of the queue is processed
+ * by worker I.  */
+struct import_pipeline_s
+{
+  int nworkers;
+  int next;           /* The slot with the oldest keyblock.  */
+  int count;          /* The number of keyblocks in the queue.  */
+  int broken;         /* Do not dispatch to the workers anymore.  */
+  int eof;            /* read_block returned EOF or an error ...  */
+  int eof_rc;         /* ... with this code ...  */
+  int eof_v3keys;     /* ... and this v3 keys count.  */
+  struct import_worker_s workers[MAX_IMPORT_JOBS];
+};
+
+
+/* The main loop of a worker process.  Only self-signatures are
+ * checked; they do not need the key database and thus the worker
+ * does not touch the files it shares with its parent.  A keyblock is
+ * sent as its length as an u32 followed by the image.  The result is
+ * the number of signatures as an u32 followed by the flags or the
+ * value (u32)(-1) if the image could not be parsed.  OPAQUE is the
+ * ctrl object.  */
+static void
+import_worker_main (void *opaque, int in_fd, int out_fd)
+{
+  ctrl_t ctrl = opaque;
+  unsigned char *image = NULL;
+  unsigned char *flags = NULL;
+  size_t imagesize = 0;
+  size_t flagssize = 0;
+  PACKET *pending_pkt;
+  kbnode_t keyblock, node;
+  iobuf_t a;
+  u32 len, nsigs, keyid[2];
+  int v3keys, rc;
+
+  while (!worker_readn (in_fd, &len, sizeof len))
+    {
+      if (len > imagesize)
+        {
+          xfree (image);
+          imagesize = len;
+          image = xmalloc (imagesize);
+        }
+      if (worker_readn (in_fd, image, len))
+        break;
+
+      keyblock = NULL;
+      pending_pkt = NULL;
+      a = iobuf_temp_with_content ((char*)image, len);
+      rc = read_block (a, 0, &pending_pkt, &keyblock, &v3keys);
+      iobuf_close (a);
+      if (pending_pkt)
+        {
+          free_packet (pending_pkt, NULL);
+          xfree (pending_pkt);
+        }
+      if (rc || keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+        {
+          release_kbnode (keyblock);
+          nsigs = (u32)(-1);
+          if (worker_writen (out_fd, &nsigs, sizeof nsigs))
+            break;
+          continue;
+        }
+
+      keyid_from_pk (keyblock->pkt->pkt.public_key, keyid);
+      nsigs = 0;
+      for (node = keyblock; node; node = node->next)
+        if (node->pkt->pkttype == PKT_SIGNATURE)
+          {
+            PKT_signature *sig = node->pkt->pkt.signature;
+
+            if (nsigs >= flagssize)
+              {
+                flagssize += 256;
+                flags = xrealloc (flags, flagssize);
+              }
+            flags[nsigs++] = (sig->keyid[0] == keyid[0]
+                              && sig->keyid[1] == keyid[1]
+                              && !check_key_signature (ctrl, keyblock,
+                                                       node, NULL));
+          }
+      release_kbnode (keyblock);
+      if (worker_writen (out_fd, &nsigs, sizeof nsigs)
+          || (nsigs && worker_writen (out_fd, flags, nsigs)))
+        break;
+    }
+}
+
+
+/* Stop the workers of PIPELINE and release it.  */
+static void
+import_stop_pipeline (struct import_pipeline_s *pipeline)
+{
+  int i;
+
+  if (!pipeline)
+    return;
+
+  for (i=0; i < pipeline->nworkers; i++)
+    worker_close_requests (&pipeline->workers[i].proc);
+  for (i=0; i < pipeline->nworkers; i++)
+    {
+      struct import_worker_s *wk = pipeline->workers + i;
+
+      worker_stop (&wk->proc, 0);
+      release_kbnode (wk->keyblock);
+      wk->keyblock = NULL;
+    }
+  xfree (pipeline);
+}
+
+
+/* Start NWORKERS worker processes and return a new pipeline.
+ * Returns NULL on error.  */
+static struct import_pipeline_s *
+import_start_pipeline (ctrl_t ctrl, int nworkers)
+{
+  gpg_error_t err;
+  struct import_pipeline_s *pipeline;
+  int i;
+
+  if (nworkers > MAX_IMPORT_JOBS)
+    nworkers = MAX_IMPORT_JOBS;
+
+  pipeline = xtrycalloc (1, sizeof *pipeline);
+  if (!pipeline)
+    {
+      err = gpg_error_from_syserror ();
+      log_info ("error starting import worker: %s\n", gpg_strerror (err));
+      return NULL;
+    }
+  pipeline->nworkers = nworkers;
+  for (i=0; i < nworkers; i++)
+    worker_init (&pipeline->workers[i].proc);
+
+  err = 0;
+  for (i=0; !err && i < nworkers; i++)
+    err = worker_start (&pipeline->workers[i].proc, 1,
+                        import_worker_main, ctrl);
+
+  if (err)
+    {
+      log_info ("error starting import worker: %s\n", gpg_strerror (err));
+      import_stop_pipeline (pipeline);
+      return NULL;
+    }
+  if (opt.verbose)
+    log_info ("using %d processes to check the self-signatures\n", nworkers);
+  return pipeline;
+}
+
+
+/* Send the keyblock of WK to its worker.  */
+static gpg_error_t
+import_dispatch_keyblock (struct import_worker_s *wk)
+{
+  gpg_error_t err;
+  iobuf_t image;
+  u32 len;
+
+  err = build_keyblock_image (wk->keyblock, &image);
+  if (err)
+    return err;
+  len = iobuf_get_temp_length (image);
+  err = worker_writen (wk->proc.to_fd, &len, sizeof len);
+  if (!err)
+    err = worker_writen (wk->proc.to_fd, iobuf_get_temp_buffer (image), len);
+  iobuf_close (image);
+  if (!err)
+    wk->dispatched = 1;
+  return err;
+}
+
+
+/* Wait for the result of WK and mark the good self-signatures of its
+ * keyblock as checked.  The result is only used if it matches the
+ * keyblock.  */
+static gpg_error_t
+import_collect_keyblock (struct import_worker_s *wk)
+{
+  gpg_error_t err;
+  kbnode_t node;
+  u32 nsigs, n;
+  unsigned char *flags = NULL;
+
+  wk->dispatched = 0;
+  err = worker_readn (wk->proc.from_fd, &nsigs, sizeof nsigs);
+  if (err)
+    return err;
+  if (nsigs == (u32)(-1))
+    return 0;  /* The worker could not parse it; we check it later.  */
+  if (nsigs)
+    {
+      flags = xtrymalloc (nsigs);
+      if (!flags)
+        return gpg_error_from_syserror ();
+      err = worker_readn (wk->proc.from_fd, flags, nsigs);
+      if (err)
+        goto leave;
+    }
+
+  for (n = 0, node = wk->keyblock; node; node = node->next)
+    if (node->pkt->pkttype == PKT_SIGNATURE && !is_deleted_kbnode (node))
+      n++;
+  if (n != nsigs)
+    goto leave;
+
+  for (n = 0, node = wk->keyblock; node; node = node->next)
+    if (node->pkt->pkttype == PKT_SIGNATURE && !is_deleted_kbnode (node))
+      {
+        if (flags[n++] == 1)
+          {
+            node->pkt->pkt.signature->flags.checked = 1;
+            node->pkt->pkt.signature->flags.valid = 1;
+          }
+      }
+
+ leave:
+  xfree (flags);
+  return err;
+}
+
+
+/* Return the next keyblock like read_block but read ahead so that the
+ * workers of PIPELINE can check the self-signatures of the next
+ * keyblocks while the caller imports this one.  */
+static int
+pipeline_read_block (struct import_pipeline_s *pipeline, IOBUF a,
+                     unsigned int options, PACKET **pending_pkt,
+                     kbnode_t *ret_root, int *r_v3keys)
+{
+  gpg_error_t err;
+  struct import_worker_s *wk;
+  kbnode_t keyblock;
+  int v3keys, rc;
+
+  /* Fill the free slots.  */
+  while (!pipeline->eof && pipeline->count < pipeline->nworkers)
+    {
+      wk = pipeline->workers + ((pipeline->next + pipeline->count)
+                                % pipeline->nworkers);
+      keyblock = NULL;
+      rc = read_block (a, options, pending_pkt, &keyblock, &v3keys);
+      if (rc)
+        {
+          pipeline->eof = 1;
+          pipeline->eof_rc = rc;
+          pipeline->eof_v3keys = v3keys;
+          break;
+        }
+      wk->keyblock = keyblock;
+      wk->v3keys = v3keys;
+      pipeline->count++;
+      if (!pipeline->broken && keyblock->pkt->pkttype == PKT_PUBLIC_KEY
+          && (err = import_dispatch_keyblock (wk)))
+        {
+          log_info ("error sending keyblock to import worker: %s\n",
+                    gpg_strerror (err));
+          pipeline->broken = 1;
+        }
+    }
+
+  if (!pipeline->count)
+    {
+      *r_v3keys = pipeline->eof_v3keys;
+      return pipeline->eof_rc;
+    }
+
+  wk = pipeline->workers + pipeline->next;
+  if (wk->dispatched && (err = import_collect_keyblock (wk)))
+    {
+      log_info ("error receiving result from import worker: %s\n",
+                gpg_strerror (err));
+      pipeline->broken = 1;
+    }
+  *ret_root = wk->keyblock;
+  *r_v3keys = wk->v3keys;
+  wk->keyblock = NULL;
+  pipeline->next = (pipeline->next + 1) % pipeline->nworkers;
+  pipeline->count--;
+  return 0;
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
 static int
 import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
 	unsigned char **fpr,size_t *fpr_len, unsigned int options,
@@ -636,6 +947,9 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
   kbnode_t secattic = NULL;  /* Kludge for PGP desktop percularity */
   int rc = 0;
   int v3keys;
+#ifndef HAVE_W32_SYSTEM
+  struct import_pipeline_s *pipeline = NULL;
+#endif
 
   getkey_disable_caches ();
 
@@ -649,8 +963,27 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
       release_armor_context (afx);
     }
 
-  while (!(rc = read_block (inp, options, &pending_pkt, &keyblock, &v3keys)))
+#ifndef HAVE_W32_SYSTEM
+  /* The cached signature flags are not used with --no-sig-cache.
+   * Repairing the PKS subkey bug moves signatures to other subkeys
+   * and thus needs to check them again.  */
+  if (opt.import_jobs > 1 && !opt.no_sig_cache
+      && !(options & IMPORT_REPAIR_PKS_SUBKEY_BUG))
+    pipeline = import_start_pipeline (ctrl, opt.import_jobs);
+#endif
+
+  for (;;)
     {
+#ifndef HAVE_W32_SYSTEM
+      if (pipeline)
+        rc = pipeline_read_block (pipeline, inp, options, &pending_pkt,
+                                  &keyblock, &v3keys);
+      else
+#endif
+        rc = read_block (inp, options, &pending_pkt, &keyblock, &v3keys);
+      if (rc)
+        break;
+
       stats->v3keys += v3keys;
       if (keyblock->pkt->pkttype == PKT_PUBLIC_KEY)
         {
@@ -747,6 +1080,9 @@ import (ctrl_t ctrl, IOBUF inp, const char* fname,struct import_stats_s *stats,
   else if (rc && gpg_err_code (rc) != GPG_ERR_INV_KEYRING)
     log_error (_("error reading '%s': %s\n"), fname, gpg_strerror (rc));
 
+#ifndef HAVE_W32_SYSTEM
+  import_stop_pipeline (pipeline);
+#endif
   release_kbnode (secattic);
 
   /* When read_block loop was stopped by error, we have PENDING_PKT left.  */
@@ -1976,6 +2312,40 @@ import_one_real (ctrl_t ctrl,
                          NULL, NULL);
     }
 
+  /* A periodic refresh mostly imports keys we already have.  If the
+   * new keyblock would not add anything to our copy we can skip the
+   * costly signature checks.  The cleaning and show options need the
+   * full processing.  */
+  if (!(options & (IMPORT_CLEAN | IMPORT_SHOW | IMPORT_DRY_RUN
+                   | IMPORT_EXPORT))
+      && !opt.dry_run
+      && !get_keyblock_byfprint_fast (ctrl, &keyblock_orig, NULL,
+                                      fpr2, fpr2len, 0))
+    {
+      if (!cmp_public_keys (keyblock_orig->pkt->pkt.public_key, pk)
+          && keyblock_is_subset (keyblock, keyblock_orig)
+          && !fix_bad_direct_key_sigs (ctrl, keyblock_orig, keyid))
+        {
+          if (r_valid)
+            *r_valid = 1;
+          same_key = 1;
+          if (is_status_enabled ())
+            print_import_ok (pk, 0);
+
+          if (!opt.quiet && !silent)
+            {
+              char *p = get_user_id_byfpr_native (ctrl, fpr2, fpr2len);
+              log_info( _("key %s: \"%s\" not changed\n"),keystr(keyid),p);
+              xfree(p);
+            }
+
+          stats->unchanged++;
+          goto leave;
+        }
+      release_kbnode (keyblock_orig);
+      keyblock_orig = NULL;
+    }
+
   clear_kbnode_flags( keyblock );
 
   if ((options&IMPORT_REPAIR_PKS_SUBKEY_BUG)
@@ -4576,6 +4946,75 @@ append_new_uid (unsigned int options,
 }
 
 
+/* A hash table of signature nodes used by merge_sigs to find the
+ * signatures we already have.  SIZE is a power of two and at least
+ * twice the number of nodes.  */
+struct sig_index_s
+{
+  unsigned int size;
+  kbnode_t *slots;
+};
+
+
+/* Return a hash value over parts of SIG which are compared by
+ * cmp_signatures.  The signature values are random enough and thus
+ * we only use the length and the low bits of the first one.  */
+static unsigned int
+sig_index_hash (PKT_signature *sig)
+{
+  unsigned int h = sig->keyid[0] ^ sig->keyid[1];
+  gcry_mpi_t a;
+  const unsigned char *p;
+  unsigned int nbits, i;
+
+  h = h * 31 + sig->pubkey_algo;
+  if (!pubkey_get_nsig (sig->pubkey_algo) || !(a = sig->data[0]))
+    return h;
+  if (gcry_mpi_get_flag (a, GCRYMPI_FLAG_OPAQUE))
+    {
+      p = gcry_mpi_get_opaque (a, &nbits);
+      h = h * 31 + nbits;
+      for (i=0; p && i < (nbits+7)/8 && i < 16; i++)
+        h = h * 31 + p[i];
+    }
+  else
+    {
+      h = h * 31 + gcry_mpi_get_nbits (a);
+      for (i=0; i < 32; i++)
+        if (gcry_mpi_test_bit (a, i))
+          h ^= 1U << i;
+    }
+  return h;
+}
+
+
+/* Add the signature NODE to INDEX.  */
+static void
+sig_index_add (struct sig_index_s *index, kbnode_t node)
+{
+  unsigned int i;
+
+  i = sig_index_hash (node->pkt->pkt.signature) & (index->size - 1);
+  while (index->slots[i])
+    i = (i + 1) & (index->size - 1);
+  index->slots[i] = node;
+}
+
+
+/* Return true if a signature equal to SIG is in INDEX.  */
+static int
+sig_index_find (struct sig_index_s *index, PKT_signature *sig)
+{
+  unsigned int i;
+
+  i = sig_index_hash (sig) & (index->size - 1);
+  for (; index->slots[i]; i = (i + 1) & (index->size - 1))
+    if (!cmp_signatures (sig, index->slots[i]->pkt->pkt.signature))
+      return 1;
+  return 0;
+}
+
+
 /* Helper function for merge_blocks
  * Merge the sigs from SRC onto DST. SRC and DST are both a PKT_USER_ID.
  * (how should we handle comment packets here?)
@@ -4584,11 +5023,31 @@ static int
 merge_sigs (kbnode_t dst, kbnode_t src, int *n_sigs)
 {
   kbnode_t n, n2;
-  int found = 0;
+  struct sig_index_s index;
+  unsigned int count = 0;
 
   log_assert (dst->pkt->pkttype == PKT_USER_ID);
   log_assert (src->pkt->pkttype == PKT_USER_ID);
 
+  /* Index the signatures we already have.  A key with many
+   * certifications would otherwise require to compare each new
+   * signature with all the old ones.  There is room for the new
+   * signatures so that duplicates in SRC are also detected.  */
+  for (n=dst->next; n && n->pkt->pkttype != PKT_USER_ID; n = n->next)
+    if (n->pkt->pkttype == PKT_SIGNATURE)
+      count++;
+  for (n=src->next; n && n->pkt->pkttype != PKT_USER_ID; n = n->next)
+    if (n->pkt->pkttype == PKT_SIGNATURE)
+      count++;
+  for (index.size = 16; index.size < 2 * count; index.size *= 2)
+    ;
+  index.slots = xtrycalloc (index.size, sizeof *index.slots);
+  if (!index.slots)
+    return gpg_error_from_syserror ();
+  for (n=dst->next; n && n->pkt->pkttype != PKT_USER_ID; n = n->next)
+    if (n->pkt->pkttype == PKT_SIGNATURE)
+      sig_index_add (&index, n);
+
   for (n=src->next; n && n->pkt->pkttype != PKT_USER_ID; n = n->next)
     {
       if (n->pkt->pkttype != PKT_SIGNATURE )
@@ -4597,14 +5056,7 @@ merge_sigs (kbnode_t dst, kbnode_t src, int *n_sigs)
           || IS_SUBKEY_REV (n->pkt->pkt.signature) )
         continue; /* skip signatures which are only valid on subkeys */
 
-      found = 0;
-      for (n2=dst->next; n2 && n2->pkt->pkttype != PKT_USER_ID; n2 = n2->next)
-        if (!cmp_signatures(n->pkt->pkt.signature,n2->pkt->pkt.signature))
-          {
-            found++;
-            break;
-          }
-      if (!found )
+      if (!sig_index_find (&index, n->pkt->pkt.signature))
         {
           /* This signature is new or newer, append N to DST.
            * We add a clone to the original keyblock, because this
@@ -4614,13 +5066,96 @@ merge_sigs (kbnode_t dst, kbnode_t src, int *n_sigs)
           n2->flag |= NODE_FLAG_A;
           n->flag |= NODE_FLAG_A;
           ++*n_sigs;
+          sig_index_add (&index, n2);
 	}
     }
 
+  xfree (index.slots);
   return 0;
 }
 
 
+/* Return true if NODE starts a key or user id component.  */
+static int
+is_component_node (kbnode_t node)
+{
+  return (node->pkt->pkttype == PKT_PUBLIC_KEY
+          || node->pkt->pkttype == PKT_PUBLIC_SUBKEY
+          || node->pkt->pkttype == PKT_USER_ID);
+}
+
+
+/* Return true if the component nodes A and B are equal.  */
+static int
+cmp_component_nodes (kbnode_t a, kbnode_t b)
+{
+  if (a->pkt->pkttype != b->pkt->pkttype)
+    return 1;
+  if (a->pkt->pkttype == PKT_USER_ID)
+    return cmp_user_ids (a->pkt->pkt.user_id, b->pkt->pkt.user_id);
+  return cmp_public_keys (a->pkt->pkt.public_key, b->pkt->pkt.public_key);
+}
+
+
+/* Return true if each key, user id and signature of KEYBLOCK is also
+ * in KEYBLOCK_ORIG and each signature belongs to the same component
+ * there.  Merging KEYBLOCK into KEYBLOCK_ORIG can then not change
+ * anything.  */
+static int
+keyblock_is_subset (kbnode_t keyblock, kbnode_t keyblock_orig)
+{
+  kbnode_t comp, ocomp, n;
+  struct sig_index_s index;
+  unsigned int count;
+  int result = 1;
+
+  index.slots = NULL;
+  for (comp = keyblock; comp && result; )
+    {
+      if (!is_component_node (comp))
+        return 0;  /* Unexpected packet.  */
+
+      for (ocomp = keyblock_orig; ocomp; ocomp = ocomp->next)
+        if (is_component_node (ocomp) && !is_deleted_kbnode (ocomp)
+            && !cmp_component_nodes (comp, ocomp))
+          break;
+      if (!ocomp)
+        return 0;  /* New key or user id.  */
+
+      /* Index the signatures of the component in KEYBLOCK_ORIG.  */
+      count = 0;
+      for (n = ocomp->next; n && !is_component_node (n); n = n->next)
+        if (n->pkt->pkttype == PKT_SIGNATURE)
+          count++;
+      for (index.size = 16; index.size < 2 * count; index.size *= 2)
+        ;
+      xfree (index.slots);
+      index.slots = xtrycalloc (index.size, sizeof *index.slots);
+      if (!index.slots)
+        return 0;
+      for (n = ocomp->next; n && !is_component_node (n); n = n->next)
+        if (n->pkt->pkttype == PKT_SIGNATURE)
+          sig_index_add (&index, n);
+
+      for (n = comp->next; n && !is_component_node (n); n = n->next)
+        {
+          if (is_deleted_kbnode (n))
+            continue;
+          if (n->pkt->pkttype != PKT_SIGNATURE
+              || !sig_index_find (&index, n->pkt->pkt.signature))
+            {
+              result = 0;  /* New signature or unexpected packet.  */
+              break;
+            }
+        }
+      comp = n;
+    }
+
+  xfree (index.slots);
+  return result;
+}
+
+
 /* Helper function for merge_blocks
  * Merge the sigs from SRC onto DST. SRC and DST are both a PKT_xxx_SUBKEY.
  */
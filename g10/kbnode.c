@@ -31,19 +31,56 @@
 
 #define USE_UNUSED_NODES 1
 
+/* An index over the nodes of a keyblock.  The nodes are stored in an
+ * array in keyblock order so that the signatures of a component are
+ * found without walking the list from the start.  A second array
+ * sorted by the address of the nodes maps a node to its position and
+ * its user id and subkey.  The index is only valid as long as the
+ * keyblock is not modified.  */
+struct kbnode_index_entry_s
+{
+  kbnode_t node;
+  size_t pos;           /* The position of NODE in NODES.  */
+  kbnode_t prev_uid;    /* The last user id before NODE or NULL.  */
+  kbnode_t prev_subkey; /* The last public subkey before NODE or NULL.  */
+};
+
+struct kbnode_index_s
+{
+  size_t nnodes;
+  kbnode_t *nodes;                       /* In keyblock order.  */
+  struct kbnode_index_entry_s *entries;  /* Sorted by NODE.  */
+};
+
+/* The number of nodes we allocate at once.  A keyblock with
+ * thousands of signatures thus needs only a few allocations for its
+ * nodes.  */
+#define NODES_PER_BLOCK 256
+
+/* A block of nodes.  The blocks are never released before the
+ * process terminates; freed nodes are put on the list of unused
+ * nodes.  */
+struct node_block_s
+{
+  struct node_block_s *next;
+  struct kbnode_struct nodes[NODES_PER_BLOCK];
+};
+
 static int cleanup_registered;
 static KBNODE unused_nodes;
+static struct node_block_s *node_blocks;
 
 static void
 release_unused_nodes (void)
 {
 #if USE_UNUSED_NODES
-  while (unused_nodes)
+  while (node_blocks)
     {
-      kbnode_t next = unused_nodes->next;
-      xfree (unused_nodes);
-      unused_nodes = next;
+      struct node_block_s *next = node_blocks->next;
+      xfree (node_blocks);
+      node_blocks = next;
     }
+  unused_nodes = NULL;
 #endif /*USE_UNUSED_NODES*/
 }
 
@@ -53,18 +90,31 @@ alloc_node (void)
 {
   kbnode_t n;
 
-  n = unused_nodes;
-  if (n)
-    unused_nodes = n->next;
-  else
+#if USE_UNUSED_NODES
+  if (!unused_nodes)
     {
+      struct node_block_s *nb;
+      int i;
+
       if (!cleanup_registered)
         {
           cleanup_registered = 1;
           register_mem_cleanup_func (release_unused_nodes);
         }
-      n = xmalloc (sizeof *n);
+      nb = xmalloc (sizeof *nb);
+      nb->next = node_blocks;
+      node_blocks = nb;
+      for (i = NODES_PER_BLOCK - 1; i >= 0; i--)
+        {
+          nb->nodes[i].next = unused_nodes;
+          unused_nodes = nb->nodes + i;
+        }
     }
+  n = unused_nodes;
+  unused_nodes = n->next;
+#else
+  n = xmalloc (sizeof *n);
+#endif
   n->next = NULL;
   n->pkt = NULL;
   n->flag = 0;
@@ -357,6 +407,132 @@ move_kbnode( KBNODE *root, KBNODE node, KBNODE where )
 
 
 
+static int
+compare_index_entries (const void *a, const void *b)
+{
+  uintptr_t na = (uintptr_t)((const struct kbnode_index_entry_s *)a)->node;
+  uintptr_t nb = (uintptr_t)((const struct kbnode_index_entry_s *)b)->node;
+
+  return na < nb? -1 : na > nb? 1 : 0;
+}
+
+
+/* Build an index for the keyblock ROOT.  Returns NULL and sets ERRNO
+ * on error.  The caller must not modify the keyblock while using the
+ * index and must release it with kbnode_index_release.  */
+kbnode_index_t
+kbnode_index_new (kbnode_t root)
+{
+  kbnode_index_t kbidx;
+  kbnode_t n, uid, subkey;
+  size_t i;
+
+  kbidx = xtrycalloc (1, sizeof *kbidx);
+  if (!kbidx)
+    return NULL;
+  for (n = root; n; n = n->next)
+    kbidx->nnodes++;
+  kbidx->nodes = xtrycalloc (kbidx->nnodes + 1, sizeof *kbidx->nodes);
+  kbidx->entries = xtrycalloc (kbidx->nnodes + 1, sizeof *kbidx->entries);
+  if (!kbidx->nodes || !kbidx->entries)
+    {
+      kbnode_index_release (kbidx);
+      return NULL;
+    }
+
+  uid = subkey = NULL;
+  for (n = root, i = 0; n; n = n->next, i++)
+    {
+      kbidx->nodes[i] = n;
+      kbidx->entries[i].node = n;
+      kbidx->entries[i].pos = i;
+      kbidx->entries[i].prev_uid = uid;
+      kbidx->entries[i].prev_subkey = subkey;
+      if (n->pkt->pkttype == PKT_USER_ID)
+        uid = n;
+      else if (n->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+        subkey = n;
+    }
+  qsort (kbidx->entries, kbidx->nnodes, sizeof *kbidx->entries,
+         compare_index_entries);
+
+  return kbidx;
+}
+
+
+void
+kbnode_index_release (kbnode_index_t kbidx)
+{
+  if (!kbidx)
+    return;
+  xfree (kbidx->nodes);
+  xfree (kbidx->entries);
+  xfree (kbidx);
+}
+
+
+/* Return the first node of the keyblock indexed by KBIDX.  */
+kbnode_t
+kbnode_index_root (kbnode_index_t kbidx)
+{
+  return kbidx->nnodes? kbidx->nodes[0] : NULL;
+}
+
+
+/* Return the index entry for NODE or NULL.  */
+static struct kbnode_index_entry_s *
+find_index_entry (kbnode_index_t kbidx, kbnode_t node)
+{
+  struct kbnode_index_entry_s key;
+
+  key.node = node;
+  return bsearch (&key, kbidx->entries, kbidx->nnodes,
+                  sizeof *kbidx->entries, compare_index_entries);
+}
+
+
+/* Same as find_prev_kbnode for the keyblock indexed by KBIDX.  The
+ * lookup of the previous user id or public subkey does not depend on
+ * the size of the keyblock.  */
+kbnode_t
+kbnode_index_find_prev (kbnode_index_t kbidx, kbnode_t node, int pkttype)
+{
+  struct kbnode_index_entry_s *e;
+
+  e = find_index_entry (kbidx, node);
+  if (!e)
+    return NULL;  /* NODE is not part of the keyblock.  */
+  if (pkttype == PKT_USER_ID)
+    return e->prev_uid;
+  if (pkttype == PKT_PUBLIC_SUBKEY)
+    return e->prev_subkey;
+  if (!pkttype)
+    return e->pos? kbidx->nodes[e->pos - 1] : NULL;
+  return find_prev_kbnode (kbidx->nodes[0], node, pkttype);
+}
+
+
+/* Return the signatures directly following NODE in the keyblock
+ * indexed by KBIDX.  The number of signatures is stored at R_NSIGS;
+ * the returned array is owned by KBIDX.  */
+kbnode_t *
+kbnode_index_sigs (kbnode_index_t kbidx, kbnode_t node, size_t *r_nsigs)
+{
+  struct kbnode_index_entry_s *e;
+  size_t i;
+
+  *r_nsigs = 0;
+  e = find_index_entry (kbidx, node);
+  if (!e)
+    return NULL;
+  for (i = e->pos + 1;
+       i < kbidx->nnodes && kbidx->nodes[i]->pkt->pkttype == PKT_SIGNATURE;
+       i++)
+    ;
+  *r_nsigs = i - e->pos - 1;
+  return kbidx->nodes + e->pos + 1;
+}
+
 
 void
 dump_kbnode (KBNODE node)
@@ -29,6 +29,7 @@
 
 #include "gpg.h"
 #include "../common/util.h"
+#include "../common/host2net.h"
 #include "options.h"
 #include "main.h" /*try_make_homedir ()*/
 #include "packet.h"
@@ -83,6 +84,32 @@ struct
   unsigned int flushes; /* The number of flushes.  */
 } kid_not_found_stats;
 
+/* In addition we use a Bloom filter with the key ids of all keys in
+   the database to reject lookups by key id or fingerprint of unknown
+   keys without searching.  The filter is built on the first such
+   lookup which failed and inserts and updates add their keys to it.
+   Deleted keys are not removed; this merely increases the rate of
+   false positives.  The key ids can only be enumerated quickly for
+   keyboxes and thus the filter is not used if a keyring has been
+   registered.  */
+#define KID_BLOOM_BITS_PER_KEY 16
+#define KID_BLOOM_HASHES        8
+
+struct
+{
+  unsigned char *bits;   /* The filter or NULL if not yet built.  */
+  u32 mask;              /* The number of bits in BITS minus one.  */
+  size_t capacity;       /* The number of keys BITS is sized for.  */
+  size_t count;          /* The number of keys added.  */
+  unsigned int disabled:1; /* The filter can't be built.  */
+} kid_bloom;
+
+struct
+{
+  unsigned int builds;   /* The number of times the filter was built.  */
+  unsigned int rejects;  /* The number of lookups rejected.  */
+} kid_bloom_stats;
+
 struct
 {
   unsigned int handles; /* Number of handles created.  */
@@ -189,6 +216,199 @@ kid_not_found_flush (void)
 }
 
 
+/* Release the Bloom filter so that it will be rebuilt on the next
+   failed lookup.  */
+static void
+kid_bloom_release (void)
+{
+  xfree (kid_bloom.bits);
+  kid_bloom.bits = NULL;
+  kid_bloom.mask = 0;
+  kid_bloom.capacity = 0;
+  kid_bloom.count = 0;
+  kid_bloom.disabled = 0;
+}
+
+
+/* Add the key id KID to the Bloom filter.  Key ids are hash values
+   and thus we can derive the bit positions directly from them.  */
+static void
+kid_bloom_add (u32 *kid)
+{
+  u32 h = kid[1];
+  u32 step = kid[0] | 1;
+  u32 bit;
+  int i;
+
+  for (i=0; i < KID_BLOOM_HASHES; i++, h += step)
+    {
+      bit = h & kid_bloom.mask;
+      kid_bloom.bits[bit / 8] |= 1 << (bit % 8);
+    }
+  kid_bloom.count++;
+}
+
+
+/* Return true if the key id KID may be in the database.  */
+static int
+kid_bloom_test (u32 *kid)
+{
+  u32 h = kid[1];
+  u32 step = kid[0] | 1;
+  u32 bit;
+  int i;
+
+  for (i=0; i < KID_BLOOM_HASHES; i++, h += step)
+    {
+      bit = h & kid_bloom.mask;
+      if (!(kid_bloom.bits[bit / 8] & (1 << (bit % 8))))
+        return 0;
+    }
+  return 1;
+}
+
+
+/* Add the keys of the keyblock KB to the Bloom filter.  */
+static void
+kid_bloom_add_kb (kbnode_t kb)
+{
+  u32 kid[2];
+
+  if (!kid_bloom.bits)
+    return;
+
+  for (; kb; kb = kb->next)
+    if (kb->pkt->pkttype == PKT_PUBLIC_KEY
+        || kb->pkt->pkttype == PKT_PUBLIC_SUBKEY)
+      {
+        keyid_from_pk (kb->pkt->pkt.public_key, kid);
+        kid_bloom_add (kid);
+      }
+
+  /* Rebuild the filter if it is getting too full.  */
+  if (kid_bloom.count > kid_bloom.capacity)
+    kid_bloom_release ();
+}
+
+
+/* Store the key ids for the search described by DESC at KID.  Returns
+   false if the search is not by key id or fingerprint.  */
+static int
+kid_bloom_kid_from_desc (KEYDB_SEARCH_DESC *desc, u32 *kid)
+{
+  if (desc->mode == KEYDB_SEARCH_MODE_LONG_KID)
+    {
+      kid[0] = desc->u.kid[0];
+      kid[1] = desc->u.kid[1];
+    }
+  else if (desc->mode == KEYDB_SEARCH_MODE_FPR && desc->fprlen == 20)
+    {
+      kid[0] = buf32_to_u32 (desc->u.fpr+12);
+      kid[1] = buf32_to_u32 (desc->u.fpr+16);
+    }
+  else if (desc->mode == KEYDB_SEARCH_MODE_FPR && desc->fprlen == 32)
+    {
+      kid[0] = buf32_to_u32 (desc->u.fpr);
+      kid[1] = buf32_to_u32 (desc->u.fpr+4);
+    }
+  else
+    return 0;
+  return 1;
+}
+
+
+/* The list of key ids used while building the Bloom filter.  */
+struct kid_bloom_list_s
+{
+  u32 *kids;      /* Two items per key id.  */
+  size_t nkids;
+  size_t size;
+};
+
+/* Callback for keybox_enum_keyids.  */
+static gpg_error_t
+kid_bloom_collect_cb (void *opaque, u32 *kid)
+{
+  struct kid_bloom_list_s *list = opaque;
+
+  if (list->nkids == list->size)
+    {
+      size_t n = list->size? 2 * list->size : 4096;
+      u32 *tmp = xtryrealloc (list->kids, 2 * n * sizeof *tmp);
+
+      if (!tmp)
+        return gpg_error_from_syserror ();
+      list->kids = tmp;
+      list->size = n;
+    }
+  list->kids[2 * list->nkids] = kid[0];
+  list->kids[2 * list->nkids + 1] = kid[1];
+  list->nkids++;
+  return 0;
+}
+
+
+/* Build the Bloom filter from all registered resources.  On error
+   the filter is disabled.  */
+static void
+kid_bloom_build (void)
+{
+  gpg_error_t err = 0;
+  struct kid_bloom_list_s list = { NULL, 0, 0 };
+  KEYBOX_HANDLE kbxhd;
+  size_t nbits, n;
+  int i;
+
+  kid_bloom_release ();
+  kid_bloom.disabled = 1;
+
+  for (i=0; i < used_resources; i++)
+    if (all_resources[i].type != KEYDB_RESOURCE_TYPE_KEYBOX)
+      return;
+
+  for (i=0; !err && i < used_resources; i++)
+    {
+      kbxhd = keybox_new_openpgp (all_resources[i].token, 0);
+      if (!kbxhd)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = keybox_enum_keyids (kbxhd, kid_bloom_collect_cb, &list);
+          keybox_release (kbxhd);
+        }
+    }
+  if (err)
+    {
+      if (DBG_CACHE)
+        log_debug ("keydb: building the Bloom filter failed: %s\n",
+                   gpg_strerror (err));
+      goto leave;
+    }
+
+  /* Leave room for imports and use a power of two for the size.  */
+  n = 2 * list.nkids + 1024;
+  for (nbits = 8192; nbits < n * KID_BLOOM_BITS_PER_KEY; nbits *= 2)
+    if (nbits >= ((size_t)1 << 31))
+      goto leave;  /* That many keys are not expected.  */
+
+  kid_bloom.bits = xtrycalloc (1, nbits / 8);
+  if (!kid_bloom.bits)
+    goto leave;
+  kid_bloom.mask = nbits - 1;
+  kid_bloom.capacity = nbits / KID_BLOOM_BITS_PER_KEY;
+  kid_bloom.disabled = 0;
+  for (n=0; n < list.nkids; n++)
+    kid_bloom_add (list.kids + 2 * n);
+  kid_bloom_stats.builds++;
+
+  if (DBG_CACHE)
+    log_debug ("keydb: Bloom filter with %zu keys built\n", list.nkids);
+
+ leave:
+  xfree (list.kids);
+}
+
+
 static void
 keyblock_cache_clear (struct keydb_handle_s *hd)
 {
@@ -735,13 +955,15 @@ keydb_add_resource (const char *url, unsigned int flags)
                 all_resources[used_resources].token = token;
 
                 /* Do a compress run if needed and no other user is
-                 * currently using the keybox. */
+                 * currently using the keybox.  Because all our
+                 * handles use the append mode, other processes may
+                 * update the keybox while the run copies it.  */
                 kbxhd = keybox_new_openpgp (token, 0);
                 if (kbxhd)
                   {
                     if (!keybox_lock (kbxhd, 1, 0))
                       {
-                        keybox_compress (kbxhd);
+                        keybox_compress_incremental (kbxhd);
                         keybox_lock (kbxhd, 0, 0);
                       }
 
@@ -769,6 +991,9 @@ keydb_add_resource (const char *url, unsigned int flags)
 
   /* fixme: check directory permissions and print a warning */
 
+  /* The Bloom filter needs to be rebuilt to cover the new resource.  */
+  kid_bloom_release ();
+
  leave:
   if (err)
     {
@@ -806,6 +1031,11 @@ keydb_dump_stats (void)
             kid_not_found_stats.count,
             kid_not_found_stats.peak,
             kid_not_found_stats.flushes);
+  log_info ("kid_bloom: keys=%zu capacity=%zu builds=%u rejects=%u\n",
+            kid_bloom.count,
+            kid_bloom.capacity,
+            kid_bloom_stats.builds,
+            kid_bloom_stats.rejects);
 }
 
 
@@ -851,6 +1081,8 @@ internal_keydb_init (KEYDB_HANDLE hd)
               reterrno = errno;
               die = 1;
             }
+          else if ((opt.import_options & IMPORT_BULK))
+            keybox_set_append_mode (hd->active[j].u.kb, 1);
           j++;
           break;
         }
@@ -917,6 +1149,18 @@ internal_keydb_lock (KEYDB_HANDLE hd)
 }
 
 
+/* Prepare the key database for use by a process forked from the
+ * process owning CTRL.  The open files of our handles share their
+ * file offsets with the parent; thus the child must not use them but
+ * open its own files.  */
+void
+keydb_prepare_worker (ctrl_t ctrl)
+{
+  keyring_invalidate_file_caches ();
+  ctrl->cached_getkey_kdb = NULL;
+}
+
+
 /* Set a flag on the handle to suppress use of cached results.  This
  * is required for updating a keyring and for key listings.  Fixme:
  * Using a new parameter for keydb_new might be a better solution.  */
@@ -1440,7 +1684,10 @@ internal_keydb_update_keyblock (ctrl_t ctrl, KEYDB_HANDLE hd, kbnode_t kb)
 
   unlock_all (hd);
   if (!err)
-    keydb_stats.update_keyblocks++;
+    {
+      keydb_stats.update_keyblocks++;
+      kid_bloom_add_kb (kb);
+    }
   return err;
 }
 
@@ -1511,7 +1758,10 @@ internal_keydb_insert_keyblock (KEYDB_HANDLE hd, kbnode_t kb)
 
   unlock_all (hd);
   if (!err)
-    keydb_stats.insert_keyblocks++;
+    {
+      keydb_stats.insert_keyblocks++;
+      kid_bloom_add_kb (kb);
+    }
   return err;
 }
 
@@ -1738,6 +1988,7 @@ internal_keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   /* If an entry is already in the cache, then don't add it again.  */
   int already_in_cache = 0;
   int fprlen;
+  u32 bloomkid[2];
 
   log_assert (!hd->use_keyboxd);
 
@@ -1756,6 +2007,17 @@ internal_keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
       return gpg_error (GPG_ERR_NOT_FOUND);
     }
 
+  if (ndesc == 1 && kid_bloom.bits
+      && kid_bloom_kid_from_desc (desc, bloomkid)
+      && !kid_bloom_test (bloomkid))
+    {
+      if (DBG_CLOCK)
+        log_clock ("%s leave (not found, bloom)", __func__);
+      kid_bloom_stats.rejects++;
+      keydb_stats.notfound_cached++;
+      return gpg_error (GPG_ERR_NOT_FOUND);
+    }
+
   /* NB: If one of the exact search modes below is used in a loop to
      walk over all keys (with the same fingerprint) the caching must
      have been disabled for the handle.  */
@@ -1869,6 +2131,14 @@ internal_keydb_search (KEYDB_HANDLE hd, KEYDB_SEARCH_DESC *desc,
       && !already_in_cache)
     kid_not_found_insert (desc[0].u.kid);
 
+  if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND
+      && ndesc == 1
+      && was_reset
+      && !kid_bloom.bits
+      && !kid_bloom.disabled
+      && kid_bloom_kid_from_desc (desc, bloomkid))
+    kid_bloom_build ();
+
   if (!rc)
     keydb_stats.found++;
   else
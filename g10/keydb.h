@@ -222,6 +222,9 @@ gpg_error_t keydb_add_resource (const char *url, unsigned int flags);
 /* Dump some statistics to the log.  */
 void keydb_dump_stats (void);
 
+/* Prepare the key database for use by a forked process.  */
+void keydb_prepare_worker (ctrl_t ctrl);
+
 /* Set a flag on the handle to suppress use of cached results.  This
    is required for updating a keyring and for key listings.  Fixme:
    Using a new parameter for keydb_new might be a better solution.  */
@@ -327,6 +330,12 @@ void cache_public_key( PKT_public_key *pk );
 /* Disable and drop the public key cache.  */
 void getkey_disable_caches(void);
 
+/* Drop the cached data of the keyblock with UBID.  */
+void getkey_invalidate_key (const byte *ubid);
+
+/* Print statistics about the public key cache.  */
+void getkey_dump_stats (void);
+
 /* Return the public key used for signature SIG and store it at PK.  */
 gpg_error_t get_pubkey_for_sig (ctrl_t ctrl,
                                 PKT_public_key *pk, PKT_signature *sig,
@@ -335,6 +344,9 @@ gpg_error_t get_pubkey_for_sig (ctrl_t ctrl,
 /* Return the public key with the key id KEYID and store it at PK.  */
 int get_pubkey (ctrl_t ctrl, PKT_public_key *pk, u32 *keyid);
 
+/* Look up the keys for the N key ids at KEYIDS at once and cache them.  */
+void prefetch_pubkeys (ctrl_t ctrl, u32 (*keyids)[2], int n);
+
 /* Similar to get_pubkey, but it does not take PK->REQ_USAGE into
    account nor does it merge in the self-signed data.  This function
    also only considers primary keys.  */
@@ -577,5 +589,12 @@ KBNODE walk_kbnode( KBNODE root, KBNODE *context, int all );
 void clear_kbnode_flags( KBNODE n );
 int  commit_kbnode( KBNODE *root );
 void dump_kbnode( KBNODE node );
+kbnode_index_t kbnode_index_new (kbnode_t root);
+void kbnode_index_release (kbnode_index_t kbidx);
+kbnode_t kbnode_index_root (kbnode_index_t kbidx);
+kbnode_t kbnode_index_find_prev (kbnode_index_t kbidx, kbnode_t node,
+                                 int pkttype);
+kbnode_t *kbnode_index_sigs (kbnode_index_t kbidx, kbnode_t node,
+                             size_t *r_nsigs);
 
 #endif /*G10_KEYDB_H*/
@@ -2609,17 +2609,15 @@ find_by_primary_fpr (ctrl_t ctrl, const char *fpr,
 }
 
 
-/* Unattended key signing function.  If the key specifified by FPR is
-   available and FPR is the primary fingerprint all user ids of the
-   key are signed using the default signing key.  If UIDS is an empty
-   list all usable UIDs are signed, if it is not empty, only those
-   user ids matching one of the entries of the list are signed.  With
-   LOCAL being true the signatures are marked as non-exportable.  */
-void
-keyedit_quick_sign (ctrl_t ctrl, const char *fpr, strlist_t uids,
-                    strlist_t locusr, int local)
+/* Worker for keyedit_quick_sign and keyedit_quick_sign_batch.  This
+   signs the key FPR but does not store it.  If the keyblock has been
+   modified it is stored at R_KEYBLOCK and the handle used to find it
+   at R_KDBHD; otherwise NULL is stored there.  */
+static void
+quick_sign_key (ctrl_t ctrl, const char *fpr, strlist_t uids,
+                strlist_t locusr, int local,
+                kbnode_t *r_keyblock, KEYDB_HANDLE *r_kdbhd)
 {
-  gpg_error_t err;
   kbnode_t keyblock = NULL;
   KEYDB_HANDLE kdbhd = NULL;
   int modified = 0;
@@ -2628,10 +2626,8 @@ keyedit_quick_sign (ctrl_t ctrl, const char *fpr, strlist_t uids,
   strlist_t sl;
   int any;
 
-#ifdef HAVE_W32_SYSTEM
-  /* See keyedit_menu for why we need this.  */
-  check_trustdb_stale (ctrl);
-#endif
+  *r_keyblock = NULL;
+  *r_kdbhd = NULL;
 
   /* We require a fingerprint because only this uniquely identifies a
      key and may thus be used to select a key for unattended key
@@ -2743,26 +2739,140 @@ keyedit_quick_sign (ctrl_t ctrl, const char *fpr, strlist_t uids,
 
   if (modified)
     {
-      err = keydb_update_keyblock (ctrl, kdbhd, keyblock);
-      if (err)
-        {
-          log_error (_("update failed: %s\n"), gpg_strerror (err));
-          goto leave;
-        }
+      *r_keyblock = keyblock;
+      keyblock = NULL;
+      *r_kdbhd = kdbhd;
+      kdbhd = NULL;
     }
   else
     log_info (_("Key not changed so no update needed.\n"));
 
-  if (update_trust)
-    revalidation_mark (ctrl);
+ leave:
+  release_kbnode (keyblock);
+  keydb_release (kdbhd);
+}
 
 
- leave:
+/* Unattended key signing function.  If the key specifified by FPR is
+   available and FPR is the primary fingerprint all user ids of the
+   key are signed using the default signing key.  If UIDS is an empty
+   list all usable UIDs are signed, if it is not empty, only those
+   user ids matching one of the entries of the list are signed.  With
+   LOCAL being true the signatures are marked as non-exportable.  */
+void
+keyedit_quick_sign (ctrl_t ctrl, const char *fpr, strlist_t uids,
+                    strlist_t locusr, int local)
+{
+  gpg_error_t err;
+  kbnode_t keyblock;
+  KEYDB_HANDLE kdbhd;
+
+#ifdef HAVE_W32_SYSTEM
+  /* See keyedit_menu for why we need this.  */
+  check_trustdb_stale (ctrl);
+#endif
+
+  quick_sign_key (ctrl, fpr, uids, locusr, local, &keyblock, &kdbhd);
+  if (keyblock)
+    {
+      err = keydb_update_keyblock (ctrl, kdbhd, keyblock);
+      if (err)
+        log_error (_("update failed: %s\n"), gpg_strerror (err));
+      else if (update_trust)
+        revalidation_mark (ctrl);
+    }
+
   release_kbnode (keyblock);
   keydb_release (kdbhd);
 }
 
 
+/* Sign all keys given by the fingerprints in FPRS the same way as
+   keyedit_quick_sign does.  The modified keyblocks are kept in
+   memory until all keys have been signed and then written using a
+   single locked key database handle; the trustdb is marked for
+   revalidation only once.  Duplicate fingerprints are skipped.  */
+void
+keyedit_quick_sign_batch (ctrl_t ctrl, strlist_t fprs, strlist_t uids,
+                          strlist_t locusr, int local)
+{
+  gpg_error_t err;
+  kbnode_t *keyblocks = NULL;
+  size_t nkeyblocks = 0;
+  size_t i, n;
+  KEYDB_HANDLE kdbhd = NULL;
+  strlist_t sl, sl2;
+  int any_update = 0;
+
+#ifdef HAVE_W32_SYSTEM
+  /* See keyedit_menu for why we need this.  */
+  check_trustdb_stale (ctrl);
+#endif
+
+  for (n=0, sl=fprs; sl; sl = sl->next)
+    n++;
+  keyblocks = xtrycalloc (n? n : 1, sizeof *keyblocks);
+  if (!keyblocks)
+    {
+      log_error ("error allocating memory: %s\n",
+                 gpg_strerror (gpg_error_from_syserror ()));
+      return;
+    }
+
+  for (sl=fprs; sl; sl = sl->next)
+    {
+      kbnode_t keyblock;
+      KEYDB_HANDLE hd;
+
+      for (sl2=fprs; sl2 != sl; sl2 = sl2->next)
+        if (!ascii_strcasecmp (sl2->d, sl->d))
+          break;
+      if (sl2 != sl)
+        continue;  /* Already done.  */
+
+      quick_sign_key (ctrl, sl->d, uids, locusr, local, &keyblock, &hd);
+      keydb_release (hd);
+      if (keyblock)
+        keyblocks[nkeyblocks++] = keyblock;
+    }
+
+  if (!nkeyblocks)
+    goto leave;
+
+  kdbhd = keydb_new (ctrl);
+  if (!kdbhd)
+    {
+      /* Note that keydb_new has already used log_error.  */
+      goto leave;
+    }
+  err = keydb_lock (kdbhd);
+  if (err)
+    {
+      log_error (_("error locking keyring: %s\n"), gpg_strerror (err));
+      goto leave;
+    }
+  keydb_disable_caching (kdbhd);
+
+  for (i=0; i < nkeyblocks; i++)
+    {
+      err = keydb_update_keyblock (ctrl, kdbhd, keyblocks[i]);
+      if (err)
+        log_error (_("update failed: %s\n"), gpg_strerror (err));
+      else
+        any_update = 1;
+    }
+
+  if (any_update && update_trust)
+    revalidation_mark (ctrl);
+
+ leave:
+  keydb_release (kdbhd);
+  for (i=0; i < nkeyblocks; i++)
+    release_kbnode (keyblocks[i]);
+  xfree (keyblocks);
+}
+
+
 /* Unattended subkey creation function.
  *
  */
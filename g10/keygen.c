@@ -61,6 +61,7 @@ const char *default_expiration_interval = "2y";
 #define KEYGEN_FLAG_NO_PROTECTION 1
 #define KEYGEN_FLAG_TRANSIENT_KEY 2
 #define KEYGEN_FLAG_CREATE_V5_KEY 4
+#define KEYGEN_FLAG_PREGEN        8  /* Only ask the agent to prepare. */
 
 /* Maximum number of supported algorithm preferences.  */
 #define MAX_PREFS 30
@@ -1521,6 +1522,14 @@ common_gen (const char *keyparms, int algo, const char *algoelem,
   PKT_public_key *pk;
   gcry_sexp_t s_key;
 
+  if ((keygen_flags & KEYGEN_FLAG_PREGEN))
+    {
+      err = agent_pregenkey (NULL, keyparms);
+      if (err && opt.verbose)
+        log_info ("pregenerating the key failed: %s\n", gpg_strerror (err));
+      return err;
+    }
+
   err = agent_genkey (NULL, cache_nonce_addr, passwd_nonce_addr, keyparms,
                       !!(keygen_flags & KEYGEN_FLAG_NO_PROTECTION),
                       passphrase, timestamp,
@@ -3200,7 +3209,7 @@ do_create (int algo, unsigned int nbits, const char *curve, kbnode_t pub_root,
 
   /* Fixme: The entropy collecting message should be moved to a
      libgcrypt progress handler.  */
-  if (!opt.batch)
+  if (!opt.batch && !(keygen_flags & KEYGEN_FLAG_PREGEN))
     tty_printf (_(
 "We need to generate a lot of random bytes. It is a good idea to perform\n"
 "some other action (type on the keyboard, move the mouse, utilize the\n"
@@ -5395,6 +5404,23 @@ do_generate_keypair (ctrl_t ctrl, struct para_data_s *para,
   if (get_parameter_uint (para, pVERSION) == 5)
     keygen_flags |= KEYGEN_FLAG_CREATE_V5_KEY;
 
+  /* Let the agent generate a slow subkey in the background while we
+   * wait for the primary key.  */
+  if (!card && get_parameter (para, pSUBKEYTYPE)
+      && !get_parameter_value (para, pSUBKEYGRIP))
+    {
+      int subkey_algo = get_parameter_algo (ctrl, para, pSUBKEYTYPE, NULL);
+
+      if (subkey_algo == PUBKEY_ALGO_RSA
+          || subkey_algo == PUBKEY_ALGO_ELGAMAL_E)
+        do_create (subkey_algo,
+                   get_parameter_uint (para, pSUBKEYLENGTH),
+                   get_parameter_value (para, pSUBKEYCURVE),
+                   NULL, 0, 0, 1,
+                   outctrl->keygen_flags | KEYGEN_FLAG_PREGEN,
+                   NULL, NULL, NULL);
+    }
+
   if (key_from_hexgrip)
     err = do_create_from_keygrip (ctrl, algo, key_from_hexgrip, cardkey,
                                   pub_root,
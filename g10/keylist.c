@@ -139,6 +139,7 @@ public_key_list (ctrl_t ctrl, strlist_t list, int locate_mode, int no_local)
 #ifdef USE_TOFU
   tofu_begin_batch_update (ctrl);
 #endif
+  agent_begin_keyinfo_batch ();
 
   if (locate_mode)
     locate_one (ctrl, list, no_local);
@@ -147,6 +148,7 @@ public_key_list (ctrl_t ctrl, strlist_t list, int locate_mode, int no_local)
   else
     list_one (ctrl, list, 0, opt.with_secret);
 
+  agent_end_keyinfo_batch ();
 #ifdef USE_TOFU
   tofu_end_batch_update (ctrl);
 #endif
@@ -160,10 +162,12 @@ secret_key_list (ctrl_t ctrl, strlist_t list)
 
   check_trustdb_stale (ctrl);
 
+  agent_begin_keyinfo_batch ();
   if (!list)
     list_all (ctrl, 1, 0);
   else				/* List by user id */
     list_one (ctrl, list, 1, 0);
+  agent_end_keyinfo_batch ();
 }
 
 
@@ -949,6 +953,7 @@ list_keyblock_print (ctrl_t ctrl, kbnode_t keyblock, int secret, int fpr,
   int skip_sigs = 0;
   char *hexgrip = NULL;
   char *serialno = NULL;
+  kbnode_index_t kbidx = NULL;
 
   /* Get the keyid from the keyblock.  */
   node = find_kbnode (keyblock, PKT_PUBLIC_KEY);
@@ -961,6 +966,13 @@ list_keyblock_print (ctrl_t ctrl, kbnode_t keyblock, int secret, int fpr,
 
   pk = node->pkt->pkt.public_key;
 
+  /* Checking the signatures needs the user id or subkey of each
+   * signature; with an index that does not depend on the number of
+   * signatures.  Without an index we fall back to walking the
+   * keyblock.  */
+  if (opt.list_sigs && listctx->check_sigs)
+    kbidx = kbnode_index_new (keyblock);
+
   if (secret || opt.with_keygrip)
     {
       rc = hexkeygrip_from_pk (pk, &hexgrip);
@@ -1154,7 +1166,10 @@ list_keyblock_print (ctrl_t ctrl, kbnode_t keyblock, int secret, int fpr,
 
 	  if (listctx->check_sigs)
 	    {
-	      rc = check_key_signature (ctrl, keyblock, node, NULL);
+              if (kbidx)
+                rc = check_key_signature_indexed (ctrl, kbidx, node, NULL);
+              else
+                rc = check_key_signature (ctrl, keyblock, node, NULL);
 	      switch (gpg_err_code (rc))
 		{
 		case 0:
@@ -1291,6 +1306,7 @@ list_keyblock_print (ctrl_t ctrl, kbnode_t keyblock, int secret, int fpr,
 	}
     }
   es_putc ('\n', es_stdout);
+  kbnode_index_release (kbidx);
   xfree (serialno);
   xfree (hexgrip);
 }
@@ -1427,6 +1443,8 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
   unsigned int keylength;
   char *curve = NULL;
   const char *curvename = NULL;
+  kbnode_index_t kbidx = NULL;
+  char namehash_hex[2*20+1];
 
   /* Get the keyid from the keyblock.  */
   node = find_kbnode (keyblock, PKT_PUBLIC_KEY);
@@ -1438,6 +1456,8 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
     }
 
   pk = node->pkt->pkt.public_key;
+  if (opt.list_sigs && opt.check_sigs)
+    kbidx = kbnode_index_new (keyblock);  /* See list_keyblock_print.  */
   if (secret || has_secret || opt.with_keygrip || opt.with_key_data)
     {
       rc = hexkeygrip_from_pk (pk, &hexgrip_buffer);
@@ -1562,15 +1582,19 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
             es_putc (uid_validity, es_stdout);
           es_fputs ("::::", es_stdout);
 
-	  es_fprintf (es_stdout, "%s:", colon_strtime (uid->created));
-	  es_fprintf (es_stdout, "%s:", colon_strtime (uid->expiredate));
+	  es_fputs (colon_strtime (uid->created), es_stdout);
+	  es_putc (':', es_stdout);
+	  es_fputs (colon_strtime (uid->expiredate), es_stdout);
+	  es_putc (':', es_stdout);
 
 	  namehash_from_uid (uid);
 
-	  for (i = 0; i < 20; i++)
-	    es_fprintf (es_stdout, "%02X", uid->namehash[i]);
+          /* Format the hash at once instead of using 20 calls to
+           * es_fprintf.  */
+          bin2hex (uid->namehash, 20, namehash_hex);
+          es_fputs (namehash_hex, es_stdout);
 
-	  es_fprintf (es_stdout, "::");
+	  es_fputs ("::", es_stdout);
 
 	  if (uid->attrib_data)
 	    es_fprintf (es_stdout, "%u %lu", uid->numattribs, uid->attrib_len);
@@ -1721,8 +1745,12 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
 	      if (opt.no_sig_cache)
 		signer_pk = xmalloc_clear (sizeof (PKT_public_key));
 
-	      rc = check_key_signature2 (ctrl, keyblock, node, NULL, signer_pk,
-					 NULL, NULL, NULL);
+              if (kbidx)
+                rc = check_key_signature_indexed (ctrl, kbidx, node,
+                                                  signer_pk);
+              else
+                rc = check_key_signature2 (ctrl, keyblock, node, NULL,
+                                           signer_pk, NULL, NULL, NULL);
 	      switch (gpg_err_code (rc))
 		{
 		case 0:
@@ -1829,6 +1857,7 @@ list_keyblock_colon (ctrl_t ctrl, kbnode_t keyblock,
 	}
     }
 
+  kbnode_index_release (kbidx);
   xfree (curve);
   xfree (hexgrip_buffer);
   xfree (serialno);
@@ -29,6 +29,7 @@
 
 #include "gpg.h"
 #include "../common/util.h"
+#include "../common/host2net.h"
 #include "keyring.h"
 #include "packet.h"
 #include "keydb.h"
@@ -36,8 +37,11 @@
 #include "main.h" /*for check_key_signature()*/
 #include "../common/i18n.h"
 #include "../kbx/keybox.h"
+#include "worker.h"
 
 
+typedef struct kr_index_s *kr_index_t;
+
 typedef struct keyring_resource *KR_RESOURCE;
 struct keyring_resource
 {
@@ -46,6 +50,7 @@ struct keyring_resource
   dotlock_t lockhd;
   int is_locked;
   int did_full_scan;
+  kr_index_t index;   /* The offset index or NULL if not yet read.  */
   char fname[1];
 };
 typedef struct keyring_resource const * CONST_KR_RESOURCE;
@@ -210,6 +215,7 @@ keyring_register_filename (const char *fname, int read_only, void **ptr)
     kr->lockhd = NULL;
     kr->is_locked = 0;
     kr->did_full_scan = 0;
+    kr->index = NULL;
     /* keep a list of all issued pointers */
     kr->next = kr_resources;
     kr_resources = kr;
@@ -232,6 +238,19 @@ keyring_is_writable (void *token)
 }
 
 
+/* Remove the fds of all keyrings from the iobuf cache so that they
+ * are opened again.  This is used by a forked process because the
+ * cached fds share their file offsets with the parent.  */
+void
+keyring_invalidate_file_caches (void)
+{
+  KR_RESOURCE kr;
+
+  for (kr = kr_resources; kr; kr = kr->next)
+    iobuf_ioctl (NULL, IOBUF_IOCTL_INVALIDATE_CACHE, 0, (char*)kr->fname);
+}
+
+
 
 /* Create a new handle for the resource associated with TOKEN.
    On error NULL is returned and ERRNO is set.
@@ -887,11 +906,53 @@ prepare_word_match (const byte *name)
 
 
 
+/* Locate the mailbox in the user id UID,UIDLEN and store its start
+ * at R_MBOX and its length at R_MBOXLEN.  Returns false if the user
+ * id has no mailbox.  */
 static int
-compare_name (int mode, const char *name, const char *uid, size_t uidlen)
+uid_mailbox (const char *uid, size_t uidlen,
+             const char **r_mbox, size_t *r_mboxlen)
 {
     int i;
     const char *s, *se;
+    int have_angles = 1;
+
+    for (i=0, s= uid; i < uidlen && *s != '<'; s++, i++)
+        ;
+    if (i == uidlen)
+      {
+        /* The UID is a plain addr-spec (cf. RFC2822 section 4.3).  */
+        have_angles = 0;
+        s = uid;
+        i = 0;
+      }
+    if (i < uidlen)  {
+        if (have_angles)
+          {
+            /* skip opening delim and one char and look for the closing one*/
+            s++; i++;
+            for (se=s+1, i++; i < uidlen && *se != '>'; se++, i++)
+              ;
+          }
+        else
+          se = s + uidlen;
+
+        if (i < uidlen) {
+            *r_mbox = s;
+            *r_mboxlen = se - s;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+
+static int
+compare_name (int mode, const char *name, const char *uid, size_t uidlen)
+{
+    int i;
+    const char *s;
+    size_t n;
 
     if (mode == KEYDB_SEARCH_MODE_EXACT) {
 	for (i=0; name[i] && uidlen; i++, uidlen--)
@@ -907,41 +968,18 @@ compare_name (int mode, const char *name, const char *uid, size_t uidlen)
     else if (   mode == KEYDB_SEARCH_MODE_MAIL
              || mode == KEYDB_SEARCH_MODE_MAILSUB
              || mode == KEYDB_SEARCH_MODE_MAILEND) {
-        int have_angles = 1;
-	for (i=0, s= uid; i < uidlen && *s != '<'; s++, i++)
-	    ;
-	if (i == uidlen)
-	  {
-	    /* The UID is a plain addr-spec (cf. RFC2822 section 4.3).  */
-	    have_angles = 0;
-	    s = uid;
-	    i = 0;
-	  }
-	if (i < uidlen)  {
-	    if (have_angles)
-	      {
-		/* skip opening delim and one char and look for the closing one*/
-		s++; i++;
-		for (se=s+1, i++; i < uidlen && *se != '>'; se++, i++)
-		  ;
-	      }
-	    else
-	      se = s + uidlen;
-
-	    if (i < uidlen) {
-		i = se - s;
-		if (mode == KEYDB_SEARCH_MODE_MAIL) {
-		    if( strlen(name)-2 == i
-                        && !ascii_memcasecmp( s, name+1, i) )
-			return 0;
-		}
-		else if (mode == KEYDB_SEARCH_MODE_MAILSUB) {
-		    if( ascii_memistr( s, i, name ) )
-			return 0;
-		}
-		else { /* email from end */
-		    /* nyi */
-		}
+	if (uid_mailbox (uid, uidlen, &s, &n)) {
+	    if (mode == KEYDB_SEARCH_MODE_MAIL) {
+		if( strlen(name)-2 == n
+                    && !ascii_memcasecmp( s, name+1, n) )
+		    return 0;
+	    }
+	    else if (mode == KEYDB_SEARCH_MODE_MAILSUB) {
+		if( ascii_memistr( s, n, name ) )
+		    return 0;
+	    }
+	    else { /* email from end */
+		/* nyi */
 	    }
 	}
     }
@@ -954,6 +992,758 @@ compare_name (int mode, const char *name, const char *uid, size_t uidlen)
 }
 
 
+/* If a search has at least this many long key id, fingerprint or
+   exact mail descriptors, keyring_search puts them into a hash table
+   so that each packet is matched by a lookup instead of a compare
+   against every descriptor.  */
+#define DESC_HASH_THRESHOLD 8
+
+/* A per-search hash table over the descriptors.  The buckets and the
+   chain store a descriptor index plus one so that zero terminates a
+   chain.  Descriptors of other modes are kept in OTHERS in ascending
+   order and compared as usual.  */
+struct desc_hash_s
+{
+  unsigned int mask;      /* Number of buckets minus one.  */
+  size_t *buckets;
+  size_t *chain;          /* Indexed by the descriptor index.  */
+  size_t *others;
+  size_t nothers;
+  unsigned int any_kid:1;
+  unsigned int any_fpr:1;
+  unsigned int any_mail:1;
+};
+typedef struct desc_hash_s *desc_hash_t;
+
+
+static u32
+desc_hash_string (const char *s, size_t len)
+{
+  u32 h = 5381;
+
+  for (; len; len--, s++)
+    h = (h << 5) + h + ascii_tolower (*(const unsigned char *)s);
+  return h;
+}
+
+
+/* Store the hash value for DESC at R_HASH and return true.  Returns
+   false if DESC can't be hashed.  */
+static int
+desc_hash_value (KEYDB_SEARCH_DESC *desc, u32 *r_hash)
+{
+  size_t len;
+
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      *r_hash = desc->u.kid[1];
+      return 1;
+    case KEYDB_SEARCH_MODE_FPR:
+      if (desc->fprlen < 16 || desc->fprlen > 32)
+        return 0;
+      *r_hash = buf32_to_u32 (desc->u.fpr);
+      return 1;
+    case KEYDB_SEARCH_MODE_MAIL:
+      len = strlen (desc->u.name);
+      if (len < 2)
+        return 0;
+      *r_hash = desc_hash_string (desc->u.name + 1, len - 2);
+      return 1;
+    default:
+      return 0;
+    }
+}
+
+
+static void
+desc_hash_release (desc_hash_t dh)
+{
+  if (!dh)
+    return;
+  xfree (dh->buckets);
+  xfree (dh->chain);
+  xfree (dh->others);
+  xfree (dh);
+}
+
+
+/* Build a hash table over the NDESC descriptors DESC.  Returns NULL
+   if there are too few hashable descriptors or on memory shortage;
+   the caller then falls back to the linear compare.  */
+static desc_hash_t
+desc_hash_new (KEYDB_SEARCH_DESC *desc, size_t ndesc)
+{
+  desc_hash_t dh;
+  size_t n, nhashed, size;
+  u32 h;
+
+  /* Descriptors with a skip function are compared linearly to keep
+     their semantics simple; they are rare in bulk searches.  */
+  for (n=nhashed=0; n < ndesc; n++)
+    if (!desc[n].skipfnc && desc_hash_value (desc + n, &h))
+      nhashed++;
+  if (nhashed < DESC_HASH_THRESHOLD)
+    return NULL;
+
+  for (size = 16; size < 2 * nhashed; size <<= 1)
+    ;
+
+  dh = xtrycalloc (1, sizeof *dh);
+  if (!dh)
+    return NULL;
+  dh->mask = size - 1;
+  dh->buckets = xtrycalloc (size, sizeof *dh->buckets);
+  dh->chain = xtrycalloc (ndesc, sizeof *dh->chain);
+  dh->others = xtrycalloc (ndesc - nhashed + 1, sizeof *dh->others);
+  if (!dh->buckets || !dh->chain || !dh->others)
+    {
+      desc_hash_release (dh);
+      return NULL;
+    }
+
+  for (n=0; n < ndesc; n++)
+    {
+      if (desc[n].skipfnc || !desc_hash_value (desc + n, &h))
+        {
+          dh->others[dh->nothers++] = n;
+          continue;
+        }
+      dh->chain[n] = dh->buckets[h & dh->mask];
+      dh->buckets[h & dh->mask] = n + 1;
+      if (desc[n].mode == KEYDB_SEARCH_MODE_LONG_KID)
+        dh->any_kid = 1;
+      else if (desc[n].mode == KEYDB_SEARCH_MODE_FPR)
+        dh->any_fpr = 1;
+      else
+        dh->any_mail = 1;
+    }
+
+  return dh;
+}
+
+
+/* Return the lowest index of a hashed descriptor matching the key PK
+   with the key id AKI and the zero padded fingerprint AFP or
+   matching the user id UID.  Returns NDESC if none matches.  */
+static size_t
+desc_hash_lookup (desc_hash_t dh, KEYDB_SEARCH_DESC *desc, size_t ndesc,
+                  PKT_public_key *pk, u32 *aki, const byte *afp,
+                  PKT_user_id *uid)
+{
+  size_t best = ndesc;
+  size_t i, n, len;
+  const char *s;
+
+  if (pk && dh->any_kid)
+    {
+      for (i = dh->buckets[aki[1] & dh->mask]; i; i = dh->chain[i-1])
+        {
+          n = i - 1;
+          if (n < best && desc[n].mode == KEYDB_SEARCH_MODE_LONG_KID
+              && desc[n].u.kid[0] == aki[0] && desc[n].u.kid[1] == aki[1])
+            best = n;
+        }
+    }
+  if (pk && dh->any_fpr)
+    {
+      for (i = dh->buckets[buf32_to_u32 (afp) & dh->mask]; i;
+           i = dh->chain[i-1])
+        {
+          n = i - 1;
+          if (n < best && desc[n].mode == KEYDB_SEARCH_MODE_FPR
+              && !memcmp (desc[n].u.fpr, afp, desc[n].fprlen))
+            best = n;
+        }
+    }
+  if (uid && dh->any_mail && uid_mailbox (uid->name, uid->len, &s, &len))
+    {
+      for (i = dh->buckets[desc_hash_string (s, len) & dh->mask]; i;
+           i = dh->chain[i-1])
+        {
+          n = i - 1;
+          if (n < best && desc[n].mode == KEYDB_SEARCH_MODE_MAIL
+              && strlen (desc[n].u.name) - 2 == len
+              && !ascii_memcasecmp (s, desc[n].u.name + 1, len))
+            best = n;
+        }
+    }
+
+  return best;
+}
+
+
+
+/* Keyrings may have an offset index in a file next to them.  It maps
+   the key ids of all keys and the mailboxes of all user ids to the
+   offsets of their keyblocks so that keyring_search can jump to the
+   keyblocks which may match instead of parsing the entire keyring.
+   The index is only used if the size, the mtime and the inode of
+   the keyring match the values recorded in the index; thus a
+   keyring modified by another program simply has no index until the
+   next keyring_rebuild_cache.  The index file starts with a header
+   of KR_INDEX_HDRLEN bytes:
+
+     4 bytes  magic "KRX1"
+     4 bytes  reserved (zero)
+     8 bytes  size of the keyring
+     8 bytes  mtime of the keyring
+     8 bytes  inode of the keyring
+     4 bytes  number of key id items
+     4 bytes  number of mailbox items
+
+   followed by the key id items and then by the mailbox items, each
+   16 bytes: the two words of the key and the offset.  All values are
+   big endian and the items are sorted by key and offset.  The key
+   of a mailbox is its hash as computed by desc_hash_string and its
+   length.  */
+#define KR_INDEX_SUFFIX  ".idx"
+#define KR_INDEX_MAGIC   "KRX1"
+#define KR_INDEX_HDRLEN  40
+#define KR_INDEX_ITEMLEN 16
+
+struct kr_index_item_s
+{
+  u32 key[2];
+  off_t offset;   /* The offset of the keyblock.  */
+};
+
+struct kr_index_list_s
+{
+  struct kr_index_item_s *items;
+  size_t n;
+  size_t size;    /* Allocated items.  */
+};
+
+struct kr_index_s
+{
+  int valid;              /* The index matches the keyring.  */
+  uint64_t size;          /* The recorded state of the keyring.  */
+  uint64_t mtime;
+  uint64_t ino;
+  struct kr_index_list_s kids;
+  struct kr_index_list_s mails;
+};
+
+
+static void
+kr_index_release (kr_index_t idx)
+{
+  if (!idx)
+    return;
+  xfree (idx->kids.items);
+  xfree (idx->mails.items);
+  xfree (idx);
+}
+
+
+/* Get the state of the keyring FNAME as recorded in the index.
+   Returns 0 on success.  */
+static int
+kr_index_stat (const char *fname,
+               uint64_t *r_size, uint64_t *r_mtime, uint64_t *r_ino)
+{
+  struct stat st;
+
+  if (stat (fname, &st))
+    return -1;
+  *r_size = st.st_size;
+  *r_mtime = st.st_mtime;
+  *r_ino = st.st_ino;
+  return 0;
+}
+
+
+/* Return the name of the index file for the keyring FNAME.  */
+static char *
+kr_index_fname (const char *fname)
+{
+  return xstrconcat (fname, KR_INDEX_SUFFIX, NULL);
+}
+
+
+/* Store the key of the mailbox in the user id UID at KEY.  Returns
+   false if the user id has no mailbox.  */
+static int
+kr_index_mail_key (PKT_user_id *uid, u32 *key)
+{
+  const char *s;
+  size_t len;
+
+  if (!uid_mailbox (uid->name, uid->len, &s, &len))
+    return 0;
+  key[0] = desc_hash_string (s, len);
+  key[1] = len;
+  return 1;
+}
+
+
+/* Store the key for looking up DESC at KEY and return a pointer to
+   the list to search in IDX.  Returns NULL if DESC can't be looked
+   up in the index.  */
+static struct kr_index_list_s *
+kr_index_desc_key (kr_index_t idx, KEYDB_SEARCH_DESC *desc, u32 *key)
+{
+  size_t len;
+
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      key[0] = desc->u.kid[0];
+      key[1] = desc->u.kid[1];
+      return &idx->kids;
+    case KEYDB_SEARCH_MODE_FPR:
+      /* The key id is taken from the fingerprint as done by
+         keyid_from_pk.  */
+      if (desc->fprlen == 20)
+        {
+          key[0] = buf32_to_u32 (desc->u.fpr + 12);
+          key[1] = buf32_to_u32 (desc->u.fpr + 16);
+        }
+      else if (desc->fprlen == 32)
+        {
+          key[0] = buf32_to_u32 (desc->u.fpr);
+          key[1] = buf32_to_u32 (desc->u.fpr + 4);
+        }
+      else
+        return NULL;
+      return &idx->kids;
+    case KEYDB_SEARCH_MODE_MAIL:
+      len = strlen (desc->u.name);
+      if (len < 2)
+        return NULL;
+      key[0] = desc_hash_string (desc->u.name + 1, len - 2);
+      key[1] = len - 2;
+      return &idx->mails;
+    default:
+      return NULL;
+    }
+}
+
+
+static int
+kr_index_item_cmp (const void *a_arg, const void *b_arg)
+{
+  const struct kr_index_item_s *a = a_arg;
+  const struct kr_index_item_s *b = b_arg;
+
+  if (a->key[0] != b->key[0])
+    return a->key[0] < b->key[0]? -1 : 1;
+  if (a->key[1] != b->key[1])
+    return a->key[1] < b->key[1]? -1 : 1;
+  if (a->offset != b->offset)
+    return a->offset < b->offset? -1 : 1;
+  return 0;
+}
+
+
+/* Append an item to LIST.  The list needs to be sorted afterwards.  */
+static gpg_error_t
+kr_index_add (struct kr_index_list_s *list, const u32 *key, off_t offset)
+{
+  struct kr_index_item_s *item;
+
+  if (list->n == list->size)
+    {
+      size_t newsize = list->size? 2 * list->size : 256;
+
+      item = xtryrealloc (list->items, newsize * sizeof *item);
+      if (!item)
+        return gpg_error_from_syserror ();
+      list->items = item;
+      list->size = newsize;
+    }
+  item = list->items + list->n++;
+  item->key[0] = key[0];
+  item->key[1] = key[1];
+  item->offset = offset;
+  return 0;
+}
+
+
+/* Add the keys and mailboxes of KEYBLOCK at OFFSET to IDX.  */
+static gpg_error_t
+kr_index_add_kb (kr_index_t idx, kbnode_t keyblock, off_t offset)
+{
+  gpg_error_t err = 0;
+  kbnode_t node;
+  u32 key[2];
+
+  for (node = keyblock; node && !err; node = node->next)
+    {
+      if (node->pkt->pkttype == PKT_PUBLIC_KEY
+          || node->pkt->pkttype == PKT_PUBLIC_SUBKEY
+          || node->pkt->pkttype == PKT_SECRET_KEY
+          || node->pkt->pkttype == PKT_SECRET_SUBKEY)
+        {
+          keyid_from_pk (node->pkt->pkt.public_key, key);
+          err = kr_index_add (&idx->kids, key, offset);
+        }
+      else if (node->pkt->pkttype == PKT_USER_ID
+               && kr_index_mail_key (node->pkt->pkt.user_id, key))
+        err = kr_index_add (&idx->mails, key, offset);
+    }
+  return err;
+}
+
+
+static void
+kr_index_sort (kr_index_t idx)
+{
+  qsort (idx->kids.items, idx->kids.n, sizeof *idx->kids.items,
+         kr_index_item_cmp);
+  qsort (idx->mails.items, idx->mails.n, sizeof *idx->mails.items,
+         kr_index_item_cmp);
+}
+
+
+/* Remove the items for the keyblock at OFFSET from LIST and move the
+   items of the keyblocks after it by DELTA.  */
+static void
+kr_index_shift (struct kr_index_list_s *list, off_t offset, off_t delta)
+{
+  size_t i, n;
+
+  for (i = n = 0; i < list->n; i++)
+    {
+      if (list->items[i].offset == offset)
+        continue;
+      list->items[n] = list->items[i];
+      if (list->items[n].offset > offset)
+        list->items[n].offset += delta;
+      n++;
+    }
+  list->n = n;
+}
+
+
+static void
+kr_index_put32 (byte *p, u32 a)
+{
+  p[0] = a >> 24;
+  p[1] = a >> 16;
+  p[2] = a >> 8;
+  p[3] = a;
+}
+
+static void
+kr_index_put64 (byte *p, uint64_t a)
+{
+  kr_index_put32 (p, a >> 32);
+  kr_index_put32 (p + 4, a);
+}
+
+static uint64_t
+kr_index_get64 (const byte *p)
+{
+  return ((uint64_t)buf32_to_u32 (p) << 32) | buf32_to_u32 (p + 4);
+}
+
+
+static gpg_error_t
+kr_index_write_list (estream_t fp, struct kr_index_list_s *list)
+{
+  byte buf[KR_INDEX_ITEMLEN];
+  size_t i;
+
+  for (i = 0; i < list->n; i++)
+    {
+      kr_index_put32 (buf, list->items[i].key[0]);
+      kr_index_put32 (buf + 4, list->items[i].key[1]);
+      kr_index_put64 (buf + 8, list->items[i].offset);
+      if (es_write (fp, buf, sizeof buf, NULL))
+        return gpg_error_from_syserror ();
+    }
+  return 0;
+}
+
+
+/* Write the sorted index IDX for the keyring FNAME, which must have
+   just been written.  Errors are only logged because a missing index
+   merely slows down the searches.  */
+static void
+kr_index_write (const char *fname, kr_index_t idx)
+{
+  gpg_error_t err;
+  char *idxfname, *tmpfname;
+  estream_t fp;
+  byte hdr[KR_INDEX_HDRLEN];
+  mode_t oldmask;
+
+  if (kr_index_stat (fname, &idx->size, &idx->mtime, &idx->ino))
+    return;
+  idxfname = kr_index_fname (fname);
+  tmpfname = xstrconcat (idxfname, ".tmp", NULL);
+
+  memset (hdr, 0, sizeof hdr);
+  memcpy (hdr, KR_INDEX_MAGIC, 4);
+  kr_index_put64 (hdr + 8, idx->size);
+  kr_index_put64 (hdr + 16, idx->mtime);
+  kr_index_put64 (hdr + 24, idx->ino);
+  kr_index_put32 (hdr + 32, idx->kids.n);
+  kr_index_put32 (hdr + 36, idx->mails.n);
+
+  oldmask = umask (077);
+  fp = es_fopen (tmpfname, "wb");
+  umask (oldmask);
+  if (!fp)
+    err = gpg_error_from_syserror ();
+  else if (es_write (fp, hdr, sizeof hdr, NULL))
+    err = gpg_error_from_syserror ();
+  else if (!(err = kr_index_write_list (fp, &idx->kids)))
+    err = kr_index_write_list (fp, &idx->mails);
+  if (fp && es_fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  if (!err)
+    err = gnupg_rename_file (tmpfname, idxfname, NULL);
+  if (err)
+    {
+      log_info ("error writing keyring index '%s': %s\n",
+                idxfname, gpg_strerror (err));
+      gnupg_remove (tmpfname);
+    }
+  xfree (tmpfname);
+  xfree (idxfname);
+}
+
+
+static int
+kr_index_read_list (estream_t fp, struct kr_index_list_s *list, size_t n)
+{
+  byte buf[KR_INDEX_ITEMLEN];
+  size_t nread;
+
+  list->items = xtrycalloc (n? n : 1, sizeof *list->items);
+  if (!list->items)
+    return -1;
+  list->size = n;
+  for (list->n = 0; list->n < n; list->n++)
+    {
+      if (es_read (fp, buf, sizeof buf, &nread) || nread != sizeof buf)
+        return -1;
+      list->items[list->n].key[0] = buf32_to_u32 (buf);
+      list->items[list->n].key[1] = buf32_to_u32 (buf + 4);
+      list->items[list->n].offset = kr_index_get64 (buf + 8);
+    }
+  return 0;
+}
+
+
+/* Read the index of the keyring FNAME.  Returns NULL if there is no
+   index or it does not match the keyring.  */
+static kr_index_t
+kr_index_read (const char *fname)
+{
+  kr_index_t idx;
+  char *idxfname;
+  estream_t fp;
+  byte hdr[KR_INDEX_HDRLEN];
+  size_t nread;
+  uint64_t size, mtime, ino;
+
+  if (kr_index_stat (fname, &size, &mtime, &ino))
+    return NULL;
+  idxfname = kr_index_fname (fname);
+  fp = es_fopen (idxfname, "rb");
+  xfree (idxfname);
+  if (!fp)
+    return NULL;
+
+  idx = xtrycalloc (1, sizeof *idx);
+  if (!idx
+      || es_read (fp, hdr, sizeof hdr, &nread) || nread != sizeof hdr
+      || memcmp (hdr, KR_INDEX_MAGIC, 4)
+      || kr_index_get64 (hdr + 8) != size
+      || kr_index_get64 (hdr + 16) != mtime
+      || kr_index_get64 (hdr + 24) != ino
+      || kr_index_read_list (fp, &idx->kids, buf32_to_u32 (hdr + 32))
+      || kr_index_read_list (fp, &idx->mails, buf32_to_u32 (hdr + 36)))
+    {
+      kr_index_release (idx);
+      es_fclose (fp);
+      return NULL;
+    }
+  es_fclose (fp);
+  idx->valid = 1;
+  idx->size = size;
+  idx->mtime = mtime;
+  idx->ino = ino;
+  return idx;
+}
+
+
+/* Return the index of the keyring KR or NULL if it has no valid
+   index.  */
+static kr_index_t
+kr_index_get (KR_RESOURCE kr)
+{
+  uint64_t size, mtime, ino;
+
+  if (kr_index_stat (kr->fname, &size, &mtime, &ino))
+    return NULL;
+  if (!kr->index || kr->index->size != size || kr->index->mtime != mtime
+      || kr->index->ino != ino)
+    {
+      kr_index_release (kr->index);
+      kr->index = kr_index_read (kr->fname);
+      if (!kr->index)
+        {
+          /* Remember that there is no index for this state of the
+             keyring.  */
+          kr->index = xtrycalloc (1, sizeof *kr->index);
+          if (!kr->index)
+            return NULL;
+          kr->index->size = size;
+          kr->index->mtime = mtime;
+          kr->index->ino = ino;
+        }
+    }
+  return kr->index->valid? kr->index : NULL;
+}
+
+
+/* Build the index for the keyring FNAME from scratch.  */
+static void
+kr_index_build (const char *fname)
+{
+  gpg_error_t err = 0;
+  kr_index_t idx;
+  IOBUF a;
+  PACKET pkt;
+  struct parse_packet_ctx_s parsectx;
+  int save_mode;
+  off_t offset, main_offset = 0;
+  int in_keyblock = 0;
+  int rc;
+  u32 key[2];
+
+  idx = xtrycalloc (1, sizeof *idx);
+  if (!idx)
+    return;
+  a = iobuf_open (fname);
+  if (!a)
+    {
+      kr_index_release (idx);
+      return;
+    }
+
+  init_packet (&pkt);
+  save_mode = set_packet_list_mode (0);
+  init_parse_packet (&parsectx, a);
+  while (!err && (rc = search_packet (&parsectx, &pkt, &offset, 1)) != -1)
+    {
+      if (gpg_err_code (rc) == GPG_ERR_LEGACY_KEY)
+        {
+          /* Legacy keys are not found by the search.  */
+          in_keyblock = 0;
+          free_packet (&pkt, &parsectx);
+          continue;
+        }
+      if (rc)
+        {
+          err = rc;
+          break;
+        }
+      if (pkt.pkttype == PKT_PUBLIC_KEY || pkt.pkttype == PKT_SECRET_KEY)
+        {
+          main_offset = offset;
+          in_keyblock = 1;
+        }
+      if (in_keyblock)
+        {
+          if (pkt.pkttype == PKT_PUBLIC_KEY
+              || pkt.pkttype == PKT_PUBLIC_SUBKEY
+              || pkt.pkttype == PKT_SECRET_KEY
+              || pkt.pkttype == PKT_SECRET_SUBKEY)
+            {
+              keyid_from_pk (pkt.pkt.public_key, key);
+              err = kr_index_add (&idx->kids, key, main_offset);
+            }
+          else if (pkt.pkttype == PKT_USER_ID
+                   && kr_index_mail_key (pkt.pkt.user_id, key))
+            err = kr_index_add (&idx->mails, key, main_offset);
+        }
+      free_packet (&pkt, &parsectx);
+    }
+  free_packet (&pkt, &parsectx);
+  deinit_parse_packet (&parsectx);
+  set_packet_list_mode (save_mode);
+  iobuf_close (a);
+
+  if (err)
+    log_info ("error building keyring index for '%s': %s\n",
+              fname, gpg_strerror (err));
+  else
+    {
+      kr_index_sort (idx);
+      kr_index_write (fname, idx);
+    }
+  kr_index_release (idx);
+}
+
+
+/* Use the index to move the search of HD for the single descriptor
+   DESC to the next keyblock which may match.  Returns -1 if no more
+   keyblock can match and an error code if seeking failed.  Returns 0
+   without moving if there is no index or DESC can't be looked up in
+   it.  */
+static int
+kr_index_seek (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc)
+{
+  KR_RESOURCE kr;
+  kr_index_t idx;
+  struct kr_index_list_s *list;
+  struct kr_index_item_s *item;
+  size_t lo, hi, mid;
+  off_t pos;
+  u32 key[2];
+
+  for (kr = kr_resources; kr && kr != hd->current.kr; kr = kr->next)
+    ;
+  if (!kr || !hd->current.iobuf || !(idx = kr_index_get (kr)))
+    return 0;
+  list = kr_index_desc_key (idx, desc, key);
+  if (!list)
+    return 0;
+
+  /* Find the first item for KEY with a keyblock at or after the
+     current position.  Note that the position is within the last
+     found keyblock if the search continues.  */
+  pos = iobuf_tell (hd->current.iobuf);
+  lo = 0;
+  hi = list->n;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      item = list->items + mid;
+      if (item->key[0] < key[0]
+          || (item->key[0] == key[0]
+              && (item->key[1] < key[1]
+                  || (item->key[1] == key[1] && item->offset < pos))))
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  if (lo == list->n)
+    return -1;
+  item = list->items + lo;
+  if (item->key[0] != key[0] || item->key[1] != key[1])
+    return -1;
+
+  if (DBG_LOOKUP)
+    log_debug ("%s: index says to continue at offset %lld\n",
+               __func__, (long long)item->offset);
+  if (item->offset != pos && iobuf_seek (hd->current.iobuf, item->offset))
+    {
+      hd->current.error = gpg_error_from_syserror ();
+      log_error ("error seeking in '%s': %s\n",
+                 kr->fname, gpg_strerror (hd->current.error));
+      return hd->current.error;
+    }
+  return 0;
+}
+
+
 /*
  * Search through the keyring(s), starting at the current position,
  * for a keyblock which contains one of the keys described in the DESC array.
@@ -967,7 +1757,8 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   struct parse_packet_ctx_s parsectx;
   int save_mode;
   off_t offset, main_offset;
-  size_t n;
+  size_t n, i, best;
+  desc_hash_t dhash;
   int need_uid, need_words, need_keyid, need_fpr, any_skip;
   int pk_no, uid_no;
   int initial_skip;
@@ -1087,6 +1878,27 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
       /*  name = hd->word_match.pattern; */
     }
 
+  if (ndesc == 1)
+    {
+      rc = kr_index_seek (hd, desc);
+      if (rc)
+        {
+          if (rc == -1)
+            {
+              if (DBG_LOOKUP)
+                log_debug ("%s: index says not present\n", __func__);
+              hd->found.kr = NULL;
+              hd->current.eof = 1;
+            }
+          return rc;
+        }
+    }
+
+  dhash = ndesc >= DESC_HASH_THRESHOLD? desc_hash_new (desc, ndesc) : NULL;
+  if (DBG_LOOKUP && dhash)
+    log_debug ("%s: using a hash table for %zu of %zu descriptors\n",
+               __func__, ndesc - dhash->nothers, ndesc);
+
   init_packet(&pkt);
   save_mode = set_packet_list_mode(0);
 
@@ -1155,8 +1967,13 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
           ++uid_no;
         }
 
-      for (n=0; n < ndesc; n++)
+      best = dhash? desc_hash_lookup (dhash, desc, ndesc,
+                                      pk, aki, afp, uid) : ndesc;
+      for (i=0; i < (dhash? dhash->nothers : ndesc); i++)
         {
+          n = dhash? dhash->others[i] : i;
+          if (n >= best)
+            break;
           switch (desc[n].mode) {
           case KEYDB_SEARCH_MODE_NONE:
             BUG ();
@@ -1202,6 +2019,11 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
             goto found;
           }
 	}
+      if (best < ndesc)
+        {
+          n = best;
+          goto found;
+        }
       free_packet (&pkt, &parsectx);
       continue;
     found:
@@ -1286,6 +2108,7 @@ keyring_search (KEYRING_HANDLE hd, KEYDB_SEARCH_DESC *desc,
   free_packet (&pkt, &parsectx);
   deinit_parse_packet (&parsectx);
   set_packet_list_mode(save_mode);
+  desc_hash_release (dhash);
   return rc;
 }
 
@@ -1403,6 +2226,273 @@ write_keyblock (IOBUF fp, KBNODE keyblock)
   return 0;
 }
 
+
+/* Check all signatures of KEYBLOCK to set the signature's cache
+ * flags.  Returns the number of signatures.  */
+static ulong
+rebuild_check_sigs (ctrl_t ctrl, kbnode_t keyblock)
+{
+  kbnode_t node;
+  ulong sigcount = 0;
+  kbnode_index_t kbidx;
+
+  /* With many signatures the index avoids a quadratic runtime.  */
+  kbidx = kbnode_index_new (keyblock);
+
+  for (node=keyblock; node; node=node->next)
+    {
+      /* Note that this doesn't cache the result of a revocation
+         issued by a designated revoker.  This is because the pk in
+         question does not carry the revkeys as we haven't merged the
+         key and selfsigs.  It is questionable whether this matters
+         very much since there are very very few designated revoker
+         revocation packets out there. */
+      if (node->pkt->pkttype == PKT_SIGNATURE)
+        {
+          PKT_signature *sig=node->pkt->pkt.signature;
+
+          if(!opt.no_sig_cache && sig->flags.checked && sig->flags.valid
+             && (openpgp_md_test_algo(sig->digest_algo)
+                 || openpgp_pk_test_algo(sig->pubkey_algo)))
+            sig->flags.checked=sig->flags.valid=0;
+          else if (kbidx)
+            check_key_signature_indexed (ctrl, kbidx, node, NULL);
+          else
+            check_key_signature (ctrl, keyblock, node, NULL);
+
+          sigcount++;
+        }
+    }
+  kbnode_index_release (kbidx);
+  return sigcount;
+}
+
+
+/* Write the checked KEYBLOCK to the temporary file FP and show the
+ * progress.  */
+static gpg_error_t
+rebuild_write_keyblock (IOBUF fp, kbnode_t keyblock, int noisy,
+                        ulong *count, ulong sigcount)
+{
+  gpg_error_t err;
+
+  err = write_keyblock (fp, keyblock);
+  if (err)
+    return err;
+
+  if ( !(++*count % 50) && noisy && !opt.quiet)
+    log_info (ngettext("%lu keys cached so far (%lu signature)\n",
+                       "%lu keys cached so far (%lu signatures)\n",
+                       sigcount),
+              *count, sigcount);
+  return 0;
+}
+
+
+#ifndef HAVE_W32_SYSTEM
+/* The upper limit for --rebuild-jobs.  */
+#define MAX_REBUILD_JOBS 64
+
+/* A process used by keyring_rebuild_cache to check the signatures of
+ * keyblocks.  The worker receives the offset of the keyblock, reads
+ * it on its own, and returns the cache flags of all signatures, one
+ * byte each, in the same encoding as the ring trust packet.  Each
+ * worker has at most one keyblock in flight; thus a round robin
+ * dispatch also returns the keyblocks in their original order.  */
+struct rebuild_worker_s
+{
+  struct worker_s proc;  /* Requests are the keyblock offsets.  */
+  kbnode_t keyblock;     /* The keyblock being checked or NULL.  */
+};
+
+/* The parameters for rebuild_worker_main.  */
+struct rebuild_worker_parm_s
+{
+  ctrl_t ctrl;
+  void *token;
+};
+
+
+/* The main loop of a worker process.  */
+static void
+rebuild_worker_main (void *opaque, int in_fd, int out_fd)
+{
+  struct rebuild_worker_parm_s *parm = opaque;
+  ctrl_t ctrl = parm->ctrl;
+  KEYRING_HANDLE hd;
+  kbnode_t keyblock, node;
+  off_t offset;
+  unsigned char *flags = NULL;
+  size_t flagssize = 0;
+  u32 nsigs;
+
+  /* The fds in the iobuf cache and the cached getkey handle share
+   * their file offsets with our parent.  Make sure we open our own
+   * files.  */
+  keyring_invalidate_file_caches ();
+  ctrl->cached_getkey_kdb = NULL;
+
+  hd = keyring_new (parm->token);
+  if (!hd)
+    _exit (2);
+  hd->found.kr = hd->resource;
+
+  while (!worker_readn (in_fd, &offset, sizeof offset))
+    {
+      hd->found.offset = offset;
+      if (keyring_get_keyblock (hd, &keyblock))
+        {
+          nsigs = (u32)(-1);
+          if (worker_writen (out_fd, &nsigs, sizeof nsigs))
+            break;
+          continue;
+        }
+
+      nsigs = rebuild_check_sigs (ctrl, keyblock);
+      if (nsigs > flagssize)
+        {
+          xfree (flags);
+          flagssize = nsigs + 64;
+          flags = xmalloc (flagssize);
+        }
+      nsigs = 0;
+      for (node = keyblock; node; node = node->next)
+        if (node->pkt->pkttype == PKT_SIGNATURE)
+          {
+            PKT_signature *sig = node->pkt->pkt.signature;
+
+            flags[nsigs++] = ((sig->flags.checked? 1 : 0)
+                              | (sig->flags.valid? 2 : 0));
+          }
+      release_kbnode (keyblock);
+      if (worker_writen (out_fd, &nsigs, sizeof nsigs)
+          || worker_writen (out_fd, flags, nsigs))
+        break;
+    }
+}
+
+
+/* Stop the NWORKERS processes in WORKERS and release their pending
+ * keyblocks.  */
+static void
+rebuild_stop_workers (struct rebuild_worker_s *workers, int nworkers)
+{
+  int i;
+
+  for (i=0; i < nworkers; i++)
+    worker_close_requests (&workers[i].proc);
+  for (i=0; i < nworkers; i++)
+    {
+      worker_stop (&workers[i].proc, 0);
+      release_kbnode (workers[i].keyblock);
+      workers[i].keyblock = NULL;
+    }
+}
+
+
+/* Start NWORKERS worker processes for the keyring TOKEN and store
+ * them at WORKERS.  */
+static gpg_error_t
+rebuild_start_workers (ctrl_t ctrl, void *token,
+                       struct rebuild_worker_s *workers, int nworkers)
+{
+  gpg_error_t err = 0;
+  struct rebuild_worker_parm_s parm;
+  int i;
+
+  for (i=0; i < nworkers; i++)
+    {
+      worker_init (&workers[i].proc);
+      workers[i].keyblock = NULL;
+    }
+
+  parm.ctrl = ctrl;
+  parm.token = token;
+  for (i=0; !err && i < nworkers; i++)
+    err = worker_start (&workers[i].proc, 1, rebuild_worker_main, &parm);
+
+  if (err)
+    {
+      log_info ("error starting rebuild worker: %s\n", gpg_strerror (err));
+      rebuild_stop_workers (workers, nworkers);
+    }
+  return err;
+}
+
+
+/* Wait for the result of WORKER, copy the signature flags to its
+ * keyblock and write that keyblock to FP.  */
+static gpg_error_t
+rebuild_finish_keyblock (struct rebuild_worker_s *worker, IOBUF fp,
+                         int noisy, ulong *count, ulong *sigcount)
+{
+  gpg_error_t err;
+  kbnode_t node;
+  u32 nsigs;
+  unsigned char flag;
+
+  err = worker_readn (worker->proc.from_fd, &nsigs, sizeof nsigs);
+  if (!err && nsigs == (u32)(-1))
+    err = gpg_error (GPG_ERR_INV_KEYRING);
+  for (node = worker->keyblock; !err && node; node = node->next)
+    if (node->pkt->pkttype == PKT_SIGNATURE)
+      {
+        PKT_signature *sig = node->pkt->pkt.signature;
+
+        if (!nsigs)
+          err = gpg_error (GPG_ERR_INV_KEYRING);
+        else if (!(err = worker_readn (worker->proc.from_fd, &flag, 1)))
+          {
+            sig->flags.checked = !!(flag & 1);
+            sig->flags.valid = !!(flag & 2);
+            nsigs--;
+            ++*sigcount;
+          }
+      }
+  if (!err && nsigs)
+    err = gpg_error (GPG_ERR_INV_KEYRING);
+  if (err)
+    {
+      log_error ("error receiving result from rebuild worker: %s\n",
+                 gpg_strerror (err));
+      return err;
+    }
+
+  err = rebuild_write_keyblock (fp, worker->keyblock, noisy,
+                                count, *sigcount);
+  release_kbnode (worker->keyblock);
+  worker->keyblock = NULL;
+  return err;
+}
+
+
+/* Write out all keyblocks pending at the NWORKERS WORKERS in the
+ * order they were dispatched; NEXTWORKER is the worker to be used
+ * next and thus has the oldest keyblock.  */
+static gpg_error_t
+rebuild_flush_workers (struct rebuild_worker_s *workers, int nworkers,
+                       int nextworker, IOBUF fp, int noisy,
+                       ulong *count, ulong *sigcount)
+{
+  gpg_error_t err;
+  int i;
+
+  for (i=0; i < nworkers; i++)
+    {
+      struct rebuild_worker_s *wk = workers + (nextworker + i) % nworkers;
+
+      if (wk->keyblock)
+        {
+          err = rebuild_finish_keyblock (wk, fp, noisy, count, sigcount);
+          if (err)
+            return err;
+        }
+    }
+  return 0;
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
 /*
  * Walk over all public keyrings, check the signatures and replace the
  * keyring with a new one where the signature cache is then updated.
@@ -1413,13 +2503,18 @@ keyring_rebuild_cache (ctrl_t ctrl, void *token, int noisy)
 {
   KEYRING_HANDLE hd;
   KEYDB_SEARCH_DESC desc;
-  KBNODE keyblock = NULL, node;
+  KBNODE keyblock = NULL;
   const char *lastresname = NULL, *resname;
   IOBUF tmpfp = NULL;
   char *tmpfilename = NULL;
   char *bakfilename = NULL;
   int rc;
   ulong count = 0, sigcount = 0;
+#ifndef HAVE_W32_SYSTEM
+  int nworkers = 0;
+  struct rebuild_worker_s workers[MAX_REBUILD_JOBS];
+  int nextworker = 0;
+#endif
 
   hd = keyring_new (token);
   if (!hd)
@@ -1431,6 +2526,21 @@ keyring_rebuild_cache (ctrl_t ctrl, void *token, int noisy)
   if(rc)
     goto leave;
 
+#ifndef HAVE_W32_SYSTEM
+  /* Start the workers before we open any files so that they do not
+   * inherit them.  On error we check the signatures ourselves.  */
+  if (opt.rebuild_jobs > 1)
+    {
+      nworkers = opt.rebuild_jobs;
+      if (nworkers > MAX_REBUILD_JOBS)
+        nworkers = MAX_REBUILD_JOBS;
+      if (rebuild_start_workers (ctrl, token, workers, nworkers))
+        nworkers = 0;
+      else if (noisy || opt.verbose)
+        log_info ("using %d processes to check the signatures\n", nworkers);
+    }
+#endif
+
   for (;;)
     {
       rc = keyring_search (hd, &desc, 1, NULL, 1 /* ignore_legacy */);
@@ -1441,6 +2551,15 @@ keyring_rebuild_cache (ctrl_t ctrl, void *token, int noisy)
       resname = keyring_get_resource_name (hd);
       if (lastresname != resname )
         { /* we have switched to a new keyring - commit changes */
+#ifndef HAVE_W32_SYSTEM
+          if (nworkers && tmpfp)
+            {
+              rc = rebuild_flush_workers (workers, nworkers, nextworker,
+                                          tmpfp, noisy, &count, &sigcount);
+              if (rc)
+                goto leave;
+            }
+#endif
           if (tmpfp)
             {
               if (iobuf_close (tmpfp))
@@ -1462,6 +2581,8 @@ keyring_rebuild_cache (ctrl_t ctrl, void *token, int noisy)
           xfree (bakfilename);  bakfilename = NULL;
           if (rc)
             goto leave;
+          if (lastresname)
+            kr_index_build (lastresname);
           lastresname = resname;
           if (noisy && !opt.quiet)
             log_info (_("caching keyring '%s'\n"), resname);
@@ -1505,43 +2626,40 @@ keyring_rebuild_cache (ctrl_t ctrl, void *token, int noisy)
              Note: This test is actually superfluous because we
              already acted upon GPG_ERR_LEGACY_KEY.      */
         }
-      else
+#ifndef HAVE_W32_SYSTEM
+      else if (nworkers)
         {
-          /* Check all signature to set the signature's cache flags. */
-          for (node=keyblock; node; node=node->next)
-            {
-              /* Note that this doesn't cache the result of a
-                 revocation issued by a designated revoker.  This is
-                 because the pk in question does not carry the revkeys
-                 as we haven't merged the key and selfsigs.  It is
-                 questionable whether this matters very much since
-                 there are very very few designated revoker revocation
-                 packets out there. */
-              if (node->pkt->pkttype == PKT_SIGNATURE)
-                {
-                  PKT_signature *sig=node->pkt->pkt.signature;
-
-                  if(!opt.no_sig_cache && sig->flags.checked && sig->flags.valid
-                     && (openpgp_md_test_algo(sig->digest_algo)
-                         || openpgp_pk_test_algo(sig->pubkey_algo)))
-                    sig->flags.checked=sig->flags.valid=0;
-                  else
-                    check_key_signature (ctrl, keyblock, node, NULL);
+          struct rebuild_worker_s *wk = workers + nextworker;
 
-                  sigcount++;
-                }
+          /* The worker's previous keyblock is the oldest one pending;
+           * write it out before handing over the new one.  */
+          nextworker = (nextworker + 1) % nworkers;
+          if (wk->keyblock)
+            {
+              rc = rebuild_finish_keyblock (wk, tmpfp, noisy,
+                                            &count, &sigcount);
+              if (rc)
+                goto leave;
             }
-
-          /* Write the keyblock to the temporary file.  */
-          rc = write_keyblock (tmpfp, keyblock);
+          rc = worker_writen (wk->proc.to_fd,
+                              &hd->found.offset, sizeof hd->found.offset);
+          if (rc)
+            {
+              log_error ("error sending keyblock to rebuild worker: %s\n",
+                         gpg_strerror (rc));
+              goto leave;
+            }
+          wk->keyblock = keyblock;
+          keyblock = NULL;
+        }
+#endif
+      else
+        {
+          sigcount += rebuild_check_sigs (ctrl, keyblock);
+          rc = rebuild_write_keyblock (tmpfp, keyblock, noisy,
+                                       &count, sigcount);
           if (rc)
             goto leave;
-
-          if ( !(++count % 50) && noisy && !opt.quiet)
-            log_info (ngettext("%lu keys cached so far (%lu signature)\n",
-                               "%lu keys cached so far (%lu signatures)\n",
-                               sigcount),
-                      count, sigcount);
         }
     } /* end main loop */
   if (rc == -1)
@@ -1551,6 +2669,15 @@ keyring_rebuild_cache (ctrl_t ctrl, void *token, int noisy)
       log_error ("keyring_search failed: %s\n", gpg_strerror (rc));
       goto leave;
     }
+#ifndef HAVE_W32_SYSTEM
+  if (nworkers && tmpfp)
+    {
+      rc = rebuild_flush_workers (workers, nworkers, nextworker,
+                                  tmpfp, noisy, &count, &sigcount);
+      if (rc)
+        goto leave;
+    }
+#endif
 
   if (noisy || opt.verbose)
     {
@@ -1577,6 +2704,8 @@ keyring_rebuild_cache (ctrl_t ctrl, void *token, int noisy)
                                      lastresname) : 0;
   xfree (tmpfilename);  tmpfilename = NULL;
   xfree (bakfilename);  bakfilename = NULL;
+  if (!rc && lastresname)
+    kr_index_build (lastresname);
 
  leave:
   if (tmpfp)
@@ -1584,6 +2713,10 @@ keyring_rebuild_cache (ctrl_t ctrl, void *token, int noisy)
   xfree (tmpfilename);
   xfree (bakfilename);
   release_kbnode (keyblock);
+#ifndef HAVE_W32_SYSTEM
+  if (nworkers)
+    rebuild_stop_workers (workers, nworkers);
+#endif
   keyring_lock (hd, 0);
   keyring_release (hd);
   return rc;
@@ -1605,6 +2738,9 @@ do_copy (int mode, const char *fname, KBNODE root,
     int rc=0;
     char *bakfname = NULL;
     char *tmpfname = NULL;
+    kr_index_t idx = NULL;
+    int idx_ok = 1;
+    off_t newoff = start_offset, oldend = 0, newend = start_offset;
 
     /* Open the source file. Because we do a rename, we have to check the
        permissions of the file */
@@ -1658,6 +2794,11 @@ do_copy (int mode, const char *fname, KBNODE root,
 	goto leave;
       }
 
+    /* An existing index is updated along with the copy.  This is only
+       possible if all other keyblocks keep their length; thus we
+       compare the positions while copying.  */
+    idx = kr_index_read (fname);
+
     /* Create the new file.  */
     rc = create_tmp_file (fname, &bakfname, &tmpfname, &newfp);
     if (rc) {
@@ -1675,6 +2816,9 @@ do_copy (int mode, const char *fname, KBNODE root,
 	    iobuf_cancel(newfp);
 	    goto leave;
 	}
+        newoff = iobuf_tell (newfp);
+        if (newoff != iobuf_tell (fp))
+          idx_ok = 0;
     }
 
     if( mode == 2 || mode == 3 ) { /* delete or update */
@@ -1687,6 +2831,8 @@ do_copy (int mode, const char *fname, KBNODE root,
 	    iobuf_cancel(newfp);
 	    goto leave;
 	}
+        if (iobuf_tell (newfp) != start_offset)
+          idx_ok = 0;
 	/* skip this keyblock */
 	log_assert( n_packets );
 	rc = skip_some_packets( fp, n_packets );
@@ -1697,6 +2843,7 @@ do_copy (int mode, const char *fname, KBNODE root,
 	    iobuf_cancel(newfp);
 	    goto leave;
 	}
+        oldend = iobuf_tell (fp);
     }
 
     if( mode == 1 || mode == 3 ) { /* insert or update */
@@ -1706,6 +2853,7 @@ do_copy (int mode, const char *fname, KBNODE root,
           iobuf_cancel(newfp);
           goto leave;
         }
+        newend = iobuf_tell (newfp);
     }
 
     if( mode == 2 || mode == 3 ) { /* delete or update */
@@ -1718,6 +2866,8 @@ do_copy (int mode, const char *fname, KBNODE root,
 	    iobuf_cancel(newfp);
 	    goto leave;
 	}
+        if (iobuf_tell (newfp) - newend != iobuf_tell (fp) - oldend)
+          idx_ok = 0;
     }
 
     /* close both files */
@@ -1734,7 +2884,21 @@ do_copy (int mode, const char *fname, KBNODE root,
 
     rc = rename_tmp_file (bakfname, tmpfname, fname);
 
+    if (!rc && idx && idx_ok) {
+        if (mode == 2 || mode == 3) {
+            kr_index_shift (&idx->kids, start_offset, newend - oldend);
+            kr_index_shift (&idx->mails, start_offset, newend - oldend);
+        }
+        if ((mode == 1 || mode == 3) && kr_index_add_kb (idx, root, newoff))
+            idx_ok = 0;
+        if (idx_ok) {
+            kr_index_sort (idx);
+            kr_index_write (fname, idx);
+        }
+    }
+
   leave:
+    kr_index_release (idx);
     xfree(bakfname);
     xfree(tmpfname);
     return rc;
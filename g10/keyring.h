@@ -26,6 +26,7 @@ typedef struct keyring_handle *KEYRING_HANDLE;
 
 int keyring_register_filename (const char *fname, int read_only, void **ptr);
 int keyring_is_writable (void *token);
+void keyring_invalidate_file_caches (void);
 
 KEYRING_HANDLE keyring_new (void *token);
 void keyring_release (KEYRING_HANDLE hd);
@@ -1733,6 +1733,10 @@ keyserver_get_chunk (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, int ndesc,
                              keyserver_retrieval_screener, &screenerarg,
                              only_fprs? KEYORG_KS : 0,
                              source);
+      /* The keys are read while they are received; a failure of the
+         dirmngr after some keys is thus only visible here.  */
+      if (es_ferror (datastream))
+        err = gpg_error (GPG_ERR_EIO);
     }
   es_fclose (datastream);
   xfree (source);
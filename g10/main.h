@@ -199,6 +199,10 @@ unsigned int ecdsa_qbits_from_Q (unsigned int qbits);
 /*-- cpr.c --*/
 void set_status_fd ( int fd );
 int  is_status_enabled ( void );
+void write_status_flush (void);
+void status_capture_start (void);
+gpg_error_t status_capture_take (void **r_buffer, size_t *r_length);
+void write_status_captured (const void *buffer, size_t length);
 void write_status ( int no );
 void write_status_error (const char *where, gpg_error_t err);
 void write_status_errcode (const char *where, int errcode);
@@ -242,6 +246,7 @@ gpg_error_t encrypt_seskey (DEK *dek, aead_algo_t aead_algo, DEK **r_seskey,
 aead_algo_t use_aead (pk_list_t pk_list, int algo);
 int use_mdc (pk_list_t pk_list,int algo);
 int encrypt_symmetric (const char *filename );
+void encrypt_symmetric_files (ctrl_t ctrl, int nfiles, char **files);
 int encrypt_store (const char *filename );
 int encrypt_crypt (ctrl_t ctrl, int filefd, const char *filename,
                    strlist_t remusr, int use_symkey, pk_list_t provided_keys,
@@ -257,6 +262,8 @@ int write_pubkey_enc (ctrl_t ctrl, PKT_public_key *pk, int throw_keyid,
 /*-- sign.c --*/
 int sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 	       int do_encrypt, strlist_t remusr, const char *outfile );
+int sign_fd (ctrl_t ctrl, int filefd, int outputfd, int detached,
+             strlist_t locusr);
 int clearsign_file (ctrl_t ctrl,
                     const char *fname, strlist_t locusr, const char *outfile);
 int sign_symencrypt_file (ctrl_t ctrl, const char *fname, strlist_t locusr);
@@ -283,6 +290,9 @@ int check_key_signature (ctrl_t ctrl, kbnode_t root, kbnode_t sig,
 int check_key_signature2 (ctrl_t ctrl, kbnode_t root, kbnode_t node,
                           PKT_public_key *check_pk, PKT_public_key *ret_pk,
                           int *is_selfsig, u32 *r_expiredate, int *r_expired);
+/* Like check_key_signature but using a keyblock index.  */
+int check_key_signature_indexed (ctrl_t ctrl, kbnode_index_t kbidx,
+                                 kbnode_t node, PKT_public_key *ret_pk);
 
 /* Returns whether SIGNER generated the signature SIG over the packet
    PACKET, which is a key, subkey or uid, and comes from the key block
@@ -494,6 +504,13 @@ int decrypt_message (ctrl_t ctrl, const char *filename );
 gpg_error_t decrypt_message_fd (ctrl_t ctrl, int input_fd, int output_fd);
 void decrypt_messages (ctrl_t ctrl, int nfiles, char *files[]);
 
+/*-- multifile.c --*/
+typedef gpg_error_t (*multifile_cb_t) (ctrl_t ctrl, const char *fname,
+                                       void *opaque);
+gpg_error_t multifile_process (ctrl_t ctrl, int nfiles, char **files,
+                               multifile_cb_t cb, void *opaque,
+                               gpg_error_t *r_first_err);
+
 /*-- plaintext.c --*/
 int hash_datafiles( gcry_md_hd_t md, gcry_md_hd_t md2,
 		    strlist_t files, const char *sigfilename, int textmode);
@@ -2573,6 +2573,49 @@ check_sig_and_print (CTX c, kbnode_t node)
 }
 
 
+/* Look up the keys of all signers of the signatures starting at
+ * NODE at once.  */
+static void
+prefetch_signers (CTX c, kbnode_t node)
+{
+  u32 (*keyids)[2];
+  kbnode_t n1;
+  int i, n;
+
+  if (opt.skip_verify)
+    return;
+
+  for (n=0, n1 = node; n1; n1 = find_next_kbnode (n1, PKT_SIGNATURE))
+    if (n1->pkt->pkttype == PKT_SIGNATURE)
+      n++;
+  if (n < 2)
+    return;
+
+  keyids = xtrycalloc (n, sizeof *keyids);
+  if (!keyids)
+    return;
+  for (n=0, n1 = node; n1; n1 = find_next_kbnode (n1, PKT_SIGNATURE))
+    {
+      PKT_signature *sig = n1->pkt->pkt.signature;
+
+      if (n1->pkt->pkttype != PKT_SIGNATURE
+          || (!sig->keyid[0] && !sig->keyid[1]))
+        continue;
+      for (i=0; i < n; i++)
+        if (keyids[i][0] == sig->keyid[0] && keyids[i][1] == sig->keyid[1])
+          break;
+      if (i == n)
+        {
+          keyids[n][0] = sig->keyid[0];
+          keyids[n][1] = sig->keyid[1];
+          n++;
+        }
+    }
+  prefetch_pubkeys (c->ctrl, keyids, n);
+  xfree (keyids);
+}
+
+
 /*
  * Process the tree which starts at node
  */
@@ -2663,6 +2706,7 @@ proc_tree (CTX c, kbnode_t node)
           return;
         }
 
+      prefetch_signers (c, node);
       for (n1 = node; (n1 = find_next_kbnode (n1, PKT_SIGNATURE));)
         check_sig_and_print (c, n1);
 
@@ -2682,6 +2726,7 @@ proc_tree (CTX c, kbnode_t node)
           return;
         }
 
+      prefetch_signers (c, node);
       for (n1 = node; (n1 = find_next_kbnode (n1, PKT_SIGNATURE));)
         check_sig_and_print (c, n1);
 
@@ -2810,6 +2855,7 @@ proc_tree (CTX c, kbnode_t node)
 
       if (multiple_ok)
         {
+          prefetch_signers (c, node);
           for (n1 = node; n1; (n1 = find_next_kbnode(n1, PKT_SIGNATURE)))
 	    check_sig_and_print (c, n1);
         }
@@ -0,0 +1,339 @@
+/* multifile.c - Process the files of --multifile in worker processes
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* With --multifile-jobs the commands --encrypt-files, --decrypt-files
+ * and --verify-files fork worker processes to process the files.
+ * Worker K of N processes the files with the indices K, K+N, K+2N,
+ * ... and sends for each file a result record followed by the status
+ * lines it emitted for that file.  The parent reads the records in
+ * the order of the files and writes the status lines to the status
+ * stream.  Thus the status output is the same as without workers;
+ * only the log output of the workers is interleaved.
+ *
+ * Everything set up before the workers have been started, for
+ * example the list of recipient keys, is shared by all workers.  The
+ * workers can't interact with the user; thus this is only done in
+ * batch mode and without --command-fd.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+
+#include "gpg.h"
+#include "options.h"
+#include "../common/status.h"
+#include "../common/util.h"
+#include "../common/i18n.h"
+#include "keydb.h"
+#include "main.h"
+#include "tdbio.h"
+#include "call-agent.h"
+#include "worker.h"
+
+
+#ifndef HAVE_W32_SYSTEM
+
+#define MAX_MULTIFILE_JOBS 64
+
+/* Flags of a result record.  */
+#define MULTIFILE_ERRORS       1  /* log_error has been called.  */
+#define MULTIFILE_ERRORS_SEEN  2  /* g10_errors_seen has been set.  */
+
+/* The record sent by a worker for each file.  It is followed by
+ * LENGTH bytes of status lines.  */
+struct multifile_result_s
+{
+  u32 code;
+  u32 flags;
+  u32 length;
+};
+
+/* A worker process.  */
+struct multifile_worker_s
+{
+  struct worker_s proc;
+};
+
+/* The parameters for multifile_worker_main.  */
+struct multifile_worker_parm_s
+{
+  ctrl_t ctrl;
+  int nfiles;
+  char **files;
+  multifile_cb_t cb;
+  void *opaque;
+  int k;              /* This is worker K ...  */
+  int nworkers;       /* ... of NWORKERS.  */
+};
+
+
+/* The main function of worker K of NWORKERS.  */
+static void
+multifile_worker_main (void *opaque_parm, int in_fd, int out_fd)
+{
+  struct multifile_worker_parm_s *parm = opaque_parm;
+  ctrl_t ctrl = parm->ctrl;
+  struct multifile_result_s result;
+  void *buffer;
+  size_t length;
+  unsigned int errcount;
+  gpg_error_t err;
+  int i;
+
+  (void)in_fd;
+
+  /* We may not use the connections and the open files of our
+   * parent.  */
+  agent_prepare_worker ();
+  keydb_prepare_worker (ctrl);
+  tdbio_prepare_worker ();
+  ctrl->dirmngr_local = NULL;
+  ctrl->keyboxd_local = NULL;
+  ctrl->tofu.dbs = NULL;
+  status_capture_start ();
+
+  for (i=parm->k; i < parm->nfiles; i += parm->nworkers)
+    {
+      errcount = log_get_errorcount (0);
+      g10_errors_seen = 0;
+      err = parm->cb (ctrl, parm->files[i], parm->opaque);
+
+      result.code = err;
+      result.flags = 0;
+      if (log_get_errorcount (0) != errcount)
+        result.flags |= MULTIFILE_ERRORS;
+      if (g10_errors_seen)
+        result.flags |= MULTIFILE_ERRORS_SEEN;
+      if (status_capture_take (&buffer, &length))
+        break;
+      result.length = length;
+      err = worker_writen (out_fd, &result, sizeof result);
+      if (!err)
+        err = worker_writen (out_fd, buffer, length);
+      xfree (buffer);
+      if (err)
+        break;
+    }
+}
+
+
+/* Stop the NWORKERS processes in WORKERS.  */
+static void
+multifile_stop_workers (struct multifile_worker_s *workers, int nworkers)
+{
+  int i;
+
+  /* After an error a worker might still be busy.  */
+  for (i=0; i < nworkers; i++)
+    worker_stop (&workers[i].proc, 1);
+}
+
+
+/* Start NWORKERS worker processes for the NFILES FILES and store them
+ * at WORKERS.  */
+static gpg_error_t
+multifile_start_workers (ctrl_t ctrl, int nfiles, char **files,
+                         multifile_cb_t cb, void *opaque,
+                         struct multifile_worker_s *workers, int nworkers)
+{
+  struct multifile_worker_parm_s parm;
+  gpg_error_t err = 0;
+  int i;
+
+  for (i=0; i < nworkers; i++)
+    worker_init (&workers[i].proc);
+
+  /* Flush the status output so that it is not duplicated by the
+   * children.  */
+  write_status_flush ();
+
+  parm.ctrl = ctrl;
+  parm.nfiles = nfiles;
+  parm.files = files;
+  parm.cb = cb;
+  parm.opaque = opaque;
+  parm.nworkers = nworkers;
+  for (i=0; i < nworkers && !err; i++)
+    {
+      parm.k = i;
+      err = worker_start (&workers[i].proc, 0, multifile_worker_main, &parm);
+    }
+
+  if (err)
+    {
+      log_info ("error starting multifile worker: %s\n", gpg_strerror (err));
+      multifile_stop_workers (workers, nworkers);
+    }
+  return err;
+}
+
+
+/* Process the NFILES FILES with workers.  */
+static gpg_error_t
+process_parallel (ctrl_t ctrl, int nfiles, char **files,
+                  multifile_cb_t cb, void *opaque, gpg_error_t *r_first_err)
+{
+  struct multifile_worker_s workers[MAX_MULTIFILE_JOBS];
+  struct multifile_result_s result;
+  gpg_error_t err = 0;
+  char *buffer = NULL;
+  size_t buffersize = 0;
+  int nworkers, i;
+
+  nworkers = opt.multifile_jobs;
+  if (nworkers > MAX_MULTIFILE_JOBS)
+    nworkers = MAX_MULTIFILE_JOBS;
+  if (nworkers > nfiles)
+    nworkers = nfiles;
+  if (multifile_start_workers (ctrl, nfiles, files, cb, opaque,
+                               workers, nworkers))
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  if (opt.verbose)
+    log_info ("using %d processes to process the files\n", nworkers);
+
+  for (i=0; i < nfiles; i++)
+    {
+      struct multifile_worker_s *w = workers + (i % nworkers);
+
+      err = worker_readn (w->proc.from_fd, &result, sizeof result);
+      if (!err && result.length > buffersize)
+        {
+          xfree (buffer);
+          buffersize = result.length;
+          buffer = xmalloc (buffersize);
+        }
+      if (!err)
+        err = worker_readn (w->proc.from_fd, buffer, result.length);
+      if (err)
+        {
+          log_error ("error reading from multifile worker: %s\n",
+                     gpg_strerror (err));
+          break;
+        }
+
+      write_status_captured (buffer, result.length);
+      if ((result.flags & MULTIFILE_ERRORS))
+        log_inc_errorcount ();
+      if ((result.flags & MULTIFILE_ERRORS_SEEN))
+        g10_errors_seen = 1;
+      if (result.code && !*r_first_err)
+        *r_first_err = result.code;
+    }
+
+  xfree (buffer);
+  multifile_stop_workers (workers, nworkers);
+  return err;
+}
+
+#endif /*!HAVE_W32_SYSTEM*/
+
+
+/* Read the names of the files from stdin and store a NULL terminated
+ * array with them at R_FILES.  */
+static gpg_error_t
+read_file_names (char ***r_files, int *r_nfiles)
+{
+  char line[2048];
+  unsigned int lno = 0;
+  strlist_t list = NULL;
+  strlist_t sl;
+  char **files;
+  int nfiles, i;
+
+  *r_files = NULL;
+  *r_nfiles = 0;
+  while (fgets (line, DIM(line), stdin))
+    {
+      lno++;
+      if (!*line || line[strlen(line)-1] != '\n')
+        {
+          log_error (_("input line %u too long or missing LF\n"), lno);
+          free_strlist (list);
+          return gpg_error (GPG_ERR_GENERAL);
+        }
+      line[strlen(line)-1] = 0;
+      append_to_strlist (&list, line);
+    }
+
+  nfiles = strlist_length (list);
+  files = xcalloc (nfiles + 1, sizeof *files);
+  for (i=0, sl = list; sl; sl = sl->next, i++)
+    files[i] = xstrdup (sl->d);
+  free_strlist (list);
+
+  *r_files = files;
+  *r_nfiles = nfiles;
+  return 0;
+}
+
+
+/* Process the NFILES FILES or, if NFILES is 0, the files named on
+ * stdin by calling CB for each file.  CB is called with CTRL, the
+ * file name and OPAQUE and needs to emit the FILE_START and FILE_DONE
+ * status lines.  The files are processed by opt.multifile_jobs
+ * worker processes if possible.  The first error returned by CB is
+ * stored at R_FIRST_ERR.  An error is returned if not all files could
+ * be processed.  */
+gpg_error_t
+multifile_process (ctrl_t ctrl, int nfiles, char **files,
+                   multifile_cb_t cb, void *opaque, gpg_error_t *r_first_err)
+{
+  gpg_error_t err;
+  char **names = NULL;
+  int i;
+
+  *r_first_err = 0;
+  if (!nfiles)
+    {
+      err = read_file_names (&names, &nfiles);
+      if (err)
+        return err;
+      files = names;
+    }
+
+  err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+#ifndef HAVE_W32_SYSTEM
+  if (nfiles > 1 && opt.multifile_jobs > 1
+      && opt.batch && opt.command_fd == -1)
+    err = process_parallel (ctrl, nfiles, files, cb, opaque, r_first_err);
+#endif
+  if (gpg_err_code (err) == GPG_ERR_NOT_SUPPORTED)
+    {
+      err = 0;
+      for (i=0; i < nfiles; i++)
+        {
+          gpg_error_t rc = cb (ctrl, files[i], opaque);
+          if (rc && !*r_first_err)
+            *r_first_err = rc;
+        }
+    }
+
+  if (names)
+    {
+      for (i=0; i < nfiles; i++)
+        xfree (names[i]);
+      xfree (names);
+    }
+  return err;
+}
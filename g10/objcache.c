@@ -38,6 +38,9 @@
 #define NO_OF_KEY_ITEM_BUCKETS    383
 #define MAX_KEY_ITEMS_PER_BUCKET  20
 
+#define NO_OF_KB_REF_BUCKETS      383
+#define MAX_KB_ITEMS              256
+
 
 /* An object to store a user id.  This describes an item in the linked
  * lists of a bucket in hash table.  The reference count will
@@ -78,6 +81,37 @@ static unsigned int key_table_dropped;/* # of items dropped.  */
 static key_item_t key_item_attic;     /* List of freed items.  */
 
 
+/* An object to store a keyblock with the self-signatures already
+ * merged.  The items are kept in a list ordered by their last use
+ * and referenced by a kb_ref_s from the hash table for each key of
+ * the keyblock.  */
+typedef struct kb_item_s
+{
+  struct kb_item_s *prev;
+  struct kb_item_s *next;
+  kbnode_t keyblock;
+} *kb_item_t;
+
+/* An entry in the hash table for merged keyblocks.  ITEM is NULL if
+ * the keyid is used by more than one keyblock.  */
+typedef struct kb_ref_s
+{
+  struct kb_ref_s *next;
+  u32 keyid[2];
+  kb_item_t item;
+} *kb_ref_t;
+
+static kb_ref_t *kb_table;     /* Hash table with the keys.  */
+static size_t kb_table_size;   /* Number of allocated buckets.  */
+static kb_item_t kb_items;     /* Most recently used item.  */
+static kb_item_t kb_items_tail;/* Least recently used item.  */
+static unsigned int kb_items_count;   /* # of items.  */
+static unsigned int kb_items_added;   /* # of items added.  */
+static unsigned int kb_items_dropped; /* # of items dropped.  */
+static unsigned int kb_items_hits;    /* # of items returned.  */
+static int kb_cache_disabled;         /* The cache may not be used.  */
+
+
 
 /* Dump stats.  */
 void
@@ -143,6 +177,10 @@ objcache_dump_stats (void)
             count, uid_table_added, uid_table_dropped,
             empty, minlen > 0? minlen : 0, maxlen,
             uid_table_size, uid_table_max);
+
+  log_info ("objcache: keyblocks=%u/%u/%u hits=%u%s\n",
+            kb_items_count, kb_items_added, kb_items_dropped,
+            kb_items_hits, kb_cache_disabled? " (disabled)":"");
 }
 
 
@@ -687,3 +725,296 @@ cache_get_uid_byfpr (const byte *fpr, size_t fprlen, size_t *r_length)
 
   return p;
 }
+
+
+
+/* Return a deep copy of the public KEYBLOCK or NULL if it contains
+ * packets we do not expect in a merged keyblock.  */
+static kbnode_t
+copy_keyblock (kbnode_t keyblock)
+{
+  kbnode_t k, node, result = NULL, *tail = &result;
+  PACKET *pkt;
+
+  for (k = keyblock; k; k = k->next)
+    {
+      pkt = xmalloc_clear (sizeof *pkt);
+      pkt->pkttype = k->pkt->pkttype;
+      switch (pkt->pkttype)
+        {
+        case PKT_PUBLIC_KEY:
+        case PKT_PUBLIC_SUBKEY:
+          pkt->pkt.public_key = copy_public_key (NULL,
+                                                 k->pkt->pkt.public_key);
+          break;
+        case PKT_USER_ID:
+        case PKT_ATTRIBUTE:
+          pkt->pkt.user_id = copy_user_id (k->pkt->pkt.user_id);
+          break;
+        case PKT_SIGNATURE:
+          pkt->pkt.signature = copy_signature (NULL, k->pkt->pkt.signature);
+          break;
+        default:
+          xfree (pkt);
+          release_kbnode (result);
+          return NULL;
+        }
+      node = new_kbnode (pkt);
+      node->flag = k->flag;
+      node->private_flag = (k->private_flag & ~2);
+      *tail = node;
+      tail = &node->next;
+    }
+  return result;
+}
+
+
+/* The hash function we use for the kb_table.  */
+static inline unsigned int
+kb_table_hasher (u32 *keyid)
+{
+  return keyid[0] % kb_table_size;
+}
+
+
+/* Remove ITEM from the use list.  */
+static void
+kb_item_unlink (kb_item_t item)
+{
+  if (item->prev)
+    item->prev->next = item->next;
+  else
+    kb_items = item->next;
+  if (item->next)
+    item->next->prev = item->prev;
+  else
+    kb_items_tail = item->prev;
+  item->prev = item->next = NULL;
+}
+
+
+/* Put ITEM at the head of the use list.  */
+static void
+kb_item_push (kb_item_t item)
+{
+  item->prev = NULL;
+  item->next = kb_items;
+  if (kb_items)
+    kb_items->prev = item;
+  else
+    kb_items_tail = item;
+  kb_items = item;
+}
+
+
+/* Remove ITEM from the cache and release it.  */
+static void
+kb_item_drop (kb_item_t item)
+{
+  kbnode_t k;
+  kb_ref_t r, *rp;
+  u32 keyid[2];
+
+  for (k = item->keyblock; k; k = k->next)
+    {
+      if (k->pkt->pkttype != PKT_PUBLIC_KEY
+          && k->pkt->pkttype != PKT_PUBLIC_SUBKEY)
+        continue;
+      keyid_from_pk (k->pkt->pkt.public_key, keyid);
+      for (rp = &kb_table[kb_table_hasher (keyid)];
+           (r = *rp); rp = &r->next)
+        if (r->item == item)
+          {
+            *rp = r->next;
+            xfree (r);
+            break;
+          }
+    }
+  kb_item_unlink (item);
+  release_kbnode (item->keyblock);
+  xfree (item);
+  kb_items_count--;
+  kb_items_dropped++;
+}
+
+
+/* Return the hash table entry for KEYID or NULL.  */
+static kb_ref_t
+kb_table_get (u32 *keyid)
+{
+  kb_ref_t r;
+
+  if (!kb_table)
+    return NULL;
+  for (r = kb_table[kb_table_hasher (keyid)]; r; r = r->next)
+    if (r->keyid[0] == keyid[0] && r->keyid[1] == keyid[1])
+      return r;
+  return NULL;
+}
+
+
+/* Store a copy of the public KEYBLOCK which must already have been
+ * run through merge_selfsigs.  If one of its keyids is already in
+ * the cache, the keyblock is not stored; if the keyid belongs to
+ * another keyblock, that keyid is not cached anymore.  */
+void
+cache_put_pubkeyblock (kbnode_t keyblock)
+{
+  kbnode_t k;
+  kb_item_t item;
+  kb_ref_t r;
+  u32 keyid[2];
+  unsigned int hash;
+  int dup = 0;
+
+  if (kb_cache_disabled || keyblock->pkt->pkttype != PKT_PUBLIC_KEY)
+    return;
+  if (!kb_table)
+    {
+      kb_table_size = NO_OF_KB_REF_BUCKETS;
+      kb_table = xcalloc (kb_table_size, sizeof *kb_table);
+    }
+
+  for (k = keyblock; k; k = k->next)
+    {
+      if (k->pkt->pkttype != PKT_PUBLIC_KEY
+          && k->pkt->pkttype != PKT_PUBLIC_SUBKEY)
+        continue;
+      keyid_from_pk (k->pkt->pkt.public_key, keyid);
+      r = kb_table_get (keyid);
+      if (!r)
+        continue;
+      dup = 1;
+      if (r->item
+          && cmp_public_keys (r->item->keyblock->pkt->pkt.public_key,
+                              keyblock->pkt->pkt.public_key))
+        {
+          /* A different keyblock uses the same keyid.  We can't
+           * decide which one a lookup would find.  */
+          kb_item_drop (r->item);
+          r = xtrycalloc (1, sizeof *r);
+          if (!r)
+            return;
+          r->keyid[0] = keyid[0];
+          r->keyid[1] = keyid[1];
+          hash = kb_table_hasher (keyid);
+          r->next = kb_table[hash];
+          kb_table[hash] = r;
+        }
+    }
+  if (dup)
+    return;
+
+  item = xtrycalloc (1, sizeof *item);
+  if (!item)
+    return;
+  item->keyblock = copy_keyblock (keyblock);
+  if (!item->keyblock)
+    {
+      xfree (item);
+      return;
+    }
+  kb_item_push (item);
+  kb_items_count++;
+  kb_items_added++;
+
+  for (k = keyblock; k; k = k->next)
+    {
+      if (k->pkt->pkttype != PKT_PUBLIC_KEY
+          && k->pkt->pkttype != PKT_PUBLIC_SUBKEY)
+        continue;
+      keyid_from_pk (k->pkt->pkt.public_key, keyid);
+      r = xtrycalloc (1, sizeof *r);
+      if (!r)
+        {
+          kb_item_drop (item);
+          return;
+        }
+      r->keyid[0] = keyid[0];
+      r->keyid[1] = keyid[1];
+      r->item = item;
+      hash = kb_table_hasher (keyid);
+      r->next = kb_table[hash];
+      kb_table[hash] = r;
+    }
+
+  while (kb_items_count > MAX_KB_ITEMS)
+    kb_item_drop (kb_items_tail);
+}
+
+
+/* Return a copy of the cached keyblock which has a key with KEYID or
+ * NULL if there is none.  The caller must release the keyblock.  */
+kbnode_t
+cache_get_pubkeyblock (u32 *keyid)
+{
+  kb_ref_t r;
+  kbnode_t keyblock;
+
+  if (kb_cache_disabled)
+    return NULL;
+  r = kb_table_get (keyid);
+  if (!r || !r->item)
+    return NULL;
+
+  keyblock = copy_keyblock (r->item->keyblock);
+  if (keyblock)
+    {
+      kb_item_unlink (r->item);
+      kb_item_push (r->item);
+      kb_items_hits++;
+    }
+  return keyblock;
+}
+
+
+/* Remove all keyblocks from the cache.  This needs to be called
+ * whenever a keyblock is changed in the database.  If DISABLE is set
+ * the cache won't be used again.  */
+void
+cache_flush_pubkeyblocks (int disable)
+{
+  kb_ref_t r, r2;
+  size_t idx;
+
+  if (disable)
+    kb_cache_disabled = 1;
+  while (kb_items_tail)
+    kb_item_drop (kb_items_tail);
+  for (idx = 0; idx < kb_table_size; idx++)
+    {
+      /* Only the entries for ambiguous keyids are left.  */
+      for (r = kb_table[idx]; r; r = r2)
+        {
+          r2 = r->next;
+          xfree (r);
+        }
+      kb_table[idx] = NULL;
+    }
+}
+
+
+/* Remove the keyblock with UBID from the cache.  If UBID is NULL all
+ * keyblocks are removed but the cache is still used.  */
+void
+cache_drop_pubkeyblock (const byte *ubid)
+{
+  kb_item_t item, item2;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+
+  if (!ubid)
+    {
+      cache_flush_pubkeyblocks (0);
+      return;
+    }
+
+  for (item = kb_items; item; item = item2)
+    {
+      item2 = item->next;
+      fingerprint_from_pk (item->keyblock->pkt->pkt.public_key,
+                           fpr, &fprlen);
+      if (fprlen >= UBID_LEN && !memcmp (fpr, ubid, UBID_LEN))
+        kb_item_drop (item);
+    }
+}
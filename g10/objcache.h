@@ -25,5 +25,9 @@ void objcache_dump_stats (void);
 void cache_put_keyblock (kbnode_t keyblock);
 char *cache_get_uid_bykid (u32 *keyid, unsigned int *r_length);
 char *cache_get_uid_byfpr (const byte *fpr, size_t fprlen, size_t *r_length);
+void cache_put_pubkeyblock (kbnode_t keyblock);
+kbnode_t cache_get_pubkeyblock (u32 *keyid);
+void cache_flush_pubkeyblocks (int disable);
+void cache_drop_pubkeyblock (const byte *ubid);
 
 #endif /*GNUPG_G10_OBJCACHE_H*/
@@ -209,6 +209,15 @@ struct
   int try_all_secrets;
   int no_expensive_trust_checks;
   int no_sig_cache;
+  int persistent_sig_cache;
+  int trustdb_cache_size;  /* Max. # of records in the tdbio cache.  */
+  int rebuild_jobs;  /* Number of processes for --rebuild-keydb-caches. */
+  int encrypt_jobs;  /* Number of processes to encrypt the session key. */
+  int import_jobs;   /* Number of processes to check self-sigs on import. */
+  int export_jobs;   /* Number of processes to check sigs on export.  */
+  int sign_jobs;     /* Number of signatures to create concurrently.  */
+  int multifile_jobs; /* Number of processes for --multifile.  */
+  int pk_cache_size; /* Max. # of keys in the public key cache.  */
   int no_auto_check_trustdb;
   int preserve_permissions;
   int no_homedir_creation;
@@ -223,6 +232,9 @@ struct
   /* If true, let write failures on the status-fd exit the process. */
   int exit_on_status_write_error;
 
+  /* If true, do not flush the status-fd after each line.  */
+  int buffer_status_output;
+
   /* If > 0, limit the number of card insertion prompts to this
      value. */
   int limit_card_insert_tries;
@@ -317,6 +329,7 @@ struct {
 #define DBG_TRUST_VALUE   256	/* debug the trustdb */
 #define DBG_HASHING_VALUE 512	/* debug hashing operations */
 #define DBG_IPC_VALUE     1024  /* debug assuan communication */
+#define DBG_IOSTAT_VALUE  2048  /* show iobuf filter statistics */
 #define DBG_CLOCK_VALUE   4096
 #define DBG_LOOKUP_VALUE  8192	/* debug the key lookup */
 #define DBG_EXTPROG_VALUE 16384 /* debug external program calls */
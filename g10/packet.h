@@ -299,6 +299,10 @@ typedef struct
   byte *attrib_data;
   /* The length of ATTRIB_DATA.  */
   unsigned long attrib_len;
+  /* NULL or the reference counter of ATTRIB_DATA if it is shared with
+     copies made by copy_user_id.  Photo IDs may be large and are
+     never modified after parsing.  */
+  unsigned int *attrib_ref;
   byte *namehash;
   int help_key_usage;
   u32 help_key_expire;
@@ -346,6 +350,17 @@ struct revoke_info
 };
 
 
+/* The public key of a PKT_public_key as S-expression.  It is built
+ * on first use by pk_verify and shared by all copies made with
+ * copy_public_key.  */
+struct pk_sexp_s
+{
+  unsigned int ref;           /* Reference counter.  */
+  gcry_sexp_t s_pkey;         /* NULL or the key.  */
+  unsigned int is_ed25519:1;  /* Only valid if S_PKEY is set.  */
+};
+
+
 /* Information pertaining to secret keys. */
 struct seckey_info
 {
@@ -449,6 +464,8 @@ typedef struct
   /* If not NULL this malloced structure describes a secret key.
      (Serialized.)  */
   struct seckey_info *seckey_info;
+  /* NULL or the shared S-expression of the public parts of PKEY.  */
+  struct pk_sexp_s *sexp;
   /* The public key.  Contains pubkey_get_npkey (pubkey_algo) +
      pubkey_get_nskey (pubkey_algo) MPIs.  (If pubkey_get_npkey
      returns 0, then the algorithm is not understood and the PKEY
@@ -899,6 +916,7 @@ prefitem_t *copy_prefs (const prefitem_t *prefs);
 PKT_public_key *copy_public_key( PKT_public_key *d, PKT_public_key *s );
 PKT_signature *copy_signature( PKT_signature *d, PKT_signature *s );
 PKT_user_id *scopy_user_id (PKT_user_id *sd );
+PKT_user_id *copy_user_id (PKT_user_id *s);
 int cmp_public_keys( PKT_public_key *a, PKT_public_key *b );
 int cmp_signatures( PKT_signature *a, PKT_signature *b );
 int cmp_user_ids( PKT_user_id *a, PKT_user_id *b );
@@ -113,6 +113,42 @@ read_32 (IOBUF inp)
 }
 
 
+/* Read up to LENGTH bytes from INP into BUFFER and return the number
+ * of bytes read.  Fewer bytes are only returned at EOF.  Reading in
+ * blocks avoids the per byte overhead of iobuf_get; this matters for
+ * keyblocks which are already in memory.  */
+static size_t
+read_block (IOBUF inp, void *buffer, size_t length)
+{
+  byte *p = buffer;
+  size_t nread = 0;
+  int n;
+
+  while (nread < length)
+    {
+      n = iobuf_read (inp, p + nread,
+                      length - nread > 65536? 65536 : length - nread);
+      if (n == -1)
+        break;
+      nread += n;
+    }
+  return nread;
+}
+
+
+/* Read LENGTH bytes from INP into BUFFER.  Like a loop over
+ * iobuf_get_noeof any bytes missing due to EOF are set to 0xff.  */
+static void
+read_block_noeof (IOBUF inp, void *buffer, size_t length)
+{
+  size_t n;
+
+  n = read_block (inp, buffer, length);
+  if (n < length)
+    memset ((byte*)buffer + n, 0xff, length - n);
+}
+
+
 /* Read an external representation of an MPI and return the MPI.  The
    external format is a 16-bit unsigned value stored in network byte
    order giving the number of bits for the following integer.  The
@@ -128,9 +164,9 @@ read_32 (IOBUF inp)
 static gcry_mpi_t
 mpi_read (iobuf_t inp, unsigned int *ret_nread, int secure)
 {
-  int c, c1, c2, i;
+  int c, c1, c2;
   unsigned int nmax = *ret_nread;
-  unsigned int nbits, nbytes;
+  unsigned int nbits, nbytes, navail, n;
   size_t nread = 0;
   gcry_mpi_t a = NULL;
   byte *buf = NULL;
@@ -159,17 +195,14 @@ mpi_read (iobuf_t inp, unsigned int *ret_nread, int secure)
   p = buf;
   p[0] = c1;
   p[1] = c2;
-  for (i = 0; i < nbytes; i++)
+  navail = nmax - nread;
+  n = read_block (inp, p + 2, nbytes < navail? nbytes : navail);
+  nread += n;
+  if (n < nbytes)
     {
-      if (nread == nmax)
-	goto overflow;
-
-      c = iobuf_get (inp);
-      if (c == -1)
-	goto leave;
-
-      p[i + 2] = c;
-      nread ++;
+      if (n == navail)
+        goto overflow;
+      goto leave;
     }
 
   if (gcry_mpi_scan (&a, GCRYMPI_FMT_PGP, buf, nread, &nread))
@@ -202,9 +235,9 @@ mpi_read (iobuf_t inp, unsigned int *ret_nread, int secure)
 static gcry_mpi_t
 sos_read (iobuf_t inp, unsigned int *ret_nread, int secure)
 {
-  int c, c1, c2, i;
+  int c, c1, c2;
   unsigned int nmax = *ret_nread;
-  unsigned int nbits, nbytes;
+  unsigned int nbits, nbytes, navail, n;
   size_t nread = 0;
   gcry_mpi_t a = NULL;
   byte *buf = NULL;
@@ -231,17 +264,14 @@ sos_read (iobuf_t inp, unsigned int *ret_nread, int secure)
   nbytes = (nbits + 7) / 8;
   buf = secure ? gcry_xmalloc_secure (nbytes) : gcry_xmalloc (nbytes);
   p = buf;
-  for (i = 0; i < nbytes; i++)
+  navail = nmax - nread;
+  n = read_block (inp, p, nbytes < navail? nbytes : navail);
+  nread += n;
+  if (n < nbytes)
     {
-      if (nread == nmax)
+      if (n == navail)
         goto overflow;
-
-      c = iobuf_get (inp);
-      if (c == -1)
-        goto leave;
-
-      p[i] = c;
-      nread ++;
+      goto leave;
     }
 
   a = gcry_mpi_set_opaque (NULL, buf, nbits);
@@ -1077,8 +1107,7 @@ skip_packet (IOBUF inp, int pkttype, unsigned long pktlen, int partial)
 static void *
 read_rest (IOBUF inp, size_t pktlen)
 {
-  int c;
-  byte *buf, *p;
+  byte *buf;
 
   buf = xtrymalloc (pktlen);
   if (!buf)
@@ -1087,16 +1116,11 @@ read_rest (IOBUF inp, size_t pktlen)
       log_error ("error reading rest of packet: %s\n", gpg_strerror (err));
       return NULL;
     }
-  for (p = buf; pktlen; pktlen--)
+  if (read_block (inp, buf, pktlen) != pktlen)
     {
-      c = iobuf_get (inp);
-      if (c == -1)
-        {
-          log_error ("premature eof while reading rest of packet\n");
-          xfree (buf);
-          return NULL;
-        }
-      *p++ = c;
+      log_error ("premature eof while reading rest of packet\n");
+      xfree (buf);
+      return NULL;
     }
 
   return buf;
@@ -3065,9 +3089,8 @@ parse_user_id (IOBUF inp, int pkttype, unsigned long pktlen, PACKET * packet)
   packet->pkt.user_id->ref = 1;
 
   p = packet->pkt.user_id->name;
-  for (; pktlen; pktlen--, p++)
-    *p = iobuf_get_noeof (inp);
-  *p = 0;
+  read_block_noeof (inp, p, pktlen);
+  p[pktlen] = 0;
 
   if (list_mode)
     {
@@ -3125,8 +3148,6 @@ static int
 parse_attribute (IOBUF inp, int pkttype, unsigned long pktlen,
 		 PACKET * packet)
 {
-  byte *p;
-
   (void) pkttype;
 
   /* We better cap the size of an attribute packet to make DoS not too
@@ -3148,9 +3169,7 @@ parse_attribute (IOBUF inp, int pkttype, unsigned long pktlen,
   packet->pkt.user_id->attrib_data = xmalloc (pktlen? pktlen:1);
   packet->pkt.user_id->attrib_len = pktlen;
 
-  p = packet->pkt.user_id->attrib_data;
-  for (; pktlen; pktlen--, p++)
-    *p = iobuf_get_noeof (inp);
+  read_block_noeof (inp, packet->pkt.user_id->attrib_data, pktlen);
 
   /* Now parse out the individual attribute subpackets.  This is
      somewhat pointless since there is only one currently defined
@@ -3187,9 +3206,7 @@ parse_comment (IOBUF inp, int pkttype, unsigned long pktlen, PACKET * packet)
     }
   packet->pkt.comment = xmalloc (sizeof *packet->pkt.comment + pktlen - 1);
   packet->pkt.comment->len = pktlen;
-  p = packet->pkt.comment->data;
-  for (; pktlen; pktlen--, p++)
-    *p = iobuf_get_noeof (inp);
+  read_block_noeof (inp, packet->pkt.comment->data, pktlen);
 
   if (list_mode)
     {
@@ -1039,6 +1039,14 @@ build_pk_list (ctrl_t ctrl, strlist_t rcpts, PK_LIST *ret_pk_list)
      select the best key.  If a key specification is ambiguous and we
      are in batch mode, die.  */
 
+#ifdef USE_TOFU
+  /* Looking up the validity of a key in the TOFU model and
+   * registering the encryption both write to the TOFU DB.  Doing
+   * this in one transaction instead of one for each recipient is
+   * much faster for a long list of recipients.  */
+  tofu_begin_batch_update (ctrl);
+#endif
+
   if (opt.encrypt_to_default_key)
     {
       static int warned;
@@ -1415,6 +1423,9 @@ build_pk_list (ctrl_t ctrl, strlist_t rcpts, PK_LIST *ret_pk_list)
 #endif /*USE_TOFU*/
 
  fail:
+#ifdef USE_TOFU
+  tofu_end_batch_update (ctrl);
+#endif
 
   if ( rc )
     release_pk_list( pk_list );
@@ -121,18 +121,15 @@ get_data_from_sexp (gcry_sexp_t sexp, const char *item, size_t *r_size)
 }
 
 
-/****************
- * Emulate our old PK interface here - sometime in the future we might
- * change the internal design to directly fit to libgcrypt.
- */
-int
-pk_verify (pubkey_algo_t pkalgo, gcry_mpi_t hash,
-           gcry_mpi_t *data, gcry_mpi_t *pkey)
+/* Make a sexp from the public key parameters PKEY of algorithm
+ * PKALGO and store it at R_S_PKEY.  */
+static gpg_error_t
+build_pk_sexp (pubkey_algo_t pkalgo, gcry_mpi_t *pkey, gcry_sexp_t *r_s_pkey)
 {
-  gcry_sexp_t s_sig, s_hash, s_pkey;
+  gcry_sexp_t s_pkey;
   int rc;
 
-  /* Make a sexp from pkey.  */
+  *r_s_pkey = NULL;
   if (pkalgo == PUBKEY_ALGO_DSA)
     {
       rc = gcry_sexp_build (&s_pkey, NULL,
@@ -187,12 +184,57 @@ pk_verify (pubkey_algo_t pkalgo, gcry_mpi_t hash,
   if (rc)
     BUG ();  /* gcry_sexp_build should never fail.  */
 
+  *r_s_pkey = s_pkey;
+  return 0;
+}
+
+
+/****************
+ * Emulate our old PK interface here - sometime in the future we might
+ * change the internal design to directly fit to libgcrypt.
+ *
+ * The S-expression of the key and the curve check are cached in PK
+ * because the same keys are often used for many verifications.
+ */
+int
+pk_verify (PKT_public_key *pk, gcry_mpi_t hash, gcry_mpi_t *data)
+{
+  pubkey_algo_t pkalgo = pk->pubkey_algo;
+  gcry_mpi_t *pkey = pk->pkey;
+  gcry_sexp_t s_sig, s_hash, s_pkey;
+  gcry_sexp_t s_pkey_tmp = NULL;
+  int is_ed25519;
+  int rc;
+
+  if (!pk->sexp && (pk->sexp = xtrycalloc (1, sizeof *pk->sexp)))
+    pk->sexp->ref = 1;
+  if (pk->sexp && pk->sexp->s_pkey)
+    {
+      s_pkey = pk->sexp->s_pkey;
+      is_ed25519 = pk->sexp->is_ed25519;
+    }
+  else
+    {
+      rc = build_pk_sexp (pkalgo, pkey, &s_pkey);
+      if (rc)
+        return rc;
+      is_ed25519 = (pkalgo == PUBKEY_ALGO_EDDSA
+                    && openpgp_oid_is_ed25519 (pkey[0]));
+      if (pk->sexp)
+        {
+          pk->sexp->s_pkey = s_pkey;
+          pk->sexp->is_ed25519 = is_ed25519;
+        }
+      else
+        s_pkey_tmp = s_pkey;
+    }
+
   /* Put hash into a S-Exp s_hash. */
   if (pkalgo == PUBKEY_ALGO_EDDSA)
     {
       const char *fmt;
 
-      if (openpgp_oid_is_ed25519 (pkey[0]))
+      if (is_ed25519)
         fmt = "(data(flags eddsa)(hash-algo sha512)(value %m))";
       else
         fmt = "(data(value %m))";
@@ -229,7 +271,7 @@ pk_verify (pubkey_algo_t pkalgo, gcry_mpi_t hash,
       gcry_mpi_t r = data[0];
       gcry_mpi_t s = data[1];
 
-      if (openpgp_oid_is_ed25519 (pkey[0]))
+      if (is_ed25519)
         {
           size_t rlen, slen, n;  /* (bytes) */
           char buf[64];
@@ -333,7 +375,7 @@ pk_verify (pubkey_algo_t pkalgo, gcry_mpi_t hash,
 
   gcry_sexp_release (s_sig);
   gcry_sexp_release (s_hash);
-  gcry_sexp_release (s_pkey);
+  gcry_sexp_release (s_pkey_tmp);
   return rc;
 }
 
@@ -39,6 +39,10 @@
 #include "../common/i18n.h"
 
 
+/* The size of the blocks read for hashing a detached data file.  */
+#define HASH_BUFSIZE (64*1024)
+
+
 /* Get the output filename.  On success, the actual filename that is
    used is set in *FNAMEP and a filepointer is returned in *FP.
 
@@ -545,51 +549,85 @@ handle_plaintext (PKT_plaintext * pt, md_filter_context_t * mfx,
 }
 
 
+/* Hash the N bytes at BUF into MD the way PGP 2 does it in text mode:
+ * A single LF or CR is converted to CR,LF.  LC is the last character
+ * of the previous block or -1.  */
+static void
+hash_pgp2_block (gcry_md_hd_t md, const byte *buf, size_t n, int *lc)
+{
+  size_t i, start;
+  int c;
+
+  /* work around a strange behaviour in pgp2 */
+  /* It seems that at least PGP5 converts a single CR to a CR,LF too */
+  for (i=start=0; i < n; i++)
+    {
+      c = buf[i];
+      if ((c == '\n' && *lc != '\r') || (c != '\n' && *lc == '\r'))
+        {
+          if (i > start)
+            gcry_md_write (md, buf + start, i - start);
+          gcry_md_putc (md, c == '\n'? '\r' : '\n');
+          start = i;
+        }
+      *lc = c;
+    }
+  if (n > start)
+    gcry_md_write (md, buf + start, n - start);
+}
+
+
+/* Hash the data from FP into MD and MD2.  */
 static void
 do_hash (gcry_md_hd_t md, gcry_md_hd_t md2, IOBUF fp, int textmode)
 {
   text_filter_context_t tfx;
-  int c;
+  struct iobuf_mmap_view_s view;
+  byte *buffer;
+  int n;
+  int lc = -1;
 
   if (textmode)
     {
       memset (&tfx, 0, sizeof tfx);
       iobuf_push_filter (fp, text_filter, &tfx);
     }
-  if (md2)
-    {				/* work around a strange behaviour in pgp2 */
-      /* It seems that at least PGP5 converts a single CR to a CR,LF too */
-      int lc = -1;
-      while ((c = iobuf_get (fp)) != -1)
-	{
-	  if (c == '\n' && lc == '\r')
-	    gcry_md_putc (md2, c);
-	  else if (c == '\n')
-	    {
-	      gcry_md_putc (md2, '\r');
-	      gcry_md_putc (md2, c);
-	    }
-	  else if (c != '\n' && lc == '\r')
-	    {
-	      gcry_md_putc (md2, '\n');
-	      gcry_md_putc (md2, c);
-	    }
-	  else
-	    gcry_md_putc (md2, c);
 
-	  if (md)
-	    gcry_md_putc (md, c);
-	  lc = c;
-	}
+  /* In binary mode a plain file can be hashed directly from the
+   * memory mapped file.  If that is not possible (e.g. for pipes or
+   * with a text or progress filter), we read the file in large
+   * blocks.  Note that MD may have several algorithms enabled; they
+   * are all computed in the same pass.  gcry_md_write runs each
+   * algorithm over the entire buffer before starting the next one,
+   * so the mapped file is fed in blocks: all algorithms then get the
+   * data while it is still in the CPU cache.  */
+  if (!textmode && !iobuf_ioctl (fp, IOBUF_IOCTL_MMAP_VIEW, 0, &view))
+    {
+      const byte *p = view.buf;
+      size_t len = view.len;
+
+      while (len)
+        {
+          n = len > HASH_BUFSIZE? HASH_BUFSIZE : len;
+          if (md)
+            gcry_md_write (md, p, n);
+          if (md2)
+            hash_pgp2_block (md2, p, n, &lc);
+          p += n;
+          len -= n;
+        }
+      return;
     }
-  else
+
+  buffer = xmalloc (HASH_BUFSIZE);
+  while ((n = iobuf_read (fp, buffer, HASH_BUFSIZE)) != -1)
     {
-      while ((c = iobuf_get (fp)) != -1)
-	{
-	  if (md)
-	    gcry_md_putc (md, c);
-	}
+      if (md)
+        gcry_md_write (md, buffer, n);
+      if (md2)
+        hash_pgp2_block (md2, buffer, n, &lc);
     }
+  xfree (buffer);
 }
 
 
@@ -36,10 +36,22 @@
 #include "call-agent.h"
 #include "../common/host2net.h"
 #include "../common/compliance.h"
+#include "../common/membuf.h"
 
 
 static gpg_error_t get_it (ctrl_t ctrl, struct pubkey_enc_list *k,
                            DEK *dek, PKT_public_key *sk, u32 *keyid);
+static gpg_error_t make_ciphertext (struct pubkey_enc_list *enc,
+                                    gcry_sexp_t *r_sexp);
+static gpg_error_t decode_session_key (ctrl_t ctrl,
+                                       struct pubkey_enc_list *enc, DEK *dek,
+                                       PKT_public_key *sk, u32 *keyid,
+                                       byte *frame, size_t nframe,
+                                       int padding);
+
+/* The maximum number of secret keys tried with one agent request for
+ * an anonymous recipient.  */
+#define MAX_MULTI_KEYS 256
 
 
 /* Check that the given algo is mentioned in one of the valid user-ids. */
@@ -67,6 +79,173 @@ is_algo_in_prefs (kbnode_t keyblock, preftype_t type, int algo)
 }
 
 
+/* Return true if the algorithm of ENC can be handled.  */
+static int
+supported_enc_algo (struct pubkey_enc_list *enc)
+{
+  if (!(enc->pubkey_algo == PUBKEY_ALGO_ELGAMAL_E
+        || enc->pubkey_algo == PUBKEY_ALGO_ECDH
+        || enc->pubkey_algo == PUBKEY_ALGO_RSA
+        || enc->pubkey_algo == PUBKEY_ALGO_RSA_E
+        || enc->pubkey_algo == PUBKEY_ALGO_ELGAMAL))
+    return 0;
+
+  return !openpgp_pk_test_algo2 (enc->pubkey_algo, PUBKEY_USAGE_ENC);
+}
+
+
+/* Build the space delimited list of the keygrips in GRIPS of those
+ * of the NSKS keys in SKS which have the algorithm ALGO and are not
+ * in TRIED.  Returns NULL if there is no such key.  */
+static char *
+build_keygrip_list (PKT_public_key **sks, char **grips, int nsks, int algo,
+                    strlist_t tried)
+{
+  membuf_t mb;
+  int i, any = 0;
+
+  init_membuf (&mb, 41 * 8);
+  for (i=0; i < nsks; i++)
+    if (sks[i]->pubkey_algo == algo && !strlist_find (tried, grips[i]))
+      {
+        if (any++)
+          put_membuf (&mb, " ", 1);
+        put_membuf_str (&mb, grips[i]);
+      }
+  put_membuf (&mb, "", 1);
+  if (!any)
+    {
+      xfree (get_membuf (&mb, NULL));
+      return NULL;
+    }
+  return get_membuf (&mb, NULL);
+}
+
+
+/* Try the secret keys for the anonymous recipients in LIST with one
+ * agent request per recipient.  The agent only tries keys it can use
+ * without a pinentry and returns the first session key it was able
+ * to decrypt.  If that is not the right one we ask again with the
+ * remaining keys.  The keygrips of all keys we have checked are
+ * added to TRIED so that the caller does not try them again.  On
+ * success the session key is stored at DEK.  */
+static gpg_error_t
+try_anonymous_recipients (ctrl_t ctrl, struct pubkey_enc_list *list,
+                          DEK *dek, strlist_t *tried)
+{
+  gpg_error_t err;
+  void *enum_context = NULL;
+  PKT_public_key *sks[MAX_MULTI_KEYS];
+  char *grips[MAX_MULTI_KEYS];
+  int nsks = 0;
+  PKT_public_key *sk;
+  struct pubkey_enc_list *k;
+  char *keygrips = NULL;
+  char usedgrip[41];
+  gcry_sexp_t s_data;
+  byte *frame;
+  size_t nframe;
+  int padding;
+  u32 keyid[2];
+  int i;
+
+  for (k = list; k; k = k->next)
+    if (!k->keyid[0] && !k->keyid[1] && supported_enc_algo (k))
+      break;
+  if (!k)
+    return gpg_error (GPG_ERR_NO_SECKEY);
+
+  /* Collect the candidate keys.  */
+  while (nsks < MAX_MULTI_KEYS)
+    {
+      sk = xmalloc_clear (sizeof *sk);
+      err = enum_secret_keys (ctrl, &enum_context, sk);
+      if (err)
+        {
+          xfree (sk);
+          break;
+        }
+      if (!gnupg_pk_is_allowed (opt.compliance, PK_USE_DECRYPTION,
+                                sk->pubkey_algo, 0,
+                                sk->pkey, nbits_from_pk (sk), NULL)
+          || hexkeygrip_from_pk (sk, &grips[nsks]))
+        {
+          free_public_key (sk);
+          continue;
+        }
+      sks[nsks++] = sk;
+    }
+  enum_secret_keys (ctrl, &enum_context, NULL);  /* free context */
+
+  err = gpg_error (GPG_ERR_NO_SECKEY);
+  for (k = list; k; k = k->next)
+    {
+      if (k->keyid[0] || k->keyid[1] || !supported_enc_algo (k))
+        continue;
+
+      for (;;)
+        {
+          xfree (keygrips);
+          keygrips = build_keygrip_list (sks, grips, nsks, k->pubkey_algo,
+                                         *tried);
+          if (!keygrips)
+            break;
+
+          err = make_ciphertext (k, &s_data);
+          if (err)
+            goto leave;
+          err = agent_pkdecrypt_multi (ctrl, keygrips, s_data,
+                                       &frame, &nframe, &padding, usedgrip);
+          gcry_sexp_release (s_data);
+          if (gpg_err_code (err) == GPG_ERR_NO_SECKEY)
+            break;  /* None of the keys was usable; try the next one.  */
+          if (err)
+            goto leave;  /* E.g. an old agent.  */
+
+          for (i=0; i < nsks; i++)
+            if (!strcmp (grips[i], usedgrip))
+              break;
+          if (i == nsks)
+            {
+              xfree (frame);
+              err = gpg_error (GPG_ERR_INV_RESPONSE);
+              goto leave;
+            }
+          add_to_strlist (tried, usedgrip);
+
+          keyid_from_pk (sks[i], keyid);
+          if (!opt.quiet)
+            log_info (_("anonymous recipient; trying secret key %s ...\n"),
+                      keystr (keyid));
+          err = decode_session_key (ctrl, k, dek, sks[i], keyid,
+                                    frame, nframe, padding);
+          k->result = err;
+          if (!err)
+            {
+              if (!opt.quiet)
+                {
+                  log_info (_("okay, we are the anonymous recipient.\n"));
+                  if (!(sks[i]->pubkey_usage & PUBKEY_USAGE_ENC))
+                    log_info (_("used key is not marked for encryption use.\n")
+                              );
+                }
+              goto leave;
+            }
+        }
+      err = gpg_error (GPG_ERR_NO_SECKEY);
+    }
+
+ leave:
+  xfree (keygrips);
+  for (i=0; i < nsks; i++)
+    {
+      free_public_key (sks[i]);
+      xfree (grips[i]);
+    }
+  return err;
+}
+
+
 /*
  * Get the session key from a pubkey enc packet and return it in DEK,
  * which should have been allocated in secure memory by the caller.
@@ -80,10 +259,21 @@ get_session_key (ctrl_t ctrl, struct pubkey_enc_list *list, DEK *dek)
   u32 keyid[2];
   int search_for_secret_keys = 1;
   struct pubkey_enc_list *k;
+  strlist_t tried = NULL;
+  char *keygrip;
 
   if (DBG_CLOCK)
     log_clock ("get_session_key enter");
 
+  /* For anonymous recipients first let the agent try all keys which
+   * it can use without a pinentry in one go.  */
+  if (!opt.skip_hidden_recipients
+      && !try_anonymous_recipients (ctrl, list, dek, &tried))
+    {
+      err = 0;
+      goto leave;
+    }
+
   while (search_for_secret_keys)
     {
       sk = xmalloc_clear (sizeof *sk);
@@ -115,14 +305,7 @@ get_session_key (ctrl_t ctrl, struct pubkey_enc_list *list, DEK *dek)
        */
       for (k = list; k; k = k->next)
         {
-          if (!(k->pubkey_algo == PUBKEY_ALGO_ELGAMAL_E
-                || k->pubkey_algo == PUBKEY_ALGO_ECDH
-                || k->pubkey_algo == PUBKEY_ALGO_RSA
-                || k->pubkey_algo == PUBKEY_ALGO_RSA_E
-                || k->pubkey_algo == PUBKEY_ALGO_ELGAMAL))
-            continue;
-
-          if (openpgp_pk_test_algo2 (k->pubkey_algo, PUBKEY_USAGE_ENC))
+          if (!supported_enc_algo (k))
             continue;
 
           if (sk->pubkey_algo != k->pubkey_algo)
@@ -135,6 +318,16 @@ get_session_key (ctrl_t ctrl, struct pubkey_enc_list *list, DEK *dek)
               if (opt.skip_hidden_recipients)
                 continue;
 
+              /* Skip keys already checked by try_anonymous_recipients.  */
+              if (tried && !hexkeygrip_from_pk (sk, &keygrip))
+                {
+                  int skip = !!strlist_find (tried, keygrip);
+
+                  xfree (keygrip);
+                  if (skip)
+                    continue;
+                }
+
               if (!opt.quiet)
                 log_info (_("anonymous recipient; trying secret key %s ...\n"),
                           keystr (keyid));
@@ -181,73 +374,82 @@ get_session_key (ctrl_t ctrl, struct pubkey_enc_list *list, DEK *dek)
           err = k->result;
     }
 
+ leave:
+  free_strlist (tried);
   if (DBG_CLOCK)
     log_clock ("get_session_key leave");
   return err;
 }
 
 
+/* Convert the encrypted session key of ENC to an S-expression and
+ * store it at R_SEXP.  */
 static gpg_error_t
-get_it (ctrl_t ctrl,
-        struct pubkey_enc_list *enc, DEK *dek, PKT_public_key *sk, u32 *keyid)
+make_ciphertext (struct pubkey_enc_list *enc, gcry_sexp_t *r_sexp)
 {
   gpg_error_t err;
-  byte *frame = NULL;
-  unsigned int n;
-  size_t nframe;
-  u16 csum, csum2;
-  int padding;
-  gcry_sexp_t s_data;
-  char *desc;
-  char *keygrip;
-  byte fp[MAX_FINGERPRINT_LEN];
-  size_t fpn;
-
-  if (DBG_CLOCK)
-    log_clock ("decryption start");
-
-  /* Get the keygrip.  */
-  err = hexkeygrip_from_pk (sk, &keygrip);
-  if (err)
-    goto leave;
 
-  /* Convert the data to an S-expression.  */
-  if (sk->pubkey_algo == PUBKEY_ALGO_ELGAMAL
-      || sk->pubkey_algo == PUBKEY_ALGO_ELGAMAL_E)
+  *r_sexp = NULL;
+  if (enc->pubkey_algo == PUBKEY_ALGO_ELGAMAL
+      || enc->pubkey_algo == PUBKEY_ALGO_ELGAMAL_E)
     {
       if (!enc->data[0] || !enc->data[1])
         err = gpg_error (GPG_ERR_BAD_MPI);
       else
-        err = gcry_sexp_build (&s_data, NULL, "(enc-val(elg(a%m)(b%m)))",
+        err = gcry_sexp_build (r_sexp, NULL, "(enc-val(elg(a%m)(b%m)))",
                                enc->data[0], enc->data[1]);
     }
-  else if (sk->pubkey_algo == PUBKEY_ALGO_RSA
-           || sk->pubkey_algo == PUBKEY_ALGO_RSA_E)
+  else if (enc->pubkey_algo == PUBKEY_ALGO_RSA
+           || enc->pubkey_algo == PUBKEY_ALGO_RSA_E)
     {
       if (!enc->data[0])
         err = gpg_error (GPG_ERR_BAD_MPI);
       else
-        err = gcry_sexp_build (&s_data, NULL, "(enc-val(rsa(a%m)))",
+        err = gcry_sexp_build (r_sexp, NULL, "(enc-val(rsa(a%m)))",
                                enc->data[0]);
     }
-  else if (sk->pubkey_algo == PUBKEY_ALGO_ECDH)
+  else if (enc->pubkey_algo == PUBKEY_ALGO_ECDH)
     {
       if (!enc->data[0] || !enc->data[1])
         err = gpg_error (GPG_ERR_BAD_MPI);
       else
-        err = gcry_sexp_build (&s_data, NULL, "(enc-val(ecdh(s%m)(e%m)))",
+        err = gcry_sexp_build (r_sexp, NULL, "(enc-val(ecdh(s%m)(e%m)))",
                                enc->data[1], enc->data[0]);
     }
   else
     err = gpg_error (GPG_ERR_BUG);
 
+  return err;
+}
+
+
+static gpg_error_t
+get_it (ctrl_t ctrl,
+        struct pubkey_enc_list *enc, DEK *dek, PKT_public_key *sk, u32 *keyid)
+{
+  gpg_error_t err;
+  byte *frame = NULL;
+  size_t nframe;
+  int padding;
+  gcry_sexp_t s_data;
+  char *desc;
+  char *keygrip;
+
+  if (DBG_CLOCK)
+    log_clock ("decryption start");
+
+  /* Get the keygrip.  */
+  err = hexkeygrip_from_pk (sk, &keygrip);
   if (err)
-    goto leave;
+    return err;
 
-  if (sk->pubkey_algo == PUBKEY_ALGO_ECDH)
+  /* Convert the data to an S-expression.  Note that the caller has
+   * made sure that the algorithms of ENC and SK match.  */
+  err = make_ciphertext (enc, &s_data);
+  if (err)
     {
-      fingerprint_from_pk (sk, fp, &fpn);
-      log_assert (fpn == 20);
+      xfree (keygrip);
+      return err;
     }
 
   /* Decrypt. */
@@ -256,9 +458,36 @@ get_it (ctrl_t ctrl,
                          desc, sk->keyid, sk->main_keyid, sk->pubkey_algo,
                          s_data, &frame, &nframe, &padding);
   xfree (desc);
+  xfree (keygrip);
   gcry_sexp_release (s_data);
   if (err)
-    goto leave;
+    return err;
+
+  return decode_session_key (ctrl, enc, dek, sk, keyid,
+                             frame, nframe, padding);
+}
+
+
+/* Get the session key for ENC from the FRAME of length NFRAME as
+ * returned by the agent for the secret key SK with KEYID and store it
+ * at DEK.  PADDING is the padding information from the agent.  FRAME
+ * is released by this function.  */
+static gpg_error_t
+decode_session_key (ctrl_t ctrl, struct pubkey_enc_list *enc, DEK *dek,
+                    PKT_public_key *sk, u32 *keyid,
+                    byte *frame, size_t nframe, int padding)
+{
+  gpg_error_t err = 0;
+  unsigned int n;
+  u16 csum, csum2;
+  byte fp[MAX_FINGERPRINT_LEN];
+  size_t fpn;
+
+  if (sk->pubkey_algo == PUBKEY_ALGO_ECDH)
+    {
+      fingerprint_from_pk (sk, fp, &fpn);
+      log_assert (fpn == 20);
+    }
 
   /* Now get the DEK (data encryption key) from the frame
    *
@@ -469,7 +698,6 @@ get_it (ctrl_t ctrl,
 
  leave:
   xfree (frame);
-  xfree (keygrip);
   return err;
 }
 
@@ -51,6 +51,9 @@ struct server_local_s
   /* List of prepared recipients.  */
   pk_list_t recplist;
 
+  /* List of signers as given to SIGNER.  */
+  strlist_t signerlist;
+
   /* Set if pinentry notifications should be passed back to the
      client. */
   int allow_pinentry_notify;
@@ -126,6 +129,8 @@ reset_notify (assuan_context_t ctx, char *line)
 
   release_pk_list (ctrl->server_local->recplist);
   ctrl->server_local->recplist = NULL;
+  free_strlist (ctrl->server_local->signerlist);
+  ctrl->server_local->signerlist = NULL;
 
   close_message_fd (ctrl);
   assuan_close_input_fd (ctx);
@@ -234,9 +239,30 @@ cmd_recipient (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_signer (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
-  (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  strlist_t sl = NULL;
+  SK_LIST sk_list = NULL;
+
+  line = skip_options (line);
+  if (!*line)
+    return set_error (GPG_ERR_ASS_PARAMETER, "no user id given");
+
+  /* Check the key now so that an unusable key is reported right
+   * here.  The list is built again by the SIGN command.  */
+  add_to_strlist (&sl, line);
+  err = build_sk_list (ctrl, sl, &sk_list, PUBKEY_USAGE_SIG);
+  release_sk_list (sk_list);
+  if (err)
+    {
+      free_strlist (sl);
+      log_error ("command '%s' failed: %s\n", "SIGNER", gpg_strerror (err));
+      return err;
+    }
+
+  sl->next = ctrl->server_local->signerlist;
+  ctrl->server_local->signerlist = sl;
+  return 0;
 }
 
 
@@ -378,9 +404,6 @@ cmd_verify (assuan_context_t ctx, char *line)
   gnupg_fd_t out_fd = assuan_get_output_fd (ctx);
   estream_t out_fp = NULL;
 
-  /* FIXME: Revamp this code it is nearly to 3 years old and was only
-     intended as a quick test.  */
-
   (void)line;
 
   if (fd == GNUPG_INVALID_FD)
@@ -402,9 +425,6 @@ cmd_verify (assuan_context_t ctx, char *line)
         return set_error (gpg_err_code_from_syserror (), "fdopen() failed");
     }
 
-  log_debug ("WARNING: The server mode is WORK "
-             "IN PROGRESS and not ready for use\n");
-
   rc = gpg_verify (ctrl, fd, ctrl->server_local->message_fd, out_fp);
 
   es_fclose (out_fp);
@@ -428,13 +448,42 @@ cmd_verify (assuan_context_t ctx, char *line)
 static gpg_error_t
 cmd_sign (assuan_context_t ctx, char *line)
 {
-  (void)ctx;
-  (void)line;
-  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err;
+  int detached;
+  int inp_fd, out_fd;
+
+  detached = has_option (line, "--detached");
+
+  inp_fd = translate_sys2libc_fd (assuan_get_input_fd (ctx), 0);
+  if (inp_fd == -1)
+    {
+      err = set_error (GPG_ERR_ASS_NO_INPUT, NULL);
+      goto leave;
+    }
+  out_fd = translate_sys2libc_fd (assuan_get_output_fd (ctx), 1);
+  if (out_fd == -1)
+    {
+      err = set_error (GPG_ERR_ASS_NO_OUTPUT, NULL);
+      goto leave;
+    }
+
+  err = sign_fd (ctrl, inp_fd, out_fd, detached,
+                 ctrl->server_local->signerlist);
+
+ leave:
+  /* Close and reset the fds. */
+  close_message_fd (ctrl);
+  assuan_close_input_fd (ctx);
+  assuan_close_output_fd (ctx);
+
+  if (err)
+    log_error ("command '%s' failed: %s\n", "SIGN", gpg_strerror (err));
+  return err;
 }
 
 
-
+
 /*  IMPORT
 
   Import keys as read from the input-fd, return status message for
@@ -753,6 +802,7 @@ gpg_server (ctrl_t ctrl)
   if (ctrl->server_local)
     {
       release_pk_list (ctrl->server_local->recplist);
+      free_strlist (ctrl->server_local->signerlist);
 
       xfree (ctrl->server_local);
       ctrl->server_local = NULL;
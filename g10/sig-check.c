@@ -33,6 +33,7 @@
 #include "../common/i18n.h"
 #include "options.h"
 #include "pkglue.h"
+#include "sigcache.h"
 #include "../common/compliance.h"
 
 static int check_signature_end (PKT_public_key *pk, PKT_signature *sig,
@@ -46,6 +47,12 @@ static int check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
                                        const void *extrahash,
                                        size_t extrahashlen);
 
+static int do_check_key_signature (ctrl_t ctrl, kbnode_t root,
+                                   kbnode_index_t kbidx, kbnode_t node,
+                                   PKT_public_key *check_pk,
+                                   PKT_public_key *ret_pk, int *is_selfsig,
+                                   u32 *r_expiredate, int *r_expired);
+
 
 /* Statistics for signature verification.  */
 struct
@@ -470,6 +477,8 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
   gcry_mpi_t result = NULL;
   int rc = 0;
   const struct weakhash *weak;
+  byte cacheid[SIGCACHE_IDLEN];
+  int use_sigcache;
 
   if (!opt.flags.allow_weak_digest_algos)
     {
@@ -591,18 +600,30 @@ check_signature_end_simple (PKT_public_key *pk, PKT_signature *sig,
     }
     gcry_md_final( digest );
 
-    /* Convert the digest to an MPI.  */
-    result = encode_md_value (pk, digest, sig->digest_algo );
-    if (!result)
-        return GPG_ERR_GENERAL;
-
-    /* Verify the signature.  */
-    if (DBG_CLOCK && sig->sig_class <= 0x01)
-      log_clock ("enter pk_verify");
-    rc = pk_verify( pk->pubkey_algo, result, sig->data, pk->pkey );
-    if (DBG_CLOCK && sig->sig_class <= 0x01)
-      log_clock ("leave pk_verify");
-    gcry_mpi_release (result);
+    /* For key signatures we may have recorded a former successful
+     * verification in the persistent cache.  */
+    use_sigcache = (opt.persistent_sig_cache && !opt.no_sig_cache
+                    && sig->sig_class >= 0x10
+                    && !sigcache_make_id (pk, sig, digest, cacheid));
+    if (use_sigcache && sigcache_lookup (cacheid))
+      rc = 0;
+    else
+      {
+        /* Convert the digest to an MPI.  */
+        result = encode_md_value (pk, digest, sig->digest_algo );
+        if (!result)
+          return GPG_ERR_GENERAL;
+
+        /* Verify the signature.  */
+        if (DBG_CLOCK && sig->sig_class <= 0x01)
+          log_clock ("enter pk_verify");
+        rc = pk_verify (pk, result, sig->data);
+        if (DBG_CLOCK && sig->sig_class <= 0x01)
+          log_clock ("leave pk_verify");
+        gcry_mpi_release (result);
+        if (!rc && use_sigcache)
+          sigcache_put (cacheid);
+      }
 
   if (!rc && sig->flags.unknown_critical)
     {
@@ -1100,6 +1121,32 @@ check_key_signature2 (ctrl_t ctrl,
                       kbnode_t root, kbnode_t node, PKT_public_key *check_pk,
                       PKT_public_key *ret_pk, int *is_selfsig,
                       u32 *r_expiredate, int *r_expired )
+{
+  return do_check_key_signature (ctrl, root, NULL, node, check_pk, ret_pk,
+                                 is_selfsig, r_expiredate, r_expired);
+}
+
+
+/* Same as check_key_signature2 with only RET_PK given but for a
+ * keyblock with the index KBIDX.  The component a signature belongs
+ * to is then found without walking the keyblock from the start, which
+ * matters for keys with many signatures.  */
+int
+check_key_signature_indexed (ctrl_t ctrl, kbnode_index_t kbidx,
+                             kbnode_t node, PKT_public_key *ret_pk)
+{
+  return do_check_key_signature (ctrl, kbnode_index_root (kbidx), kbidx,
+                                 node, NULL, ret_pk, NULL, NULL, NULL);
+}
+
+
+/* The worker for check_key_signature2.  If KBIDX is not NULL it is
+ * the index of the keyblock ROOT.  */
+static int
+do_check_key_signature (ctrl_t ctrl, kbnode_t root, kbnode_index_t kbidx,
+                        kbnode_t node, PKT_public_key *check_pk,
+                        PKT_public_key *ret_pk, int *is_selfsig,
+                        u32 *r_expiredate, int *r_expired)
 {
   PKT_public_key *pk;
   PKT_signature *sig;
@@ -1179,7 +1226,12 @@ check_key_signature2 (ctrl_t ctrl,
     }
   else if (IS_SUBKEY_REV (sig) || IS_SUBKEY_SIG (sig))
     {
-      kbnode_t snode = find_prev_kbnode (root, node, PKT_PUBLIC_SUBKEY);
+      kbnode_t snode;
+
+      if (kbidx)
+        snode = kbnode_index_find_prev (kbidx, node, PKT_PUBLIC_SUBKEY);
+      else
+        snode = find_prev_kbnode (root, node, PKT_PUBLIC_SUBKEY);
 
       if (snode)
         {
@@ -1220,7 +1272,12 @@ check_key_signature2 (ctrl_t ctrl,
       }
     else if (IS_UID_SIG (sig) || IS_UID_REV (sig))
       {
-	kbnode_t unode = find_prev_kbnode (root, node, PKT_USER_ID);
+	kbnode_t unode;
+
+        if (kbidx)
+          unode = kbnode_index_find_prev (kbidx, node, PKT_USER_ID);
+        else
+          unode = find_prev_kbnode (root, node, PKT_USER_ID);
 
 	if (unode)
           {
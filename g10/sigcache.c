@@ -0,0 +1,391 @@
+/* sigcache.c - Persistent cache of verified key signatures
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* The signature flags stored in a keyring's ring trust packets are
+ * not available for keyboxes and keyboxd.  This module implements a
+ * file in the home directory which records all key signatures which
+ * passed the public key verification.  An item is the SHA-256 hash
+ * over the signer's fingerprint, the hash of the signed data, and
+ * the signature values.  It thus can't be used for any other
+ * signature, key or user id.  Only good signatures are recorded; the
+ * expiration and revocation status is not cached because that
+ * depends on the time and on other signatures.
+ *
+ * The file is a header item followed by the items, each
+ * SIGCACHE_IDLEN bytes.  New items are appended, so concurrent gpg
+ * processes do not need a lock.  A damaged file is truncated; an
+ * overfull file is not updated anymore.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "../common/host2net.h"
+#include "packet.h"
+#include "options.h"
+#include "main.h"
+#include "sigcache.h"
+
+#if defined(HAVE_DOSISH_SYSTEM) && !defined(ftruncate)
+#define ftruncate chsize
+#endif
+
+#if defined(HAVE_DOSISH_SYSTEM) || defined(__CYGWIN__)
+#define MY_O_BINARY  O_BINARY
+#else
+#define MY_O_BINARY  0
+#endif
+
+#define SIGCACHE_FILENAME "sigcache.bin"
+
+/* The maximum number of items we store in the file.  This limits it
+ * to 32 MiB.  */
+#define SIGCACHE_MAX_ITEMS (1024*1024)
+
+/* The header item.  Bump the version if the definition of an item
+ * changes.  */
+static const char sigcache_magic[SIGCACHE_IDLEN] = "GnuPG sigcache 1";
+
+/* The in-memory hash table with open addressing; an all zero slot
+ * is empty.  TABLE_SIZE is a power of two.  */
+static byte *table;
+static size_t table_size;
+static size_t table_count;
+
+/* The state of the cache: 0 = not yet loaded, 1 = ready, -1 =
+ * disabled due to an error.  */
+static int sigcache_state;
+
+/* The fd of the file or -1 if we can't write to it.  */
+static int sigcache_fd = -1;
+
+static struct
+{
+  unsigned int loaded;
+  unsigned int hits;
+  unsigned int misses;
+  unsigned int added;
+} sigcache_stats;
+
+
+
+/* Dump stats.  */
+void
+sigcache_dump_stats (void)
+{
+  if (sigcache_state)
+    log_info ("sigcache: loaded=%u hits=%u misses=%u added=%u\n",
+              sigcache_stats.loaded, sigcache_stats.hits,
+              sigcache_stats.misses, sigcache_stats.added);
+}
+
+
+/* Compute the cache id for the signature SIG made by PK over the
+ * data hashed by the already finalized DIGEST and store it at R_ID,
+ * which must have room for SIGCACHE_IDLEN bytes.  */
+gpg_error_t
+sigcache_make_id (PKT_public_key *pk, PKT_signature *sig,
+                  gcry_md_hd_t digest, byte *r_id)
+{
+  gpg_error_t err;
+  gcry_md_hd_t md;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  const byte *dvalue;
+  unsigned int dlen;
+  byte buf[4];
+  int i, nsig;
+
+  dvalue = gcry_md_read (digest, sig->digest_algo);
+  dlen = gcry_md_get_algo_dlen (sig->digest_algo);
+  nsig = pubkey_get_nsig (sig->pubkey_algo);
+  if (!dvalue || !dlen || !nsig)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  err = gcry_md_open (&md, GCRY_MD_SHA256, 0);
+  if (err)
+    return err;
+
+  fingerprint_from_pk (pk, fpr, &fprlen);
+  gcry_md_putc (md, fprlen);
+  gcry_md_write (md, fpr, fprlen);
+  gcry_md_putc (md, sig->pubkey_algo);
+  gcry_md_putc (md, sig->digest_algo);
+  gcry_md_putc (md, dlen);
+  gcry_md_write (md, dvalue, dlen);
+  for (i=0; i < nsig; i++)
+    {
+      gcry_mpi_t a = sig->data[i];
+      unsigned char *tmp = NULL;
+      const void *p;
+      unsigned int nbits;
+      size_t n;
+
+      if (!a)
+        {
+          err = gpg_error (GPG_ERR_BAD_MPI);
+          break;
+        }
+      if (gcry_mpi_get_flag (a, GCRYMPI_FLAG_OPAQUE))
+        {
+          p = gcry_mpi_get_opaque (a, &nbits);
+          n = (nbits + 7) / 8;
+        }
+      else
+        {
+          err = gcry_mpi_aprint (GCRYMPI_FMT_USG, &tmp, &n, a);
+          if (err)
+            break;
+          p = tmp;
+        }
+      ulongtobuf (buf, n);
+      gcry_md_write (md, buf, 4);
+      if (n)
+        gcry_md_write (md, p, n);
+      gcry_free (tmp);
+    }
+  if (!err)
+    memcpy (r_id, gcry_md_read (md, GCRY_MD_SHA256), SIGCACHE_IDLEN);
+  gcry_md_close (md);
+  return err;
+}
+
+
+/* Return the slot for ID; that is either the slot with ID or the
+ * empty slot where it would be inserted.  */
+static byte *
+table_slot (const byte *id)
+{
+  static const byte zeroes[SIGCACHE_IDLEN];
+  size_t idx;
+  byte *slot;
+
+  idx = buf32_to_size_t (id) & (table_size - 1);
+  for (;;)
+    {
+      slot = table + idx * SIGCACHE_IDLEN;
+      if (!memcmp (slot, id, SIGCACHE_IDLEN)
+          || !memcmp (slot, zeroes, SIGCACHE_IDLEN))
+        return slot;
+      idx = (idx + 1) & (table_size - 1);
+    }
+}
+
+
+/* Insert ID into the hash table.  Returns true if ID was added.  */
+static int
+table_insert (const byte *id)
+{
+  byte *slot;
+
+  if ((table_count + 1) * 2 > table_size)
+    {
+      byte *oldtable = table;
+      size_t oldsize = table_size;
+      size_t newsize = table_size? table_size * 2 : 1024;
+      byte *newtable;
+      size_t idx;
+
+      newtable = xtrycalloc (newsize, SIGCACHE_IDLEN);
+      if (!newtable)
+        return 0;
+      table = newtable;
+      table_size = newsize;
+      for (idx=0; idx < oldsize; idx++)
+        {
+          byte *old = oldtable + idx * SIGCACHE_IDLEN;
+          static const byte zeroes[SIGCACHE_IDLEN];
+
+          if (memcmp (old, zeroes, SIGCACHE_IDLEN))
+            memcpy (table_slot (old), old, SIGCACHE_IDLEN);
+        }
+      xfree (oldtable);
+    }
+
+  slot = table_slot (id);
+  if (!memcmp (slot, id, SIGCACHE_IDLEN))
+    return 0;
+  memcpy (slot, id, SIGCACHE_IDLEN);
+  table_count++;
+  return 1;
+}
+
+
+/* Truncate the file and write the header.  */
+static gpg_error_t
+reset_file (const char *fname)
+{
+  gpg_error_t err;
+
+  if (ftruncate (sigcache_fd, 0)
+      || write (sigcache_fd, sigcache_magic, SIGCACHE_IDLEN) != SIGCACHE_IDLEN)
+    {
+      err = gpg_error_from_syserror ();
+      log_info ("error resetting '%s': %s\n", fname, gpg_strerror (err));
+      return err;
+    }
+  return 0;
+}
+
+
+/* Open the cache file and read all items.  */
+static void
+load_cache (void)
+{
+  char *fname;
+  struct stat st;
+  byte buffer[128 * SIGCACHE_IDLEN];
+  ssize_t n;
+  size_t off;
+  int first = 1;
+
+  sigcache_state = -1;
+  fname = make_filename (gnupg_homedir (), SIGCACHE_FILENAME, NULL);
+  sigcache_fd = open (fname, O_RDWR | O_APPEND | O_CREAT | MY_O_BINARY,
+                      S_IRUSR | S_IWUSR);
+  if (sigcache_fd == -1)
+    {
+      if (opt.verbose)
+        log_info ("can't open '%s': %s\n",
+                  fname, gpg_strerror (gpg_error_from_syserror ()));
+      goto leave;
+    }
+
+  if (fstat (sigcache_fd, &st))
+    {
+      log_info ("can't stat '%s': %s\n",
+                fname, gpg_strerror (gpg_error_from_syserror ()));
+      goto leave;
+    }
+  if (!st.st_size || (st.st_size % SIGCACHE_IDLEN))
+    {
+      /* New file or an item has only partly been written.  */
+      if (st.st_size && opt.verbose)
+        log_info ("'%s' is damaged - resetting\n", fname);
+      if (reset_file (fname))
+        goto leave;
+      sigcache_state = 1;
+      goto leave;
+    }
+
+  while ((n = read (sigcache_fd, buffer, sizeof buffer)) > 0)
+    {
+      if ((n % SIGCACHE_IDLEN))
+        {
+          /* Should not happen because we checked the size.  Stop
+           * reading but keep what we have.  */
+          n -= n % SIGCACHE_IDLEN;
+          if (!n)
+            break;
+        }
+      for (off = 0; off < n; off += SIGCACHE_IDLEN)
+        {
+          if (first)
+            {
+              first = 0;
+              if (memcmp (buffer, sigcache_magic, SIGCACHE_IDLEN))
+                {
+                  if (opt.verbose)
+                    log_info ("'%s' has an unknown format - resetting\n",
+                              fname);
+                  if (!reset_file (fname))
+                    sigcache_state = 1;
+                  goto leave;
+                }
+              continue;
+            }
+          if (table_insert (buffer + off))
+            sigcache_stats.loaded++;
+        }
+    }
+  if (n < 0)
+    log_info ("error reading '%s': %s\n",
+              fname, gpg_strerror (gpg_error_from_syserror ()));
+  sigcache_state = 1;
+
+ leave:
+  if (sigcache_state != 1 && sigcache_fd != -1)
+    {
+      close (sigcache_fd);
+      sigcache_fd = -1;
+    }
+  xfree (fname);
+}
+
+
+/* Return true if ID is in the cache.  */
+int
+sigcache_lookup (const byte *id)
+{
+  byte *slot;
+
+  if (!sigcache_state)
+    load_cache ();
+  if (sigcache_state != 1 || !table)
+    {
+      sigcache_stats.misses++;
+      return 0;
+    }
+
+  slot = table_slot (id);
+  if (!memcmp (slot, id, SIGCACHE_IDLEN))
+    {
+      sigcache_stats.hits++;
+      return 1;
+    }
+  sigcache_stats.misses++;
+  return 0;
+}
+
+
+/* Add ID to the cache.  */
+void
+sigcache_put (const byte *id)
+{
+  if (!sigcache_state)
+    load_cache ();
+  if (sigcache_state != 1)
+    return;
+
+  if (!table_insert (id))
+    return;  /* Already known or out of core.  */
+  sigcache_stats.added++;
+  if (sigcache_fd == -1 || table_count > SIGCACHE_MAX_ITEMS)
+    return;
+
+  /* The file has been opened in append mode and an item is small
+   * enough to be written atomically.  */
+  if (write (sigcache_fd, id, SIGCACHE_IDLEN) != SIGCACHE_IDLEN)
+    {
+      log_info ("error writing signature cache: %s\n",
+                gpg_strerror (gpg_error_from_syserror ()));
+      close (sigcache_fd);
+      sigcache_fd = -1;
+    }
+}
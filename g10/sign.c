@@ -23,6 +23,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <errno.h>
+#include <unistd.h>
 
 #include "gpg.h"
 #include "options.h"
@@ -42,6 +43,8 @@
 #include "call-agent.h"
 #include "../common/mbox-util.h"
 #include "../common/compliance.h"
+#include "../common/shareddefs.h"
+#include "worker.h"
 
 #ifdef HAVE_DOSISH_SYSTEM
 #define LF "\r\n"
@@ -909,6 +912,293 @@ write_plaintext_packet (iobuf_t out, iobuf_t inp,
 }
 
 
+/* Create a new signature packet for PK and store it at R_SIG.  A copy
+ * of the non-finalized HASH with the signature's trailer hashed and
+ * finalized is stored at R_MD.  */
+static gpg_error_t
+prepare_signature (ctrl_t ctrl, PKT_public_key *pk, gcry_md_hd_t hash,
+                   pt_extra_hash_data_t extrahash,
+                   int sigclass, u32 timestamp, u32 duration,
+                   PKT_signature **r_sig, gcry_md_hd_t *r_md)
+{
+  PKT_signature *sig;
+  gcry_md_hd_t md;
+  gpg_error_t err;
+
+  *r_sig = NULL;
+  *r_md = NULL;
+
+  /* Build the signature packet.  */
+  sig = xtrycalloc (1, sizeof *sig);
+  if (!sig)
+    return gpg_error_from_syserror ();
+
+  if (pk->version >= 5)
+    sig->version = 5;  /* Required for v5 keys.  */
+  else
+    sig->version = 4;  /* Required.  */
+
+  keyid_from_pk (pk, sig->keyid);
+  sig->digest_algo = hash_for (pk);
+  sig->pubkey_algo = pk->pubkey_algo;
+  if (timestamp)
+    sig->timestamp = timestamp;
+  else
+    sig->timestamp = make_timestamp();
+  if (duration)
+    sig->expiredate = sig->timestamp + duration;
+  sig->sig_class = sigclass;
+
+  if (gcry_md_copy (&md, hash))
+    BUG ();
+
+  build_sig_subpkt_from_sig (sig, pk);
+  mk_notation_policy_etc (ctrl, sig, NULL, pk);
+  if (opt.flags.include_key_block && IS_SIG (sig))
+    err = mk_sig_subpkt_key_block (ctrl, sig, pk);
+  else
+    err = 0;
+  hash_sigversion_to_magic (md, sig, extrahash);
+  gcry_md_final (md);
+
+  if (err)
+    {
+      gcry_md_close (md);
+      free_seckey_enc (sig);
+      return err;
+    }
+  *r_sig = sig;
+  *r_md = md;
+  return 0;
+}
+
+
+/* Write the signature packet SIG created with PK to OUT and release
+ * SIG.  */
+static gpg_error_t
+write_signature_packet (IOBUF out, PKT_public_key *pk, PKT_signature *sig,
+                        int status_letter)
+{
+  gpg_error_t err;
+  PACKET pkt;
+
+  init_packet (&pkt);
+  pkt.pkttype = PKT_SIGNATURE;
+  pkt.pkt.signature = sig;
+  err = build_packet (out, &pkt);
+  if (!err && is_status_enabled())
+    print_status_sig_created (pk, sig, status_letter);
+  free_packet (&pkt, NULL);
+  if (err)
+    log_error ("build signature packet failed: %s\n", gpg_strerror (err));
+  return err;
+}
+
+
+#ifndef HAVE_W32_SYSTEM
+/* The upper limit for --sign-jobs.  */
+#define MAX_SIGN_JOBS 16
+
+/* A process used by write_signature_packets_parallel to create one
+ * signature.  It uses its own connection to the agent so that the
+ * agent can work on several signatures at the same time; for example
+ * while another one is created by a smartcard.  */
+struct sign_worker_s
+{
+  struct worker_s proc;
+};
+
+/* The parameters for sign_worker_main.  */
+struct sign_worker_parm_s
+{
+  ctrl_t ctrl;
+  PKT_public_key *pk;
+  PKT_signature *sig;
+  gcry_md_hd_t md;
+  const char *cache_nonce;
+};
+
+
+/* The main function of a worker process which signs MD with PK and
+ * returns the packet for SIG.  The worker writes the error code as
+ * an u32 and on success the length of the packet as an u32 followed
+ * by the packet.  */
+static void
+sign_worker_main (void *opaque, int in_fd, int out_fd)
+{
+  struct sign_worker_parm_s *parm = opaque;
+  gpg_error_t err;
+  iobuf_t tmp = NULL;
+  PACKET pkt;
+  u32 code, len;
+
+  (void)in_fd;
+
+  /* We may not use the agent connection and the open files of our
+   * parent.  */
+  agent_prepare_worker ();
+  keydb_prepare_worker (parm->ctrl);
+
+  err = do_sign (parm->ctrl, parm->pk, parm->sig, parm->md,
+                 hash_for (parm->pk), parm->cache_nonce, 0);
+  if (!err)
+    {
+      tmp = iobuf_temp ();
+      init_packet (&pkt);
+      pkt.pkttype = PKT_SIGNATURE;
+      pkt.pkt.signature = parm->sig;
+      err = build_packet (tmp, &pkt);
+      iobuf_flush_temp (tmp);
+    }
+  code = err;
+  if (!worker_writen (out_fd, &code, sizeof code) && !err)
+    {
+      len = iobuf_get_temp_length (tmp);
+      if (!worker_writen (out_fd, &len, sizeof len))
+        worker_writen (out_fd, iobuf_get_temp_buffer (tmp), len);
+    }
+}
+
+
+/* Start a worker process which signs MD with PK and returns the
+ * packet for SIG.  */
+static gpg_error_t
+sign_start_worker (ctrl_t ctrl, struct sign_worker_s *wk,
+                   PKT_public_key *pk, PKT_signature *sig, gcry_md_hd_t md,
+                   const char *cache_nonce)
+{
+  struct sign_worker_parm_s parm;
+
+  parm.ctrl = ctrl;
+  parm.pk = pk;
+  parm.sig = sig;
+  parm.md = md;
+  parm.cache_nonce = cache_nonce;
+  return worker_start (&wk->proc, 0, sign_worker_main, &parm);
+}
+
+
+/* Wait for the worker WK and write its packet to OUT unless SKIP is
+ * set.  */
+static gpg_error_t
+sign_collect_worker (struct sign_worker_s *wk, IOBUF out, int skip)
+{
+  gpg_error_t err;
+  unsigned char *buffer = NULL;
+  u32 code, len;
+
+  err = worker_readn (wk->proc.from_fd, &code, sizeof code);
+  if (!err && code)
+    err = code;
+  else if (!err)
+    err = worker_readn (wk->proc.from_fd, &len, sizeof len);
+  if (!err && !skip)
+    {
+      buffer = xtrymalloc (len);
+      if (!buffer)
+        err = gpg_error_from_syserror ();
+      else
+        err = worker_readn (wk->proc.from_fd, buffer, len);
+      if (!err)
+        err = iobuf_write (out, buffer, len);
+      xfree (buffer);
+    }
+
+  worker_stop (&wk->proc, 0);
+  return err;
+}
+
+
+/* Variant of write_signature_packets which creates up to NJOBS
+ * signatures at the same time.  The first signature of each group is
+ * created by us, the others by worker processes.  The packets are
+ * written in the order of SK_LIST.  */
+static int
+write_signature_packets_parallel (ctrl_t ctrl, int njobs,
+                                  SK_LIST sk_list, IOBUF out,
+                                  gcry_md_hd_t hash,
+                                  pt_extra_hash_data_t extrahash,
+                                  int sigclass, u32 timestamp, u32 duration,
+                                  int status_letter, const char *cache_nonce)
+{
+  gpg_error_t err = 0;
+  gpg_error_t err2, prep_err = 0;
+  SK_LIST sk_rover = sk_list;
+  PKT_public_key *pks[MAX_SIGN_JOBS];
+  PKT_signature *sigs[MAX_SIGN_JOBS];
+  gcry_md_hd_t mds[MAX_SIGN_JOBS];
+  struct sign_worker_s workers[MAX_SIGN_JOBS];
+  int i, n;
+
+  if (njobs > MAX_SIGN_JOBS)
+    njobs = MAX_SIGN_JOBS;
+
+  while (sk_rover && !err && !prep_err)
+    {
+      /* Prepare the next group.  The signatures before one which
+       * can't be prepared are still written.  */
+      for (n=0; n < njobs && sk_rover; n++, sk_rover = sk_rover->next)
+        {
+          pks[n] = sk_rover->pk;
+          prep_err = prepare_signature (ctrl, pks[n], hash, extrahash,
+                                        sigclass, timestamp, duration,
+                                        sigs + n, mds + n);
+          if (prep_err)
+            break;
+        }
+
+      /* Start the workers; if that fails the signature is created
+       * later by us.  */
+      for (i=0; i < n; i++)
+        {
+          worker_init (&workers[i].proc);
+          if (i && (err2 = sign_start_worker (ctrl, workers + i, pks[i],
+                                              sigs[i], mds[i],
+                                              cache_nonce)))
+            log_info ("error starting signing worker: %s\n",
+                      gpg_strerror (err2));
+        }
+
+      /* Create and write the signatures in order.  After an error
+       * the remaining workers are only waited for.  */
+      for (i=0; i < n; i++)
+        {
+          if (workers[i].proc.pid != (pid_t)(-1))
+            {
+              err2 = sign_collect_worker (workers + i, out, !!err);
+              if (!err && !err2 && is_status_enabled ())
+                print_status_sig_created (pks[i], sigs[i], status_letter);
+            }
+          else if (!err)
+            {
+              err2 = do_sign (ctrl, pks[i], sigs[i], mds[i], hash_for (pks[i]),
+                              cache_nonce, 0);
+              if (!err2)
+                {
+                  err2 = write_signature_packet (out, pks[i], sigs[i],
+                                                 status_letter);
+                  sigs[i] = NULL;
+                }
+            }
+          else
+            err2 = 0;
+          if (!err)
+            err = err2;
+        }
+
+      for (i=0; i < n; i++)
+        {
+          gcry_md_close (mds[i]);
+          if (sigs[i])
+            free_seckey_enc (sigs[i]);
+        }
+    }
+
+  return err? err : prep_err;
+}
+#endif /*!HAVE_W32_SYSTEM*/
+
+
 /*
  * Write the signatures from the SK_LIST to OUT. HASH must be a
  * non-finalized hash which will not be changes here.  EXTRAHASH is
@@ -923,6 +1213,17 @@ write_signature_packets (ctrl_t ctrl,
 {
   SK_LIST sk_rover;
 
+#ifndef HAVE_W32_SYSTEM
+  /* With a loopback pinentry the workers would need to ask for
+   * passphrases at the same time.  */
+  if (opt.sign_jobs > 1 && sk_list && sk_list->next
+      && opt.pinentry_mode != PINENTRY_MODE_LOOPBACK)
+    return write_signature_packets_parallel (ctrl, opt.sign_jobs,
+                                             sk_list, out, hash, extrahash,
+                                             sigclass, timestamp, duration,
+                                             status_letter, cache_nonce);
+#endif
+
   /* Loop over the certificates with secret keys. */
   for (sk_rover = sk_list; sk_rover; sk_rover = sk_rover->next)
     {
@@ -933,58 +1234,15 @@ write_signature_packets (ctrl_t ctrl,
 
       pk = sk_rover->pk;
 
-      /* Build the signature packet.  */
-      sig = xtrycalloc (1, sizeof *sig);
-      if (!sig)
-        return gpg_error_from_syserror ();
-
-      if (pk->version >= 5)
-        sig->version = 5;  /* Required for v5 keys.  */
-      else
-        sig->version = 4;  /* Required.  */
-
-      keyid_from_pk (pk, sig->keyid);
-      sig->digest_algo = hash_for (pk);
-      sig->pubkey_algo = pk->pubkey_algo;
-      if (timestamp)
-        sig->timestamp = timestamp;
-      else
-        sig->timestamp = make_timestamp();
-      if (duration)
-        sig->expiredate = sig->timestamp + duration;
-      sig->sig_class = sigclass;
-
-      if (gcry_md_copy (&md, hash))
-        BUG ();
-
-      build_sig_subpkt_from_sig (sig, pk);
-      mk_notation_policy_etc (ctrl, sig, NULL, pk);
-      if (opt.flags.include_key_block && IS_SIG (sig))
-        err = mk_sig_subpkt_key_block (ctrl, sig, pk);
-      else
-        err = 0;
-      hash_sigversion_to_magic (md, sig, extrahash);
-      gcry_md_final (md);
+      err = prepare_signature (ctrl, pk, hash, extrahash,
+                               sigclass, timestamp, duration, &sig, &md);
+      if (err)
+        return err;
 
-      if (!err)
-        err = do_sign (ctrl, pk, sig, md, hash_for (pk), cache_nonce, 0);
+      err = do_sign (ctrl, pk, sig, md, hash_for (pk), cache_nonce, 0);
       gcry_md_close (md);
       if (!err)
-        {
-          /* Write the packet.  */
-          PACKET pkt;
-
-          init_packet (&pkt);
-          pkt.pkttype = PKT_SIGNATURE;
-          pkt.pkt.signature = sig;
-          err = build_packet (out, &pkt);
-          if (!err && is_status_enabled())
-            print_status_sig_created (pk, sig, status_letter);
-          free_packet (&pkt, NULL);
-          if (err)
-            log_error ("build signature packet failed: %s\n",
-                       gpg_strerror (err));
-	}
+        err = write_signature_packet (out, pk, sig, status_letter);
       else
         free_seckey_enc (sig);
 
@@ -1007,10 +1265,14 @@ write_signature_packets (ctrl_t ctrl,
  * If OUTFILE is not NULL; this file is used for output and the function
  * does not ask for overwrite permission; output is then always
  * uncompressed, non-armored and in binary mode.
+ * If FILEFD is not -1 the data is read from this file descriptor
+ * instead of FILENAMES; if OUTPUTFD is not -1 the output is written to
+ * it.  Both descriptors are not closed.
  */
-int
-sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
-	   int encryptflag, strlist_t remusr, const char *outfile )
+static int
+do_sign_file (ctrl_t ctrl, int filefd, int outputfd,
+              strlist_t filenames, int detached, strlist_t locusr,
+              int encryptflag, strlist_t remusr, const char *outfile)
 {
   const char *fname;
   armor_filter_context_t *afx;
@@ -1072,7 +1334,10 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
     inp = NULL;     /* we do it later */
   else
     {
-      inp = iobuf_open(fname);
+      if (filefd != -1)
+        inp = iobuf_fdopen_nc (filefd, "rb");
+      else
+        inp = iobuf_open(fname);
       if (inp && is_secured_file (iobuf_get_fd (inp)))
         {
           iobuf_close (inp);
@@ -1108,7 +1373,7 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
       else if (opt.verbose)
         log_info (_("writing to '%s'\n"), outfile);
     }
-  else if ((rc = open_outfile (-1, fname,
+  else if ((rc = open_outfile (outputfd, fname,
                                opt.armor? 1 : detached? 2 : 0, 0, &out)))
     {
       goto leave;
@@ -1365,6 +1630,28 @@ sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
 }
 
 
+/* Sign the files whose names are in FILENAMES.  See do_sign_file
+ * for details.  */
+int
+sign_file (ctrl_t ctrl, strlist_t filenames, int detached, strlist_t locusr,
+	   int encryptflag, strlist_t remusr, const char *outfile )
+{
+  return do_sign_file (ctrl, -1, -1, filenames, detached, locusr,
+                       encryptflag, remusr, outfile);
+}
+
+
+/* Sign the data read from FILEFD and write the signature or the
+ * signed data to OUTPUTFD.  This is used by the server.  */
+int
+sign_fd (ctrl_t ctrl, int filefd, int outputfd, int detached,
+         strlist_t locusr)
+{
+  return do_sign_file (ctrl, filefd, outputfd, NULL, detached, locusr,
+                       0, NULL, NULL);
+}
+
+
 /*
  * Make a clear signature.  Note that opt.armor is not needed.
  */
@@ -98,8 +98,7 @@ export_ownertrust (ctrl_t ctrl)
 {
   TRUSTREC rec;
   ulong recnum;
-  int i;
-  byte *p;
+  char hexfpr[2*20+1];
 
   init_trustdb (ctrl, 0);
   es_printf (_("# List of assigned trustvalues, created %s\n"
@@ -111,15 +110,43 @@ export_ownertrust (ctrl_t ctrl)
         {
           if (!rec.r.trust.ownertrust)
             continue;
-          p = rec.r.trust.fingerprint;
-          for (i=0; i < 20; i++, p++ )
-            es_printf("%02X", *p );
-          es_printf (":%u:\n", (unsigned int)rec.r.trust.ownertrust );
+          bin2hex (rec.r.trust.fingerprint, 20, hexfpr);
+          es_printf ("%s:%u:\n",
+                     hexfpr, (unsigned int)rec.r.trust.ownertrust);
 	}
     }
 }
 
 
+/* An entry read by import_ownertrust.  */
+struct ownertrust_item
+{
+  byte fpr[MAX_FINGERPRINT_LEN];
+  unsigned int otrust;
+  unsigned int lno;
+};
+
+
+/* qsort function to sort ownertrust items by fingerprint and, for
+ * the same fingerprint, by the order in the input.  */
+static int
+cmp_ownertrust_items (const void *a_arg, const void *b_arg)
+{
+  const struct ownertrust_item *a = a_arg;
+  const struct ownertrust_item *b = b_arg;
+  int cmp;
+
+  cmp = memcmp (a->fpr, b->fpr, MAX_FINGERPRINT_LEN);
+  if (cmp)
+    return cmp;
+  return a->lno < b->lno? -1 : a->lno > b->lno;
+}
+
+
+/* Read the ownertrust values from FNAME.  All values are first read
+ * into memory and sorted by fingerprint; they are then applied in one
+ * transaction so that the trustdb is locked and written only once.
+ * If a fingerprint is listed several times the last value is used.  */
 void
 import_ownertrust (ctrl_t ctrl, const char *fname )
 {
@@ -129,8 +156,14 @@ import_ownertrust (ctrl_t ctrl, const char *fname )
     char *p;
     size_t n, fprlen;
     unsigned int otrust;
-    byte fpr[MAX_FINGERPRINT_LEN];
+    byte *fpr;
+    struct ownertrust_item *items = NULL;
+    size_t nitems = 0;
+    size_t itemsize = 0;
+    size_t idx;
+    unsigned int lno = 0;
     int any = 0;
+    int transaction;
     int rc;
 
     init_trustdb (ctrl, 0);
@@ -153,8 +186,7 @@ import_ownertrust (ctrl_t ctrl, const char *fname )
       }
 
     while (es_fgets (line, DIM(line)-1, fp)) {
-	TRUSTREC rec;
-
+	lno++;
 	if( !*line || *line == '#' )
 	    continue;
 	n = strlen(line);
@@ -183,6 +215,13 @@ import_ownertrust (ctrl_t ctrl, const char *fname )
 	}
 	if( !otrust )
 	    continue; /* no otrust defined - no need to update or insert */
+	if (nitems == itemsize) {
+	    itemsize = itemsize? 2 * itemsize : 256;
+	    items = xrealloc (items, itemsize * sizeof *items);
+	}
+	items[nitems].otrust = otrust;
+	items[nitems].lno = lno;
+	fpr = items[nitems++].fpr;
 	/* Convert the ascii fingerprint to binary */
 	for(p=line, fprlen=0;
             fprlen < MAX_FINGERPRINT_LEN && *p != ':';
@@ -190,6 +229,27 @@ import_ownertrust (ctrl_t ctrl, const char *fname )
           fpr[fprlen++] = HEXTOBIN(p[0]) * 16 + HEXTOBIN(p[1]);
 	while (fprlen < MAX_FINGERPRINT_LEN)
 	    fpr[fprlen++] = 0;
+    }
+    if (es_ferror (fp))
+	log_error ( _("read error in '%s': %s\n"), fname, strerror(errno) );
+    if (!is_stdin)
+	es_fclose (fp);
+
+    /* Sorting lets us skip superseded values and makes the lookups
+     * walk the hash table of the trustdb in order.  */
+    qsort (items, nitems, sizeof *items, cmp_ownertrust_items);
+
+    /* Commit all records with one write at the end.  */
+    transaction = !tdbio_begin_bulk_transaction ();
+
+    for (idx=0; idx < nitems; idx++) {
+	TRUSTREC rec;
+
+	if (idx+1 < nitems
+	    && !memcmp (items[idx].fpr, items[idx+1].fpr, MAX_FINGERPRINT_LEN))
+	    continue; /* superseded by a later line */
+	fpr = items[idx].fpr;
+	otrust = items[idx].otrust;
 
 	rc = tdbio_search_trust_byfpr (ctrl, fpr, &rec);
 	if( !rc ) { /* found: update */
@@ -223,17 +283,12 @@ import_ownertrust (ctrl_t ctrl, const char *fname )
 	    log_error (_("error finding trust record in '%s': %s\n"),
                        fname, gpg_strerror (rc));
     }
-    if (es_ferror (fp))
-	log_error ( _("read error in '%s': %s\n"), fname, strerror(errno) );
-    if (!is_stdin)
-	es_fclose (fp);
+    xfree (items);
 
     if (any)
-      {
-        revalidation_mark (ctrl);
-        rc = tdbio_sync ();
-        if (rc)
-          log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (rc) );
-      }
+      revalidation_mark (ctrl);
+    rc = transaction? tdbio_end_transaction () : tdbio_sync ();
+    if (rc)
+      log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (rc) );
 
 }
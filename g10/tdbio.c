@@ -26,12 +26,16 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <fcntl.h>
+#ifdef HAVE_MMAP
+# include <sys/mman.h>
+#endif
 #include <unistd.h>
 
 #include "gpg.h"
 #include "../common/status.h"
 #include "../common/iobuf.h"
 #include "../common/util.h"
+#include "../common/host2net.h"
 #include "options.h"
 #include "main.h"
 #include "../common/i18n.h"
@@ -65,6 +69,7 @@ typedef struct cache_ctrl_struct *CACHE_CTRL;
 struct cache_ctrl_struct
 {
   CACHE_CTRL next;
+  CACHE_CTRL hnext;  /* Next in the hash bucket or in the free list.  */
   struct {
     unsigned used:1;
     unsigned dirty:1;
@@ -75,7 +80,8 @@ struct cache_ctrl_struct
 
 /* Size of the cache.  The SOFT value is the general one.  While in a
    transaction this may not be sufficient and thus we may increase it
-   then up to the HARD limit.  */
+   then up to the HARD limit.  The SOFT value can be raised with
+   --trustdb-cache-size.  */
 #define MAX_CACHE_ENTRIES_SOFT	200
 #define MAX_CACHE_ENTRIES_HARD	10000
 
@@ -84,6 +90,32 @@ struct cache_ctrl_struct
 static CACHE_CTRL cache_list;
 static int cache_entries;
 static int cache_is_dirty;
+static int cache_dirty_entries;  /* Number of used and dirty entries.  */
+static int cache_max_entries = MAX_CACHE_ENTRIES_SOFT;
+
+/* The used cache entries are also linked into a hash table indexed
+ * by the record number; unused entries are kept in a free list.  */
+static CACHE_CTRL *cache_hash;
+static unsigned int cache_hash_size;
+static CACHE_CTRL cache_free_list;
+
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+# define USE_DB_MAP 1
+#endif
+
+#ifdef USE_DB_MAP
+/* A read-only mapping of the trustdb used to read records without
+ * system calls.  Records are still written with write(2); the
+ * mapping is shared and thus sees these updates.  The mapping is
+ * extended when a record beyond its end is requested.  */
+static const byte *db_map;
+static size_t db_maplen;   /* Length of the valid part of the map.  */
+static size_t db_mapsize;  /* Allocated length of the map.  */
+static int db_map_failed;
+
+/* The headroom of the mapping for appended records.  */
+#define DB_MAP_HEADROOM (1024 * TRUST_RECORD_LEN * 64)
+#endif
 
 
 /* An object to pass information to cmp_krec_fpr. */
@@ -114,12 +146,58 @@ static unsigned int is_locked;
 /* The file descriptor of the trustdb.  */
 static int  db_fd = -1;
 
-/* A flag indicating that a transaction is active.  */
-/* static int in_transaction;   Not yet used. */
+/* The in-memory index of the trust records; see build_trust_index.
+ * An item with a RECNUM of 0 is empty.  */
+struct trust_index_item
+{
+  byte fpr[20];
+  ulong recnum;
+};
+static struct trust_index_item *trust_index;
+static size_t trust_index_size;     /* A power of two.  */
+static size_t trust_index_used;
+static unsigned int trust_index_searches;
+
+/* The number of searches done while holding the lock before the
+ * index is built.  */
+#define TRUST_INDEX_THRESHOLD 32
+
+/* The RECNUM of a deleted item.  */
+#define TRUST_INDEX_DELETED ((ulong)(-1))
+
+/* The nesting level of the active transaction; 0 if there is none.
+ * TRANSACTION_LOCKED is set if the outermost transaction took the
+ * lock and TRANSACTION_CANCELED if an inner one has been canceled.  */
+static int in_transaction;
+static int transaction_locked;
+static int transaction_canceled;
+
+/* Set if the active transaction has been started by
+ * tdbio_begin_bulk_transaction; the cache is then not limited by
+ * MAX_CACHE_ENTRIES_HARD.  */
+static int transaction_bulk;
+
+/* Set if the trustdb has been opened read-only.  */
+static int db_readonly;
+
+/* The write-ahead journal used to commit a transaction is a file
+ * with this suffix next to the trustdb.  It consists of the magic,
+ * the number of records as a 32 bit value, the records each
+ * prefixed by their record number, and a SHA-1 hash over all the
+ * preceding bytes.  */
+#define JOURNAL_SUFFIX   ".jrnl"
+#define JOURNAL_MAGIC    "GnuPG tdbjrnl 1"
+#define JOURNAL_MAGICLEN 16
+#define JOURNAL_ITEMLEN  (4 + TRUST_RECORD_LEN)
+#define JOURNAL_HASHLEN  20
 
 
 
 static void open_db (void);
+static int commit_cache (void);
+static void cache_hash_grow (void);
+static int begin_transaction (int bulk);
+static void trust_index_release (void);
 static void create_hashtable (ctrl_t ctrl, TRUSTREC *vr, int type);
 
 
@@ -178,6 +256,8 @@ release_write_lock (void)
   if (--is_locked)
     return;
 
+  /* Another process may now change the trustdb.  */
+  trust_index_release ();
   if (dotlock_release (lockhandle))
     log_error ("Oops, tdbio:release_write_locked failed\n");
 }
@@ -188,6 +268,113 @@ release_write_lock (void)
  ************* record cache **********
  *************************************/
 
+/* Return the used cache entry for RECNO or NULL.  */
+static CACHE_CTRL
+cache_hash_lookup (ulong recno)
+{
+  CACHE_CTRL r;
+
+  if (!cache_hash)
+    return NULL;
+  for (r = cache_hash[recno % cache_hash_size]; r; r = r->hnext)
+    if (r->recno == recno)
+      return r;
+  return NULL;
+}
+
+
+/* Mark the entry R as used for RECNO and insert it into the hash
+ * table.  */
+static void
+cache_hash_insert (CACHE_CTRL r, ulong recno)
+{
+  unsigned int i;
+
+  if (!cache_hash)
+    {
+      /* Allocate the table on first use so that the option
+       * --trustdb-cache-size has been seen.  */
+      if (opt.trustdb_cache_size > cache_max_entries)
+        cache_max_entries = opt.trustdb_cache_size;
+      cache_hash_size = cache_max_entries / 4 + 1;
+      cache_hash = xcalloc (cache_hash_size, sizeof *cache_hash);
+    }
+  r->flags.used = 1;
+  r->recno = recno;
+  i = recno % cache_hash_size;
+  r->hnext = cache_hash[i];
+  cache_hash[i] = r;
+  cache_entries++;
+
+  /* A large transaction may grow the cache far beyond the size the
+   * table has been allocated for.  Keep the chains short.  */
+  if (cache_entries / 8 > cache_hash_size)
+    cache_hash_grow ();
+}
+
+
+/* Double the size of the hash table.  */
+static void
+cache_hash_grow (void)
+{
+  CACHE_CTRL *newhash, r, rnext;
+  unsigned int newsize, i, j;
+
+  newsize = cache_hash_size * 2 + 1;
+  newhash = xcalloc (newsize, sizeof *newhash);
+  for (i=0; i < cache_hash_size; i++)
+    for (r = cache_hash[i]; r; r = rnext)
+      {
+        rnext = r->hnext;
+        j = r->recno % newsize;
+        r->hnext = newhash[j];
+        newhash[j] = r;
+      }
+  xfree (cache_hash);
+  cache_hash = newhash;
+  cache_hash_size = newsize;
+}
+
+
+/* Remove the used entry R from the hash table and put it into the
+ * free list.  */
+static void
+cache_hash_remove (CACHE_CTRL r)
+{
+  CACHE_CTRL *rp;
+
+  for (rp = &cache_hash[r->recno % cache_hash_size]; *rp; rp = &(*rp)->hnext)
+    if (*rp == r)
+      {
+        *rp = r->hnext;
+        break;
+      }
+  if (r->flags.dirty)
+    {
+      r->flags.dirty = 0;
+      cache_dirty_entries--;
+    }
+  r->flags.used = 0;
+  r->hnext = cache_free_list;
+  cache_free_list = r;
+  cache_entries--;
+}
+
+
+/* Store DATA in the entry R and mark it as dirty.  */
+static void
+cache_set_dirty (CACHE_CTRL r, const char *data)
+{
+  memcpy (r->data, data, TRUST_RECORD_LEN);
+  if (!r->flags.dirty)
+    {
+      r->flags.dirty = 1;
+      cache_dirty_entries++;
+    }
+  cache_is_dirty = 1;
+}
+
+
 /*
  * Get the data from the record cache and return a pointer into that
  * cache.  Caller should copy the returned data.  NULL is returned on
@@ -198,12 +385,8 @@ get_record_from_cache (ulong recno)
 {
   CACHE_CTRL r;
 
-  for (r = cache_list; r; r = r->next)
-    {
-      if (r->flags.used && r->recno == recno)
-        return r->data;
-    }
-  return NULL;
+  r = cache_hash_lookup (recno);
+  return r? r->data : NULL;
 }
 
 
@@ -233,6 +416,8 @@ write_cache_item (CACHE_CTRL r)
                  r->recno, n, strerror (errno) );
       return err;
     }
+  if (r->flags.dirty)
+    cache_dirty_entries--;
   r->flags.dirty = 0;
   return 0;
 }
@@ -247,71 +432,45 @@ write_cache_item (CACHE_CTRL r)
 static int
 put_record_into_cache (ulong recno, const char *data)
 {
-  CACHE_CTRL r, unused;
-  int dirty_count = 0;
-  int clean_count = 0;
+  CACHE_CTRL r;
+  int dirty_count, clean_count;
 
   /* See whether we already cached this one.  */
-  for (unused = NULL, r = cache_list; r; r = r->next)
+  r = cache_hash_lookup (recno);
+  if (r)
     {
-      if (!r->flags.used)
-        {
-          if (!unused)
-            unused = r;
-	}
-      else if (r->recno == recno)
-        {
-          if (!r->flags.dirty)
-            {
-              /* Hmmm: should we use a copy and compare? */
-              if (memcmp (r->data, data, TRUST_RECORD_LEN))
-                {
-                  r->flags.dirty = 1;
-                  cache_is_dirty = 1;
-		}
-	    }
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          return 0;
-	}
-      if (r->flags.used)
-        {
-          if (r->flags.dirty)
-            dirty_count++;
-          else
-            clean_count++;
-	}
+      if (r->flags.dirty || memcmp (r->data, data, TRUST_RECORD_LEN))
+        cache_set_dirty (r, data);
+      return 0;
     }
 
   /* Not in the cache: add a new entry. */
-  if (unused)
+  if (cache_free_list)
     {
       /* Reuse this entry. */
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
+      r = cache_free_list;
+      cache_free_list = r->hnext;
+      cache_hash_insert (r, recno);
+      cache_set_dirty (r, data);
       return 0;
     }
 
   /* See whether we reached the limit. */
-  if (cache_entries < MAX_CACHE_ENTRIES_SOFT)
+  if (cache_entries < cache_max_entries)
     {
       /* No: Put into cache.  */
       r = xmalloc (sizeof *r);
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
+      r->flags.dirty = 0;
       r->next = cache_list;
       cache_list = r;
-      cache_is_dirty = 1;
-      cache_entries++;
+      cache_hash_insert (r, recno);
+      cache_set_dirty (r, data);
       return 0;
     }
 
+  dirty_count = cache_dirty_entries;
+  clean_count = cache_entries - cache_dirty_entries;
+
   /* Cache is full: discard some clean entries.  */
   if (clean_count)
     {
@@ -322,57 +481,54 @@ put_record_into_cache (ulong recno, const char *data)
       if (!n)
         n = 1;
 
-      for (unused = NULL, r = cache_list; r; r = r->next)
+      for (r = cache_list; r; r = r->next)
         {
           if (r->flags.used && !r->flags.dirty)
             {
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
+              cache_hash_remove (r);
               if (!--n)
                 break;
 	    }
 	}
 
       /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
+      log_assert (cache_free_list);
+      r = cache_free_list;
+      cache_free_list = r->hnext;
+      cache_hash_insert (r, recno);
+      cache_set_dirty (r, data);
       return 0;
     }
 
   /* No clean entries: We have to flush some dirty entries.  */
-#if 0 /* Transactions are not yet used.  */
   if (in_transaction)
     {
-      /* But we can't do this while in a transaction.  Thus we
-       * increase the cache size instead.  */
-      if (cache_entries < MAX_CACHE_ENTRIES_HARD)
+      int rc;
+
+      /* But we don't want to do this while in a transaction.  Thus
+       * we increase the cache size instead.  */
+      if (transaction_bulk || cache_entries < MAX_CACHE_ENTRIES_HARD)
         {
           if (opt.debug && !(cache_entries % 100))
             log_debug ("increasing tdbio cache size\n");
           r = xmalloc (sizeof *r);
-          r->flags.used = 1;
-          r->recno = recno;
-          memcpy (r->data, data, TRUST_RECORD_LEN);
-          r->flags.dirty = 1;
+          r->flags.dirty = 0;
           r->next = cache_list;
           cache_list = r;
-          cache_is_dirty = 1;
-          cache_entries++;
+          cache_hash_insert (r, recno);
+          cache_set_dirty (r, data);
           return 0;
 	}
-      /* Hard limit for the cache size reached.  */
-      log_info (_("trustdb transaction too large\n"));
-      return GPG_ERR_RESOURCE_LIMIT;
+      /* Hard limit for the cache size reached.  Commit the changes
+       * done so far and continue the transaction with a clean
+       * cache.  */
+      if (opt.verbose)
+        log_info (_("trustdb transaction too large - committing a part\n"));
+      rc = commit_cache ();
+      if (rc)
+        return rc;
+      return put_record_into_cache (recno, data);
     }
-#endif
 
   if (dirty_count)
     {
@@ -384,7 +540,7 @@ put_record_into_cache (ulong recno, const char *data)
         n = 1;
 
       take_write_lock ();
-      for (unused = NULL, r = cache_list; r; r = r->next)
+      for (r = cache_list; r; r = r->next)
         {
           if (r->flags.used && r->flags.dirty)
             {
@@ -393,10 +549,7 @@ put_record_into_cache (ulong recno, const char *data)
               rc = write_cache_item (r);
               if (rc)
                 return rc;
-              if (!unused)
-                unused = r;
-              r->flags.used = 0;
-              cache_entries--;
+              cache_hash_remove (r);
               if (!--n)
                 break;
 	    }
@@ -404,14 +557,11 @@ put_record_into_cache (ulong recno, const char *data)
       release_write_lock ();
 
       /* Now put into the cache.  */
-      log_assert (unused);
-      r = unused;
-      r->flags.used = 1;
-      r->recno = recno;
-      memcpy (r->data, data, TRUST_RECORD_LEN);
-      r->flags.dirty = 1;
-      cache_is_dirty = 1;
-      cache_entries++;
+      log_assert (cache_free_list);
+      r = cache_free_list;
+      cache_free_list = r->hnext;
+      cache_hash_insert (r, recno);
+      cache_set_dirty (r, data);
       return 0;
     }
 
@@ -429,7 +579,8 @@ tdbio_is_dirty()
 
 
 /*
- * Flush the cache.  This cannot be used while in a transaction.
+ * Flush the cache.  While in a transaction this does nothing; the
+ * records are written by tdbio_end_transaction.
  */
 int
 tdbio_sync()
@@ -439,10 +590,8 @@ tdbio_sync()
 
     if( db_fd == -1 )
 	open_db();
-#if 0 /* Transactions are not yet used.  */
     if( in_transaction )
-	log_bug("tdbio: syncing while in transaction\n");
-#endif
+	return 0;
 
     if( !cache_is_dirty )
 	return 0;
@@ -450,7 +599,7 @@ tdbio_sync()
     if (!take_write_lock ())
         did_lock = 1;
 
-    for( r = cache_list; r; r = r->next ) {
+    for( r = cache_list; r && cache_dirty_entries; r = r->next ) {
 	if( r->flags.used && r->flags.dirty ) {
 	    int rc = write_cache_item( r );
 	    if( rc )
@@ -465,73 +614,374 @@ tdbio_sync()
 }
 
 
-#if 0  /* Not yet used.  */
+/* Flush the file descriptor FD to the disk.  Returns 0 on success
+ * and -1 with ERRNO set on error.  */
+static int
+sync_fd (int fd)
+{
+#if defined(HAVE_W32CE_SYSTEM)
+  if (!FlushFileBuffers ((HANDLE)fd))
+    {
+      gpg_err_set_errno (EIO);
+      return -1;
+    }
+  return 0;
+#elif defined(HAVE_W32_SYSTEM)
+  if (!FlushFileBuffers ((HANDLE)_get_osfhandle (fd)))
+    {
+      gpg_err_set_errno (EIO);
+      return -1;
+    }
+  return 0;
+#else
+  return fsync (fd);
+#endif
+}
+
+
+/* Write all dirty records of the cache to the journal FNAME and
+ * flush it to the disk.  */
+static gpg_error_t
+write_journal (const char *fname)
+{
+  gpg_error_t err = 0;
+  CACHE_CTRL r;
+  byte *buffer, *p;
+  size_t len, n;
+  ssize_t nwritten;
+  int fd;
+
+  len = (JOURNAL_MAGICLEN + 4 + cache_dirty_entries * JOURNAL_ITEMLEN
+         + JOURNAL_HASHLEN);
+  buffer = xtrymalloc (len);
+  if (!buffer)
+    return gpg_error_from_syserror ();
+  memcpy (buffer, JOURNAL_MAGIC, JOURNAL_MAGICLEN);
+  p = buffer + JOURNAL_MAGICLEN;
+  ulongtobuf (p, cache_dirty_entries);
+  p += 4;
+  for (r = cache_list; r; r = r->next)
+    if (r->flags.used && r->flags.dirty)
+      {
+        ulongtobuf (p, r->recno);
+        memcpy (p + 4, r->data, TRUST_RECORD_LEN);
+        p += JOURNAL_ITEMLEN;
+      }
+  log_assert (p + JOURNAL_HASHLEN == buffer + len);
+  gcry_md_hash_buffer (GCRY_MD_SHA1, p, buffer, p - buffer);
+
+  fd = open (fname, O_WRONLY | O_CREAT | O_TRUNC | MY_O_BINARY,
+             S_IRUSR | S_IWUSR);
+  if (fd == -1)
+    {
+      err = gpg_error_from_syserror ();
+      log_error (_("can't create '%s': %s\n"), fname, gpg_strerror (err));
+      goto leave;
+    }
+  for (p = buffer, n = len; n; p += nwritten, n -= nwritten)
+    {
+      nwritten = write (fd, p, n);
+      if (nwritten < 0)
+        {
+          if (errno == EINTR)
+            {
+              nwritten = 0;
+              continue;
+            }
+          err = gpg_error_from_syserror ();
+          break;
+        }
+    }
+  if (!err && sync_fd (fd))
+    err = gpg_error_from_syserror ();
+  if (close (fd) && !err)
+    err = gpg_error_from_syserror ();
+  if (err)
+    {
+      log_error (_("error writing '%s': %s\n"), fname, gpg_strerror (err));
+      gnupg_remove (fname);
+    }
+
+ leave:
+  xfree (buffer);
+  return err;
+}
+
+
+/*
+ * Write all dirty records of the cache to the trustdb.  If more than
+ * one record is to be written, they are first written to the journal
+ * so that a crash can't leave a partly updated trustdb; the journal
+ * is applied again by open_db.  The caller must hold the lock.
+ *
+ * Returns: 0 on success or an error code.
+ */
+static int
+commit_cache (void)
+{
+  CACHE_CTRL r;
+  char *jname = NULL;
+  int rc = 0;
+
+  if (!cache_is_dirty)
+    return 0;
+
+  if (cache_dirty_entries > 1)
+    {
+      jname = strconcat (db_name, JOURNAL_SUFFIX, NULL);
+      rc = write_journal (jname);
+      if (rc)
+        {
+          xfree (jname);
+          return rc;
+        }
+    }
+
+  gnupg_block_all_signals ();
+  for (r = cache_list; r && cache_dirty_entries; r = r->next)
+    {
+      if (r->flags.used && r->flags.dirty)
+        {
+          rc = write_cache_item (r);
+          if (rc)
+            break;
+        }
+    }
+  if (!rc && jname)
+    {
+      if (sync_fd (db_fd))
+        {
+          rc = gpg_error_from_syserror ();
+          log_error (_("%s: error flushing trustdb: %s\n"),
+                     db_name, gpg_strerror (rc));
+        }
+      else
+        gnupg_remove (jname);
+    }
+  if (!rc)
+    cache_is_dirty = 0;
+  gnupg_unblock_all_signals ();
+
+  xfree (jname);
+  return rc;
+}
+
+
+/*
+ * Apply a journal left over by a crashed process.  A journal which
+ * has not completely been written is removed without applying it.
+ * On a write error the process is terminated.
+ */
+static void
+replay_journal (void)
+{
+  char *fname;
+  int fd = -1;
+  struct stat st;
+  byte *buffer = NULL;
+  const byte *p;
+  byte digest[JOURNAL_HASHLEN];
+  size_t len, n;
+  ssize_t nread;
+  ulong count, recno;
+
+  fname = strconcat (db_name, JOURNAL_SUFFIX, NULL);
+  if (access (fname, F_OK))
+    {
+      xfree (fname);
+      return;  /* The usual case.  */
+    }
+
+  /* Take the lock before opening the journal, so that we don't see
+   * a journal which is just being written or has just been applied
+   * by another process.  */
+  take_write_lock ();
+  fd = open (fname, O_RDONLY | MY_O_BINARY);
+  if (fd == -1)
+    goto leave;
+  if (fstat (fd, &st))
+    log_fatal (_("can't stat '%s': %s\n"), fname, strerror (errno));
+  len = st.st_size;
+  if (len < JOURNAL_MAGICLEN + 4 + JOURNAL_HASHLEN)
+    goto incomplete;
+  buffer = xmalloc (len);
+  for (n = 0; n < len; n += nread)
+    {
+      nread = read (fd, buffer + n, len - n);
+      if (nread < 0 && errno == EINTR)
+        nread = 0;
+      else if (nread < 0)
+        log_fatal (_("error reading '%s': %s\n"), fname, strerror (errno));
+      else if (!nread)
+        goto incomplete;
+    }
+  count = buf32_to_ulong (buffer + JOURNAL_MAGICLEN);
+  if (memcmp (buffer, JOURNAL_MAGIC, JOURNAL_MAGICLEN)
+      || count > (len - JOURNAL_MAGICLEN - 4 - JOURNAL_HASHLEN)
+                 / JOURNAL_ITEMLEN
+      || len != (JOURNAL_MAGICLEN + 4 + count * JOURNAL_ITEMLEN
+                 + JOURNAL_HASHLEN))
+    goto incomplete;
+  gcry_md_hash_buffer (GCRY_MD_SHA1, digest, buffer, len - JOURNAL_HASHLEN);
+  if (memcmp (digest, buffer + len - JOURNAL_HASHLEN, JOURNAL_HASHLEN))
+    goto incomplete;
+
+  p = buffer + JOURNAL_MAGICLEN + 4;
+  for (; count; count--, p += JOURNAL_ITEMLEN)
+    {
+      recno = buf32_to_ulong (p);
+      if (lseek (db_fd, (off_t)recno * TRUST_RECORD_LEN, SEEK_SET) == -1
+          || write (db_fd, p + 4, TRUST_RECORD_LEN) != TRUST_RECORD_LEN)
+        log_fatal (_("trustdb rec %lu: write failed: %s\n"),
+                   recno, strerror (errno));
+    }
+  if (sync_fd (db_fd))
+    log_fatal (_("%s: error flushing trustdb: %s\n"),
+               db_name, strerror (errno));
+  log_info (_("%s: unfinished transaction has been completed\n"), db_name);
+  goto remove;
+
+ incomplete:
+  if (opt.verbose)
+    log_info (_("%s: discarding incomplete journal\n"), db_name);
+ remove:
+  close (fd);
+  fd = -1;
+  gnupg_remove (fname);
+
+ leave:
+  if (fd != -1)
+    close (fd);
+  xfree (buffer);
+  release_write_lock ();
+  xfree (fname);
+}
+
+
 /*
  * Simple transactions system:
  * Everything between begin_transaction and end/cancel_transaction
  * is not immediately written but at the time of end_transaction.
- *
- * NOTE: The transaction code is disabled in the 1.2 branch, as it is
- * not yet used.
+ * The lock is held during the entire transaction.  Transactions may
+ * be nested; only the outermost one writes the records.  If a
+ * transaction grows beyond MAX_CACHE_ENTRIES_HARD records, the part
+ * done so far is committed and can't be canceled anymore.
+ */
+int
+tdbio_begin_transaction ()
+{
+  return begin_transaction (0);
+}
+
+
+/*
+ * Same as tdbio_begin_transaction but the outermost transaction is
+ * never committed in parts; all changes are kept in memory until
+ * tdbio_end_transaction writes them with one journal.  This is meant
+ * for bulk updates like --import-ownertrust.
  */
 int
-tdbio_begin_transaction ()  /* Not yet used.  */
+tdbio_begin_bulk_transaction ()
+{
+  return begin_transaction (1);
+}
+
+
+static int
+begin_transaction (int bulk)
 {
   int rc;
 
   if (in_transaction)
-    log_bug ("tdbio: nested transactions\n");
+    {
+      in_transaction++;
+      return 0;
+    }
+
   /* Flush everything out. */
   rc = tdbio_sync();
   if (rc)
     return rc;
+  if (!db_readonly)
+    {
+      take_write_lock ();
+      transaction_locked = 1;
+    }
   in_transaction = 1;
+  transaction_canceled = 0;
+  transaction_bulk = bulk;
   return 0;
 }
 
+
+/* Discard all dirty marked entries, so that the original ones are
+ * read back the next time.  */
+static void
+discard_dirty_entries (void)
+{
+  CACHE_CTRL r;
+
+  if (cache_is_dirty)
+    {
+      for (r = cache_list; r; r = r->next)
+        {
+          if (r->flags.used && r->flags.dirty)
+            cache_hash_remove (r);
+	}
+      cache_is_dirty = 0;
+    }
+}
+
+
 int
-tdbio_end_transaction ()  /* Not yet used.  */
+tdbio_end_transaction ()
 {
   int rc;
 
   if (!in_transaction)
     log_bug ("tdbio: no active transaction\n");
-  take_write_lock ();
-  gnupg_block_all_signals ();
-  in_transaction = 0;
-  rc = tdbio_sync();
-  gnupg_unblock_all_signals();
-  release_write_lock ();
+  if (--in_transaction)
+    return 0;
+
+  transaction_bulk = 0;
+  if (transaction_canceled)
+    {
+      discard_dirty_entries ();
+      rc = gpg_error (GPG_ERR_CANCELED);
+    }
+  else if (!transaction_locked)
+    rc = tdbio_sync ();
+  else
+    rc = commit_cache ();
+  if (transaction_locked)
+    {
+      transaction_locked = 0;
+      release_write_lock ();
+    }
   return rc;
 }
 
+
 int
-tdbio_cancel_transaction () /* Not yet used.  */
+tdbio_cancel_transaction ()
 {
-  CACHE_CTRL r;
-
   if (!in_transaction)
     log_bug ("tdbio: no active transaction\n");
-
-  /* Remove all dirty marked entries, so that the original ones are
-   * read back the next time.  */
-  if (cache_is_dirty)
+  if (--in_transaction)
     {
-      for (r = cache_list; r; r = r->next)
-        {
-          if (r->flags.used && r->flags.dirty)
-            {
-              r->flags.used = 0;
-              cache_entries--;
-	    }
-	}
-      cache_is_dirty = 0;
+      transaction_canceled = 1;
+      return 0;
     }
 
-  in_transaction = 0;
+  transaction_bulk = 0;
+  discard_dirty_entries ();
+  if (transaction_locked)
+    {
+      transaction_locked = 0;
+      release_write_lock ();
+    }
   return 0;
 }
-#endif  /* Not yet used.  */
 
 
 
@@ -755,6 +1205,12 @@ tdbio_set_dbname (ctrl_t ctrl, const char *new_dbname,
       if (db_fd == -1)
         log_fatal (_("can't open '%s': %s\n"), db_name, strerror (errno));
 
+      /* A journal left over from a former trustdb must not be
+       * applied to the new one.  */
+      p = strconcat (db_name, JOURNAL_SUFFIX, NULL);
+      gnupg_remove (p);
+      xfree (p);
+
       rc = create_version_record (ctrl);
       if (rc)
         log_fatal (_("%s: failed to create version record: %s"),
@@ -783,6 +1239,75 @@ tdbio_get_dbname ()
 }
 
 
+/*
+ * Prepare the trustdb for use by a process forked from the current
+ * process.  The open trustdb shares its file offset with the parent;
+ * thus the file is opened again using the same descriptor.
+ */
+void
+tdbio_prepare_worker (void)
+{
+#ifndef HAVE_W32_SYSTEM
+  int fd;
+
+  if (db_fd == -1)
+    return;
+
+  fd = open (db_name, (db_readonly? O_RDONLY : O_RDWR) | MY_O_BINARY);
+  if (fd == -1)
+    log_fatal (_("can't open '%s': %s\n"), db_name, strerror (errno));
+  if (dup2 (fd, db_fd) == -1)
+    log_fatal ("trustdb: dup2 failed: %s\n", strerror (errno));
+  close (fd);
+#endif /*!HAVE_W32_SYSTEM*/
+}
+
+
+#ifdef USE_DB_MAP
+/*
+ * Map the trustdb or extend the mapping to the current size of the
+ * file.  On error the mapping is disabled.
+ */
+static void
+update_db_map (void)
+{
+  struct stat st;
+  size_t len;
+  void *p;
+
+  if (fstat (db_fd, &st))
+    {
+      db_map_failed = 1;
+      return;
+    }
+  len = st.st_size - (st.st_size % TRUST_RECORD_LEN);
+  if (len <= db_mapsize)
+    {
+      /* The pages beyond the end of the file are already mapped.  */
+      if (len > db_maplen)
+        db_maplen = len;
+      return;
+    }
+
+  if (db_map)
+    munmap ((void*)db_map, db_mapsize);
+  db_map = NULL;
+  db_maplen = db_mapsize = 0;
+  p = mmap (NULL, len + DB_MAP_HEADROOM, PROT_READ, MAP_SHARED, db_fd, 0);
+  if (p == MAP_FAILED)
+    {
+      if (opt.verbose)
+        log_info ("can't map '%s': %s\n", db_name, strerror (errno));
+      db_map_failed = 1;
+      return;
+    }
+  db_map = p;
+  db_maplen = len;
+  db_mapsize = len + DB_MAP_HEADROOM;
+}
+#endif /*USE_DB_MAP*/
+
+
 /*
  * Open the trustdb.  This may only be called if it has not yet been
  * opened and after a successful call to tdbio_set_dbname.  On return
@@ -822,10 +1347,13 @@ open_db ()
       db_fd = open (db_name, O_RDONLY | MY_O_BINARY );
       if (db_fd != -1 && !opt.quiet)
           log_info (_("Note: trustdb not writable\n"));
+      db_readonly = 1;
   }
   if ( db_fd == -1 )
     log_fatal( _("can't open '%s': %s\n"), db_name, strerror(errno) );
 #endif /*!HAVE_W32CE_SYSTEM*/
+  if (!db_readonly)
+    replay_journal ();
   register_secured_file (db_name);
 
   /* Read the version record. */
@@ -870,10 +1398,12 @@ create_hashtable (ctrl_t ctrl, TRUSTREC *vr, int type)
         log_fatal (_("%s: failed to create hashtable: %s\n"),
                    db_name, gpg_strerror (rc));
     }
-  /* Update the version record and flush. */
+  /* Update the version record and flush.  Within a transaction we
+   * need to commit right now because new records are allocated at
+   * the end of the file.  */
   rc = tdbio_write_record (ctrl, vr);
   if (!rc)
-    rc = tdbio_sync ();
+    rc = in_transaction? commit_cache () : tdbio_sync ();
   if (rc)
     log_fatal (_("%s: error updating version record: %s\n"),
                db_name, gpg_strerror (rc));
@@ -1416,6 +1946,125 @@ lookup_hashtable (ulong table, const byte *key, size_t keylen,
 }
 
 
+/*
+ * An in-memory index of the trust records.  It is an open addressed
+ * hash table keyed by the fingerprint and is only used while we hold
+ * the lock: Then no other process can change the trustdb and thus
+ * the index is authoritative; a search needs to read just the trust
+ * record instead of walking the hash table records.  The index is
+ * built after TRUST_INDEX_THRESHOLD searches and released with the
+ * lock.
+ */
+static void
+trust_index_release (void)
+{
+  xfree (trust_index);
+  trust_index = NULL;
+  trust_index_size = trust_index_used = 0;
+  trust_index_searches = 0;
+}
+
+
+/* Return the slot for FPR; that is either the slot with FPR or the
+ * empty slot where it would be inserted.  */
+static struct trust_index_item *
+trust_index_slot (const byte *fpr)
+{
+  size_t idx;
+  struct trust_index_item *item;
+
+  idx = buf32_to_size_t (fpr) & (trust_index_size - 1);
+  for (;;)
+    {
+      item = trust_index + idx;
+      if (!item->recnum
+          || (item->recnum != TRUST_INDEX_DELETED
+              && !memcmp (item->fpr, fpr, 20)))
+        return item;
+      idx = (idx + 1) & (trust_index_size - 1);
+    }
+}
+
+
+/* Add FPR with RECNUM to the index.  On error the index is
+ * released.  */
+static void
+trust_index_add (const byte *fpr, ulong recnum)
+{
+  struct trust_index_item *item;
+
+  if ((trust_index_used + 1) * 2 > trust_index_size)
+    {
+      struct trust_index_item *oldindex = trust_index;
+      size_t oldsize = trust_index_size;
+      size_t idx;
+
+      trust_index = xtrycalloc (oldsize * 2, sizeof *trust_index);
+      if (!trust_index)
+        {
+          trust_index = oldindex;
+          trust_index_release ();
+          return;
+        }
+      trust_index_size = oldsize * 2;
+      trust_index_used = 0;
+      for (idx = 0; idx < oldsize; idx++)
+        if (oldindex[idx].recnum
+            && oldindex[idx].recnum != TRUST_INDEX_DELETED)
+          {
+            *trust_index_slot (oldindex[idx].fpr) = oldindex[idx];
+            trust_index_used++;
+          }
+      xfree (oldindex);
+    }
+
+  item = trust_index_slot (fpr);
+  if (item->recnum)
+    return;  /* Already known.  */
+  memcpy (item->fpr, fpr, 20);
+  item->recnum = recnum;
+  trust_index_used++;
+}
+
+
+/* Build the index from all trust records.  */
+static void
+build_trust_index (void)
+{
+  struct stat st;
+  ulong recnum, nrecs;
+  TRUSTREC rec;
+
+  if (fstat (db_fd, &st))
+    return;
+  nrecs = st.st_size / TRUST_RECORD_LEN;
+
+  trust_index_size = 1024;
+  while (trust_index_size < nrecs)
+    trust_index_size *= 2;
+  trust_index = xtrycalloc (trust_index_size, sizeof *trust_index);
+  if (!trust_index)
+    {
+      trust_index_release ();
+      return;
+    }
+
+  for (recnum = 1; recnum < nrecs && trust_index; recnum++)
+    {
+      if (tdbio_read_record (recnum, &rec, 0))
+        {
+          trust_index_release ();
+          return;
+        }
+      if (rec.rectype == RECTYPE_TRUST)
+        trust_index_add (rec.r.trust.fingerprint, recnum);
+    }
+  if (trust_index && DBG_TRUST)
+    log_debug ("tdbio: indexed %lu trust records\n",
+               (unsigned long)trust_index_used);
+}
+
+
 /*
  * Update the trust hash table TR or create the table if it does not
  * exist.
@@ -1522,6 +2171,15 @@ tdbio_read_record (ulong recnum, TRUSTREC *rec, int expected)
     open_db ();
 
   buf = get_record_from_cache( recnum );
+#ifdef USE_DB_MAP
+  if (!buf && !db_map_failed)
+    {
+      if ((recnum + 1) * TRUST_RECORD_LEN > db_maplen)
+        update_db_map ();
+      if ((recnum + 1) * TRUST_RECORD_LEN <= db_maplen)
+        buf = db_map + recnum * TRUST_RECORD_LEN;
+    }
+#endif /*USE_DB_MAP*/
   if (!buf)
     {
       if (lseek (db_fd, recnum * TRUST_RECORD_LEN, SEEK_SET) == -1)
@@ -1744,7 +2402,16 @@ tdbio_write_record (ctrl_t ctrl, TRUSTREC *rec)
   if (rc)
     ;
   else if (rec->rectype == RECTYPE_TRUST)
-    rc = update_trusthashtbl (ctrl, rec);
+    {
+      /* A trust record in the index is already in the hash table.  */
+      if (!trust_index
+          || trust_index_slot (rec->r.trust.fingerprint)->recnum != recnum)
+        {
+          rc = update_trusthashtbl (ctrl, rec);
+          if (!rc && trust_index)
+            trust_index_add (rec->r.trust.fingerprint, recnum);
+        }
+    }
 
   return rc;
 }
@@ -1769,6 +2436,14 @@ tdbio_delete_record (ctrl_t ctrl, ulong recnum)
     {
       rc = drop_from_hashtable (ctrl, get_trusthashrec (ctrl),
                                 rec.r.trust.fingerprint, 20, rec.recnum);
+      if (trust_index)
+        {
+          struct trust_index_item *item;
+
+          item = trust_index_slot (rec.r.trust.fingerprint);
+          if (item->recnum == recnum)
+            item->recnum = TRUST_INDEX_DELETED;
+        }
     }
 
   if (rc)
@@ -1893,6 +2568,23 @@ tdbio_search_trust_byfpr (ctrl_t ctrl, const byte *fingerprint, TRUSTREC *rec)
 {
   int rc;
 
+  if (!trust_index && is_locked
+      && ++trust_index_searches == TRUST_INDEX_THRESHOLD)
+    build_trust_index ();
+  if (trust_index)
+    {
+      struct trust_index_item *item = trust_index_slot (fingerprint);
+
+      if (!item->recnum)
+        return gpg_error (GPG_ERR_NOT_FOUND);
+      rc = tdbio_read_record (item->recnum, rec, 0);
+      if (!rc && cmp_trec_fpr (fingerprint, rec))
+        return 0;
+      /* The index is out of sync; don't use it anymore.  */
+      trust_index_release ();
+      trust_index_searches = TRUST_INDEX_THRESHOLD;
+    }
+
   /* Locate the trust record using the hash table */
   rc = lookup_hashtable (get_trusthashrec (ctrl), fingerprint, 20,
                          cmp_trec_fpr, fingerprint, rec );
@@ -106,6 +106,7 @@ int tdbio_write_nextcheck (ctrl_t ctrl, ulong stamp);
 int tdbio_is_dirty(void);
 int tdbio_sync(void);
 int tdbio_begin_transaction(void);
+int tdbio_begin_bulk_transaction(void);
 int tdbio_end_transaction(void);
 int tdbio_cancel_transaction(void);
 int tdbio_delete_record (ctrl_t ctrl, ulong recnum);
@@ -115,6 +116,7 @@ gpg_error_t tdbio_search_trust_byfpr (ctrl_t ctrl, const byte *fingerprint,
 gpg_error_t tdbio_search_trust_bypk (ctrl_t ctrl, PKT_public_key *pk,
                                      TRUSTREC *rec);
 
+void tdbio_prepare_worker (void);
 void tdbio_how_to_fix (void);
 void tdbio_invalid(void);
 
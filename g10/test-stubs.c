@@ -458,6 +458,16 @@ agent_probe_any_secret_key (ctrl_t ctrl, kbnode_t keyblock)
   return gpg_error (GPG_ERR_NO_SECKEY);
 }
 
+void
+agent_begin_keyinfo_batch (void)
+{
+}
+
+void
+agent_end_keyinfo_batch (void)
+{
+}
+
 gpg_error_t
 agent_get_keyinfo (ctrl_t ctrl, const char *hexkeygrip,
                    char **r_serialno, int *r_cleartext)
@@ -61,6 +61,39 @@
    To initialize this or get the current singleton, call opendbs().
    There is no need to explicitly release it; cleanup is done when the
    CTRL object is released.  */
+
+/* An item of the memo of effective policies.  KEY is the fingerprint
+ * and the email address separated by a space.  */
+struct policy_memo_s
+{
+  struct policy_memo_s *next;
+  enum tofu_policy policy;
+  char key[1];
+};
+
+/* The number of buckets of the policy memo and the maximum number of
+ * items after which the memo is flushed.  */
+#define POLICY_MEMO_BUCKETS 1021
+#define POLICY_MEMO_MAX     (16 * POLICY_MEMO_BUCKETS)
+
+/* A signature observation which has not yet been written to the
+ * database.  The strings are stored in BUFFER.  */
+struct pending_sig_s
+{
+  struct pending_sig_s *next;
+  time_t sig_time;
+  time_t time;
+  char *fingerprint;
+  char *email;
+  char *sig_digest;
+  char *origin;
+  char buffer[1];
+};
+
+/* The number of queued signature observations which triggers a
+ * flush.  */
+#define PENDING_SIGS_MAX 256
+
 struct tofu_dbs_s
 {
   sqlite3 *db;
@@ -82,8 +115,20 @@ struct tofu_dbs_s
     sqlite3_stmt *register_already_seen;
     sqlite3_stmt *register_signature;
     sqlite3_stmt *register_encryption;
+    sqlite3_stmt *notice_key_changed;
   } s;
 
+  /* The effective policies computed by get_policy for bindings which
+   * need no interaction.  These are valid as long as this process
+   * does not change the bindings table.  */
+  struct policy_memo_s *policy_memo[POLICY_MEMO_BUCKETS];
+  unsigned int policy_memo_count;
+
+  /* The queue of signature observations; see flush_pending_sigs.  */
+  struct pending_sig_s *pending_sigs;
+  struct pending_sig_s **pending_sigs_tail;
+  unsigned int npending_sigs;
+
   int in_batch_transaction;
   int in_transaction;
   time_t batch_update_started;
@@ -110,6 +155,7 @@ struct tofu_dbs_s
 
 /* Local prototypes.  */
 static gpg_error_t end_transaction (ctrl_t ctrl, int only_batch);
+static gpg_error_t flush_pending_sigs (tofu_dbs_t dbs);
 static char *email_from_user_id (const char *user_id);
 static int show_statistics (tofu_dbs_t dbs,
                             const char *fingerprint, const char *email,
@@ -656,6 +702,75 @@ check_utks (sqlite3 *db)
   return rc;
 }
 
+/* The SQL to create a summary of the signatures or encryptions
+ * TABLE for each binding.  The summary holds the number of rows, the
+ * first and the last time, and the number of distinct days.  It is
+ * maintained by a trigger so that it stays correct if an older
+ * version of gpg, which does not know about it, updates the database.
+ * The index on (binding, time) makes the trigger's check whether a
+ * row for the same day exists a simple lookup.  */
+#define SUMMARY_SQL(table)                                             \
+  "create index if not exists " table "_binding_time\n"                 \
+  " on " table " (binding, time);\n"                                    \
+  "create table " table "_summary\n"                                    \
+  " (binding INTEGER PRIMARY KEY, n INTEGER,\n"                         \
+  "  first_time INTEGER, last_time INTEGER, ndays INTEGER);\n"          \
+  "insert into " table "_summary\n"                                     \
+  " select binding, count (*), min (time), max (time),\n"              \
+  "   count (distinct time / (24 * 60 * 60))\n"                         \
+  "  from " table " group by binding;\n"                                \
+  "create trigger " table "_summary_insert after insert on " table "\n" \
+  " begin\n"                                                            \
+  "  insert or ignore into " table "_summary\n"                         \
+  "   values (new.binding, 0, new.time, new.time, 0);\n"                \
+  "  update " table "_summary set\n"                                    \
+  "    n = n + 1,\n"                                                    \
+  "    first_time = min (first_time, new.time),\n"                      \
+  "    last_time = max (last_time, new.time),\n"                        \
+  "    ndays = ndays + not exists\n"                                    \
+  "     (select 1 from " table "\n"                                     \
+  "       where binding = new.binding\n"                                \
+  "        and time >= new.time / (24 * 60 * 60) * (24 * 60 * 60)\n"    \
+  "        and time < (new.time / (24 * 60 * 60) + 1) * (24 * 60 * 60)\n" \
+  "        and rowid != new.rowid)\n"                                   \
+  "   where binding = new.binding;\n"                                   \
+  " end;\n"
+
+
+/* Create the summary for TABLE unless it already exists.  Returns 0
+ * on success.  */
+static int
+create_summary (sqlite3 *db, const char *table, const char *sql)
+{
+  char *err = NULL;
+  unsigned long count;
+  int rc;
+
+  rc = gpgsql_exec_printf (db, get_single_unsigned_long_cb, &count, &err,
+                           "select count (*) from sqlite_master"
+                           " where type = 'table' and name = '%q_summary';",
+                           table);
+  if (rc)
+    {
+      log_error (_("error reading TOFU database: %s\n"), err);
+      print_further_info ("checking for %s_summary", table);
+      sqlite3_free (err);
+      return rc;
+    }
+  if (count)
+    return 0;
+
+  rc = sqlite3_exec (db, sql, NULL, NULL, &err);
+  if (rc)
+    {
+      log_error (_("error initializing TOFU database: %s\n"), err);
+      print_further_info ("create %s_summary", table);
+      sqlite3_free (err);
+    }
+  return rc;
+}
+
+
 /* If the DB is new, initialize it.  Otherwise, check the DB's
    version.
 
@@ -876,6 +991,11 @@ initdb (sqlite3 *db)
 	}
     }
 
+  if (! rc)
+    rc = create_summary (db, "signatures", SUMMARY_SQL ("signatures"));
+  if (! rc)
+    rc = create_summary (db, "encryptions", SUMMARY_SQL ("encryptions"));
+
   if (! rc)
     rc = check_utks (db);
 
@@ -989,6 +1109,85 @@ opendbs (ctrl_t ctrl)
 }
 
 
+/* Return the bucket of DBS's policy memo for <FINGERPRINT, EMAIL>.  */
+static struct policy_memo_s **
+policy_memo_bucket (tofu_dbs_t dbs, const char *fingerprint, const char *email)
+{
+  const unsigned char *s;
+  unsigned int hash = 0;
+
+  for (s = (const unsigned char *)fingerprint; *s; s++)
+    hash = hash * 33 + *s;
+  for (s = (const unsigned char *)email; *s; s++)
+    hash = hash * 33 + *s;
+  return &dbs->policy_memo[hash % POLICY_MEMO_BUCKETS];
+}
+
+
+/* Return the memo item for the binding <FINGERPRINT, EMAIL> or NULL
+ * if there is none.  */
+static struct policy_memo_s *
+policy_memo_lookup (tofu_dbs_t dbs, const char *fingerprint, const char *email)
+{
+  struct policy_memo_s *memo;
+  size_t fprlen = strlen (fingerprint);
+
+  for (memo = *policy_memo_bucket (dbs, fingerprint, email);
+       memo; memo = memo->next)
+    if (!strncmp (memo->key, fingerprint, fprlen)
+        && memo->key[fprlen] == ' '
+        && !strcmp (memo->key + fprlen + 1, email))
+      return memo;
+  return NULL;
+}
+
+
+/* Forget all memorized policies.  This needs to be called whenever
+ * the bindings table is changed.  */
+static void
+policy_memo_flush (tofu_dbs_t dbs)
+{
+  struct policy_memo_s *memo, *next;
+  int i;
+
+  if (!dbs->policy_memo_count)
+    return;
+  for (i = 0; i < POLICY_MEMO_BUCKETS; i++)
+    {
+      for (memo = dbs->policy_memo[i]; memo; memo = next)
+        {
+          next = memo->next;
+          xfree (memo);
+        }
+      dbs->policy_memo[i] = NULL;
+    }
+  dbs->policy_memo_count = 0;
+}
+
+
+/* Memorize the effective POLICY of the binding <FINGERPRINT, EMAIL>.  */
+static void
+policy_memo_put (tofu_dbs_t dbs, const char *fingerprint, const char *email,
+                 enum tofu_policy policy)
+{
+  struct policy_memo_s **bucket;
+  struct policy_memo_s *memo;
+
+  if (dbs->policy_memo_count >= POLICY_MEMO_MAX)
+    policy_memo_flush (dbs);
+
+  memo = xtrymalloc (sizeof *memo + strlen (fingerprint) + strlen (email) + 1);
+  if (!memo)
+    return;  /* The memo is only an optimization.  */
+  strcpy (stpcpy (stpcpy (memo->key, fingerprint), " "), email);
+  memo->policy = policy;
+  bucket = policy_memo_bucket (dbs, fingerprint, email);
+  memo->next = *bucket;
+  *bucket = memo;
+  dbs->policy_memo_count++;
+}
+
+
 /* Release all of the resources associated with the DB handle.  */
 void
 tofu_closedbs (ctrl_t ctrl)
@@ -1002,6 +1201,7 @@ tofu_closedbs (ctrl_t ctrl)
 
   log_assert (dbs->in_transaction == 0);
 
+  flush_pending_sigs (dbs);
   end_transaction (ctrl, 2);
 
   /* Arghh, that is a surprising use of the struct.  */
@@ -1010,6 +1210,7 @@ tofu_closedbs (ctrl_t ctrl)
        statements ++)
     sqlite3_finalize (*statements);
 
+  policy_memo_flush (dbs);
   sqlite3_close (dbs->db);
   xfree (dbs->want_lock_file);
   xfree (dbs);
@@ -1112,6 +1313,7 @@ record_binding (tofu_dbs_t dbs, const char *fingerprint, const char *email,
       goto leave;
     }
 
+  policy_memo_flush (dbs);
   rc = gpgsql_stepx
     (dbs->db, &dbs->s.record_binding_update, NULL, NULL, &err,
      "insert or replace into bindings\n"
@@ -1677,6 +1879,7 @@ ask_about_binding (ctrl_t ctrl,
 
       /* Use the time when we saw the signature, not when the
          signature was created as that can be forged.  */
+      flush_pending_sigs (dbs);
       rc = gpgsql_stepx
         (dbs->db, &dbs->s.get_trust_gather_signature_stats,
          signature_stats_collect_cb, &stats, &sqerr,
@@ -2337,6 +2540,17 @@ get_policy (ctrl_t ctrl, tofu_dbs_t dbs, PKT_public_key *pk,
   char *conflict = NULL;
   strlist_t conflict_set = NULL;
   int conflict_set_count;
+  struct policy_memo_s *memo;
+
+  /* Bindings which need no interaction have been registered when
+   * they were memorized.  */
+  memo = policy_memo_lookup (dbs, fingerprint, email);
+  if (memo)
+    {
+      if (conflict_setp)
+        *conflict_setp = NULL;
+      return memo->policy;
+    }
 
   /* Check if the <FINGERPRINT, EMAIL> binding is known
      (TOFU_POLICY_NONE cannot appear in the DB.  Thus, if POLICY is
@@ -2613,10 +2827,19 @@ get_policy (ctrl_t ctrl, tofu_dbs_t dbs, PKT_public_key *pk,
       if (record_binding (dbs, fingerprint, email, user_id,
                           policy == TOFU_POLICY_NONE ? TOFU_POLICY_AUTO : policy,
                           effective_policy, conflict, 1, 0, now) != 0)
-        log_error ("error setting TOFU binding's policy"
+        {
+          log_error ("error setting TOFU binding's policy"
                      " to %s\n", tofu_policy_str (policy));
+          effective_policy_orig = _tofu_GET_POLICY_ERROR;
+        }
     }
 
+  /* A conflict needs to be rechecked each time.  */
+  if (effective_policy != _tofu_GET_POLICY_ERROR
+      && effective_policy != TOFU_POLICY_ASK
+      && effective_policy_orig != _tofu_GET_POLICY_ERROR)
+    policy_memo_put (dbs, fingerprint, email, effective_policy);
+
   /* If the caller wants the set of conflicts, return it.  */
   if (effective_policy == TOFU_POLICY_ASK && conflict_setp)
     {
@@ -2814,6 +3037,7 @@ get_trust (ctrl_t ctrl, PKT_public_key *pk,
    * the current key.  */
   log_assert (conflict_set);
 
+  policy_memo_flush (dbs);
   for (iter = conflict_set->next; iter; iter = iter->next)
     {
       /* We don't immediately set the effective policy to 'ask,
@@ -3008,12 +3232,12 @@ show_statistics (tofu_dbs_t dbs,
   fingerprint_pp = format_hexfingerprint (fingerprint, NULL, 0);
 
   /* Get the signature stats.  */
+  flush_pending_sigs (dbs);
   rc = gpgsql_exec_printf
     (dbs->db, strings_collect_cb, &strlist, &err,
-     "select count (*), coalesce (min (signatures.time), 0),\n"
-     "  coalesce (max (signatures.time), 0)\n"
-     " from signatures\n"
-     " left join bindings on signatures.binding = bindings.oid\n"
+     "select ndays, n, first_time, last_time\n"
+     " from signatures_summary\n"
+     " join bindings on signatures_summary.binding = bindings.oid\n"
      " where fingerprint = %Q and email = %Q;",
      fingerprint, email);
   if (rc)
@@ -3024,23 +3248,6 @@ show_statistics (tofu_dbs_t dbs,
       rc = gpg_error (GPG_ERR_GENERAL);
       goto out;
     }
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
-     "select count (*) from\n"
-     "  (select round(signatures.time / (24 * 60 * 60)) day\n"
-     "    from signatures\n"
-     "    left join bindings on signatures.binding = bindings.oid\n"
-     "    where fingerprint = %Q and email = %Q\n"
-     "    group by day);",
-     fingerprint, email);
-  if (rc)
-    {
-      log_error (_("error reading TOFU database: %s\n"), err);
-      print_further_info ("getting signature statistics (by day)");
-      sqlite3_free (err);
-      rc = gpg_error (GPG_ERR_GENERAL);
-      goto out;
-    }
 
   if (strlist)
     {
@@ -3064,10 +3271,9 @@ show_statistics (tofu_dbs_t dbs,
   /* Get the encryption stats.  */
   rc = gpgsql_exec_printf
     (dbs->db, strings_collect_cb, &strlist, &err,
-     "select count (*), coalesce (min (encryptions.time), 0),\n"
-     "  coalesce (max (encryptions.time), 0)\n"
-     " from encryptions\n"
-     " left join bindings on encryptions.binding = bindings.oid\n"
+     "select ndays, n, first_time, last_time\n"
+     " from encryptions_summary\n"
+     " join bindings on encryptions_summary.binding = bindings.oid\n"
      " where fingerprint = %Q and email = %Q;",
      fingerprint, email);
   if (rc)
@@ -3078,23 +3284,6 @@ show_statistics (tofu_dbs_t dbs,
       rc = gpg_error (GPG_ERR_GENERAL);
       goto out;
     }
-  rc = gpgsql_exec_printf
-    (dbs->db, strings_collect_cb, &strlist, &err,
-     "select count (*) from\n"
-     "  (select round(encryptions.time / (24 * 60 * 60)) day\n"
-     "    from encryptions\n"
-     "    left join bindings on encryptions.binding = bindings.oid\n"
-     "    where fingerprint = %Q and email = %Q\n"
-     "    group by day);",
-     fingerprint, email);
-  if (rc)
-    {
-      log_error (_("error reading TOFU database: %s\n"), err);
-      print_further_info ("getting encryption statistics (by day)");
-      sqlite3_free (err);
-      rc = gpg_error (GPG_ERR_GENERAL);
-      goto out;
-    }
 
   if (strlist)
     {
@@ -3296,6 +3485,186 @@ email_from_user_id (const char *user_id)
   return email;
 }
 
+/* Write the signature observation ITEM to the database unless it is
+ * already known.  */
+static gpg_error_t
+write_pending_sig (tofu_dbs_t dbs, struct pending_sig_s *item)
+{
+  gpg_error_t rc;
+  char *sqlerr = NULL;
+  unsigned long c;
+
+  /* If we've already seen this signature before, then don't add
+     it again.  */
+  rc = gpgsql_stepx
+    (dbs->db, &dbs->s.register_already_seen,
+     get_single_unsigned_long_cb2, &c, &sqlerr,
+     "select count (*)\n"
+     " from signatures left join bindings\n"
+     "  on signatures.binding = bindings.oid\n"
+     " where fingerprint = ? and email = ? and sig_time = ?\n"
+     "  and sig_digest = ?",
+     GPGSQL_ARG_STRING, item->fingerprint, GPGSQL_ARG_STRING, item->email,
+     GPGSQL_ARG_LONG_LONG, (long long) item->sig_time,
+     GPGSQL_ARG_STRING, item->sig_digest,
+     GPGSQL_ARG_END);
+  if (rc)
+    {
+      log_error (_("error reading TOFU database: %s\n"), sqlerr);
+      print_further_info ("checking existence");
+      sqlite3_free (sqlerr);
+      rc = gpg_error (GPG_ERR_GENERAL);
+    }
+  else if (c > 1)
+    /* Duplicates!  This should not happen.  In particular,
+       because <fingerprint, email, sig_time, sig_digest> is the
+       primary key!  */
+    log_debug ("SIGNATURES DB contains duplicate records"
+               " <key: %s, email: %s, time: 0x%lx, sig: %s,"
+               " origin: %s>."
+               "  Please report.\n",
+               item->fingerprint, item->email,
+               (unsigned long) item->sig_time,
+               item->sig_digest, item->origin);
+  else if (c == 1)
+    {
+      if (DBG_TRUST)
+        log_debug ("Already observed the signature and binding"
+                   " <key: %s, email: %s, time: 0x%lx, sig: %s,"
+                   " origin: %s>\n",
+                   item->fingerprint, item->email,
+                   (unsigned long) item->sig_time,
+                   item->sig_digest, item->origin);
+    }
+  else
+    /* This is the first time that we've seen this signature and
+       binding.  Record it.  */
+    {
+      if (DBG_TRUST)
+        log_debug ("TOFU: Saving signature"
+                   " <key: %s, user id: %s, sig: %s>\n",
+                   item->fingerprint, item->email, item->sig_digest);
+
+      log_assert (c == 0);
+
+      rc = gpgsql_stepx
+        (dbs->db, &dbs->s.register_signature, NULL, NULL, &sqlerr,
+         "insert into signatures\n"
+         " (binding, sig_digest, origin, sig_time, time)\n"
+         " values\n"
+         " ((select oid from bindings\n"
+         "    where fingerprint = ? and email = ?),\n"
+         "  ?, ?, ?, ?);",
+         GPGSQL_ARG_STRING, item->fingerprint, GPGSQL_ARG_STRING, item->email,
+         GPGSQL_ARG_STRING, item->sig_digest, GPGSQL_ARG_STRING, item->origin,
+         GPGSQL_ARG_LONG_LONG, (long long) item->sig_time,
+         GPGSQL_ARG_LONG_LONG, (long long) item->time,
+         GPGSQL_ARG_END);
+      if (rc)
+        {
+          log_error (_("error updating TOFU database: %s\n"), sqlerr);
+          print_further_info ("insert signatures");
+          sqlite3_free (sqlerr);
+          rc = gpg_error (GPG_ERR_GENERAL);
+        }
+    }
+
+  return rc;
+}
+
+
+/* Write all queued signature observations of DBS to the database in
+ * one transaction.  This needs to be called before the signatures
+ * table is read.  On error the observations are dropped.  We don't
+ * use begin_transaction here because this is also called without a
+ * CTRL; a savepoint nests into any open transaction.  */
+static gpg_error_t
+flush_pending_sigs (tofu_dbs_t dbs)
+{
+  struct pending_sig_s *item, *next;
+  gpg_error_t rc;
+  char *err = NULL;
+
+  if (!dbs || !dbs->pending_sigs)
+    return 0;
+
+  rc = gpgsql_exec_printf (dbs->db, NULL, NULL, &err,
+                           "savepoint pending_sigs;");
+  if (rc)
+    {
+      log_error (_("error beginning transaction on TOFU database: %s\n"),
+                 err);
+      sqlite3_free (err);
+      rc = gpg_error (GPG_ERR_GENERAL);
+    }
+  else
+    {
+      for (item = dbs->pending_sigs; item && !rc; item = item->next)
+        rc = write_pending_sig (dbs, item);
+      if (rc)
+        gpgsql_exec_printf (dbs->db, NULL, NULL, NULL,
+                            "rollback to pending_sigs;");
+      if (gpgsql_exec_printf (dbs->db, NULL, NULL, &err,
+                              "release pending_sigs;"))
+        {
+          log_error (_("error committing transaction on TOFU database: %s\n"),
+                     err);
+          sqlite3_free (err);
+          rc = gpg_error (GPG_ERR_GENERAL);
+        }
+    }
+
+  for (item = dbs->pending_sigs; item; item = next)
+    {
+      next = item->next;
+      xfree (item);
+    }
+  dbs->pending_sigs = NULL;
+  dbs->pending_sigs_tail = &dbs->pending_sigs;
+  dbs->npending_sigs = 0;
+  return rc;
+}
+
+
+/* Queue the observation of the signature SIG_DIGEST made at SIG_TIME
+ * on the binding <FINGERPRINT, EMAIL>.  */
+static gpg_error_t
+queue_pending_sig (tofu_dbs_t dbs, const char *fingerprint, const char *email,
+                   const char *sig_digest, const char *origin,
+                   time_t sig_time, time_t now)
+{
+  struct pending_sig_s *item;
+  char *p;
+
+  item = xtrymalloc (sizeof *item + strlen (fingerprint) + strlen (email)
+                     + strlen (sig_digest) + strlen (origin) + 4);
+  if (!item)
+    return gpg_error_from_syserror ();
+  item->next = NULL;
+  item->sig_time = sig_time;
+  item->time = now;
+  p = item->buffer;
+  item->fingerprint = p;
+  p = stpcpy (p, fingerprint) + 1;
+  item->email = p;
+  p = stpcpy (p, email) + 1;
+  item->sig_digest = p;
+  p = stpcpy (p, sig_digest) + 1;
+  item->origin = p;
+  strcpy (p, origin);
+
+  if (!dbs->pending_sigs_tail)
+    dbs->pending_sigs_tail = &dbs->pending_sigs;
+  *dbs->pending_sigs_tail = item;
+  dbs->pending_sigs_tail = &item->next;
+  dbs->npending_sigs++;
+
+  if (dbs->npending_sigs >= PENDING_SIGS_MAX)
+    return flush_pending_sigs (dbs);
+  return 0;
+}
+
+
 /* Register the signature with the bindings <fingerprint, USER_ID>,
    for each USER_ID in USER_ID_LIST.  The fingerprint is taken from
    the primary key packet PK.
@@ -3314,6 +3683,9 @@ email_from_user_id (const char *user_id)
    This is necessary if there is a conflict or the binding's policy is
    TOFU_POLICY_ASK.
 
+   The signature itself is only queued; it is written to the database
+   in a batch by flush_pending_sigs.
+
    This function returns 0 on success and an error code if an error
    occurred.  */
 gpg_error_t
@@ -3323,14 +3695,12 @@ tofu_register_signature (ctrl_t ctrl,
                          time_t sig_time, const char *origin)
 {
   time_t now = gnupg_get_time ();
-  gpg_error_t rc;
+  gpg_error_t rc = 0;
   tofu_dbs_t dbs;
   char *fingerprint = NULL;
   strlist_t user_id;
   char *email = NULL;
-  char *sqlerr = NULL;
   char *sig_digest = NULL;
-  unsigned long c;
 
   dbs = opendbs (ctrl);
   if (! dbs)
@@ -3341,12 +3711,6 @@ tofu_register_signature (ctrl_t ctrl,
       return rc;
     }
 
-  /* We do a query and then an insert.  Make sure they are atomic
-     by wrapping them in a transaction.  */
-  rc = begin_transaction (ctrl, 0);
-  if (rc)
-    return rc;
-
   log_assert (pk_is_primary (pk));
 
   sig_digest = make_radix64_string (sig_digest_bin, sig_digest_bin_len);
@@ -3385,82 +3749,13 @@ tofu_register_signature (ctrl_t ctrl,
           break;
         }
 
-      /* If we've already seen this signature before, then don't add
-         it again.  */
-      rc = gpgsql_stepx
-        (dbs->db, &dbs->s.register_already_seen,
-         get_single_unsigned_long_cb2, &c, &sqlerr,
-         "select count (*)\n"
-         " from signatures left join bindings\n"
-         "  on signatures.binding = bindings.oid\n"
-         " where fingerprint = ? and email = ? and sig_time = ?\n"
-         "  and sig_digest = ?",
-         GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
-         GPGSQL_ARG_LONG_LONG, (long long) sig_time,
-         GPGSQL_ARG_STRING, sig_digest,
-         GPGSQL_ARG_END);
-      if (rc)
-        {
-          log_error (_("error reading TOFU database: %s\n"), sqlerr);
-          print_further_info ("checking existence");
-          sqlite3_free (sqlerr);
-          rc = gpg_error (GPG_ERR_GENERAL);
-        }
-      else if (c > 1)
-        /* Duplicates!  This should not happen.  In particular,
-           because <fingerprint, email, sig_time, sig_digest> is the
-           primary key!  */
-        log_debug ("SIGNATURES DB contains duplicate records"
-                   " <key: %s, email: %s, time: 0x%lx, sig: %s,"
-                   " origin: %s>."
-                   "  Please report.\n",
-                   fingerprint, email, (unsigned long) sig_time,
-                   sig_digest, origin);
-      else if (c == 1)
-        {
-          if (DBG_TRUST)
-            log_debug ("Already observed the signature and binding"
-                       " <key: %s, email: %s, time: 0x%lx, sig: %s,"
-                       " origin: %s>\n",
-                       fingerprint, email, (unsigned long) sig_time,
-                       sig_digest, origin);
-        }
-      else if (opt.dry_run)
-        {
-          log_info ("TOFU database update skipped due to --dry-run\n");
-        }
+      /* The signature is written by flush_pending_sigs, so that the
+       * caller does not need to wait for a commit.  */
+      if (opt.dry_run)
+        log_info ("TOFU database update skipped due to --dry-run\n");
       else
-        /* This is the first time that we've seen this signature and
-           binding.  Record it.  */
-        {
-          if (DBG_TRUST)
-            log_debug ("TOFU: Saving signature"
-                       " <key: %s, user id: %s, sig: %s>\n",
-                       fingerprint, email, sig_digest);
-
-          log_assert (c == 0);
-
-          rc = gpgsql_stepx
-            (dbs->db, &dbs->s.register_signature, NULL, NULL, &sqlerr,
-             "insert into signatures\n"
-             " (binding, sig_digest, origin, sig_time, time)\n"
-             " values\n"
-             " ((select oid from bindings\n"
-             "    where fingerprint = ? and email = ?),\n"
-             "  ?, ?, ?, ?);",
-             GPGSQL_ARG_STRING, fingerprint, GPGSQL_ARG_STRING, email,
-             GPGSQL_ARG_STRING, sig_digest, GPGSQL_ARG_STRING, origin,
-             GPGSQL_ARG_LONG_LONG, (long long) sig_time,
-             GPGSQL_ARG_LONG_LONG, (long long) now,
-             GPGSQL_ARG_END);
-          if (rc)
-            {
-              log_error (_("error updating TOFU database: %s\n"), sqlerr);
-              print_further_info ("insert signatures");
-              sqlite3_free (sqlerr);
-              rc = gpg_error (GPG_ERR_GENERAL);
-            }
-        }
+        rc = queue_pending_sig (dbs, fingerprint, email, sig_digest, origin,
+                                sig_time, now);
 
       xfree (email);
 
@@ -3469,11 +3764,6 @@ tofu_register_signature (ctrl_t ctrl,
     }
 
  leave:
-  if (rc)
-    rollback_transaction (ctrl);
-  else
-    rc = end_transaction (ctrl, 0);
-
   xfree (fingerprint);
   xfree (sig_digest);
 
@@ -4023,7 +4313,8 @@ tofu_notice_key_changed (ctrl_t ctrl, kbnode_t kb)
   if (!fingerprint)
     return gpg_error_from_syserror ();
 
-  rc = gpgsql_stepx (dbs->db, NULL, NULL, NULL, &sqlerr,
+  policy_memo_flush (dbs);
+  rc = gpgsql_stepx (dbs->db, &dbs->s.notice_key_changed, NULL, NULL, &sqlerr,
                      "update bindings set effective_policy = ?"
                      " where fingerprint = ?;",
                      GPGSQL_ARG_INT, (int) TOFU_POLICY_NONE,
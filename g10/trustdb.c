@@ -111,6 +111,28 @@ static struct key_item *utk_list;      /* all ultimately trusted keys */
 
 static int pending_check_trustdb;
 
+/* A memo of the results of tdb_get_validity_core.  Listing a large
+ * keyring or encrypting to many recipients asks for the validity of
+ * the same key and user id several times; the memo avoids reading
+ * the trust records again.  It is cleared whenever the trustdb needs
+ * to be revalidated or has been validated.  */
+#define VALIDITY_MEMO_BUCKETS   256
+#define VALIDITY_MEMO_MAX_ITEMS 8192
+struct validity_memo_s
+{
+  struct validity_memo_s *next;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  byte fprlen;
+  byte namehash[20];
+  unsigned int with_uid:1;        /* NAMEHASH is valid.  */
+  unsigned int disabled_valid:1;  /* DISABLED is valid.  */
+  unsigned int disabled:1;        /* The disabled flag of the key.  */
+  int trust_model;
+  unsigned int validity;
+};
+static struct validity_memo_s *validity_memo[VALIDITY_MEMO_BUCKETS];
+static unsigned int validity_memo_items;
+
 static int validate_keys (ctrl_t ctrl, int interactive);
 
 
@@ -118,6 +140,83 @@ static int validate_keys (ctrl_t ctrl, int interactive);
  ************* some helpers *******************
  **********************************************/
 
+/* Remove all items from the validity memo.  */
+static void
+validity_memo_clear (void)
+{
+  struct validity_memo_s *item, *next;
+  int i;
+
+  for (i=0; i < VALIDITY_MEMO_BUCKETS; i++)
+    {
+      for (item = validity_memo[i]; item; item = next)
+        {
+          next = item->next;
+          xfree (item);
+        }
+      validity_memo[i] = NULL;
+    }
+  validity_memo_items = 0;
+}
+
+
+/* Return the memo item for the primary key MAIN_PK and the user id
+ * UID (which may be NULL) or NULL.  The fingerprint of MAIN_PK is
+ * stored at FPR and its length at R_FPRLEN.  */
+static struct validity_memo_s *
+validity_memo_find (PKT_public_key *main_pk, PKT_user_id *uid,
+                    byte *fpr, size_t *r_fprlen)
+{
+  struct validity_memo_s *item;
+
+  fingerprint_from_pk (main_pk, fpr, r_fprlen);
+  for (item = validity_memo[fpr[*r_fprlen - 1] % VALIDITY_MEMO_BUCKETS];
+       item; item = item->next)
+    if (item->fprlen == *r_fprlen
+        && !memcmp (item->fpr, fpr, *r_fprlen)
+        && item->trust_model == opt.trust_model
+        && item->with_uid == !!uid
+        && (!uid || !memcmp (item->namehash, uid->namehash, 20)))
+      return item;
+  return NULL;
+}
+
+
+/* Store VALIDITY for the key with the fingerprint FPR of length
+ * FPRLEN and the user id UID in the memo.  If DISABLED_VALID is set,
+ * DISABLED is the disabled flag to be set on the key with a later
+ * hit.  */
+static void
+validity_memo_put (const byte *fpr, size_t fprlen, PKT_user_id *uid,
+                   unsigned int validity, int disabled_valid, int disabled)
+{
+  struct validity_memo_s *item;
+  int bucket;
+
+  if (validity_memo_items >= VALIDITY_MEMO_MAX_ITEMS)
+    validity_memo_clear ();
+
+  item = xtrycalloc (1, sizeof *item);
+  if (!item)
+    return;  /* Out of core - the memo is only an optimization.  */
+  memcpy (item->fpr, fpr, fprlen);
+  item->fprlen = fprlen;
+  if (uid)
+    {
+      memcpy (item->namehash, uid->namehash, 20);
+      item->with_uid = 1;
+    }
+  item->disabled_valid = !!disabled_valid;
+  item->disabled = !!disabled;
+  item->trust_model = opt.trust_model;
+  item->validity = validity;
+
+  bucket = fpr[fprlen - 1] % VALIDITY_MEMO_BUCKETS;
+  item->next = validity_memo[bucket];
+  validity_memo[bucket] = item;
+  validity_memo_items++;
+}
+
 static struct key_item *
 new_key_item (void)
 {
@@ -639,6 +738,7 @@ tdb_revalidation_mark (ctrl_t ctrl)
   if (tdbio_write_nextcheck (ctrl, 1))
     do_sync ();
   pending_check_trustdb = 1;
+  validity_memo_clear ();
 }
 
 int
@@ -1096,6 +1196,11 @@ tdb_get_validity_core (ctrl_t ctrl,
   int free_kb = 0;
 #endif
   unsigned int validity = TRUST_UNKNOWN;
+  struct validity_memo_s *memo;
+  byte fpr[MAX_FINGERPRINT_LEN];
+  size_t fprlen;
+  int use_memo;
+  int disabled_valid = 0;
 
   if (kb && pk)
     log_assert (keyid_cmp (pk_main_keyid (pk),
@@ -1123,6 +1228,22 @@ tdb_get_validity_core (ctrl_t ctrl,
 
   check_trustdb_stale (ctrl);
 
+  /* With TOFU the validity depends on the signature and asking may
+     change the policy; thus we use the memo only for plain
+     lookups.  */
+  use_memo = ((opt.trust_model != TM_TOFU && opt.trust_model != TM_TOFU_PGP)
+              || (!sig && !may_ask));
+  if (use_memo && (memo = validity_memo_find (main_pk, uid, fpr, &fprlen)))
+    {
+      if (memo->disabled_valid)
+        {
+          pk->flags.disabled = memo->disabled;
+          pk->flags.disabled_valid = 1;
+        }
+      validity = memo->validity;
+      goto leave_memo;
+    }
+
   if(opt.trust_model==TM_DIRECT)
     {
       /* Note that this happens BEFORE any user ID stuff is checked.
@@ -1302,6 +1423,7 @@ tdb_get_validity_core (ctrl_t ctrl,
       else
 	pk->flags.disabled = 0;
       pk->flags.disabled_valid = 1;
+      disabled_valid = 1;
     }
 
  leave:
@@ -1318,6 +1440,11 @@ tdb_get_validity_core (ctrl_t ctrl,
     validity |= TRUST_EXPIRED;
 #endif /*!USE_TOFU*/
 
+  if (use_memo)
+    validity_memo_put (fpr, fprlen, uid, validity,
+                       disabled_valid, pk->flags.disabled);
+
+ leave_memo:
   if (opt.trust_model != TM_TOFU
       && pending_check_trustdb)
     validity |= TRUST_FLAG_PENDING_CHECK;
@@ -1832,22 +1959,334 @@ search_skipfnc (void *opaque, u32 *kid, int dummy_uid_no)
 }
 
 
+/* The number of buckets of a CertEdgeTable.  */
+#define CERT_EDGE_TABLE_SIZE 16384
+
+/* An edge of the web of trust: A key with the key ID SIGNER has
+ * issued at least one signature on the keyblock with the primary key
+ * ID SIGNEE.  The edges are hashed by the key ID of the signer.  */
+struct cert_edge
+{
+  struct cert_edge *next;
+  u32 signer[2];
+  u32 signee[2];
+};
+typedef struct cert_edge **CertEdgeTable;
+
+
+static void
+release_cert_edge_table (CertEdgeTable tbl)
+{
+  struct cert_edge *e, *e2;
+  int i;
+
+  if (!tbl)
+    return;
+  for (i=0; i < CERT_EDGE_TABLE_SIZE; i++)
+    for (e = tbl[i]; e; e = e2)
+      {
+        e2 = e->next;
+        xfree (e);
+      }
+  xfree (tbl);
+}
+
+
+/* Add an edge from SIGNER to SIGNEE to TBL unless it already
+ * exists.  */
+static gpg_error_t
+add_cert_edge (CertEdgeTable tbl, u32 *signer, u32 *signee)
+{
+  int i = signer[1] % CERT_EDGE_TABLE_SIZE;
+  struct cert_edge *e;
+
+  for (e = tbl[i]; e; e = e->next)
+    if (e->signer[0] == signer[0] && e->signer[1] == signer[1]
+        && e->signee[0] == signee[0] && e->signee[1] == signee[1])
+      return 0;
+
+  e = xtrymalloc (sizeof *e);
+  if (!e)
+    return gpg_error_from_syserror ();
+  e->signer[0] = signer[0];
+  e->signer[1] = signer[1];
+  e->signee[0] = signee[0];
+  e->signee[1] = signee[1];
+  e->next = tbl[i];
+  tbl[i] = e;
+  return 0;
+}
+
+
+/*
+ * Scan all keys and return a table with the issuers of all
+ * signatures on the keys.  The signatures are not checked; thus the
+ * table is a superset of the certifications validate_one_keyblock
+ * will use.  The number of scanned keyblocks is stored at R_NKEYS.
+ * Returns NULL on error.
+ */
+static CertEdgeTable
+build_cert_edges (ctrl_t ctrl, KEYDB_HANDLE hd, size_t *r_nkeys)
+{
+  gpg_error_t err;
+  CertEdgeTable tbl;
+  KEYDB_SEARCH_DESC desc;
+  KBNODE keyblock, node;
+  u32 main_kid[2];
+  size_t nkeys = 0;
+
+  (void)ctrl;
+
+  tbl = xtrycalloc (CERT_EDGE_TABLE_SIZE, sizeof *tbl);
+  if (!tbl)
+    return NULL;
+
+  err = keydb_search_reset (hd);
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FIRST;
+  while (!err && !(err = keydb_search (hd, &desc, 1, NULL)))
+    {
+      desc.mode = KEYDB_SEARCH_MODE_NEXT;
+      err = keydb_get_keyblock (hd, &keyblock);
+      if (err)
+        break;
+      if (keyblock->pkt->pkttype == PKT_PUBLIC_KEY)
+        {
+          nkeys++;
+          keyid_from_pk (keyblock->pkt->pkt.public_key, main_kid);
+          for (node = keyblock; node && !err; node = node->next)
+            {
+              PKT_signature *sig;
+
+              if (node->pkt->pkttype != PKT_SIGNATURE)
+                continue;
+              sig = node->pkt->pkt.signature;
+              if (sig->keyid[0] == main_kid[0]
+                  && sig->keyid[1] == main_kid[1])
+                continue;  /* Self-signature.  */
+              err = add_cert_edge (tbl, sig->keyid, main_kid);
+            }
+        }
+      release_kbnode (keyblock);
+    }
+  if (gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    err = 0;
+  if (err)
+    {
+      log_error ("error building the certification graph: %s\n",
+                 gpg_strerror (err));
+      release_cert_edge_table (tbl);
+      return NULL;
+    }
+
+  *r_nkeys = nkeys;
+  return tbl;
+}
+
+
+/*
+ * Return an array of search descriptions for all keys which have at
+ * least one signature issued by a key in KLIST and are not yet in
+ * FULL_TRUST.  The number of descriptions is stored at R_NCAND.
+ * Returns NULL on error.
+ */
+static KEYDB_SEARCH_DESC *
+collect_cert_candidates (CertEdgeTable edges, struct key_item *klist,
+                         KeyHashTable full_trust, size_t *r_ncand)
+{
+  KEYDB_SEARCH_DESC *cand, *tmp;
+  size_t ncand = 0, maxcand = 1000;
+  KeyHashTable seen;
+  struct key_item *k;
+  struct cert_edge *e;
+
+  cand = xtrycalloc (maxcand, sizeof *cand);
+  if (!cand)
+    return NULL;
+  seen = new_key_hash_table ();
+
+  for (k = klist; k; k = k->next)
+    for (e = edges[k->kid[1] % CERT_EDGE_TABLE_SIZE]; e; e = e->next)
+      {
+        if (e->signer[0] != k->kid[0] || e->signer[1] != k->kid[1]
+            || test_key_hash_table (full_trust, e->signee)
+            || test_key_hash_table (seen, e->signee))
+          continue;
+        add_key_hash_table (seen, e->signee);
+        if (ncand == maxcand)
+          {
+            maxcand += 1000;
+            tmp = xtryrealloc (cand, maxcand * sizeof *cand);
+            if (!tmp)
+              {
+                xfree (cand);
+                release_key_hash_table (seen);
+                return NULL;
+              }
+            cand = tmp;
+          }
+        memset (cand + ncand, 0, sizeof *cand);
+        cand[ncand].mode = KEYDB_SEARCH_MODE_LONG_KID;
+        cand[ncand].u.kid[0] = e->signee[0];
+        cand[ncand].u.kid[1] = e->signee[1];
+        ncand++;
+      }
+
+  release_key_hash_table (seen);
+  *r_ncand = ncand;
+  return cand;
+}
+
+
+/* From this number of keys in klist on, validate_key_list passes
+ * only those keys of klist to validate_one_keyblock which have
+ * actually signed the keyblock.  is_in_klist is a linear search and
+ * is called for each signature.  */
+#define KLIST_INDEX_THRESHOLD 16
+
+/* A hash index over the items of a klist using open addressing.  */
+struct klist_index_s
+{
+  size_t mask;               /* Number of slots minus one.  */
+  struct key_item **slots;
+};
+typedef struct klist_index_s *klist_index_t;
+
+
+static void
+klist_index_release (klist_index_t idx)
+{
+  if (!idx)
+    return;
+  xfree (idx->slots);
+  xfree (idx);
+}
+
+
+/* Create an index for KLIST.  Returns NULL if KLIST is short or on
+ * memory shortage.  */
+static klist_index_t
+klist_index_new (struct key_item *klist)
+{
+  klist_index_t idx;
+  struct key_item *k;
+  size_t n, size, i;
+
+  for (n=0, k=klist; k; k = k->next)
+    n++;
+  if (n < KLIST_INDEX_THRESHOLD)
+    return NULL;
+  for (size = 64; size < 2 * n; size <<= 1)
+    ;
+
+  idx = xtrycalloc (1, sizeof *idx);
+  if (!idx)
+    return NULL;
+  idx->mask = size - 1;
+  idx->slots = xtrycalloc (size, sizeof *idx->slots);
+  if (!idx->slots)
+    {
+      xfree (idx);
+      return NULL;
+    }
+
+  for (k=klist; k; k = k->next)
+    {
+      for (i = k->kid[1] & idx->mask; idx->slots[i]; i = (i+1) & idx->mask)
+        if (idx->slots[i]->kid[0] == k->kid[0]
+            && idx->slots[i]->kid[1] == k->kid[1])
+          break;
+      /* Keep the first one to match the semantics of is_in_klist.  */
+      if (!idx->slots[i])
+        idx->slots[i] = k;
+    }
+  return idx;
+}
+
+
+static struct key_item *
+klist_index_find (klist_index_t idx, u32 *kid)
+{
+  size_t i;
+
+  for (i = kid[1] & idx->mask; idx->slots[i]; i = (i+1) & idx->mask)
+    if (idx->slots[i]->kid[0] == kid[0] && idx->slots[i]->kid[1] == kid[1])
+      return idx->slots[i];
+  return NULL;
+}
+
+
+/* Return a list with shallow copies of the items in the klist of IDX
+ * which issued a signature in KEYBLOCK.  The list must be released
+ * with release_klist_copies.  */
+static struct key_item *
+klist_for_keyblock (klist_index_t idx, kbnode_t keyblock)
+{
+  struct key_item *list = NULL, *k, *kr;
+  kbnode_t node;
+
+  for (node = keyblock; node; node = node->next)
+    {
+      PKT_signature *sig;
+
+      if (node->pkt->pkttype != PKT_SIGNATURE)
+        continue;
+      sig = node->pkt->pkt.signature;
+      kr = klist_index_find (idx, sig->keyid);
+      if (!kr)
+        continue;
+      for (k = list; k; k = k->next)
+        if (k->kid[0] == kr->kid[0] && k->kid[1] == kr->kid[1])
+          break;
+      if (k)
+        continue;
+      k = new_key_item ();
+      *k = *kr;
+      k->next = list;
+      list = k;
+    }
+  return list;
+}
+
+
+/* Release a list created by klist_for_keyblock.  The trust_regexp
+ * is owned by the original klist.  */
+static void
+release_klist_copies (struct key_item *k)
+{
+  struct key_item *k2;
+
+  for (; k; k = k2)
+    {
+      k2 = k->next;
+      xfree (k);
+    }
+}
+
+
 /*
  * Scan all keys and return a key_array of all suitable keys from
  * kllist.  The caller has to pass keydb handle so that we don't use
- * to create our own.  Returns either a key_array or NULL in case of
- * an error.  No results found are indicated by an empty array.
- * Caller hast to release the returned array.
+ * to create our own.  If CAND is not NULL only the NCAND keys
+ * described by it are considered instead of all keys.  Returns either
+ * a key_array or NULL in case of an error.  No results found are
+ * indicated by an empty array.  Caller hast to release the returned
+ * array.
  */
 static struct key_array *
 validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
-                   struct key_item *klist, u32 curtime, u32 *next_expire)
+                   struct key_item *klist, u32 curtime, u32 *next_expire,
+                   KEYDB_SEARCH_DESC *cand, size_t ncand)
 {
   KBNODE keyblock = NULL;
   struct key_array *keys = NULL;
   size_t nkeys, maxkeys;
   int rc;
   KEYDB_SEARCH_DESC desc;
+  klist_index_t kidx;
+  struct key_item *sublist;
+  kbnode_t node;
+  int valid;
 
   maxkeys = 1000;
   keys = xmalloc ((maxkeys+1) * sizeof *keys);
@@ -1860,14 +2299,22 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
       xfree (keys);
       return NULL;
     }
+  kidx = klist_index_new (klist);
 
   memset (&desc, 0, sizeof desc);
   desc.mode = KEYDB_SEARCH_MODE_FIRST;
   desc.skipfnc = search_skipfnc;
   desc.skipfncvalue = full_trust;
-  rc = keydb_search (hd, &desc, 1, NULL);
+  if (!cand)
+    {
+      cand = &desc;
+      ncand = 1;
+    }
+  rc = ncand? keydb_search (hd, cand, ncand, NULL)
+    /**/    : gpg_error (GPG_ERR_NOT_FOUND);
   if (gpg_err_code (rc) == GPG_ERR_NOT_FOUND)
     {
+      klist_index_release (kidx);
       keys[nkeys].keyblock = NULL;
       return keys;
     }
@@ -1906,12 +2353,36 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
         {
           /* it does not make sense to look further at those keys */
           mark_keyblock_seen (full_trust, keyblock);
+          valid = 0;
         }
-      else if (validate_one_keyblock (ctrl, keyblock, klist,
-                                      curtime, next_expire))
+      else
+        {
+          if (!kidx)
+            valid = validate_one_keyblock (ctrl, keyblock, klist,
+                                           curtime, next_expire);
+          else if (!(sublist = klist_for_keyblock (kidx, keyblock)))
+            {
+              /* Not signed by any key in klist.  Only take care of
+               * the user ID expiration as validate_one_keyblock
+               * does.  */
+              for (node = keyblock; node; node = node->next)
+                if (node->pkt->pkttype == PKT_USER_ID
+                    && !node->pkt->pkt.user_id->flags.revoked
+                    && !node->pkt->pkt.user_id->flags.expired
+                    && node->pkt->pkt.user_id->expiredate
+                    && node->pkt->pkt.user_id->expiredate < *next_expire)
+                  *next_expire = node->pkt->pkt.user_id->expiredate;
+              valid = 0;
+            }
+          else
+            {
+              valid = validate_one_keyblock (ctrl, keyblock, sublist,
+                                             curtime, next_expire);
+              release_klist_copies (sublist);
+            }
+        }
+      if (valid)
         {
-	  KBNODE node;
-
           if (pk->expiredate && pk->expiredate >= curtime
               && pk->expiredate < *next_expire)
             *next_expire = pk->expiredate;
@@ -1938,7 +2409,7 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
       release_kbnode (keyblock);
       keyblock = NULL;
     }
-  while (!(rc = keydb_search (hd, &desc, 1, NULL)));
+  while (!(rc = keydb_search (hd, cand, ncand, NULL)));
 
   if (rc && gpg_err_code (rc) != GPG_ERR_NOT_FOUND)
     {
@@ -1946,10 +2417,12 @@ validate_key_list (ctrl_t ctrl, KEYDB_HANDLE hd, KeyHashTable full_trust,
       goto die;
     }
 
+  klist_index_release (kidx);
   keys[nkeys].keyblock = NULL;
   return keys;
 
  die:
+  klist_index_release (kidx);
   keys[nkeys].keyblock = NULL;
   release_key_array (keys);
   return NULL;
@@ -2022,6 +2495,10 @@ reset_trust_records (ctrl_t ctrl)
  *           End Loop
  *         Ready
  *
+ * To avoid scanning all keys in Step 4 for each level, we first
+ * collect the issuers of all signatures and then only look at the
+ * keys which have a signature from a key in klist.  A full scan is
+ * still done if most keys are affected anyway.
  */
 static int
 validate_keys (ctrl_t ctrl, int interactive)
@@ -2037,7 +2514,11 @@ validate_keys (ctrl_t ctrl, int interactive)
   int depth;
   int ot_unknown, ot_undefined, ot_never, ot_marginal, ot_full, ot_ultimate;
   KeyHashTable stored,used,full_trust;
+  CertEdgeTable edges = NULL;
+  KEYDB_SEARCH_DESC *cand = NULL;
+  size_t ncand, nkeys = 0;
   u32 start_time, next_expire;
+  int transaction = 0;
 
   /* Make sure we have all sigs cached.  TODO: This is going to
      require some architectural re-thinking, as it is agonizingly slow.
@@ -2045,11 +2526,18 @@ validate_keys (ctrl_t ctrl, int interactive)
      the caches on keys that are actually involved in the web of
      trust. */
   keydb_rebuild_caches (ctrl, 0);
+  validity_memo_clear ();
 
   kdb = keydb_new (ctrl);
   if (!kdb)
     return gpg_error_from_syserror ();
 
+  /* Write all changes at once at the end.  We can't do this in
+   * interactive mode because we would hold the lock while asking
+   * the user.  */
+  if (!interactive)
+    transaction = !tdbio_begin_transaction ();
+
   start_time = make_timestamp ();
   next_expire = 0xffffffff; /* set next expire to the year 2106 */
   stored = new_key_hash_table ();
@@ -2111,6 +2599,9 @@ validate_keys (ctrl_t ctrl, int interactive)
               opt.marginals_needed, opt.completes_needed,
               trust_model_string (opt.trust_model));
 
+  /* On error we simply scan all keys at each level.  */
+  edges = build_cert_edges (ctrl, kdb, &nkeys);
+
   for (depth=0; depth < opt.max_cert_depth; depth++)
     {
       int valids=0,key_count;
@@ -2175,8 +2666,24 @@ validate_keys (ctrl_t ctrl, int interactive)
         }
 
       /* Find all keys which are signed by a key in kdlist */
+      ncand = 0;
+      if (edges)
+        {
+          cand = collect_cert_candidates (edges, klist, full_trust, &ncand);
+          if (cand && ncand > nkeys / 4)
+            {
+              /* Scanning all keys is cheaper.  */
+              xfree (cand);
+              cand = NULL;
+            }
+          if (DBG_TRUST)
+            log_debug ("depth %d: %s %zu candidate keys\n", depth,
+                       cand? "checking":"not using", ncand);
+        }
       keys = validate_key_list (ctrl, kdb, full_trust, klist,
-				start_time, &next_expire);
+				start_time, &next_expire, cand, ncand);
+      xfree (cand);
+      cand = NULL;
       if (!keys)
         {
           log_error ("validate_key_list failed\n");
@@ -2254,6 +2761,7 @@ validate_keys (ctrl_t ctrl, int interactive)
  leave:
   keydb_release (kdb);
   release_key_array (keys);
+  release_cert_edge_table (edges);
   if (klist != utk_list)
     release_key_items (klist);
   release_key_hash_table (full_trust);
@@ -2283,6 +2791,17 @@ validate_keys (ctrl_t ctrl, int interactive)
 
       do_sync ();
       pending_check_trustdb = 0;
+      validity_memo_clear ();
+    }
+
+  if (transaction)
+    {
+      int rc2 = tdbio_end_transaction ();
+      if (rc2)
+        {
+          log_error (_("trustdb: sync failed: %s\n"), gpg_strerror (rc2));
+          g10_exit (2);
+        }
     }
 
   return rc;
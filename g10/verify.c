@@ -183,6 +183,14 @@ verify_one_file (ctrl_t ctrl, const char *name )
     return rc;
 }
 
+/* Wrapper around verify_one_file for multifile_process.  */
+static gpg_error_t
+verify_one_file_cb (ctrl_t ctrl, const char *name, void *opaque)
+{
+  (void)opaque;
+  return verify_one_file (ctrl, name);
+}
+
 /****************
  * Verify each file given in the files array or read the names of the
  * files from stdin.
@@ -194,6 +202,15 @@ verify_files (ctrl_t ctrl, int nfiles, char **files )
     int i, rc;
     int first_rc = 0;
 
+    if (opt.multifile_jobs > 1)
+      {
+        gpg_error_t first_err;
+
+        rc = multifile_process (ctrl, nfiles, files,
+                                verify_one_file_cb, NULL, &first_err);
+        return rc? rc : first_err;
+      }
+
     if( !nfiles ) { /* read the filenames from stdin */
 	char line[2048];
 	unsigned int lno = 0;
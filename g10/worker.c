@@ -0,0 +1,232 @@
+/* worker.c - Forked worker processes
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* Several operations of gpg distribute their work to forked
+ * processes which talk to their parent over pipes.  This module
+ * starts and stops these processes and provides the functions to
+ * move the data over the pipes.  A list of the running workers is
+ * kept so that a new worker can close the pipes of its siblings;
+ * otherwise a worker would not see an EOF when the parent closes
+ * the request pipe of a sibling.
+ */
+
+#include <config.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <unistd.h>
+#include <signal.h>
+#include <sys/types.h>
+#ifndef HAVE_W32_SYSTEM
+# include <sys/wait.h>
+#endif
+
+#include "gpg.h"
+#include "../common/util.h"
+#include "worker.h"
+
+#ifndef HAVE_W32_SYSTEM
+
+/* The list of running workers.  */
+static worker_t worker_list;
+
+
+/* Remove WK from the list of running workers.  */
+static void
+unlink_worker (worker_t wk)
+{
+  worker_t w, *wp;
+
+  for (wp = &worker_list; (w = *wp); wp = &w->next)
+    if (w == wk)
+      {
+        *wp = w->next;
+        break;
+      }
+  wk->next = NULL;
+}
+
+
+/* Initialize the worker object WK.  */
+void
+worker_init (worker_t wk)
+{
+  wk->next = NULL;
+  wk->pid = (pid_t)(-1);
+  wk->to_fd = -1;
+  wk->from_fd = -1;
+}
+
+
+/* Start a worker process and store it at WK, which must have been
+ * initialized.  If WITH_REQUESTS is set a pipe to send requests to
+ * the worker is created.  The worker runs FNC with OPAQUE.  */
+gpg_error_t
+worker_start (worker_t wk, int with_requests,
+              worker_main_t fnc, void *opaque)
+{
+  gpg_error_t err;
+  int to_child[2] = { -1, -1 };
+  int from_child[2];
+  worker_t w;
+  pid_t pid;
+
+  if (with_requests && pipe (to_child))
+    return gpg_error_from_syserror ();
+  if (pipe (from_child))
+    {
+      err = gpg_error_from_syserror ();
+      if (with_requests)
+        {
+          close (to_child[0]);
+          close (to_child[1]);
+        }
+      return err;
+    }
+
+  /* Flush our output so that it is not duplicated by the child.  */
+  es_fflush (es_stdout);
+  es_fflush (es_stderr);
+
+  pid = fork ();
+  if (pid == (pid_t)(-1))
+    {
+      err = gpg_error_from_syserror ();
+      if (with_requests)
+        {
+          close (to_child[0]);
+          close (to_child[1]);
+        }
+      close (from_child[0]);
+      close (from_child[1]);
+      return err;
+    }
+  if (!pid)
+    {
+      /* Child.  Close the pipes of the other workers so that they
+       * see an EOF when our parent closes them.  */
+      for (w = worker_list; w; w = w->next)
+        {
+          if (w->to_fd != -1)
+            close (w->to_fd);
+          if (w->from_fd != -1)
+            close (w->from_fd);
+        }
+      worker_list = NULL;
+      if (with_requests)
+        close (to_child[1]);
+      close (from_child[0]);
+      fnc (opaque, to_child[0], from_child[1]);
+      /* Use _exit so that our parent's atexit handlers, which for
+       * example remove the lock files, and its buffers are not run a
+       * second time.  */
+      _exit (0);
+    }
+
+  if (with_requests)
+    close (to_child[0]);
+  close (from_child[1]);
+  wk->pid = pid;
+  wk->to_fd = to_child[1];
+  wk->from_fd = from_child[0];
+  wk->next = worker_list;
+  worker_list = wk;
+  return 0;
+}
+
+
+/* Close the request pipe of WK.  The worker then sees an EOF.  */
+void
+worker_close_requests (worker_t wk)
+{
+  if (wk->to_fd != -1)
+    close (wk->to_fd);
+  wk->to_fd = -1;
+}
+
+
+/* Close the pipes of WK and wait for the process to terminate.  If
+ * TERMINATE is set the process is killed first; this is used if the
+ * results of a busy worker are not needed anymore.  WK may be an
+ * initialized object for which no process has been started.  */
+void
+worker_stop (worker_t wk, int terminate)
+{
+  worker_close_requests (wk);
+  if (wk->from_fd != -1)
+    close (wk->from_fd);
+  wk->from_fd = -1;
+  if (wk->pid != (pid_t)(-1))
+    {
+      if (terminate)
+        kill (wk->pid, SIGTERM);
+      while (waitpid (wk->pid, NULL, 0) == -1 && errno == EINTR)
+        ;
+      unlink_worker (wk);
+    }
+  wk->pid = (pid_t)(-1);
+}
+
+
+/* Write LENGTH bytes from BUFFER to FD.  */
+gpg_error_t
+worker_writen (int fd, const void *buffer, size_t length)
+{
+  const char *p = buffer;
+  ssize_t n;
+
+  while (length)
+    {
+      n = write (fd, p, length);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        return gpg_error_from_syserror ();
+      p += n;
+      length -= n;
+    }
+  return 0;
+}
+
+
+/* Read exactly LENGTH bytes from FD.  Returns GPG_ERR_EOF if the
+ * other end closed the pipe.  */
+gpg_error_t
+worker_readn (int fd, void *buffer, size_t length)
+{
+  char *p = buffer;
+  ssize_t n;
+
+  while (length)
+    {
+      n = read (fd, p, length);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        return gpg_error_from_syserror ();
+      if (!n)
+        return gpg_error (GPG_ERR_EOF);
+      p += n;
+      length -= n;
+    }
+  return 0;
+}
+
+#endif /*!HAVE_W32_SYSTEM*/
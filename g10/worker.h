@@ -0,0 +1,54 @@
+/* worker.h - Forked worker processes
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef GNUPG_G10_WORKER_H
+#define GNUPG_G10_WORKER_H
+
+#ifndef HAVE_W32_SYSTEM
+
+#include <sys/types.h>
+
+/* A worker process.  This object is usually embedded into the
+ * caller's worker object.  */
+struct worker_s
+{
+  struct worker_s *next;  /* Used internally.  */
+  pid_t pid;              /* The process or -1.  */
+  int to_fd;              /* Pipe to send requests or -1.  */
+  int from_fd;            /* Pipe to receive the results or -1.  */
+};
+typedef struct worker_s *worker_t;
+
+/* The main function of a worker.  IN_FD is -1 for a worker without
+ * requests.  The process terminates when this function returns.  */
+typedef void (*worker_main_t) (void *opaque, int in_fd, int out_fd);
+
+void worker_init (worker_t wk);
+gpg_error_t worker_start (worker_t wk, int with_requests,
+                          worker_main_t fnc, void *opaque);
+void worker_close_requests (worker_t wk);
+void worker_stop (worker_t wk, int terminate);
+
+gpg_error_t worker_writen (int fd, const void *buffer, size_t length);
+gpg_error_t worker_readn (int fd, void *buffer, size_t length);
+
+#endif /*!HAVE_W32_SYSTEM*/
+
+#endif /*GNUPG_G10_WORKER_H*/
@@ -25,6 +25,7 @@
 #include <unistd.h>
 #include <sys/stat.h>
 #include <assert.h>
+#include <npth.h>
 
 #include "g13.h"
 #include "../common/i18n.h"
@@ -210,6 +211,108 @@ g13_mount_container (ctrl_t ctrl, const char *filename, const char *mountpoint)
 }
 
 
+/* The maximum number of containers mounted at the same time by
+   g13_mount_containers.  Each mount runs its own gpg process.  */
+#define MAX_MOUNT_THREADS 8
+
+/* The state shared by the threads of g13_mount_containers.  */
+struct mount_batch_s
+{
+  ctrl_t ctrl;            /* The caller's control object.  */
+  strlist_t next;         /* The next container to mount.  */
+  gpg_error_t first_err;  /* The first error.  */
+  int nmounted;           /* The number of mounted containers.  */
+};
+
+
+/* Thread to mount containers taken from the batch ARG until all have
+   been mounted.  */
+static void *
+mount_batch_thread (void *arg)
+{
+  struct mount_batch_s *batch = arg;
+  struct server_control_s ctrl;
+  const char *filename;
+  gpg_error_t err;
+
+  /* Each thread needs its own control object so that it gets its own
+     connection to the syshelp.  */
+  memset (&ctrl, 0, sizeof ctrl);
+  g13_init_default_ctrl (&ctrl);
+  ctrl.no_server = batch->ctrl->no_server;
+  ctrl.status_fd = batch->ctrl->status_fd;
+  ctrl.conttype = batch->ctrl->conttype;
+
+  /* NPth switches threads only in blocking calls; thus taking an item
+     from the list does not need a lock.  */
+  while (batch->next)
+    {
+      filename = batch->next->d;
+      batch->next = batch->next->next;
+
+      err = g13_mount_container (&ctrl, filename, NULL);
+      if (err)
+        {
+          log_error ("error mounting container '%s': %s <%s>\n",
+                     filename, gpg_strerror (err), gpg_strsource (err));
+          if (!batch->first_err)
+            batch->first_err = err;
+        }
+      else
+        batch->nmounted++;
+    }
+
+  g13_deinit_default_ctrl (&ctrl);
+  return NULL;
+}
+
+
+/* Mount all containers listed in FILENAMES at temporary mountpoints.
+   The containers are mounted concurrently; thus the decryption of
+   the keyblobs by gpg and the setups by the syshelp overlap.  Errors
+   are logged; the first one is returned only if no container could
+   be mounted so that the mounted ones are still taken care of.  */
+gpg_error_t
+g13_mount_containers (ctrl_t ctrl, strlist_t filenames)
+{
+  struct mount_batch_s batch;
+  npth_attr_t tattr;
+  npth_t threads[MAX_MOUNT_THREADS];
+  int nthreads, maxthreads, i, ret;
+
+  maxthreads = strlist_length (filenames);
+  if (maxthreads > MAX_MOUNT_THREADS)
+    maxthreads = MAX_MOUNT_THREADS;
+
+  batch.ctrl = ctrl;
+  batch.next = filenames;
+  batch.first_err = 0;
+  batch.nmounted = 0;
+
+  npth_attr_init (&tattr);
+  npth_attr_setdetachstate (&tattr, NPTH_CREATE_JOINABLE);
+  for (nthreads = 0; nthreads < maxthreads; nthreads++)
+    {
+      ret = npth_create (&threads[nthreads], &tattr,
+                         mount_batch_thread, &batch);
+      if (ret)
+        {
+          log_error ("error spawning mount thread: %s\n", strerror (ret));
+          break;
+        }
+      npth_setname_np (threads[nthreads], "mount-batch");
+    }
+  npth_attr_destroy (&tattr);
+
+  if (!nthreads)  /* Mount them without threads.  */
+    mount_batch_thread (&batch);
+  for (i=0; i < nthreads; i++)
+    npth_join (threads[i], NULL);
+
+  return batch.nmounted? 0 : batch.first_err;
+}
+
+
 /* Unmount the container with name FILENAME or the one mounted at
    MOUNTPOINT.  If both are given the FILENAME takes precedence.  */
 gpg_error_t
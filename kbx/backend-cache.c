@@ -34,16 +34,30 @@
 #include "keyboxd.h"
 #include "../common/i18n.h"
 #include "../common/host2net.h"
+#include "../common/metrics.h"
 #include "backend.h"
 #include "keybox-defs.h"
 
 
-/* Standard values for the number of buckets and the threshold we use
- * to flush items.  */
+/* Standard values for the initial number of buckets, the average
+ * number of items per bucket at which we enlarge the tables, and the
+ * number of bytes we use at most for the items.  */
 #define NO_OF_KEY_ITEM_BUCKETS          383
-#define KEY_ITEMS_PER_BUCKET_THRESHOLD  40
+#define KEY_ITEMS_PER_BUCKET_LIMIT      8
+#define KEY_ITEMS_BYTE_BUDGET           (16*1024*1024)
 #define NO_OF_BLOB_BUCKETS              383
-#define BLOBS_PER_BUCKET_THRESHOLD      20
+#define BLOBS_PER_BUCKET_LIMIT          4
+#define BLOBS_BYTE_BUDGET               (64*1024*1024)
+#define NO_OF_QUERY_BUCKETS             127
+#define QUERY_ITEMS_PER_BUCKET_LIMIT    8
+#define QUERY_ITEMS_BYTE_BUDGET         (16*1024*1024)
+
+/* The maximum number of results we cache for one query.  */
+#define MAX_QUERY_RESULTS  8
+
+/* The maximum value of the usecounts.  An item which is not used
+ * anymore survives log2 of this number of clock rounds.  */
+#define MAX_USECOUNT  255
 
 
 /* Our definition of the backend handle.  */
@@ -60,7 +74,7 @@ typedef struct blob_s
   struct blob_s *next;
   enum pubkey_types pktype;
   unsigned int refcount;
-  unsigned int usecount;
+  unsigned int usecount;      /* Aged by the clock; see blob_table_evict.  */
   unsigned int datalen;
   unsigned char *data;        /* The actual data of length DATALEN.  */
   unsigned char ubid[UBID_LEN];
@@ -69,9 +83,14 @@ typedef struct blob_s
 
 static blob_t *blob_table;                /* Hash table with the blobs.   */
 static size_t blob_table_size;            /* Number of allocated buckets. */
-static unsigned int blob_table_threshold; /* Max. # of items per bucket.  */
+static unsigned int blob_table_count;     /* Number of items in the table.*/
+static size_t blob_table_bytes;           /* Memory used by the items.    */
+static size_t blob_table_budget;          /* Max. value for the above.    */
+static size_t blob_table_hand;            /* The bucket for the clock.    */
 static unsigned int blob_table_added;     /* Number of items added.       */
-static unsigned int blob_table_dropped;   /* Number of items dropped.     */
+static unsigned int blob_table_dropped;   /* Number of items evicted.     */
+static unsigned long blob_table_hits;     /* Number of cache hits.        */
+static unsigned long blob_table_misses;   /* Number of cache misses.      */
 static blob_t blob_attic;                 /* List of freed blobs.         */
 
 
@@ -107,7 +126,7 @@ typedef struct key_item_s
 {
   struct key_item_s *next;
   bloblist_t  blist;       /* List of blobs or NULL for not-found.  */
-  unsigned int usecount;
+  unsigned int usecount;   /* Aged by the clock; see key_table_evict.  */
   unsigned int refcount;   /* Reference counter for this item.  */
   u32 kid_h;               /* Upper 4 bytes of the keyid.  */
   u32 kid_l;               /* Lower 4 bytes of the keyid.  */
@@ -115,20 +134,25 @@ typedef struct key_item_s
 
 static key_item_t *key_table;            /* Hash table with the keys.    */
 static size_t key_table_size;            /* Number of allocated buckets. */
-static unsigned int key_table_threshold; /* Max. # of items per bucket.  */
+static unsigned int key_table_count;     /* Number of items in the table.*/
+static size_t key_table_bytes;           /* Memory used by the items.    */
+static size_t key_table_budget;          /* Max. value for the above.    */
+static size_t key_table_hand;            /* The bucket for the clock.    */
 static unsigned int key_table_added;     /* Number of items added.       */
-static unsigned int key_table_dropped;   /* Number of items dropped.     */
+static unsigned int key_table_dropped;   /* Number of items evicted.     */
+static unsigned long key_table_hits;     /* Number of cache hits.        */
+static unsigned long key_table_misses;   /* Number of cache misses.      */
 static key_item_t key_item_attic;        /* List of freed items.         */
 
 
 
 
-/* The hash function we use for the key_table.  Must not call a system
- * function.  */
+/* The hash function we use for the blob_table.  Must not call a
+ * system function.  */
 static inline unsigned int
 blob_table_hasher (const unsigned char *ubid)
 {
-  return (ubid[0] << 16 | ubid[1]) % blob_table_size;
+  return buf32_to_uint (ubid) % blob_table_size;
 }
 
 
@@ -140,7 +164,7 @@ blob_table_init (void)
   if (blob_table)
     return 0;
   blob_table_size = NO_OF_BLOB_BUCKETS;
-  blob_table_threshold  = BLOBS_PER_BUCKET_THRESHOLD;
+  blob_table_budget = BLOBS_BYTE_BUDGET;
   blob_table = xtrycalloc (blob_table_size, sizeof *blob_table);
   if (!blob_table)
     return gpg_error_from_syserror ();
@@ -187,20 +211,78 @@ find_blob (unsigned int hash, const unsigned char *ubid,
 }
 
 
-/* Helper for the qsort in key_table_put.  */
-static int
-compare_blobs (const void *arg_a, const void *arg_b)
+/* Double the size of the blob table.  On malloc failure the old
+ * table is kept.  The new table is allocated before the old one is
+ * looked at; if another thread resized the table meanwhile the new
+ * table is dropped.  Callers must not keep pointers into the bucket
+ * array across this call.  */
+static void
+blob_table_resize (void)
 {
-  const blob_t a = *(const blob_t *)arg_a;
-  const blob_t b = *(const blob_t *)arg_b;
+  blob_t *newtable, *oldtable, b, b_next;
+  size_t oldsize, newsize, idx;
+  unsigned int hash;
 
-  /* Reverse sort on the usecount.  */
-  if (a->usecount > b->usecount)
-    return -1;
-  else if (a->usecount == b->usecount)
-    return 0;
-  else
-    return 1;
+  oldsize = blob_table_size;
+  newsize = 2 * oldsize + 1;
+  newtable = xtrycalloc (newsize, sizeof *newtable);
+  if (!newtable)
+    return;  /* Out of core - ignore.  */
+  if (blob_table_size != oldsize)
+    {
+      /* Already resized by another thread.  */
+      xfree (newtable);
+      return;
+    }
+
+  for (idx=0; idx < blob_table_size; idx++)
+    for (b = blob_table[idx]; b; b = b_next)
+      {
+        b_next = b->next;
+        hash = buf32_to_uint (b->ubid) % newsize;
+        b->next = newtable[hash];
+        newtable[hash] = b;
+      }
+  oldtable = blob_table;
+  blob_table = newtable;
+  blob_table_size = newsize;
+  blob_table_hand = 0;
+  xfree (oldtable);
+}
+
+
+/* Evict blobs until the table fits into its budget.  This is a CLOCK
+ * algorithm which sweeps over the buckets: Items which have been used
+ * since the last round get their usecount halved and are kept, the
+ * others are removed.  Must not call a system function.  */
+static void
+blob_table_evict (void)
+{
+  blob_t b, *bp;
+  size_t nswept;
+
+  for (nswept = 0;
+       blob_table_bytes > blob_table_budget && nswept < 10 * blob_table_size;
+       nswept++)
+    {
+      for (bp = blob_table + blob_table_hand; (b = *bp); )
+        {
+          if (b->usecount)
+            {
+              b->usecount >>= 1;
+              bp = &b->next;
+              continue;
+            }
+          *bp = b->next;
+          b->next = NULL;
+          blob_table_count--;
+          blob_table_bytes -= sizeof *b + b->datalen;
+          blob_table_dropped++;
+          blob_unref (b);
+        }
+      if (++blob_table_hand >= blob_table_size)
+        blob_table_hand = 0;
+    }
 }
 
 
@@ -212,12 +294,12 @@ blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
 {
   unsigned int hash;
   blob_t b;
-  unsigned int count, n;
+  unsigned int n;
   void *blobdatacopy = NULL;
 
-  hash = blob_table_hasher (ubid);
  find_again:
-  b = find_blob (hash, ubid, &count);
+  hash = blob_table_hasher (ubid);
+  b = find_blob (hash, ubid, NULL);
   if (b)
     {
       xfree (blobdatacopy);
@@ -237,72 +319,6 @@ blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
       memcpy (blobdatacopy, blobdata, blobdatalen);
     }
 
-  /* If the bucket is full remove a couple of items. */
-  if (count >= blob_table_threshold)
-    {
-      blob_t list_head, *list_tailp, b_next;
-      blob_t *array;
-      int narray, idx;
-
-      /* Unlink from the global list so that other threads don't
-       * disturb us.  If another thread adds or removes something only
-       * one will be the winner.  Bad luck for the dropped cache items
-       * but after all it is just a cache.  */
-      list_head = blob_table[hash];
-      blob_table[hash] = NULL;
-
-      /* Put all items into an array for sorting.  */
-      array = xtrycalloc (count, sizeof *array);
-      if (!array)
-        {
-          /* That's bad; give up all  items of the bucket.  */
-          log_info ("Note: malloc failed while purging blobs from the "
-                    "cache: %s\n", gpg_strerror (gpg_error_from_syserror ()));
-          goto leave_drop;
-        }
-      narray = 0;
-      for (b = list_head; b; b = b_next)
-        {
-          b_next = b->next;
-          array[narray++] = b;
-          b->next = NULL;
-        }
-      log_assert (narray == count);
-
-      /* Sort the array and put half of it onto a new list.  */
-      qsort (array, narray, sizeof *array, compare_blobs);
-      list_head = NULL;
-      list_tailp = &list_head;
-      for (idx=0; idx < narray/2; idx++)
-        {
-          *list_tailp = array[idx];
-          list_tailp = &array[idx]->next;
-        }
-
-      /* Put the new list into the bucket.  */
-      b = blob_table[hash];
-      blob_table[hash] = list_head;
-      list_head = b;
-
-      /* Free the remaining items and the array.  */
-      for (; idx < narray; idx++)
-        {
-          blob_unref (array[idx]);
-          blob_table_dropped++;
-        }
-      xfree (array);
-
-    leave_drop:
-      /* Free any items added in the meantime by other threads.  This
-       * is also used in case of a malloc problem (which won't update
-       * the counters, though). */
-      for ( ; list_head; list_head = b_next)
-        {
-          b_next = list_head->next;
-          blob_unref (list_head);
-        }
-    }
-
   /* Add an item to the bucket.  We allocate a whole block of items
    * for cache performance reasons.  */
   if (!blob_attic)
@@ -344,6 +360,13 @@ blob_table_put (const unsigned char *ubid, enum pubkey_types pktype,
   b->next = blob_table[hash];
   blob_table[hash] = b;
   blob_table_added++;
+  blob_table_count++;
+  blob_table_bytes += sizeof *b + blobdatalen;
+
+  if (blob_table_count > blob_table_size * BLOBS_PER_BUCKET_LIMIT)
+    blob_table_resize ();
+  if (blob_table_bytes > blob_table_budget)
+    blob_table_evict ();
 }
 
 
@@ -359,11 +382,14 @@ blob_table_get (const unsigned char *ubid)
   b = find_blob (hash, ubid, NULL);
   if (b)
     {
-      b->usecount++;
+      blob_table_hits++;
+      if (b->usecount < MAX_USECOUNT)
+        b->usecount++;
       b->refcount++;
       return b;  /* Found  */
     }
 
+  blob_table_misses++;
   return NULL;
 }
 
@@ -386,7 +412,7 @@ key_table_init (void)
   if (key_table)
     return 0;
   key_table_size = NO_OF_KEY_ITEM_BUCKETS;
-  key_table_threshold  = KEY_ITEMS_PER_BUCKET_THRESHOLD;
+  key_table_budget = KEY_ITEMS_BYTE_BUDGET;
   key_table = xtrycalloc (key_table_size, sizeof *key_table);
   if (!key_table)
     return gpg_error_from_syserror ();
@@ -441,23 +467,6 @@ find_in_chain (unsigned int hash, u32 kid_h, u32 kid_l,
 }
 
 
-/* Helper for the qsort in key_table_put.  */
-static int
-compare_key_items (const void *arg_a, const void *arg_b)
-{
-  const key_item_t a = *(const key_item_t *)arg_a;
-  const key_item_t b = *(const key_item_t *)arg_b;
-
-  /* Reverse sort on the usecount.  */
-  if (a->usecount > b->usecount)
-    return -1;
-  else if (a->usecount == b->usecount)
-    return 0;
-  else
-    return 1;
-}
-
-
 /* Allocate new key items.  They are put to the attic so that the
  * caller can take them from there.  On allocation failure a note
  * is printed and an error returned.  */
@@ -545,82 +554,87 @@ new_bloblist_item (const unsigned char *fpr, unsigned int fprlen,
 }
 
 
-/* If the list of key item in the bucken HASH is full remove a couple
- * of them.  On error a diagnostic is printed and an error code
- * return.  Note that the error code GPG_ERR_TRUE is returned if any
- * flush and thus system calls were done.
- */
-static gpg_error_t
-maybe_flush_some_key_buckets (unsigned int hash, unsigned int count)
+/* Double the size of the key table.  On malloc failure the old table
+ * is kept.  See blob_table_resize for the rules.  */
+static void
+key_table_resize (void)
 {
-  gpg_error_t err;
-  key_item_t ki, list_head, *list_tailp, ki_next;
-  key_item_t *array;
-  int narray, idx;
-
-  if (count < key_table_threshold)
-    return 0;  /* Nothing to do.  */
-
-  /* Unlink from the global list so that other threads don't disturb
-   * us.  If another thread adds or removes something only one will be
-   * the winner.  Bad luck for the dropped cache items but after all
-   * it is just a cache.  */
-  list_head = key_table[hash];
-  key_table[hash] = NULL;
-
-  /* Put all items into an array for sorting.  */
-  array = xtrycalloc (count, sizeof *array);
-  if (!array)
-    {
-      /* That's bad; give up all items of the bucket.  */
-      err = gpg_error_from_syserror ();
-      log_info ("Note: malloc failed while purging from the cache: %s\n",
-                gpg_strerror (err));
-      goto leave;
-    }
-  narray = 0;
-  for (ki = list_head; ki; ki = ki_next)
-    {
-      ki_next = ki->next;
-      array[narray++] = ki;
-      ki->next = NULL;
-    }
-  log_assert (narray == count);
+  key_item_t *newtable, *oldtable, ki, ki_next;
+  size_t oldsize, newsize, idx;
+  unsigned int hash;
 
-  /* Sort the array and put half of it onto a new list.  */
-  qsort (array, narray, sizeof *array, compare_key_items);
-  list_head = NULL;
-  list_tailp = &list_head;
-  for (idx=0; idx < narray/2; idx++)
+  oldsize = key_table_size;
+  newsize = 2 * oldsize + 1;
+  newtable = xtrycalloc (newsize, sizeof *newtable);
+  if (!newtable)
+    return;  /* Out of core - ignore.  */
+  if (key_table_size != oldsize)
     {
-      *list_tailp = array[idx];
-      list_tailp = &array[idx]->next;
+      /* Already resized by another thread.  */
+      xfree (newtable);
+      return;
     }
 
-  /* Put the new list into the bucket.  */
-  ki = key_table[hash];
-  key_table[hash] = list_head;
-  list_head = ki;
+  for (idx=0; idx < key_table_size; idx++)
+    for (ki = key_table[idx]; ki; ki = ki_next)
+      {
+        ki_next = ki->next;
+        hash = ki->kid_l % newsize;
+        ki->next = newtable[hash];
+        newtable[hash] = ki;
+      }
+  oldtable = key_table;
+  key_table = newtable;
+  key_table_size = newsize;
+  key_table_hand = 0;
+  xfree (oldtable);
+}
 
-  /* Free the remaining items and the array.  */
-  for (; idx < narray; idx++)
-    {
-      key_item_unref (array[idx]);
-      key_table_dropped++;
-    }
-  xfree (array);
-  err = gpg_error (GPG_ERR_TRUE);
 
- leave:
-  /* Free any items added in the meantime by other threads.  This is
-   * also used in case of a malloc problem (which won't update the
-   * counters, though). */
-  for ( ; list_head; list_head = ki_next)
+/* Return the number of bytes used by the key item KI.  */
+static size_t
+key_item_size (key_item_t ki)
+{
+  size_t n = sizeof *ki;
+  bloblist_t bl;
+
+  for (bl = ki->blist; bl; bl = bl->next)
+    n += sizeof *bl;
+  return n;
+}
+
+
+/* Evict key items until the table fits into its budget.  This is the
+ * same CLOCK algorithm as used by blob_table_evict.  Must not call a
+ * system function.  */
+static void
+key_table_evict (void)
+{
+  key_item_t ki, *kip;
+  size_t nswept;
+
+  for (nswept = 0;
+       key_table_bytes > key_table_budget && nswept < 10 * key_table_size;
+       nswept++)
     {
-      ki_next = list_head->next;
-      key_item_unref (list_head);
+      for (kip = key_table + key_table_hand; (ki = *kip); )
+        {
+          if (ki->usecount)
+            {
+              ki->usecount >>= 1;
+              kip = &ki->next;
+              continue;
+            }
+          *kip = ki->next;
+          ki->next = NULL;
+          key_table_count--;
+          key_table_bytes -= key_item_size (ki);
+          key_table_dropped++;
+          key_item_unref (ki);
+        }
+      if (++key_table_hand >= key_table_size)
+        key_table_hand = 0;
     }
-  return err;
 }
 
 
@@ -637,14 +651,13 @@ do_key_table_put (u32 kid_h, u32 kid_l,
   unsigned int hash;
   key_item_t ki;
   bloblist_t bl, bl_tail;
-  unsigned int count;
   int do_find_again;
   int mark_not_found = !fpr;
 
-  hash = key_table_hasher (kid_l);
  find_again:
   do_find_again = 0;
-  ki = find_in_chain (hash, kid_h, kid_l, &count);
+  hash = key_table_hasher (kid_l);
+  ki = find_in_chain (hash, kid_h, kid_l, NULL);
   if (ki)
     {
       if (mark_not_found)
@@ -673,18 +686,11 @@ do_key_table_put (u32 kid_h, u32 kid_l,
         bl_tail->next = bl;
       else
         ki->blist = bl;
+      key_table_bytes += sizeof *bl;
 
       return;
     }
 
-  /* If the bucket is full remove a couple of items. */
-  if (maybe_flush_some_key_buckets (hash, count))
-    {
-      /* During the function call another thread might have changed
-       * the bucket.  Thus we need to start over.  */
-      do_find_again = 1;
-    }
-
   if (!key_item_attic)
     {
       if (alloc_more_key_items ())
@@ -721,6 +727,13 @@ do_key_table_put (u32 kid_h, u32 kid_l,
   ki->next = key_table[hash];
   key_table[hash] = ki;
   key_table_added++;
+  key_table_count++;
+  key_table_bytes += key_item_size (ki);
+
+  if (key_table_count > key_table_size * KEY_ITEMS_PER_BUCKET_LIMIT)
+    key_table_resize ();
+  if (key_table_bytes > key_table_budget)
+    key_table_evict ();
 }
 
 
@@ -796,11 +809,14 @@ key_table_get (u32 kid_h, u32 kid_l)
   ki = find_in_chain (hash, kid_h, kid_l, NULL);
   if (ki)
     {
-      ki->usecount++;
+      key_table_hits++;
+      if (ki->usecount < MAX_USECOUNT)
+        ki->usecount++;
       ki->refcount++;
       return ki;  /* Found  */
     }
 
+  key_table_misses++;
   return NULL;
 }
 
@@ -843,6 +859,509 @@ query_by_fpr (const unsigned char *fpr, unsigned int fprlen)
 }
 
 
+
+/* The query cache maps the search descriptors of a search to the list
+ * of its results.  This is used by the frontend for searches which
+ * are repeated over and over again; for example for the fingerprint
+ * of the sender of each mail in a thread.  All entries are
+ * invalidated by a store or delete; see be_cache_query_invalidate.
+ * Because the results are delivered one by one, an entry may have
+ * only the first results; the frontend then needs to continue with
+ * the actual database search.  */
+
+/* A result of a cached query.  */
+struct query_result_s
+{
+  enum pubkey_types pktype;
+  unsigned int is_ephemeral:1;
+  unsigned int is_revoked:1;
+  int uid_no;
+  int pk_no;
+  unsigned int datalen;
+  unsigned char *data;        /* The blob of length DATALEN.  */
+  unsigned char ubid[UBID_LEN];
+};
+
+/* A cached query.  KEY is the serialized form of the search
+ * descriptors as built by query_key_from_desc.  */
+struct query_item_s
+{
+  struct query_item_s *next;
+  unsigned int refcount;
+  unsigned int usecount;      /* Aged by the clock; see query_table_evict.  */
+  unsigned int in_table:1;    /* The item is linked into the table.  */
+  unsigned int complete:1;    /* RESULTS has all results of the query.  */
+  unsigned long generation;   /* The generation at creation time.  */
+  db_request_t recorder;      /* The request adding results or NULL.  */
+  unsigned int hash;
+  unsigned int nresults;
+  struct query_result_s results[MAX_QUERY_RESULTS];
+  size_t keylen;
+  unsigned char key[1];
+};
+typedef struct query_item_s *query_item_t;
+
+static query_item_t *query_table;         /* Hash table with the queries. */
+static size_t query_table_size;           /* Number of allocated buckets. */
+static unsigned int query_table_count;    /* Number of items in the table.*/
+static size_t query_table_bytes;          /* Memory used by the items.    */
+static size_t query_table_budget;         /* Max. value for the above.    */
+static size_t query_table_hand;           /* The bucket for the clock.    */
+static unsigned int query_table_added;    /* Number of items added.       */
+static unsigned int query_table_dropped;  /* Number of items evicted.     */
+static unsigned long query_table_hits;    /* Number of cache hits.        */
+static unsigned long query_table_misses;  /* Number of cache misses.      */
+static unsigned long query_generation;    /* Bumped on each change.       */
+static unsigned long query_table_generation; /* Generation of the items.  */
+
+
+/* Runtime allocation of the query table.  */
+static gpg_error_t
+query_table_init (void)
+{
+  if (query_table)
+    return 0;
+  query_table_size = NO_OF_QUERY_BUCKETS;
+  query_table_budget = QUERY_ITEMS_BYTE_BUDGET;
+  query_table = xtrycalloc (query_table_size, sizeof *query_table);
+  if (!query_table)
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Return the memory used by the query item QI.  */
+static size_t
+query_item_size (query_item_t qi)
+{
+  size_t n;
+  unsigned int i;
+
+  n = sizeof *qi + qi->keylen;
+  for (i=0; i < qi->nresults; i++)
+    n += qi->results[i].datalen;
+  return n;
+}
+
+
+/* Release a reference to the query item QI.  */
+static void
+query_item_unref (query_item_t qi)
+{
+  unsigned int i;
+
+  if (!qi)
+    return;
+  log_assert (qi->refcount);
+  if (!--qi->refcount)
+    {
+      for (i=0; i < qi->nresults; i++)
+        xfree (qi->results[i].data);
+      xfree (qi);
+    }
+}
+
+
+/* Remove the query item at *QIP from the table.  */
+static void
+query_table_unlink (query_item_t *qip)
+{
+  query_item_t qi = *qip;
+
+  *qip = qi->next;
+  qi->next = NULL;
+  qi->in_table = 0;
+  query_table_count--;
+  query_table_bytes -= query_item_size (qi);
+  query_item_unref (qi);
+}
+
+
+/* Remove the query item QI from the table.  */
+static void
+query_table_remove (query_item_t qi)
+{
+  query_item_t *qip;
+
+  if (!qi->in_table)
+    return;
+  for (qip = query_table + qi->hash % query_table_size; *qip;
+       qip = &(*qip)->next)
+    if (*qip == qi)
+      {
+        query_table_unlink (qip);
+        break;
+      }
+}
+
+
+/* Remove all items from the query table.  */
+static void
+query_table_flush (void)
+{
+  size_t idx;
+
+  for (idx=0; idx < query_table_size; idx++)
+    while (query_table[idx])
+      query_table_unlink (query_table + idx);
+  query_table_generation = query_generation;
+}
+
+
+/* Double the size of the query table.  On malloc failure the old
+ * table is kept.  See blob_table_resize for the rules.  */
+static void
+query_table_resize (void)
+{
+  query_item_t *newtable, *oldtable, qi, qi_next;
+  size_t oldsize, newsize, idx;
+
+  oldsize = query_table_size;
+  newsize = 2 * oldsize + 1;
+  newtable = xtrycalloc (newsize, sizeof *newtable);
+  if (!newtable)
+    return;  /* Out of core - ignore.  */
+  if (query_table_size != oldsize)
+    {
+      /* Already resized by another thread.  */
+      xfree (newtable);
+      return;
+    }
+
+  for (idx=0; idx < query_table_size; idx++)
+    for (qi = query_table[idx]; qi; qi = qi_next)
+      {
+        qi_next = qi->next;
+        qi->next = newtable[qi->hash % newsize];
+        newtable[qi->hash % newsize] = qi;
+      }
+  oldtable = query_table;
+  query_table = newtable;
+  query_table_size = newsize;
+  query_table_hand = 0;
+  xfree (oldtable);
+}
+
+
+/* Evict query items until the table fits into its budget.  This is
+ * the same CLOCK algorithm as used by blob_table_evict.  */
+static void
+query_table_evict (void)
+{
+  query_item_t qi, *qip;
+  size_t nswept;
+
+  for (nswept = 0;
+       query_table_bytes > query_table_budget
+         && nswept < 10 * query_table_size;
+       nswept++)
+    {
+      for (qip = query_table + query_table_hand; (qi = *qip); )
+        {
+          if (qi->usecount)
+            {
+              qi->usecount >>= 1;
+              qip = &qi->next;
+              continue;
+            }
+          query_table_unlink (qip);
+          query_table_dropped++;
+        }
+      if (++query_table_hand >= query_table_size)
+        query_table_hand = 0;
+    }
+}
+
+
+/* Append the search descriptor DESC to the key in MB.  Returns false
+ * if DESC can't be cached.  */
+static int
+query_key_from_desc (membuf_t *mb, KEYDB_SEARCH_DESC *desc)
+{
+  unsigned char buf[4];
+
+  if (desc->skipfnc)
+    return 0;  /* We can't know what the callback does.  */
+
+  buf[0] = desc->mode;
+  buf[1] = !!desc->exact;
+  put_membuf (mb, buf, 2);
+  switch (desc->mode)
+    {
+    case KEYDB_SEARCH_MODE_EXACT:
+    case KEYDB_SEARCH_MODE_SUBSTR:
+    case KEYDB_SEARCH_MODE_MAIL:
+    case KEYDB_SEARCH_MODE_MAILSUB:
+    case KEYDB_SEARCH_MODE_MAILEND:
+    case KEYDB_SEARCH_MODE_WORDS:
+    case KEYDB_SEARCH_MODE_ISSUER:
+    case KEYDB_SEARCH_MODE_SUBJECT:
+      put_membuf (mb, desc->u.name? desc->u.name : "",
+                  (desc->u.name? strlen (desc->u.name) : 0) + 1);
+      break;
+
+    case KEYDB_SEARCH_MODE_ISSUER_SN:
+    case KEYDB_SEARCH_MODE_SN:
+      buf[0] = desc->snhex;
+      buf[1] = desc->snlen >> 8;
+      buf[2] = desc->snlen;
+      put_membuf (mb, buf, 3);
+      if (desc->snlen)
+        put_membuf (mb, desc->sn, desc->snlen);
+      if (desc->mode == KEYDB_SEARCH_MODE_ISSUER_SN)
+        put_membuf (mb, desc->u.name? desc->u.name : "",
+                    (desc->u.name? strlen (desc->u.name) : 0) + 1);
+      break;
+
+    case KEYDB_SEARCH_MODE_SHORT_KID:
+    case KEYDB_SEARCH_MODE_LONG_KID:
+      put_membuf (mb, desc->u.kid, sizeof desc->u.kid);
+      break;
+
+    case KEYDB_SEARCH_MODE_FPR:
+      if (desc->fprlen > sizeof desc->u.fpr)
+        return 0;
+      buf[0] = desc->fprlen;
+      put_membuf (mb, buf, 1);
+      put_membuf (mb, desc->u.fpr, desc->fprlen);
+      break;
+
+    case KEYDB_SEARCH_MODE_KEYGRIP:
+      put_membuf (mb, desc->u.grip, KEYGRIP_LEN);
+      break;
+
+    case KEYDB_SEARCH_MODE_UBID:
+      put_membuf (mb, desc->u.ubid, UBID_LEN);
+      break;
+
+    default:
+      /* FIRST and NEXT would cache the entire database.  */
+      return 0;
+    }
+  return 1;
+}
+
+
+/* Stop the use of the query cache by REQUEST.  */
+void
+be_cache_query_stop (db_request_t request)
+{
+  query_item_t qi = request->query_item;
+
+  if (!qi)
+    return;
+  if (qi->recorder == request)
+    qi->recorder = NULL;
+  query_item_unref (qi);
+  request->query_item = NULL;
+  request->query_pos = 0;
+  request->query_backend = 0;
+  request->query_skip = 0;
+}
+
+
+/* Start a new search with (DESC,NDESC) for REQUEST.  This looks up
+ * the query in the cache; if it is not yet cached a new entry is
+ * created to which the results of the search are added.  */
+void
+be_cache_query_start (ctrl_t ctrl, db_request_t request,
+                      KEYDB_SEARCH_DESC *desc, unsigned int ndesc)
+{
+  membuf_t mb;
+  unsigned char flags;
+  unsigned char *key;
+  size_t keylen;
+  unsigned int hash, n;
+  query_item_t qi;
+
+  be_cache_query_stop (request);
+  if (!desc || !ndesc || !query_table)
+    return;
+  if (query_table_generation != query_generation)
+    query_table_flush ();
+
+  init_membuf (&mb, 64);
+  flags = (ctrl->filter_opgp? 1 : 0) | (ctrl->filter_x509? 2 : 0);
+  put_membuf (&mb, &flags, 1);
+  for (n=0; n < ndesc; n++)
+    if (!query_key_from_desc (&mb, desc + n))
+      {
+        xfree (get_membuf (&mb, NULL));
+        return;
+      }
+  key = get_membuf (&mb, &keylen);
+  if (!key)
+    return;  /* Out of core - ignore.  */
+
+  for (hash = 0, n = 0; n < keylen; n++)
+    hash = hash * 31 + key[n];
+
+  for (qi = query_table[hash % query_table_size]; qi; qi = qi->next)
+    if (qi->hash == hash && qi->keylen == keylen
+        && !memcmp (qi->key, key, keylen))
+      break;
+  if (qi)
+    {
+      query_table_hits++;
+      if (qi->usecount < MAX_USECOUNT)
+        qi->usecount++;
+      qi->refcount++;
+      request->query_item = qi;
+      xfree (key);
+      return;
+    }
+  query_table_misses++;
+
+  qi = xtrycalloc (1, sizeof *qi + keylen);
+  if (!qi)
+    {
+      xfree (key);
+      return;  /* Out of core - ignore.  */
+    }
+  memcpy (qi->key, key, keylen);
+  qi->keylen = keylen;
+  xfree (key);
+  qi->hash = hash;
+  qi->generation = query_generation;
+  qi->recorder = request;
+  qi->usecount = 1;
+  qi->refcount = 2;  /* One for the table and one for REQUEST.  */
+  qi->in_table = 1;
+  qi->next = query_table[hash % query_table_size];
+  query_table[hash % query_table_size] = qi;
+  query_table_added++;
+  query_table_count++;
+  query_table_bytes += query_item_size (qi);
+  request->query_item = qi;
+
+  if (query_table_count > query_table_size * QUERY_ITEMS_PER_BUCKET_LIMIT)
+    query_table_resize ();
+  if (query_table_bytes > query_table_budget)
+    query_table_evict ();
+}
+
+
+/* Return the next result of the search of REQUEST from the query
+ * cache.  Returns 0 if the result has been returned,
+ * GPG_ERR_NOT_FOUND if the cache knows that there are no more
+ * results, and GPG_ERR_EOF if the database needs to be searched.  In
+ * the latter case the number of results already delivered from the
+ * cache is stored at R_NSKIP; the caller needs to skip them.  */
+gpg_error_t
+be_cache_query_next (ctrl_t ctrl, db_request_t request,
+                     unsigned int *r_nskip)
+{
+  query_item_t qi = request->query_item;
+  struct query_result_s *r;
+
+  *r_nskip = 0;
+  if (!qi || request->query_backend)
+    return gpg_error (GPG_ERR_EOF);
+
+  if (request->query_pos < qi->nresults)
+    {
+      /* Note that QI->DATA stays valid as long as we hold QI even if
+       * another thread adds results.  */
+      r = qi->results + request->query_pos++;
+      return be_return_pubkey (ctrl, r->data, r->datalen, r->pktype, r->ubid,
+                               r->is_ephemeral, r->is_revoked,
+                               r->uid_no, r->pk_no);
+    }
+  if (qi->complete)
+    return gpg_error (GPG_ERR_NOT_FOUND);
+
+  /* The cached results are exhausted.  If nobody else is adding
+   * results we take over.  */
+  if (!qi->recorder && qi->in_table && qi->generation == query_generation
+      && qi->nresults == request->query_pos)
+    qi->recorder = request;
+  *r_nskip = request->query_pos;
+  return gpg_error (GPG_ERR_EOF);
+}
+
+
+/* Record the result (BLOB,BLOBLEN) returned for REQUEST.  This is
+ * called by be_return_pubkey.  */
+void
+be_cache_query_record (db_request_t request,
+                       const void *blob, size_t bloblen,
+                       enum pubkey_types pktype, const unsigned char *ubid,
+                       int is_ephemeral, int is_revoked,
+                       int uid_no, int pk_no)
+{
+  query_item_t qi = request->query_item;
+  struct query_result_s *r;
+  unsigned char *data;
+
+  /* Results replayed by be_cache_query_next never get here because
+   * REQUEST can't be the recorder at that time.  */
+  if (!qi || qi->recorder != request)
+    return;
+  if (qi->nresults != request->query_pos++)
+    return;
+  if (qi->nresults >= MAX_QUERY_RESULTS)
+    {
+      qi->recorder = NULL;  /* Too many results; keep the first.  */
+      return;
+    }
+
+  data = xtrymalloc (bloblen? bloblen : 1);
+  if (!data)
+    {
+      qi->recorder = NULL;  /* Out of core - ignore.  */
+      return;
+    }
+  memcpy (data, blob, bloblen);
+  r = qi->results + qi->nresults;
+  r->pktype = pktype;
+  r->is_ephemeral = !!is_ephemeral;
+  r->is_revoked = !!is_revoked;
+  r->uid_no = uid_no;
+  r->pk_no = pk_no;
+  r->datalen = bloblen;
+  r->data = data;
+  memcpy (r->ubid, ubid, UBID_LEN);
+  qi->nresults++;
+  if (qi->in_table)
+    {
+      query_table_bytes += bloblen;
+      if (query_table_bytes > query_table_budget)
+        query_table_evict ();
+    }
+}
+
+
+/* Tell the query cache that the database search of REQUEST returned
+ * ERR.  */
+void
+be_cache_query_done (db_request_t request, gpg_error_t err)
+{
+  query_item_t qi = request->query_item;
+
+  if (!qi || qi->recorder != request)
+    return;
+  if (gpg_err_code (err) == GPG_ERR_EOF)
+    {
+      if (qi->nresults == request->query_pos)
+        qi->complete = 1;
+      qi->recorder = NULL;
+    }
+  else if (err)
+    {
+      /* We don't know the results; thus remove the item.  */
+      qi->recorder = NULL;
+      query_table_remove (qi);
+    }
+}
+
+
+/* Invalidate all entries of the query cache.  This needs to be
+ * called after each change of the database.  */
+void
+be_cache_query_invalidate (void)
+{
+  query_generation++;
+}
 
 
 
@@ -855,10 +1374,69 @@ be_cache_initialize (void)
   err = blob_table_init ();
   if (!err)
     err = key_table_init ();
+  if (!err)
+    err = query_table_init ();
   return err;
 }
 
 
+/* Return a malloced string with statistics about the cache or NULL
+ * on malloc failure.  */
+char *
+be_cache_stats_string (void)
+{
+  return xtryasprintf ("blobs=%u bytes=%lu added=%u evicted=%u"
+                       " hits=%lu misses=%lu"
+                       " keys=%u bytes=%lu added=%u evicted=%u"
+                       " hits=%lu misses=%lu"
+                       " queries=%u bytes=%lu added=%u evicted=%u"
+                       " hits=%lu misses=%lu",
+                       blob_table_count, (unsigned long)blob_table_bytes,
+                       blob_table_added, blob_table_dropped,
+                       blob_table_hits, blob_table_misses,
+                       key_table_count, (unsigned long)key_table_bytes,
+                       key_table_added, key_table_dropped,
+                       key_table_hits, key_table_misses,
+                       query_table_count, (unsigned long)query_table_bytes,
+                       query_table_added, query_table_dropped,
+                       query_table_hits, query_table_misses);
+}
+
+
+/* Helper for be_cache_collect_metrics.  */
+static void
+set_cache_metrics (const char *cache, unsigned int items, size_t bytes,
+                   unsigned long hits, unsigned long misses)
+{
+  char labels[50];
+
+  snprintf (labels, sizeof labels, "cache=\"%s\"", cache);
+  gnupg_metric_set (gnupg_metric_get (GNUPG_METRIC_GAUGE, "cache_items",
+                                      labels), items);
+  gnupg_metric_set (gnupg_metric_get (GNUPG_METRIC_GAUGE, "cache_bytes",
+                                      labels), bytes);
+  snprintf (labels, sizeof labels, "cache=\"%s\",result=\"hit\"", cache);
+  gnupg_metric_set (gnupg_metric_get (GNUPG_METRIC_COUNTER, "cache_lookups",
+                                      labels), hits);
+  snprintf (labels, sizeof labels, "cache=\"%s\",result=\"miss\"", cache);
+  gnupg_metric_set (gnupg_metric_get (GNUPG_METRIC_COUNTER, "cache_lookups",
+                                      labels), misses);
+}
+
+
+/* Copy the statistics of the caches to the metrics.  */
+void
+be_cache_collect_metrics (void)
+{
+  set_cache_metrics ("blob", blob_table_count, blob_table_bytes,
+                     blob_table_hits, blob_table_misses);
+  set_cache_metrics ("key", key_table_count, key_table_bytes,
+                     key_table_hits, key_table_misses);
+  set_cache_metrics ("query", query_table_count, query_table_bytes,
+                     query_table_hits, query_table_misses);
+}
+
+
 /* Install a new resource and return a handle for that backend.  */
 gpg_error_t
 be_cache_add_resource (ctrl_t ctrl, backend_handle_t *r_hd)
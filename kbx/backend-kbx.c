@@ -353,6 +353,10 @@ be_kbx_insert (ctrl_t ctrl, backend_handle_t backend_hd,
   if (err)
     goto leave;
 
+  /* Append instead of copying the file only within a transaction,
+   * which is what a client uses for a bulk import.  */
+  keybox_set_append_mode (part->kbx_hd, opt.in_transaction);
+
   if (pktype == PUBKEY_TYPE_OPGP)
     err = keybox_insert_keyblock (part->kbx_hd, blob, bloblen);
   else if (pktype == PUBKEY_TYPE_X509)
@@ -402,6 +406,7 @@ be_kbx_update (ctrl_t ctrl, backend_handle_t backend_hd,
   /* FIXME: We make use of the fact that we know that the caller
    * already did a keybox search.  This needs to be made more
    * explicit.  */
+  keybox_set_append_mode (part->kbx_hd, opt.in_transaction);
   if (pktype == PUBKEY_TYPE_OPGP)
     {
       err = keybox_update_keyblock (part->kbx_hd, blob, bloblen);
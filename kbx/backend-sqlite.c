@@ -64,6 +64,12 @@ struct backend_handle_s
 /* Definition of local request data.  */
 struct be_sqlite_local_s
 {
+  /* A read-only connection used by this request or NULL.  */
+  sqlite3 *readdb;
+
+  /* The connection to be used for a new select command.  */
+  sqlite3 *select_db;
+
   /* The statement object of the current select command.  */
   sqlite3_stmt *select_stmt;
 
@@ -91,14 +97,57 @@ struct be_sqlite_local_s
 
 /* The Mutex we use to protect all our SQLite calls.  */
 static npth_mutex_t database_mutex = NPTH_MUTEX_INITIALIZER;
-/* The one and only database handle. */
+/* The one and only database handle used for writing.  */
 static sqlite3 *database_hd;
+/* True if searches may use their own read-only connection.  This
+ * requires a thread-safe sqlite and a database in WAL mode.  */
+static int use_reader_connections;
 /* A lockfile used make sure only we are accessing the database.  */
 static dotlock_t database_lock;
 
 /* The version of our current database schema.  */
 #define DATABASE_VERSION 1
 
+/* True if the full-text index tables userid_fts and userid_words are
+ * available.  They require an sqlite with FTS5 and the trigram
+ * tokenizer; without them substring searches scan the userid
+ * table.  */
+static int have_fulltext_index;
+
+/* State of a bulk load started by be_sqlite_begin_bulk_load.  While
+ * a bulk load is active the secondary indices and the full-text
+ * index do not exist, stores are done in large transactions, and
+ * each store is protected by a savepoint so that a bad keyblock does
+ * not abort the entire batch.  */
+static struct
+{
+  int active;
+  int synchronous;           /* The saved value of PRAGMA synchronous. */
+  sqlite3_int64 nkeys;       /* The number of pubkeys at the start.  */
+  unsigned long nstored;     /* The number of stored keyblocks.  */
+} bulk_load;
+
+/* The number of keyblocks stored in one bulk load transaction.  */
+#define BULK_LOAD_BATCH 10000
+
+/* The maximum number of idle prepared statements we keep.  */
+#define STMT_CACHE_SIZE 32
+
+/* The time in milliseconds a reader waits for a busy database.  */
+#define READER_BUSY_TIMEOUT 5000
+
+/* Cache of idle prepared statements of DATABASE_HD.  The statements
+ * are looked up by their SQL text which is the same for all queries
+ * of the same shape; i.e. search mode and filter flags.  The most
+ * recently used statement is at the end.  */
+static struct
+{
+  sqlite3_stmt *stmt[STMT_CACHE_SIZE];
+  unsigned int nstmt;
+  unsigned long hits;
+  unsigned long misses;
+} stmt_cache;
+
 /* Table definitions for the database.  */
 static struct
 {
@@ -322,14 +371,19 @@ run_sql_reset (sqlite3_stmt *stmt)
 }
 
 
-/* Run an SQL prepare for SQLSTR and return a statement at R_STMT.  If
- * EXTRA is not NULL that part is appended to the SQL statement.  */
+/* Run an SQL prepare for SQLSTR on the connection DB and return a
+ * statement at R_STMT.  If EXTRA is not NULL that part is appended to
+ * the SQL statement.  For the main connection the statement is taken
+ * from the statement cache if possible.  The statement must be
+ * released using release_sql_stmt.  */
 static gpg_error_t
-run_sql_prepare (const char *sqlstr, const char *extra, sqlite3_stmt **r_stmt)
+run_sql_prepare_on (sqlite3 *db, const char *sqlstr, const char *extra,
+                    sqlite3_stmt **r_stmt)
 {
   gpg_error_t err;
   int res;
   char *buffer = NULL;
+  unsigned int idx;
 
   if (extra)
     {
@@ -339,7 +393,27 @@ run_sql_prepare (const char *sqlstr, const char *extra, sqlite3_stmt **r_stmt)
       sqlstr = buffer;
     }
 
-  res = sqlite3_prepare_v2 (database_hd, sqlstr, -1, r_stmt, NULL);
+  idx = 0;
+  if (db == database_hd)
+    {
+      for (idx = stmt_cache.nstmt; idx; idx--)
+        if (!strcmp (sqlite3_sql (stmt_cache.stmt[idx-1]), sqlstr))
+          break;
+      if (!idx)
+        stmt_cache.misses++;
+    }
+  if (idx)
+    {
+      *r_stmt = stmt_cache.stmt[idx-1];
+      memmove (stmt_cache.stmt + idx - 1, stmt_cache.stmt + idx,
+               (stmt_cache.nstmt - idx) * sizeof *stmt_cache.stmt);
+      stmt_cache.nstmt--;
+      stmt_cache.hits++;
+      xfree (buffer);
+      return 0;
+    }
+
+  res = sqlite3_prepare_v2 (db, sqlstr, -1, r_stmt, NULL);
   if (res)
     err = diag_prepare_err (res, sqlstr);
   else
@@ -349,6 +423,60 @@ run_sql_prepare (const char *sqlstr, const char *extra, sqlite3_stmt **r_stmt)
 }
 
 
+/* Run an SQL prepare on the main connection.  See run_sql_prepare_on
+ * for details.  */
+static gpg_error_t
+run_sql_prepare (const char *sqlstr, const char *extra, sqlite3_stmt **r_stmt)
+{
+  return run_sql_prepare_on (database_hd, sqlstr, extra, r_stmt);
+}
+
+
+/* Release the statement STMT which was returned by run_sql_prepare.
+ * A statement of the main connection is reset and put into the
+ * statement cache.  */
+static void
+release_sql_stmt (sqlite3_stmt *stmt)
+{
+  if (!stmt)
+    return;
+
+  if (sqlite3_db_handle (stmt) != database_hd)
+    {
+      sqlite3_finalize (stmt);
+      return;
+    }
+
+  /* An error from reset is the error of the last step which has
+   * already been handled.  */
+  sqlite3_reset (stmt);
+  sqlite3_clear_bindings (stmt);
+
+  if (stmt_cache.nstmt == STMT_CACHE_SIZE)
+    {
+      /* Evict the least recently used statement.  */
+      sqlite3_finalize (stmt_cache.stmt[0]);
+      memmove (stmt_cache.stmt, stmt_cache.stmt + 1,
+               (STMT_CACHE_SIZE - 1) * sizeof *stmt_cache.stmt);
+      stmt_cache.nstmt--;
+    }
+  stmt_cache.stmt[stmt_cache.nstmt++] = stmt;
+}
+
+
+/* Return the counters of the statement cache.  */
+void
+be_sqlite_stmt_cache_stats (unsigned long *r_hits, unsigned long *r_misses,
+                            unsigned int *r_cached)
+{
+  acquire_mutex ();
+  *r_hits = stmt_cache.hits;
+  *r_misses = stmt_cache.misses;
+  *r_cached = stmt_cache.nstmt;
+  release_mutex ();
+}
+
+
 /* Helper to bind a BLOB parameter to a statement.  */
 static gpg_error_t
 run_sql_bind_blob (sqlite3_stmt *stmt, int no,
@@ -382,6 +510,22 @@ run_sql_bind_int (sqlite3_stmt *stmt, int no, int value)
 }
 
 
+/* Helper to bind a 64 bit INTEGER parameter to a statement.  */
+static gpg_error_t
+run_sql_bind_int64 (sqlite3_stmt *stmt, int no, sqlite3_int64 value)
+{
+  gpg_error_t err;
+  int res;
+
+  res = sqlite3_bind_int64 (stmt, no, value);
+  if (res)
+    err = diag_bind_err (res, stmt);
+  else
+    err = 0;
+  return err;
+}
+
+
 /* Helper to bind a string parameter to a statement.  VALUE is allowed
  * to be NULL to bind NULL.  */
 static gpg_error_t
@@ -444,6 +588,57 @@ run_sql_bind_text_like (sqlite3_stmt *stmt, int no, const char *value)
 }
 
 
+/* Helper to bind the words of VALUE as an FTS5 query to a statement.
+ * All words need to match.  Words are the runs of letters and digits;
+ * we quote them so that they are not taken as query syntax.  */
+static gpg_error_t
+run_sql_bind_words (sqlite3_stmt *stmt, int no, const char *value)
+{
+  gpg_error_t err;
+  int res;
+  char *buf, *p;
+  const unsigned char *s;
+  int inword = 0;
+
+  /* In the worst case each character is a word of its own.  */
+  buf = xtrymalloc (4 * strlen (value) + 1);
+  if (!buf)
+    return gpg_error_from_syserror ();
+  for (p = buf, s = value; *s; s++)
+    {
+      if (*s >= 0x80 || alnump (s))
+        {
+          if (!inword)
+            {
+              if (p != buf)
+                *p++ = ' ';
+              *p++ = '\"';
+              inword = 1;
+            }
+          *p++ = *s;
+        }
+      else if (inword)
+        {
+          *p++ = '\"';
+          inword = 0;
+        }
+    }
+  if (inword)
+    *p++ = '\"';
+  *p = 0;
+
+  /* An empty query is a syntax error; no words match nothing.  */
+  res = sqlite3_bind_text (stmt, no, *buf? buf : "\"\"", -1,
+                           SQLITE_TRANSIENT);
+  if (res)
+    err = diag_bind_err (res, stmt);
+  else
+    err = 0;
+  xfree (buf);
+  return err;
+}
+
+
 /* Wrapper around sqlite3_step for use with simple functions.  */
 static gpg_error_t
 run_sql_step (sqlite3_stmt *stmt)
@@ -470,7 +665,16 @@ run_sql_step_for_select (sqlite3_stmt *stmt)
   gpg_error_t err;
   int res;
 
-  res = sqlite3_step (stmt);
+  if (sqlite3_db_handle (stmt) != database_hd)
+    {
+      /* A reader connection is only used by one thread; thus we can
+       * let the other threads run while sqlite does its work.  */
+      npth_unprotect ();
+      res = sqlite3_step (stmt);
+      npth_protect ();
+    }
+  else
+    res = sqlite3_step (stmt);
   if (res == SQLITE_DONE || res == SQLITE_ROW)
     err = gpg_error (gpg_err_code_from_sqlite (res));
   else
@@ -495,7 +699,7 @@ static gpg_error_t
 run_sql_statement_bind_ubid (const char *sqlstr, const unsigned char *ubid)
 {
   gpg_error_t err;
-  sqlite3_stmt *stmt;
+  sqlite3_stmt *stmt = NULL;
 
   err = run_sql_prepare (sqlstr, NULL, &stmt);
   if (err)
@@ -508,11 +712,11 @@ run_sql_statement_bind_ubid (const char *sqlstr, const unsigned char *ubid)
     }
 
   err = run_sql_step (stmt);
-  sqlite3_finalize (stmt);
   if (err)
     goto leave;
 
  leave:
+  release_sql_stmt (stmt);
   return err;
 }
 
@@ -526,6 +730,141 @@ run_sql_statement (const char *sqlstr)
 }
 
 
+/* Helper for create_or_open_database to switch the database to WAL
+ * mode.  */
+static gpg_error_t
+enable_wal_mode (void)
+{
+  gpg_error_t err;
+  sqlite3_stmt *stmt = NULL;
+  const char *s;
+
+  use_reader_connections = 0;
+  err = run_sql_prepare ("PRAGMA journal_mode = WAL", NULL, &stmt);
+  if (err)
+    return err;
+  err = run_sql_step_for_select (stmt);
+  if (gpg_err_code (err) == GPG_ERR_SQL_ROW)
+    {
+      s = sqlite3_column_text (stmt, 0);
+      if (s && !strcmp (s, "wal"))
+        use_reader_connections = !!sqlite3_threadsafe ();
+      else
+        log_info ("note: database not in WAL mode (%s)\n", s? s : "?");
+      err = 0;
+    }
+  else if (gpg_err_code (err) == GPG_ERR_SQL_DONE)
+    err = 0;
+  release_sql_stmt (stmt);
+  return err;
+}
+
+
+/* Helper for create_or_open_database to create the full-text index
+ * of the user ids.  The table userid_fts uses the trigram tokenizer
+ * for substring searches with LIKE and userid_words is used for word
+ * searches.  The rowids of both are those of the userid table.  The
+ * config value "ftsindex" is cleared whenever the database is used
+ * without the index, so that the index is rebuilt the next time it
+ * is available.  */
+static gpg_error_t
+init_fulltext_index (void)
+{
+  gpg_error_t err;
+  int res;
+  char *value;
+
+  have_fulltext_index = 0;
+  res = sqlite3_exec (database_hd,
+                      "CREATE VIRTUAL TABLE IF NOT EXISTS userid_fts"
+                      " USING fts5 (uid, addrspec, tokenize='trigram')",
+                      NULL, NULL, NULL);
+  if (!res)
+    res = sqlite3_exec (database_hd,
+                        "CREATE VIRTUAL TABLE IF NOT EXISTS userid_words"
+                        " USING fts5 (uid,"
+                        " tokenize='unicode61 remove_diacritics 0')",
+                        NULL, NULL, NULL);
+  if (!res)  /* Check that the modules are really there.  */
+    res = sqlite3_exec (database_hd,
+                        "SELECT 1 FROM userid_fts, userid_words LIMIT 0",
+                        NULL, NULL, NULL);
+  if (res)
+    {
+      if (opt.verbose)
+        log_info ("note: full-text search not available: %s\n",
+                  sqlite3_errmsg (database_hd));
+      return set_config_value ("ftsindex", "0");
+    }
+
+  err = get_config_value ("ftsindex", &value);
+  if (!err && !strcmp (value, "1"))
+    {
+      xfree (value);
+      have_fulltext_index = 1;
+      return 0;
+    }
+  xfree (value);
+  if (err && gpg_err_code (err) != GPG_ERR_NOT_FOUND)
+    return err;
+
+  /* (Re-)build the index.  */
+  if (!opt.quiet)
+    log_info ("building the full-text index\n");
+  err = run_sql_statement ("begin transaction");
+  if (err)
+    return err;
+  err = run_sql_statement ("DELETE FROM userid_fts");
+  if (!err)
+    err = run_sql_statement ("DELETE FROM userid_words");
+  if (!err)
+    err = run_sql_statement ("INSERT INTO userid_fts(rowid,uid,addrspec)"
+                             " SELECT rowid, uid, addrspec FROM userid");
+  if (!err)
+    err = run_sql_statement ("INSERT INTO userid_words(rowid,uid)"
+                             " SELECT rowid, uid FROM userid");
+  if (!err)
+    err = set_config_value ("ftsindex", "1");
+  if (!err)
+    err = run_sql_statement ("commit");
+  else if (run_sql_statement ("rollback"))
+    log_error ("Warning: database rollback failed - should not happen!\n");
+  if (!err)
+    have_fulltext_index = 1;
+  return err;
+}
+
+
+/* Open the per request read-only connection for CTX.  */
+static gpg_error_t
+open_reader_connection (backend_handle_t backend_hd, be_sqlite_local_t ctx)
+{
+  gpg_error_t err;
+  int res;
+
+  if (ctx->readdb)
+    return 0;
+  if (!use_reader_connections)
+    return gpg_error (GPG_ERR_NOT_SUPPORTED);
+
+  res = sqlite3_open_v2 (backend_hd->filename, &ctx->readdb,
+                         (SQLITE_OPEN_READONLY | SQLITE_OPEN_NOMUTEX),
+                         NULL);
+  if (res)
+    {
+      err = gpg_error (gpg_err_code_from_sqlite (res));
+      log_error ("error opening '%s' for reading: %s\n",
+                 backend_hd->filename, sqlite3_errstr (res));
+      sqlite3_close (ctx->readdb);
+      ctx->readdb = NULL;
+      return err;
+    }
+  sqlite3_extended_result_codes (ctx->readdb, 1);
+  sqlite3_busy_timeout (ctx->readdb, READER_BUSY_TIMEOUT);
+  return 0;
+}
+
+
 /* Create and initialize a new SQL database file if it does not
  * exists; else open it and check that all required objects are
  * available.  */
@@ -573,7 +912,8 @@ create_or_open_database (const char *filename)
    * the tables exist, and prepare the required statements.  We use
    * our own locking instead of the more complex serialization sqlite
    * would have to do and it avoid that we call
-   * npth_unprotect/protect.  */
+   * npth_unprotect/protect.  Only searches on the per request reader
+   * connections run unprotected.  */
   res = sqlite3_open_v2 (filename,
                          &database_hd,
                          (SQLITE_OPEN_READWRITE
@@ -589,6 +929,13 @@ create_or_open_database (const char *filename)
   /* Enable extended error codes.  */
   sqlite3_extended_result_codes (database_hd, 1);
 
+  /* Switch to WAL mode so that readers don't block the writer and
+   * vice versa.  Only then we use separate connections for reading.
+   * The mode is persistent and thus only set once.  */
+  err = enable_wal_mode ();
+  if (err)
+    goto leave;
+
   /* Create the tables if needed.  */
   for (idx=0; idx < DIM(table_definitions); idx++)
     {
@@ -643,6 +990,10 @@ create_or_open_database (const char *filename)
         err = set_config_value ("created", isotimestamp (gnupg_get_time ()));
     }
 
+  err = init_fulltext_index ();
+  if (err)
+    goto leave;
+
 
   err = 0;
 
@@ -725,8 +1076,16 @@ be_sqlite_init_local (backend_handle_t backend_hd, db_request_part_t part)
 void
 be_sqlite_release_local (be_sqlite_local_t ctx)
 {
+  if (!ctx)
+    return;
   if (ctx->select_stmt)
-    sqlite3_finalize (ctx->select_stmt);
+    {
+      acquire_mutex ();
+      release_sql_stmt (ctx->select_stmt);
+      release_mutex ();
+    }
+  if (ctx->readdb)
+    sqlite3_close (ctx->readdb);
   xfree (ctx);
 }
 
@@ -804,7 +1163,7 @@ get_config_value (const char *name, char **r_value)
   else
     log_assert (err);  /* We'll never see 0 here.  */
 
-  sqlite3_finalize (stmt);
+  release_sql_stmt (stmt);
 
   return err;
 }
@@ -828,12 +1187,22 @@ set_config_value (const char *name, const char *value)
   if (!err)
     err = run_sql_step (stmt);
 
-  sqlite3_finalize (stmt);
+  release_sql_stmt (stmt);
 
   return err;
 }
 
 
+/* Helper for run_select_statement to prepare the select statement
+ * SQLSTR,EXTRA on the connection to be used for CTX.  */
+static gpg_error_t
+prepare_select (be_sqlite_local_t ctx, const char *sqlstr, const char *extra)
+{
+  return run_sql_prepare_on (ctx->select_db, sqlstr, extra,
+                             &ctx->select_stmt);
+}
+
+
 /* Run a select for the search given by (DESC,NDESC).  The data is not
  * returned but stored in the request item.  */
 static gpg_error_t
@@ -856,16 +1225,21 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
   /* Check whether we can re-use the current select statement.  */
   if (!ctx->select_stmt)
     ;
+  else if (sqlite3_db_handle (ctx->select_stmt) != ctx->select_db)
+    {
+      release_sql_stmt (ctx->select_stmt);
+      ctx->select_stmt = NULL;
+    }
   else if (ctx->select_mode != desc[descidx].mode)
     {
-      sqlite3_finalize (ctx->select_stmt);
+      release_sql_stmt (ctx->select_stmt);
       ctx->select_stmt = NULL;
     }
   else if (ctx->filter_opgp != ctrl->filter_opgp
            || ctx->filter_x509 != ctrl->filter_x509)
     {
       /* The filter flags changed, thus we can't reuse the statement.  */
-      sqlite3_finalize (ctx->select_stmt);
+      release_sql_stmt (ctx->select_stmt);
       ctx->select_stmt = NULL;
     }
 
@@ -904,34 +1278,46 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_EXACT:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid AND u.uid = ?1",
-                               extra, &ctx->select_stmt);
+        err = prepare_select (ctx,
+                              "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+                              " p.keyblob, u.uidno"
+                              " FROM pubkey as p, userid as u"
+                              " WHERE p.ubid = u.ubid AND u.uid = ?1",
+                              extra);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1, desc[descidx].u.name);
       break;
     case KEYDB_SEARCH_MODE_MAIL:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid AND u.addrspec = ?1",
-                               extra, &ctx->select_stmt);
+        err = prepare_select (ctx,
+                              "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+                              " p.keyblob, u.uidno"
+                              " FROM pubkey as p, userid as u"
+                              " WHERE p.ubid = u.ubid AND u.addrspec = ?1",
+                              extra);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1, desc[descidx].u.name);
       break;
 
     case KEYDB_SEARCH_MODE_MAILSUB:
       ctx->select_col_uidno = 5;
-      if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid AND u.addrspec LIKE ?1",
-                               extra, &ctx->select_stmt);
+      if (!ctx->select_stmt && have_fulltext_index)
+        err = prepare_select (ctx,
+                              "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+                              " p.keyblob, u.uidno"
+                              " FROM pubkey as p, userid as u"
+                              " WHERE u.rowid IN (SELECT f.rowid"
+                              " FROM userid_fts as f WHERE f.addrspec LIKE ?1)"
+                              " AND p.ubid = u.ubid",
+                              extra);
+      else if (!ctx->select_stmt)
+        err = prepare_select (ctx,
+                              "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+                              " p.keyblob, u.uidno"
+                              " FROM pubkey as p, userid as u"
+                              " WHERE p.ubid = u.ubid AND u.addrspec LIKE ?1",
+                              extra);
       if (!err)
         err = run_sql_bind_text_like (ctx->select_stmt, 1,
                                       desc[descidx].u.name);
@@ -939,30 +1325,61 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_SUBSTR:
       ctx->select_col_uidno = 5;
-      if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid AND u.uid LIKE ?1",
-                               extra, &ctx->select_stmt);
+      if (!ctx->select_stmt && have_fulltext_index)
+        err = prepare_select (ctx,
+                              "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+                              " p.keyblob, u.uidno"
+                              " FROM pubkey as p, userid as u"
+                              " WHERE u.rowid IN (SELECT f.rowid"
+                              " FROM userid_fts as f WHERE f.uid LIKE ?1)"
+                              " AND p.ubid = u.ubid",
+                              extra);
+      else if (!ctx->select_stmt)
+        err = prepare_select (ctx,
+                              "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+                              " p.keyblob, u.uidno"
+                              " FROM pubkey as p, userid as u"
+                              " WHERE p.ubid = u.ubid AND u.uid LIKE ?1",
+                              extra);
       if (!err)
         err = run_sql_bind_text_like (ctx->select_stmt, 1,
                                       desc[descidx].u.name);
       break;
 
-    case KEYDB_SEARCH_MODE_MAILEND:
     case KEYDB_SEARCH_MODE_WORDS:
+      if (!have_fulltext_index)
+        {
+          err = gpg_error (GPG_ERR_NOT_IMPLEMENTED);
+          break;
+        }
+      ctx->select_col_uidno = 5;
+      if (!ctx->select_stmt)
+        err = prepare_select (ctx,
+                              "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+                              " p.keyblob, u.uidno"
+                              " FROM pubkey as p, userid as u"
+                              " WHERE u.rowid IN (SELECT w.rowid"
+                              " FROM userid_words as w"
+                              " WHERE userid_words MATCH ?1)"
+                              " AND p.ubid = u.ubid",
+                              extra);
+      if (!err)
+        err = run_sql_bind_words (ctx->select_stmt, 1, desc[descidx].u.name);
+      break;
+
+    case KEYDB_SEARCH_MODE_MAILEND:
       err = gpg_error (GPG_ERR_NOT_IMPLEMENTED);
       break;
 
     case KEYDB_SEARCH_MODE_ISSUER:
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob"
-                               " FROM pubkey as p, issuer as i"
-                               " WHERE p.ubid = i.ubid"
-                               " AND i.dn = $1",
-                               extra, &ctx->select_stmt);
+        err = prepare_select (ctx,
+                              "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+                              " p.keyblob"
+                              " FROM pubkey as p, issuer as i"
+                              " WHERE p.ubid = i.ubid"
+                              " AND i.dn = $1",
+                              extra);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1,
                                  desc[descidx].u.name);
@@ -978,12 +1395,13 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
       else
         {
           if (!ctx->select_stmt)
-            err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                                   " p.revoked, p.keyblob"
-                                   " FROM pubkey as p, issuer as i"
-                                   " WHERE p.ubid = i.ubid"
-                                   " AND i.sn = $1 AND i.dn = $2",
-                                   extra, &ctx->select_stmt);
+            err = prepare_select (ctx,
+                                  "SELECT p.ubid, p.type, p.ephemeral,"
+                                  " p.revoked, p.keyblob"
+                                  " FROM pubkey as p, issuer as i"
+                                  " WHERE p.ubid = i.ubid"
+                                  " AND i.sn = $1 AND i.dn = $2",
+                                  extra);
           if (!err)
             err = run_sql_bind_ntext (ctx->select_stmt, 1,
                                       desc[descidx].sn, desc[descidx].snlen);
@@ -1003,12 +1421,13 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_SUBJECT:
       ctx->select_col_uidno = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, u.uidno"
-                               " FROM pubkey as p, userid as u"
-                               " WHERE p.ubid = u.ubid"
-                               " AND u.uid = $1",
-                               extra, &ctx->select_stmt);
+        err = prepare_select (ctx,
+                              "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+                              " p.keyblob, u.uidno"
+                              " FROM pubkey as p, userid as u"
+                              " WHERE p.ubid = u.ubid"
+                              " AND u.uid = $1",
+                              extra);
       if (!err)
         err = run_sql_bind_text (ctx->select_stmt, 1,
                                  desc[descidx].u.name);
@@ -1017,12 +1436,13 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_SHORT_KID:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND"
-                               " substr(f.kid,5) = ?1",
-                               extra, &ctx->select_stmt);
+        err = prepare_select (ctx,
+                              "SELECT p.ubid, p.type, p.ephemeral,"
+                              " p.revoked, p.keyblob, f.subkey"
+                              " FROM pubkey as p, fingerprint as f"
+                              " WHERE p.ubid = f.ubid AND"
+                              " substr(f.kid,5) = ?1",
+                              extra);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  kid_from_u32 (desc[descidx].u.kid, kidbuf)+4,
@@ -1032,11 +1452,12 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_LONG_KID:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND f.kid = ?1",
-                               extra, &ctx->select_stmt);
+        err = prepare_select (ctx,
+                              "SELECT p.ubid, p.type, p.ephemeral,"
+                              " p.revoked, p.keyblob, f.subkey"
+                              " FROM pubkey as p, fingerprint as f"
+                              " WHERE p.ubid = f.ubid AND f.kid = ?1",
+                              extra);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  kid_from_u32 (desc[descidx].u.kid, kidbuf),
@@ -1046,11 +1467,12 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_FPR:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral,"
-                               " p.revoked, p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND f.fpr = ?1",
-                               extra, &ctx->select_stmt);
+        err = prepare_select (ctx,
+                              "SELECT p.ubid, p.type, p.ephemeral,"
+                              " p.revoked, p.keyblob, f.subkey"
+                              " FROM pubkey as p, fingerprint as f"
+                              " WHERE p.ubid = f.ubid AND f.fpr = ?1",
+                              extra);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  desc[descidx].u.fpr, desc[descidx].fprlen);
@@ -1059,11 +1481,12 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
     case KEYDB_SEARCH_MODE_KEYGRIP:
       ctx->select_col_subkey = 5;
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
-                               " p.keyblob, f.subkey"
-                               " FROM pubkey as p, fingerprint as f"
-                               " WHERE p.ubid = f.ubid AND f.keygrip = ?1",
-                               extra, &ctx->select_stmt);
+        err = prepare_select (ctx,
+                              "SELECT p.ubid, p.type, p.ephemeral, p.revoked,"
+                              " p.keyblob, f.subkey"
+                              " FROM pubkey as p, fingerprint as f"
+                              " WHERE p.ubid = f.ubid AND f.keygrip = ?1",
+                              extra);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  desc[descidx].u.grip, KEYGRIP_LEN);
@@ -1071,10 +1494,11 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
 
     case KEYDB_SEARCH_MODE_UBID:
       if (!ctx->select_stmt)
-        err = run_sql_prepare ("SELECT ubid, type, ephemeral, revoked, keyblob"
-                               " FROM pubkey as p"
-                               " WHERE ubid = ?1",
-                               extra, &ctx->select_stmt);
+        err = prepare_select (ctx,
+                              "SELECT ubid, type, ephemeral, revoked, keyblob"
+                              " FROM pubkey as p"
+                              " WHERE ubid = ?1",
+                              extra);
       if (!err)
         err = run_sql_bind_blob (ctx->select_stmt, 1,
                                  desc[descidx].u.ubid, UBID_LEN);
@@ -1092,10 +1516,11 @@ run_select_statement (ctrl_t ctrl, be_sqlite_local_t ctx,
           else
             extra = " ORDER by ubid";
 
-          err = run_sql_prepare ("SELECT ubid, type, ephemeral, revoked,"
-                                 " keyblob"
-                                 " FROM pubkey as p",
-                                 extra, &ctx->select_stmt);
+          err = prepare_select (ctx,
+                                "SELECT ubid, type, ephemeral, revoked,"
+                                " keyblob"
+                                " FROM pubkey as p",
+                                extra);
         }
       break;
 
@@ -1124,13 +1549,14 @@ be_sqlite_search (ctrl_t ctrl,
   gpg_error_t err;
   db_request_part_t part;
   be_sqlite_local_t ctx;
+  int use_reader;
+  int got_mutex = 0;
 
   log_assert (backend_hd && backend_hd->db_type == DB_TYPE_SQLITE);
   log_assert (request);
 
-  acquire_mutex ();
-
-  /* Find the specific request part or allocate it.  */
+  /* Find the specific request part or allocate it.  This is per
+   * session data and thus does not need the mutex.  */
   err = be_find_request_part (backend_hd, request, &part);
   if (err)
     goto leave;
@@ -1153,13 +1579,42 @@ be_sqlite_search (ctrl_t ctrl,
       goto leave;
     }
 
-  /* Start a global transaction if needed.  */
-  if (!opt.active_transaction && opt.in_transaction)
+  /* Decide which connection to use.  A running select continues on
+   * its connection.  Within a global transaction we need to use the
+   * main connection so that we see the changes of the transaction.  */
+  if (ctx->select_done && ctx->select_stmt)
+    use_reader = (sqlite3_db_handle (ctx->select_stmt) != database_hd);
+  else
+    use_reader = (!opt.in_transaction
+                  && !open_reader_connection (backend_hd, ctx));
+
+  if (use_reader)
     {
-      err = run_sql_statement ("begin transaction");
-      if (err)
-        goto leave;
-      opt.active_transaction = 1;
+      ctx->select_db = ctx->readdb;
+      if (ctx->select_stmt
+          && sqlite3_db_handle (ctx->select_stmt) == database_hd)
+        {
+          /* Give the statement of the main connection back.  */
+          acquire_mutex ();
+          release_sql_stmt (ctx->select_stmt);
+          release_mutex ();
+          ctx->select_stmt = NULL;
+        }
+    }
+  else
+    {
+      ctx->select_db = database_hd;
+      acquire_mutex ();
+      got_mutex = 1;
+
+      /* Start a global transaction if needed.  */
+      if (!opt.active_transaction && opt.in_transaction)
+        {
+          err = run_sql_statement ("begin transaction");
+          if (err)
+            goto leave;
+          opt.active_transaction = 1;
+        }
     }
 
 
@@ -1190,7 +1645,7 @@ be_sqlite_search (ctrl_t ctrl,
       n = sqlite3_column_bytes (ctx->select_stmt, 0);
       if (!ubid || n < 0)
         {
-          if (!ubid && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!ubid && sqlite3_errcode (ctx->select_db) == SQLITE_NOMEM)
             err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           else
             err = gpg_error (GPG_ERR_DB_CORRUPTED);
@@ -1207,7 +1662,7 @@ be_sqlite_search (ctrl_t ctrl,
         }
 
       n = sqlite3_column_int (ctx->select_stmt, 1);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (ctx->select_db) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1218,7 +1673,7 @@ be_sqlite_search (ctrl_t ctrl,
       pubkey_type = n;
 
       n = sqlite3_column_int (ctx->select_stmt, 2);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (ctx->select_db) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1229,7 +1684,7 @@ be_sqlite_search (ctrl_t ctrl,
       is_ephemeral = !!n;
 
       n = sqlite3_column_int (ctx->select_stmt, 3);
-      if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+      if (!n && sqlite3_errcode (ctx->select_db) == SQLITE_NOMEM)
         {
           err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           show_sqlstmt (ctx->select_stmt);
@@ -1243,7 +1698,7 @@ be_sqlite_search (ctrl_t ctrl,
       n = sqlite3_column_bytes (ctx->select_stmt, 4);
       if (!keyblob || n < 0)
         {
-          if (!keyblob && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!keyblob && sqlite3_errcode (ctx->select_db) == SQLITE_NOMEM)
             err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
           else
             err = gpg_error (GPG_ERR_DB_CORRUPTED);
@@ -1257,7 +1712,7 @@ be_sqlite_search (ctrl_t ctrl,
       if (ctx->select_col_uidno)
         {
           n = sqlite3_column_int (ctx->select_stmt, ctx->select_col_uidno);
-          if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!n && sqlite3_errcode (ctx->select_db) == SQLITE_NOMEM)
             {
               err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
               show_sqlstmt (ctx->select_stmt);
@@ -1276,7 +1731,7 @@ be_sqlite_search (ctrl_t ctrl,
       if (ctx->select_col_subkey)
         {
           n = sqlite3_column_int (ctx->select_stmt, ctx->select_col_subkey);
-          if (!n && sqlite3_errcode (database_hd) == SQLITE_NOMEM)
+          if (!n && sqlite3_errcode (ctx->select_db) == SQLITE_NOMEM)
             {
               err = gpg_error (gpg_err_code_from_sqlite (SQLITE_NOMEM));
               show_sqlstmt (ctx->select_stmt);
@@ -1313,7 +1768,8 @@ be_sqlite_search (ctrl_t ctrl,
     }
 
  leave:
-  release_mutex ();
+  if (got_mutex)
+    release_mutex ();
   return err;
 }
 
@@ -1353,8 +1809,7 @@ store_into_pubkey (enum kbxd_store_modes mode,
   err = run_sql_step (stmt);
 
  leave:
-  if (stmt)
-    sqlite3_finalize (stmt);
+  release_sql_stmt (stmt);
   return err;
 }
 
@@ -1395,8 +1850,7 @@ store_into_fingerprint (const unsigned char *ubid, int subkey,
   err = run_sql_step (stmt);
 
  leave:
-  if (stmt)
-    sqlite3_finalize (stmt);
+  release_sql_stmt (stmt);
   return err;
 }
 
@@ -1412,6 +1866,7 @@ store_into_userid (const unsigned char *ubid, enum pubkey_types pktype,
   const char *sqlstr;
   sqlite3_stmt *stmt = NULL;
   char *addrspec = NULL;
+  sqlite3_int64 rowid;
 
   sqlstr = ("INSERT OR REPLACE INTO userid(uid,addrspec,type,ubid,uidno)"
             " VALUES(?1,?2,?3,?4,?5)");
@@ -1444,15 +1899,62 @@ store_into_userid (const unsigned char *ubid, enum pubkey_types pktype,
     goto leave;
 
   err = run_sql_step (stmt);
+  if (err || !have_fulltext_index)
+    goto leave;
+  rowid = sqlite3_last_insert_rowid (database_hd);
+
+  /* Add the user id to the full-text index.  */
+  release_sql_stmt (stmt);
+  err = run_sql_prepare ("INSERT INTO userid_fts(rowid,uid,addrspec)"
+                         " VALUES(?1,?2,?3)", NULL, &stmt);
+  if (!err)
+    err = run_sql_bind_int64 (stmt, 1, rowid);
+  if (!err)
+    err = run_sql_bind_text (stmt, 2, uid);
+  if (!err)
+    err = run_sql_bind_text (stmt, 3, override_mbox? override_mbox : addrspec);
+  if (!err)
+    err = run_sql_step (stmt);
+  if (err)
+    goto leave;
+
+  release_sql_stmt (stmt);
+  err = run_sql_prepare ("INSERT INTO userid_words(rowid,uid)"
+                         " VALUES(?1,?2)", NULL, &stmt);
+  if (!err)
+    err = run_sql_bind_int64 (stmt, 1, rowid);
+  if (!err)
+    err = run_sql_bind_text (stmt, 2, uid);
+  if (!err)
+    err = run_sql_step (stmt);
 
  leave:
-  if (stmt)
-    sqlite3_finalize (stmt);
+  release_sql_stmt (stmt);
   xfree (addrspec);
   return err;
 }
 
 
+/* Remove the user ids of UBID from the full-text index.  This must
+ * be called before they are deleted from the userid table.  */
+static gpg_error_t
+delete_from_fulltext_index (const unsigned char *ubid)
+{
+  gpg_error_t err;
+
+  if (!have_fulltext_index)
+    return 0;
+  err = run_sql_statement_bind_ubid
+    ("DELETE FROM userid_fts WHERE rowid IN"
+     " (SELECT rowid FROM userid WHERE ubid = ?1)", ubid);
+  if (!err)
+    err = run_sql_statement_bind_ubid
+      ("DELETE FROM userid_words WHERE rowid IN"
+       " (SELECT rowid FROM userid WHERE ubid = ?1)", ubid);
+  return err;
+}
+
+
 /* Helper for be_sqlite_store to update or insert a row in the
  * issuer table.  */
 static gpg_error_t
@@ -1483,13 +1985,74 @@ store_into_issuer (const unsigned char *ubid,
   err = run_sql_step (stmt);
 
  leave:
-  if (stmt)
-    sqlite3_finalize (stmt);
+  release_sql_stmt (stmt);
   xfree (addrspec);
   return err;
 }
 
 
+/* Helper for be_sqlite_store to finish the store of a keyblock during
+ * a bulk load.  ERR is the error of the store; if it is set the
+ * changes of this store are undone.  Every BULK_LOAD_BATCH keyblocks
+ * the transaction is committed.  */
+static gpg_error_t
+finish_bulk_load_store (gpg_error_t err)
+{
+  if (!err)
+    err = run_sql_statement ("release bulkload");
+  else if (run_sql_statement ("rollback to bulkload")
+           || run_sql_statement ("release bulkload"))
+    log_error ("Warning: database rollback failed - should not happen!\n");
+  if (err)
+    return err;
+
+  if (!(++bulk_load.nstored % BULK_LOAD_BATCH))
+    {
+      if (opt.verbose)
+        log_info ("%lu keyblocks stored\n", bulk_load.nstored);
+      err = run_sql_statement ("commit");
+      if (!err)
+        err = run_sql_statement ("begin transaction");
+    }
+  return err;
+}
+
+
+/* Helper for be_sqlite_store and be_sqlite_delete to start a
+ * savepoint when running inside a global transaction.  This allows
+ * to undo a failed operation without rolling back the entire
+ * transaction.  Sets R_SAVEPOINT on success.  */
+static gpg_error_t
+begin_op_savepoint (int *r_savepoint)
+{
+  gpg_error_t err;
+
+  *r_savepoint = 0;
+  if (!opt.active_transaction)
+    return 0;
+  err = run_sql_statement ("savepoint kbxop");
+  if (!err)
+    *r_savepoint = 1;
+  return err;
+}
+
+
+/* Finish the savepoint started by begin_op_savepoint.  ERR is the
+ * error of the operation; if it is set the changes done since the
+ * savepoint are undone.  Returns ERR or an error from releasing the
+ * savepoint.  */
+static gpg_error_t
+finish_op_savepoint (gpg_error_t err)
+{
+  if (!err)
+    err = run_sql_statement ("release kbxop");
+  else if (run_sql_statement ("rollback to kbxop")
+           || run_sql_statement ("release kbxop"))
+    log_error ("Warning: database rollback failed - should not happen!\n");
+  return err;
+}
+
+
 /* Store (BLOB,BLOBLEN) into the database.  UBID is the UBID matching
  * that blob.  BACKEND_HD is the handle for this backend and REQUEST
  * is the current database request object.  MODE is the store
@@ -1505,6 +2068,7 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
   /* be_sqlite_local_t ctx; */
   int got_mutex = 0;
   int in_transaction = 0;
+  int in_savepoint = 0;
   int info_valid = 0;
   struct _keybox_openpgp_info info;
   ksba_cert_t cert = NULL;
@@ -1558,7 +2122,16 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
     goto leave;
   /* ctx = part->besqlite; */
 
-  if (!opt.active_transaction)
+  if (bulk_load.active)
+    {
+      /* Without the indices deleting the related rows would require
+       * a full table scan; thus a bulk load may only insert.  */
+      log_assert (mode == KBXD_STORE_INSERT);
+      err = run_sql_statement ("savepoint bulkload");
+      if (err)
+        goto leave;
+    }
+  else if (!opt.active_transaction)
     {
       err = run_sql_statement ("begin transaction");
       if (err)
@@ -1567,28 +2140,33 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
         opt.active_transaction = 1;
     }
   in_transaction = 1;
+  if (!bulk_load.active)
+    {
+      err = begin_op_savepoint (&in_savepoint);
+      if (err)
+        goto leave;
+    }
 
   err = store_into_pubkey (mode, pktype, ubid, blob, bloblen);
   if (err)
     goto leave;
 
   /* Delete all related rows so that we can freshly add possibly added
-   * or changed user ids and subkeys.  */
-  err = run_sql_statement_bind_ubid
-    ("DELETE FROM fingerprint WHERE ubid = ?1", ubid);
-  if (err)
+   * or changed user ids and subkeys.  A successful insert tells us
+   * that there are none.  */
+  if (mode == KBXD_STORE_INSERT)
+    ;
+  else if ((err = run_sql_statement_bind_ubid
+            ("DELETE FROM fingerprint WHERE ubid = ?1", ubid)))
     goto leave;
-  err = run_sql_statement_bind_ubid
-    ("DELETE FROM userid WHERE ubid = ?1", ubid);
-  if (err)
+  else if ((err = delete_from_fulltext_index (ubid)))
+    goto leave;
+  else if ((err = run_sql_statement_bind_ubid
+            ("DELETE FROM userid WHERE ubid = ?1", ubid)))
+    goto leave;
+  else if (cert && (err = run_sql_statement_bind_ubid
+                    ("DELETE FROM issuer WHERE ubid = ?1", ubid)))
     goto leave;
-  if (cert)
-    {
-      err = run_sql_statement_bind_ubid
-        ("DELETE FROM issuer WHERE ubid = ?1", ubid);
-      if (err)
-        goto leave;
-    }
 
   if (cert)  /* X.509 */
     {
@@ -1708,7 +2286,11 @@ be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
     }
 
  leave:
-  if (in_transaction && !err)
+  if (in_transaction && bulk_load.active)
+    err = finish_bulk_load_store (err);
+  else if (in_savepoint)
+    err = finish_op_savepoint (err);
+  else if (in_transaction && !err)
     {
       if (opt.active_transaction)
         ; /* We are in a global transaction.  */
@@ -1747,6 +2329,7 @@ be_sqlite_delete (ctrl_t ctrl, backend_handle_t backend_hd,
   /* be_sqlite_local_t ctx; */
   sqlite3_stmt *stmt = NULL;
   int in_transaction = 0;
+  int in_savepoint = 0;
 
   (void)ctrl;
 
@@ -1770,9 +2353,14 @@ be_sqlite_delete (ctrl_t ctrl, backend_handle_t backend_hd,
         opt.active_transaction = 1;
     }
   in_transaction = 1;
+  err = begin_op_savepoint (&in_savepoint);
+  if (err)
+    goto leave;
 
-  err = run_sql_statement_bind_ubid
-    ("DELETE from userid WHERE ubid = ?1", ubid);
+  err = delete_from_fulltext_index (ubid);
+  if (!err)
+    err = run_sql_statement_bind_ubid
+      ("DELETE from userid WHERE ubid = ?1", ubid);
   if (!err)
     err = run_sql_statement_bind_ubid
       ("DELETE from fingerprint WHERE ubid = ?1", ubid);
@@ -1785,10 +2373,11 @@ be_sqlite_delete (ctrl_t ctrl, backend_handle_t backend_hd,
 
 
  leave:
-  if (stmt)
-    sqlite3_finalize (stmt);
+  release_sql_stmt (stmt);
 
-  if (in_transaction && !err)
+  if (in_savepoint)
+    err = finish_op_savepoint (err);
+  else if (in_transaction && !err)
     {
       if (opt.active_transaction)
         ; /* We are in a global transaction.  */
@@ -1805,3 +2394,215 @@ be_sqlite_delete (ctrl_t ctrl, backend_handle_t backend_hd,
   release_mutex ();
   return err;
 }
+
+
+
+/* Run the SQL statement SQLSTR which returns a single integer and
+ * store that at R_VALUE.  */
+static gpg_error_t
+get_int_value (const char *sqlstr, sqlite3_int64 *r_value)
+{
+  gpg_error_t err;
+  sqlite3_stmt *stmt;
+
+  *r_value = 0;
+  err = run_sql_prepare (sqlstr, NULL, &stmt);
+  if (err)
+    return err;
+  err = run_sql_step_for_select (stmt);
+  if (gpg_err_code (err) == GPG_ERR_SQL_ROW)
+    {
+      *r_value = sqlite3_column_int64 (stmt, 0);
+      err = 0;
+    }
+  else if (gpg_err_code (err) == GPG_ERR_SQL_DONE)
+    err = gpg_error (GPG_ERR_NOT_FOUND);
+  release_sql_stmt (stmt);
+  return err;
+}
+
+
+/* Drop the indices of table_definitions.  They are re-created at the
+ * end of the bulk load or the next time the database is opened.  */
+static gpg_error_t
+drop_secondary_indices (void)
+{
+  static const char prefix[] = "CREATE INDEX IF NOT EXISTS ";
+  gpg_error_t err = 0;
+  const char *name;
+  char *sqlstr;
+  int idx;
+
+  for (idx=0; idx < DIM(table_definitions) && !err; idx++)
+    {
+      if (strncmp (table_definitions[idx].sql, prefix, strlen (prefix)))
+        continue;
+      name = table_definitions[idx].sql + strlen (prefix);
+      sqlstr = xtryasprintf ("DROP INDEX IF EXISTS %.*s",
+                             (int)strcspn (name, " "), name);
+      if (!sqlstr)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = run_sql_statement (sqlstr);
+          xfree (sqlstr);
+        }
+    }
+  return err;
+}
+
+
+/* Check the database after a bulk load.  NKEYS is the expected
+ * number of pubkeys.  */
+static gpg_error_t
+verify_bulk_load (sqlite3_int64 nkeys)
+{
+  gpg_error_t err;
+  sqlite3_stmt *stmt;
+  sqlite3_int64 n;
+  const char *s;
+
+  err = get_int_value ("SELECT count(*) FROM pubkey", &n);
+  if (err)
+    return err;
+  if (n != nkeys)
+    {
+      log_error ("database has %lld keyblocks but %lld are expected\n",
+                 (long long)n, (long long)nkeys);
+      return gpg_error (GPG_ERR_INV_KEYRING);
+    }
+
+  /* Each row of foreign_key_check describes a dangling reference.  */
+  err = run_sql_prepare ("PRAGMA foreign_key_check", NULL, &stmt);
+  if (err)
+    return err;
+  err = run_sql_step_for_select (stmt);
+  release_sql_stmt (stmt);
+  if (gpg_err_code (err) == GPG_ERR_SQL_ROW)
+    {
+      log_error ("database has rows without a keyblock\n");
+      return gpg_error (GPG_ERR_INV_KEYRING);
+    }
+  else if (gpg_err_code (err) != GPG_ERR_SQL_DONE)
+    return err;
+
+  /* quick_check also verifies that the indices match the tables.  */
+  err = run_sql_prepare ("PRAGMA quick_check", NULL, &stmt);
+  if (err)
+    return err;
+  err = run_sql_step_for_select (stmt);
+  if (gpg_err_code (err) == GPG_ERR_SQL_ROW)
+    {
+      s = sqlite3_column_text (stmt, 0);
+      if (s && !strcmp (s, "ok"))
+        err = 0;
+      else
+        {
+          log_error ("database check failed: %s\n", s? s : "?");
+          err = gpg_error (GPG_ERR_INV_KEYRING);
+        }
+    }
+  release_sql_stmt (stmt);
+  return err;
+}
+
+
+/* Start a bulk load into the database.  Until be_sqlite_end_bulk_load
+ * is called the only allowed operation is be_sqlite_store with mode
+ * KBXD_STORE_INSERT.  To speed up the load we drop the indices and
+ * the full-text index and don't sync the database file.  If the
+ * process dies during the load, the next open of the database
+ * re-creates the indices; the keyblocks of the last batch are
+ * lost.  */
+gpg_error_t
+be_sqlite_begin_bulk_load (void)
+{
+  gpg_error_t err;
+  sqlite3_int64 n;
+
+  acquire_mutex ();
+  if (!database_hd)
+    {
+      err = gpg_error (GPG_ERR_NOT_INITIALIZED);
+      goto leave;
+    }
+  if (bulk_load.active || opt.in_transaction)
+    {
+      err = gpg_error (GPG_ERR_CONFLICT);
+      goto leave;
+    }
+
+  err = get_int_value ("SELECT count(*) FROM pubkey", &bulk_load.nkeys);
+  if (err)
+    goto leave;
+  err = get_int_value ("PRAGMA synchronous", &n);
+  if (err)
+    goto leave;
+  bulk_load.synchronous = (int)n;
+  bulk_load.nstored = 0;
+
+  /* The full-text index is not updated during the load.  Clearing
+   * the config value makes sure that it is rebuilt even if we don't
+   * get to the end.  */
+  err = set_config_value ("ftsindex", "0");
+  if (err)
+    goto leave;
+  have_fulltext_index = 0;
+
+  err = drop_secondary_indices ();
+  if (!err)
+    err = run_sql_statement ("PRAGMA synchronous = OFF");
+  if (!err)
+    err = run_sql_statement ("begin transaction");
+  if (!err)
+    bulk_load.active = 1;
+
+ leave:
+  release_mutex ();
+  return err;
+}
+
+
+/* Finish a bulk load started by be_sqlite_begin_bulk_load.  This
+ * commits the keyblocks, re-creates the indices and checks the
+ * database.  */
+gpg_error_t
+be_sqlite_end_bulk_load (void)
+{
+  gpg_error_t err;
+  gpg_error_t err2;
+  char numbuf[35];
+  int idx;
+
+  acquire_mutex ();
+  if (!bulk_load.active)
+    {
+      release_mutex ();
+      return gpg_error (GPG_ERR_NO_DATA);
+    }
+  bulk_load.active = 0;
+
+  err = run_sql_statement ("commit");
+  if (err)
+    goto leave;
+
+  if (!opt.quiet)
+    log_info ("%lu keyblocks stored; creating the indices\n",
+              bulk_load.nstored);
+  for (idx=0; idx < DIM(table_definitions) && !err; idx++)
+    if (!strncmp (table_definitions[idx].sql, "CREATE INDEX", 12))
+      err = run_sql_statement (table_definitions[idx].sql);
+  if (!err)
+    err = init_fulltext_index ();
+  if (!err)
+    err = verify_bulk_load (bulk_load.nkeys + bulk_load.nstored);
+
+ leave:
+  snprintf (numbuf, sizeof numbuf, "PRAGMA synchronous = %d",
+            bulk_load.synchronous);
+  err2 = run_sql_statement (numbuf);
+  if (!err)
+    err = err2;
+  release_mutex ();
+  return err;
+}
@@ -107,6 +107,7 @@ be_release_request (db_request_t req)
   if (!req)
     return;
 
+  be_cache_query_stop (req);
   for (part = req->part; part; part = partn)
     {
       partn = part->next;
@@ -172,6 +173,19 @@ be_return_pubkey (ctrl_t ctrl, const void *buffer, size_t buflen,
   gpg_error_t err;
   char hexubid[2*UBID_LEN+1];
 
+  if (ctrl->db_req)
+    {
+      /* Results already delivered from the query cache are not
+       * returned again.  */
+      if (ctrl->db_req->query_skip)
+        {
+          ctrl->db_req->query_skip--;
+          return 0;
+        }
+      be_cache_query_record (ctrl->db_req, buffer, buflen, pubkey_type, ubid,
+                             is_ephemeral, is_revoked, uid_no, pk_no);
+    }
+
   bin2hex (ubid, UBID_LEN, hexubid);
   err = status_printf (ctrl, "PUBKEY_INFO", "%d %s %c%c %d %d",
                        pubkey_type, hexubid,
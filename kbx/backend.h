@@ -86,6 +86,7 @@ struct db_request_s
   unsigned int last_cached_valid:1; /* see below */
   unsigned int last_cached_final:1; /* see below */
   unsigned int last_cached_fprlen:8;/* see below */
+  unsigned int query_backend:1;     /* see below */
 
   db_request_part_t part;
 
@@ -101,6 +102,15 @@ struct db_request_s
   u32 last_cached_kid_h;
   u32 last_cached_kid_l;
   unsigned char last_cached_fpr[32];
+
+  /* The query cache entry of the current search, the number of
+   * results delivered since the start of the search, and the number
+   * of database results which be_return_pubkey shall suppress
+   * because they have already been delivered from the cache.
+   * QUERY_BACKEND is set once the database has been searched.  */
+  struct query_item_s *query_item;
+  unsigned int query_pos;
+  unsigned int query_skip;
 };
 
 
@@ -138,6 +148,21 @@ void be_cache_pubkey (ctrl_t ctrl, const unsigned char *ubid,
                       enum pubkey_types pubkey_type);
 void be_cache_not_found (ctrl_t ctrl, enum pubkey_types pubkey_type,
                          KEYDB_SEARCH_DESC *desc, unsigned int ndesc);
+char *be_cache_stats_string (void);
+void be_cache_collect_metrics (void);
+void be_cache_query_stop (db_request_t request);
+void be_cache_query_start (ctrl_t ctrl, db_request_t request,
+                           KEYDB_SEARCH_DESC *desc, unsigned int ndesc);
+gpg_error_t be_cache_query_next (ctrl_t ctrl, db_request_t request,
+                                 unsigned int *r_nskip);
+void be_cache_query_record (db_request_t request,
+                            const void *blob, size_t bloblen,
+                            enum pubkey_types pktype,
+                            const unsigned char *ubid,
+                            int is_ephemeral, int is_revoked,
+                            int uid_no, int pk_no);
+void be_cache_query_done (db_request_t request, gpg_error_t err);
+void be_cache_query_invalidate (void);
 
 
 /*-- backend-kbx.c --*/
@@ -181,8 +206,13 @@ gpg_error_t be_sqlite_store (ctrl_t ctrl, backend_handle_t backend_hd,
                              enum pubkey_types pktype,
                              const unsigned char *ubid,
                              const void *blob, size_t bloblen);
+gpg_error_t be_sqlite_begin_bulk_load (void);
+gpg_error_t be_sqlite_end_bulk_load (void);
 gpg_error_t be_sqlite_delete (ctrl_t ctrl, backend_handle_t backend_hd,
                               db_request_t request, const unsigned char *ubid);
+void be_sqlite_stmt_cache_stats (unsigned long *r_hits,
+                                 unsigned long *r_misses,
+                                 unsigned int *r_cached);
 
 
 #endif /*KBX_BACKEND_H*/
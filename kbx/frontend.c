@@ -28,8 +28,10 @@
 #include <assuan.h>
 #include "../common/i18n.h"
 #include "../common/userids.h"
+#include "../common/metrics.h"
 #include "backend.h"
 #include "frontend.h"
+#include "keybox.h"
 
 
 /* An object to keep infos about the database.  */
@@ -39,6 +41,9 @@ struct
   backend_handle_t backend_handle;
 } the_database;
 
+/* Set if keyblocks have been changed in the current transaction.  */
+static int changes_in_transaction;
+
 
 
 /* Take a lock for reading the databases.  */
@@ -176,14 +181,74 @@ kbxd_release_session_info (ctrl_t ctrl)
 gpg_error_t
 kbxd_rollback (void)
 {
-  return be_sqlite_rollback ();
+  gpg_error_t err;
+
+  err = be_sqlite_rollback ();
+  be_cache_query_invalidate ();
+  if (changes_in_transaction)
+    {
+      changes_in_transaction = 0;
+      kbxd_notify_change (NULL);
+    }
+  return err;
 }
 
 
 gpg_error_t
 kbxd_commit (void)
 {
-  return be_sqlite_commit ();
+  gpg_error_t err;
+
+  err = be_sqlite_commit ();
+  be_cache_query_invalidate ();
+  /* Clients may have read the old keyblocks while the transaction
+   * was running.  */
+  if (changes_in_transaction)
+    {
+      changes_in_transaction = 0;
+      kbxd_notify_change (NULL);
+    }
+  return err;
+}
+
+
+/* Return the counters of the SQL statement cache.  */
+void
+kbxd_get_stmt_cache_stats (unsigned long *r_hits, unsigned long *r_misses,
+                           unsigned int *r_cached)
+{
+  be_sqlite_stmt_cache_stats (r_hits, r_misses, r_cached);
+}
+
+
+/* Return a malloced string describing the state of the key and blob
+ * cache or NULL on malloc failure.  */
+char *
+kbxd_get_cache_stats (void)
+{
+  return be_cache_stats_string ();
+}
+
+
+/* Collector for the metrics.  */
+void
+kbxd_collect_metrics (void)
+{
+  unsigned long hits, misses;
+  unsigned int cached;
+
+  gnupg_metric_set (gnupg_metric_gauge ("connections"),
+                    get_kbxd_active_connection_count ());
+  be_cache_collect_metrics ();
+  be_sqlite_stmt_cache_stats (&hits, &misses, &cached);
+  gnupg_metric_set (gnupg_metric_get (GNUPG_METRIC_GAUGE, "cache_items",
+                                      "cache=\"stmt\""), cached);
+  gnupg_metric_set (gnupg_metric_get (GNUPG_METRIC_COUNTER, "cache_lookups",
+                                      "cache=\"stmt\",result=\"hit\""),
+                    hits);
+  gnupg_metric_set (gnupg_metric_get (GNUPG_METRIC_COUNTER, "cache_lookups",
+                                      "cache=\"stmt\",result=\"miss\""),
+                    misses);
 }
 
 
@@ -199,6 +264,7 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
   gpg_error_t err;
   int i;
   db_request_t request;
+  unsigned int nskip;
 
   if (DBG_CLOCK)
     log_clock ("%s: enter", __func__);
@@ -268,6 +334,7 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
       request->any_search = 0;
       request->any_found = 0;
       request->next_dbidx = 0;
+      be_cache_query_start (ctrl, request, desc, ndesc);
       if (!desc) /* Reset only mode */
         {
           err = 0;
@@ -275,7 +342,25 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
         }
     }
 
-  /* Divert to the backend for the actual search.  */
+  /* Identical searches are often repeated; thus try the query cache
+   * first.  */
+  err = be_cache_query_next (ctrl, request, &nskip);
+  if (gpg_err_code (err) != GPG_ERR_EOF)
+    {
+      if (DBG_LOOKUP)
+        log_debug ("%s: query cache => %s\n", __func__, gpg_strerror (err));
+      request->any_search = 1;
+      if (!err)
+        request->any_found = 1;
+      goto leave;
+    }
+
+  /* Divert to the backend for the actual search.  The first NSKIP
+   * results have already been returned from the query cache.  */
+  request->query_backend = 1;
+  request->query_skip = nskip;
+ again:
+  nskip = request->query_skip;
   switch (the_database.db_type)
     {
     case DB_TYPE_CACHE:
@@ -303,6 +388,10 @@ kbxd_search (ctrl_t ctrl, KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
       err = gpg_error (GPG_ERR_INTERNAL);
       break;
     }
+  if (!err && nskip)
+    goto again;
+  request->query_skip = 0;
+  be_cache_query_done (request, err);
 
   if (DBG_LOOKUP)
     log_debug ("%s: searched %s => %s\n", __func__,
@@ -419,6 +508,14 @@ kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
                  __func__, the_database.db_type);
       err = gpg_error (GPG_ERR_INTERNAL);
     }
+  /* Cached search results may now be wrong.  */
+  be_cache_query_invalidate ();
+  if (!err)
+    {
+      kbxd_notify_change (ubid);
+      if (opt.in_transaction)
+        changes_in_transaction = 1;
+    }
 
 
  leave:
@@ -490,6 +587,14 @@ kbxd_delete (ctrl_t ctrl, const unsigned char *ubid)
                  __func__, the_database.db_type);
       err = gpg_error (GPG_ERR_INTERNAL);
     }
+  /* Cached search results may now be wrong.  */
+  be_cache_query_invalidate ();
+  if (!err)
+    {
+      kbxd_notify_change (ubid);
+      if (opt.in_transaction)
+        changes_in_transaction = 1;
+    }
 
 
  leave:
@@ -498,3 +603,114 @@ kbxd_delete (ctrl_t ctrl, const unsigned char *ubid)
     log_clock ("%s: leave", __func__);
   return err;
 }
+
+
+/* Import all keyblocks and certificates from the keybox file FILENAME
+ * into the SQLite database.  This is meant to migrate a pubring.kbx
+ * to keyboxd and thus uses a bulk load which defers the creation of
+ * the indices to the end.  Keyblocks which are already in the
+ * database are skipped.  */
+gpg_error_t
+kbxd_import_kbx (ctrl_t ctrl, const char *filename)
+{
+  gpg_error_t err, err2;
+  db_request_t request;
+  void *token;
+  KEYBOX_HANDLE kbx_hd = NULL;
+  KEYBOX_SEARCH_DESC desc;
+  void *buffer;
+  size_t buflen;
+  enum pubkey_types pktype;
+  unsigned char ubid[UBID_LEN];
+  unsigned long count = 0;
+  unsigned long nskipped = 0;
+  unsigned long nerrors = 0;
+  int bulk_load = 0;
+
+  take_read_write_lock (ctrl);
+
+  /* Allocate a handle object if none exists for this context.  */
+  if (!ctrl->db_req)
+    {
+      ctrl->db_req = xtrycalloc (1, sizeof *ctrl->db_req);
+      if (!ctrl->db_req)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+    }
+  request = ctrl->db_req;
+
+  if (the_database.db_type != DB_TYPE_SQLITE)
+    {
+      log_error ("%s: error: no SQLite database configured\n", __func__);
+      err = gpg_error (GPG_ERR_NOT_INITIALIZED);
+      goto leave;
+    }
+
+  err = keybox_register_file (filename, 0, &token);
+  if (err)
+    {
+      log_error (_("can't open '%s': %s\n"), filename, gpg_strerror (err));
+      goto leave;
+    }
+  kbx_hd = keybox_new_openpgp (token, 0);
+  if (!kbx_hd)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  err = be_sqlite_begin_bulk_load ();
+  if (err)
+    goto leave;
+  bulk_load = 1;
+
+  memset (&desc, 0, sizeof desc);
+  desc.mode = KEYDB_SEARCH_MODE_FIRST;
+  while (!(err = keybox_search (kbx_hd, &desc, 1, 0, NULL, NULL)))
+    {
+      desc.mode = KEYDB_SEARCH_MODE_NEXT;
+      count++;
+
+      err = keybox_get_data (kbx_hd, &buffer, &buflen, &pktype, ubid);
+      if (!err)
+        {
+          err = be_sqlite_store (ctrl, the_database.backend_handle, request,
+                                 KBXD_STORE_INSERT, pktype, ubid,
+                                 buffer, buflen);
+          xfree (buffer);
+        }
+      if (gpg_err_code (err) == GPG_ERR_SQL_CONSTRAINT)
+        nskipped++;  /* Already in the database.  */
+      else if (err)
+        {
+          log_error ("error importing keyblock %lu: %s\n",
+                     count, gpg_strerror (err));
+          nerrors++;
+        }
+    }
+  if (err == -1 || gpg_err_code (err) == GPG_ERR_EOF)
+    err = 0;
+  else
+    log_error (_("error reading '%s': %s\n"), filename, gpg_strerror (err));
+
+  if (!opt.quiet)
+    log_info ("%s: %lu keyblocks read, %lu skipped, %lu errors\n",
+              filename, count, nskipped, nerrors);
+
+ leave:
+  if (bulk_load)
+    {
+      err2 = be_sqlite_end_bulk_load ();
+      if (err2)
+        log_error ("error finishing the import: %s\n", gpg_strerror (err2));
+      if (!err)
+        err = err2;
+    }
+  keybox_release (kbx_hd);
+  release_lock (ctrl);
+  if (!err && nerrors)
+    err = gpg_error (GPG_ERR_GENERAL);
+  return err;
+}
@@ -30,12 +30,17 @@ void kbxd_release_session_info (ctrl_t ctrl);
 
 gpg_error_t kbxd_rollback (void);
 gpg_error_t kbxd_commit (void);
+void kbxd_get_stmt_cache_stats (unsigned long *r_hits, unsigned long *r_misses,
+                                unsigned int *r_cached);
+char *kbxd_get_cache_stats (void);
+void kbxd_collect_metrics (void);
 gpg_error_t kbxd_search (ctrl_t ctrl,
                          KEYDB_SEARCH_DESC *desc, unsigned int ndesc,
                          int reset);
 gpg_error_t kbxd_store (ctrl_t ctrl, const void *blob, size_t bloblen,
                         enum kbxd_store_modes mode);
 gpg_error_t kbxd_delete (ctrl_t ctrl, const unsigned char *ubid);
+gpg_error_t kbxd_import_kbx (ctrl_t ctrl, const char *filename);
 
 
 #endif /*KBX_FRONTEND_H*/
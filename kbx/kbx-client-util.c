@@ -23,6 +23,17 @@
 #include <stdlib.h>
 #include <stddef.h>
 #include <string.h>
+#include <unistd.h>
+#if defined(HAVE_MEMFD_CREATE) && defined(HAVE_MMAP)
+# include <sys/mman.h>
+# include <fcntl.h>
+# ifndef MAP_FAILED
+#  define MAP_FAILED ((void*)-1)
+# endif
+# ifdef F_ADD_SEALS
+#  define USE_DATA_SHM 1
+# endif
+#endif
 #include <npth.h>
 #include <assuan.h>
 
@@ -38,6 +49,9 @@
 
 #define MAX_DATABLOB_SIZE (16*1024*1024)
 
+/* The size of the shared memory area we offer to the keyboxd.  */
+#define DATA_SHM_SIZE (4*1024*1024)
+
 
 
 /* This object is used to implement a client to the keyboxd.  */
@@ -65,6 +79,15 @@ struct kbx_client_data_s
   char *dlinedata;
   size_t dlinedatalen;
   gpg_error_t dlineerr;
+
+  /* If not NULL a shared memory area of SHMSIZE bytes used by the
+   * keyboxd to convey the data instead of D-lines.  The other
+   * variables are used by shm_status_cb.  */
+  char *shm;
+  size_t shmsize;
+  membuf_t *shm_mb;
+  gpg_error_t (*status_cb)(void *opaque, const char *line);
+  void *status_cb_value;
 };
 
 
@@ -166,6 +189,82 @@ prepare_data_pipe (kbx_client_data_t kcd)
 }
 
 
+/* Offer a shared memory area to the keyboxd so that the data can be
+ * returned without the need to escape it for use in D-lines.  This
+ * is an optional optimization and thus errors are ignored.  */
+static void
+prepare_data_shm (kbx_client_data_t kcd)
+{
+#ifdef USE_DATA_SHM
+  gpg_error_t err;
+  int fd;
+  void *p;
+  char line[ASSUAN_LINELENGTH];
+
+  fd = memfd_create ("gnupg-kbx-data", MFD_CLOEXEC | MFD_ALLOW_SEALING);
+  if (fd == -1)
+    return;
+  /* The keyboxd requires that we can't shrink the area.  */
+  if (ftruncate (fd, DATA_SHM_SIZE)
+      || fcntl (fd, F_ADD_SEALS, F_SEAL_SHRINK | F_SEAL_SEAL))
+    {
+      close (fd);
+      return;
+    }
+  p = mmap (NULL, DATA_SHM_SIZE, PROT_READ, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    {
+      close (fd);
+      return;
+    }
+
+  err = assuan_sendfd (kcd->ctx, INT2FD (fd));
+  if (!err)
+    {
+      snprintf (line, sizeof line, "OPTION data-shm=%u", DATA_SHM_SIZE);
+      err = assuan_transact (kcd->ctx, line,
+                             NULL, NULL, NULL, NULL, NULL, NULL);
+    }
+  close (fd);
+  if (err)
+    {
+      munmap (p, DATA_SHM_SIZE);
+      return;  /* Server does not support it - use D-lines.  */
+    }
+
+  kcd->shm = p;
+  kcd->shmsize = DATA_SHM_SIZE;
+#else
+  (void)kcd;
+#endif
+}
+
+
+/* The status callback used with a shared memory area.  It takes the
+ * data announced by DATA_SHM from the area and passes all other
+ * status lines to the caller's status callback.  */
+static gpg_error_t
+shm_status_cb (void *opaque, const char *line)
+{
+  kbx_client_data_t kcd = opaque;
+  const char *s;
+  char *endp;
+  unsigned long off, len;
+
+  if ((s = has_leading_keyword (line, "DATA_SHM")))
+    {
+      off = strtoul (s, &endp, 10);
+      len = strtoul (endp, NULL, 10);
+      if (off > kcd->shmsize || len > kcd->shmsize - off)
+        return gpg_error (GPG_ERR_INV_RESPONSE);
+      put_membuf (kcd->shm_mb, kcd->shm + off, len);
+      return 0;
+    }
+
+  return kcd->status_cb? kcd->status_cb (kcd->status_cb_value, line) : 0;
+}
+
+
 /* The thread used to read from the data stream.  This is running as
  * long as the connection and its datastream exists.  */
 static void *
@@ -269,8 +368,9 @@ datastream_thread (void *arg)
 
 /* Create a new keyboxd client data object and return it at R_KCD.
  * CTX is the assuan context to be used for connecting the keyboxd.
- * If dlines is set, communication is done without fd passing via
- * D-lines.  */
+ * If dlines is set, communication is done without a data pipe; the
+ * data is then returned via a shared memory area if the system and
+ * the keyboxd support this and via D-lines otherwise.  */
 gpg_error_t
 kbx_client_data_new (kbx_client_data_t *r_kcd, assuan_context_t ctx,
                      int dlines)
@@ -286,7 +386,10 @@ kbx_client_data_new (kbx_client_data_t *r_kcd, assuan_context_t ctx,
   kcd->ctx = ctx;
 
   if (dlines)
-    goto leave;
+    {
+      prepare_data_shm (kcd);
+      goto leave;
+    }
 
   rc = npth_mutex_init (&kcd->mutex, NULL);
   if (rc)
@@ -331,6 +434,10 @@ kbx_client_data_release (kbx_client_data_t kcd)
   fp = kcd->fp;
   kcd->fp = NULL;
   es_fclose (fp);  /* That close should let the thread run into an error.  */
+#ifdef USE_DATA_SHM
+  if (kcd->shm)
+    munmap (kcd->shm, kcd->shmsize);
+#endif
   /* FIXME: Make thread killing explicit.  Otherwise we run in a
    * log_fatal due to the destroyed mutex. */
   npth_cond_destroy (&kcd->cond);
@@ -391,10 +498,22 @@ kbx_client_data_cmd (kbx_client_data_t kcd, const char *command,
       /* log_debug ("%s: sending command '%s' (no fd-passing)\n", */
       /*            __func__, command); */
       init_membuf (&mb, 8192);
-      err = assuan_transact (kcd->ctx, command,
-                             put_membuf_cb, &mb,
-                             NULL, NULL,
-                             status_cb, status_cb_value);
+      if (kcd->shm)
+        {
+          kcd->shm_mb = &mb;
+          kcd->status_cb = status_cb;
+          kcd->status_cb_value = status_cb_value;
+          err = assuan_transact (kcd->ctx, command,
+                                 put_membuf_cb, &mb,
+                                 NULL, NULL,
+                                 shm_status_cb, kcd);
+          kcd->shm_mb = NULL;
+        }
+      else
+        err = assuan_transact (kcd->ctx, command,
+                               put_membuf_cb, &mb,
+                               NULL, NULL,
+                               status_cb, status_cb_value);
       if (err)
         {
           if (gpg_err_code (err) != GPG_ERR_NOT_FOUND)
@@ -0,0 +1,708 @@
+/* kbxbench.c - Benchmark for keybox lookups
+ * Copyright (C) 2026 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+/* This tool reads the OpenPGP keyblocks from a keyring file, for
+ * example one exported by "gpg --export" or generated by
+ * tests/openpgp/bench.scm, and measures
+ *
+ *  - the import throughput, that is how many of these keys per
+ *    second can be stored, and
+ *
+ *  - the latency and throughput of lookups by fingerprint, long
+ *    keyid, exact mail address and substring with 1 to 64
+ *    concurrent clients.
+ *
+ * Without --keyboxd the keys are stored in the keybox file given with
+ * --keybox and the lookups use keybox_search directly.  With
+ * --keyboxd the keys are stored using the STORE command of the
+ * keyboxd for the selected home directory and the lookups use its
+ * SEARCH command; thus this measures the backend which is configured
+ * for that keyboxd.  Use a scratch home directory for this.  */
+
+#include <config.h>
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#ifndef HAVE_W32_SYSTEM
+# include <sys/wait.h>
+#endif
+
+#include <gpg-error.h>
+#include <assuan.h>
+#include "../common/util.h"
+#include "../common/i18n.h"
+#include "../common/init.h"
+#include "../common/asshelp.h"
+#include "../common/userids.h"
+#include "../common/mbox-util.h"
+#include "../common/metrics.h"
+#include "keybox-defs.h"
+#include <gcrypt.h>
+
+
+enum cmd_and_opt_values {
+  aNull = 0,
+  oVerbose	  = 'v',
+
+  oDebug = 500,
+  oHomedir,
+  oKeyboxd,
+  oKeybox,
+  oImport,
+  oClients,
+  oSearches,
+
+  oLast
+};
+
+
+static gpgrt_opt_t opts[] = {
+  { oKeyboxd,  "keyboxd",  0, "use the keyboxd" },
+  { oKeybox,   "keybox",   2, "|FILE|use the keybox FILE" },
+  { oImport,   "import",   0, "store the keys before the lookups" },
+  { oClients,  "clients",  1, "|N|run N concurrent clients" },
+  { oSearches, "searches", 1, "|N|run N lookups per mode and client" },
+  { oHomedir,  "homedir",  2, "@" },
+  { oVerbose,  "verbose",  0, N_("verbose") },
+  { oDebug,    "debug",    0, N_("set debugging flags")},
+
+  ARGPARSE_end () /* end of list */
+};
+
+
+#define MAX_CLIENTS 64
+
+/* The search modes we measure.  */
+enum bench_modes
+  {
+    MODE_FPR,
+    MODE_LONG_KID,
+    MODE_MAIL,
+    MODE_SUBSTR,
+    N_MODES
+  };
+
+static const char *mode_names[N_MODES] =
+  { "fpr", "long-kid", "mail", "substr" };
+
+
+/* Information about one key from the keyring file.  */
+struct keyinfo_s
+{
+  const unsigned char *image;
+  size_t imagelen;
+  char *pattern[N_MODES];
+};
+
+/* The result of one search mode in one client.  */
+struct mode_result_s
+{
+  unsigned long long start;   /* Monotonic start time in usecs.  */
+  unsigned long long end;     /* Monotonic end time in usecs.  */
+  u32 count;                  /* Number of searches.  */
+  u32 errors;                 /* Number of failed searches.  */
+};
+
+
+static struct
+{
+  int verbose;
+  int debug;
+  int use_keyboxd;
+  const char *keybox;
+  int import;
+  int clients;
+  int searches;
+} opt;
+
+static struct keyinfo_s *keys;
+static unsigned int nkeys;
+
+
+static const char *
+my_strusage( int level )
+{
+  const char *p;
+
+  switch (level)
+    {
+    case  9: p = "GPL-3.0-or-later"; break;
+    case 11: p = "kbxbench (@GNUPG@)";
+      break;
+    case 13: p = VERSION; break;
+    case 14: p = GNUPG_DEF_COPYRIGHT_LINE; break;
+    case 17: p = PRINTABLE_OS_NAME; break;
+    case 19: p = _("Please report bugs to <@EMAIL@>.\n"); break;
+
+    case 1:
+    case 40:	p =
+        _("Usage: kbxbench [options] KEYRING (-h for help)");
+      break;
+    case 41:	p =
+        _("Syntax: kbxbench [options] KEYRING\n"
+          "Benchmark imports and lookups using the keys from KEYRING\n");
+      break;
+
+    default:	p = NULL;
+    }
+  return p;
+}
+
+
+static char *
+read_file (const char *fname, size_t *r_length)
+{
+  FILE *fp;
+  struct stat st;
+  char *buf;
+  size_t buflen;
+
+  fp = fopen (fname, "rb");
+  if (!fp)
+    log_fatal ("can't open '%s': %s\n", fname, strerror (errno));
+  if (fstat (fileno (fp), &st))
+    log_fatal ("can't stat '%s': %s\n", fname, strerror (errno));
+
+  buflen = st.st_size;
+  buf = xmalloc (buflen+1);
+  if (fread (buf, buflen, 1, fp) != 1)
+    log_fatal ("error reading '%s': %s\n", fname, strerror (errno));
+  fclose (fp);
+
+  *r_length = buflen;
+  return buf;
+}
+
+
+/* Return the user ID described by U as a malloced string.  */
+static char *
+get_uid (const unsigned char *image, struct _keybox_openpgp_uid_info *u)
+{
+  char *uid;
+
+  uid = xmalloc (u->len + 1);
+  memcpy (uid, image + u->off, u->len);
+  uid[u->len] = 0;
+  return uid;
+}
+
+
+/* Parse the keyblocks of the keyring in BUFFER and fill the KEYS
+ * table.  */
+static void
+parse_keyring (const char *fname, const unsigned char *buffer, size_t buflen)
+{
+  gpg_error_t err;
+  struct _keybox_openpgp_info info;
+  struct keyinfo_s *k;
+  unsigned int allocated = 0;
+  size_t nparsed, n;
+  char *uid, *mbox;
+
+  for (;;)
+    {
+      err = _keybox_parse_openpgp (buffer, buflen, &nparsed, &info);
+      if (gpg_err_code (err) == GPG_ERR_NO_DATA)
+        break;
+      if (err)
+        log_info ("%s: failed to parse OpenPGP keyblock: %s\n",
+                  fname, gpg_strerror (err));
+      else if (info.nuids)
+        {
+          if (nkeys == allocated)
+            {
+              allocated += 1024;
+              keys = xrealloc (keys, allocated * sizeof *keys);
+            }
+          k = keys + nkeys++;
+          k->image = buffer;
+          k->imagelen = nparsed;
+
+          k->pattern[MODE_FPR] = bin2hex (info.primary.fpr,
+                                          info.primary.fprlen, NULL);
+          k->pattern[MODE_LONG_KID] = xmalloc (2 + 16 + 1);
+          strcpy (k->pattern[MODE_LONG_KID], "0x");
+          bin2hex (info.primary.keyid, 8, k->pattern[MODE_LONG_KID] + 2);
+
+          uid = get_uid (buffer, &info.uids);
+          mbox = mailbox_from_userid (uid, 0);
+          k->pattern[MODE_MAIL] = mbox? xstrconcat ("<", mbox, ">", NULL)
+                                      : xstrconcat ("=", uid, NULL);
+          xfree (mbox);
+          /* Use the middle part of the user ID for the substring
+           * search so that neither end of the string is matched.  */
+          n = strlen (uid);
+          if (n > 8)
+            {
+              memmove (uid, uid + n/4, n/2);
+              uid[n/2] = 0;
+            }
+          k->pattern[MODE_SUBSTR] = xstrconcat ("*", uid, NULL);
+          xfree (uid);
+
+          _keybox_destroy_openpgp_info (&info);
+        }
+      else
+        _keybox_destroy_openpgp_info (&info);
+      buffer += nparsed;
+      buflen -= nparsed;
+    }
+}
+
+
+/* Print a result line for NAME with COUNT items in USECS
+ * microseconds.  */
+static void
+print_rate (const char *name, unsigned long count, const char *unit,
+            unsigned long long usecs)
+{
+  if (!usecs)
+    usecs = 1;
+  printf ("%-16s %8lu %-5s %12.1f %s/s\n",
+          name, count, unit, count * 1000000.0 / usecs, unit);
+}
+
+
+
+/* Keybox file access.  */
+
+static KEYBOX_HANDLE
+open_keybox (void)
+{
+  void *token;
+  KEYBOX_HANDLE hd;
+  gpg_error_t err;
+
+  err = keybox_register_file (opt.keybox, 0, &token);
+  if (err)
+    log_fatal ("error registering '%s': %s\n", opt.keybox,
+               gpg_strerror (err));
+  hd = keybox_new_openpgp (token, 0);
+  if (!hd)
+    log_fatal ("error opening '%s': %s\n", opt.keybox,
+               gpg_strerror (gpg_error_from_syserror ()));
+  return hd;
+}
+
+
+static void
+import_keybox (void)
+{
+  KEYBOX_HANDLE hd;
+  unsigned long long start;
+  gpg_error_t err;
+  unsigned int i;
+
+  hd = open_keybox ();
+  /* Without append mode each insert would copy the file.  */
+  keybox_set_append_mode (hd, 1);
+  err = keybox_lock (hd, 1, -1);
+  if (err)
+    log_fatal ("error locking '%s': %s\n", opt.keybox, gpg_strerror (err));
+
+  start = gnupg_metrics_now ();
+  for (i=0; i < nkeys; i++)
+    {
+      err = keybox_insert_keyblock (hd, keys[i].image, keys[i].imagelen);
+      if (err)
+        log_fatal ("error storing key %u: %s\n", i, gpg_strerror (err));
+    }
+  print_rate ("import", nkeys, "keys", gnupg_metrics_now () - start);
+
+  keybox_lock (hd, 0, 0);
+  keybox_release (hd);
+}
+
+
+static gpg_error_t
+search_keybox (KEYBOX_HANDLE hd, const char *pattern)
+{
+  gpg_error_t err;
+  KEYBOX_SEARCH_DESC desc;
+  void *buffer;
+  size_t buflen;
+
+  err = classify_user_id (pattern, &desc, 1);
+  if (!err)
+    err = keybox_search_reset (hd);
+  if (!err)
+    err = keybox_search (hd, &desc, 1, KEYBOX_BLOBTYPE_PGP, NULL, NULL);
+  if (!err)
+    {
+      /* Also fetch the data so that we get the same work as with a
+       * SEARCH command of the keyboxd.  */
+      err = keybox_get_data (hd, &buffer, &buflen, NULL, NULL);
+      if (!err)
+        xfree (buffer);
+    }
+  return err;
+}
+
+
+
+/* Keyboxd access.  */
+
+static assuan_context_t
+connect_keyboxd (void)
+{
+  assuan_context_t ctx;
+  gpg_error_t err;
+
+  err = start_new_keyboxd (&ctx, GPG_ERR_SOURCE_DEFAULT, NULL, 1,
+                           opt.verbose, opt.debug, NULL, NULL);
+  if (err)
+    log_fatal ("error connecting the keyboxd: %s\n", gpg_strerror (err));
+  return ctx;
+}
+
+
+/* Data callback which ignores the returned data.  */
+static gpg_error_t
+ignore_data_cb (void *opaque, const void *data, size_t datalen)
+{
+  (void)opaque;
+  (void)data;
+  (void)datalen;
+  return 0;
+}
+
+
+/* Parameter for store_inq_cb.  */
+struct store_parm_s
+{
+  assuan_context_t ctx;
+  struct keyinfo_s *key;
+};
+
+/* Inquire callback to send the keyblock for a STORE command.  */
+static gpg_error_t
+store_inq_cb (void *opaque, const char *line)
+{
+  struct store_parm_s *parm = opaque;
+
+  if (!has_leading_keyword (line, "BLOB"))
+    return gpg_error (GPG_ERR_ASS_UNKNOWN_INQUIRE);
+  return assuan_send_data (parm->ctx, parm->key->image, parm->key->imagelen);
+}
+
+
+static void
+import_keyboxd (void)
+{
+  struct store_parm_s parm;
+  unsigned long long start;
+  gpg_error_t err;
+  unsigned int i;
+
+  parm.ctx = connect_keyboxd ();
+  start = gnupg_metrics_now ();
+  for (i=0; i < nkeys; i++)
+    {
+      parm.key = keys + i;
+      err = assuan_transact (parm.ctx, "STORE", NULL, NULL,
+                             store_inq_cb, &parm, NULL, NULL);
+      if (err)
+        log_fatal ("error storing key %u: %s\n", i, gpg_strerror (err));
+    }
+  print_rate ("import", nkeys, "keys", gnupg_metrics_now () - start);
+  assuan_release (parm.ctx);
+}
+
+
+static gpg_error_t
+search_keyboxd (assuan_context_t ctx, const char *pattern)
+{
+  char line[ASSUAN_LINELENGTH];
+
+  snprintf (line, sizeof line, "SEARCH %s", pattern);
+  return assuan_transact (ctx, line, ignore_data_cb, NULL,
+                          NULL, NULL, NULL, NULL);
+}
+
+
+
+/* The clients.  */
+
+#ifndef HAVE_W32_SYSTEM
+
+/* Write LENGTH bytes from BUFFER to FD.  */
+static void
+writen (int fd, const void *buffer, size_t length)
+{
+  const char *p = buffer;
+  ssize_t n;
+
+  while (length)
+    {
+      n = write (fd, p, length);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n < 0)
+        log_fatal ("error writing to pipe: %s\n", strerror (errno));
+      p += n;
+      length -= n;
+    }
+}
+
+
+/* Read exactly LENGTH bytes from FD.  */
+static void
+readn (int fd, void *buffer, size_t length)
+{
+  char *p = buffer;
+  ssize_t n;
+
+  while (length)
+    {
+      n = read (fd, p, length);
+      if (n < 0 && errno == EINTR)
+        continue;
+      if (n <= 0)
+        log_fatal ("error reading from client: %s\n",
+                   n? strerror (errno) : "EOF");
+      p += n;
+      length -= n;
+    }
+}
+
+
+/* The main function of client number IDX.  For each mode this sends
+ * a mode_result_s followed by the latencies of the searches in
+ * microseconds as an array of u32 to FD.  Never returns.  */
+static void
+client_main (int idx, int fd)
+{
+  KEYBOX_HANDLE hd = NULL;
+  assuan_context_t ctx = NULL;
+  struct mode_result_s result;
+  unsigned long long t0, t1;
+  unsigned int seed = 4711 + idx;
+  u32 *latencies;
+  int mode, i;
+
+  if (opt.use_keyboxd)
+    ctx = connect_keyboxd ();
+  else
+    hd = open_keybox ();
+
+  latencies = xcalloc (opt.searches, sizeof *latencies);
+  for (mode=0; mode < N_MODES; mode++)
+    {
+      memset (&result, 0, sizeof result);
+      result.start = gnupg_metrics_now ();
+      for (i=0; i < opt.searches; i++)
+        {
+          const char *pattern;
+          gpg_error_t err;
+
+          seed = seed * 1103515245 + 12345;
+          pattern = keys[(seed >> 8) % nkeys].pattern[mode];
+          t0 = gnupg_metrics_now ();
+          if (ctx)
+            err = search_keyboxd (ctx, pattern);
+          else
+            err = search_keybox (hd, pattern);
+          t1 = gnupg_metrics_now ();
+          if (err)
+            {
+              if (opt.verbose)
+                log_info ("search for '%s' failed: %s\n",
+                          pattern, gpg_strerror (err));
+              result.errors++;
+            }
+          latencies[result.count++] = t1 - t0;
+        }
+      result.end = gnupg_metrics_now ();
+      writen (fd, &result, sizeof result);
+      writen (fd, latencies, result.count * sizeof *latencies);
+    }
+
+  if (ctx)
+    assuan_release (ctx);
+  if (hd)
+    keybox_release (hd);
+  _exit (0);
+}
+
+
+static int
+cmp_u32 (const void *a, const void *b)
+{
+  u32 x = *(const u32 *)a;
+  u32 y = *(const u32 *)b;
+
+  return x < y? -1 : x > y;
+}
+
+
+/* Start the clients, collect their results and print them.  */
+static void
+run_clients (void)
+{
+  int fds[MAX_CLIENTS];
+  pid_t pids[MAX_CLIENTS];
+  int p[2];
+  int i, mode;
+  struct mode_result_s result;
+  unsigned long long start, end;
+  unsigned long count, errors;
+  u32 *latencies;
+  char name[50];
+
+  fflush (stdout);
+  for (i=0; i < opt.clients; i++)
+    {
+      if (pipe (p))
+        log_fatal ("error creating pipe: %s\n", strerror (errno));
+      pids[i] = fork ();
+      if (pids[i] == (pid_t)(-1))
+        log_fatal ("error forking client: %s\n", strerror (errno));
+      if (!pids[i])
+        {
+          close (p[0]);
+          client_main (i, p[1]);
+          /*NOTREACHED*/
+        }
+      close (p[1]);
+      fds[i] = p[0];
+    }
+
+  latencies = xcalloc ((size_t)opt.clients * opt.searches, sizeof *latencies);
+  for (mode=0; mode < N_MODES; mode++)
+    {
+      start = end = 0;
+      count = errors = 0;
+      for (i=0; i < opt.clients; i++)
+        {
+          readn (fds[i], &result, sizeof result);
+          readn (fds[i], latencies + count, result.count * sizeof *latencies);
+          if (!start || result.start < start)
+            start = result.start;
+          if (result.end > end)
+            end = result.end;
+          count += result.count;
+          errors += result.errors;
+        }
+
+      snprintf (name, sizeof name, "search-%s", mode_names[mode]);
+      print_rate (name, count, "ops", end - start);
+      qsort (latencies, count, sizeof *latencies, cmp_u32);
+      printf ("%-16s p50 %lu us  p90 %lu us  p99 %lu us  max %lu us"
+              "  errors %lu\n", "",
+              (unsigned long)latencies[count * 50 / 100],
+              (unsigned long)latencies[count * 90 / 100],
+              (unsigned long)latencies[count * 99 / 100],
+              (unsigned long)latencies[count - 1],
+              errors);
+    }
+  xfree (latencies);
+
+  for (i=0; i < opt.clients; i++)
+    {
+      close (fds[i]);
+      while (waitpid (pids[i], NULL, 0) == -1 && errno == EINTR)
+        ;
+    }
+}
+
+#endif /*!HAVE_W32_SYSTEM*/
+
+
+int
+main (int argc, char **argv)
+{
+  gpgrt_argparse_t pargs;
+  char *buffer;
+  size_t buflen;
+
+  early_system_init ();
+  gpgrt_set_strusage (my_strusage);
+  gcry_control (GCRYCTL_DISABLE_SECMEM);
+  log_set_prefix ("kbxbench", GPGRT_LOG_WITH_PREFIX);
+  i18n_init ();
+  init_common_subsystems (&argc, &argv);
+  assuan_set_gpg_err_source (GPG_ERR_SOURCE_DEFAULT);
+
+  opt.clients = 1;
+  opt.searches = 1000;
+
+  pargs.argc = &argc;
+  pargs.argv = &argv;
+  pargs.flags= ARGPARSE_FLAG_KEEP;
+  while (gpgrt_argparse (NULL,&pargs, opts))
+    {
+      switch (pargs.r_opt)
+        {
+        case oVerbose: opt.verbose++; break;
+        case oDebug: opt.debug = 1; break;
+        case oHomedir: gnupg_set_homedir (pargs.r.ret_str); break;
+        case oKeyboxd: opt.use_keyboxd = 1; break;
+        case oKeybox: opt.keybox = pargs.r.ret_str; break;
+        case oImport: opt.import = 1; break;
+        case oClients: opt.clients = pargs.r.ret_int; break;
+        case oSearches: opt.searches = pargs.r.ret_int; break;
+
+        default:
+          pargs.err = 2;
+          break;
+	}
+    }
+  gpgrt_argparse (NULL, &pargs, NULL);
+
+  if (argc != 1)
+    gpgrt_usage (1);
+  if (opt.clients < 1 || opt.clients > MAX_CLIENTS)
+    log_error ("the number of clients must be in the range 1 to %d\n",
+               MAX_CLIENTS);
+  if (opt.searches < 1)
+    log_error ("the number of searches must be positive\n");
+  if (!opt.use_keyboxd && !opt.keybox)
+    log_error ("either --keyboxd or --keybox is required\n");
+  if (log_get_errorcount (0))
+    exit (2);
+
+  buffer = read_file (*argv, &buflen);
+  parse_keyring (*argv, (unsigned char *)buffer, buflen);
+  if (!nkeys)
+    log_fatal ("no usable keys found in '%s'\n", *argv);
+  printf ("# kbxbench: %u keys, %d client%s, %s\n", nkeys,
+          opt.clients, opt.clients == 1? "":"s",
+          opt.use_keyboxd? "keyboxd" : opt.keybox);
+
+  if (opt.import)
+    {
+      if (opt.use_keyboxd)
+        import_keyboxd ();
+      else
+        import_keybox ();
+    }
+
+#ifndef HAVE_W32_SYSTEM
+  run_clients ();
+#else
+  log_info ("the lookup benchmark is not supported on this platform\n");
+#endif
+
+  return 0;
+}
@@ -28,6 +28,16 @@
 #include <sys/stat.h>
 #include <unistd.h>
 #include <errno.h>
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+# include <sys/mman.h>
+# include <fcntl.h>
+# ifndef MAP_FAILED
+#  define MAP_FAILED ((void*)-1)
+# endif
+# ifdef F_GET_SEALS
+#  define USE_DATA_SHM 1
+# endif
+#endif
 
 #include "keyboxd.h"
 #include <assuan.h>
@@ -36,6 +46,7 @@
 #include "../common/userids.h"
 #include "../common/asshelp.h"
 #include "../common/host2net.h"
+#include "../common/metrics.h"
 #include "frontend.h"
 
 
@@ -45,6 +56,16 @@
 #define set_error(e,t) (ctx ? assuan_set_error (ctx, gpg_error (e), (t)) \
                         /**/: gpg_error (e))
 
+/* The maximum number of keys returned by one SEARCH or NEXT with
+ * option --batch and the number of bytes after which we stop adding
+ * more keys to a batch.  */
+#define MAX_SEARCH_BATCH        1000
+#define SEARCH_BATCH_MAX_BYTES  (1024*1024)
+
+/* The maximum size of a shared memory area set with the option
+ * "data-shm".  */
+#define MAX_DATA_SHM_SIZE  (64*1024*1024)
+
 
 
 /* Control structure per connection. */
@@ -93,6 +114,25 @@ struct server_local_s
 
   /* If not NULL write output to this stream instead of using D lines.  */
   estream_t outstream;
+
+  /* If not NULL the data of a batched search is collected here
+   * instead of being sent directly.  */
+  membuf_t *batch_mb;
+
+  /* If not NULL a shared memory area of SHMSIZE bytes provided by the
+   * client to convey the data.  SHMUSED is the number of bytes used
+   * by the current command.  */
+  char *shm;
+  size_t shmsize;
+  size_t shmused;
+
+  /* If set the client has subscribed to change notifications and
+   * CHANGES_SEEN is the last generation sent to it.  */
+  unsigned int subscribed : 1;
+  unsigned long changes_seen;
+
+  /* The time the current command started for the metrics.  */
+  unsigned long long cmd_start;
 };
 
 
@@ -100,6 +140,22 @@ struct server_local_s
  * contexts and anchor them at this variable.  */
 static struct server_local_s *session_list;
 
+/* The size of the change log; must be a power of two.  */
+#define CHANGE_LOG_SIZE 128
+
+/* The ring buffer with the last changes as recorded by
+ * kbxd_notify_change.  The change with generation N is stored at
+ * index N % CHANGE_LOG_SIZE.  An entry without a UBID stands for a
+ * change of all keys.  */
+static struct
+{
+  unsigned int all : 1;
+  unsigned char ubid[UBID_LEN];
+} change_log[CHANGE_LOG_SIZE];
+
+/* The generation of the last change.  */
+static unsigned long change_generation;
+
 
 
 
@@ -125,6 +181,8 @@ prepare_outstream (ctrl_t ctrl)
 
   log_assert (ctrl && ctrl->server_local);
 
+  ctrl->server_local->shmused = 0;
+
   if (ctrl->server_local->outstream)
     return 0;  /* Already enabled.  */
 
@@ -176,6 +234,17 @@ kbxd_write_data_line (ctrl_t ctrl, const void *buffer_arg, size_t size)
   if (!ctx) /* Oops - no assuan context.  */
     return gpg_error (GPG_ERR_NOT_PROCESSED);
 
+  /* Collect the data if we are running a batched search.  */
+  if (ctrl && ctrl->server_local && ctrl->server_local->batch_mb)
+    {
+      unsigned char lenbuf[4];
+
+      ulongtobuf (lenbuf, size);
+      put_membuf (ctrl->server_local->batch_mb, lenbuf, 4);
+      put_membuf (ctrl->server_local->batch_mb, buffer, size);
+      return 0;  /* Out of core is detected when sending the batch.  */
+    }
+
   /* Write toa file descriptor if enabled.  */
   if (ctrl && ctrl->server_local && ctrl->server_local->outstream)
     {
@@ -194,6 +263,21 @@ kbxd_write_data_line (ctrl_t ctrl, const void *buffer_arg, size_t size)
       goto leave;
     }
 
+  /* Use the shared memory area if the data fits.  The client is told
+   * where to find the data by a status line.  */
+  if (ctrl && ctrl->server_local && ctrl->server_local->shm
+      && size <= (ctrl->server_local->shmsize - ctrl->server_local->shmused))
+    {
+      memcpy (ctrl->server_local->shm + ctrl->server_local->shmused,
+              buffer, size);
+      err = print_assuan_status (ctx, "DATA_SHM", "%lu %lu",
+                                 (unsigned long)ctrl->server_local->shmused,
+                                 (unsigned long)size);
+      if (!err)
+        ctrl->server_local->shmused += size;
+      goto leave;
+    }
+
   /* If we do not want logging, enable it here.  */
   if (ctrl && ctrl->server_local && ctrl->server_local->inhibit_data_logging)
     ctrl->server_local->inhibit_data_logging_now = 1;
@@ -245,6 +329,61 @@ kbxd_write_data_line (ctrl_t ctrl, const void *buffer_arg, size_t size)
 
 
 
+/* Record a change of the keyblock with UBID for the subscribed
+ * clients.  With UBID NULL all keyblocks may have changed; this is
+ * for example the case after a rollback.  */
+void
+kbxd_notify_change (const unsigned char *ubid)
+{
+  change_generation++;
+  change_log[change_generation % CHANGE_LOG_SIZE].all = !ubid;
+  if (ubid)
+    memcpy (change_log[change_generation % CHANGE_LOG_SIZE].ubid,
+            ubid, UBID_LEN);
+}
+
+
+/* Send the changes since the last call as KEY_CHANGED status lines to
+ * the client of CTRL if it has subscribed to them.  */
+static gpg_error_t
+send_change_events (ctrl_t ctrl)
+{
+  struct server_local_s *sl = ctrl->server_local;
+  gpg_error_t err = 0;
+  char hexubid[2*UBID_LEN+1];
+  unsigned long gen;
+
+  if (!sl->subscribed || sl->changes_seen == change_generation)
+    return 0;
+
+  if (change_generation - sl->changes_seen > CHANGE_LOG_SIZE)
+    {
+      /* The client missed changes; it needs to assume that all keys
+       * have changed.  */
+      err = print_assuan_status (sl->assuan_ctx, "KEY_CHANGED", "%lu *",
+                                 change_generation);
+    }
+  else
+    {
+      for (gen = sl->changes_seen + 1; !err && gen <= change_generation;
+           gen++)
+        {
+          if (change_log[gen % CHANGE_LOG_SIZE].all)
+            strcpy (hexubid, "*");
+          else
+            bin2hex (change_log[gen % CHANGE_LOG_SIZE].ubid, UBID_LEN,
+                     hexubid);
+          err = print_assuan_status (sl->assuan_ctx, "KEY_CHANGED", "%lu %s",
+                                     gen, hexubid);
+        }
+    }
+  if (!err)
+    sl->changes_seen = change_generation;
+  return err;
+}
+
+
+
 /* Helper to print a message while leaving a command.  */
 static gpg_error_t
 leave_cmd (assuan_context_t ctx, gpg_error_t err)
@@ -266,6 +405,87 @@ leave_cmd (assuan_context_t ctx, gpg_error_t err)
 
 
 
+/* Release the shared memory area of the session CTRL.  */
+static void
+release_data_shm (ctrl_t ctrl)
+{
+#ifdef USE_DATA_SHM
+  if (ctrl->server_local->shm)
+    {
+      munmap (ctrl->server_local->shm, ctrl->server_local->shmsize);
+      ctrl->server_local->shm = NULL;
+      ctrl->server_local->shmsize = 0;
+      ctrl->server_local->shmused = 0;
+    }
+#else
+  (void)ctrl;
+#endif
+}
+
+
+/* Map the shared memory area of VALUE bytes which the client has
+ * sent us as a file descriptor.  */
+static gpg_error_t
+setup_data_shm (ctrl_t ctrl, const char *value)
+{
+#ifdef USE_DATA_SHM
+  gpg_error_t err;
+  assuan_fd_t afd;
+  int fd, seals;
+  unsigned long size;
+  struct stat st;
+  void *p;
+
+  size = strtoul (value, NULL, 10);
+  if (!size || size > MAX_DATA_SHM_SIZE)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  err = assuan_receivefd (ctrl->server_local->assuan_ctx, &afd);
+  if (err)
+    return err;
+  fd = translate_sys2libc_fd (afd, 0);
+
+  /* The client must not be able to shrink the file while we have it
+   * mapped because that would let us die with SIGBUS.  */
+  seals = fcntl (fd, F_GET_SEALS);
+  if (seals == -1 || !(seals & F_SEAL_SHRINK))
+    {
+      err = gpg_error (GPG_ERR_NOT_SUPPORTED);
+      goto leave;
+    }
+  if (fstat (fd, &st))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (st.st_size < size)
+    {
+      err = gpg_error (GPG_ERR_INV_VALUE);
+      goto leave;
+    }
+
+  p = mmap (NULL, size, PROT_READ|PROT_WRITE, MAP_SHARED, fd, 0);
+  if (p == MAP_FAILED)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  release_data_shm (ctrl);
+  ctrl->server_local->shm = p;
+  ctrl->server_local->shmsize = size;
+
+ leave:
+  close (fd);
+  return err;
+#else
+  (void)ctrl;
+  (void)value;
+  return gpg_error (GPG_ERR_NOT_SUPPORTED);
+#endif
+}
+
+
 /* Handle OPTION commands. */
 static gpg_error_t
 option_handler (assuan_context_t ctx, const char *key, const char *value)
@@ -281,6 +501,8 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
       if (!ctrl->lc_messages)
         return out_of_core ();
     }
+  else if (!strcmp (key, "data-shm"))
+    err = setup_data_shm (ctrl, value);
   else
     err = gpg_error (GPG_ERR_UNKNOWN_OPTION);
 
@@ -289,19 +511,127 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
 
 
 
+/* Return the value of the --batch option from LINE; 0 is returned if
+ * the option was not given.  */
+static unsigned int
+get_batch_option (const char *line)
+{
+  const char *s;
+  int n;
+
+  if (!has_option_name (line, "--batch"))
+    return 0;
+  s = option_value (line, "--batch");
+  n = s? atoi (s) : 0;
+  if (n < 1)
+    n = 1;
+  else if (n > MAX_SEARCH_BATCH)
+    n = MAX_SEARCH_BATCH;
+  return n;
+}
+
+
+/* Run the search as set up by cmd_search.  With RESET set the search
+ * is started from the beginning, otherwise it continues after the
+ * last result.  */
+static gpg_error_t
+run_search (ctrl_t ctrl, int reset)
+{
+  struct server_local_s *sl = ctrl->server_local;
+
+  if (sl->multi_search_desc_len)
+    {
+      /* The next condition should never be tru but we better handle
+       * the first/next transition anyway.  */
+      if (!reset && sl->multi_search_desc[0].mode == KEYDB_SEARCH_MODE_FIRST)
+        sl->multi_search_desc[0].mode = KEYDB_SEARCH_MODE_NEXT;
+
+      return kbxd_search (ctrl, sl->multi_search_desc,
+                          sl->multi_search_desc_len, reset);
+    }
+
+  /* We need to do the transition from first to next here.  */
+  if (!reset && sl->search_desc.mode == KEYDB_SEARCH_MODE_FIRST)
+    sl->search_desc.mode = KEYDB_SEARCH_MODE_NEXT;
+
+  return kbxd_search (ctrl, &sl->search_desc, 1, reset);
+}
+
+
+/* Return up to BATCHSIZE search results at once.  The keys are sent
+ * as one data object with each key prefixed by its length as a 4 byte
+ * number in network byte order.  The PUBKEY_INFO status lines are
+ * emitted in the same order followed by
+ *   SEARCH_BATCH <n>
+ * with N being the number of returned keys.  If at least one key has
+ * been found, reaching the end of the search is not an error.  */
+static gpg_error_t
+run_search_batch (ctrl_t ctrl, int reset, unsigned int batchsize)
+{
+  gpg_error_t err;
+  membuf_t mb;
+  unsigned int n;
+  char *buffer;
+  size_t buflen;
+
+  init_membuf (&mb, 8192);
+  ctrl->server_local->batch_mb = &mb;
+  err = 0;
+  for (n=0; n < batchsize; n++)
+    {
+      err = run_search (ctrl, reset && !n);
+      if (err)
+        break;
+      if (get_membuf_len (&mb) >= SEARCH_BATCH_MAX_BYTES)
+        {
+          n++;
+          break;
+        }
+    }
+  ctrl->server_local->batch_mb = NULL;
+
+  if (n && gpg_err_code (err) == GPG_ERR_NOT_FOUND)
+    err = 0;
+
+  buffer = get_membuf (&mb, &buflen);
+  if (!buffer)
+    {
+      if (!err)
+        err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (err)
+    goto leave;
+
+  err = print_assuan_status (ctrl->server_local->assuan_ctx,
+                             "SEARCH_BATCH", "%u", n);
+  if (!err && buflen)
+    err = kbxd_write_data_line (ctrl, buffer, buflen);
+
+ leave:
+  xfree (buffer);
+  return err;
+}
+
+
 static const char hlp_search[] =
-  "SEARCH [--no-data] [--openpgp|--x509] [[--more] PATTERN]\n"
+  "SEARCH [--no-data] [--openpgp|--x509] [--batch=N] [[--more] PATTERN]\n"
   "\n"
   "Search for the keys identified by PATTERN.  With --more more\n"
   "patterns to be used for the search are expected with the next\n"
   "command.  With --no-data only the search status is returned but\n"
   "not the actual data.  With --openpgp or --x509 only the respective\n"
-  "keys are returned.  See also \"NEXT\".";
+  "keys are returned.  With --batch up to N keys are returned at once;\n"
+  "each key is then prefixed by its length as a 4 byte number in\n"
+  "network byte order and the status line\n"
+  "  SEARCH_BATCH <n>\n"
+  "gives the number of returned keys.  See also \"NEXT\".";
 static gpg_error_t
 cmd_search (assuan_context_t ctx, char *line)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
   int opt_more, opt_no_data, opt_openpgp, opt_x509;
+  unsigned int opt_batch;
   gpg_error_t err;
   unsigned int n, k;
 
@@ -309,6 +639,7 @@ cmd_search (assuan_context_t ctx, char *line)
   opt_more = has_option (line, "--more");
   opt_openpgp = has_option (line, "--openpgp");
   opt_x509 = has_option (line, "--x509");
+  opt_batch = get_batch_option (line);
   line = skip_options (line);
 
   ctrl->server_local->search_any_found = 0;
@@ -398,14 +729,15 @@ cmd_search (assuan_context_t ctx, char *line)
   ctrl->no_data_return = opt_no_data;
   ctrl->filter_opgp = opt_openpgp;
   ctrl->filter_x509 = opt_x509;
-  err = prepare_outstream (ctrl);
+  err = send_change_events (ctrl);
+  if (!err)
+    err = prepare_outstream (ctrl);
   if (err)
     ;
-  else if (ctrl->server_local->multi_search_desc_len)
-    err = kbxd_search (ctrl, ctrl->server_local->multi_search_desc,
-                       ctrl->server_local->multi_search_desc_len, 1);
+  else if (opt_batch)
+    err = run_search_batch (ctrl, 1, opt_batch);
   else
-    err = kbxd_search (ctrl, &ctrl->server_local->search_desc, 1, 1);
+    err = run_search (ctrl, 1);
   if (err)
     goto leave;
 
@@ -422,17 +754,20 @@ cmd_search (assuan_context_t ctx, char *line)
 
 
 static const char hlp_next[] =
-  "NEXT [--no-data]\n"
+  "NEXT [--no-data] [--batch=N]\n"
   "\n"
-  "Get the next search result from a previous search.";
+  "Get the next search result from a previous search.  With --batch\n"
+  "up to N results are returned as described for \"SEARCH\".";
 static gpg_error_t
 cmd_next (assuan_context_t ctx, char *line)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
   int opt_no_data;
+  unsigned int opt_batch;
   gpg_error_t err;
 
   opt_no_data = has_option (line, "--no-data");
+  opt_batch = get_batch_option (line);
   line = skip_options (line);
 
   if (*line)
@@ -451,28 +786,15 @@ cmd_next (assuan_context_t ctx, char *line)
   ctrl->server_local->inhibit_data_logging_now = 0;
   ctrl->server_local->inhibit_data_logging_count = 0;
   ctrl->no_data_return = opt_no_data;
-  err = prepare_outstream (ctrl);
+  err = send_change_events (ctrl);
+  if (!err)
+    err = prepare_outstream (ctrl);
   if (err)
     ;
-  else if (ctrl->server_local->multi_search_desc_len)
-    {
-      /* The next condition should never be tru but we better handle
-       * the first/next transition anyway.  */
-      if (ctrl->server_local->multi_search_desc[0].mode
-          == KEYDB_SEARCH_MODE_FIRST)
-        ctrl->server_local->multi_search_desc[0].mode = KEYDB_SEARCH_MODE_NEXT;
-
-      err = kbxd_search (ctrl, ctrl->server_local->multi_search_desc,
-                         ctrl->server_local->multi_search_desc_len, 0);
-    }
+  else if (opt_batch)
+    err = run_search_batch (ctrl, 0, opt_batch);
   else
-    {
-      /* We need to do the transition from first to next here.  */
-      if (ctrl->server_local->search_desc.mode == KEYDB_SEARCH_MODE_FIRST)
-        ctrl->server_local->search_desc.mode = KEYDB_SEARCH_MODE_NEXT;
-
-      err = kbxd_search (ctrl, &ctrl->server_local->search_desc, 1, 0);
-    }
+    err = run_search (ctrl, 0);
   if (err)
     goto leave;
 
@@ -483,20 +805,131 @@ cmd_next (assuan_context_t ctx, char *line)
 }
 
 
+/* Number of keys stored by STORE --batch in one database
+ * transaction.  */
+#define STORE_BATCH_COMMIT_SIZE 1000
+
+/* Helper for cmd_store to store all keys of a batch.  */
+static gpg_error_t
+store_batch (assuan_context_t ctx, enum kbxd_store_modes mode)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err, tmperr;
+  unsigned char *value = NULL;
+  size_t valuelen, off, len;
+  unsigned int nitems, nstored, nbatched;
+  int own_transaction = 0;
+
+  if (opt.in_transaction && opt.transaction_pid != assuan_get_pid (ctx))
+    return set_error (GPG_ERR_CONFLICT, "other client is in a transaction");
+
+  /* Ask for the key material.  */
+  err = assuan_inquire (ctx, "BLOBS", &value, &valuelen, 0);
+  if (err)
+    {
+      log_error (_("assuan_inquire failed: %s\n"), gpg_strerror (err));
+      goto leave;
+    }
+
+  /* Unless the client runs its own transaction we commit the keys in
+   * large transactions.  */
+  if (!opt.in_transaction)
+    {
+      opt.in_transaction = 1;
+      opt.transaction_pid = assuan_get_pid (ctx);
+      own_transaction = 1;
+    }
+
+  nitems = nstored = nbatched = 0;
+  for (off = 0; off < valuelen; off += len, nitems++)
+    {
+      if (valuelen - off < 4)
+        {
+          err = set_error (GPG_ERR_INV_DATA, "truncated length field");
+          break;
+        }
+      len = buf32_to_size_t (value + off);
+      off += 4;
+      if (len > valuelen - off)
+        {
+          err = set_error (GPG_ERR_INV_DATA, "truncated blob");
+          break;
+        }
+
+      /* Inside the transaction the backend wraps each store into a
+       * savepoint; thus a key which fails half-way is undone and
+       * does not end up in the commit.  */
+      if (!len)
+        tmperr = gpg_error (GPG_ERR_MISSING_VALUE);
+      else
+        tmperr = kbxd_store (ctrl, value + off, len, mode);
+      if (tmperr)
+        {
+          err = print_assuan_status (ctx, "STORE_FAILED", "%u %u",
+                                     nitems, tmperr);
+          if (err)
+            break;
+          continue;
+        }
+      nstored++;
+
+      if (own_transaction && ++nbatched == STORE_BATCH_COMMIT_SIZE)
+        {
+          nbatched = 0;
+          err = kbxd_commit ();
+          if (err)
+            break;
+          opt.in_transaction = 1;
+        }
+    }
+
+  /* Keep what has been stored even if the batch is corrupt.  */
+  if (own_transaction)
+    {
+      tmperr = kbxd_commit ();
+      if (!err)
+        err = tmperr;
+    }
+
+  if (!err)
+    {
+      char numbuf[50];
+
+      snprintf (numbuf, sizeof numbuf, "%u of %u stored", nstored, nitems);
+      err = assuan_set_okay_line (ctx, numbuf);
+    }
+
+ leave:
+  xfree (value);
+  return err;
+}
+
+
 static const char hlp_store[] =
-  "STORE [--update|--insert]\n"
+  "STORE [--update|--insert] [--batch]\n"
   "\n"
   "Insert a key into the database.  Whether to insert or update\n"
   "the key is decided by looking at the primary key's fingerprint.\n"
   "With option --update the key must already exist.\n"
   "With option --insert the key must not already exist.\n"
   "The actual key material is requested by this function using\n"
-  "  INQUIRE BLOB";
+  "  INQUIRE BLOB\n"
+  "\n"
+  "With option --batch many keys are stored at once.  They are\n"
+  "requested using\n"
+  "  INQUIRE BLOBS\n"
+  "and the client sends the keys each prefixed by its length as a\n"
+  "4 byte number in network byte order.  Unless a transaction has\n"
+  "been started the keys are stored in large transactions.  For each\n"
+  "key which could not be stored the status line\n"
+  "  STORE_FAILED <n> <errcode>\n"
+  "is emitted, with N being the index of the key in the batch.  The\n"
+  "OK line gives the number of stored keys.";
 static gpg_error_t
 cmd_store (assuan_context_t ctx, char *line)
 {
   ctrl_t ctrl = assuan_get_pointer (ctx);
-  int opt_update, opt_insert;
+  int opt_update, opt_insert, opt_batch;
   enum kbxd_store_modes mode;
   gpg_error_t err;
   unsigned char *value = NULL;
@@ -504,6 +937,7 @@ cmd_store (assuan_context_t ctx, char *line)
 
   opt_update = has_option (line, "--update");
   opt_insert = has_option (line, "--insert");
+  opt_batch = has_option (line, "--batch");
   line = skip_options (line);
   if (*line)
     {
@@ -517,6 +951,12 @@ cmd_store (assuan_context_t ctx, char *line)
   else
     mode = KBXD_STORE_AUTO;
 
+  if (opt_batch)
+    {
+      err = store_batch (ctx, mode);
+      goto leave;
+    }
+
   /* Ask for the key material.  */
   err = assuan_inquire (ctx, "BLOB", &value, &valuelen, 0);
   if (err)
@@ -651,6 +1091,44 @@ cmd_transaction (assuan_context_t ctx, char *line)
 
 
 
+static const char hlp_subscribe[] =
+  "SUBSCRIBE [--off]\n"
+  "\n"
+  "Subscribe to change notifications.  The responses of the commands\n"
+  "SEARCH and NEXT then start with a status line\n"
+  "  KEY_CHANGED <generation> <ubid>\n"
+  "for each keyblock stored or deleted since the last response.  An\n"
+  "asterisk instead of the UBID tells that all keys may have changed;\n"
+  "this is the case after a transaction or if there were too many\n"
+  "changes.  The current generation is returned with the status line\n"
+  "  KEY_GENERATION <generation>\n"
+  "With --off the subscription is cancelled.";
+static gpg_error_t
+cmd_subscribe (assuan_context_t ctx, char *line)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+  gpg_error_t err = 0;
+  int opt_off;
+
+  opt_off = has_option (line, "--off");
+  line = skip_options (line);
+  if (*line)
+    err = set_error (GPG_ERR_INV_ARG, "no args expected");
+  else if (opt_off)
+    ctrl->server_local->subscribed = 0;
+  else
+    {
+      ctrl->server_local->subscribed = 1;
+      ctrl->server_local->changes_seen = change_generation;
+      err = print_assuan_status (ctx, "KEY_GENERATION", "%lu",
+                                 change_generation);
+    }
+
+  return leave_cmd (ctx, err);
+}
+
+
+
 static const char hlp_getinfo[] =
   "GETINFO <what>\n"
   "\n"
@@ -661,7 +1139,10 @@ static const char hlp_getinfo[] =
   "pid         - Return the process id of the server.\n"
   "socket_name - Return the name of the socket.\n"
   "session_id  - Return the current session_id.\n"
-  "getenv NAME - Return value of envvar NAME\n";
+  "getenv NAME - Return value of envvar NAME\n"
+  "stmt_cache  - Return hits, misses and size of the SQL statement cache.\n"
+  "cache_stats - Return the counters of the key and blob cache.\n"
+  "metrics     - Return the metrics in the Prometheus text format.\n";
 static gpg_error_t
 cmd_getinfo (assuan_context_t ctx, char *line)
 {
@@ -691,6 +1172,40 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       snprintf (numbuf, sizeof numbuf, "%u", ctrl->server_local->session_id);
       err = assuan_send_data (ctx, numbuf, strlen (numbuf));
     }
+  else if (!strcmp (line, "stmt_cache"))
+    {
+      unsigned long hits, misses;
+      unsigned int cached;
+
+      kbxd_get_stmt_cache_stats (&hits, &misses, &cached);
+      snprintf (numbuf, sizeof numbuf, "%lu %lu %u", hits, misses, cached);
+      err = assuan_send_data (ctx, numbuf, strlen (numbuf));
+    }
+  else if (!strcmp (line, "cache_stats"))
+    {
+      char *s = kbxd_get_cache_stats ();
+      if (!s)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = assuan_send_data (ctx, s, strlen (s));
+          xfree (s);
+        }
+    }
+  else if (!strcmp (line, "metrics"))
+    {
+      char *s;
+
+      gnupg_metrics_add_collector (kbxd_collect_metrics);
+      s = gnupg_metrics_format ("keyboxd");
+      if (!s)
+        err = gpg_error_from_syserror ();
+      else
+        {
+          err = assuan_send_data (ctx, s, strlen (s));
+          xfree (s);
+        }
+    }
   else if (!strncmp (line, "getenv", 6)
            && (line[6] == ' ' || line[6] == '\t' || !line[6]))
     {
@@ -772,6 +1287,7 @@ register_commands (assuan_context_t ctx)
     { "STORE",      cmd_store,      hlp_store  },
     { "DELETE",     cmd_delete,     hlp_delete  },
     { "TRANSACTION",cmd_transaction,hlp_transaction },
+    { "SUBSCRIBE",  cmd_subscribe,  hlp_subscribe },
     { "GETINFO",    cmd_getinfo,    hlp_getinfo },
     { "OUTPUT",     NULL,           hlp_output },
     { "KILLKEYBOXD",cmd_killkeyboxd,hlp_killkeyboxd },
@@ -804,6 +1320,32 @@ reset_notify (assuan_context_t ctx, char *line)
 }
 
 
+/* Called by libassuan before all commands.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)cmd;
+
+  ctrl->server_local->cmd_start = gnupg_metrics_now ();
+  return 0;
+}
+
+
+/* Called by libassuan after all commands.  */
+static void
+post_cmd_notify (assuan_context_t ctx, gpg_error_t err)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)err;
+
+  gnupg_metrics_command_done (assuan_get_command_name (ctx),
+                              ctrl->server_local->cmd_start);
+}
+
+
 /* This function is called by our assuan log handler to test whether a
  * log message shall really be printed.  The function must return
  * false to inhibit the logging of MSG.  CAT gives the requested log
@@ -906,6 +1448,8 @@ kbxd_start_command_handler (ctrl_t ctrl, gnupg_fd_t fd, unsigned int session_id)
   assuan_set_hello_line (ctx, hello_line);
   assuan_register_option_handler (ctx, option_handler);
   assuan_register_reset_notify (ctx, reset_notify);
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
+  assuan_register_post_cmd_notify (ctx, post_cmd_notify);
 
   ctrl->server_local->session_id = session_id;
 
@@ -966,6 +1510,7 @@ kbxd_start_command_handler (ctrl_t ctrl, gnupg_fd_t fd, unsigned int session_id)
     }
 
   assuan_close_output_fd (ctx);
+  release_data_shm (ctrl);
 
   set_assuan_context_func (NULL);
   ctrl->server_local->assuan_ctx = NULL;
@@ -56,6 +56,7 @@ enum cmd_and_opt_values {
   aImportOpenPGP,
   aFindDups,
   aCut,
+  aBuildIndex,
 
   oDebug,
   oDebugAll,
@@ -78,6 +79,7 @@ static gpgrt_opt_t opts[] = {
   { aImportOpenPGP, "import-openpgp", 0, "import OpenPGP keyblocks"},
   { aFindDups,    "find-dups",   0, "find duplicates" },
   { aCut,         "cut",         0, "export records" },
+  { aBuildIndex,  "build-index", 0, "write the index file" },
 
   { 301, NULL, 0, N_("@\nOptions:\n ") },
 
@@ -463,6 +465,22 @@ import_openpgp (const char *filename, int dryrun)
 }
 
 
+/* Write the index file for the keybox FILENAME.  */
+static void
+build_index (const char *filename)
+{
+  gpg_error_t err;
+  void *token;
+
+  err = keybox_register_file (filename, 0, &token);
+  if (!err)
+    err = keybox_write_index (token);
+  if (err)
+    log_error ("%s: failed to write the index: %s\n",
+               filename, gpg_strerror (err));
+}
+
+
 
 
 int
@@ -515,6 +533,7 @@ main (int argc, char **argv)
         case aImportOpenPGP:
         case aFindDups:
         case aCut:
+        case aBuildIndex:
           cmd = pargs.r_opt;
           break;
 
@@ -577,6 +596,13 @@ main (int argc, char **argv)
             _keybox_dump_cut_records (*argv, from, to, stdout);
         }
     }
+  else if (cmd == aBuildIndex)
+    {
+      if (!argc)
+        log_error ("usage: kbxutil --build-index KEYBOXFILE...\n");
+      for (; argc; argc--, argv++)
+        build_index (*argv);
+    }
   else if (cmd == aImportOpenPGP)
     {
       if (!argc)
@@ -216,16 +216,12 @@ struct keyid_list {
     byte kid[8];
 };
 
-struct fixup_list {
-    struct fixup_list *next;
-    u32 off;
-    u32 val;
-};
 
 
 struct keyboxblob {
   byte *blob;
   size_t bloblen;
+  size_t blobsize;  /* Allocated size of BLOB; 0 if not known.  */
   off_t fileoffset;
 
   /* stuff used only by keybox_create_blob */
@@ -238,8 +234,6 @@ struct keyboxblob {
   struct keyboxblob_uid *uids;
   int nsigs;
   u32  *sigs;
-  struct fixup_list *fixups;
-  int fixup_out_of_core;
 
   struct keyid_list *temp_kids;
   struct membuf bufbuf; /* temporary store for the blob */
@@ -252,10 +246,12 @@ struct keyboxblob {
    create a buffer, put_membuf to append bytes and get_membuf to
    release and return the buffer.  Allocation errors are detected but
    only returned at the final get_membuf(), this helps not to clutter
-   the code with out of core checks.  */
+   the code with out of core checks.  The blob creation functions
+   compute the size in advance and thus the buffer is never
+   reallocated.  */
 
 static void
-init_membuf (struct membuf *mb, int initiallen)
+init_membuf (struct membuf *mb, size_t initiallen)
 {
   mb->len = 0;
   mb->size = initiallen;
@@ -271,7 +267,7 @@ put_membuf (struct membuf *mb, const void *buf, size_t len)
   if (mb->out_of_core)
     return;
 
-  if (mb->len + len >= mb->size)
+  if (mb->len + len > mb->size)
     {
       char *p;
 
@@ -338,39 +334,16 @@ put32 (struct membuf *mb, u32 a )
 }
 
 
-
-/* Store a value in the fixup list */
-static void
-add_fixup (KEYBOXBLOB blob, u32 off, u32 val)
-{
-  struct fixup_list *fl;
-
-  if (blob->fixup_out_of_core)
-    return;
-
-  fl = xtrycalloc(1, sizeof *fl);
-  if (!fl)
-    blob->fixup_out_of_core = 1;
-  else
-    {
-      fl->off = off;
-      fl->val = val;
-      fl->next = blob->fixups;
-      blob->fixups = fl;
-    }
-}
-
-
 
 /*
   OpenPGP specific stuff
 */
 
 
-/* We must store the keyid at some place because we can't calculate
-   the offset yet. This is only used for v3 keyIDs.  Function returns
-   an index value for later fixup or -1 for out of core.  The value
-   must be a non-zero value. */
+/* We must store the keyid at some place because it is written after
+   the key infos. This is only used for v3 keyIDs.  Function returns
+   an index value for write_stored_kid or -1 for out of core.  The
+   value must be a non-zero value. */
 static int
 pgp_temp_store_kid (KEYBOXBLOB blob, struct _keybox_openpgp_key_info *kinfo)
 {
@@ -475,18 +448,7 @@ static int
 pgp_create_blob_keyblock (KEYBOXBLOB blob,
                           const unsigned char *image, size_t imagelen)
 {
-  struct membuf *a = blob->buf;
-  int n;
-  u32 kbstart = a->len;
-
-  add_fixup (blob, 8, kbstart);
-
-  for (n = 0; n < blob->nuids; n++)
-    add_fixup (blob, blob->uids[n].off_addr, kbstart + blob->uids[n].off);
-
-  put_membuf (a, image, imagelen);
-
-  add_fixup (blob, 12, a->len - kbstart);
+  put_membuf (blob->buf, image, imagelen);
   return 0;
 }
 
@@ -497,24 +459,12 @@ pgp_create_blob_keyblock (KEYBOXBLOB blob,
    X.509 specific stuff
  */
 
-/* Write the raw certificate out */
+/* Write the raw certificate IMAGE out */
 static int
-x509_create_blob_cert (KEYBOXBLOB blob, ksba_cert_t cert)
+x509_create_blob_cert (KEYBOXBLOB blob,
+                       const unsigned char *image, size_t length)
 {
-  struct membuf *a = blob->buf;
-  const unsigned char *image;
-  size_t length;
-  u32 kbstart = a->len;
-
-  /* Store our offset for later fixup */
-  add_fixup (blob, 8, kbstart);
-
-  image = ksba_cert_get_image (cert, &length);
-  if (!image)
-    return gpg_error (GPG_ERR_GENERAL);
-  put_membuf (a, image, length);
-
-  add_fixup (blob, 12, a->len - kbstart);
+  put_membuf (blob->buf, image, length);
   return 0;
 }
 
@@ -551,28 +501,86 @@ release_kid_list (struct keyid_list *kl)
 }
 
 
-/* Create a new blob header.  If WANT_FPR32 is set a version 2 blob is
- * created.  */
+/* Return the length of the blob header for BLOB; that is the offset
+ * of the keyblock or certificate.  See create_blob_header for the
+ * meaning of BLOBTYPE and WANT_FPR32.  The variable part after the
+ * reserved space holds the v3 key IDs or the X.509 names.  */
+static size_t
+blob_header_length (KEYBOXBLOB blob, int blobtype, int want_fpr32)
+{
+  size_t n;
+  int i;
+
+  n = 4 + 1 + 1 + 2 + 4 + 4;
+  n += 2 + 2 + blob->nkeys * (want_fpr32? (32 + 2 + 2 + 20)
+                                        : (20 + 4 + 2 + 2));
+  n += 2 + blob->seriallen;
+  n += 2 + 2 + blob->nuids * (4 + 4 + 2 + 1 + 1);
+  n += 2 + 2 + blob->nsigs * 4;
+  n += 1 + 1 + 2 + 4 + 4 + 4 + 4;
+
+  if (blobtype == KEYBOX_BLOBTYPE_PGP && !want_fpr32)
+    {
+      for (i=0; i < blob->nkeys; i++)
+        if (blob->keys[i].off_kid)
+          n += 8;
+    }
+  if (blobtype == KEYBOX_BLOBTYPE_X509)
+    {
+      for (i=0; i < blob->nuids; i++)
+        if (blob->uids[i].name)
+          n += blob->uids[i].len;
+    }
+
+  return n;
+}
+
+
+/* Allocate the buffer for BLOB and write the blob header.  If
+ * WANT_FPR32 is set a version 2 blob is created.  IMAGELEN is the
+ * length of the keyblock or certificate; all offsets and lengths are
+ * computed in advance so that the blob is written in one pass.  */
 static int
 create_blob_header (KEYBOXBLOB blob, int blobtype, int as_ephemeral,
-                    int want_fpr32)
+                    int want_fpr32, size_t imagelen)
 {
-  struct membuf *a = blob->buf;
+  struct membuf *a;
+  size_t kbstart, kidoff;
   int i;
 
-  put32 ( a, 0 ); /* blob length, needs fixup */
+  kbstart = blob_header_length (blob, blobtype, want_fpr32);
+  init_membuf (&blob->bufbuf, kbstart + imagelen + 20);
+  blob->buf = a = &blob->bufbuf;
+
+  put32 ( a, kbstart + imagelen + 20 ); /* blob length */
   put8 ( a, blobtype);
   put8 ( a, want_fpr32? 2:1 );  /* blob type version */
   put16 ( a, as_ephemeral? 6:4 ); /* blob flags */
 
-  put32 ( a, 0 ); /* offset to the raw data, needs fixup */
-  put32 ( a, 0 ); /* length of the raw data, needs fixup */
+  put32 ( a, kbstart );  /* offset to the raw data */
+  put32 ( a, imagelen ); /* length of the raw data */
 
   put16 ( a, blob->nkeys );
   if (want_fpr32)
     put16 ( a, 32 + 2 + 2 + 20);  /* size of key info */
   else
     put16 ( a, 20 + 4 + 2 + 2 );  /* size of key info */
+  /* The v3 key IDs or the X.509 names are stored at the end of the
+   * header.  */
+  kidoff = kbstart;
+  if (blobtype == KEYBOX_BLOBTYPE_PGP && !want_fpr32)
+    {
+      for (i=0; i < blob->nkeys; i++)
+        if (blob->keys[i].off_kid)
+          kidoff -= 8;
+    }
+  if (blobtype == KEYBOX_BLOBTYPE_X509)
+    {
+      for (i=0; i < blob->nuids; i++)
+        if (blob->uids[i].name)
+          kidoff -= blob->uids[i].len;
+    }
+
   for ( i=0; i < blob->nkeys; i++ )
     {
       if (want_fpr32)
@@ -592,7 +600,17 @@ create_blob_header (KEYBOXBLOB blob, int blobtype, int as_ephemeral,
           log_assert (blob->keys[i].fprlen <= 20);
           put_membuf (a, blob->keys[i].fpr, 20);
           blob->keys[i].off_kid_addr = a->len;
-          put32 ( a, 0 ); /* offset to keyid, fixed up later */
+          if (blobtype != KEYBOX_BLOBTYPE_PGP)
+            put32 ( a, 0 ); /* no keyid */
+          else if (blob->keys[i].off_kid)
+            { /* this is a v3 one */
+              put32 ( a, kidoff );
+              kidoff += 8;
+            }
+          else
+            { /* the better v4 key IDs - just store an offset 8 bytes back */
+              put32 ( a, blob->keys[i].off_kid_addr - 8 );
+            }
           put16 ( a, blob->keys[i].flags );
           put16 ( a, 0 ); /* reserved */
         }
@@ -607,7 +625,15 @@ create_blob_header (KEYBOXBLOB blob, int blobtype, int as_ephemeral,
   for (i=0; i < blob->nuids; i++)
     {
       blob->uids[i].off_addr = a->len;
-      put32 ( a, 0 ); /* offset to userid, fixed up later */
+      if (blobtype == KEYBOX_BLOBTYPE_PGP)
+        put32 ( a, kbstart + blob->uids[i].off ); /* offset to userid */
+      else if (blob->uids[i].name)
+        {
+          put32 ( a, kidoff ); /* offset to the utf-8 name */
+          kidoff += blob->uids[i].len;
+        }
+      else
+        put32 ( a, 0 );
       put32 ( a, blob->uids[i].len );
       put16 ( a, blob->uids[i].flags );
       put8  ( a, 0 ); /* validity */
@@ -636,22 +662,13 @@ create_blob_header (KEYBOXBLOB blob, int blobtype, int as_ephemeral,
     {
       /* For version 1 blobs, we need to store the keyids for all v3
        * keys because those key IDs are not part of the fingerprint.
-       * While we are doing that, we fixup all the keyID offsets.  For
-       * version 2 blobs (which can't carry v3 keys) we compute the
-       * keyids in the fly because they are just stripped down
+       * For version 2 blobs (which can't carry v3 keys) we compute
+       * the keyids in the fly because they are just stripped down
        * fingerprints.  */
       for (i=0; i < blob->nkeys; i++ )
         {
           if (blob->keys[i].off_kid)
-            { /* this is a v3 one */
-              add_fixup (blob, blob->keys[i].off_kid_addr, a->len);
-              write_stored_kid (blob, blob->keys[i].off_kid);
-            }
-          else
-            { /* the better v4 key IDs - just store an offset 8 bytes back */
-              add_fixup (blob, blob->keys[i].off_kid_addr,
-                         blob->keys[i].off_kid_addr - 8);
-            }
+            write_stored_kid (blob, blob->keys[i].off_kid);
         }
     }
 
@@ -662,14 +679,13 @@ create_blob_header (KEYBOXBLOB blob, int blobtype, int as_ephemeral,
       for (i=0; i < blob->nuids; i++ )
         {
           if (blob->uids[i].name)
-            { /* this is a v3 one */
-              add_fixup (blob, blob->uids[i].off_addr, a->len);
-              put_membuf (blob->buf, blob->uids[i].name, blob->uids[i].len);
-            }
+            put_membuf (blob->buf, blob->uids[i].name, blob->uids[i].len);
         }
     }
 
-    return 0;
+  if (!a->out_of_core)
+    log_assert (a->len == kbstart);
+  return 0;
 }
 
 
@@ -687,7 +703,6 @@ create_blob_finish (KEYBOXBLOB blob)
 {
   struct membuf *a = blob->buf;
   unsigned char *p;
-  unsigned char *pp;
   size_t n;
 
   /* Write placeholders for the checksum.  */
@@ -698,46 +713,15 @@ create_blob_finish (KEYBOXBLOB blob)
   p = get_membuf (a, &n);
   if (!p)
     return gpg_error (GPG_ERR_ENOMEM);
-  assert (n >= 20);
-
-  /* fixup the length */
-  add_fixup (blob, 0, n);
-
-  /* do the fixups */
-  if (blob->fixup_out_of_core)
-    {
-      xfree (p);
-      return gpg_error (GPG_ERR_ENOMEM);
-    }
+  assert (n >= 40 && n == get32 (p));
 
-  {
-    struct fixup_list *fl, *next;
-    for (fl = blob->fixups; fl; fl = next)
-      {
-        assert (fl->off+4 <= n);
-        p[fl->off+0] = fl->val >> 24;
-        p[fl->off+1] = fl->val >> 16;
-        p[fl->off+2] = fl->val >>  8;
-        p[fl->off+3] = fl->val;
-        next = fl->next;
-        xfree (fl);
-      }
-    blob->fixups = NULL;
-  }
-
-  /* Compute and store the SHA-1 checksum. */
+  /* Compute and store the SHA-1 checksum.  The buffer has been
+   * allocated with the final size and thus we can keep it.  */
   gcry_md_hash_buffer (GCRY_MD_SHA1, p + n - 20, p, n - 40);
 
-  pp = xtrymalloc (n);
-  if ( !pp )
-    {
-      xfree (p);
-      return gpg_error_from_syserror ();
-    }
-  memcpy (pp , p, n);
-  xfree (p);
-  blob->blob = pp;
+  blob->blob = p;
   blob->bloblen = n;
+  blob->blobsize = n;
 
   return 0;
 }
@@ -814,10 +798,8 @@ _keybox_create_openpgp_blob (KEYBOXBLOB *r_blob,
   pgp_create_uid_part (blob, info);
   pgp_create_sig_part (blob, NULL);
 
-  init_membuf (&blob->bufbuf, 1024);
-  blob->buf = &blob->bufbuf;
   err = create_blob_header (blob, KEYBOX_BLOBTYPE_PGP,
-                            as_ephemeral, need_fpr32);
+                            as_ephemeral, need_fpr32, imagelen);
   if (err)
     goto leave;
   err = pgp_create_blob_keyblock (blob, image, imagelen);
@@ -899,6 +881,8 @@ _keybox_create_x509_blob (KEYBOXBLOB *r_blob, ksba_cert_t cert,
   char *p;
   char **names = NULL;
   size_t max_names;
+  const unsigned char *image;
+  size_t imagelen;
 
   *r_blob = NULL;
   blob = xtrycalloc (1, sizeof *blob);
@@ -1000,14 +984,19 @@ _keybox_create_x509_blob (KEYBOXBLOB *r_blob, ksba_cert_t cert,
   /* signatures */
   blob->sigs[0] = 0;	/* not yet checked */
 
-  /* Create a temporary buffer for further processing */
-  init_membuf (&blob->bufbuf, 1024);
-  blob->buf = &blob->bufbuf;
+  image = ksba_cert_get_image (cert, &imagelen);
+  if (!image)
+    {
+      rc = gpg_error (GPG_ERR_GENERAL);
+      goto leave;
+    }
+
   /* write out what we already have */
-  rc = create_blob_header (blob, KEYBOX_BLOBTYPE_X509, as_ephemeral, 0);
+  rc = create_blob_header (blob, KEYBOX_BLOBTYPE_X509, as_ephemeral, 0,
+                           imagelen);
   if (rc)
     goto leave;
-  rc = x509_create_blob_cert (blob, cert);
+  rc = x509_create_blob_cert (blob, image, imagelen);
   if (rc)
     goto leave;
   rc = create_blob_trailer (blob);
@@ -1055,12 +1044,39 @@ _keybox_new_blob (KEYBOXBLOB *r_blob,
 
   blob->blob = image;
   blob->bloblen = imagelen;
+  blob->blobsize = imagelen;
   blob->fileoffset = off;
   *r_blob = blob;
   return 0;
 }
 
 
+/* Prepare BLOB, which must have been created by _keybox_new_blob,
+ * for an image of IMAGELEN bytes at file offset OFF.  The current
+ * image buffer is reused if it is large enough.  Returns a pointer
+ * to the new image buffer or NULL on error, in which case BLOB is
+ * unchanged.  */
+unsigned char *
+_keybox_reuse_blob (KEYBOXBLOB blob, size_t imagelen, off_t off)
+{
+  if (imagelen > blob->blobsize)
+    {
+      unsigned char *image;
+      size_t newsize = imagelen < 4096? 4096 : imagelen;
+
+      image = xtrymalloc (newsize);
+      if (!image)
+        return NULL;
+      xfree (blob->blob);
+      blob->blob = image;
+      blob->blobsize = newsize;
+    }
+  blob->bloblen = imagelen;
+  blob->fileoffset = off;
+  return blob->blob;
+}
+
+
 void
 _keybox_release_blob (KEYBOXBLOB blob)
 {
@@ -1097,6 +1113,12 @@ _keybox_get_blob_fileoffset (KEYBOXBLOB blob)
   return blob->fileoffset;
 }
 
+void
+_keybox_set_blob_fileoffset (KEYBOXBLOB blob, off_t off)
+{
+  blob->fileoffset = off;
+}
+
 
 
 void
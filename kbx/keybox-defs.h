@@ -38,6 +38,7 @@
 
 
 typedef struct keyboxblob *KEYBOXBLOB;
+typedef struct keybox_index_s *keybox_index_t;
 
 
 typedef struct keybox_name *KB_NAME;
@@ -65,6 +66,9 @@ struct keybox_name
   /* Not yet used.  */
   int did_full_scan;
 
+  /* The in-memory index or NULL if not yet built.  */
+  keybox_index_t index;
+
   /* The name of the resource file. */
   char fname[1];
 };
@@ -84,6 +88,7 @@ struct keybox_handle {
   int eof;
   int error;
   int ephemeral;
+  int append_mode;        /* Append new and updated blobs in place.  */
   int for_openpgp;        /* Used by gpg.  */
   struct keybox_found_s found;
   struct keybox_found_s saved_found;
@@ -159,9 +164,12 @@ int _keybox_create_x509_blob (KEYBOXBLOB *r_blob, ksba_cert_t cert,
 int  _keybox_new_blob (KEYBOXBLOB *r_blob,
                        unsigned char *image, size_t imagelen,
                        off_t off);
+unsigned char *_keybox_reuse_blob (KEYBOXBLOB blob,
+                                   size_t imagelen, off_t off);
 void _keybox_release_blob (KEYBOXBLOB blob);
 const unsigned char *_keybox_get_blob_image (KEYBOXBLOB blob, size_t *n);
 off_t _keybox_get_blob_fileoffset (KEYBOXBLOB blob);
+void _keybox_set_blob_fileoffset (KEYBOXBLOB blob, off_t off);
 void _keybox_update_header_blob (KEYBOXBLOB blob, int for_openpgp);
 
 /*-- keybox-openpgp.c --*/
@@ -172,7 +180,10 @@ void _keybox_destroy_openpgp_info (keybox_openpgp_info_t info);
 
 
 /*-- keybox-file.c --*/
+void _keybox_set_read_buffer (FILE *fp);
 int _keybox_read_blob (KEYBOXBLOB *r_blob, FILE *fp, int *skipped_deleted);
+int _keybox_read_blob_reuse (KEYBOXBLOB *r_blob, FILE *fp,
+                             int *skipped_deleted);
 int _keybox_write_blob (KEYBOXBLOB blob, FILE *fp);
 
 /*-- keybox-search.c --*/
@@ -180,6 +191,9 @@ gpg_err_code_t _keybox_get_flag_location (const unsigned char *buffer,
                                           size_t length,
                                           int what,
                                           size_t *flag_off, size_t *flag_size);
+int _keybox_get_blob_mailbox (const unsigned char *buffer, size_t length,
+                              int x509, size_t idx,
+                              size_t *r_off, size_t *r_len);
 
 static inline int
 blob_get_type (KEYBOXBLOB blob)
@@ -195,6 +209,19 @@ blob_get_type (KEYBOXBLOB blob)
 }
 
 
+/*-- keybox-index.c --*/
+void _keybox_index_release (keybox_index_t index);
+int  _keybox_index_prepare (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc,
+                            size_t ndesc);
+int  _keybox_index_next (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc,
+                         size_t ndesc, off_t pos, off_t *r_off);
+void _keybox_index_invalidate (KB_NAME kb);
+void _keybox_index_flush (KB_NAME kb);
+int  _keybox_index_is_current (KB_NAME kb);
+void _keybox_index_note_change (KB_NAME kb, int was_current);
+void _keybox_index_note_insert (KB_NAME kb, KEYBOXBLOB blob, int was_current);
+
+
 /*-- keybox-dump.c --*/
 int _keybox_dump_blob (KEYBOXBLOB blob, FILE *fp);
 int _keybox_dump_file (const char *filename, int stats_only, FILE *outfp);
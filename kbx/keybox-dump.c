@@ -658,7 +658,11 @@ open_file (const char **filename, FILE *outfp)
       fp = stdin;
     }
   else
-    fp = fopen (*filename, "rb");
+    {
+      fp = fopen (*filename, "rb");
+      if (fp)
+        _keybox_set_read_buffer (fp);
+    }
   if (!fp)
     {
       int save_errno = errno;
@@ -674,7 +678,7 @@ int
 _keybox_dump_file (const char *filename, int stats_only, FILE *outfp)
 {
   FILE *fp;
-  KEYBOXBLOB blob;
+  KEYBOXBLOB blob = NULL;
   int rc;
   unsigned long count = 0;
   struct file_stats_s stats;
@@ -687,7 +691,7 @@ _keybox_dump_file (const char *filename, int stats_only, FILE *outfp)
 
   for (;;)
     {
-      rc = _keybox_read_blob (&blob, fp, &skipped_deleted);
+      rc = _keybox_read_blob_reuse (&blob, fp, &skipped_deleted);
       if (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
           && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX)
         {
@@ -718,9 +722,9 @@ _keybox_dump_file (const char *filename, int stats_only, FILE *outfp)
           _keybox_dump_blob (blob, outfp);
           fprintf (outfp, "END-RECORD\n");
         }
-      _keybox_release_blob (blob);
       count++;
     }
+  _keybox_release_blob (blob);
   if (rc == -1)
     rc = 0;
   if (rc)
@@ -788,7 +792,7 @@ int
 _keybox_dump_find_dups (const char *filename, int print_them, FILE *outfp)
 {
   FILE *fp;
-  KEYBOXBLOB blob;
+  KEYBOXBLOB blob = NULL;
   int rc;
   unsigned long recno = 0;
   unsigned char zerodigest[20];
@@ -814,7 +818,7 @@ _keybox_dump_find_dups (const char *filename, int print_them, FILE *outfp)
     }
   dupitems_count = 0;
 
-  while ( !(rc = _keybox_read_blob (&blob, fp, NULL)) )
+  while ( !(rc = _keybox_read_blob_reuse (&blob, fp, NULL)) )
     {
       unsigned char digest[20];
 
@@ -842,9 +846,9 @@ _keybox_dump_find_dups (const char *filename, int print_them, FILE *outfp)
           memcpy (dupitems[dupitems_count].digest, digest, 20);
           dupitems_count++;
         }
-      _keybox_release_blob (blob);
       recno++;
     }
+  _keybox_release_blob (blob);
   if (rc == -1)
     rc = 0;
   if (rc)
@@ -881,14 +885,14 @@ _keybox_dump_cut_records (const char *filename, unsigned long from,
                           unsigned long to, FILE *outfp)
 {
   FILE *fp;
-  KEYBOXBLOB blob;
+  KEYBOXBLOB blob = NULL;
   int rc;
   unsigned long recno = 0;
 
   if (!(fp = open_file (&filename, stderr)))
     return gpg_error_from_syserror ();
 
-  while ( !(rc = _keybox_read_blob (&blob, fp, NULL)) )
+  while ( !(rc = _keybox_read_blob_reuse (&blob, fp, NULL)) )
     {
       if (recno > to)
         break; /* Ready.  */
@@ -901,7 +905,6 @@ _keybox_dump_cut_records (const char *filename, unsigned long from,
               goto leave;
             }
         }
-      _keybox_release_blob (blob);
       recno++;
     }
   if (rc == -1)
@@ -909,6 +912,7 @@ _keybox_dump_cut_records (const char *filename, unsigned long from,
   if (rc)
     fprintf (stderr, "error reading '%s': %s\n", filename, gpg_strerror (rc));
  leave:
+  _keybox_release_blob (blob);
   if (fp != stdin)
     fclose (fp);
   return rc;
@@ -25,6 +25,7 @@
 #include <time.h>
 
 #include "keybox-defs.h"
+#include "../common/host2net.h"
 
 
 #define IMAGELEN_LIMIT (5*1024*1024)
@@ -45,40 +46,56 @@ ftello (FILE *stream)
 
 
 
-/* Read a block at the current position and return it in R_BLOB.
-   R_BLOB may be NULL to simply skip the current block.  */
-int
-_keybox_read_blob (KEYBOXBLOB *r_blob, FILE *fp, int *skipped_deleted)
+/* Size of the stdio buffer used for reading keybox files.  */
+#define READ_BUFFER_SIZE (64*1024)
+
+
+/* Give the stream FP, which has just been opened for reading, a
+   large buffer.  Keybox files are read sequentially and most blobs
+   are small, thus the default stdio buffer leads to a lot of read
+   calls.  */
+void
+_keybox_set_read_buffer (FILE *fp)
+{
+  setvbuf (fp, NULL, _IOFBF, READ_BUFFER_SIZE);
+}
+
+
+/* Read a blob at the current position of FP.  If REUSE is set and
+   *R_BLOB is not NULL, that blob object and its image buffer are
+   reused.  */
+static int
+read_blob (KEYBOXBLOB *r_blob, int reuse, FILE *fp, int *skipped_deleted)
 {
   unsigned char *image;
+  unsigned char hdr[5];
   size_t imagelen = 0;
-  int c1, c2, c3, c4, type;
+  size_t n;
+  int type;
   int rc;
   off_t off;
 
   if (skipped_deleted)
     *skipped_deleted = 0;
  again:
-  if (r_blob)
+  if (r_blob && !reuse)
     *r_blob = NULL;
   off = ftello (fp);
   if (off == (off_t)-1)
     return gpg_error_from_syserror ();
 
-  if ((c1 = getc (fp)) == EOF
-      || (c2 = getc (fp)) == EOF
-      || (c3 = getc (fp)) == EOF
-      || (c4 = getc (fp)) == EOF
-      || (type = getc (fp)) == EOF)
+  n = fread (hdr, 1, 5, fp);
+  if (n != 5)
     {
-      if ( c1 == EOF && !ferror (fp) )
+      if (!n && !ferror (fp))
         return -1; /* eof */
       if (!ferror (fp))
         return gpg_error (GPG_ERR_TOO_SHORT);
       return gpg_error_from_syserror ();
     }
 
-  imagelen = ((unsigned int) c1 << 24) | (c2 << 16) | (c3 << 8 ) | c4;
+  imagelen = buf32_to_size_t (hdr);
+  type = hdr[4];
   if (imagelen < 5)
     return gpg_error (GPG_ERR_TOO_SHORT);
 
@@ -109,18 +126,36 @@ _keybox_read_blob (KEYBOXBLOB *r_blob, FILE *fp, int *skipped_deleted)
       return 0;
     }
 
-  image = xtrymalloc (imagelen);
-  if (!image)
-    return gpg_error_from_syserror ();
+  if (reuse && *r_blob)
+    {
+      image = _keybox_reuse_blob (*r_blob, imagelen, off);
+      if (!image)
+        return gpg_error_from_syserror ();
+    }
+  else
+    {
+      image = xtrymalloc (imagelen);
+      if (!image)
+        return gpg_error_from_syserror ();
+    }
 
-  image[0] = c1; image[1] = c2; image[2] = c3; image[3] = c4; image[4] = type;
+  memcpy (image, hdr, 5);
   if (fread (image+5, imagelen-5, 1, fp) != 1)
     {
-      gpg_error_t tmperr = gpg_error_from_syserror ();
-      xfree (image);
+      gpg_error_t tmperr;
+
+      if (ferror (fp))
+        tmperr = gpg_error_from_syserror ();
+      else
+        tmperr = gpg_error (GPG_ERR_TOO_SHORT);
+      if (!(reuse && *r_blob))
+        xfree (image);
       return tmperr;
     }
 
+  if (reuse && *r_blob)
+    return 0;
+
   rc = _keybox_new_blob (r_blob, image, imagelen, off);
   if (rc)
     xfree (image);
@@ -128,6 +163,28 @@ _keybox_read_blob (KEYBOXBLOB *r_blob, FILE *fp, int *skipped_deleted)
 }
 
 
+/* Read a block at the current position and return it in R_BLOB.
+   R_BLOB may be NULL to simply skip the current block.  */
+int
+_keybox_read_blob (KEYBOXBLOB *r_blob, FILE *fp, int *skipped_deleted)
+{
+  return read_blob (r_blob, 0, fp, skipped_deleted);
+}
+
+
+/* Same as _keybox_read_blob but if R_BLOB points to a blob object
+   returned by an earlier call, the object and its buffer are reused
+   for the new blob.  This avoids memory allocations for each blob
+   while scanning a file.  On error *R_BLOB is not changed but its
+   content is undefined; it must eventually be released by the
+   caller.  */
+int
+_keybox_read_blob_reuse (KEYBOXBLOB *r_blob, FILE *fp, int *skipped_deleted)
+{
+  return read_blob (r_blob, 1, fp, skipped_deleted);
+}
+
+
 /* Write the block to the current file position */
 int
 _keybox_write_blob (KEYBOXBLOB blob, FILE *fp)
@@ -0,0 +1,1412 @@
+/* keybox-index.c - In-memory and on-disk index for faster searches
+ * Copyright (C) 2020 g10 Code GmbH
+ *
+ * This file is part of GnuPG.
+ *
+ * GnuPG is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * GnuPG is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, see <https://www.gnu.org/licenses/>.
+ */
+
+/*
+ * The index maps the first 8 bytes of the fingerprints, the key ids,
+ * the keygrips and of a hash of the mail addresses of all keys in a
+ * keybox file to the file offsets of their blobs.  For X.509 blobs
+ * it also maps a hash of the issuer and of the subject DN so that
+ * gpgsm's chain building does not need to scan the keybox for each
+ * step.  It is only used to
+ * find candidate blobs; the search code still reads each candidate
+ * blob and runs the usual compare functions on it.  Thus a stale
+ * entry can't lead to a wrong result but at worst to an extra blob
+ * read.
+ *
+ * The index is tied to the identity (device, inode, size and mtime
+ * including the nanoseconds if available) of the file it has been
+ * built from and is rebuilt on the next
+ * search if the file has changed in any other way than by the update
+ * functions of this process.
+ *
+ * To avoid building the index in each new process it is also stored
+ * in a sidecar file with the suffix ".idx".  That file is written
+ * when the last handle of a resource with a changed index is
+ * released.  Its format is:
+ *
+ *   byte 4   Magic "KBXi"
+ *   byte 1   Version number (3)
+ *   byte 3   RFU
+ *   u32      Generation counter; incremented with each rewrite.
+ *   u32      Number of entries in the fingerprint table
+ *   u32      Number of entries in the key id table
+ *   u32      Number of entries in the mail table
+ *   u32      Number of entries in the keygrip table
+ *   u32      Flags: bit 0 - keygrip table is valid
+ *                   bit 1 - keygrips are not available for all blobs.
+ *   u64      Size of the keybox file
+ *   u64      Modification time of the keybox file
+ *   u64      Inode number of the keybox file
+ *   u32      Number of entries in the DN table
+ *   u32      Nanoseconds of the modification time or 0
+ *
+ * followed by the tables in the above order.  Each entry is 16 bytes
+ * long: 8 bytes of the key followed by the offset of the blob as an
+ * u64.  All numbers are in network byte order and the tables are
+ * sorted so that a memory mapped file can directly be used.
+ *
+ * For substring searches the index also keeps the user ids of all
+ * blobs mapped to lowercase in one large buffer.  A substring is then
+ * located with a single scan over that buffer instead of reading and
+ * parsing each blob.  This table is only built on the first substring
+ * search and is not stored in the sidecar file.
+ */
+
+#include <config.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#if defined(HAVE_MMAP) && !defined(HAVE_W32_SYSTEM)
+# include <sys/mman.h>
+# define USE_INDEX_MMAP 1
+#endif
+
+#include "keybox-defs.h"
+#include <gcrypt.h>
+#include "../common/host2net.h"
+
+#define get16(a) buf16_to_ulong ((a))
+#define get32(a) buf32_to_ulong ((a))
+
+#define SIDECAR_SUFFIX   ".idx"
+#define SIDECAR_HDRLEN   64
+#define SIDECAR_VERSION  3
+#define SIDECAR_FLAG_HAVE_GRIPS 1
+#define SIDECAR_FLAG_NO_GRIPS   2
+
+
+/* An index entry.  This is the same in memory and on disk.  Because
+ * the offset is stored in network byte order entries are sorted by
+ * comparing all 16 bytes.  */
+struct index_entry_s
+{
+  unsigned char key[8];  /* Prefix of the fingerprint, keyid, ...  */
+  unsigned char off[8];  /* Offset of the blob.  */
+};
+
+
+/* A table of index entries.  The first NSORTED entries are sorted;
+ * entries added after an insert operation are appended unsorted and
+ * merged from time to time.  If SIZE is 0 the items are part of the
+ * loaded sidecar image and must not be modified.  */
+struct index_table_s
+{
+  struct index_entry_s *items;
+  size_t nitems;
+  size_t nsorted;
+  size_t size;
+};
+
+
+/* A record of the table of folded user ids.  */
+struct name_rec_s
+{
+  size_t pos;   /* Start of the user ids of the blob in TEXT.  */
+  off_t off;    /* Offset of the blob.  */
+};
+
+
+/* The table of folded user ids.  TEXT holds for each blob its user
+ * ids mapped to lowercase, each terminated by a Nul.  RECS maps the
+ * start of the user ids of a blob to the offset of that blob; it is
+ * sorted by both values.  */
+struct name_table_s
+{
+  char *text;
+  size_t textlen;
+  size_t textsize;
+  struct name_rec_s *recs;
+  size_t nrecs;
+  size_t recssize;
+};
+
+
+struct keybox_index_s
+{
+  /* Identity of the file.  */
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  time_t mtime;
+  unsigned long mtime_nsec;
+
+  /* The tables for fingerprints (and UBIDs), key ids, mail addresses,
+   * keygrips and X.509 issuer and subject DNs.  */
+  struct index_table_s fprs;
+  struct index_table_s kids;
+  struct index_table_s mails;
+  struct index_table_s grips;
+  struct index_table_s dns;
+
+  /* The folded user ids.  */
+  struct name_table_s names;
+
+  unsigned int have_grips:1;  /* The GRIPS table has been filled.  */
+  unsigned int have_names:1;  /* The NAMES table has been filled.  */
+  unsigned int no_grips:1;    /* Grips are not available for all blobs. */
+  unsigned int dirty:1;       /* The sidecar file needs an update.  */
+  unsigned int image_mapped:1;/* IMAGE is memory mapped.  */
+
+  /* The generation counter of the sidecar file.  */
+  u32 generation;
+
+  /* The loaded sidecar file or NULL.  */
+  unsigned char *image;
+  size_t imagelen;
+};
+
+
+
+static void
+release_table (struct index_table_s *tbl)
+{
+  if (tbl->size)
+    xfree (tbl->items);
+  tbl->items = NULL;
+  tbl->nitems = tbl->nsorted = tbl->size = 0;
+}
+
+
+static void
+release_names (struct name_table_s *tbl)
+{
+  xfree (tbl->text);
+  xfree (tbl->recs);
+  memset (tbl, 0, sizeof *tbl);
+}
+
+
+void
+_keybox_index_release (keybox_index_t index)
+{
+  if (!index)
+    return;
+  release_table (&index->fprs);
+  release_table (&index->kids);
+  release_table (&index->mails);
+  release_table (&index->grips);
+  release_table (&index->dns);
+  release_names (&index->names);
+  if (index->image)
+    {
+#ifdef USE_INDEX_MMAP
+      if (index->image_mapped)
+        munmap (index->image, index->imagelen);
+      else
+#endif
+        xfree (index->image);
+    }
+  xfree (index);
+}
+
+
+static int
+compare_entries (const void *a, const void *b)
+{
+  return memcmp (a, b, sizeof (struct index_entry_s));
+}
+
+
+static void
+sort_table (struct index_table_s *tbl)
+{
+  if (tbl->nsorted != tbl->nitems)
+    {
+      qsort (tbl->items, tbl->nitems, sizeof *tbl->items, compare_entries);
+      tbl->nsorted = tbl->nitems;
+    }
+}
+
+
+static void
+entry_set_off (struct index_entry_s *e, off_t off)
+{
+  uint64_t val = off;
+  int i;
+
+  for (i=7; i >= 0; i--, val >>= 8)
+    e->off[i] = val;
+}
+
+
+static off_t
+entry_get_off (const struct index_entry_s *e)
+{
+  uint64_t val = 0;
+  int i;
+
+  for (i=0; i < 8; i++)
+    val = (val << 8) | e->off[i];
+  return val;
+}
+
+
+static gpg_error_t
+add_entry (struct index_table_s *tbl, const unsigned char *key, off_t off)
+{
+  if (tbl->nitems == tbl->size)
+    {
+      struct index_entry_s *tmp;
+      size_t newsize = tbl->size? tbl->size * 2 : tbl->nitems + 1024;
+
+      if (!tbl->size)
+        {
+          /* The items are still those of the sidecar image.  */
+          tmp = xtrymalloc (newsize * sizeof *tmp);
+          if (tmp && tbl->nitems)
+            memcpy (tmp, tbl->items, tbl->nitems * sizeof *tmp);
+        }
+      else
+        tmp = xtryrealloc (tbl->items, newsize * sizeof *tmp);
+      if (!tmp)
+        return gpg_error_from_syserror ();
+      tbl->items = tmp;
+      tbl->size = newsize;
+    }
+  memcpy (tbl->items[tbl->nitems].key, key, 8);
+  entry_set_off (tbl->items + tbl->nitems, off);
+  tbl->nitems++;
+  return 0;
+}
+
+
+/* Compute the index key for the mail address MBOX,MBOXLEN and store
+ * it at KEY.  */
+static void
+mail_key (unsigned char *key, const void *mbox, size_t mboxlen)
+{
+  const unsigned char *s = mbox;
+  gcry_md_hd_t md;
+  size_t n;
+
+  if (gcry_md_open (&md, GCRY_MD_SHA1, 0))
+    {
+      memset (key, 0, 8);
+      return;
+    }
+  for (n=0; n < mboxlen; n++)
+    gcry_md_putc (md, ascii_tolower (s[n]));
+  memcpy (key, gcry_md_read (md, GCRY_MD_SHA1), 8);
+  gcry_md_close (md);
+}
+
+
+/* Compute the index key for the DN NAME,NAMELEN and store it at KEY.
+ * TAG is 'I' for an issuer and 'S' for a subject.  The DN is used
+ * as is because has_issuer and has_subject compare it exactly.  */
+static void
+dn_key (unsigned char *key, int tag, const void *name, size_t namelen)
+{
+  gcry_md_hd_t md;
+
+  if (gcry_md_open (&md, GCRY_MD_SHA1, 0))
+    {
+      memset (key, 0, 8);
+      return;
+    }
+  gcry_md_putc (md, tag);
+  gcry_md_write (md, name, namelen);
+  memcpy (key, gcry_md_read (md, GCRY_MD_SHA1), 8);
+  gcry_md_close (md);
+}
+
+
+/* Add the issuer and subject DN of the X.509 blob image BUFFER,LENGTH
+ * located at BLOBOFF to INDEX.  */
+static gpg_error_t
+add_blob_dns (keybox_index_t index,
+              const unsigned char *buffer, size_t length, off_t bloboff)
+{
+  gpg_error_t err;
+  size_t pos, off, len;
+  size_t nkeys, keyinfolen;
+  size_t nuids, uidinfolen;
+  size_t nserial;
+  int idx;
+  unsigned char key[8];
+
+  /* The same checks as in blob_cmp_name.  */
+  nkeys = get16 (buffer + 16);
+  keyinfolen = get16 (buffer + 18 );
+  if (keyinfolen < 28)
+    return 0; /* invalid blob */
+  pos = 20 + keyinfolen*nkeys;
+  if ((uint64_t)pos+2 > (uint64_t)length)
+    return 0; /* out of bounds */
+  nserial = get16 (buffer+pos);
+  pos += 2 + nserial;
+  if (pos+4 > length)
+    return 0; /* out of bounds */
+  nuids = get16 (buffer + pos);  pos += 2;
+  uidinfolen = get16 (buffer + pos);  pos += 2;
+  if (uidinfolen < 12)
+    return 0; /* invalid blob */
+  if (pos + uidinfolen*nuids > length)
+    return 0; /* out of bounds */
+
+  /* Index 0 is the issuer and index 1 the subject.  */
+  for (idx=0; idx < 2 && idx < nuids; idx++)
+    {
+      off = get32 (buffer + pos + idx*uidinfolen);
+      len = get32 (buffer + pos + idx*uidinfolen + 4);
+      if ((uint64_t)off+(uint64_t)len > (uint64_t)length)
+        return 0; /* out of bounds */
+      dn_key (key, idx? 'S' : 'I', buffer + off, len);
+      err = add_entry (&index->dns, key, bloboff);
+      if (err)
+        return err;
+    }
+  return 0;
+}
+
+
+/* Add the fingerprints, key ids and mail addresses of the blob image
+ * BUFFER,LENGTH located at BLOBOFF to INDEX.  */
+static gpg_error_t
+add_blob_keys (keybox_index_t index,
+               const unsigned char *buffer, size_t length, off_t bloboff)
+{
+  gpg_error_t err;
+  size_t pos, off, len;
+  size_t nkeys, keyinfolen;
+  int idx, fpr32, x509, rc;
+  unsigned char key[8];
+
+  if (length < 40)
+    return 0; /* blob too short */
+  fpr32 = buffer[5] == 2;
+  x509 = buffer[4] == KEYBOX_BLOBTYPE_X509;
+
+  nkeys = get16 (buffer + 16);
+  keyinfolen = get16 (buffer + 18 );
+  if (keyinfolen < (fpr32?56:28))
+    return 0; /* invalid blob */
+  pos = 20;
+  if (pos + (uint64_t)keyinfolen*nkeys > (uint64_t)length)
+    return 0; /* out of bounds */
+
+  /* This needs to match what blob_cmp_fpr and blob_cmp_fpr_part in
+   * keybox-search.c compare.  */
+  for (idx=0; idx < nkeys; idx++)
+    {
+      off = pos + idx*keyinfolen;
+      err = add_entry (&index->fprs, buffer + off, bloboff);
+      if (!err)
+        err = add_entry (&index->kids, buffer + off + (fpr32? 0 : 12),
+                         bloboff);
+      if (err)
+        return err;
+    }
+
+  /* Same as in blob_cmp_mail.  */
+  for (idx=x509; ; idx++)
+    {
+      rc = _keybox_get_blob_mailbox (buffer, length, x509, idx, &off, &len);
+      if (rc == -1)
+        break;
+      if (!rc)
+        continue;
+      mail_key (key, buffer + off, len);
+      err = add_entry (&index->mails, key, bloboff);
+      if (err)
+        return err;
+    }
+
+  if (x509)
+    return add_blob_dns (index, buffer, length, bloboff);
+
+  return 0;
+}
+
+
+/* Add the keygrips of the blob image BUFFER,LENGTH located at
+ * BLOBOFF to INDEX.  */
+static gpg_error_t
+add_blob_grips (keybox_index_t index,
+                const unsigned char *buffer, size_t length, off_t bloboff)
+{
+  gpg_error_t err;
+  size_t cert_off, cert_len;
+  struct _keybox_openpgp_info info;
+  struct _keybox_openpgp_key_info *k;
+
+  if (length < 40)
+    return 0; /* Too short. */
+  if (buffer[4] != KEYBOX_BLOBTYPE_PGP)
+    {
+      /* For X.509 we would need to parse the certificate.  We don't
+       * do this and thus can't use the grip index at all.  */
+      index->no_grips = 1;
+      return 0;
+    }
+
+  cert_off = get32 (buffer+8);
+  cert_len = get32 (buffer+12);
+  if ((uint64_t)cert_off+(uint64_t)cert_len > (uint64_t)length)
+    return 0; /* Too short.  */
+
+  if (_keybox_parse_openpgp (buffer + cert_off, cert_len, NULL, &info))
+    return 0; /* Parse error - blob_openpgp_has_grip won't match.  */
+
+  err = add_entry (&index->grips, info.primary.grip, bloboff);
+  if (!err && info.nsubkeys)
+    for (k = &info.subkeys; k && !err; k = k->next)
+      err = add_entry (&index->grips, k->grip, bloboff);
+
+  _keybox_destroy_openpgp_info (&info);
+  return err;
+}
+
+
+/* Add the user ids of the blob image BUFFER,LENGTH located at BLOBOFF
+ * to the folded user ids of INDEX.  */
+static gpg_error_t
+add_blob_names (keybox_index_t index,
+                const unsigned char *buffer, size_t length, off_t bloboff)
+{
+  struct name_table_s *tbl = &index->names;
+  size_t pos, off, len, n;
+  size_t nkeys, keyinfolen;
+  size_t nuids, uidinfolen;
+  size_t nserial, needed;
+  int idx;
+  char *p;
+
+  /* The same checks as in blob_cmp_name.  */
+  if (length < 40)
+    return 0; /* blob too short */
+  nkeys = get16 (buffer + 16);
+  keyinfolen = get16 (buffer + 18 );
+  if (keyinfolen < 28)
+    return 0; /* invalid blob */
+  pos = 20 + keyinfolen*nkeys;
+  if ((uint64_t)pos+2 > (uint64_t)length)
+    return 0; /* out of bounds */
+  nserial = get16 (buffer+pos);
+  pos += 2 + nserial;
+  if (pos+4 > length)
+    return 0; /* out of bounds */
+  nuids = get16 (buffer + pos);  pos += 2;
+  uidinfolen = get16 (buffer + pos);  pos += 2;
+  if (uidinfolen < 12)
+    return 0; /* invalid blob */
+  if (pos + uidinfolen*nuids > length)
+    return 0; /* out of bounds */
+
+  /* Compute the required space so that the buffer needs to be
+   * checked only once.  For X.509 the issuer at index 0 is skipped
+   * the same way has_username does.  */
+  needed = 0;
+  for (idx = (buffer[4] == KEYBOX_BLOBTYPE_X509); idx < nuids; idx++)
+    {
+      off = get32 (buffer + pos + idx*uidinfolen);
+      len = get32 (buffer + pos + idx*uidinfolen + 4);
+      if ((uint64_t)off+(uint64_t)len > (uint64_t)length)
+        return 0; /* out of bounds */
+      needed += len + 1;
+    }
+  if (!needed)
+    return 0;
+
+  if (tbl->textlen + needed > tbl->textsize)
+    {
+      size_t newsize = tbl->textsize? tbl->textsize * 2 : 64*1024;
+
+      while (newsize < tbl->textlen + needed)
+        newsize *= 2;
+      p = xtryrealloc (tbl->text, newsize);
+      if (!p)
+        return gpg_error_from_syserror ();
+      tbl->text = p;
+      tbl->textsize = newsize;
+    }
+  if (tbl->nrecs == tbl->recssize)
+    {
+      struct name_rec_s *tmp;
+      size_t newsize = tbl->recssize? tbl->recssize * 2 : 1024;
+
+      tmp = xtryrealloc (tbl->recs, newsize * sizeof *tmp);
+      if (!tmp)
+        return gpg_error_from_syserror ();
+      tbl->recs = tmp;
+      tbl->recssize = newsize;
+    }
+
+  tbl->recs[tbl->nrecs].pos = tbl->textlen;
+  tbl->recs[tbl->nrecs].off = bloboff;
+  tbl->nrecs++;
+  p = tbl->text + tbl->textlen;
+  for (idx = (buffer[4] == KEYBOX_BLOBTYPE_X509); idx < nuids; idx++)
+    {
+      off = get32 (buffer + pos + idx*uidinfolen);
+      len = get32 (buffer + pos + idx*uidinfolen + 4);
+      for (n=0; n < len; n++)
+        *p++ = ascii_tolower (buffer[off+n]);
+      *p++ = 0;
+    }
+  tbl->textlen += needed;
+  return 0;
+}
+
+
+/* Return the nanoseconds of the modification time in ST or 0 if the
+ * system does not provide them.  */
+static unsigned long
+get_mtime_nsec (struct stat *st)
+{
+#ifdef HAVE_STRUCT_STAT_ST_MTIM_TV_NSEC
+  return st->st_mtim.tv_nsec;
+#else
+  (void)st;
+  return 0;
+#endif
+}
+
+
+static void
+set_identity (keybox_index_t index, struct stat *st)
+{
+  index->dev = st->st_dev;
+  index->ino = st->st_ino;
+  index->size = st->st_size;
+  index->mtime = st->st_mtime;
+  index->mtime_nsec = get_mtime_nsec (st);
+}
+
+
+static int
+same_identity (keybox_index_t index, struct stat *st)
+{
+  return (index->dev == st->st_dev
+          && index->ino == st->st_ino
+          && index->size == st->st_size
+          && index->mtime == st->st_mtime
+          && index->mtime_nsec == get_mtime_nsec (st));
+}
+
+
+/* Flags for scan_blobs.  */
+#define SCAN_KEYS   1
+#define SCAN_GRIPS  2
+#define SCAN_NAMES  4
+
+
+/* Read all blobs of the keybox file of KB and add the items selected
+ * by WHAT to INDEX.  With SCAN_KEYS the index is assumed to be new
+ * and its identity is set; otherwise the file must still be the one
+ * the index has been built from.  The tables are not sorted.  */
+static gpg_error_t
+scan_blobs (KB_NAME kb, keybox_index_t index, unsigned int what)
+{
+  gpg_error_t err;
+  KEYBOXBLOB blob = NULL;
+  const unsigned char *buffer;
+  size_t length;
+  off_t bloboff;
+  FILE *fp;
+  struct stat st;
+  int blobtype;
+
+  fp = fopen (kb->fname, "rb");
+  if (!fp)
+    return gpg_error_from_syserror ();
+  _keybox_set_read_buffer (fp);
+  if (fstat (fileno (fp), &st))
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if ((what & SCAN_KEYS))
+    set_identity (index, &st);
+  else if (!same_identity (index, &st))
+    {
+      err = gpg_error (GPG_ERR_CONFLICT);
+      goto leave;
+    }
+
+  for (;;)
+    {
+      err = _keybox_read_blob_reuse (&blob, fp, NULL);
+      if (gpg_err_code (err) == GPG_ERR_TOO_LARGE
+          && gpg_err_source (err) == GPG_ERR_SOURCE_KEYBOX)
+        continue; /* Skipped by the search anyway.  */
+      if (err == -1)
+        {
+          err = 0;
+          break;
+        }
+      if (err)
+        goto leave;
+
+      blobtype = blob_get_type (blob);
+      if (blobtype != KEYBOX_BLOBTYPE_PGP && blobtype != KEYBOX_BLOBTYPE_X509)
+        continue;
+
+      buffer = _keybox_get_blob_image (blob, &length);
+      bloboff = _keybox_get_blob_fileoffset (blob);
+      err = 0;
+      if ((what & SCAN_KEYS))
+        err = add_blob_keys (index, buffer, length, bloboff);
+      if (!err && (what & SCAN_GRIPS))
+        err = add_blob_grips (index, buffer, length, bloboff);
+      if (!err && (what & SCAN_NAMES))
+        err = add_blob_names (index, buffer, length, bloboff);
+      if (err)
+        goto leave;
+    }
+
+ leave:
+  _keybox_release_blob (blob);
+  fclose (fp);
+  return err;
+}
+
+
+/* Build a new index for the keybox file of KB and store it at
+ * R_INDEX.  If WITH_GRIPS is set the keygrip table is also created
+ * and if WITH_NAMES is set the table of folded user ids.  */
+static gpg_error_t
+build_index (KB_NAME kb, int with_grips, int with_names,
+             keybox_index_t *r_index)
+{
+  gpg_error_t err;
+  keybox_index_t index;
+
+  *r_index = NULL;
+
+  index = xtrycalloc (1, sizeof *index);
+  if (!index)
+    return gpg_error_from_syserror ();
+
+  err = scan_blobs (kb, index, (SCAN_KEYS
+                                | (with_grips? SCAN_GRIPS : 0)
+                                | (with_names? SCAN_NAMES : 0)));
+  if (err)
+    {
+      _keybox_index_release (index);
+      return err;
+    }
+
+  sort_table (&index->fprs);
+  sort_table (&index->kids);
+  sort_table (&index->mails);
+  sort_table (&index->dns);
+  if (with_grips)
+    {
+      sort_table (&index->grips);
+      index->have_grips = 1;
+    }
+  if (with_names)
+    index->have_names = 1;
+
+  index->dirty = 1;
+  *r_index = index;
+  return 0;
+}
+
+
+static char *
+sidecar_name (KB_NAME kb)
+{
+  return strconcat (kb->fname, SIDECAR_SUFFIX, NULL);
+}
+
+
+static uint64_t
+get64 (const unsigned char *p)
+{
+  return ((uint64_t)get32 (p) << 32) | get32 (p+4);
+}
+
+
+static void
+put64 (unsigned char *p, uint64_t val)
+{
+  ulongtobuf (p, (u32)(val >> 32));
+  ulongtobuf (p+4, (u32)val);
+}
+
+
+/* Try to load the sidecar file of KB which must match the identity
+ * ST of the keybox file.  On success the index is stored at R_INDEX;
+ * on any problem NULL is stored there.  */
+static void
+load_sidecar (KB_NAME kb, struct stat *st, keybox_index_t *r_index)
+{
+  keybox_index_t index = NULL;
+  char *fname;
+  FILE *fp = NULL;
+  struct stat idxst;
+  unsigned char *image = NULL;
+  size_t imagelen;
+  unsigned char hdr[SIDECAR_HDRLEN];
+  size_t nfprs, nkids, nmails, ngrips, ndns;
+  unsigned int flags;
+  struct index_entry_s *items;
+
+  *r_index = NULL;
+
+  fname = sidecar_name (kb);
+  if (!fname)
+    return;
+  fp = fopen (fname, "rb");
+  if (!fp)
+    goto leave;
+  if (fstat (fileno (fp), &idxst) || idxst.st_size < SIDECAR_HDRLEN)
+    goto leave;
+  imagelen = idxst.st_size;
+  if ((off_t)imagelen != idxst.st_size)
+    goto leave;  /* Too large for us.  */
+
+  /* Check the header before mapping the whole file.  */
+  if (fread (hdr, SIDECAR_HDRLEN, 1, fp) != 1)
+    goto leave;
+  if (memcmp (hdr, "KBXi", 4) || hdr[4] != SIDECAR_VERSION)
+    goto leave;
+  if (get64 (hdr+32) != (uint64_t)st->st_size
+      || get64 (hdr+40) != (uint64_t)st->st_mtime
+      || get64 (hdr+48) != (uint64_t)st->st_ino
+      || get32 (hdr+60) != get_mtime_nsec (st))
+    goto leave;  /* Stale.  */
+  nfprs  = get32 (hdr+12);
+  nkids  = get32 (hdr+16);
+  nmails = get32 (hdr+20);
+  ngrips = get32 (hdr+24);
+  flags  = get32 (hdr+28);
+  ndns   = get32 (hdr+56);
+  if ((uint64_t)SIDECAR_HDRLEN
+      + ((uint64_t)nfprs + nkids + nmails + ngrips + ndns) * sizeof *items
+      != (uint64_t)imagelen)
+    goto leave;  /* Corrupted.  */
+
+  index = xtrycalloc (1, sizeof *index);
+  if (!index)
+    goto leave;
+
+#ifdef USE_INDEX_MMAP
+  image = mmap (NULL, imagelen, PROT_READ, MAP_SHARED, fileno (fp), 0);
+  if (image == MAP_FAILED)
+    image = NULL;
+  else
+    index->image_mapped = 1;
+#endif
+  if (!image)
+    {
+      image = xtrymalloc (imagelen);
+      if (!image)
+        goto leave;
+      if (fseek (fp, 0, SEEK_SET) || fread (image, imagelen, 1, fp) != 1)
+        {
+          xfree (image);
+          goto leave;
+        }
+    }
+  index->image = image;
+  index->imagelen = imagelen;
+
+  set_identity (index, st);
+  index->generation = get32 (hdr+8);
+  index->have_grips = !!(flags & SIDECAR_FLAG_HAVE_GRIPS);
+  index->no_grips = !!(flags & SIDECAR_FLAG_NO_GRIPS);
+
+  items = (struct index_entry_s *)(image + SIDECAR_HDRLEN);
+  index->fprs.items = items;
+  index->fprs.nitems = index->fprs.nsorted = nfprs;
+  items += nfprs;
+  index->kids.items = items;
+  index->kids.nitems = index->kids.nsorted = nkids;
+  items += nkids;
+  index->mails.items = items;
+  index->mails.nitems = index->mails.nsorted = nmails;
+  items += nmails;
+  index->grips.items = items;
+  index->grips.nitems = index->grips.nsorted = ngrips;
+  items += ngrips;
+  index->dns.items = items;
+  index->dns.nitems = index->dns.nsorted = ndns;
+
+  *r_index = index;
+  index = NULL;
+
+ leave:
+  _keybox_index_release (index);
+  if (fp)
+    fclose (fp);
+  xfree (fname);
+}
+
+
+static gpg_error_t
+write_table (FILE *fp, struct index_table_s *tbl)
+{
+  if (tbl->nitems
+      && fwrite (tbl->items, sizeof *tbl->items, tbl->nitems, fp)
+         != tbl->nitems)
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Write the index of KB to its sidecar file.  */
+static gpg_error_t
+write_sidecar (KB_NAME kb)
+{
+  gpg_error_t err;
+  keybox_index_t index = kb->index;
+  char *fname, *tmpfname;
+  FILE *fp;
+  unsigned char hdr[SIDECAR_HDRLEN];
+  unsigned int flags;
+
+  fname = sidecar_name (kb);
+  if (!fname)
+    return gpg_error_from_syserror ();
+
+  /* Use a per-process temporary file so that concurrent processes
+   * which also built an index don't clash.  */
+  tmpfname = xtryasprintf ("%s.%lu", fname, (unsigned long)getpid ());
+  if (!tmpfname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  sort_table (&index->fprs);
+  sort_table (&index->kids);
+  sort_table (&index->mails);
+  sort_table (&index->grips);
+  sort_table (&index->dns);
+
+  if (!index->generation)
+    {
+      /* Continue with the generation of an existing file.  */
+      FILE *oldfp = fopen (fname, "rb");
+
+      if (oldfp)
+        {
+          if (fread (hdr, 12, 1, oldfp) == 1 && !memcmp (hdr, "KBXi", 4))
+            index->generation = get32 (hdr+8);
+          fclose (oldfp);
+        }
+    }
+  index->generation++;
+
+  flags = 0;
+  if (index->have_grips)
+    flags |= SIDECAR_FLAG_HAVE_GRIPS;
+  if (index->no_grips)
+    flags |= SIDECAR_FLAG_NO_GRIPS;
+
+  memset (hdr, 0, sizeof hdr);
+  memcpy (hdr, "KBXi", 4);
+  hdr[4] = SIDECAR_VERSION;
+  ulongtobuf (hdr+8,  index->generation);
+  ulongtobuf (hdr+12, index->fprs.nitems);
+  ulongtobuf (hdr+16, index->kids.nitems);
+  ulongtobuf (hdr+20, index->mails.nitems);
+  ulongtobuf (hdr+24, index->grips.nitems);
+  ulongtobuf (hdr+28, flags);
+  put64 (hdr+32, index->size);
+  put64 (hdr+40, index->mtime);
+  put64 (hdr+48, index->ino);
+  ulongtobuf (hdr+56, index->dns.nitems);
+  ulongtobuf (hdr+60, index->mtime_nsec);
+
+  fp = fopen (tmpfname, "wb");
+  if (!fp)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (fwrite (hdr, sizeof hdr, 1, fp) != 1)
+    err = gpg_error_from_syserror ();
+  else if (!(err = write_table (fp, &index->fprs))
+           && !(err = write_table (fp, &index->kids))
+           && !(err = write_table (fp, &index->mails))
+           && !(err = write_table (fp, &index->grips)))
+    err = write_table (fp, &index->dns);
+  if (fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  if (!err)
+    err = gnupg_rename_file (tmpfname, fname, NULL);
+  if (err)
+    gnupg_remove (tmpfname);
+
+ leave:
+  xfree (tmpfname);
+  xfree (fname);
+  return err;
+}
+
+
+/* The longest pattern looked up in the folded user ids.  */
+#define MAX_NAME_PATTERN 256
+
+/* Return the pattern of a name search for DESC and store its length
+ * at R_LEN.  The brackets are stripped the same way has_mail does it
+ * for OpenPGP; that gives a superset of the matches for X.509.  */
+static const char *
+name_pattern (KEYBOX_SEARCH_DESC *desc, size_t *r_len)
+{
+  const char *name = desc->u.name;
+  size_t namelen;
+
+  if (desc->mode == KEYDB_SEARCH_MODE_MAILSUB && *name == '<')
+    name++;
+  namelen = strlen (name);
+  if (desc->mode == KEYDB_SEARCH_MODE_MAILSUB
+      && namelen && name[namelen-1] == '>')
+    namelen--;
+  *r_len = namelen;
+  return name;
+}
+
+
+/* Return true if the search descriptions DESC can be served by the
+ * index.  Set R_NEED_GRIPS if the keygrip table is required and
+ * R_NEED_NAMES if the folded user ids are required.  */
+static int
+indexable_desc (KEYBOX_SEARCH_DESC *desc, size_t ndesc, int *r_need_grips,
+                int *r_need_names)
+{
+  size_t n, namelen;
+
+  *r_need_grips = 0;
+  *r_need_names = 0;
+  if (!ndesc)
+    return 0;
+  for (n=0; n < ndesc; n++)
+    {
+      switch (desc[n].mode)
+        {
+        case KEYDB_SEARCH_MODE_FPR:
+          if (desc[n].fprlen != 20 && desc[n].fprlen != 32)
+            return 0;
+          break;
+        case KEYDB_SEARCH_MODE_LONG_KID:
+        case KEYDB_SEARCH_MODE_UBID:
+          break;
+        case KEYDB_SEARCH_MODE_MAIL:
+          if (!desc[n].u.name)
+            return 0;
+          break;
+        case KEYDB_SEARCH_MODE_KEYGRIP:
+          *r_need_grips = 1;
+          break;
+        case KEYDB_SEARCH_MODE_ISSUER:
+        case KEYDB_SEARCH_MODE_ISSUER_SN:
+        case KEYDB_SEARCH_MODE_SUBJECT:
+          if (!desc[n].u.name)
+            return 0;
+          break;
+        case KEYDB_SEARCH_MODE_EXACT:
+        case KEYDB_SEARCH_MODE_SUBSTR:
+        case KEYDB_SEARCH_MODE_MAILSUB:
+          if (!desc[n].u.name)
+            return 0;
+          name_pattern (desc + n, &namelen);
+          if (!namelen || namelen > MAX_NAME_PATTERN)
+            return 0;
+          *r_need_names = 1;
+          break;
+        default:
+          return 0;
+        }
+    }
+  return 1;
+}
+
+
+/* Prepare the index of the resource of HD for a search with DESC and
+ * NDESC.  HD must have an open file.  Returns true if the index can
+ * be used for this search; the index is loaded or built if needed.  */
+int
+_keybox_index_prepare (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc,
+                       size_t ndesc)
+{
+  gpg_error_t err;
+  KB_NAME kb = hd->kb;
+  struct stat st;
+  int need_grips, need_names;
+
+  if (!hd->fp || !indexable_desc (desc, ndesc, &need_grips, &need_names))
+    return 0;
+  if (fstat (fileno (hd->fp), &st))
+    return 0;
+
+  if (kb->index && !same_identity (kb->index, &st))
+    _keybox_index_invalidate (kb);
+  if (!kb->index)
+    load_sidecar (kb, &st, &kb->index);
+  if (kb->index && need_grips && !kb->index->have_grips)
+    _keybox_index_invalidate (kb);
+  if (!kb->index)
+    {
+      err = build_index (kb, need_grips, need_names, &kb->index);
+      if (err)
+        {
+          log_debug ("%s: building index for '%s' failed: %s\n",
+                     __func__, kb->fname, gpg_strerror (err));
+          return 0;
+        }
+    }
+
+  /* The file might have been replaced after HD opened it.  */
+  if (!same_identity (kb->index, &st))
+    return 0;
+  if (need_grips && kb->index->no_grips)
+    return 0;
+
+  if (need_names && !kb->index->have_names)
+    {
+      err = scan_blobs (kb, kb->index, SCAN_NAMES);
+      if (err)
+        {
+          release_names (&kb->index->names);
+          log_debug ("%s: reading user ids of '%s' failed: %s\n",
+                     __func__, kb->fname, gpg_strerror (err));
+          return 0;
+        }
+      kb->index->have_names = 1;
+    }
+
+  return 1;
+}
+
+
+/* Return the smallest offset which is not less than POS of all
+ * entries in TBL matching KEY at R_OFF.  R_OFF is not changed if
+ * it is already less than the found offset.  */
+static void
+lookup_table (struct index_table_s *tbl, const unsigned char *key,
+              off_t pos, off_t *r_off)
+{
+  size_t lo, hi, mid, n;
+  struct index_entry_s *e, want;
+  off_t off;
+
+  memcpy (want.key, key, 8);
+  entry_set_off (&want, pos);
+
+  /* Binary search for the lower bound of (KEY,POS) in the sorted
+   * part.  */
+  lo = 0;
+  hi = tbl->nsorted;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (compare_entries (tbl->items + mid, &want) < 0)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  if (lo < tbl->nsorted)
+    {
+      e = tbl->items + lo;
+      off = entry_get_off (e);
+      if (!memcmp (e->key, key, 8) && (*r_off == -1 || off < *r_off))
+        *r_off = off;
+    }
+
+  /* Scan the unsorted tail.  */
+  for (n = tbl->nsorted; n < tbl->nitems; n++)
+    {
+      e = tbl->items + n;
+      if (memcmp (e->key, key, 8))
+        continue;
+      off = entry_get_off (e);
+      if (off >= pos && (*r_off == -1 || off < *r_off))
+        *r_off = off;
+    }
+}
+
+
+/* Return the first occurrence of PAT,PATLEN in TEXT,TEXTLEN or
+ * NULL.  */
+static const char *
+find_text (const char *text, size_t textlen, const char *pat, size_t patlen)
+{
+  const char *s, *end;
+
+  if (patlen > textlen)
+    return NULL;
+  end = text + textlen - patlen + 1;
+  for (s = text; s < end && (s = memchr (s, *pat, end - s)); s++)
+    if (!memcmp (s, pat, patlen))
+      return s;
+  return NULL;
+}
+
+
+/* Look up the name search DESC in the folded user ids of INDEX.  The
+ * smallest offset which is not less than POS of a blob with a user id
+ * containing the pattern is stored at R_OFF unless R_OFF is already
+ * less than that offset.  */
+static void
+lookup_names (struct name_table_s *tbl, KEYBOX_SEARCH_DESC *desc,
+              off_t pos, off_t *r_off)
+{
+  char pat[MAX_NAME_PATTERN];
+  const char *name, *s;
+  size_t namelen, lo, hi, mid, n;
+
+  name = name_pattern (desc, &namelen);
+  for (n=0; n < namelen; n++)
+    pat[n] = ascii_tolower (name[n]);
+
+  /* Find the first blob at or after POS.  */
+  lo = 0;
+  hi = tbl->nrecs;
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (tbl->recs[mid].off < pos)
+        lo = mid + 1;
+      else
+        hi = mid;
+    }
+  if (lo == tbl->nrecs)
+    return;
+
+  s = find_text (tbl->text + tbl->recs[lo].pos,
+                 tbl->textlen - tbl->recs[lo].pos, pat, namelen);
+  if (!s)
+    return;
+
+  /* Map the match back to the last blob starting before it.  */
+  n = s - tbl->text;
+  hi = tbl->nrecs;
+  while (hi - lo > 1)
+    {
+      mid = lo + (hi - lo) / 2;
+      if (tbl->recs[mid].pos <= n)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  if (*r_off == -1 || tbl->recs[lo].off < *r_off)
+    *r_off = tbl->recs[lo].off;
+}
+
+
+/* Find the offset of the next blob at or after POS in the resource
+ * of HD which may match one of the search descriptions DESC and store
+ * it at R_OFF.  Returns -1 if there is no such blob.  This may only
+ * be used after a successful _keybox_index_prepare.  */
+int
+_keybox_index_next (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
+                    off_t pos, off_t *r_off)
+{
+  keybox_index_t index = hd->kb->index;
+  unsigned char key[8];
+  const char *name;
+  size_t n, namelen;
+
+  *r_off = -1;
+  for (n=0; n < ndesc; n++)
+    {
+      switch (desc[n].mode)
+        {
+        case KEYDB_SEARCH_MODE_FPR:
+          lookup_table (&index->fprs, desc[n].u.fpr, pos, r_off);
+          break;
+        case KEYDB_SEARCH_MODE_UBID:
+          lookup_table (&index->fprs, desc[n].u.ubid, pos, r_off);
+          break;
+        case KEYDB_SEARCH_MODE_LONG_KID:
+          ulongtobuf (key, desc[n].u.kid[0]);
+          ulongtobuf (key + 4, desc[n].u.kid[1]);
+          lookup_table (&index->kids, key, pos, r_off);
+          break;
+        case KEYDB_SEARCH_MODE_MAIL:
+          /* Strip the brackets the same way has_mail does.  */
+          name = desc[n].u.name;
+          if (*name == '<')
+            name++;
+          namelen = strlen (name);
+          if (namelen && name[namelen-1] == '>')
+            namelen--;
+          mail_key (key, name, namelen);
+          lookup_table (&index->mails, key, pos, r_off);
+          break;
+        case KEYDB_SEARCH_MODE_KEYGRIP:
+          lookup_table (&index->grips, desc[n].u.grip, pos, r_off);
+          break;
+        case KEYDB_SEARCH_MODE_ISSUER:
+        case KEYDB_SEARCH_MODE_ISSUER_SN:
+          name = desc[n].u.name;
+          dn_key (key, 'I', name, strlen (name));
+          lookup_table (&index->dns, key, pos, r_off);
+          break;
+        case KEYDB_SEARCH_MODE_SUBJECT:
+          name = desc[n].u.name;
+          dn_key (key, 'S', name, strlen (name));
+          lookup_table (&index->dns, key, pos, r_off);
+          break;
+        case KEYDB_SEARCH_MODE_EXACT:
+        case KEYDB_SEARCH_MODE_SUBSTR:
+        case KEYDB_SEARCH_MODE_MAILSUB:
+          lookup_names (&index->names, desc + n, pos, r_off);
+          break;
+        default:
+          never_reached ();
+          break;
+        }
+    }
+
+  return *r_off == -1? -1 : 0;
+}
+
+
+/* Build the index of the keybox file registered as TOKEN and write
+ * it to the sidecar file.  This is used to prepare the index of a
+ * file which is only read by its users, for example a trustedkeys.kbx
+ * for gpgv; a lookup then needs only to map the sidecar file instead
+ * of scanning the keybox.  */
+gpg_error_t
+keybox_write_index (void *token)
+{
+  gpg_error_t err;
+  KB_NAME kb = token;
+  keybox_index_t index;
+
+  if (!kb)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  err = build_index (kb, 1, 0, &index);
+  if (err)
+    return err;
+  _keybox_index_release (kb->index);
+  kb->index = index;
+  index->dirty = 0;
+  return write_sidecar (kb);
+}
+
+
+/* Drop the index of the resource KB.  */
+void
+_keybox_index_invalidate (KB_NAME kb)
+{
+  _keybox_index_release (kb->index);
+  kb->index = NULL;
+}
+
+
+/* Write the index of the resource KB to its sidecar file if it has
+ * changed.  This is called when the last handle of KB is
+ * released.  */
+void
+_keybox_index_flush (KB_NAME kb)
+{
+  gpg_error_t err;
+
+  if (!kb->index || !kb->index->dirty)
+    return;
+  kb->index->dirty = 0;  /* Don't retry in case of an error.  */
+  if (!keybox_is_writable (kb))
+    return;
+  err = write_sidecar (kb);
+  if (err)
+    log_debug ("%s: writing index for '%s' failed: %s\n",
+               __func__, kb->fname, gpg_strerror (err));
+}
+
+
+/* Return true if the index of the resource KB is valid for the
+ * current file.  This is to be called before an update operation.  */
+int
+_keybox_index_is_current (KB_NAME kb)
+{
+  struct stat st;
+
+  if (!kb->index)
+    return 0;
+  if (stat (kb->fname, &st))
+    return 0;
+  return same_identity (kb->index, &st);
+}
+
+
+/* Record that the file of the resource KB has been changed in place
+ * without moving any blob.  WAS_CURRENT is the result of
+ * _keybox_index_is_current before the change.  */
+void
+_keybox_index_note_change (KB_NAME kb, int was_current)
+{
+  struct stat st;
+
+  if (!kb->index)
+    return;
+  if (!was_current || stat (kb->fname, &st) || st.st_size != kb->index->size)
+    _keybox_index_invalidate (kb);
+  else
+    {
+      set_identity (kb->index, &st);
+      kb->index->dirty = 1;
+    }
+}
+
+
+/* Record that BLOB has been appended to the file of the resource KB.
+ * WAS_CURRENT is the result of _keybox_index_is_current before the
+ * insert operation.  */
+void
+_keybox_index_note_insert (KB_NAME kb, KEYBOXBLOB blob, int was_current)
+{
+  keybox_index_t index = kb->index;
+  struct stat st;
+  const unsigned char *image;
+  size_t imagelen;
+
+  if (!index)
+    return;
+
+  /* The new blob has been appended to the old file; thus its offset
+   * is the old file size.  */
+  image = _keybox_get_blob_image (blob, &imagelen);
+  if (!was_current || stat (kb->fname, &st)
+      || st.st_size != index->size + (off_t)imagelen
+      || add_blob_keys (index, image, imagelen, index->size)
+      || (index->have_grips
+          && add_blob_grips (index, image, imagelen, index->size))
+      || (index->have_names
+          && add_blob_names (index, image, imagelen, index->size)))
+    goto invalidate;
+  set_identity (index, &st);
+  index->dirty = 1;
+
+  /* Merge the unsorted tails from time to time so that lookups don't
+   * degrade to linear scans during bulk imports.  */
+  if (index->fprs.nitems - index->fprs.nsorted > 64 + index->fprs.nsorted/32)
+    {
+      sort_table (&index->fprs);
+      sort_table (&index->kids);
+      sort_table (&index->mails);
+      sort_table (&index->grips);
+      sort_table (&index->dns);
+    }
+  return;
+
+ invalidate:
+  _keybox_index_invalidate (kb);
+}
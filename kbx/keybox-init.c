@@ -63,6 +63,7 @@ keybox_register_file (const char *fname, int secret, void **r_token)
   kr->lockhd = NULL;
   kr->is_locked = 0;
   kr->did_full_scan = 0;
+  kr->index = NULL;
   /* keep a list of all issued pointers */
   kr->next = kb_names;
   kb_names = kr;
@@ -170,10 +171,15 @@ keybox_release (KEYBOX_HANDLE hd)
     return;
   if (hd->kb->handle_table)
     {
-      int idx;
+      int idx, any = 0;
       for (idx=0; idx < hd->kb->handle_table_size; idx++)
         if (hd->kb->handle_table[idx] == hd)
           hd->kb->handle_table[idx] = NULL;
+        else if (hd->kb->handle_table[idx])
+          any = 1;
+      /* Save the index when the last handle is released.  */
+      if (!any)
+        _keybox_index_flush (hd->kb);
     }
   _keybox_release_blob (hd->found.blob);
   _keybox_release_blob (hd->saved_found.blob);
@@ -235,6 +241,20 @@ keybox_set_ephemeral (KEYBOX_HANDLE hd, int yes)
 }
 
 
+/* Switch the update mode of HD.  If YES is set inserted and updated
+ * blobs are appended to the existing file and replaced blobs are
+ * only marked as deleted; the space is reclaimed by keybox_compress.
+ * Without this mode each update writes a new copy of the file.  */
+int
+keybox_set_append_mode (KEYBOX_HANDLE hd, int yes)
+{
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  hd->append_mode = yes;
+  return 0;
+}
+
+
 /* Close the file of the resource identified by HD.  For consistent
    results this function closes the files of all handles pointing to
    the resource identified by HD.  */
@@ -442,104 +442,128 @@ blob_cmp_name (KEYBOXBLOB blob, int idx,
 }
 
 
-/* Compare all email addresses of the subject.  With SUBSTR given as
-   True a substring search is done in the mail address.  The X509 flag
-   indicated whether the search is done on an X.509 blob.  */
-static int
-blob_cmp_mail (KEYBOXBLOB blob, const char *name, size_t namelen, int substr,
-               int x509)
+/* Locate the mail address of the user id with index IDX in the blob
+ * image BUFFER,LENGTH.  The X509 flag indicates whether this is an
+ * X.509 blob.  On success the offset and length of the address are
+ * stored at R_OFF and R_LEN and 1 is returned.  0 is returned if the
+ * user id has no mail address and -1 if IDX is out of range or the
+ * blob is invalid.  */
+int
+_keybox_get_blob_mailbox (const unsigned char *buffer, size_t length,
+                          int x509, size_t idx,
+                          size_t *r_off, size_t *r_len)
 {
-  const unsigned char *buffer;
-  size_t length;
   size_t pos, off, len;
   size_t nkeys, keyinfolen;
   size_t nuids, uidinfolen;
   size_t nserial;
-  int idx;
+  size_t mypos, mylen;
 
-  /* fixme: this code is common to blob_cmp_mail */
-  buffer = _keybox_get_blob_image (blob, &length);
   if (length < 40)
-    return 0; /* blob too short */
+    return -1; /* blob too short */
 
   /*keys*/
   nkeys = get16 (buffer + 16);
   keyinfolen = get16 (buffer + 18 );
   if (keyinfolen < 28)
-    return 0; /* invalid blob */
+    return -1; /* invalid blob */
   pos = 20 + keyinfolen*nkeys;
   if (pos+2 > length)
-    return 0; /* out of bounds */
+    return -1; /* out of bounds */
 
   /*serial*/
   nserial = get16 (buffer+pos);
   pos += 2 + nserial;
   if (pos+4 > length)
-    return 0; /* out of bounds */
+    return -1; /* out of bounds */
 
   /* user ids*/
   nuids = get16 (buffer + pos);  pos += 2;
   uidinfolen = get16 (buffer + pos);  pos += 2;
   if (uidinfolen < 12 /* should add a: || nuidinfolen > MAX_UIDINFOLEN */)
-    return 0; /* invalid blob */
+    return -1; /* invalid blob */
   if (pos + uidinfolen*nuids > length)
-    return 0; /* out of bounds */
+    return -1; /* out of bounds */
+  if (idx >= nuids)
+    return -1;
+
+  mypos = pos + idx*uidinfolen;
+  off = get32 (buffer+mypos);
+  len = get32 (buffer+mypos+4);
+  if ((uint64_t)off+(uint64_t)len > (uint64_t)length)
+    return -1; /* error: better stop here - out of bounds */
+  if (x509)
+    {
+      if (len < 2 || buffer[off] != '<')
+        return 0; /* empty name or trailing 0 not stored */
+      len--; /* one back */
+      if ( len < 3 || buffer[off+len] != '>')
+        return 0; /* not a proper email address */
+      off++;
+      len--;
+    }
+  else /* OpenPGP.  */
+    {
+      /* We need to forward to the mailbox part.  */
+      mypos = off;
+      mylen = len;
+      for ( ; len && buffer[off] != '<'; len--, off++)
+        ;
+      if (len < 2 || buffer[off] != '<')
+        {
+          /* Mailbox not explicitly given or too short.  Restore
+             OFF and LEN and check whether the entire string
+             resembles a mailbox without the angle brackets.  */
+          off = mypos;
+          len = mylen;
+          if (!is_valid_mailbox_mem (buffer+off, len))
+            return 0; /* Not a mail address. */
+        }
+      else /* Seems to be standard user id with mail address.  */
+        {
+          off++; /* Point to first char of the mail address.  */
+          len--;
+          /* Search closing '>'.  */
+          for (mypos=off; len && buffer[mypos] != '>'; len--, mypos++)
+            ;
+          if (!len || buffer[mypos] != '>' || off == mypos)
+            return 0; /* Not a proper mail address.  */
+          len = mypos - off;
+        }
+    }
+
+  *r_off = off;
+  *r_len = len;
+  return 1;
+}
+
+
+/* Compare all email addresses of the subject.  With SUBSTR given as
+   True a substring search is done in the mail address.  The X509 flag
+   indicated whether the search is done on an X.509 blob.  */
+static int
+blob_cmp_mail (KEYBOXBLOB blob, const char *name, size_t namelen, int substr,
+               int x509)
+{
+  const unsigned char *buffer;
+  size_t length;
+  size_t off, len;
+  int idx, rc;
+
+  buffer = _keybox_get_blob_image (blob, &length);
 
   if (namelen < 1)
     return 0;
 
   /* Note that for X.509 we start at index 1 because index 0 is used
      for the issuer name.  */
-  for (idx=!!x509 ;idx < nuids; idx++)
+  for (idx=!!x509 ;; idx++)
     {
-      size_t mypos = pos;
-      size_t mylen;
-
-      mypos += idx*uidinfolen;
-      off = get32 (buffer+mypos);
-      len = get32 (buffer+mypos+4);
-      if ((uint64_t)off+(uint64_t)len > (uint64_t)length)
-        return 0; /* error: better stop here - out of bounds */
-      if (x509)
-        {
-          if (len < 2 || buffer[off] != '<')
-            continue; /* empty name or trailing 0 not stored */
-          len--; /* one back */
-          if ( len < 3 || buffer[off+len] != '>')
-            continue; /* not a proper email address */
-          off++;
-          len--;
-        }
-      else /* OpenPGP.  */
-        {
-          /* We need to forward to the mailbox part.  */
-          mypos = off;
-          mylen = len;
-          for ( ; len && buffer[off] != '<'; len--, off++)
-            ;
-          if (len < 2 || buffer[off] != '<')
-            {
-              /* Mailbox not explicitly given or too short.  Restore
-                 OFF and LEN and check whether the entire string
-                 resembles a mailbox without the angle brackets.  */
-              off = mypos;
-              len = mylen;
-              if (!is_valid_mailbox_mem (buffer+off, len))
-                continue; /* Not a mail address. */
-            }
-          else /* Seems to be standard user id with mail address.  */
-            {
-              off++; /* Point to first char of the mail address.  */
-              len--;
-              /* Search closing '>'.  */
-              for (mypos=off; len && buffer[mypos] != '>'; len--, mypos++)
-                ;
-              if (!len || buffer[mypos] != '>' || off == mypos)
-                continue; /* Not a proper mail address.  */
-              len = mypos - off;
-            }
-
-        }
+      rc = _keybox_get_blob_mailbox (buffer, length, x509, idx, &off, &len);
+      if (rc == -1)
+        return 0; /* No more user ids or invalid blob.  */
+      if (!rc)
+        continue; /* No mail address.  */
 
       if (substr)
         {
@@ -552,7 +576,6 @@ blob_cmp_mail (KEYBOXBLOB blob, const char *name, size_t namelen, int substr,
             return idx+1; /* found */
         }
     }
-  return 0; /* not found */
 }
 
 
@@ -886,6 +909,7 @@ open_file (KEYBOX_HANDLE hd)
       hd->error = gpg_error_from_syserror ();
       return hd->error;
     }
+  _keybox_set_read_buffer (hd->fp);
 
   return 0;
 }
@@ -943,6 +967,7 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
   struct sn_array_s *sn_array = NULL;
   int pk_no, uid_no;
   off_t lastfoundoff;
+  int use_index;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -1089,20 +1114,52 @@ keybox_search (KEYBOX_HANDLE hd, KEYBOX_SEARCH_DESC *desc, size_t ndesc,
     }
 
 
+  /* Check whether we can use the index to skip over blobs which
+   * can't match.  */
+  use_index = _keybox_index_prepare (hd, desc, ndesc);
+
   pk_no = uid_no = 0;
   for (;;)
     {
       unsigned int blobflags;
       int blobtype;
 
-      _keybox_release_blob (blob); blob = NULL;
-      rc = _keybox_read_blob (&blob, hd->fp, NULL);
+      if (use_index)
+        {
+          off_t curoff, nextoff;
+
+          curoff = ftello (hd->fp);
+          if (curoff == (off_t)-1)
+            {
+              rc = gpg_error_from_syserror ();
+              break;
+            }
+          if (_keybox_index_next (hd, desc, ndesc, curoff, &nextoff))
+            {
+              rc = -1;  /* No more candidates.  */
+              break;
+            }
+          if (fseeko (hd->fp, nextoff, SEEK_SET))
+            {
+              rc = gpg_error_from_syserror ();
+              break;
+            }
+        }
+      /* Note that BLOB is reused until we found a match.  */
+      rc = _keybox_read_blob_reuse (&blob, hd->fp, NULL);
       if (gpg_err_code (rc) == GPG_ERR_TOO_LARGE
           && gpg_err_source (rc) == GPG_ERR_SOURCE_KEYBOX)
         {
           ++*r_skipped;
           continue; /* Skip too large records.  */
         }
+      if (gpg_err_code (rc) == GPG_ERR_TOO_SHORT && feof (hd->fp))
+        {
+          /* A short blob at the end of the file is one which is just
+             being appended by another process (see blob_append in
+             keybox-update.c).  */
+          rc = -1;
+        }
 
       if (rc)
         break;
@@ -1492,3 +1549,80 @@ keybox_seek (KEYBOX_HANDLE hd, off_t offset)
 
   return hd->error;
 }
+
+
+/* Call CB with OPAQUE for the key id of each OpenPGP key and subkey
+ * in the keybox of HD.  This reads through the entire file without
+ * parsing the keyblocks and does not change the search state of HD.
+ * If CB returns an error the enumeration stops and that error is
+ * returned.  */
+gpg_error_t
+keybox_enum_keyids (KEYBOX_HANDLE hd,
+                    gpg_error_t (*cb)(void *opaque, u32 *kid), void *opaque)
+{
+  gpg_error_t err;
+  KEYBOXBLOB blob = NULL;
+  const unsigned char *buffer, *p;
+  size_t length, nkeys, keyinfolen, idx;
+  int fpr32;
+  u32 kid[2];
+  FILE *fp;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_VALUE);
+
+  fp = fopen (hd->kb->fname, "rb");
+  if (!fp)
+    return gpg_error_from_syserror ();
+  _keybox_set_read_buffer (fp);
+
+  for (;;)
+    {
+      err = _keybox_read_blob_reuse (&blob, fp, NULL);
+      if (gpg_err_code (err) == GPG_ERR_TOO_LARGE
+          && gpg_err_source (err) == GPG_ERR_SOURCE_KEYBOX)
+        continue; /* Skipped by the search anyway.  */
+      if (err == -1)
+        {
+          err = 0;
+          break;
+        }
+      if (err)
+        break;
+      if (blob_get_type (blob) != KEYBOX_BLOBTYPE_PGP)
+        continue;
+
+      /* This needs to match blob_get_first_keyid.  */
+      buffer = _keybox_get_blob_image (blob, &length);
+      if (length < 48)
+        continue; /* blob too short */
+      fpr32 = buffer[5] == 2;
+      nkeys = get16 (buffer + 16);
+      keyinfolen = get16 (buffer + 18);
+      if (keyinfolen < (fpr32?56:28) || nkeys > (length - 20) / keyinfolen)
+        continue; /* invalid blob */
+
+      for (idx=0; idx < nkeys && !err; idx++)
+        {
+          p = buffer + 20 + idx * keyinfolen;
+          if (fpr32 && (get16 (p + 32) & 0x80))
+            {
+              /* 32 byte fingerprint.  */
+              kid[0] = get32 (p);
+              kid[1] = get32 (p + 4);
+            }
+          else /* 20 byte fingerprint.  */
+            {
+              kid[0] = get32 (p + 12);
+              kid[1] = get32 (p + 16);
+            }
+          err = cb (opaque, kid);
+        }
+      if (err)
+        break;
+    }
+
+  _keybox_release_blob (blob);
+  fclose (fp);
+  return err;
+}
@@ -25,6 +25,7 @@
 #include <time.h>
 #include <unistd.h>
 #include <assert.h>
+#include <sys/stat.h>
 
 #include "keybox-defs.h"
 #include "../common/sysutils.h"
@@ -37,6 +38,44 @@
 #define FILECOPY_DELETE 2
 #define FILECOPY_UPDATE 3
 
+/* While keybox_compress_incremental runs, changes done in place are
+ * logged to a file with this suffix.  Each record consists of the
+ * file offset as a 64 bit value, a length byte and the new data of
+ * at most 8 bytes.  */
+#define COMPRESS_LOG_SUFFIX ".clog"
+#define COMPRESS_LOG_MAXDATA 8
+
+/* keybox_compress_incremental starts another segment without the
+ * lock if at least this many bytes have been appended meanwhile.  It
+ * does not do more than COMPRESS_MAX_SEGMENTS such segments.  */
+#define COMPRESS_SEGMENT_MIN  (256*1024)
+#define COMPRESS_MAX_SEGMENTS 8
+
+
+/* The state of a compress run.  */
+struct compress_state
+{
+  u32 cut_time;     /* Ephemeral blobs created before are removed.  */
+  int first_blob;   /* The next blob is the first one.  */
+  int any_changes;  /* The new file differs from the old one.  */
+};
+
+/* The offsets of the blobs copied by keybox_compress_incremental in
+ * the order of the file.  */
+struct compress_map_item
+{
+  off_t oldoff;
+  off_t newoff;
+  size_t length;
+};
+
+struct compress_map
+{
+  struct compress_map_item *items;
+  size_t used;
+  size_t size;
+};
+
 
 #if !defined(HAVE_FSEEKO) && !defined(fseeko)
 
@@ -93,6 +132,65 @@ create_tmp_file (const char *template,
 }
 
 
+/* Remove the log of an incremental compress run for FNAME.  This is
+   done whenever FNAME is replaced; a compress run which still works
+   on the old file notices this and gives up.  */
+static void
+remove_compress_log (const char *fname)
+{
+  char *logfname;
+
+  logfname = strconcat (fname, COMPRESS_LOG_SUFFIX, NULL);
+  if (logfname && !access (logfname, F_OK))
+    gnupg_remove (logfname);
+  xfree (logfname);
+}
+
+
+/* If an incremental compress run is active for FNAME, log that the
+   LENGTH bytes at OFF have been changed to DATA.  This must be called
+   with the lock held.  If the log can't be written it is removed,
+   which makes the compress run give up.  */
+static gpg_error_t
+note_compress_change (const char *fname, off_t off,
+                      const void *data, size_t length)
+{
+  gpg_error_t err = 0;
+  char *logfname;
+  FILE *fp;
+  unsigned char rec[8 + 1 + COMPRESS_LOG_MAXDATA];
+  unsigned long long val = off;
+  int i;
+
+  logfname = strconcat (fname, COMPRESS_LOG_SUFFIX, NULL);
+  if (!logfname)
+    return gpg_error_from_syserror ();
+  fp = fopen (logfname, "r+b");
+  if (!fp)
+    {
+      if (errno != ENOENT)
+        err = gpg_error_from_syserror ();
+      goto leave;  /* No compress run.  */
+    }
+
+  log_assert (length <= COMPRESS_LOG_MAXDATA);
+  for (i=0; i < 8; i++)
+    rec[i] = val >> (56 - 8*i);
+  rec[8] = length;
+  memcpy (rec + 9, data, length);
+  if (fseeko (fp, 0, SEEK_END) || fwrite (rec, 9 + length, 1, fp) != 1)
+    err = gpg_error_from_syserror ();
+  if (fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+
+ leave:
+  if (err)
+    gnupg_remove (logfname);
+  xfree (logfname);
+  return err;
+}
+
+
 static int
 rename_tmp_file (const char *bakfname, const char *tmpfname,
                  const char *fname, int secret )
@@ -129,6 +227,8 @@ rename_tmp_file (const char *bakfname, const char *tmpfname,
 
   /* Then rename the file. */
   rc = gnupg_rename_file (tmpfname, fname, NULL);
+  if (!rc)
+    remove_compress_log (fname);
   if (block)
     {
       gnupg_unblock_all_signals ();
@@ -353,6 +453,95 @@ blob_filecopy (int mode, const char *fname, KEYBOXBLOB blob,
 }
 
 
+/* Append BLOB to the keybox FNAME without copying the file.  If
+   DELETE_OFFSET is not -1 the blob at that offset is marked as
+   deleted after the new blob has been written; a crash in between
+   thus leaves a duplicate but never loses the keyblock.  If R_OFFSET
+   is not NULL the offset of the new blob is stored there.  The space
+   of deleted blobs is reclaimed by keybox_compress.  */
+static gpg_error_t
+blob_append (const char *fname, KEYBOXBLOB blob, int for_openpgp,
+             off_t delete_offset, off_t *r_offset)
+{
+  gpg_error_t err = 0;
+  FILE *fp;
+  unsigned char hdr[8];
+  off_t endoff;
+
+  if (access (fname, W_OK))
+    return gpg_error_from_syserror ();
+
+  fp = fopen (fname, "r+b");
+  if (!fp)
+    return gpg_error_from_syserror ();
+
+  /* Make sure that the openpgp flag is set in the header (cf.
+     blob_filecopy).  */
+  if (for_openpgp && fread (hdr, sizeof hdr, 1, fp) == 1
+      && hdr[4] == KEYBOX_BLOBTYPE_HEADER && !(hdr[7] & 0x02))
+    {
+      hdr[7] |= 0x02;
+      if (fseeko (fp, 7, SEEK_SET) || putc (hdr[7], fp) == EOF)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      err = note_compress_change (fname, 7, hdr + 7, 1);
+      if (err)
+        goto leave;
+    }
+
+  if (fseeko (fp, 0, SEEK_END) || (endoff = ftello (fp)) == (off_t)-1)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  err = _keybox_write_blob (blob, fp);
+  if (!err && fflush (fp))
+    err = gpg_error_from_syserror ();
+  if (err)
+    {
+#ifdef HAVE_FTRUNCATE
+      /* Do not leave a partial blob at the end of the file.  */
+      if (ftruncate (fileno (fp), endoff))
+        log_error ("error truncating '%s': %s\n",
+                   fname, gpg_strerror (gpg_error_from_syserror ()));
+#endif
+      goto leave;
+    }
+
+  if (delete_offset != (off_t)-1)
+    {
+#ifdef HAVE_FSYNC
+      /* The new blob must be on disk before the old one is marked as
+         deleted; otherwise a crash could lose both.  */
+      if (fsync (fileno (fp)))
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+#endif /*HAVE_FSYNC*/
+      if (fseeko (fp, delete_offset + 4, SEEK_SET) || putc (0, fp) == EOF)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      err = note_compress_change (fname, delete_offset + 4, "", 1);
+      if (err)
+        goto leave;
+    }
+
+  if (r_offset)
+    *r_offset = endoff;
+
+ leave:
+  if (fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  return err;
+}
+
+
 /* Insert the OpenPGP keyblock {IMAGE,IMAGELEN} into HD. */
 gpg_error_t
 keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
@@ -362,6 +551,7 @@ keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   KEYBOXBLOB blob;
   size_t nparsed;
   struct _keybox_openpgp_info info;
+  int index_current;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_HANDLE);
@@ -386,12 +576,16 @@ keybox_insert_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   _keybox_destroy_openpgp_info (&info);
   if (!err)
     {
-      err = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 1, 0);
+      index_current = _keybox_index_is_current (hd->kb);
+      if (hd->append_mode)
+        err = blob_append (fname, blob, 1, (off_t)-1, NULL);
+      else
+        err = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 1, 0);
+      if (!err)
+        _keybox_index_note_insert (hd->kb, blob, index_current);
+      else
+        _keybox_index_invalidate (hd->kb);
       _keybox_release_blob (blob);
-      /*    if (!rc && !hd->secret && kb_offtbl) */
-      /*      { */
-      /*        update_offset_hash_table_from_kb (kb_offtbl, kb, 0); */
-      /*      } */
     }
   return err;
 }
@@ -404,10 +598,11 @@ keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
 {
   gpg_error_t err;
   const char *fname;
-  off_t off;
+  off_t off, newoff;
   KEYBOXBLOB blob;
   size_t nparsed;
   struct _keybox_openpgp_info info;
+  int index_current;
 
   if (!hd || !image || !imagelen)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -437,10 +632,31 @@ keybox_update_keyblock (KEYBOX_HANDLE hd, const void *image, size_t imagelen)
   _keybox_destroy_openpgp_info (&info);
 
   /* Update the keyblock.  */
-  if (!err)
+  if (!err && hd->append_mode)
+    {
+      index_current = _keybox_index_is_current (hd->kb);
+      err = blob_append (fname, blob, 1, off, &newoff);
+      if (!err)
+        {
+          _keybox_index_note_insert (hd->kb, blob, index_current);
+          /* The old blob is now marked as deleted; let the found
+           * state refer to the new one so that a following update or
+           * set_flags does not work on the deleted blob.  */
+          _keybox_set_blob_fileoffset (blob, newoff);
+          _keybox_release_blob (hd->found.blob);
+          hd->found.blob = blob;
+          blob = NULL;
+        }
+      else
+        _keybox_index_invalidate (hd->kb);
+      _keybox_release_blob (blob);
+    }
+  else if (!err)
     {
       err = blob_filecopy (FILECOPY_UPDATE, fname, blob, hd->secret, 1, off);
       _keybox_release_blob (blob);
+      /* The offsets of all following blobs may have changed.  */
+      _keybox_index_invalidate (hd->kb);
     }
   return err;
 }
@@ -455,6 +671,7 @@ keybox_insert_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
   int rc;
   const char *fname;
   KEYBOXBLOB blob;
+  int index_current;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_HANDLE);
@@ -472,12 +689,16 @@ keybox_insert_cert (KEYBOX_HANDLE hd, ksba_cert_t cert,
   rc = _keybox_create_x509_blob (&blob, cert, sha1_digest, hd->ephemeral);
   if (!rc)
     {
-      rc = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 0, 0);
+      index_current = _keybox_index_is_current (hd->kb);
+      if (hd->append_mode)
+        rc = blob_append (fname, blob, 0, (off_t)-1, NULL);
+      else
+        rc = blob_filecopy (FILECOPY_INSERT, fname, blob, hd->secret, 0, 0);
+      if (!rc)
+        _keybox_index_note_insert (hd->kb, blob, index_current);
+      else
+        _keybox_index_invalidate (hd->kb);
       _keybox_release_blob (blob);
-      /*    if (!rc && !hd->secret && kb_offtbl) */
-      /*      { */
-      /*        update_offset_hash_table_from_kb (kb_offtbl, kb, 0); */
-      /*      } */
     }
   return rc;
 }
@@ -508,6 +729,7 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
   size_t flag_pos, flag_size;
   const unsigned char *buffer;
   size_t length;
+  int index_current;
 
   (void)idx;  /* Not yet used.  */
 
@@ -535,6 +757,7 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
   off += flag_pos;
 
   _keybox_close_file (hd);
+  index_current = _keybox_index_is_current (hd->kb);
   fp = fopen (hd->kb->fname, "r+b");
   if (!fp)
     return gpg_error_from_syserror ();
@@ -558,6 +781,10 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
         case 4:
           if (fwrite (tmp+4-flag_size, flag_size, 1, fp) != 1)
             ec = gpg_err_code_from_syserror ();
+          else
+            ec = gpg_err_code (note_compress_change (fname, off,
+                                                     tmp+4-flag_size,
+                                                     flag_size));
           break;
         default:
           ec = GPG_ERR_BUG;
@@ -571,6 +798,9 @@ keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value)
         ec = gpg_err_code_from_syserror ();
     }
 
+  /* The flags are not part of the index.  */
+  _keybox_index_note_change (hd->kb, index_current);
+
   return gpg_error (ec);
 }
 
@@ -583,6 +813,7 @@ keybox_delete (KEYBOX_HANDLE hd)
   const char *fname;
   FILE *fp;
   int rc;
+  int index_current;
 
   if (!hd)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -600,6 +831,7 @@ keybox_delete (KEYBOX_HANDLE hd)
   off += 4;
 
   _keybox_close_file (hd);
+  index_current = _keybox_index_is_current (hd->kb);
   fp = fopen (hd->kb->fname, "r+b");
   if (!fp)
     return gpg_error_from_syserror ();
@@ -609,7 +841,7 @@ keybox_delete (KEYBOX_HANDLE hd)
   else if (putc (0, fp) == EOF)
     rc = gpg_error_from_syserror ();
   else
-    rc = 0;
+    rc = note_compress_change (fname, off, "", 1);
 
   if (fclose (fp))
     {
@@ -617,54 +849,22 @@ keybox_delete (KEYBOX_HANDLE hd)
         rc = gpg_error_from_syserror ();
     }
 
+  /* The blob is now marked as deleted but still at its offset.  A
+   * search skips deleted blobs and thus we can keep the index.  */
+  _keybox_index_note_change (hd->kb, index_current);
+
   return rc;
 }
 
 
-/* Compress the keybox file.  This should be run with the file
-   locked. */
-int
-keybox_compress (KEYBOX_HANDLE hd)
+/* Check whether a compress run for the keybox opened at FP is due.
+   We schedule a compress run after 3 hours.  FP is rewound.  */
+static int
+compress_is_due (FILE *fp)
 {
-  int read_rc, rc;
-  const char *fname;
-  FILE *fp, *newfp;
-  char *bakfname = NULL;
-  char *tmpfname = NULL;
-  int first_blob;
   KEYBOXBLOB blob = NULL;
-  u32 cut_time;
-  int any_changes = 0;
-  int skipped_deleted;
-
-  if (!hd)
-    return gpg_error (GPG_ERR_INV_HANDLE);
-  if (!hd->kb)
-    return gpg_error (GPG_ERR_INV_HANDLE);
-  if (hd->secret)
-    return gpg_error (GPG_ERR_NOT_IMPLEMENTED);
-  fname = hd->kb->fname;
-  if (!fname)
-    return gpg_error (GPG_ERR_INV_HANDLE);
-
-  _keybox_close_file (hd);
-
-  /* Open the source file. Because we do a rename, we have to check the
-     permissions of the file */
-  if (access (fname, W_OK))
-    return gpg_error_from_syserror ();
+  int due = 1;
 
-  fp = fopen (fname, "rb");
-  if (!fp && errno == ENOENT)
-    return 0; /* Ready. File has been deleted right after the access above. */
-  if (!fp)
-    {
-      rc = gpg_error_from_syserror ();
-      return rc;
-    }
-
-  /* A quick test to see if we need to compress the file at all.  We
-     schedule a compress run after 3 hours. */
   if ( !_keybox_read_blob (&blob, fp, NULL) )
     {
       const unsigned char *buffer;
@@ -676,54 +876,147 @@ keybox_compress (KEYBOX_HANDLE hd)
           u32 last_maint = buf32_to_u32 (buffer+20);
 
           if ( (last_maint + 3*3600) > make_timestamp () )
-            {
-              fclose (fp);
-              _keybox_release_blob (blob);
-              return 0; /* Compress run not yet needed. */
-            }
+            due = 0; /* Compress run not yet needed. */
         }
       _keybox_release_blob (blob);
-      fseek (fp, 0, SEEK_SET);
-      clearerr (fp);
     }
+  fseek (fp, 0, SEEK_SET);
+  clearerr (fp);
+  return due;
+}
 
-  /* Create the new file. */
-  rc = create_tmp_file (fname, &bakfname, &tmpfname, &newfp);
-  if (rc)
+
+/* Record in MAP that BLOB has been copied to NEWOFF.  */
+static gpg_error_t
+compress_map_add (struct compress_map *map, KEYBOXBLOB blob, off_t newoff)
+{
+  struct compress_map_item *item;
+
+  if (map->used == map->size)
     {
-      fclose (fp);
-      return rc;;
+      size_t newsize = map->size? 2 * map->size : 1024;
+
+      item = xtryrealloc (map->items, newsize * sizeof *item);
+      if (!item)
+        return gpg_error_from_syserror ();
+      map->items = item;
+      map->size = newsize;
     }
+  item = map->items + map->used++;
+  item->oldoff = _keybox_get_blob_fileoffset (blob);
+  _keybox_get_blob_image (blob, &item->length);
+  item->newoff = newoff;
+  return 0;
+}
 
 
-  /* Processing loop.  By reading using _keybox_read_blob we
-     automagically skip any blobs flagged as deleted.  Thus what we
-     only have to do is to check all ephemeral flagged blocks whether
-     their time has come and write out all other blobs. */
-  cut_time = make_timestamp () - 86400;
-  first_blob = 1;
-  skipped_deleted = 0;
-  for (rc=0; !(read_rc = _keybox_read_blob (&blob, fp, &skipped_deleted));
-       _keybox_release_blob (blob), blob = NULL )
+/* Return the item of MAP for the blob at the old file offset OFF or
+   NULL if that blob has not been copied.  */
+static struct compress_map_item *
+compress_map_find (struct compress_map *map, off_t off)
+{
+  size_t lo = 0, hi = map->used, mid;
+  struct compress_map_item *item;
+
+  while (lo < hi)
+    {
+      mid = lo + (hi - lo) / 2;
+      item = map->items + mid;
+      if (off < item->oldoff)
+        hi = mid;
+      else if (off >= item->oldoff + (off_t)item->length)
+        lo = mid + 1;
+      else
+        return item;
+    }
+  return NULL;
+}
+
+
+/* Apply the changes logged in LOGFP to the blobs in NEWFP as
+   described by MAP.  Changes to blobs which have not been copied are
+   ignored.  */
+static gpg_error_t
+compress_replay_log (FILE *logfp, FILE *newfp, struct compress_map *map)
+{
+  unsigned char rec[8 + 1 + COMPRESS_LOG_MAXDATA];
+  struct compress_map_item *item;
+  unsigned long long val;
+  off_t off;
+  size_t length;
+  int i;
+
+  for (;;)
+    {
+      if (fread (rec, 9, 1, logfp) != 1)
+        break;
+      for (val=0, i=0; i < 8; i++)
+        val = (val << 8) | rec[i];
+      off = val;
+      length = rec[8];
+      if (length > COMPRESS_LOG_MAXDATA
+          || fread (rec + 9, length, 1, logfp) != 1)
+        return gpg_error (GPG_ERR_INV_DATA);
+
+      item = compress_map_find (map, off);
+      if (!item || off + (off_t)length > item->oldoff + (off_t)item->length)
+        continue;
+      if (fseeko (newfp, item->newoff + (off - item->oldoff), SEEK_SET)
+          || fwrite (rec + 9, length, 1, newfp) != 1)
+        return gpg_error_from_syserror ();
+    }
+  if (ferror (logfp))
+    return gpg_error_from_syserror ();
+  return 0;
+}
+
+
+/* Copy the blobs from FP to NEWFP which are to be kept by a compress
+   run.  Blobs flagged as deleted are automagically skipped by
+   _keybox_read_blob.  Thus what we only have to do is to check all
+   ephemeral flagged blocks whether their time has come and write out
+   all other blobs.  If ENDOFF is not -1 only the blobs starting
+   before ENDOFF are copied; FP is then left at an undefined
+   position.  If MAP is not NULL the old and new offset of each copied
+   blob is recorded there.  */
+static int
+compress_copy_blobs (KEYBOX_HANDLE hd, struct compress_state *cs,
+                     FILE *fp, FILE *newfp, off_t endoff,
+                     struct compress_map *map)
+{
+  int read_rc, rc;
+  KEYBOXBLOB blob = NULL;
+  int skipped_deleted = 0;
+
+  for (rc=0; !(read_rc = _keybox_read_blob_reuse (&blob, fp,
+                                                  &skipped_deleted)); )
     {
       unsigned int blobflags;
       const unsigned char *buffer;
       size_t length, pos, size;
       u32 created_at;
+      off_t newoff;
 
+      if (endoff != (off_t)-1 && _keybox_get_blob_fileoffset (blob) >= endoff)
+        break; /* That one is copied by the next segment.  */
       if (skipped_deleted)
-        any_changes = 1;
+        cs->any_changes = 1;
       buffer = _keybox_get_blob_image (blob, &length);
-      if (first_blob)
+      if (cs->first_blob)
         {
-          first_blob = 0;
+          cs->first_blob = 0;
           if (length > 4 && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
             {
               /* Write out the blob with an updated maintenance time
                  stamp and if needed (ie. used by gpg) set the openpgp
                  flag.  */
               _keybox_update_header_blob (blob, hd->for_openpgp);
+              newoff = 0;
               rc = _keybox_write_blob (blob, newfp);
+              if (rc)
+                break;
+              if (map)
+                rc = compress_map_add (map, blob, newoff);
               if (rc)
                 break;
               continue;
@@ -733,12 +1026,12 @@ keybox_compress (KEYBOX_HANDLE hd)
           rc = _keybox_write_header_blob (newfp, NULL, hd->for_openpgp);
           if (rc)
             break;
-          any_changes = 1;
+          cs->any_changes = 1;
         }
       else if (length > 4 && buffer[4] == KEYBOX_BLOBTYPE_HEADER)
         {
           /* Oops: There is another header record - remove it. */
-          any_changes = 1;
+          cs->any_changes = 1;
           continue;
         }
 
@@ -760,24 +1053,104 @@ keybox_compress (KEYBOX_HANDLE hd)
           else
             created_at = buf32_to_u32 (buffer+pos);
 
-          if (created_at && created_at < cut_time)
+          if (created_at && created_at < cs->cut_time)
             {
-              any_changes = 1;
+              cs->any_changes = 1;
               continue; /* Skip this blob. */
             }
         }
 
+      newoff = ftello (newfp);
+      if (newoff == (off_t)-1)
+        {
+          rc = gpg_error_from_syserror ();
+          break;
+        }
       rc = _keybox_write_blob (blob, newfp);
       if (rc)
         break;
+      if (map)
+        rc = compress_map_add (map, blob, newoff);
+      if (rc)
+        break;
     }
   if (skipped_deleted)
-    any_changes = 1;
-  _keybox_release_blob (blob); blob = NULL;
+    cs->any_changes = 1;
+  _keybox_release_blob (blob);
   if (!rc && read_rc == -1)
     rc = 0;
+  else if (!rc && read_rc && endoff != (off_t)-1)
+    {
+      /* A read error after ENDOFF may be caused by a blob which is
+       * just being appended; the next segment reads it again.  */
+      off_t off = ftello (fp);
+      if (off == (off_t)-1 || off <= endoff)
+        rc = read_rc;
+    }
   else if (!rc)
     rc = read_rc;
+  return rc;
+}
+
+
+/* Compress the keybox file.  This should be run with the file
+   locked. */
+int
+keybox_compress (KEYBOX_HANDLE hd)
+{
+  int rc;
+  const char *fname;
+  FILE *fp, *newfp;
+  char *bakfname = NULL;
+  char *tmpfname = NULL;
+  struct compress_state cs;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  if (!hd->kb)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  if (hd->secret)
+    return gpg_error (GPG_ERR_NOT_IMPLEMENTED);
+  fname = hd->kb->fname;
+  if (!fname)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+
+  _keybox_close_file (hd);
+
+  /* Open the source file. Because we do a rename, we have to check the
+     permissions of the file */
+  if (access (fname, W_OK))
+    return gpg_error_from_syserror ();
+
+  fp = fopen (fname, "rb");
+  if (!fp && errno == ENOENT)
+    return 0; /* Ready. File has been deleted right after the access above. */
+  if (!fp)
+    {
+      rc = gpg_error_from_syserror ();
+      return rc;
+    }
+
+  /* A quick test to see if we need to compress the file at all.  */
+  if (!compress_is_due (fp))
+    {
+      fclose (fp);
+      return 0;
+    }
+
+  /* Create the new file. */
+  rc = create_tmp_file (fname, &bakfname, &tmpfname, &newfp);
+  if (rc)
+    {
+      fclose (fp);
+      return rc;;
+    }
+
+  /* Processing loop.  */
+  cs.cut_time = make_timestamp () - 86400;
+  cs.first_blob = 1;
+  cs.any_changes = 0;
+  rc = compress_copy_blobs (hd, &cs, fp, newfp, (off_t)-1, NULL);
 
   /* Close both files. */
   if (fclose(fp) && !rc)
@@ -786,12 +1159,208 @@ keybox_compress (KEYBOX_HANDLE hd)
     rc = gpg_error_from_syserror ();
 
   /* Rename or remove the temporary file. */
-  if (rc || !any_changes)
+  if (rc || !cs.any_changes)
     gnupg_remove (tmpfname);
   else
-    rc = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
+    {
+      rc = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
+      _keybox_index_invalidate (hd->kb);
+    }
 
   xfree(bakfname);
   xfree(tmpfname);
   return rc;
 }
+
+
+/* Open FNAME for reading and seek to OFF.  If R_ENDOFF is not NULL
+   the current length of the file is stored there.  */
+static gpg_error_t
+compress_open_at (const char *fname, off_t off, FILE **r_fp, off_t *r_endoff)
+{
+  gpg_error_t err = 0;
+  FILE *fp;
+
+  *r_fp = NULL;
+  fp = fopen (fname, "rb");
+  if (!fp)
+    return gpg_error_from_syserror ();
+  if (r_endoff)
+    {
+      if (fseeko (fp, 0, SEEK_END) || (*r_endoff = ftello (fp)) == (off_t)-1)
+        err = gpg_error_from_syserror ();
+    }
+  if (!err && fseeko (fp, off, SEEK_SET))
+    err = gpg_error_from_syserror ();
+  if (err)
+    fclose (fp);
+  else
+    *r_fp = fp;
+  return err;
+}
+
+
+/* Compress the keybox file without blocking other writers for the
+   entire run.  This must be called with the file locked and returns
+   with the file locked, but the lock is released while the bulk of
+   the blobs is copied.  The live blobs are copied segment by segment;
+   each segment ends at the end of the file as seen under the lock.
+   Blobs appended by other writers in the meantime go into the next
+   segment.  A writer which changes a blob in place records the
+   change in a log (see note_compress_change); the log is replayed on
+   the new file under the lock right before it replaces the old one.
+   This only works if all writers use the append mode; a writer which
+   rewrites the file removes the log and this function then gives up
+   without changing anything.  */
+int
+keybox_compress_incremental (KEYBOX_HANDLE hd)
+{
+  gpg_error_t err;
+  const char *fname;
+  FILE *fp = NULL;
+  FILE *newfp = NULL;
+  FILE *logfp = NULL;
+  char *logfname = NULL;
+  char *bakfname = NULL;
+  char *tmpfname = NULL;
+  struct compress_state cs;
+  struct compress_map map = { NULL, 0, 0 };
+  off_t pos, endoff, newend;
+  int unlocked = 0;
+  int nsegments;
+  struct stat st;
+
+  if (!hd)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  if (!hd->kb)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  if (hd->secret)
+    return gpg_error (GPG_ERR_NOT_IMPLEMENTED);
+  fname = hd->kb->fname;
+  if (!fname)
+    return gpg_error (GPG_ERR_INV_HANDLE);
+  if (!hd->kb->is_locked)
+    return keybox_compress (hd);
+
+  _keybox_close_file (hd);
+
+  /* Open the source file. Because we do a rename, we have to check the
+     permissions of the file */
+  if (access (fname, W_OK))
+    return gpg_error_from_syserror ();
+  err = compress_open_at (fname, 0, &fp, &endoff);
+  if (gpg_err_code (err) == GPG_ERR_ENOENT)
+    return 0;
+  if (err)
+    return err;
+  if (!compress_is_due (fp))
+    {
+      fclose (fp);
+      return 0;
+    }
+
+  /* An existing log means that another process is running a compress
+   * or that such a run has been aborted; we consider it stale after a
+   * day.  */
+  logfname = strconcat (fname, COMPRESS_LOG_SUFFIX, NULL);
+  if (!logfname)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  if (!stat (logfname, &st) && st.st_mtime + 86400 > time (NULL))
+    goto leave;
+
+  err = create_tmp_file (fname, &bakfname, &tmpfname, &newfp);
+  if (err)
+    goto leave;
+  logfp = fopen (logfname, "wb");
+  if (!logfp || fclose (logfp))
+    {
+      err = gpg_error_from_syserror ();
+      logfp = NULL;
+      goto leave;
+    }
+  logfp = NULL;
+
+  cs.cut_time = make_timestamp () - 86400;
+  cs.first_blob = 1;
+  cs.any_changes = 0;
+
+  /* Copy the segments.  We stop after a few rounds to make sure
+   * that we terminate even with a busy writer.  */
+  pos = 0;
+  for (nsegments = 0; ; nsegments++)
+    {
+      err = keybox_lock (hd, 0, 0);
+      if (err)
+        goto leave;
+      unlocked = 1;
+      err = compress_copy_blobs (hd, &cs, fp, newfp, endoff, &map);
+      fclose (fp);
+      fp = NULL;
+      if (err)
+        goto leave;
+      err = keybox_lock (hd, 1, -1);
+      if (err)
+        goto leave;
+      unlocked = 0;
+
+      pos = endoff;
+      err = compress_open_at (fname, pos, &fp, &newend);
+      if (err)
+        goto leave;
+      if (newend - endoff < COMPRESS_SEGMENT_MIN
+          || nsegments >= COMPRESS_MAX_SEGMENTS)
+        break;
+      endoff = newend;
+    }
+
+  /* Now under the lock: copy what has been appended since the last
+   * segment and apply the logged changes.  */
+  logfp = fopen (logfname, "rb");
+  if (!logfp)
+    {
+      /* The file has been rewritten in the meantime.  */
+      err = 0;
+      cs.any_changes = 0;
+      goto leave;
+    }
+  err = compress_copy_blobs (hd, &cs, fp, newfp, (off_t)-1, NULL);
+  if (!err && cs.any_changes)
+    err = compress_replay_log (logfp, newfp, &map);
+  if (fclose (fp) && !err)
+    err = gpg_error_from_syserror ();
+  fp = NULL;
+  if (fclose (newfp) && !err)
+    err = gpg_error_from_syserror ();
+  newfp = NULL;
+
+  if (!err && cs.any_changes)
+    {
+      err = rename_tmp_file (bakfname, tmpfname, fname, hd->secret);
+      _keybox_index_invalidate (hd->kb);
+      xfree (tmpfname);
+      tmpfname = NULL;
+    }
+
+ leave:
+  if (unlocked && keybox_lock (hd, 1, -1) && !err)
+    err = gpg_error (GPG_ERR_NOT_LOCKED);
+  if (fp)
+    fclose (fp);
+  if (logfp)
+    fclose (logfp);
+  if (newfp)
+    fclose (newfp);
+  if (tmpfname)
+    {
+      gnupg_remove (tmpfname);
+      gnupg_remove (logfname);
+    }
+  xfree (map.items);
+  xfree (logfname);
+  xfree (bakfname);
+  xfree (tmpfname);
+  return err;
+}
@@ -68,6 +68,9 @@ gpg_error_t keybox_register_file (const char *fname, int secret,
                                   void **r_token);
 int keybox_is_writable (void *token);
 
+/*-- keybox-index.c --*/
+gpg_error_t keybox_write_index (void *token);
+
 KEYBOX_HANDLE keybox_new_openpgp (void *token, int secret);
 KEYBOX_HANDLE keybox_new_x509 (void *token, int secret);
 void keybox_release (KEYBOX_HANDLE hd);
@@ -75,6 +78,7 @@ void keybox_push_found_state (KEYBOX_HANDLE hd);
 void keybox_pop_found_state (KEYBOX_HANDLE hd);
 const char *keybox_get_resource_name (KEYBOX_HANDLE hd);
 int keybox_set_ephemeral (KEYBOX_HANDLE hd, int yes);
+int keybox_set_append_mode (KEYBOX_HANDLE hd, int yes);
 
 gpg_error_t keybox_lock (KEYBOX_HANDLE hd, int yes, long timeout);
 
@@ -104,6 +108,9 @@ gpg_error_t keybox_search (KEYBOX_HANDLE hd,
 
 off_t keybox_offset (KEYBOX_HANDLE hd);
 gpg_error_t keybox_seek (KEYBOX_HANDLE hd, off_t offset);
+gpg_error_t keybox_enum_keyids (KEYBOX_HANDLE hd,
+                                gpg_error_t (*cb)(void *opaque, u32 *kid),
+                                void *opaque);
 
 /*-- keybox-update.c --*/
 gpg_error_t keybox_insert_keyblock (KEYBOX_HANDLE hd,
@@ -121,6 +128,7 @@ int keybox_set_flags (KEYBOX_HANDLE hd, int what, int idx, unsigned int value);
 
 int keybox_delete (KEYBOX_HANDLE hd);
 int keybox_compress (KEYBOX_HANDLE hd);
+int keybox_compress_incremental (KEYBOX_HANDLE hd);
 
 
 /*--  --*/
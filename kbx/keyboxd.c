@@ -75,6 +75,7 @@ enum cmd_and_opt_values
     oNoVerbose = 500,
     aGPGConfList,
     aGPGConfTest,
+    aImportKbx,
     oOptions,
     oDebug,
     oDebugAll,
@@ -98,6 +99,8 @@ enum cmd_and_opt_values
 static gpgrt_opt_t opts[] = {
   ARGPARSE_c (aGPGConfList, "gpgconf-list", "@"),
   ARGPARSE_c (aGPGConfTest, "gpgconf-test", "@"),
+  ARGPARSE_c (aImportKbx, "import-kbx",
+              N_("|FILE|import the keys from the keybox FILE")),
 
   ARGPARSE_group (301, N_("@Options:\n ")),
 
@@ -464,6 +467,7 @@ main (int argc, char **argv )
   int nodetach = 0;
   char *logfile = NULL;
   int gpgconf_list = 0;
+  int import_kbx = 0;
   int debug_wait = 0;
   struct assuan_malloc_hooks malloc_hooks;
 
@@ -563,6 +567,7 @@ main (int argc, char **argv )
         {
         case aGPGConfList: gpgconf_list = 1; break;
         case aGPGConfTest: gpgconf_list = 2; break;
+        case aImportKbx: import_kbx = 1; break;
         case oBatch: opt.batch=1; break;
         case oDebugWait: debug_wait = pargs.r.ret_int; break;
         case oNoGreeting: /* Dummy option.  */ break;
@@ -633,7 +638,7 @@ main (int argc, char **argv )
   bind_textdomain_codeset (PACKAGE_GT, "UTF-8");
 #endif
 
-  if (!pipe_server && !is_daemon && !gpgconf_list)
+  if (!pipe_server && !is_daemon && !gpgconf_list && !import_kbx)
     {
      /* We have been called without any command and thus we merely
       * check whether an instance of us is already running.  We do
@@ -683,7 +688,30 @@ main (int argc, char **argv )
       current_logfile = xstrdup (logfile);
     }
 
-  if (pipe_server)
+  if (import_kbx)
+    {
+      /* Migrate a keybox file to the database.  */
+      ctrl_t ctrl;
+      gpg_error_t err;
+
+      if (argc != 1)
+        {
+          log_error ("usage: keyboxd --import-kbx FILE\n");
+          kbxd_exit (2);
+        }
+
+      initialize_modules ();
+
+      ctrl = xcalloc (1, sizeof *ctrl);
+      kbxd_init_default_ctrl (ctrl);
+      err = kbxd_set_database (ctrl, "pubring.db", 0);
+      if (!err)
+        err = kbxd_import_kbx (ctrl, *argv);
+      kbxd_deinit_default_ctrl (ctrl);
+      xfree (ctrl);
+      kbxd_exit (err? 1 : 0);
+    }
+  else if (pipe_server)
     {
       /* This is the simple pipe based server */
       ctrl_t ctrl;
@@ -176,5 +176,6 @@ void kbxd_sighup_action (void);
 gpg_error_t kbxd_write_data_line (ctrl_t ctrl,
                                   const void *buffer_arg, size_t size);
 void kbxd_start_command_handler (ctrl_t, gnupg_fd_t, unsigned int);
+void kbxd_notify_change (const unsigned char *ubid);
 
 #endif /*KEYBOXD_H*/
@@ -72,6 +72,8 @@ if test x$_ldap_with != xno ; then
        # The extra test for ldap_start_tls_sA is for W32 because 
        # that is the actual function in the library.
        AC_CHECK_FUNCS(ldap_start_tls_s ldap_start_tls_sA)
+       # For paged search results (RFC-2696).
+       AC_CHECK_FUNCS(ldap_create_page_control ldap_parse_pageresponse_control)
 
        if test "$ac_cv_func_ldap_get_option" != yes ; then
           AC_MSG_CHECKING([whether LDAP supports ld_errno])
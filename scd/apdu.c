@@ -115,6 +115,7 @@ struct reader_table_s {
     ccid_driver_t handle;
   } ccid;
   struct {
+    HANDLE context;   /* The reader's own context or 0.  */
     HANDLE card;
     pcsc_dword_t protocol;
     pcsc_dword_t verify_ioctl;
@@ -230,6 +231,7 @@ static npth_mutex_t reader_table_lock;
 #define PCSC_E_READER_UNAVAILABLE      0x80100017
 #define PCSC_E_NO_SERVICE              0x8010001D
 #define PCSC_E_SERVICE_STOPPED         0x8010001E
+#define PCSC_E_NO_READERS_AVAILABLE    0x8010002E
 #define PCSC_W_RESET_CARD              0x80100068
 #define PCSC_W_REMOVED_CARD            0x80100069
 
@@ -770,9 +772,17 @@ pcsc_send_apdu (int slot, unsigned char *apdu, size_t apdulen,
       send_pci.protocol = PCSC_PROTOCOL_T0;
   send_pci.pci_len = sizeof send_pci;
   recv_len = *buflen;
+  /* The card is locked by the caller; thus let other threads talk to
+     other readers meanwhile.  */
+#ifdef USE_NPTH
+  npth_unprotect ();
+#endif
   err = pcsc_transmit (reader_table[slot].pcsc.card,
                        &send_pci, apdu, apdulen,
                        NULL, buffer, &recv_len);
+#ifdef USE_NPTH
+  npth_protect ();
+#endif
   *buflen = recv_len;
   if (err)
     log_error ("pcsc_transmit failed: %s (0x%lx)\n",
@@ -802,8 +812,15 @@ control_pcsc (int slot, pcsc_dword_t ioctl_code,
 {
   long err;
 
+  /* This may wait for the user to enter a PIN on the pinpad.  */
+#ifdef USE_NPTH
+  npth_unprotect ();
+#endif
   err = pcsc_control (reader_table[slot].pcsc.card, ioctl_code,
                       cntlbuf, len, buffer, buflen? *buflen:0, buflen);
+#ifdef USE_NPTH
+  npth_protect ();
+#endif
   if (err)
     {
       log_error ("pcsc_control failed: %s (0x%lx)\n",
@@ -815,10 +832,16 @@ control_pcsc (int slot, pcsc_dword_t ioctl_code,
 }
 
 
+/* Close the reader at SLOT.  With SLOT -1 only the reference to the
+   shared context is released.  */
 static int
 close_pcsc_reader (int slot)
 {
-  (void)slot;
+  if (slot >= 0 && reader_table[slot].pcsc.context)
+    {
+      pcsc_release_context (reader_table[slot].pcsc.context);
+      reader_table[slot].pcsc.context = 0;
+    }
   if (--pcsc.count == 0 && npth_mutex_trylock (&reader_table_lock) == 0)
     {
       int i;
@@ -847,7 +870,24 @@ connect_pcsc_card (int slot)
   reader_table[slot].atrlen = 0;
   reader_table[slot].is_t0 = 0;
 
-  err = pcsc_connect (pcsc.context,
+  /* PC/SC Lite serializes all calls using the same context.  To allow
+     for concurrent use of several readers each gets its own context.
+     If that fails we use the shared one.  */
+  if (!reader_table[slot].pcsc.context)
+    {
+      err = pcsc_establish_context (PCSC_SCOPE_SYSTEM, NULL, NULL,
+                                    &reader_table[slot].pcsc.context);
+      if (err)
+        {
+          if (DBG_READER)
+            log_debug ("pcsc_establish_context failed: %s (0x%lx)\n",
+                       pcsc_error_string (err), err);
+          reader_table[slot].pcsc.context = 0;
+        }
+    }
+
+  err = pcsc_connect (reader_table[slot].pcsc.context?
+                      reader_table[slot].pcsc.context : pcsc.context,
                       reader_table[slot].rdrname,
                       PCSC_SHARE_EXCLUSIVE,
                       PCSC_PROTOCOL_T0|PCSC_PROTOCOL_T1,
@@ -1203,6 +1243,246 @@ pcsc_init (void)
   return 0;
 }
 
+#ifdef USE_NPTH
+/* The PC/SC monitor thread waits in pcsc_get_status_change for a
+   change of any reader and then kicks the main loop, which in turn
+   checks the status of the cards.  Thus PC/SC readers need not to be
+   polled from the ticker.  The special reader name PCSC_PNP_READER
+   is used to get notified about added and removed readers; if the
+   PC/SC service does not support it, the list of readers is checked
+   every PCSC_MONITOR_RELIST milliseconds.  The thread uses its own
+   PC/SC context because a context may not be used by several threads
+   at the same time.  */
+#define PCSC_PNP_READER      "\\\\?PnP?\\Notification"
+#define PCSC_INFINITE        0xffffffff
+#define PCSC_MONITOR_RELIST  2000
+
+/* 0 = not started, 1 = running, -1 = failed to start.  */
+static int pcsc_monitor_state;
+
+
+/* Return a malloced list of readers in the multi-string format of
+   pcsc_list_readers or NULL if there are no readers.  On error NULL
+   is returned and *R_ERR is set.  */
+static char *
+pcsc_monitor_list_readers (HANDLE context, long *r_err)
+{
+  pcsc_dword_t nreader;
+  char *list;
+  long err;
+
+  err = pcsc_list_readers (context, NULL, NULL, &nreader);
+  if (!err)
+    {
+      list = xtrymalloc (nreader + 1);
+      if (!list)
+        {
+          *r_err = PCSC_E_NO_MEMORY;
+          return NULL;
+        }
+      err = pcsc_list_readers (context, NULL, list, &nreader);
+      if (!err)
+        {
+          list[nreader] = 0;
+          *r_err = 0;
+          return list;
+        }
+      xfree (list);
+    }
+  *r_err = err == PCSC_E_NO_READERS_AVAILABLE? 0 : err;
+  return NULL;
+}
+
+
+/* Return true if the reader lists A and B differ.  */
+static int
+pcsc_reader_lists_differ (const char *a, const char *b)
+{
+  size_t n;
+
+  if (!a || !b)
+    return !a != !b;
+  for (; *a || *b; a += n + 1, b += n + 1)
+    {
+      n = strlen (a);
+      if (strcmp (a, b))
+        return 1;
+    }
+  return 0;
+}
+
+
+static void *
+pcsc_monitor_thread (void *arg)
+{
+  HANDLE context = 0;
+  struct pcsc_readerstate_s *states = NULL;
+  pcsc_dword_t nstates = 0;
+  pcsc_dword_t i;
+  char *readers = NULL;
+  char *newreaders;
+  const char *s;
+  int relist = 1;
+  int initial = 0;
+  int use_pnp = 1;
+  int changed;
+  long err;
+
+  (void)arg;
+
+  for (;;)
+    {
+      if (!context)
+        {
+          err = pcsc_establish_context (PCSC_SCOPE_SYSTEM, NULL, NULL,
+                                        &context);
+          if (err)
+            {
+              if (DBG_READER)
+                log_debug ("pcsc monitor: establish_context failed:"
+                           " %s (0x%lx)\n", pcsc_error_string (err), err);
+              context = 0;
+              npth_sleep (5);
+              continue;
+            }
+          relist = 1;
+        }
+
+      if (relist)
+        {
+          relist = 0;
+          newreaders = pcsc_monitor_list_readers (context, &err);
+          if (err)
+            {
+              log_error ("pcsc monitor: list_readers failed: %s (0x%lx)\n",
+                         pcsc_error_string (err), err);
+              pcsc_release_context (context);
+              context = 0;
+              npth_sleep (1);
+              continue;
+            }
+          if (pcsc_reader_lists_differ (readers, newreaders))
+            scd_kick_the_loop ();
+          xfree (readers);
+          readers = newreaders;
+
+          nstates = 1;
+          for (s = readers; s && *s; s += strlen (s) + 1)
+            nstates++;
+          xfree (states);
+          states = xtrycalloc (nstates, sizeof *states);
+          if (!states)
+            {
+              log_error ("pcsc monitor: out of core\n");
+              nstates = 0;
+              relist = 1;
+              npth_sleep (1);
+              continue;
+            }
+          states[0].reader = PCSC_PNP_READER;
+          states[0].current_state = use_pnp? PCSC_STATE_UNAWARE
+            /**/                           : PCSC_STATE_IGNORE;
+          for (i = 1, s = readers; s && *s; s += strlen (s) + 1, i++)
+            {
+              states[i].reader = s;
+              states[i].current_state = PCSC_STATE_UNAWARE;
+            }
+          initial = 1;
+        }
+
+      npth_unprotect ();
+      err = pcsc_get_status_change (context, (initial? 0
+                                              : use_pnp? PCSC_INFINITE
+                                              : PCSC_MONITOR_RELIST),
+                                    states, nstates);
+      npth_protect ();
+
+      if (err == PCSC_E_TIMEOUT)
+        {
+          if (!use_pnp)
+            relist = 1;
+          continue;
+        }
+      else if (err == PCSC_E_UNKNOWN_READER)
+        {
+          /* A reader has been removed and PnP did not tell us.  */
+          relist = 1;
+          continue;
+        }
+      else if (err)
+        {
+          log_error ("pcsc monitor: get_status_change failed: %s (0x%lx)\n",
+                     pcsc_error_string (err), err);
+          pcsc_release_context (context);
+          context = 0;
+          scd_kick_the_loop ();
+          npth_sleep (1);
+          continue;
+        }
+
+      if (use_pnp && (states[0].event_state & PCSC_STATE_UNKNOWN))
+        {
+          if (DBG_READER)
+            log_debug ("pcsc monitor: no PnP support - polling the list\n");
+          use_pnp = 0;
+          states[0].current_state = PCSC_STATE_IGNORE;
+        }
+      else if (use_pnp && !initial
+               && (states[0].event_state & PCSC_STATE_CHANGED))
+        relist = 1;
+      else if (use_pnp)
+        states[0].current_state = states[0].event_state & ~PCSC_STATE_CHANGED;
+
+      changed = 0;
+      for (i = 1; i < nstates; i++)
+        if ((states[i].event_state & PCSC_STATE_CHANGED))
+          {
+            states[i].current_state = (states[i].event_state
+                                       & ~PCSC_STATE_CHANGED);
+            changed = 1;
+          }
+      if (changed && !initial)
+        scd_kick_the_loop ();
+      initial = 0;
+    }
+
+  /*NOTREACHED*/
+  return NULL;
+}
+
+
+/* Start the PC/SC monitor thread if not yet done.  Returns 0 if the
+   thread is running.  */
+static int
+pcsc_start_monitor (void)
+{
+  npth_attr_t tattr;
+  npth_t thread;
+  int ret;
+
+  if (pcsc_monitor_state)
+    return pcsc_monitor_state > 0? 0 : -1;
+
+  ret = npth_attr_init (&tattr);
+  if (!ret)
+    {
+      npth_attr_setdetachstate (&tattr, NPTH_CREATE_DETACHED);
+      ret = npth_create (&thread, &tattr, pcsc_monitor_thread, NULL);
+      npth_attr_destroy (&tattr);
+    }
+  if (ret)
+    {
+      log_error ("error spawning the PC/SC monitor: %s\n", strerror (ret));
+      pcsc_monitor_state = -1;
+      return -1;
+    }
+  npth_setname_np (thread, "pcsc-monitor");
+  pcsc_monitor_state = 1;
+  return 0;
+}
+#endif /*USE_NPTH*/
+
+
 /* Open the PC/SC reader.  Returns -1 on error or a slot number for
    the reader.  */
 static int
@@ -1218,12 +1498,13 @@ open_pcsc_reader (const char *rdrname)
   if (!reader_table[slot].rdrname)
     {
       log_error ("error allocating memory for reader name\n");
-      close_pcsc_reader (0);
+      close_pcsc_reader (-1);
       reader_table[slot].used = 0;
       unlock_slot (slot);
       return -1;
     }
 
+  reader_table[slot].pcsc.context = 0;
   reader_table[slot].pcsc.card = 0;
   reader_table[slot].atrlen = 0;
 
@@ -1235,6 +1516,12 @@ open_pcsc_reader (const char *rdrname)
   reader_table[slot].send_apdu_reader = pcsc_send_apdu;
   reader_table[slot].dump_status_reader = dump_pcsc_reader_status;
 
+#ifdef USE_NPTH
+  /* With the monitor thread the status is checked only on a change.  */
+  if (!pcsc_start_monitor ())
+    reader_table[slot].require_get_status = 0;
+#endif
+
   pcsc.count++;
   dump_reader_status (slot);
   unlock_slot (slot);
@@ -2009,7 +2296,7 @@ apdu_dev_list_start (const char *portstr, struct dev_list **l_p)
               err = gpg_error_from_syserror ();
 
               log_error ("error allocating memory for reader list\n");
-              close_pcsc_reader (0);
+              close_pcsc_reader (-1);
               npth_mutex_unlock (&reader_table_lock);
               return err;
             }
@@ -2020,7 +2307,7 @@ apdu_dev_list_start (const char *portstr, struct dev_list **l_p)
           log_error ("pcsc_list_readers failed: %s (0x%lx)\n",
                      pcsc_error_string (r), r);
           xfree (p);
-          close_pcsc_reader (0);
+          close_pcsc_reader (-1);
           npth_mutex_unlock (&reader_table_lock);
           return gpg_error (GPG_ERR_NO_SERVICE);
         }
@@ -2580,6 +2867,72 @@ apdu_get_atr (int slot, size_t *atrlen)
 }
 
 
+/* Return true if the card in SLOT announces support for extended
+   Lc and Le fields in the card capabilities of its ATR's historical
+   bytes.  */
+int
+apdu_ext_length_supported (int slot)
+{
+  const unsigned char *atr;
+  size_t atrlen, idx;
+  int y, nhist;
+  unsigned int tag, len;
+
+  if (slot < 0 || slot >= MAX_READER || !reader_table[slot].used
+      || reader_table[slot].is_t0)
+    return 0;
+  atr = reader_table[slot].atr;
+  atrlen = reader_table[slot].atrlen;
+  if (atrlen < 2)
+    return 0;
+
+  /* Skip TS, T0 and the interface bytes.  */
+  nhist = atr[1] & 0x0f;
+  y = atr[1] & 0xf0;
+  idx = 2;
+  while (y)
+    {
+      idx += !!(y & 0x10) + !!(y & 0x20) + !!(y & 0x40);
+      if (!(y & 0x80))
+        break;
+      if (idx >= atrlen)
+        return 0;
+      y = atr[idx++] & 0xf0;
+    }
+  if (idx + nhist > atrlen || !nhist)
+    return 0;
+  atr += idx;
+
+  /* Only the category indicators 0x00 and 0x80 use Compact-TLV; with
+     0x00 the last 3 bytes are the status indicator.  */
+  if (*atr == 0x00)
+    {
+      if (nhist < 4)
+        return 0;
+      nhist -= 3;
+    }
+  else if (*atr != 0x80)
+    return 0;
+  atr++;
+  nhist--;
+
+  while (nhist > 0)
+    {
+      tag = (*atr & 0xf0) >> 4;
+      len = (*atr & 0x0f);
+      atr++;
+      nhist--;
+      if (len > nhist)
+        return 0;
+      if (tag == 7 && len == 3)
+        return !!(atr[2] & 0x40);
+      atr += len;
+      nhist -= len;
+    }
+  return 0;
+}
+
+
 
 /* Retrieve the status for SLOT. The function does only wait for the
    card to become available if HANG is set to true. On success the
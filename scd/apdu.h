@@ -116,6 +116,7 @@ int apdu_close_reader (int slot);
 void apdu_prepare_exit (void);
 int apdu_enum_reader (int slot, int *used);
 unsigned char *apdu_get_atr (int slot, size_t *atrlen);
+int apdu_ext_length_supported (int slot);
 
 const char *apdu_strerror (int rc);
 
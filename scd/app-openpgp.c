@@ -151,6 +151,7 @@ rsa_key_format_t;
 struct cache_s {
   struct cache_s *next;
   int tag;
+  tlv_index_t tlvidx;  /* Index of a constructed DO or NULL.  */
   size_t length;
   unsigned char data[1];
 };
@@ -264,6 +265,27 @@ struct app_local_s {
 #define ECC_FLAG_PUBKEY    (1 << 1)
 
 
+/* The maximum number of items in the public key cache.  */
+#define PUBKEY_CACHE_SIZE 24
+
+/* An item of the public key cache.  Reading a public key from a card
+ * is slow and in contrast to the app_local object this cache
+ * survives a reset or a re-insertion of the card.  An item is only
+ * used if the fingerprint stored on the card for that key still
+ * matches.  */
+struct pubkey_cache_s
+{
+  struct pubkey_cache_s *next;
+  int keyno;
+  unsigned char fpr[20];
+  unsigned char *key;   /* Canonical encoded S-expression.  */
+  size_t keylen;
+  size_t serialnolen;
+  unsigned char serialno[1];
+};
+static struct pubkey_cache_s *pubkey_cache;
+
+
 /***** Local prototypes  *****/
 static unsigned long convert_sig_counter_value (const unsigned char *value,
                                                 size_t valuelen);
@@ -340,6 +362,7 @@ do_deinit (app_t app)
       for (c = app->app_local->cache; c; c = c2)
         {
           c2 = c->next;
+          tlv_index_release (c->tlvidx);
           xfree (c);
         }
 
@@ -466,6 +489,7 @@ get_cached_data (app_t app, int tag,
         xfree (p);
       c->length = len;
       c->tag = tag;
+      c->tlvidx = NULL;
       c->next = app->app_local->cache;
       app->app_local->cache = c;
     }
@@ -490,6 +514,7 @@ flush_cache_item (app_t app, int tag)
           cprev->next = c->next;
         else
           app->app_local->cache = c->next;
+        tlv_index_release (c->tlvidx);
         xfree (c);
 
         for (c=app->app_local->cache; c ; c = c->next)
@@ -530,6 +555,7 @@ flush_cache (app_t app)
       for (c = app->app_local->cache; c; c = c2)
         {
           c2 = c->next;
+          tlv_index_release (c->tlvidx);
           xfree (c);
         }
       app->app_local->cache = NULL;
@@ -537,6 +563,32 @@ flush_cache (app_t app)
 }
 
 
+/* Locate the DO TAG in BUFFER of BUFLEN which is a copy of the cached
+   constructed DO GET_FROM.  This is the same as find_tlv_unchecked
+   but uses an index built on the first lookup.  Constructed DOs like
+   the Application Related Data are thus parsed only once.  */
+static const unsigned char *
+find_cached_tlv (app_t app, int get_from,
+                 const unsigned char *buffer, size_t buflen,
+                 int tag, size_t *nbytes)
+{
+  struct cache_s *c;
+  const unsigned char *s;
+
+  for (c=app->app_local->cache; c; c = c->next)
+    if (c->tag == get_from)
+      break;
+  if (!c || c->length != buflen)
+    return find_tlv_unchecked (buffer, buflen, tag, nbytes);
+
+  if (!c->tlvidx && tlv_index_new (&c->tlvidx, c->data, c->length))
+    return find_tlv_unchecked (buffer, buflen, tag, nbytes);
+
+  s = tlv_index_find_unchecked (c->tlvidx, tag, nbytes);
+  return s? buffer + (s - c->data) : NULL;
+}
+
+
 /* Get the DO identified by TAG from the card in SLOT and return a
    buffer with its content in RESULT and NBYTES.  The return value is
    NULL if not found or a pointer which must be used to release the
@@ -589,7 +641,12 @@ get_one_do (app_t app, int tag, unsigned char **result, size_t *nbytes,
         {
           const unsigned char *s;
 
-          s = find_tlv_unchecked (buffer, buflen, tag, &valuelen);
+          if (data_objects[i].dont_cache
+              || data_objects[i].get_immediate_in_v11)
+            s = find_tlv_unchecked (buffer, buflen, tag, &valuelen);
+          else
+            s = find_cached_tlv (app, data_objects[i].get_from,
+                                 buffer, buflen, tag, &valuelen);
           if (!s)
             value = NULL; /* not found */
           else if (valuelen > buflen - (s - buffer))
@@ -1883,6 +1940,115 @@ read_public_key (app_t app, ctrl_t ctrl, u32 created_at, int keyno,
 }
 
 
+/* Store the fingerprint of key KEYNO from the card at FPR, which
+ * must have room for 20 bytes.  Return false if no key is set.  */
+static int
+pubkey_cache_fpr (app_t app, int keyno, unsigned char *fpr)
+{
+  void *relptr;
+  unsigned char *value;
+  size_t valuelen;
+  int i, okay = 0;
+
+  relptr = get_one_do (app, 0x00C5, &value, &valuelen, NULL);
+  if (relptr && valuelen >= 60)
+    {
+      memcpy (fpr, value + keyno*20, 20);
+      for (i=0; i < 20 && !okay; i++)
+        if (fpr[i])
+          okay = 1;
+    }
+  xfree (relptr);
+  return okay;
+}
+
+
+/* Look up the public key cache for key KEYNO of the card APP with the
+ * fingerprint FPR.  On success the key is stored with APP and true is
+ * returned.  */
+static int
+pubkey_cache_get (app_t app, int keyno, const unsigned char *fpr)
+{
+  struct pubkey_cache_s *c;
+  unsigned char *keybuf;
+
+  for (c = pubkey_cache; c; c = c->next)
+    if (c->keyno == keyno
+        && c->serialnolen == app->card->serialnolen
+        && !memcmp (c->serialno, app->card->serialno, c->serialnolen)
+        && !memcmp (c->fpr, fpr, 20))
+      break;
+  if (!c)
+    return 0;
+
+  keybuf = xtrymalloc (c->keylen + 1);
+  if (!keybuf)
+    return 0;
+  memcpy (keybuf, c->key, c->keylen + 1);
+  app->app_local->pk[keyno].key = keybuf;
+  app->app_local->pk[keyno].keylen = c->keylen;
+  if (store_keygrip (app, keyno))
+    {
+      xfree (app->app_local->pk[keyno].key);
+      app->app_local->pk[keyno].key = NULL;
+      app->app_local->pk[keyno].keylen = 0;
+      return 0;
+    }
+  if (DBG_APP)
+    log_debug ("public key %d taken from the cache\n", keyno+1);
+  return 1;
+}
+
+
+/* Put the public key KEYNO of APP with the fingerprint FPR into the
+ * public key cache.  */
+static void
+pubkey_cache_put (app_t app, int keyno, const unsigned char *fpr)
+{
+  struct pubkey_cache_s *c, **cp;
+  int n;
+
+  if (!app->card->serialno || !app->app_local->pk[keyno].key)
+    return;
+
+  /* Remove an old item for this key and the oldest item if the cache
+   * is full.  New items are inserted at the head.  */
+  for (n = 0, cp = &pubkey_cache; (c = *cp); )
+    {
+      if ((c->keyno == keyno
+           && c->serialnolen == app->card->serialnolen
+           && !memcmp (c->serialno, app->card->serialno, c->serialnolen))
+          || ++n >= PUBKEY_CACHE_SIZE)
+        {
+          *cp = c->next;
+          xfree (c->key);
+          xfree (c);
+        }
+      else
+        cp = &c->next;
+    }
+
+  c = xtrymalloc (sizeof *c + app->card->serialnolen);
+  if (!c)
+    return;
+  c->key = xtrymalloc (app->app_local->pk[keyno].keylen + 1);
+  if (!c->key)
+    {
+      xfree (c);
+      return;
+    }
+  memcpy (c->key, app->app_local->pk[keyno].key,
+          app->app_local->pk[keyno].keylen + 1);
+  c->keylen = app->app_local->pk[keyno].keylen;
+  c->keyno = keyno;
+  memcpy (c->fpr, fpr, 20);
+  c->serialnolen = app->card->serialnolen;
+  memcpy (c->serialno, app->card->serialno, c->serialnolen);
+  c->next = pubkey_cache;
+  pubkey_cache = c;
+}
+
+
 /* Get the public key for KEYNO and store it as an S-expression with
    the APP handle.  On error that field gets cleared.  If we already
    know about the public key we will just return.  Note that this does
@@ -1897,7 +2063,7 @@ static gpg_error_t
 get_public_key (app_t app, int keyno)
 {
   gpg_error_t err = 0;
-  unsigned char *buffer;
+  unsigned char *buffer = NULL;
   const unsigned char *m, *e;
   size_t buflen;
   size_t mlen = 0;
@@ -1922,6 +2088,12 @@ get_public_key (app_t app, int keyno)
   if (app->appversion > 0x0100)
     {
       int exmode, le_value;
+      unsigned char fpr[20];
+      int have_fpr;
+
+      have_fpr = app->card->serialno && pubkey_cache_fpr (app, keyno, fpr);
+      if (have_fpr && pubkey_cache_get (app, keyno, fpr))
+        goto leave;
 
       /* We may simply read the public key out of these cards.  */
       if (app->app_local->cardcap.ext_lc_le
@@ -1951,6 +2123,8 @@ get_public_key (app_t app, int keyno)
         }
 
       err = read_public_key (app, NULL, 0U, keyno, buffer, buflen);
+      if (!err && have_fpr)
+        pubkey_cache_put (app, keyno, fpr);
     }
   else
     {
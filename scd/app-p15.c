@@ -369,9 +369,42 @@ struct app_local_s
   /* Information on all authentication objects. */
   aodf_object_t auth_object_info;
 
+  /* The raw content of the ODF.  Malloced.  */
+  unsigned char *odf_image;
+  size_t odf_imagelen;
+
+  /* Flag indicating that the application has been completely
+   * initialized and that the directory information may thus be moved
+   * to the directory cache.  */
+  unsigned int cacheable:1;
 };
 
 
+/* The maximum number of cards in the directory cache.  */
+#define DIR_CACHE_SIZE 4
+
+/* An item of the directory cache.  Reading and parsing all the
+ * directory files takes many APDUs and thus some seconds with slow
+ * cards.  When the application is released, for example after a card
+ * reset or a re-insertion of the card, the parsed directories are
+ * moved to this process-wide cache.  They are moved back if a card
+ * with the same serial number and ODF is selected again.  */
+struct dir_cache_s
+{
+  struct dir_cache_s *next;
+  cdf_object_t certificate_info;
+  cdf_object_t trusted_certificate_info;
+  cdf_object_t useful_certificate_info;
+  prkdf_object_t private_key_info;
+  aodf_object_t auth_object_info;
+  unsigned char *odf_image;
+  size_t odf_imagelen;
+  size_t serialnolen;
+  unsigned char serialno[1];
+};
+static struct dir_cache_s *dir_cache;
+
+
 /*** Local prototypes.  ***/
 static gpg_error_t keygrip_from_prkdf (app_t app, prkdf_object_t prkdf);
 static gpg_error_t readcert_by_cdf (app_t app, cdf_object_t cdf,
@@ -437,12 +470,139 @@ release_aodflist (aodf_object_t a)
 }
 
 
+/* Release the directory cache item C.  */
+static void
+release_dir_cache_item (struct dir_cache_s *c)
+{
+  if (c)
+    {
+      release_cdflist (c->certificate_info);
+      release_cdflist (c->trusted_certificate_info);
+      release_cdflist (c->useful_certificate_info);
+      release_prkdflist (c->private_key_info);
+      release_aodflist (c->auth_object_info);
+      xfree (c->odf_image);
+      xfree (c);
+    }
+}
+
+
+/* Move the directory information of APP to the directory cache.  */
+static void
+dir_cache_put (app_t app)
+{
+  struct app_local_s *l = app->app_local;
+  struct dir_cache_s *c, **cp;
+  prkdf_object_t prkdf;
+  int n;
+
+  /* We require a serial number.  The German prototype cards have
+   * their serial number changed after the lookup and all share the
+   * same number anyway; they are thus not cached.  */
+  if (!app->card->serialno || !l->odf_image
+      || (app->card->serialnolen > 3
+          && !memcmp (app->card->serialno, "\xff\x01", 3)))
+    return;
+
+  /* Remove an old item for this card and the oldest item if the
+   * cache is full.  New items are inserted at the head.  */
+  for (n = 0, cp = &dir_cache; (c = *cp); )
+    {
+      if ((c->serialnolen == app->card->serialnolen
+           && !memcmp (c->serialno, app->card->serialno, c->serialnolen))
+          || ++n >= DIR_CACHE_SIZE)
+        {
+          *cp = c->next;
+          release_dir_cache_item (c);
+        }
+      else
+        cp = &c->next;
+    }
+
+  c = xtrycalloc (1, sizeof *c + app->card->serialnolen);
+  if (!c)
+    return;
+  memcpy (c->serialno, app->card->serialno, app->card->serialnolen);
+  c->serialnolen = app->card->serialnolen;
+
+  /* A new session starts with unverified PINs.  */
+  for (prkdf = l->private_key_info; prkdf; prkdf = prkdf->next)
+    prkdf->pin_verified = 0;
+
+  c->certificate_info = l->certificate_info;
+  l->certificate_info = NULL;
+  c->trusted_certificate_info = l->trusted_certificate_info;
+  l->trusted_certificate_info = NULL;
+  c->useful_certificate_info = l->useful_certificate_info;
+  l->useful_certificate_info = NULL;
+  c->private_key_info = l->private_key_info;
+  l->private_key_info = NULL;
+  c->auth_object_info = l->auth_object_info;
+  l->auth_object_info = NULL;
+  c->odf_image = l->odf_image;
+  c->odf_imagelen = l->odf_imagelen;
+  l->odf_image = NULL;
+  l->odf_imagelen = 0;
+
+  c->next = dir_cache;
+  dir_cache = c;
+}
+
+
+/* Look up the directory cache for the card APP using the serial
+ * number and the already read ODF.  On success the directory
+ * information is moved to APP and true is returned.  */
+static int
+dir_cache_get (app_t app)
+{
+  struct app_local_s *l = app->app_local;
+  struct dir_cache_s *c, **cp;
+
+  if (!app->card->serialno || !l->odf_image)
+    return 0;
+
+  for (cp = &dir_cache; (c = *cp); cp = &c->next)
+    if (c->serialnolen == app->card->serialnolen
+        && !memcmp (c->serialno, app->card->serialno, c->serialnolen))
+      break;
+  if (!c)
+    return 0;
+  *cp = c->next;
+
+  if (c->odf_imagelen != l->odf_imagelen
+      || memcmp (c->odf_image, l->odf_image, l->odf_imagelen))
+    {
+      /* The card has been re-personalized.  */
+      release_dir_cache_item (c);
+      return 0;
+    }
+
+  l->certificate_info = c->certificate_info;
+  l->trusted_certificate_info = c->trusted_certificate_info;
+  l->useful_certificate_info = c->useful_certificate_info;
+  l->private_key_info = c->private_key_info;
+  l->auth_object_info = c->auth_object_info;
+  c->certificate_info = NULL;
+  c->trusted_certificate_info = NULL;
+  c->useful_certificate_info = NULL;
+  c->private_key_info = NULL;
+  c->auth_object_info = NULL;
+  release_dir_cache_item (c);
+
+  if (opt.verbose)
+    log_info ("p15: directory information taken from the cache\n");
+  return 1;
+}
+
+
 /* Release all local resources.  */
 static void
 do_deinit (app_t app)
 {
   if (app && app->app_local)
     {
+      if (app->app_local->cacheable)
+        dir_cache_put (app);
       release_cdflist (app->app_local->certificate_info);
       release_cdflist (app->app_local->trusted_certificate_info);
       release_cdflist (app->app_local->useful_certificate_info);
@@ -450,6 +610,7 @@ do_deinit (app_t app)
       release_aodflist (app->app_local->auth_object_info);
       xfree (app->app_local->manufacturer_id);
       xfree (app->app_local->serialno);
+      xfree (app->app_local->odf_image);
       xfree (app->app_local);
       app->app_local = NULL;
     }
@@ -689,13 +850,14 @@ read_ef_odf (app_t app, unsigned short odf_fid)
   unsigned char *buffer, *p;
   size_t buflen, n;
   unsigned short value;
-  size_t offset;
+  size_t offset, imagelen;
   unsigned short home_df = 0;
 
   err = select_and_read_binary (app_get_slot (app), odf_fid, "ODF",
                                 &buffer, &buflen);
   if (err)
     return err;
+  imagelen = buflen;
 
   if (buflen < 8)
     {
@@ -804,7 +966,10 @@ read_ef_odf (app_t app, unsigned short odf_fid)
         }
     }
 
-  xfree (buffer);
+  /* Keep the ODF to validate the directory cache.  */
+  xfree (app->app_local->odf_image);
+  app->app_local->odf_image = buffer;
+  app->app_local->odf_imagelen = imagelen;
   return 0;
 }
 
@@ -2563,6 +2728,11 @@ read_p15_info (app_t app)
   if (err)
     return err;
 
+  /* If we have seen this card before we can skip the reading of the
+     directory files. */
+  if (dir_cache_get (app))
+    return 0;
+
   /* Read certificate information. */
   assert (!app->app_local->certificate_info);
   assert (!app->app_local->trusted_certificate_info);
@@ -4341,6 +4511,7 @@ app_select_p15 (app_t app)
       app->fnc.change_pin = NULL;
       app->fnc.check_pin = NULL;
       app->fnc.with_keygrip = do_with_keygrip;
+      app->app_local->cacheable = 1;
 
     leave:
       if (rc)
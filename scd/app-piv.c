@@ -211,6 +211,8 @@ struct app_local_s {
   struct
   {
     unsigned int yubikey:1;  /* This is on a Yubikey.  */
+    unsigned int objcache_checked:1; /* The CHUID has been checked.  */
+    unsigned int objcache_valid:1;   /* The object cache may be used.  */
   } flags;
 
   /* Keep track on whether we cache a certain PIN so that we get it
@@ -231,7 +233,44 @@ struct app_local_s {
 };
 
 
+/* The maximum number of cards for which the object cache holds
+ * data.  */
+#define OBJCACHE_CARDS 4
+
+/* An item of the object cache.  */
+struct objcache_item_s
+{
+  struct objcache_item_s *next;
+  int tag;
+  char *keygripstr;       /* The keygrip of the object or NULL.  */
+  unsigned int got_cert:1;/* Value for get_keygrip_by_tag.  */
+  size_t length;
+  unsigned char data[1];
+};
+
+/* The object cache holds the certificates and other public DOs of a
+ * card.  In contrast to the cache in app_local it survives a reset
+ * or a re-insertion of the card so that LEARN and READCERT don't need
+ * to read the certificates again.  The data of a card is only used
+ * if the CHUID, which holds a GUID that is unique for each card, read
+ * from the card is unchanged.  Writes done by us flush the affected
+ * items.  */
+struct objcache_s
+{
+  struct objcache_s *next;
+  struct objcache_item_s *items;
+  unsigned char *chuid;
+  size_t chuidlen;
+  size_t serialnolen;
+  unsigned char serialno[1];
+};
+static struct objcache_s *objcache;
+
+
 /***** Local prototypes  *****/
+static gpg_error_t get_cached_data (app_t app, int tag,
+                                    unsigned char **result, size_t *resultlen,
+                                    int get_immediate);
 static gpg_error_t get_keygrip_by_tag (app_t app, unsigned int tag,
                                        char **r_keygripstr, int *got_cert);
 static gpg_error_t genkey_parse_rsa (const unsigned char *data, size_t datalen,
@@ -263,6 +302,183 @@ do_deinit (app_t app)
 }
 
 
+/* Release the object cache entry OC.  */
+static void
+objcache_release (struct objcache_s *oc)
+{
+  struct objcache_item_s *item, *item2;
+
+  if (!oc)
+    return;
+  for (item = oc->items; item; item = item2)
+    {
+      item2 = item->next;
+      xfree (item->keygripstr);
+      xfree (item);
+    }
+  xfree (oc->chuid);
+  xfree (oc);
+}
+
+
+/* Return true if the DO with TAG may be stored in the object cache.
+ * The CHUID is used to validate the cache and thus can't be stored;
+ * PIN protected objects are not kept beyond the session.  */
+static int
+objcache_tag_p (int tag)
+{
+  int i;
+
+  if (tag == 0x5FC102)
+    return 0;
+  for (i=0; data_objects[i].tag; i++)
+    if (data_objects[i].tag == tag)
+      return !data_objects[i].dont_cache && !data_objects[i].acr_contact;
+  return 0;
+}
+
+
+/* Return the object cache entry for the card of APP or NULL if the
+ * cache can't be used for it.  The CHUID is checked only once for
+ * each application context; it is read anyway by LEARN.  */
+static struct objcache_s *
+objcache_card (app_t app)
+{
+  struct objcache_s *oc, **ocp;
+  unsigned char *chuid;
+  size_t chuidlen, n;
+  const unsigned char *s;
+  int i;
+
+  if (!app->card || !app->card->serialno
+      || (app->app_local->flags.objcache_checked
+          && !app->app_local->flags.objcache_valid))
+    return NULL;
+
+  for (ocp = &objcache; (oc = *ocp); ocp = &oc->next)
+    if (oc->serialnolen == app->card->serialnolen
+        && !memcmp (oc->serialno, app->card->serialno, oc->serialnolen))
+      break;
+  if (oc && app->app_local->flags.objcache_checked)
+    return oc;
+
+  app->app_local->flags.objcache_checked = 1;
+  if (get_cached_data (app, 0x5FC102, &chuid, &chuidlen, 0))
+    return NULL;
+  s = find_tlv (chuid, chuidlen, 0x34, &n);
+  for (i=0; s && n == 16 && i < n && !s[i]; i++)
+    ;
+  if (!s || n != 16 || i == n)
+    {
+      /* No GUID - we can't tell whether this is still the same card
+       * or whether it has been re-initialized.  */
+      xfree (chuid);
+      return NULL;
+    }
+  app->app_local->flags.objcache_valid = 1;
+
+  if (oc && oc->chuidlen == chuidlen && !memcmp (oc->chuid, chuid, chuidlen))
+    {
+      xfree (chuid);
+      return oc;
+    }
+  if (oc)
+    {
+      if (opt.verbose)
+        log_info ("piv: CHUID changed - flushing the object cache\n");
+      *ocp = oc->next;
+      objcache_release (oc);
+    }
+
+  oc = xtrycalloc (1, sizeof *oc + app->card->serialnolen);
+  if (!oc)
+    {
+      xfree (chuid);
+      return NULL;
+    }
+  oc->chuid = chuid;
+  oc->chuidlen = chuidlen;
+  oc->serialnolen = app->card->serialnolen;
+  memcpy (oc->serialno, app->card->serialno, oc->serialnolen);
+  oc->next = objcache;
+  objcache = oc;
+
+  /* Drop the least recently added card if the cache is full.  */
+  for (i=1, ocp = &oc->next; *ocp; ocp = &(*ocp)->next, i++)
+    if (i == OBJCACHE_CARDS)
+      {
+        objcache_release (*ocp);
+        *ocp = NULL;
+        break;
+      }
+
+  return oc;
+}
+
+
+/* Return the item for TAG from the object cache entry OC or NULL.  */
+static struct objcache_item_s *
+objcache_find (struct objcache_s *oc, int tag)
+{
+  struct objcache_item_s *item;
+
+  for (item = oc? oc->items : NULL; item; item = item->next)
+    if (item->tag == tag)
+      return item;
+  return NULL;
+}
+
+
+/* Store DATA of LENGTH for TAG in the object cache entry OC.  */
+static void
+objcache_put (struct objcache_s *oc, int tag,
+              const unsigned char *data, size_t length)
+{
+  struct objcache_item_s *item;
+
+  if (objcache_find (oc, tag))
+    return;
+  item = xtrycalloc (1, sizeof *item + length);
+  if (!item)
+    return;
+  item->tag = tag;
+  item->length = length;
+  if (length)
+    memcpy (item->data, data, length);
+  item->next = oc->items;
+  oc->items = item;
+}
+
+
+/* Remove the item for TAG or with TAG 0 all items of the card of APP
+ * from the object cache.  */
+static void
+objcache_flush (app_t app, int tag)
+{
+  struct objcache_s *oc;
+  struct objcache_item_s *item, **itemp;
+
+  if (!app->card || !app->card->serialno)
+    return;
+  for (oc = objcache; oc; oc = oc->next)
+    if (oc->serialnolen == app->card->serialnolen
+        && !memcmp (oc->serialno, app->card->serialno, oc->serialnolen))
+      break;
+  if (!oc)
+    return;
+
+  for (itemp = &oc->items; (item = *itemp); )
+    if (!tag || item->tag == tag)
+      {
+        *itemp = item->next;
+        xfree (item->keygripstr);
+        xfree (item);
+      }
+    else
+      itemp = &item->next;
+}
+
+
 /* Wrapper around iso7816_get_data which first tries to get the data
  * from the cache.  With GET_IMMEDIATE passed as true, the cache is
  * bypassed.  The tag-53 container is also removed.  */
@@ -277,6 +493,8 @@ get_cached_data (app_t app, int tag,
   const unsigned char *s;
   size_t len, n;
   struct cache_s *c;
+  struct objcache_s *oc = NULL;
+  struct objcache_item_s *item = NULL;
 
   *result = NULL;
   *resultlen = 0;
@@ -301,19 +519,37 @@ get_cached_data (app_t app, int tag,
           }
     }
 
-  err = iso7816_get_data_odd (app_get_slot (app), 0, tag, &p, &len);
-  if (err)
-    return err;
-
-  /* Unless the Discovery Object or the BIT Group Template is
-   * requested, remove the outer container.
-   * (SP800-73.4 Part 2, section 3.1.2)   */
-  if (tag == 0x7E || tag == 0x7F61)
-    ;
-  else if (len && *p == 0x53 && (s = find_tlv (p, len, 0x53, &n)))
+  if (!get_immediate && objcache_tag_p (tag) && (oc = objcache_card (app)))
+    item = objcache_find (oc, tag);
+  if (item)
+    {
+      p = xtrymalloc (item->length + 1);
+      if (!p)
+        return gpg_error_from_syserror ();
+      memcpy (p, item->data, item->length);
+      len = item->length;
+      if (DBG_APP)
+        log_debug ("piv: DO 0x%X taken from the object cache\n", tag);
+    }
+  else
     {
-      memmove (p, s, n);
-      len = n;
+      err = iso7816_get_data_odd (app_get_slot (app), 0, tag, &p, &len);
+      if (err)
+        return err;
+
+      /* Unless the Discovery Object or the BIT Group Template is
+       * requested, remove the outer container.
+       * (SP800-73.4 Part 2, section 3.1.2)   */
+      if (tag == 0x7E || tag == 0x7F61)
+        ;
+      else if (len && *p == 0x53 && (s = find_tlv (p, len, 0x53, &n)))
+        {
+          memmove (p, s, n);
+          len = n;
+        }
+
+      if (oc)
+        objcache_put (oc, tag, p, len);
     }
 
   if (len)
@@ -358,23 +594,24 @@ get_cached_data (app_t app, int tag,
 static void
 flush_cached_data (app_t app, int tag)
 {
-  struct cache_s *c, *cprev;
+  struct cache_s *c, **cp;
+
+  objcache_flush (app, tag);
 
-  for (c=app->app_local->cache, cprev=NULL; c; cprev=c, c = c->next)
+  for (cp = &app->app_local->cache; (c = *cp); )
     if (c->tag == tag || !tag)
       {
-        if (cprev)
-          cprev->next = c->next;
-        else
-          app->app_local->cache = c->next;
+        *cp = c->next;
         xfree (c);
-
-        for (c=app->app_local->cache; c ; c = c->next)
+        if (tag)
           {
-            log_assert (c->tag != tag); /* Oops: duplicated entry. */
+            for (c=app->app_local->cache; c ; c = c->next)
+              log_assert (c->tag != tag); /* Oops: duplicated entry. */
+            return;
           }
-        return;
       }
+    else
+      cp = &c->next;
 }
 
 
@@ -1288,6 +1525,8 @@ get_keygrip_by_tag (app_t app, unsigned int tag,
   gcry_sexp_t s_pkey = NULL;
   ksba_cert_t cert = NULL;
   unsigned char grip[KEYGRIP_LEN];
+  struct objcache_s *oc;
+  struct objcache_item_s *item;
 
   *r_got_cert = 0;
   *r_keygripstr = xtrymalloc (2*KEYGRIP_LEN+1);
@@ -1297,6 +1536,17 @@ get_keygrip_by_tag (app_t app, unsigned int tag,
       goto leave;
     }
 
+  /* Computing the keygrip requires parsing the certificate; thus we
+   * also keep the keygrip in the object cache.  */
+  oc = objcache_tag_p (tag)? objcache_card (app) : NULL;
+  item = objcache_find (oc, tag);
+  if (item && item->keygripstr)
+    {
+      strcpy (*r_keygripstr, item->keygripstr);
+      *r_got_cert = item->got_cert;
+      return 0;
+    }
+
   /* We need to get the public key from the certificate.  */
   err = readcert_by_tag (app, tag, &certbuf, &certbuflen, &mechanism);
   if (err)
@@ -1334,6 +1584,12 @@ get_keygrip_by_tag (app_t app, unsigned int tag,
       err = app_help_get_keygrip_string (cert, *r_keygripstr, NULL, NULL);
     }
 
+  if (!err && (item = objcache_find (oc, tag)) && !item->keygripstr)
+    {
+      item->keygripstr = xtrystrdup (*r_keygripstr);
+      item->got_cert = !!*r_got_cert;
+    }
+
  leave:
   gcry_sexp_release (s_pkey);
   ksba_cert_release (cert);
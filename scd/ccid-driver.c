@@ -246,6 +246,12 @@ struct ccid_driver_s
 
   unsigned char intr_buf[64];
   struct libusb_transfer *transfer;
+
+  /* An asynchronous bulk in transfer submitted before the request
+     has been sent; see start_bulk_in.  */
+  struct libusb_transfer *bulk_in_transfer;
+  int bulk_in_pending;   /* The transfer has been submitted.  */
+  int bulk_in_done;      /* The transfer has completed.  */
 };
 
 
@@ -261,6 +267,7 @@ static int ccid_usb_thread_is_alive;
 
 static unsigned int compute_edc (const unsigned char *data, size_t datalen,
                                  int use_crc);
+static void cancel_bulk_in (ccid_driver_t handle);
 static int bulk_out (ccid_driver_t handle, unsigned char *msg, size_t msglen,
                      int no_debug);
 static int bulk_in (ccid_driver_t handle, unsigned char *buffer, size_t length,
@@ -1842,6 +1849,12 @@ do_close_reader (ccid_driver_t handle)
       libusb_free_transfer (handle->transfer);
       handle->transfer = NULL;
     }
+  if (handle->bulk_in_transfer)
+    {
+      cancel_bulk_in (handle);
+      libusb_free_transfer (handle->bulk_in_transfer);
+      handle->bulk_in_transfer = NULL;
+    }
   libusb_release_interface (handle->idev, handle->ifc_no);
   --ccid_usb_thread_is_alive;
   libusb_close (handle->idev);
@@ -1990,6 +2003,94 @@ bulk_out (ccid_driver_t handle, unsigned char *msg, size_t msglen,
 }
 
 
+/* Completion callback for the bulk in transfer.  */
+static void
+bulk_in_cb (struct libusb_transfer *transfer)
+{
+  ccid_driver_t handle = transfer->user_data;
+
+  handle->bulk_in_done = 1;
+}
+
+
+/* Submit a read of a maximum of LENGTH bytes from the bulk in
+   endpoint into BUFFER before the request is sent with bulk_out.
+   The next bulk_in with the same BUFFER then only needs to wait for
+   the response; this saves the delay between the end of the bulk
+   out transfer and the submission of a synchronous bulk in transfer
+   for each block.  Errors are ignored because bulk_in falls back to
+   a synchronous transfer.  */
+static void
+start_bulk_in (ccid_driver_t handle, unsigned char *buffer, size_t length,
+               int timeout)
+{
+  if (handle->bulk_in_pending)
+    return;
+  if (!handle->bulk_in_transfer)
+    {
+      handle->bulk_in_transfer = libusb_alloc_transfer (0);
+      if (!handle->bulk_in_transfer)
+        return;
+    }
+
+  memset (buffer, 0, length);
+  libusb_fill_bulk_transfer (handle->bulk_in_transfer, handle->idev,
+                             handle->ep_bulk_in, buffer, length,
+                             bulk_in_cb, handle, timeout);
+  handle->bulk_in_done = 0;
+  if (!libusb_submit_transfer (handle->bulk_in_transfer))
+    handle->bulk_in_pending = 1;
+}
+
+
+/* Wait for the bulk in transfer submitted by start_bulk_in.  Returns
+   a libusb error code and stores the length of the message at
+   R_MSGLEN.  */
+static int
+wait_bulk_in (ccid_driver_t handle, int *r_msglen)
+{
+  struct libusb_transfer *transfer = handle->bulk_in_transfer;
+
+  while (!handle->bulk_in_done)
+    {
+#ifdef USE_NPTH
+      npth_unprotect ();
+#endif
+      libusb_handle_events_completed (NULL, &handle->bulk_in_done);
+#ifdef USE_NPTH
+      npth_protect ();
+#endif
+    }
+  handle->bulk_in_pending = 0;
+
+  *r_msglen = transfer->actual_length;
+  switch (transfer->status)
+    {
+    case LIBUSB_TRANSFER_COMPLETED: return 0;
+    case LIBUSB_TRANSFER_TIMED_OUT: return LIBUSB_ERROR_TIMEOUT;
+    case LIBUSB_TRANSFER_STALL:     return LIBUSB_ERROR_PIPE;
+    case LIBUSB_TRANSFER_NO_DEVICE: return LIBUSB_ERROR_NO_DEVICE;
+    case LIBUSB_TRANSFER_OVERFLOW:  return LIBUSB_ERROR_OVERFLOW;
+    default:                        return LIBUSB_ERROR_IO;
+    }
+}
+
+
+/* Cancel a bulk in transfer submitted by start_bulk_in.  */
+static void
+cancel_bulk_in (ccid_driver_t handle)
+{
+  int msglen;
+
+  if (!handle->bulk_in_pending)
+    return;
+  if (libusb_cancel_transfer (handle->bulk_in_transfer)
+      == LIBUSB_ERROR_NOT_FOUND)
+    handle->bulk_in_done = 1;  /* Already completed.  */
+  wait_bulk_in (handle, &msglen);
+}
+
+
 /* Read a maximum of LENGTH bytes from the bulk in endpoint into
    BUFFER and return the actual read number if bytes in NREAD. SEQNO
    is the sequence number used to send the request and EXPECTED_TYPE
@@ -2009,17 +2110,28 @@ bulk_in (ccid_driver_t handle, unsigned char *buffer, size_t length,
 
   /* Fixme: The next line for the current Valgrind without support
      for USB IOCTLs. */
-  memset (buffer, 0, length);
+  if (!handle->bulk_in_pending)
+    memset (buffer, 0, length);
  retry:
 
+  if (handle->bulk_in_pending)
+    {
+      /* Take the response from the transfer started before the
+         request has been sent.  */
+      log_assert (handle->bulk_in_transfer->buffer == buffer);
+      rc = wait_bulk_in (handle, &msglen);
+    }
+  else
+    {
 #ifdef USE_NPTH
-  npth_unprotect ();
+      npth_unprotect ();
 #endif
-  rc = libusb_bulk_transfer (handle->idev, handle->ep_bulk_in,
-                             buffer, length, &msglen, bwi*timeout);
+      rc = libusb_bulk_transfer (handle->idev, handle->ep_bulk_in,
+                                 buffer, length, &msglen, bwi*timeout);
 #ifdef USE_NPTH
-  npth_protect ();
+      npth_protect ();
 #endif
+    }
   if (rc)
     {
       DEBUGOUT_1 ("usb_bulk_read error: %s\n", libusb_error_name (rc));
@@ -3193,9 +3305,15 @@ ccid_transceive (ccid_driver_t handle,
                     (!(msg[pcboff] & 0x80) && (msg[pcboff] & 0x20)?
                      " [more]":""));
 
+      if (!via_escape)
+        start_bulk_in (handle, recv_buffer, sizeof recv_buffer,
+                       (wait_more ? wait_more : 1) * CCID_CMD_TIMEOUT);
       rc = bulk_out (handle, msg, msglen, 0);
       if (rc)
-        return rc;
+        {
+          cancel_bulk_in (handle);
+          return rc;
+        }
 
       msg = recv_buffer;
       rc = bulk_in (handle, msg, sizeof recv_buffer, &msglen,
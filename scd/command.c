@@ -41,6 +41,7 @@
 #endif
 #include "../common/asshelp.h"
 #include "../common/server-help.h"
+#include "../common/metrics.h"
 
 /* Maximum length allowed as a PIN; used for INQUIRE NEEDPIN.  That
  * length needs to small compared to the maximum Assuan line length.  */
@@ -97,6 +98,9 @@ struct server_local_s
 
   /* If set to true, status change will be reported. */
   unsigned int watching_status:1;
+
+  /* The time the current command started for the metrics.  */
+  unsigned long long cmd_start;
 };
 
 
@@ -180,6 +184,35 @@ reset_notify (assuan_context_t ctx, char *line)
 }
 
 
+/* Called by libassuan before all commands.  */
+static gpg_error_t
+pre_cmd_notify (assuan_context_t ctx, const char *cmd)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)cmd;
+
+  ctrl->server_local->cmd_start = gnupg_metrics_now ();
+  return 0;
+}
+
+
+/* Called by libassuan after all commands.  */
+static void
+post_cmd_notify (assuan_context_t ctx, gpg_error_t err)
+{
+  ctrl_t ctrl = assuan_get_pointer (ctx);
+
+  (void)err;
+
+  gnupg_metrics_command_done (assuan_get_command_name (ctx),
+                              ctrl->server_local->cmd_start);
+  gnupg_trace_span (ctrl->trace_id, SCDAEMON_NAME,
+                    assuan_get_command_name (ctx),
+                    ctrl->server_local->cmd_start);
+}
+
+
 static gpg_error_t
 option_handler (assuan_context_t ctx, const char *key, const char *value)
 {
@@ -203,6 +236,11 @@ option_handler (assuan_context_t ctx, const char *key, const char *value)
       ctrl->server_local->event_signal = i;
 #endif
     }
+  else if (!strcmp (key, "trace-id"))
+    {
+      /* Log the timings of the commands with this id.  */
+      return gnupg_trace_set_id (ctrl->trace_id, value);
+    }
 
  return 0;
 }
@@ -1696,6 +1734,15 @@ cmd_unlock (assuan_context_t ctx, char *line)
 }
 
 
+/* Collector for the metrics.  */
+static void
+collect_metrics (void)
+{
+  gnupg_metric_set (gnupg_metric_gauge ("connections"),
+                    get_active_connection_count ());
+}
+
+
 static const char hlp_getinfo[] =
   "GETINFO <what>\n"
   "\n"
@@ -1706,6 +1753,7 @@ static const char hlp_getinfo[] =
   "  pid         - Return the process id of the server.\n"
   "  socket_name - Return the name of the socket.\n"
   "  connections - Return number of active connections.\n"
+  "  metrics     - Return the metrics in the Prometheus text format.\n"
   "  status      - Return the status of the current reader (in the future,\n"
   "                may also return the status of all readers).  The status\n"
   "                is a list of one-character flags.  The following flags\n"
@@ -1791,6 +1839,20 @@ cmd_getinfo (assuan_context_t ctx, char *line)
       snprintf (numbuf, sizeof numbuf, "%d", get_active_connection_count ());
       rc = assuan_send_data (ctx, numbuf, strlen (numbuf));
     }
+  else if (!strcmp (line, "metrics"))
+    {
+      char *buf;
+
+      gnupg_metrics_add_collector (collect_metrics);
+      buf = gnupg_metrics_format ("scdaemon");
+      if (!buf)
+        rc = gpg_error_from_syserror ();
+      else
+        {
+          rc = assuan_send_data (ctx, buf, strlen (buf));
+          xfree (buf);
+        }
+    }
   else if (!strcmp (line, "status"))
     {
       ctrl_t ctrl = assuan_get_pointer (ctx);
@@ -2291,6 +2353,8 @@ register_commands (assuan_context_t ctx)
 
   assuan_register_reset_notify (ctx, reset_notify);
   assuan_register_option_handler (ctx, option_handler);
+  assuan_register_pre_cmd_notify (ctx, pre_cmd_notify);
+  assuan_register_post_cmd_notify (ctx, post_cmd_notify);
   return 0;
 }
 
@@ -874,10 +874,16 @@ iso7816_get_challenge (int slot, int length, unsigned char *buffer)
   return 0;
 }
 
+/* The number of bytes we request with one READ BINARY if the entire
+   file is read using extended length.  */
+#define READ_ALL_EXT_CHUNK 2048
+
 /* Perform a READ BINARY command requesting a maximum of NMAX bytes
    from OFFSET.  With NMAX = 0 the entire file is read. The result is
    stored in a newly allocated buffer at the address passed by RESULT.
-   Returns the length of this data at the address of RESULTLEN. */
+   Returns the length of this data at the address of RESULTLEN.  If
+   the entire file is to be read without EXTENDED_MODE but the card
+   supports extended length, larger chunks are requested.  */
 gpg_error_t
 iso7816_read_binary_ext (int slot, int extended_mode,
                          size_t offset, size_t nmax,
@@ -888,6 +894,7 @@ iso7816_read_binary_ext (int slot, int extended_mode,
   size_t bufferlen;
   int read_all = !nmax;
   size_t n;
+  int auto_ext = 0;
 
   if (!result || !resultlen)
     return gpg_error (GPG_ERR_INV_VALUE);
@@ -899,14 +906,30 @@ iso7816_read_binary_ext (int slot, int extended_mode,
   if (offset > 32767)
     return gpg_error (GPG_ERR_INV_VALUE);
 
+  if (read_all && !extended_mode && apdu_ext_length_supported (slot))
+    auto_ext = 1;
+
   do
     {
       buffer = NULL;
       bufferlen = 0;
-      n = read_all? 0 : nmax;
-      sw = apdu_send_le (slot, extended_mode, 0x00, CMD_READ_BINARY,
+      n = auto_ext? READ_ALL_EXT_CHUNK : read_all? 0 : nmax;
+      sw = apdu_send_le (slot, auto_ext? 1 : extended_mode,
+                         0x00, CMD_READ_BINARY,
                          ((offset>>8) & 0xff), (offset & 0xff) , -1, NULL,
                          n, &buffer, &bufferlen);
+      if (auto_ext && (sw == SW_WRONG_LENGTH || sw == SW_HOST_NOT_SUPPORTED))
+        {
+          /* The card does not like the extended length; read this and
+             the remaining chunks as before.  */
+          xfree (buffer);
+          buffer = NULL;
+          auto_ext = 0;
+          n = 0;
+          sw = apdu_send_le (slot, extended_mode, 0x00, CMD_READ_BINARY,
+                             ((offset>>8) & 0xff), (offset & 0xff) , -1, NULL,
+                             n, &buffer, &bufferlen);
+        }
       if ( SW_EXACT_LENGTH_P(sw) )
         {
           n = (sw & 0x00ff);
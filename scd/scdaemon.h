@@ -30,6 +30,7 @@
 #include <gcrypt.h>
 #include "../common/util.h"
 #include "../common/sysutils.h"
+#include "../common/metrics.h"
 #include "app-common.h"
 
 
@@ -114,6 +115,9 @@ struct server_control_s
    * apps.  */
   apptype_t current_apptype;
 
+  /* The trace id set by the client or an empty string.  */
+  char trace_id[GNUPG_TRACE_ID_LEN+1];
+
   /* Helper to store the value we are going to sign */
   struct
   {
@@ -88,6 +88,24 @@ struct default_inq_parm_s
   assuan_context_t ctx;
 };
 
+
+/* The answers to ISTRUSTED are kept for this number of seconds.  A
+   long running server would otherwise ask the agent for the same
+   root certificates with each operation.  */
+#define TRUST_CACHE_TTL        300
+#define TRUST_CACHE_MAX_ITEMS  32
+
+struct trust_cache_s
+{
+  struct trust_cache_s *next;
+  char fpr[41];                    /* Uppercase hex fingerprint.  */
+  gpg_error_t err;                 /* 0 or GPG_ERR_NOT_TRUSTED.  */
+  struct rootca_flags_s flags;
+  time_t expires;
+};
+typedef struct trust_cache_s *trust_cache_t;
+static trust_cache_t trust_cache;
+
 
 /* Print a warning if the server's version number is less than our
    version number.  Returns an error code on a connection problem.  */
@@ -894,6 +912,43 @@ istrusted_status_cb (void *opaque, const char *line)
 
 
 
+/* Remove all cached answers to ISTRUSTED.  */
+void
+gpgsm_flush_trust_cache (void)
+{
+  while (trust_cache)
+    {
+      trust_cache_t tmp = trust_cache->next;
+      xfree (trust_cache);
+      trust_cache = tmp;
+    }
+}
+
+
+/* Return the cached answer for the fingerprint FPR or NULL.  */
+static trust_cache_t
+trust_cache_lookup (const char *fpr)
+{
+  trust_cache_t item, *itemp;
+  time_t now = gnupg_get_time ();
+  unsigned int count = 0;
+
+  for (itemp = &trust_cache; (item = *itemp); )
+    {
+      if (item->expires <= now || ++count > TRUST_CACHE_MAX_ITEMS)
+        {
+          *itemp = item->next;
+          xfree (item);
+          continue;
+        }
+      if (!ascii_strcasecmp (item->fpr, fpr))
+        return item;
+      itemp = &item->next;
+    }
+  return NULL;
+}
+
+
 /* Ask the agent whether the certificate is in the list of trusted
    keys.  The certificate is either specified by the CERT object or by
    the fingerprint HEXFPR.  ROOTCA_FLAGS is guaranteed to be cleared
@@ -904,39 +959,64 @@ gpgsm_agent_istrusted (ctrl_t ctrl, ksba_cert_t cert, const char *hexfpr,
 {
   int rc;
   char line[ASSUAN_LINELENGTH];
+  char *fpr;
+  trust_cache_t item;
 
   memset (rootca_flags, 0, sizeof *rootca_flags);
 
   if (cert && hexfpr)
     return gpg_error (GPG_ERR_INV_ARG);
 
-  rc = start_agent (ctrl);
-  if (rc)
-    return rc;
-
   if (hexfpr)
-    {
-      snprintf (line, DIM(line), "ISTRUSTED %s", hexfpr);
-    }
+    fpr = xtrystrdup (hexfpr);
   else
     {
-      char *fpr;
-
       fpr = gpgsm_get_fingerprint_hexstring (cert, GCRY_MD_SHA1);
       if (!fpr)
         {
           log_error ("error getting the fingerprint\n");
           return gpg_error (GPG_ERR_GENERAL);
         }
+    }
+  if (!fpr)
+    return gpg_error_from_syserror ();
 
-      snprintf (line, DIM(line), "ISTRUSTED %s", fpr);
+  if ((item = trust_cache_lookup (fpr)))
+    {
       xfree (fpr);
+      if (!item->err)
+        *rootca_flags = item->flags;
+      return item->err;
     }
 
+  rc = start_agent (ctrl);
+  if (rc)
+    {
+      xfree (fpr);
+      return rc;
+    }
+
+  snprintf (line, DIM(line), "ISTRUSTED %s", fpr);
   rc = assuan_transact (agent_ctx, line, NULL, NULL, NULL, NULL,
                         istrusted_status_cb, rootca_flags);
   if (!rc)
     rootca_flags->valid = 1;
+  else
+    memset (rootca_flags, 0, sizeof *rootca_flags);
+
+  /* Only definite answers are cached.  */
+  if ((!rc || gpg_err_code (rc) == GPG_ERR_NOT_TRUSTED)
+      && strlen (fpr) < sizeof item->fpr
+      && (item = xtrycalloc (1, sizeof *item)))
+    {
+      strcpy (item->fpr, fpr);
+      item->err = rc;
+      item->flags = *rootca_flags;
+      item->expires = gnupg_get_time () + TRUST_CACHE_TTL;
+      item->next = trust_cache;
+      trust_cache = item;
+    }
+  xfree (fpr);
   return rc;
 }
 
@@ -978,6 +1058,7 @@ gpgsm_agent_marktrusted (ctrl_t ctrl, ksba_cert_t cert)
 
   rc = assuan_transact (agent_ctx, line, NULL, NULL,
                         default_inq_cb, &inq_parm, NULL, NULL);
+  gpgsm_flush_trust_cache ();
   return rc;
 }
 
@@ -50,6 +50,70 @@ struct marktrusted_info_s
 static struct marktrusted_info_s *marktrusted_info;
 
 
+/* The number of seconds a successful chain validation is reused and
+   the maximum number of cached validations.  The period is short
+   because we do not learn about new CRLs or OCSP results.  */
+#define CHAIN_CACHE_TTL        300
+#define CHAIN_CACHE_MAX_ITEMS  256
+
+/* A cached successful chain validation.  */
+struct chain_cache_s
+{
+  struct chain_cache_s *next;
+  unsigned char fpr[20];   /* Fingerprint of the target certificate.  */
+  unsigned int flags;      /* The validation flags.  */
+  int use_ocsp;            /* The value of CTRL->USE_OCSP.  */
+  int offline;             /* The value of CTRL->OFFLINE.  */
+  ksba_isotime_t checktime;/* The check time for the chain model.  */
+  time_t expires;          /* The item is valid until this time.  */
+  ksba_isotime_t exptime;  /* The result of the validation.  */
+  unsigned int retflags;
+  int is_qualified;        /* -1 = unknown, 0 = no, 1 = yes.  */
+};
+typedef struct chain_cache_s *chain_cache_t;
+static chain_cache_t chain_cache;
+
+
+/* Many target certificates share the same intermediate CA
+   certificates.  To avoid checking them again and again we cache the
+   successful checks of a CA certificate against its issuer for the
+   same period as the chain validations.  */
+#define CA_CACHE_MAX_ITEMS  64
+#define CA_CACHE_SIG  1    /* The signature of the issuer is valid.  */
+#define CA_CACHE_CRL  2    /* The certificate has not been revoked.  */
+
+struct ca_cache_s
+{
+  struct ca_cache_s *next;
+  unsigned char subject_fpr[20];
+  unsigned char issuer_fpr[20];
+  unsigned int what;       /* One of the CA_CACHE_ constants.  */
+  int force_ocsp;          /* Only used for CA_CACHE_CRL.  */
+  int use_ocsp;            /* The value of CTRL->USE_OCSP.  */
+  time_t expires;          /* The item is valid until this time.  */
+};
+typedef struct ca_cache_s *ca_cache_t;
+static ca_cache_t ca_cache;
+
+
+/* Looking up the issuer of a certificate scans the key database and
+   is the major cost of validating many certificates from the same
+   CA.  Thus we remember the issuer certificates found for an issuer
+   DN and authorityKeyIdentifier.  A cached issuer is used only if it
+   passes the signature check like a freshly found one.  */
+#define ISSUER_CACHE_MAX_ITEMS  32
+
+struct issuer_cache_s
+{
+  struct issuer_cache_s *next;
+  unsigned char key[20];   /* Hash over the issuer DN and the AKI.  */
+  ksba_cert_t cert;        /* The issuer certificate.  */
+  time_t expires;          /* The item is valid until this time.  */
+};
+typedef struct issuer_cache_s *issuer_cache_t;
+static issuer_cache_t issuer_cache;
+
+
 /* While running the validation function we want to keep track of the
    certificates in the chain.  This type is used for that.  */
 struct chain_item_s
@@ -102,6 +166,305 @@ set_already_asked_marktrusted (ksba_cert_t cert)
  marktrusted_info = r;
 }
 
+/* Remove all cached chain validations.  This needs to be called if a
+   revocation or a change of the trust list has been noticed.  */
+void
+gpgsm_flush_chain_cache (void)
+{
+  while (chain_cache)
+    {
+      chain_cache_t tmp = chain_cache->next;
+      xfree (chain_cache);
+      chain_cache = tmp;
+    }
+  while (ca_cache)
+    {
+      ca_cache_t tmp = ca_cache->next;
+      xfree (ca_cache);
+      ca_cache = tmp;
+    }
+  while (issuer_cache)
+    {
+      issuer_cache_t tmp = issuer_cache->next;
+      ksba_cert_release (issuer_cache->cert);
+      xfree (issuer_cache);
+      issuer_cache = tmp;
+    }
+}
+
+
+/* Return the cached validation of the certificate with fingerprint
+   FPR for FLAGS and CHECKTIME or NULL.  */
+static chain_cache_t
+chain_cache_lookup (ctrl_t ctrl, const unsigned char *fpr,
+                    unsigned int flags, const char *checktime)
+{
+  chain_cache_t item, *itemp;
+  time_t now = gnupg_get_time ();
+  unsigned int count = 0;
+
+  if (!(flags & VALIDATE_FLAG_CHAIN_MODEL))
+    checktime = "";
+  for (itemp = &chain_cache; (item = *itemp); )
+    {
+      if (item->expires <= now || ++count > CHAIN_CACHE_MAX_ITEMS)
+        {
+          *itemp = item->next;
+          xfree (item);
+          continue;
+        }
+      if (!memcmp (item->fpr, fpr, 20) && item->flags == flags
+          && item->use_ocsp == ctrl->use_ocsp
+          && item->offline == ctrl->offline
+          && !strcmp (item->checktime, checktime))
+        {
+          /* Move to the head.  */
+          *itemp = item->next;
+          item->next = chain_cache;
+          chain_cache = item;
+          return item;
+        }
+      itemp = &item->next;
+    }
+  return NULL;
+}
+
+
+/* Store the successful validation of CERT with fingerprint FPR.  The
+   item expires after CHAIN_CACHE_TTL seconds but not later than the
+   chain itself as given by EXPTIME.  */
+static void
+chain_cache_put (ctrl_t ctrl, ksba_cert_t cert, const unsigned char *fpr,
+                 unsigned int flags, const char *checktime,
+                 const ksba_isotime_t exptime, unsigned int retflags)
+{
+  chain_cache_t item;
+  ksba_isotime_t current_time;
+  time_t expires, exp_epoch;
+  char buf[1];
+  size_t buflen;
+
+  /* The validation is not valid after the nearest expiration.  */
+  gnupg_get_isotime (current_time);
+  if (*exptime && strcmp (exptime, current_time) <= 0)
+    return;
+  expires = gnupg_get_time () + CHAIN_CACHE_TTL;
+  if (*exptime)
+    {
+      exp_epoch = isotime2epoch (exptime);
+      if (exp_epoch == (time_t)(-1))
+        return;
+      if (exp_epoch < expires)
+        expires = exp_epoch;
+    }
+
+  item = xtrycalloc (1, sizeof *item);
+  if (!item)
+    return;
+  memcpy (item->fpr, fpr, 20);
+  item->flags = flags;
+  item->use_ocsp = ctrl->use_ocsp;
+  item->offline = ctrl->offline;
+  if ((flags & VALIDATE_FLAG_CHAIN_MODEL))
+    gnupg_copy_time (item->checktime, checktime);
+  item->expires = expires;
+  gnupg_copy_time (item->exptime, exptime);
+  item->retflags = retflags;
+  if (!ksba_cert_get_user_data (cert, "is_qualified", buf, 1, &buflen)
+      && buflen)
+    item->is_qualified = !!*buf;
+  else
+    item->is_qualified = -1;
+  item->next = chain_cache;
+  chain_cache = item;
+}
+
+
+/* Compute the fingerprints of SUBJECT and ISSUER for the CA cache.
+   Returns false on error.  */
+static int
+ca_cache_fprs (ksba_cert_t subject, ksba_cert_t issuer,
+               unsigned char *subject_fpr, unsigned char *issuer_fpr)
+{
+  return (gpgsm_get_fingerprint (subject, GCRY_MD_SHA1, subject_fpr, NULL)
+          && gpgsm_get_fingerprint (issuer, GCRY_MD_SHA1, issuer_fpr, NULL));
+}
+
+
+/* Return true if the check WHAT of the CA certificate SUBJECT against
+   ISSUER has been cached.  */
+static int
+ca_cache_lookup (ctrl_t ctrl, ksba_cert_t subject, ksba_cert_t issuer,
+                 unsigned int what, int force_ocsp)
+{
+  unsigned char subject_fpr[20], issuer_fpr[20];
+  ca_cache_t item, *itemp;
+  time_t now;
+  unsigned int count = 0;
+
+  if (!ca_cache || !ca_cache_fprs (subject, issuer, subject_fpr, issuer_fpr))
+    return 0;
+  now = gnupg_get_time ();
+  for (itemp = &ca_cache; (item = *itemp); )
+    {
+      if (item->expires <= now || ++count > CA_CACHE_MAX_ITEMS)
+        {
+          *itemp = item->next;
+          xfree (item);
+          continue;
+        }
+      if (item->what == what
+          && !memcmp (item->subject_fpr, subject_fpr, 20)
+          && !memcmp (item->issuer_fpr, issuer_fpr, 20)
+          && (what != CA_CACHE_CRL
+              || (item->force_ocsp == force_ocsp
+                  && item->use_ocsp == ctrl->use_ocsp)))
+        return 1;
+      itemp = &item->next;
+    }
+  return 0;
+}
+
+
+/* Store the successful check WHAT of the CA certificate SUBJECT
+   against ISSUER.  */
+static void
+ca_cache_put (ctrl_t ctrl, ksba_cert_t subject, ksba_cert_t issuer,
+              unsigned int what, int force_ocsp)
+{
+  ca_cache_t item;
+
+  item = xtrycalloc (1, sizeof *item);
+  if (!item)
+    return;
+  if (!ca_cache_fprs (subject, issuer, item->subject_fpr, item->issuer_fpr))
+    {
+      xfree (item);
+      return;
+    }
+  item->what = what;
+  item->force_ocsp = force_ocsp;
+  item->use_ocsp = ctrl->use_ocsp;
+  item->expires = gnupg_get_time () + CHAIN_CACHE_TTL;
+  item->next = ca_cache;
+  ca_cache = item;
+}
+
+
+/* Compute the key for the issuer cache from the ISSUER DN and the
+   authorityKeyIdentifier of CERT.  Returns false on error.  */
+static int
+issuer_cache_key (ksba_cert_t cert, const char *issuer, unsigned char *key)
+{
+  gcry_md_hd_t md;
+  ksba_name_t authid;
+  ksba_sexp_t authidno;
+  ksba_sexp_t keyid;
+  const char *s;
+
+  if (gcry_md_open (&md, GCRY_MD_SHA1, 0))
+    return 0;
+  gcry_md_write (md, issuer, strlen (issuer) + 1);
+  if (!ksba_cert_get_auth_key_id (cert, &keyid, &authid, &authidno))
+    {
+      if (keyid)
+        gcry_md_write (md, keyid, gcry_sexp_canon_len (keyid, 0, NULL, NULL));
+      gcry_md_putc (md, 0);
+      s = ksba_name_enum (authid, 0);
+      if (s)
+        gcry_md_write (md, s, strlen (s) + 1);
+      if (authidno)
+        gcry_md_write (md, authidno,
+                       gcry_sexp_canon_len (authidno, 0, NULL, NULL));
+      xfree (keyid);
+      ksba_name_release (authid);
+      xfree (authidno);
+    }
+  memcpy (key, gcry_md_read (md, GCRY_MD_SHA1), 20);
+  gcry_md_close (md);
+  return 1;
+}
+
+
+/* Return a new reference to the cached issuer certificate for CERT
+   with the issuer DN ISSUER or NULL.  */
+static ksba_cert_t
+issuer_cache_lookup (ksba_cert_t cert, const char *issuer)
+{
+  unsigned char key[20];
+  issuer_cache_t item, *itemp;
+  time_t now;
+  unsigned int count = 0;
+
+  if (!issuer_cache || !issuer_cache_key (cert, issuer, key))
+    return NULL;
+  now = gnupg_get_time ();
+  for (itemp = &issuer_cache; (item = *itemp); )
+    {
+      if (item->expires <= now || ++count > ISSUER_CACHE_MAX_ITEMS)
+        {
+          *itemp = item->next;
+          ksba_cert_release (item->cert);
+          xfree (item);
+          continue;
+        }
+      if (!memcmp (item->key, key, 20))
+        {
+          ksba_cert_ref (item->cert);
+          return item->cert;
+        }
+      itemp = &item->next;
+    }
+  return NULL;
+}
+
+
+/* Remove the cached issuer certificate for CERT with the issuer DN
+   ISSUER.  */
+static void
+issuer_cache_remove (ksba_cert_t cert, const char *issuer)
+{
+  unsigned char key[20];
+  issuer_cache_t item, *itemp;
+
+  if (!issuer_cache || !issuer_cache_key (cert, issuer, key))
+    return;
+  for (itemp = &issuer_cache; (item = *itemp); itemp = &item->next)
+    if (!memcmp (item->key, key, 20))
+      {
+        *itemp = item->next;
+        ksba_cert_release (item->cert);
+        xfree (item);
+        return;
+      }
+}
+
+
+/* Store ISSUER_CERT as the issuer certificate for CERT with the
+   issuer DN ISSUER.  */
+static void
+issuer_cache_put (ksba_cert_t cert, const char *issuer,
+                  ksba_cert_t issuer_cert)
+{
+  issuer_cache_t item;
+
+  issuer_cache_remove (cert, issuer);
+  item = xtrycalloc (1, sizeof *item);
+  if (!item)
+    return;
+  if (!issuer_cache_key (cert, issuer, item->key))
+    {
+      xfree (item);
+      return;
+    }
+  ksba_cert_ref (issuer_cert);
+  item->cert = issuer_cert;
+  item->expires = gnupg_get_time () + CHAIN_CACHE_TTL;
+  item->next = issuer_cache;
+  issuer_cache = item;
+}
+
+
 /* If LISTMODE is true, print FORMAT using LISTMODE to FP.  If
    LISTMODE is false, use the string to print an log_info or, if
    IS_ERROR is true, and log_error. */
@@ -1226,6 +1589,7 @@ is_cert_still_valid (ctrl_t ctrl, int force_ocsp, int lm, estream_t fp,
         case GPG_ERR_CERT_REVOKED:
           do_list (1, lm, fp, _("certificate has been revoked"));
           *any_revoked = 1;
+          gpgsm_flush_chain_cache ();
           /* Store that in the keybox so that key listings are able to
              return the revoked flag.  We don't care about error,
              though. */
@@ -1261,6 +1625,41 @@ is_cert_still_valid (ctrl_t ctrl, int force_ocsp, int lm, estream_t fp,
 }
 
 
+/* Same as is_cert_still_valid but for a CA certificate SUBJECT_CERT;
+   a successful check is taken from or put into the CA cache.  */
+static gpg_error_t
+is_ca_cert_still_valid (ctrl_t ctrl, int force_ocsp, int lm, estream_t fp,
+                        ksba_cert_t subject_cert, ksba_cert_t issuer_cert,
+                        int *any_revoked, int *any_no_crl,
+                        int *any_crl_too_old)
+{
+  gpg_error_t err;
+  int revoked = 0;
+  int no_crl = 0;
+  int crl_too_old = 0;
+  int use_cache;
+
+  /* Listings and the audit log want to see each check.  */
+  use_cache = (!lm && !ctrl->audit && !ctrl->offline);
+  if (use_cache && ca_cache_lookup (ctrl, subject_cert, issuer_cert,
+                                    CA_CACHE_CRL, force_ocsp))
+    return 0;
+
+  err = is_cert_still_valid (ctrl, force_ocsp, lm, fp,
+                             subject_cert, issuer_cert,
+                             &revoked, &no_crl, &crl_too_old);
+  if (use_cache && !err && !revoked && !no_crl && !crl_too_old)
+    ca_cache_put (ctrl, subject_cert, issuer_cert, CA_CACHE_CRL, force_ocsp);
+  if (revoked)
+    *any_revoked = 1;
+  if (no_crl)
+    *any_no_crl = 1;
+  if (crl_too_old)
+    *any_crl_too_old = 1;
+  return err;
+}
+
+
 /* Helper for gpgsm_validate_chain to check the validity period of
    SUBJECT_CERT.  The caller needs to pass EXPTIME which will be
    updated to the nearest expiration time seen.  A DEPTH of 0 indicates
@@ -1453,6 +1852,7 @@ ask_marktrusted (ctrl_t ctrl, ksba_cert_t cert, int listmode)
   if (!rc)
     {
       log_info (_("root certificate has now been marked as trusted\n"));
+      gpgsm_flush_chain_cache ();
       success = 1;
     }
   else if (!listmode)
@@ -1520,6 +1920,7 @@ do_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime_arg,
                             from a qualified root certificate.
                             -1 = unknown, 0 = no, 1 = yes. */
   chain_item_t chain = NULL; /* A list of all certificates in the chain.  */
+  int issuer_cached;         /* ISSUER_CERT is from the issuer cache.  */
 
 
   gnupg_get_isotime (current_time);
@@ -1771,6 +2172,13 @@ do_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime_arg,
             ; /* Fixme: check revocations via DNS.  */
           else if (opt.no_trusted_cert_crl_check || rootca_flags->relax)
             ;
+          else if (depth)
+            rc = is_ca_cert_still_valid (ctrl,
+                                         (flags & VALIDATE_FLAG_CHAIN_MODEL),
+                                         listmode, listfp,
+                                         subject_cert, subject_cert,
+                                         &any_revoked, &any_no_crl,
+                                         &any_crl_too_old);
           else
             rc = is_cert_still_valid (ctrl,
                                       (flags & VALIDATE_FLAG_CHAIN_MODEL),
@@ -1794,6 +2202,15 @@ do_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime_arg,
         }
 
       /* Find the next cert up the tree. */
+      issuer_cert = issuer_cache_lookup (subject_cert, issuer);
+      issuer_cached = !!issuer_cert;
+      if (issuer_cached)
+        {
+          if (DBG_X509)
+            log_debug ("  found in the issuer cache\n");
+          goto try_another_cert;
+        }
+    find_issuer:
       keydb_search_reset (kh);
       rc = find_up (ctrl, kh, subject_cert, issuer, 0);
       if (rc)
@@ -1830,7 +2247,26 @@ do_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime_arg,
           gpgsm_dump_cert ("issuer", issuer_cert);
         }
 
-      rc = gpgsm_check_cert_sig (issuer_cert, subject_cert);
+      /* The signature on a CA certificate has likely been checked
+         while validating another certificate.  */
+      if (depth && ca_cache_lookup (ctrl, subject_cert, issuer_cert,
+                                    CA_CACHE_SIG, 0))
+        rc = 0;
+      else
+        {
+          rc = gpgsm_check_cert_sig (issuer_cert, subject_cert);
+          if (!rc && depth)
+            ca_cache_put (ctrl, subject_cert, issuer_cert, CA_CACHE_SIG, 0);
+        }
+      if (rc && issuer_cached)
+        {
+          /* Do a regular search instead of using the cached issuer.  */
+          issuer_cache_remove (subject_cert, issuer);
+          issuer_cached = 0;
+          goto find_issuer;
+        }
+      if (!rc && !issuer_cached)
+        issuer_cache_put (subject_cert, issuer, issuer_cert);
       if (rc)
         {
           do_list (0, listmode, listfp, _("certificate has a BAD signature"));
@@ -1955,6 +2391,13 @@ do_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime_arg,
       else if (is_root && (opt.no_trusted_cert_crl_check
                            || (!istrusted_rc && rootca_flags->relax)))
         rc = 0;
+      else if (depth)
+        rc = is_ca_cert_still_valid (ctrl,
+                                     (flags & VALIDATE_FLAG_CHAIN_MODEL),
+                                     listmode, listfp,
+                                     subject_cert, issuer_cert,
+                                     &any_revoked, &any_no_crl,
+                                     &any_crl_too_old);
       else
         rc = is_cert_still_valid (ctrl,
                                   (flags & VALIDATE_FLAG_CHAIN_MODEL),
@@ -2122,6 +2565,10 @@ gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime,
   int rc;
   struct rootca_flags_s rootca_flags;
   unsigned int dummy_retflags;
+  unsigned char fpr[20];
+  int use_cache;
+  chain_cache_t item;
+  ksba_isotime_t exptime;
 
   if (!retflags)
     retflags = &dummy_retflags;
@@ -2137,10 +2584,34 @@ gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime,
      RETFLAGS.  */
   *retflags = (flags & VALIDATE_FLAG_CHAIN_MODEL);
 
+  /* A successful validation of the same certificate is reused for a
+     short time.  We don't do this in list mode or with auditing
+     because these need the details of the chain.  */
+  use_cache = (!listmode && !ctrl->audit && !opt.no_chain_validation
+               && checktime
+               && gpgsm_get_fingerprint (cert, GCRY_MD_SHA1, fpr, NULL));
+  if (use_cache
+      && (item = chain_cache_lookup (ctrl, fpr, flags, checktime)))
+    {
+      if (r_exptime)
+        gnupg_copy_time (r_exptime, item->exptime);
+      *retflags = item->retflags;
+      if (item->is_qualified != -1)
+        {
+          char buf[1];
+
+          buf[0] = item->is_qualified;
+          ksba_cert_set_user_data (cert, "is_qualified", buf, 1);
+        }
+      if (opt.verbose)
+        log_info ("using cached chain validation\n");
+      return 0;
+    }
+
   memset (&rootca_flags, 0, sizeof rootca_flags);
 
   rc = do_validate_chain (ctrl, cert, checktime,
-                          r_exptime, listmode, listfp, flags,
+                          exptime, listmode, listfp, flags,
                           &rootca_flags);
   if (!rc && (flags & VALIDATE_FLAG_STEED))
     {
@@ -2152,7 +2623,7 @@ gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime,
     {
       do_list (0, listmode, listfp, _("switching to chain model"));
       rc = do_validate_chain (ctrl, cert, checktime,
-                              r_exptime, listmode, listfp,
+                              exptime, listmode, listfp,
                               (flags |= VALIDATE_FLAG_CHAIN_MODEL),
                               &rootca_flags);
       *retflags |= VALIDATE_FLAG_CHAIN_MODEL;
@@ -2165,6 +2636,15 @@ gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert, ksba_isotime_t checktime,
              (*retflags & VALIDATE_FLAG_CHAIN_MODEL)?
              _("chain"):_("shell"));
 
+  if (r_exptime)
+    gnupg_copy_time (r_exptime, exptime);
+  /* FLAGS now has the model actually used.  Thus a result of the
+     switch to the chain model is stored for the chain model and the
+     check time and won't be used for a later shell model check.  */
+  if (!rc && use_cache)
+    chain_cache_put (ctrl, cert, fpr, flags, checktime, exptime,
+                     *retflags);
+
   return rc;
 }
 
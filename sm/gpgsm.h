@@ -220,6 +220,12 @@ struct server_control_s
 
   keydb_local_t keydb_local;  /* Local data for call-keyboxd.c  */
 
+  /* The handle used by keydb_store_cert during a batch, a flag
+   * telling that it is currently in use and the nesting level.  */
+  struct keydb_handle *store_kh;
+  int store_kh_used;
+  int store_kh_depth;
+
   audit_ctx_t audit;  /* NULL or a context for the audit subsystem.  */
   int agent_seen;     /* Flag indicating that the gpg-agent has been
                          accessed.  */
@@ -368,6 +374,7 @@ int gpgsm_validate_chain (ctrl_t ctrl, ksba_cert_t cert,
                           int listmode, estream_t listfp,
                           unsigned int flags, unsigned int *retflags);
 int gpgsm_basic_cert_check (ctrl_t ctrl, ksba_cert_t cert);
+void gpgsm_flush_chain_cache (void);
 
 /*-- certlist.c --*/
 int gpgsm_cert_use_sign_p (ksba_cert_t cert, int silent);
@@ -453,6 +460,7 @@ int gpgsm_agent_readkey (ctrl_t ctrl, int fromcard, const char *hexkeygrip,
                          ksba_sexp_t *r_pubkey);
 int gpgsm_agent_scd_serialno (ctrl_t ctrl, char **r_serialno);
 int gpgsm_agent_scd_keypairinfo (ctrl_t ctrl, strlist_t *r_list);
+void gpgsm_flush_trust_cache (void);
 int gpgsm_agent_istrusted (ctrl_t ctrl, ksba_cert_t cert, const char *hexfpr,
                            struct rootca_flags_s *rootca_flags);
 int gpgsm_agent_havekey (ctrl_t ctrl, const char *hexkeygrip);
@@ -520,8 +520,11 @@ gpgsm_import (ctrl_t ctrl, int in_fd, int reimport_mode)
   memset (&stats, 0, sizeof stats);
   if (reimport_mode)
     rc = reimport_one (ctrl, &stats, in_fd);
-  else
-    rc = import_one (ctrl, &stats, in_fd);
+  else if (!(rc = keydb_store_batch_begin (ctrl)))
+    {
+      rc = import_one (ctrl, &stats, in_fd);
+      keydb_store_batch_end (ctrl);
+    }
   print_imported_summary (ctrl, &stats);
   /* If we never printed an error message do it now so that a command
      line invocation will return with an error (log_error keeps a
@@ -541,7 +544,11 @@ gpgsm_import_files (ctrl_t ctrl, int nfiles, char **files,
 
   memset (&stats, 0, sizeof stats);
 
-  if (!nfiles)
+  /* Store all certificates of all files using one key DB handle.  */
+  rc = keydb_store_batch_begin (ctrl);
+  if (rc)
+    ;
+  else if (!nfiles)
     rc = import_one (ctrl, &stats, 0);
   else
     {
@@ -554,6 +561,7 @@ gpgsm_import_files (ctrl_t ctrl, int nfiles, char **files,
             rc = 0;
         }
     }
+  keydb_store_batch_end (ctrl);
   print_imported_summary (ctrl, &stats);
   /* If we never printed an error message do it now so that a command
      line invocation will return with an error (log_error keeps a
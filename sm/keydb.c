@@ -445,13 +445,15 @@ keydb_add_resource (ctrl_t ctrl, const char *url, int force, int *auto_created)
             all_resources[used_resources].u.kr = NULL; /* Not used here */
             all_resources[used_resources].token = token;
 
-            /* Do a compress run if needed and the keybox is not locked. */
+            /* Do a compress run if needed and the keybox is not
+             * locked.  Other processes may update the keybox while
+             * the run copies it.  */
             kbxhd = keybox_new_x509 (token, 0);
             if (kbxhd)
               {
                 if (!keybox_lock (kbxhd, 1, 0))
                   {
-                    keybox_compress (kbxhd);
+                    keybox_compress_incremental (kbxhd);
                     keybox_lock (kbxhd, 0, 0);
                   }
 
@@ -1891,6 +1893,50 @@ keydb_search_subject (ctrl_t ctrl, KEYDB_HANDLE hd, const char *name)
 
 
 
+/* Start a batch of keydb_store_cert calls.  Until keydb_store_batch_end
+ * is called all certificates are stored using the same handle.  This
+ * avoids opening the key DB for each certificate and, because the
+ * handle stays open, writing the keybox index after each insert.
+ * The lock is still only held during each store operation so that
+ * other processes and other handles of this process may update the
+ * key DB in between.  */
+gpg_error_t
+keydb_store_batch_begin (ctrl_t ctrl)
+{
+  if (ctrl->store_kh)
+    {
+      /* Nested batches are merged.  */
+      ctrl->store_kh_depth++;
+      return 0;
+    }
+
+  ctrl->store_kh = keydb_new (ctrl);
+  if (!ctrl->store_kh)
+    {
+      log_error (_("failed to allocate keyDB handle\n"));
+      return gpg_error (GPG_ERR_ENOMEM);
+    }
+  ctrl->store_kh_used = 0;
+  return 0;
+}
+
+
+/* End a batch started with keydb_store_batch_begin.  */
+void
+keydb_store_batch_end (ctrl_t ctrl)
+{
+  if (!ctrl->store_kh)
+    return;
+  if (ctrl->store_kh_depth)
+    {
+      ctrl->store_kh_depth--;
+      return;
+    }
+  keydb_release (ctrl->store_kh);
+  ctrl->store_kh = NULL;
+}
+
+
 /* Store the certificate in the key DB but make sure that it does not
    already exists.  We do this simply by comparing the fingerprint.
    If EXISTED is not NULL it will be set to true if the certificate
@@ -1911,11 +1957,22 @@ keydb_store_cert (ctrl_t ctrl, ksba_cert_t cert, int ephemeral, int *existed)
       return gpg_error (GPG_ERR_GENERAL);
     }
 
-  kh = keydb_new (ctrl);
-  if (!kh)
+  /* Use the handle of a batch unless it is already used by an outer
+   * call which is possible if storing triggers another store.  */
+  if (ctrl->store_kh && !ctrl->store_kh_used)
     {
-      log_error (_("failed to allocate keyDB handle\n"));
-      return gpg_error (GPG_ERR_ENOMEM);;
+      kh = ctrl->store_kh;
+      ctrl->store_kh_used = 1;
+      keydb_search_reset (kh);
+    }
+  else
+    {
+      kh = keydb_new (ctrl);
+      if (!kh)
+        {
+          log_error (_("failed to allocate keyDB handle\n"));
+          return gpg_error (GPG_ERR_ENOMEM);;
+        }
     }
 
   /* Set the ephemeral flag so that the search looks at all
@@ -1926,13 +1983,13 @@ keydb_store_cert (ctrl_t ctrl, ksba_cert_t cert, int ephemeral, int *existed)
     {
       rc = lock_all (kh);
       if (rc)
-        return rc;
+        goto leave;
     }
 
   rc = keydb_search_fpr (ctrl, kh, fpr);
   if (gpg_err_code (rc) != GPG_ERR_NOT_FOUND)
     {
-      keydb_release (kh);
+      unlock_all (kh);
       if (!rc)
         {
           if (existed)
@@ -1947,14 +2004,14 @@ keydb_store_cert (ctrl_t ctrl, ksba_cert_t cert, int ephemeral, int *existed)
                 {
                   log_error ("clearing ephemeral flag failed: %s\n",
                              gpg_strerror (rc));
-                  return rc;
+                  goto leave;
                 }
             }
-          return 0; /* okay */
+          goto leave; /* okay */
         }
       log_error (_("problem looking for existing certificate: %s\n"),
                  gpg_strerror (rc));
-      return rc;
+      goto leave;
     }
 
   /* Reset the ephemeral flag if not requested.  */
@@ -1965,19 +2022,25 @@ keydb_store_cert (ctrl_t ctrl, ksba_cert_t cert, int ephemeral, int *existed)
   if (rc)
     {
       log_error (_("error finding writable keyDB: %s\n"), gpg_strerror (rc));
-      keydb_release (kh);
-      return rc;
+      goto leave;
     }
 
   rc = keydb_insert_cert (kh, cert);
   if (rc)
     {
       log_error (_("error storing certificate: %s\n"), gpg_strerror (rc));
-      keydb_release (kh);
-      return rc;
+      goto leave;
     }
-  keydb_release (kh);
-  return 0;
+
+ leave:
+  if (kh == ctrl->store_kh)
+    {
+      unlock_all (kh);
+      ctrl->store_kh_used = 0;
+    }
+  else
+    keydb_release (kh);
+  return rc;
 }
 
 
@@ -66,6 +66,8 @@ int keydb_search_issuer_sn (ctrl_t ctrl, KEYDB_HANDLE hd,
                             const char *issuer, const unsigned char *serial);
 int keydb_search_subject (ctrl_t ctrl, KEYDB_HANDLE hd, const char *issuer);
 
+gpg_error_t keydb_store_batch_begin (ctrl_t ctrl);
+void keydb_store_batch_end (ctrl_t ctrl);
 int keydb_store_cert (ctrl_t ctrl, ksba_cert_t cert, int ephemeral,
                       int *existed);
 gpg_error_t keydb_set_cert_flags (ctrl_t ctrl, ksba_cert_t cert, int ephemeral,
@@ -1277,6 +1277,25 @@ cmd_passwd (assuan_context_t ctx, char *line)
 }
 
 
+static const char hlp_flushcaches[] =
+  "FLUSHCACHES\n"
+  "\n"
+  "Remove all cached chain validations and answers of the gpg-agent\n"
+  "about trusted root certificates.  A long running server keeps them\n"
+  "for a few minutes; this command may be used after the trust list\n"
+  "or a CRL has been changed.";
+static gpg_error_t
+cmd_flushcaches (assuan_context_t ctx, char *line)
+{
+  (void)ctx;
+  (void)line;
+
+  gpgsm_flush_chain_cache ();
+  gpgsm_flush_trust_cache ();
+  return 0;
+}
+
+
 
 /* Return true if the command CMD implements the option OPT.  */
 static int
@@ -1321,6 +1340,7 @@ register_commands (assuan_context_t ctx)
     { "GETAUDITLOG",   cmd_getauditlog,    hlp_getauditlog },
     { "GETINFO",       cmd_getinfo,   hlp_getinfo },
     { "PASSWD",        cmd_passwd,    hlp_passwd },
+    { "FLUSHCACHES",   cmd_flushcaches, hlp_flushcaches },
     { NULL }
   };
   int i, rc;
@@ -44,6 +44,7 @@
 #include "../../common/util.h"
 #include "../../common/exechelp.h"
 #include "../../common/sysutils.h"
+#include "../../common/metrics.h"
 
 #include "private.h"
 #include "ffi.h"
@@ -532,6 +533,15 @@ do_get_time (scheme *sc, pointer args)
   FFI_RETURN_INT (sc, gnupg_get_time ());
 }
 
+/* Return a monotonic timestamp in microseconds.  */
+static pointer
+do_get_monotonic_time (scheme *sc, pointer args)
+{
+  FFI_PROLOG ();
+  FFI_ARGS_DONE_OR_RETURN (sc, args);
+  FFI_RETURN_INT (sc, gnupg_metrics_now ());
+}
+
 static pointer
 do_getpid (scheme *sc, pointer args)
 {
@@ -1382,6 +1392,7 @@ ffi_init (scheme *sc, const char *argv0, const char *scriptname,
   ffi_define_function (sc, rmdir);
   ffi_define_function (sc, get_isotime);
   ffi_define_function (sc, get_time);
+  ffi_define_function (sc, get_monotonic_time);
   ffi_define_function (sc, getpid);
 
   /* Random numbers.  */
@@ -0,0 +1,209 @@
+#!/usr/bin/env gpgscm
+
+;; Copyright (C) 2026 g10 Code GmbH
+;;
+;; This file is part of GnuPG.
+;;
+;; GnuPG is free software; you can redistribute it and/or modify
+;; it under the terms of the GNU General Public License as published by
+;; the Free Software Foundation; either version 3 of the License, or
+;; (at your option) any later version.
+;;
+;; GnuPG is distributed in the hope that it will be useful,
+;; but WITHOUT ANY WARRANTY; without even the implied warranty of
+;; MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+;; GNU General Public License for more details.
+;;
+;; You should have received a copy of the GNU General Public License
+;; along with this program; if not, see <http://www.gnu.org/licenses/>.
+
+;; Throughput benchmark for the OpenPGP pipeline.  This is not part
+;; of the test suite; run it using 'make bench'.  The results are
+;; printed as lines of the form
+;;
+;;   bench: NAME VALUE UNIT
+;;
+;; The benchmark can be tuned using these environment variables:
+;;
+;;   BENCH_SIZE      The size of the bulk data in MiB (default 8).
+;;   BENCH_OPS       The number of sign and verify operations (default 20).
+;;   BENCH_KEYS      A comma separated list of keyring sizes for the
+;;                   import and listing benchmark (default 1000).
+;;                   Generating the keyrings is slow; they are kept as
+;;                   bench-keys-N.gpg in the build directory and
+;;                   reused by later runs.
+;;   BENCH_BASELINE  The saved output of an earlier run.  If given,
+;;                   the change against that run is appended to each
+;;                   line.
+
+(load (in-srcdir "tests" "openpgp" "defs.scm"))
+(setup-legacy-environment)
+
+(define bench-size (string->number (getenv' "BENCH_SIZE" "8")))
+(define bench-ops (string->number (getenv' "BENCH_OPS" "20")))
+(define bench-keys (map string->number
+			(string-split (getenv' "BENCH_KEYS" "1000") #\,)))
+
+;; Read the results of an earlier run as a list of (NAME VALUE).
+(define bench-baseline
+  (let ((name (getenv "BENCH_BASELINE")))
+    (if (string=? name "")
+	'()
+	(let loop ((lines (string-split-newlines
+			   (call-with-input-file name read-all)))
+		   (acc '()))
+	  (if (null? lines)
+	      acc
+	      (let ((f (filter (lambda (s) (not (string=? s "")))
+			       (string-split (car lines) #\space))))
+		(loop (cdr lines)
+		      (if (and (>= (length f) 3) (string=? (car f) "bench:"))
+			  (cons (list (cadr f) (string->number (caddr f)))
+				acc)
+			  acc))))))))
+
+;; Return the time in microseconds it takes to call THUNK.
+(define (bench-time thunk)
+  (let ((start (get-monotonic-time)))
+    (thunk)
+    (max 1 (- (get-monotonic-time) start))))
+
+;; Round X to two decimal places.
+(define (bench-round x)
+  (/ (round (* x 100)) 100.0))
+
+;; Report that AMOUNT UNITs have been processed in USECS microseconds.
+(define (bench-report name amount unit usecs)
+  (let* ((value (bench-round (/ (* amount 1000000.0) usecs)))
+	 (base (assoc name bench-baseline)))
+    (if (and base (cadr base) (> (cadr base) 0))
+	(info "bench:" name value unit
+	      (string-append "(baseline " (number->string (cadr base)) ", "
+			     (number->string
+			      (bench-round (* 100 (- (/ value (cadr base)) 1))))
+			     "%)"))
+	(info "bench:" name value unit))))
+
+;; Run the gpg command ARGS and return the elapsed time.
+(define (bench-gpg args)
+  (bench-time (lambda () (call-check `(,@GPG --yes ,@args)))))
+
+;;
+;; Bulk data.
+;;
+
+(define bulk "bench-data")
+(define bulk-mib bench-size)
+(make-test-data bulk (* bench-size 1024 1024))
+
+;; Encrypt BULK using ARGS and report the encryption and decryption
+;; throughput as NAME.
+(define (bench-encrypt name args)
+  (bench-report (string-append "encrypt-" name) bulk-mib "MB/s"
+		(bench-gpg `(--output bench.gpg --encrypt --recipient ,usrname2
+				      --compress-algo none ,@args ,bulk)))
+  (bench-report (string-append "decrypt-" name) bulk-mib "MB/s"
+		(bench-gpg '(--output bench.out --decrypt bench.gpg)))
+  (unless (file=? bulk "bench.out")
+	  (fail "decrypted data differ")))
+
+(bench-encrypt "cfb-mdc" '())
+(bench-encrypt "aead-ocb" '(--force-aead --aead-algo ocb))
+(bench-encrypt "aead-eax" '(--force-aead --aead-algo eax))
+
+(bench-report "enarmor" bulk-mib "MB/s"
+	      (bench-gpg `(--output bench.asc --enarmor ,bulk)))
+(bench-report "dearmor" bulk-mib "MB/s"
+	      (bench-gpg '(--output bench.out --dearmor bench.asc)))
+
+;; The armored data is compressible, unlike the random bulk data.
+(define (bench-compress algo name)
+  (bench-report (string-append "compress-" name) bulk-mib "MB/s"
+		(bench-gpg `(--output bench.gpg --store
+				      --compress-algo ,algo bench.asc)))
+  (bench-report (string-append "decompress-" name) bulk-mib "MB/s"
+		(bench-gpg '(--output bench.out --decrypt bench.gpg))))
+
+(for-each (lambda (algo)
+	    (if (have-compression-algo? (car algo))
+		(apply bench-compress algo)))
+	  '(("ZLIB" "zlib") ("BZIP2" "bzip2")))
+
+;;
+;; Signatures on small messages.
+;;
+
+(define (repeat n thunk)
+  (if (> n 0)
+      (begin (thunk) (repeat (- n 1) thunk))))
+
+(bench-report "sign" bench-ops "ops/s"
+	      (bench-time
+	       (lambda ()
+		 (repeat bench-ops
+			 (lambda ()
+			   (call-check `(,@GPG --yes --output bench.sig
+					       --local-user ,usrname1
+					       --sign plain-1)))))))
+(bench-report "verify" bench-ops "ops/s"
+	      (bench-time
+	       (lambda ()
+		 (repeat bench-ops
+			 (lambda ()
+			   (call-check `(,@GPG --output bench.out
+					       --verify bench.sig)))))))
+
+;;
+;; Import and listing of large keyrings.
+;;
+
+;; Return the name of a keyring with N keys, creating it if needed.
+(define (bench-keyring n)
+  (let ((name (path-join (getenv "objdir") "tests" "openpgp"
+			 (string-append "bench-keys-" (number->string n)
+					".gpg"))))
+    (unless (file-exists? name)
+	    (info "Generating" n "keys; this may take a while...")
+	    (call-with-output-file
+		"bench-keys.parm"
+	      (lambda (port)
+		(let loop ((i 0))
+		  (when (< i n)
+			(display (string-append
+				  "Key-Type: eddsa\n"
+				  "Key-Curve: ed25519\n"
+				  "Name-Email: bench-" (number->string i)
+				  "@bench.example.org\n"
+				  "Expire-Date: 0\n"
+				  "%no-protection\n"
+				  "%transient-key\n"
+				  "%commit\n")
+				 port)
+			(loop (+ i 1))))))
+	    (call-check `(,@GPG --batch --gen-key bench-keys.parm))
+	    (call-check `(,@GPG --yes --output ,name
+				--export "@bench.example.org")))
+    name))
+
+(for-each
+ (lambda (n)
+   (let ((keyring (bench-keyring n))
+	 (homedir (mkdtemp-autoremove)))
+     (bench-report (string-append "import-" (number->string n)) n "keys/s"
+		   (bench-time
+		    (lambda ()
+		      (call-check `(,(tool 'gpg) --no-permission-warning
+				    --batch --homedir ,homedir
+				    --import ,keyring)))))
+     (bench-report (string-append "list-" (number->string n)) n "keys/s"
+		   (bench-time
+		    (lambda ()
+		      (catch #f (unlink "bench.out"))
+		      (letfd ((fd (open "bench.out"
+					(logior O_WRONLY O_CREAT O_BINARY)
+					#o600)))
+			(call-with-fds `(,(tool 'gpg) --no-permission-warning
+					 --batch --homedir ,homedir
+					 --list-keys)
+				       CLOSED_FD fd CLOSED_FD)))))))
+ bench-keys)
@@ -77,6 +77,8 @@ enum opt_values
     oNoKeyLookup,
     oNoHistory,
     oChUid,
+    oScript,
+    oAllCards,
 
     oDummy
   };
@@ -106,6 +108,10 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_n (oNoHistory,"no-history",
                 "do not use the command history file"),
   ARGPARSE_s_s (oChUid,      "chuid",      "@"),
+  ARGPARSE_s_s (oScript,     "script",
+                "|FILE|run the commands from FILE"),
+  ARGPARSE_s_n (oAllCards,   "all-cards",
+                "run the commands for all inserted cards"),
 
   ARGPARSE_end ()
 };
@@ -130,6 +136,12 @@ typedef struct keyinfolabel_s *keyinfolabel_t;
 /* Helper for --chuid.  */
 static const char *changeuser;
 
+/* The file given with --script.  */
+static const char *scriptfile;
+
+/* Limit for the length of a line read from a script.  */
+#define MAX_SCRIPT_LINE 4096
+
 /* Limit of size of data we read from a file for certain commands.  */
 #define MAX_GET_DATA_FROM_FILE 16384
 
@@ -145,6 +157,10 @@ static const char *changeuser;
 /* Local prototypes.  */
 static void show_keysize_warning (void);
 static gpg_error_t dispatch_command (card_info_t info, const char *command);
+static gpg_error_t read_script (const char *fname,
+                                char ***r_list, int *r_count);
+static gpg_error_t run_command_list (card_info_t info, char **command_list);
+static gpg_error_t run_for_all_cards (char **command_list);
 static void interactive_loop (void);
 #ifdef HAVE_LIBREADLINE
 static char **command_completion (const char *text, int start, int end);
@@ -240,6 +256,8 @@ parse_arguments (gpgrt_argparse_t *pargs, gpgrt_opt_t *popts)
         case oNoHistory:   opt.no_history = 1; break;
 
         case oChUid:       changeuser = pargs->r.ret_str; break;
+        case oScript:      scriptfile = pargs->r.ret_str; break;
+        case oAllCards:    opt.all_cards = 1; break;
 
         default: pargs->err = 2; break;
 	}
@@ -328,6 +346,16 @@ main (int argc, char **argv)
           command = NULL;
         }
     }
+  if (scriptfile)
+    {
+      err = read_script (scriptfile, &command_list, &cmdidx);
+      if (err)
+        {
+          log_error ("error reading '%s': %s\n",
+                     scriptfile, gpg_strerror (err));
+          exit (2);
+        }
+    }
   opt.interactive = !cmdidx;
 
   if (!opt.interactive)
@@ -335,25 +363,19 @@ main (int argc, char **argv)
 
   if (opt.interactive)
     {
+      if (opt.all_cards)
+        log_info ("option '%s' ignored in interactive mode\n", "--all-cards");
       interactive_loop ();
       err = 0;
     }
+  else if (opt.all_cards)
+    err = run_for_all_cards (command_list);
   else
     {
       struct card_info_s info_buffer = { 0 };
-      card_info_t info = &info_buffer;
 
-      err = 0;
-      for (cmdidx=0; (command = command_list[cmdidx]); cmdidx++)
-        {
-          err = dispatch_command (info, command);
-          if (err)
-            break;
-        }
-      if (gpg_err_code (err) == GPG_ERR_EOF)
-        err = 0; /* This was a "quit".  */
-      else if (command && !opt.quiet)
-        log_info ("stopped at command '%s'\n", command);
+      err = run_command_list (&info_buffer, command_list);
+      release_card_info (&info_buffer);
     }
 
   flush_keyblock_cache ();
@@ -373,6 +395,146 @@ main (int argc, char **argv)
 }
 
 
+/* Append the commands from the file FNAME to the NULL terminated
+ * array at R_LIST which has *R_COUNT items.  Empty lines and lines
+ * starting with a '#' are ignored.  If FNAME is "-" the commands are
+ * read from stdin.  */
+static gpg_error_t
+read_script (const char *fname, char ***r_list, int *r_count)
+{
+  gpg_error_t err = 0;
+  estream_t fp;
+  char *line = NULL;
+  size_t linelen = 0;
+  size_t maxlen;
+  ssize_t len;
+  char *p;
+  char **tmp;
+  int size = *r_count + 1;
+
+  if (!strcmp (fname, "-"))
+    fp = es_stdin;
+  else
+    fp = es_fopen (fname, "r");
+  if (!fp)
+    return gpg_error_from_syserror ();
+
+  maxlen = MAX_SCRIPT_LINE;
+  while ((len = es_read_line (fp, &line, &linelen, &maxlen)) > 0)
+    {
+      if (!maxlen)
+        {
+          err = gpg_error (GPG_ERR_LINE_TOO_LONG);
+          break;
+        }
+      maxlen = MAX_SCRIPT_LINE;
+      p = trim_spaces (line);
+      if (!*p || *p == '#')
+        continue;
+      if (*r_count + 1 >= size)
+        {
+          size += 64;
+          tmp = xtryrealloc (*r_list, size * sizeof *tmp);
+          if (!tmp)
+            {
+              err = gpg_error_from_syserror ();
+              break;
+            }
+          *r_list = tmp;
+        }
+      (*r_list)[(*r_count)++] = xstrdup (p);
+      (*r_list)[*r_count] = NULL;
+    }
+  if (len < 0 && !err)
+    err = gpg_error_from_syserror ();
+  es_free (line);
+  if (fp != es_stdin)
+    es_fclose (fp);
+  return err;
+}
+
+
+/* Run the commands from the NULL terminated COMMAND_LIST for the
+ * card described by INFO.  */
+static gpg_error_t
+run_command_list (card_info_t info, char **command_list)
+{
+  gpg_error_t err = 0;
+  char *command;
+  int cmdidx;
+
+  for (cmdidx=0; (command = command_list[cmdidx]); cmdidx++)
+    {
+      err = dispatch_command (info, command);
+      if (err)
+        break;
+    }
+  if (gpg_err_code (err) == GPG_ERR_EOF)
+    err = 0; /* This was a "quit".  */
+  else if (command && !opt.quiet)
+    log_info ("stopped at command '%s'\n", command);
+  return err;
+}
+
+
+/* Run the commands from the NULL terminated COMMAND_LIST once for
+ * each inserted card.  A failure on one card does not stop the
+ * processing of the other cards; the first error is returned.  */
+static gpg_error_t
+run_for_all_cards (char **command_list)
+{
+  gpg_error_t err, firsterr = 0;
+  strlist_t cards, sl;
+  struct card_info_s info_buffer;
+  int ncards = 0;
+  int nfailed = 0;
+
+  err = scd_cardlist (&cards);
+  if (err)
+    {
+      log_error ("error getting the list of cards: %s\n",
+                 gpg_strerror (err));
+      return err;
+    }
+  if (!cards)
+    {
+      log_error ("no cards inserted\n");
+      return gpg_error (GPG_ERR_CARD_NOT_PRESENT);
+    }
+
+  for (sl = cards; sl; sl = sl->next)
+    {
+      ncards++;
+      if (!opt.quiet)
+        log_info ("processing card %s\n", sl->d);
+      err = scd_switchcard (sl->d);
+      if (err)
+        log_error ("error switching to card %s: %s\n",
+                   sl->d, gpg_strerror (err));
+      else
+        {
+          /* Each card gets its own info so that the data learned from
+           * a card is used for all commands run on that card.  */
+          memset (&info_buffer, 0, sizeof info_buffer);
+          err = run_command_list (&info_buffer, command_list);
+          release_card_info (&info_buffer);
+        }
+      if (err)
+        {
+          nfailed++;
+          if (!firsterr)
+            firsterr = err;
+          gnupg_status_printf (STATUS_FAILURE, "%s %u", sl->d, err);
+        }
+    }
+  free_strlist (cards);
+
+  if (!opt.quiet)
+    log_info ("%d cards processed, %d failed\n", ncards, nfailed);
+  return firsterr;
+}
+
+
 /* Read data from file FNAME up to MAX_GET_DATA_FROM_FILE characters.
  * On error return an error code and stores NULL at R_BUFFER; on
  * success returns 0 and stores the number of bytes read at R_BUFLEN
@@ -43,6 +43,8 @@ struct
 
   int no_history;     /* Do not use the command line history.  */
 
+  int all_cards;      /* Run the commands for all inserted cards.  */
+
   /* Options passed to the gpg-agent: */
   session_env_t session_env;
   char *lc_ctype;
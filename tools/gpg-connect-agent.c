@@ -73,6 +73,7 @@ enum cmd_and_opt_values
     oNoHistory,
     oNoAutostart,
     oChUid,
+    oPipeline,
 
     oNoop
   };
@@ -100,6 +101,8 @@ static gpgrt_opt_t opts[] = {
   ARGPARSE_s_s (oRun,  "run",
                 N_("|FILE|run commands from FILE on startup")),
   ARGPARSE_s_n (oSubst, "subst",     N_("run /subst on startup")),
+  ARGPARSE_s_i (oPipeline, "pipeline",
+                N_("|N|send up to N commands ahead of their responses")),
 
   ARGPARSE_s_n (oNoAutostart, "no-autostart", "@"),
   ARGPARSE_s_n (oNoVerbose, "no-verbose", "@"),
@@ -137,8 +140,17 @@ struct
   int enable_varsubst;  /* Set if variable substitution is enabled.  */
   int trim_leading_spaces;
   int no_history;
+  int pipeline;         /* Number of commands to send ahead.  */
 } opt;
 
+/* The maximum value for --pipeline.  Limited so that the responses
+ * for the commands sent ahead won't fill up the socket buffers.  */
+#define MAX_PIPELINE 256
+
+/* The number of commands sent in pipeline mode for which we have not
+ * yet read the response.  */
+static int pending_responses;
+
 
 
 /* Definitions for /definq commands and a global linked list with all
@@ -196,6 +208,7 @@ static struct
 
 /*-- local prototypes --*/
 static char *substitute_line_copy (const char *buffer);
+static int read_pending_responses (assuan_context_t ctx, int *r_goterr);
 static int read_and_print_response (assuan_context_t ctx, int withhash,
                                     int *r_goterr);
 static assuan_context_t start_agent (void);
@@ -1241,6 +1254,11 @@ main (int argc, char **argv)
           opt.trim_leading_spaces = 1;
           break;
         case oChUid:     changeuser = pargs.r.ret_str; break;
+        case oPipeline:
+          opt.pipeline = pargs.r.ret_int;
+          if (opt.pipeline < 0 || opt.pipeline > MAX_PIPELINE)
+            opt.pipeline = MAX_PIPELINE;
+          break;
 
         default: pargs.err = 2; break;
 	}
@@ -1493,6 +1511,9 @@ main (int argc, char **argv)
                 log_info ("end of script\n");
               continue;
             }
+          rc = read_pending_responses (ctx, &cmderr);
+          if (rc)
+            log_info (_("receiving line failed: %s\n"), gpg_strerror (rc) );
           break;
         }
       if (!maxlength)
@@ -1542,6 +1563,22 @@ main (int argc, char **argv)
           loopidx++;
         }
 
+      if (*line == '/' && pending_responses)
+        {
+          /* Control commands may depend on the results of the
+           * previous commands; thus we need to read them first.  */
+          rc = read_pending_responses (ctx, &cmderr);
+          if (rc)
+            log_info (_("receiving line failed: %s\n"), gpg_strerror (rc) );
+          if ((rc || cmderr) && script_fp)
+            {
+              log_error ("stopping script execution\n");
+              gpgrt_fclose (script_fp);
+              script_fp = NULL;
+              continue;
+            }
+        }
+
       if (*line == '/')
         {
           /* Handle control commands. */
@@ -1710,6 +1747,12 @@ main (int argc, char **argv)
             }
           else if (!strcmp (cmd, "nosubst"))
             opt.enable_varsubst = 0;
+          else if (!strcmp (cmd, "pipeline"))
+            {
+              opt.pipeline = *p? atoi (p) : 0;
+              if (opt.pipeline < 0 || opt.pipeline > MAX_PIPELINE)
+                opt.pipeline = MAX_PIPELINE;
+            }
           else if (!strcmp (cmd, "run"))
             {
               char *p2;
@@ -1877,6 +1920,7 @@ main (int argc, char **argv)
 "/[no]hex               Enable hex dumping of received data lines.\n"
 "/[no]decode            Enable decoding of received data lines.\n"
 "/[no]subst             Enable variable substitution.\n"
+"/pipeline [N]          Send up to N commands ahead; 0 to disable.\n"
 "/run FILE              Run commands from FILE.\n"
 "/if VAR                Begin conditional block controlled by VAR.\n"
 "/while VAR             Begin loop controlled by VAR.\n"
@@ -1910,7 +1954,25 @@ main (int argc, char **argv)
       if (*line == '#' || !*line)
         continue; /* Don't expect a response for a comment line. */
 
-      rc = read_and_print_response (ctx, help_cmd_p (line), &cmderr);
+      if (opt.pipeline && (script_fp || !use_tty) && !help_cmd_p (line))
+        {
+          /* Send more commands before reading the responses.  */
+          if (++pending_responses < opt.pipeline)
+            continue;
+          rc = read_pending_responses (ctx, &cmderr);
+        }
+      else
+        {
+          rc = read_pending_responses (ctx, &cmderr);
+          if (!rc)
+            {
+              int goterr;
+
+              rc = read_and_print_response (ctx, help_cmd_p (line), &goterr);
+              if (goterr)
+                cmderr = 1;
+            }
+        }
       if (rc)
         log_info (_("receiving line failed: %s\n"), gpg_strerror (rc) );
       if ((rc || cmderr) && script_fp)
@@ -2067,6 +2129,30 @@ handle_inquire (assuan_context_t ctx, char *line)
 }
 
 
+/* Read and print the responses for all commands sent ahead in
+ * pipeline mode.  Returns 0 on success or an assuan error code.  Sets
+ * R_GOTERR to true if one of the commands did not return OK.  */
+static int
+read_pending_responses (assuan_context_t ctx, int *r_goterr)
+{
+  int rc, goterr;
+
+  *r_goterr = 0;
+  for (; pending_responses; pending_responses--)
+    {
+      rc = read_and_print_response (ctx, 0, &goterr);
+      if (rc)
+        {
+          pending_responses = 0;
+          return rc;
+        }
+      if (goterr)
+        *r_goterr = 1;
+    }
+  return 0;
+}
+
+
 /* Read all response lines from server and print them.  Returns 0 on
    success or an assuan error code.  If WITHHASH istrue, comment lines
    are printed.  Sets R_GOTERR to true if the command did not returned
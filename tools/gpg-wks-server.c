@@ -156,6 +156,7 @@ static int opt_with_file;
 /* Prototypes.  */
 static gpg_error_t get_domain_list (strlist_t *r_list);
 
+static gpg_error_t command_receive_maildir (const char *maildir);
 static gpg_error_t command_receive_cb (void *opaque,
                                        const char *mediatype, estream_t fp,
                                        unsigned int flags);
@@ -371,9 +372,12 @@ main (int argc, char **argv)
   switch (cmd)
     {
     case aReceive:
+      if (argc > 1)
+        wrong_args ("--receive [MAILDIR]");
       if (argc)
-        wrong_args ("--receive");
-      err = wks_receive (es_stdin, command_receive_cb, NULL);
+        err = command_receive_maildir (*argv);
+      else
+        err = wks_receive (es_stdin, command_receive_cb, NULL);
       break;
 
     case aCron:
@@ -1606,6 +1610,105 @@ command_receive_cb (void *opaque, const char *mediatype,
 
 
 
+/* Process all new mails in the Maildir MAILDIR.  Each mail is moved
+ * to the "cur" sub-directory with the flag S if it has been processed
+ * or with the flag F if there was an error.  Errors in a single mail
+ * are logged but do not stop processing.  */
+static gpg_error_t
+command_receive_maildir (const char *maildir)
+{
+  gpg_error_t err;
+  char *newdir = NULL;
+  char *fname = NULL;
+  char *curname = NULL;
+  DIR *dir = NULL;
+  struct dirent *dentry;
+  estream_t fp;
+  unsigned int nprocessed = 0;
+  unsigned int nfailed = 0;
+
+  newdir = make_filename_try (maildir, "new", NULL);
+  if (!newdir)
+    {
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+  dir = opendir (newdir);
+  if (!dir)
+    {
+      err = gpg_error_from_syserror ();
+      log_error (("can't access directory '%s': %s\n"),
+                 newdir, gpg_strerror (err));
+      goto leave;
+    }
+
+  while ((dentry = readdir (dir)))
+    {
+      if (*dentry->d_name == '.')
+        continue;
+      xfree (fname);
+      fname = make_filename_try (newdir, dentry->d_name, NULL);
+      if (!fname)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+
+      fp = es_fopen (fname, "rb");
+      if (!fp)
+        {
+          err = gpg_error_from_syserror ();
+          /* Another process may have taken this mail.  */
+          if (gpg_err_code (err) != GPG_ERR_ENOENT)
+            log_error ("error opening '%s': %s\n", fname, gpg_strerror (err));
+          continue;
+        }
+      if (opt.verbose)
+        log_info ("processing '%s'\n", fname);
+      err = wks_receive (fp, command_receive_cb, NULL);
+      es_fclose (fp);
+      if (err)
+        {
+          log_error ("processing '%s' failed: %s\n",
+                     fname, gpg_strerror (err));
+          nfailed++;
+        }
+      else
+        nprocessed++;
+
+      /* Move the mail out of "new" as per the Maildir spec.  */
+      xfree (curname);
+      curname = xtryasprintf ("%s" DIRSEP_S "cur" DIRSEP_S "%s:2,%s",
+                              maildir, dentry->d_name, err? "F":"S");
+      if (!curname)
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      if (rename (fname, curname))
+        {
+          err = gpg_error_from_syserror ();
+          log_error ("error renaming '%s' to '%s': %s\n",
+                     fname, curname, gpg_strerror (err));
+          goto leave;
+        }
+    }
+  err = 0;
+  if (opt.verbose || nfailed)
+    log_info ("%u mails processed, %u failed\n",
+              nprocessed + nfailed, nfailed);
+
+ leave:
+  if (dir)
+    closedir (dir);
+  xfree (newdir);
+  xfree (fname);
+  xfree (curname);
+  return err;
+}
+
+
+
 /* Return a list of all configured domains.  Each list element is the
  * top directory for the domain.  To figure out the actual domain
  * name strrchr(name, '/') can be used.  */
@@ -28,6 +28,7 @@
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/types.h>
+#include <sys/stat.h>
 #include <errno.h>
 #include <time.h>
 #include <stdarg.h>
@@ -48,6 +49,7 @@
 #include "../common/exechelp.h"
 #include "../common/sysutils.h"
 #include "../common/status.h"
+#include "../common/membuf.h"
 
 #include "../common/gc-opt-flags.h"
 #include "gpgconf.h"
@@ -1556,18 +1558,245 @@ find_option (gc_component_id_t component, const char *name)
 
 
 
+/* The option tables and the defaults of the components are cached
+ * in files in the homedir so that we do not need to run all
+ * components for each --list-options.  The first line of such a file
+ * is the key computed by make_cache_key, then the output of
+ * --dump-option-table follows, a line with "%%", and the output of
+ * --gpgconf-list.  */
+#define OPTCACHE_SEPARATOR "%%"
+
+
+/* Append the modification time and size of FNAME to the membuf MB.  */
+static void
+add_file_to_cache_key (membuf_t *mb, const char *fname)
+{
+  struct stat st;
+  char buf[80];
+
+  if (stat (fname, &st))
+    put_membuf_str (mb, ":-:-");
+  else
+    {
+      snprintf (buf, sizeof buf, ":%lu:%lu",
+                (unsigned long)st.st_mtime, (unsigned long)st.st_size);
+      put_membuf_str (mb, buf);
+    }
+}
+
+
+/* Return a malloced key describing the program PGMNAME of COMPONENT
+ * and its config files or NULL if the program can't be stat-ed.  */
+static char *
+make_cache_key (gc_component_id_t component, const char *pgmname)
+{
+  struct stat st;
+  membuf_t mb;
+  const char *config_name;
+  char *fname;
+
+  if (stat (pgmname, &st))
+    return NULL;
+
+  init_membuf (&mb, 256);
+  put_membuf_str (&mb, "1:" VERSION ":");
+  put_membuf_str (&mb, pgmname);
+  add_file_to_cache_key (&mb, pgmname);
+  config_name = gc_component[component].option_config_filename;
+  if (config_name)
+    {
+      fname = make_filename (gnupg_sysconfdir (), config_name, NULL);
+      add_file_to_cache_key (&mb, fname);
+      xfree (fname);
+      fname = make_filename (gnupg_homedir (), config_name, NULL);
+      add_file_to_cache_key (&mb, fname);
+      xfree (fname);
+    }
+  put_membuf (&mb, "", 1);
+  return get_membuf (&mb, NULL);
+}
+
+
+/* Return the malloced name of the cache file for COMPONENT.  */
+static char *
+cache_file_name (gc_component_id_t component)
+{
+  char *name, *fname;
+
+  name = xstrconcat ("gpgconf-", gc_component[component].name,
+                     EXTSEP_S "cache", NULL);
+  fname = make_filename (gnupg_homedir (), name, NULL);
+  xfree (name);
+  return fname;
+}
+
+
+/* Try to read the cached outputs for COMPONENT with KEY.  On success
+ * two memory streams are stored at R_TABLEFP and R_LISTFP and true is
+ * returned.  */
+static int
+read_option_cache (gc_component_id_t component, const char *key,
+                   estream_t *r_tablefp, estream_t *r_listfp)
+{
+  char *fname;
+  estream_t fp;
+  estream_t outfp[2] = { NULL, NULL };
+  char *line = NULL;
+  size_t line_len = 0;
+  ssize_t length;
+  int part = -1;
+  int okay = 0;
+
+  fname = cache_file_name (component);
+  fp = es_fopen (fname, "r");
+  xfree (fname);
+  if (!fp)
+    return 0;
+
+  while ((length = es_read_line (fp, &line, &line_len, NULL)) > 0)
+    {
+      if (part == -1)
+        {
+          /* Check the key.  */
+          if (length < 2 || line[length-1] != '\n'
+              || strlen (key) != length - 1
+              || strncmp (line, key, length - 1))
+            break;
+          part = 0;
+          if (!(outfp[0] = es_fopenmem (0, "w+"))
+              || !(outfp[1] = es_fopenmem (0, "w+")))
+            break;
+        }
+      else if (!part && !strcmp (line, OPTCACHE_SEPARATOR "\n"))
+        part = 1;
+      else if (es_fputs (line, outfp[part]) == EOF)
+        break;
+    }
+  okay = (part == 1 && !length && !es_ferror (fp));
+  es_fclose (fp);
+  xfree (line);
+
+  if (!okay)
+    {
+      es_fclose (outfp[0]);
+      es_fclose (outfp[1]);
+      return 0;
+    }
+  es_rewind (outfp[0]);
+  es_rewind (outfp[1]);
+  *r_tablefp = outfp[0];
+  *r_listfp = outfp[1];
+  return 1;
+}
+
+
+/* Copy the rest of the stream SRC to DST.  */
+static int
+copy_stream (estream_t src, estream_t dst)
+{
+  char buffer[4096];
+  size_t nread;
+
+  while (!es_read (src, buffer, sizeof buffer, &nread) && nread)
+    if (es_fwrite (buffer, nread, 1, dst) != 1)
+      return -1;
+  return es_ferror (src)? -1 : 0;
+}
+
+
+/* Write the outputs in TABLEFP and LISTFP under KEY to the cache
+ * file of COMPONENT.  Errors are not fatal; the cache will then be
+ * updated by the next run.  */
+static void
+write_option_cache (gc_component_id_t component, const char *key,
+                    estream_t tablefp, estream_t listfp)
+{
+  char *fname, *tmpname;
+  estream_t fp;
+  int rc;
+
+  fname = cache_file_name (component);
+  tmpname = xstrconcat (fname, EXTSEP_S "tmp", NULL);
+  fp = es_fopen (tmpname, "w");
+  if (!fp)
+    {
+      if (opt.verbose)
+        log_info ("can't create '%s': %s\n",
+                  tmpname, gpg_strerror (gpg_error_from_syserror ()));
+      goto leave;
+    }
+  es_rewind (tablefp);
+  es_rewind (listfp);
+  es_fprintf (fp, "%s\n", key);
+  rc = copy_stream (tablefp, fp);
+  if (!rc)
+    rc = es_fputs (OPTCACHE_SEPARATOR "\n", fp) == EOF? -1 : 0;
+  if (!rc)
+    rc = copy_stream (listfp, fp);
+  es_rewind (tablefp);
+  es_rewind (listfp);
+  if (es_fclose (fp) || rc
+      || gnupg_rename_file (tmpname, fname, NULL))
+    {
+      if (opt.verbose)
+        log_info ("error writing '%s': %s\n",
+                  fname, gpg_strerror (gpg_error_from_syserror ()));
+      gnupg_remove (tmpname);
+    }
+
+ leave:
+  xfree (tmpname);
+  xfree (fname);
+}
+
+
+/* Run PGMNAME with the single argument OPTION and return its output
+ * as a memory stream.  */
+static estream_t
+read_program_output (const char *pgmname, const char *option)
+{
+  gpg_error_t err;
+  const char *argv[2];
+  estream_t outfp, memfp;
+  int exitcode;
+  pid_t pid;
+
+  argv[0] = option;
+  argv[1] = NULL;
+  err = gnupg_spawn_process (pgmname, argv, NULL, NULL, 0,
+                             NULL, &outfp, NULL, &pid);
+  if (err)
+    gc_error (1, 0, "could not run '%s %s': %s",
+              pgmname, option, gpg_strerror (err));
+
+  memfp = es_fopenmem (0, "w+");
+  if (!memfp)
+    gc_error (1, errno, "error allocating memory stream");
+  if (copy_stream (outfp, memfp))
+    gc_error (1, errno, "error reading from %s", pgmname);
+  if (es_fclose (outfp))
+    gc_error (1, errno, "error closing %s", pgmname);
+
+  err = gnupg_wait_process (pgmname, pid, 1, &exitcode);
+  if (err)
+    gc_error (1, 0, "running %s failed (exitcode=%d): %s",
+              pgmname, exitcode, gpg_strerror (err));
+  gnupg_release_process (pid);
+
+  es_rewind (memfp);
+  return memfp;
+}
+
+
 /* Retrieve the options for the component COMPONENT.  With
  * ONLY_INSTALLED set components which are not installed are silently
  * ignored. */
 static void
 retrieve_options_from_program (gc_component_id_t component, int only_installed)
 {
-  gpg_error_t err;
   const char *pgmname;
-  const char *argv[2];
-  estream_t outfp;
-  int exitcode;
-  pid_t pid;
+  estream_t outfp, listfp;
+  char *cache_key;
   known_option_t *known_option;
   gc_option_t *option;
   char *line = NULL;
@@ -1595,16 +1824,18 @@ retrieve_options_from_program (gc_component_id_t component, int only_installed)
     }
 
 
-  /* First we need to read the option table from the program.  */
-  argv[0] = "--dump-option-table";
-  argv[1] = NULL;
-  err = gnupg_spawn_process (pgmname, argv, NULL, NULL, 0,
-                             NULL, &outfp, NULL, &pid);
-  if (err)
+  /* First we need to read the option table and the defaults from
+   * the program or from the cache.  */
+  cache_key = make_cache_key (component, pgmname);
+  if (!cache_key || !read_option_cache (component, cache_key,
+                                        &outfp, &listfp))
     {
-      gc_error (1, 0, "could not gather option table from '%s': %s",
-                pgmname, gpg_strerror (err));
+      outfp = read_program_output (pgmname, "--dump-option-table");
+      listfp = read_program_output (pgmname, "--gpgconf-list");
+      if (cache_key)
+        write_option_cache (component, cache_key, outfp, listfp);
     }
+  xfree (cache_key);
 
   while ((length = es_read_line (outfp, &line, &line_len, NULL)) > 0)
     {
@@ -1737,32 +1968,16 @@ retrieve_options_from_program (gc_component_id_t component, int only_installed)
     }
   if (length < 0 || es_ferror (outfp))
     gc_error (1, errno, "error reading from %s", pgmname);
-  if (es_fclose (outfp))
-    gc_error (1, errno, "error closing %s", pgmname);
+  es_fclose (outfp);
   log_assert (opt_table_used == opt_info_used);
 
-  err = gnupg_wait_process (pgmname, pid, 1, &exitcode);
-  if (err)
-    gc_error (1, 0, "running %s failed (exitcode=%d): %s",
-              pgmname, exitcode, gpg_strerror (err));
-  gnupg_release_process (pid);
-
   /* Make the gpgrt option table and the internal option table available.  */
   gc_component[component].opt_table = opt_table;
   gc_component[component].options = opt_info;
 
 
   /* Now read the default options.  */
-  argv[0] = "--gpgconf-list";
-  argv[1] = NULL;
-  err = gnupg_spawn_process (pgmname, argv, NULL, NULL, 0,
-                             NULL, &outfp, NULL, &pid);
-  if (err)
-    {
-      gc_error (1, 0, "could not gather active options from '%s': %s",
-                pgmname, gpg_strerror (err));
-    }
-
+  outfp = listfp;
   while ((length = es_read_line (outfp, &line, &line_len, NULL)) > 0)
     {
       char *linep;
@@ -1842,14 +2057,7 @@ retrieve_options_from_program (gc_component_id_t component, int only_installed)
     }
   if (length < 0 || es_ferror (outfp))
     gc_error (1, errno, "error reading from %s", pgmname);
-  if (es_fclose (outfp))
-    gc_error (1, errno, "error closing %s", pgmname);
-
-  err = gnupg_wait_process (pgmname, pid, 1, &exitcode);
-  if (err)
-    gc_error (1, 0, "running %s failed (exitcode=%d): %s",
-              pgmname, exitcode, gpg_strerror (err));
-  gnupg_release_process (pid);
+  es_fclose (outfp);
 
 
   /* At this point, we can parse the configuration file.  */
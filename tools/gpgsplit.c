@@ -538,13 +538,38 @@ handle_bzip2(int algo,FILE *fpin,FILE *fpout)
 }
 #endif /* HAVE_BZIP2 */
 
+/* Copy N bytes from FPIN to FPOUT.  If N is -1 copy until EOF.
+   Returns 0 on success, -1 on a read error or premature EOF and 2 on
+   a write error.  */
+static int
+copy_bytes (FILE *fpin, FILE *fpout, unsigned long n)
+{
+  static char buffer[65536];
+  size_t nbytes, nread;
+  int to_eof = (n == (unsigned long)(-1));
+
+  while (n)
+    {
+      nbytes = (!to_eof && n < sizeof buffer)? n : sizeof buffer;
+      nread = fread (buffer, 1, nbytes, fpin);
+      if (nread && fwrite (buffer, 1, nread, fpout) != nread)
+        return 2;
+      if (nread != nbytes)
+        return to_eof? 0 : -1;
+      if (!to_eof)
+        n -= nread;
+    }
+  return 0;
+}
+
+
 /* hdr must point to a buffer large enough to hold all header bytes */
 static int
 write_part (FILE *fpin, unsigned long pktlen,
             int pkttype, int partial, unsigned char *hdr, size_t hdrlen)
 {
   FILE *fpout;
-  int c, first;
+  int c, first, rc;
   unsigned char *p;
   const char *outname = create_filename (pkttype);
 
@@ -574,17 +599,12 @@ write_part (FILE *fpin, unsigned long pktlen,
       && (pkttype == PKT_SECRET_KEY || pkttype == PKT_SECRET_SUBKEY))
     {
       unsigned char *blob = xmalloc (pktlen);
-      int i, len;
+      int len;
 
       pkttype = pkttype == PKT_SECRET_KEY? PKT_PUBLIC_KEY:PKT_PUBLIC_SUBKEY;
 
-      for (i=0; i < pktlen; i++)
-        {
-          c = getc (fpin);
-          if (c == EOF)
-            goto read_error;
-          blob[i] = c;
-        }
+      if (fread (blob, 1, pktlen, fpin) != pktlen)
+        goto read_error;
       len = public_key_length (blob, pktlen);
       if (!len)
         {
@@ -602,11 +622,8 @@ write_part (FILE *fpin, unsigned long pktlen,
             goto write_error;
         }
 
-      for (i=0; i < len; i++)
-        {
-          if ( putc (blob[i], fpout) == EOF )
-            goto write_error;
-        }
+      if (fwrite (blob, 1, len, fpout) != len)
+        goto write_error;
 
       goto ready;
     }
@@ -671,13 +688,11 @@ write_part (FILE *fpin, unsigned long pktlen,
                     goto write_error;
                 }
               partlen = 1 << (c & 0x1f);
-              for (; partlen; partlen--)
-                {
-                  if ((c = getc (fpin)) == EOF)
-                    goto read_error;
-                  if ( putc (c, fpout) == EOF )
-                    goto write_error;
-                }
+              rc = copy_bytes (fpin, fpout, partlen);
+              if (rc < 0)
+                goto read_error;
+              else if (rc)
+                goto write_error;
             }
         }
       else if (partial == 2)
@@ -694,14 +709,11 @@ write_part (FILE *fpin, unsigned long pktlen,
             }
           if (!partlen)
             partial = 0; /* end of packet */
-          for (; partlen; partlen--)
-            {
-              c = getc (fpin);
-              if (c == EOF)
-                goto read_error;
-              if ( putc (c, fpout) == EOF )
-                goto write_error;
-            }
+          rc = copy_bytes (fpin, fpout, partlen);
+          if (rc < 0)
+            goto read_error;
+          else if (rc)
+            goto write_error;
         }
       else
         { /* compressed: read to end */
@@ -737,11 +749,8 @@ write_part (FILE *fpin, unsigned long pktlen,
             }
           else
             {
-              while ( (c=getc (fpin)) != EOF )
-                {
-                  if ( putc (c, fpout) == EOF )
-                    goto write_error;
-                }
+              if (copy_bytes (fpin, fpout, (unsigned long)(-1)))
+                goto write_error;
             }
           if (!feof (fpin))
             goto read_error;
@@ -755,14 +764,11 @@ write_part (FILE *fpin, unsigned long pktlen,
     }
 
   /* standard packet or last segment of partial length encoded packet */
-  for (; pktlen; pktlen--)
-    {
-      c = getc (fpin);
-      if (c == EOF)
-        goto read_error;
-      if ( putc (c, fpout) == EOF )
-        goto write_error;
-    }
+  rc = copy_bytes (fpin, fpout, pktlen);
+  if (rc < 0)
+    goto read_error;
+  else if (rc)
+    goto write_error;
 
  ready:
   if ( !opt_no_split && fclose (fpout) )
@@ -886,6 +892,8 @@ split_packets (const char *fname)
       log_error ("can't open '%s': %s\n", fname, strerror (errno));
       return;
     }
+  /* Large dumps are read faster with a large buffer.  */
+  setvbuf (fp, NULL, _IOFBF, 256*1024);
 
   while ( !(rc = do_split (fp)) )
     ;
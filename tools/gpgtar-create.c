@@ -34,9 +34,11 @@
 # include <grp.h>
 #endif /*!HAVE_W32_SYSTEM*/
 #include <assert.h>
+#include <fcntl.h>
 
 #include "../common/i18n.h"
 #include "../common/exectool.h"
+#include "../common/exechelp.h"
 #include "../common/sysutils.h"
 #include "../common/ccparray.h"
 #include "gpgtar.h"
@@ -683,13 +685,22 @@ build_header (void *record, tar_header_t hdr)
 }
 
 
+/* The number of records copied at once from a file.  */
+#define COPY_RECORDS 128
+
+/* The size we request for the pipe to gpg.  */
+#define PIPE_BUFFER_SIZE (1024*1024)
+
+
 static gpg_error_t
 write_file (estream_t stream, tar_header_t hdr)
 {
   gpg_error_t err;
+  static char *buffer;
   char record[RECORDSIZE];
   estream_t infp;
-  size_t nread, nbytes;
+  unsigned long long left;
+  size_t nread, nbytes, nrec;
   int any;
 
   err = build_header (record, hdr);
@@ -723,14 +734,20 @@ write_file (estream_t stream, tar_header_t hdr)
 
   if (hdr->typeflag == TF_REGULAR)
     {
+      /* Copy several records at once to save on calls.  The last
+       * record is padded with zeroes.  */
+      if (!buffer && !(buffer = xtrymalloc (COPY_RECORDS * RECORDSIZE)))
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
       hdr->nrecords = (hdr->size + RECORDSIZE-1)/RECORDSIZE;
       any = 0;
-      while (hdr->nrecords--)
+      for (left = hdr->size; left; left -= nbytes)
         {
-          nbytes = hdr->nrecords? RECORDSIZE : (hdr->size % RECORDSIZE);
-          if (!nbytes)
-            nbytes = RECORDSIZE;
-          nread = es_fread (record, 1, nbytes, infp);
+          nbytes = left < COPY_RECORDS * RECORDSIZE
+                   ? left : COPY_RECORDS * RECORDSIZE;
+          nread = es_fread (buffer, 1, nbytes, infp);
           if (nread != nbytes)
             {
               err = gpg_error_from_syserror ();
@@ -740,9 +757,16 @@ write_file (estream_t stream, tar_header_t hdr)
               goto leave;
             }
           any = 1;
-          err = write_record (stream, record);
-          if (err)
-            goto leave;
+          nrec = (nbytes + RECORDSIZE - 1) / RECORDSIZE;
+          if (nbytes % RECORDSIZE)
+            memset (buffer + nbytes, 0, nrec * RECORDSIZE - nbytes);
+          if (es_fwrite (buffer, RECORDSIZE, nrec, stream) != nrec)
+            {
+              err = gpg_error_from_syserror ();
+              log_error ("error writing '%s': %s\n",
+                         es_fname_get (stream), gpg_strerror (err));
+              goto leave;
+            }
         }
       nread = es_fread (record, 1, 1, infp);
       if (nread)
@@ -791,6 +815,8 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
   estream_t outstream = NULL;
   estream_t cipher_stream = NULL;
   int eof_seen = 0;
+  const char **argv = NULL;
+  pid_t pid = (pid_t)(-1);
 
   memset (scanctrl, 0, sizeof *scanctrl);
   scanctrl->flist_tail = &scanctrl->flist;
@@ -953,36 +979,11 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
   if (outstream == es_stdout)
     es_set_binary (es_stdout);
 
-  if (encrypt || sign)
-    {
-      cipher_stream = outstream;
-      outstream = es_fopenmem (0, "rwb");
-      if (! outstream)
-        {
-          err = gpg_error_from_syserror ();
-          goto leave;
-        }
-    }
-
-  for (hdr = scanctrl->flist; hdr; hdr = hdr->next)
-    {
-      err = write_file (outstream, hdr);
-      if (err)
-        goto leave;
-    }
-  err = write_eof_mark (outstream);
-  if (err)
-    goto leave;
-
   if (encrypt || sign)
     {
       strlist_t arg;
       ccparray_t ccp;
-      const char **argv;
-
-      err = es_fseek (outstream, 0, SEEK_SET);
-      if (err)
-        goto leave;
+      int filedes[2];
 
       /* '--encrypt' may be combined with '--symmetric', but 'encrypt'
          is set either way.  Clear it if no recipients are specified.
@@ -1018,9 +1019,59 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
           goto leave;
         }
 
-      err = gnupg_exec_tool_stream (opt.gpg_program, argv,
-                                    outstream, NULL, cipher_stream, NULL, NULL);
-      xfree (argv);
+      /* The tarball is piped to gpg which writes directly to the
+       * output; thus gpg encrypts while we are still reading files
+       * and the data is not copied through our process again.  */
+      cipher_stream = outstream;
+      outstream = NULL;
+      if (es_fflush (cipher_stream))
+        {
+          err = gpg_error_from_syserror ();
+          goto leave;
+        }
+      err = gnupg_create_outbound_pipe (filedes, &outstream, 0);
+      if (err)
+        goto leave;
+#ifdef F_SETPIPE_SZ
+      /* A larger pipe saves on context switches; errors are ignored
+       * because this is only an optimization.  */
+      fcntl (filedes[1], F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+#endif
+      err = gnupg_spawn_process_fd (opt.gpg_program, argv, filedes[0],
+                                    es_fileno (cipher_stream),
+                                    es_fileno (es_stderr), &pid);
+      gnupg_close_pipe (filedes[0]);
+      if (err)
+        {
+          log_error ("error running '%s': %s\n",
+                     opt.gpg_program, gpg_strerror (err));
+          pid = (pid_t)(-1);
+          goto leave;
+        }
+    }
+
+  for (hdr = scanctrl->flist; hdr; hdr = hdr->next)
+    {
+      err = write_file (outstream, hdr);
+      if (err)
+        goto leave;
+    }
+  err = write_eof_mark (outstream);
+  if (err)
+    goto leave;
+
+  if (pid != (pid_t)(-1))
+    {
+      gpg_error_t err2;
+
+      if (es_fclose (outstream))
+        err = gpg_error_from_syserror ();
+      outstream = NULL;
+      err2 = gnupg_wait_process (opt.gpg_program, pid, 1, NULL);
+      gnupg_release_process (pid);
+      pid = (pid_t)(-1);
+      if (!err)
+        err = err2;
       if (err)
         goto leave;
     }
@@ -1048,11 +1099,17 @@ gpgtar_create (char **inpattern, const char *files_from, int null_names,
                  opt.outfile ? opt.outfile : "-", gpg_strerror (err));
       if (outstream && outstream != es_stdout)
         es_fclose (outstream);
+      if (pid != (pid_t)(-1))
+        {
+          gnupg_wait_process (opt.gpg_program, pid, 1, NULL);
+          gnupg_release_process (pid);
+        }
       if (cipher_stream && cipher_stream != es_stdout)
         es_fclose (cipher_stream);
       if (opt.outfile)
         gnupg_remove (opt.outfile);
     }
+  xfree (argv);
   scanctrl->flist_tail = NULL;
   while ( (hdr = scanctrl->flist) )
     {
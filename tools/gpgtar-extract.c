@@ -25,22 +25,35 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <unistd.h>
+#include <fcntl.h>
 #include <assert.h>
 
 #include "../common/i18n.h"
 #include "../common/exectool.h"
+#include "../common/exechelp.h"
 #include "../common/sysutils.h"
 #include "../common/ccparray.h"
 #include "gpgtar.h"
 
 
+/* The number of records copied at once to a file.  */
+#define COPY_RECORDS 128
+
+/* Files of at least this size are preallocated.  */
+#define PREALLOC_THRESHOLD (1024*1024)
+
+/* The size we request for the pipe from gpg.  */
+#define PIPE_BUFFER_SIZE (1024*1024)
+
+
 static gpg_error_t
 extract_regular (estream_t stream, const char *dirname,
                  tarinfo_t info, tar_header_t hdr)
 {
   gpg_error_t err;
-  char record[RECORDSIZE];
-  size_t n, nbytes, nwritten;
+  static char *buffer;
+  unsigned long long n, nrec, left;
+  size_t nbytes, nread, nwritten;
   char *fname;
   estream_t outfp = NULL;
 
@@ -65,19 +78,45 @@ extract_regular (estream_t stream, const char *dirname,
       goto leave;
     }
 
-  for (n=0; n < hdr->nrecords;)
+#ifdef HAVE_POSIX_FALLOCATE
+  /* Reserving the space up front avoids fragmentation and lets the
+   * file system allocate large extents.  Errors are ignored because
+   * this is only an optimization; a real lack of space is detected
+   * while writing.  */
+  if (!opt.dry_run && hdr->size >= PREALLOC_THRESHOLD)
+    posix_fallocate (es_fileno (outfp), 0, (off_t)hdr->size);
+#endif
+
+  if (hdr->nrecords && !buffer
+      && !(buffer = xtrymalloc (COPY_RECORDS * RECORDSIZE)))
     {
-      err = read_record (stream, record);
-      if (err)
-        goto leave;
-      info->nblocks++;
-      n++;
-      if (n < hdr->nrecords || (hdr->size && !(hdr->size % RECORDSIZE)))
-        nbytes = RECORDSIZE;
-      else
-        nbytes = (hdr->size % RECORDSIZE);
+      err = gpg_error_from_syserror ();
+      goto leave;
+    }
+
+  left = hdr->size;
+  for (n=0; n < hdr->nrecords; n += nrec)
+    {
+      nrec = hdr->nrecords - n;
+      if (nrec > COPY_RECORDS)
+        nrec = COPY_RECORDS;
+      nread = es_fread (buffer, RECORDSIZE, nrec, stream);
+      if (nread != nrec)
+        {
+          err = gpg_error_from_syserror ();
+          if (es_ferror (stream))
+            log_error ("error reading '%s': %s\n",
+                       es_fname_get (stream), gpg_strerror (err));
+          else
+            log_error ("error reading '%s': premature EOF\n",
+                       es_fname_get (stream));
+          goto leave;
+        }
+      info->nblocks += nrec;
+      nbytes = left < nrec * RECORDSIZE? left : nrec * RECORDSIZE;
+      left -= nbytes;
 
-      nwritten = es_fwrite (record, 1, nbytes, outfp);
+      nwritten = es_fwrite (buffer, 1, nbytes, outfp);
       if (nwritten != nbytes)
         {
           err = gpg_error_from_syserror ();
@@ -290,6 +329,7 @@ gpgtar_extract (const char *filename, int decrypt)
   char *dirname = NULL;
   struct tarinfo_s tarinfo_buffer;
   tarinfo_t tarinfo = &tarinfo_buffer;
+  pid_t pid = (pid_t)(-1);
 
   memset (&tarinfo_buffer, 0, sizeof tarinfo_buffer);
 
@@ -317,14 +357,10 @@ gpgtar_extract (const char *filename, int decrypt)
       strlist_t arg;
       ccparray_t ccp;
       const char **argv;
+      int filedes[2];
 
       cipher_stream = stream;
-      stream = es_fopenmem (0, "rwb");
-      if (! stream)
-        {
-          err = gpg_error_from_syserror ();
-          goto leave;
-        }
+      stream = NULL;
 
       ccparray_init (&ccp, 0);
 
@@ -340,15 +376,32 @@ gpgtar_extract (const char *filename, int decrypt)
           goto leave;
         }
 
-      err = gnupg_exec_tool_stream (opt.gpg_program, argv,
-                                    cipher_stream, NULL, stream, NULL, NULL);
-      xfree (argv);
+      /* Instead of decrypting to memory and extracting afterwards,
+       * we read the plaintext from a pipe so that gpg decrypts while
+       * we are writing the files.  */
+      err = gnupg_create_inbound_pipe (filedes, &stream, 0);
       if (err)
-        goto leave;
-
-      err = es_fseek (stream, 0, SEEK_SET);
+        {
+          xfree (argv);
+          goto leave;
+        }
+#ifdef F_SETPIPE_SZ
+      /* A larger pipe saves on context switches; errors are ignored
+       * because this is only an optimization.  */
+      fcntl (filedes[0], F_SETPIPE_SZ, PIPE_BUFFER_SIZE);
+#endif
+      err = gnupg_spawn_process_fd (opt.gpg_program, argv,
+                                    es_fileno (cipher_stream), filedes[1],
+                                    es_fileno (es_stderr), &pid);
+      xfree (argv);
+      gnupg_close_pipe (filedes[1]);
       if (err)
-        goto leave;
+        {
+          log_error ("error running '%s': %s\n",
+                     opt.gpg_program, gpg_strerror (err));
+          pid = (pid_t)(-1);
+          goto leave;
+        }
     }
 
   if (opt.directory)
@@ -403,6 +456,26 @@ gpgtar_extract (const char *filename, int decrypt)
  leave:
   xfree (header);
   xfree (dirname);
+  if (pid != (pid_t)(-1))
+    {
+      gpg_error_t err2;
+      char buffer[4096];
+
+      /* Read the remaining output, like the padding after the EOF
+       * mark, so that gpg does not fail due to a broken pipe.  */
+      if (!err)
+        while (es_fread (buffer, 1, sizeof buffer, stream))
+          ;
+      es_fclose (stream);
+      stream = NULL;
+      err2 = gnupg_wait_process (opt.gpg_program, pid, 1, NULL);
+      gnupg_release_process (pid);
+      if (!err)
+        err = err2;
+      if (err2)
+        log_error ("decryption failed; extracted files may be incomplete"
+                   " or corrupt\n");
+    }
   if (stream != es_stdin)
     es_fclose (stream);
   if (stream != cipher_stream)
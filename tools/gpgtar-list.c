@@ -23,6 +23,8 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <sys/types.h>
+#include <sys/stat.h>
 
 #include "../common/i18n.h"
 #include "gpgtar.h"
@@ -236,6 +238,16 @@ skip_data (estream_t stream, tarinfo_t info, tar_header_t header)
   char record[RECORDSIZE];
   unsigned long long n;
 
+  /* Seeking over the data makes listing a large archive stored in a
+     file or decrypted to memory as fast as reading its headers.  */
+  if (info->seekable && header->nrecords
+      && !es_fseeko (stream, (gpgrt_off_t)(header->nrecords * RECORDSIZE),
+                     SEEK_CUR))
+    {
+      info->nblocks += header->nrecords;
+      return 0;
+    }
+
   for (n=0; n < header->nrecords; n++)
     {
       if (read_record (stream, record))
@@ -356,6 +368,15 @@ gpgtar_list (const char *filename, int decrypt)
       err = es_fseek (stream, 0, SEEK_SET);
       if (err)
         goto leave;
+      tarinfo->seekable = 1;
+    }
+  else
+    {
+      struct stat st;
+
+      /* We can't seek on a pipe.  */
+      tarinfo->seekable = (!fstat (es_fileno (stream), &st)
+                           && S_ISREG (st.st_mode));
     }
 
   for (;;)
@@ -49,6 +49,7 @@ struct tarinfo_s
 {
   unsigned long long nblocks;     /* Count of processed blocks.  */
   unsigned long long headerblock; /* Number of current header block. */
+  int seekable;                   /* Data may be skipped by seeking.  */
 };
 typedef struct tarinfo_s *tarinfo_t;
 
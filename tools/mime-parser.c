@@ -27,6 +27,10 @@
 #include "rfc822parse.h"
 #include "mime-parser.h"
 
+/* The maximum length of a line we accept.  RFC-5322 allows only
+ * 1000 octets but we need to cope with broken mailers.  */
+#define MIME_PARSER_MAX_LINE (1024*1024)
+
 
 enum pgpmime_states
   {
@@ -94,9 +98,6 @@ struct mime_parser_context_s
   } show;
 
   struct b64state *b64state;     /* NULL or malloced Base64 decoder state.  */
-
-  /* A buffer for reading a mail line,  */
-  char line[5000];
 };
 
 
@@ -679,10 +680,10 @@ mime_parser_parse (mime_parser_t ctx, estream_t fp)
   gpg_error_t err;
   rfc822parse_t msg = NULL;
   unsigned int lineno = 0;
-  size_t length;
-  char *line;
-
-  line = ctx->line;
+  ssize_t nread;
+  size_t length, maxlen;
+  char *line = NULL;
+  size_t linesize = 0;
 
   msg = rfc822parse_open (parse_message_cb, ctx);
   if (!msg)
@@ -692,16 +693,28 @@ mime_parser_parse (mime_parser_t ctx, estream_t fp)
       goto leave;
     }
 
-  /* Fixme: We should not use fgets because it can't cope with
-     embedded nul characters. */
-  while (es_fgets (ctx->line, sizeof (ctx->line), fp))
+  /* The line buffer is reused for all lines.  Lines are passed
+   * along with their length so that embedded nul characters in the
+   * body do not matter.  */
+  for (;;)
     {
+      maxlen = MIME_PARSER_MAX_LINE;
+      nread = es_read_line (fp, &line, &linesize, &maxlen);
+      if (nread < 0)
+        {
+          err = gpg_error_from_syserror ();
+          log_error ("error reading mail: %s\n", gpg_strerror (err));
+          goto leave;
+        }
+      if (!nread)
+        break;
+      length = nread;
+
       lineno++;
       if (lineno == 1 && !strncmp (line, "From ", 5))
         continue;  /* We better ignore a leading From line. */
 
-      length = strlen (line);
-      if (length && line[length - 1] == '\n')
+      if (maxlen && length && line[length - 1] == '\n')
 	line[--length] = 0;
       else
         log_error ("mail parser detected too long or"
@@ -829,5 +842,6 @@ mime_parser_parse (mime_parser_t ctx, estream_t fp)
 
  leave:
   rfc822parse_cancel (msg);
+  xfree (line);
   return err;
 }
@@ -37,9 +37,8 @@
 #include <arpa/inet.h>
 #include <fcntl.h>
 #include <time.h>
-#ifdef HAVE_SYS_SELECT_H
-# include <sys/select.h>
-#endif
+#include <poll.h>
+#include <signal.h>
 
 #define PGM "watchgnupg"
 
@@ -64,6 +63,11 @@
 static int verbose;
 static int time_only;
 
+/* The file given with --output and a flag set by SIGHUP to reopen
+ * it.  */
+static const char *output_name;
+static volatile sig_atomic_t reopen_output;
+
 static void
 die (const char *format, ...)
 {
@@ -232,11 +236,6 @@ setup_client (int server_fd, int is_un)
       printf ("[accepting %s connection failed: %s]\n",
               is_un? "local":"tcp", strerror (errno));
     }
-  else if (fd >= FD_SETSIZE)
-    {
-      close (fd);
-      printf ("[connection request denied: too many connections]\n");
-    }
   else
     {
       for (client = client_list; client && client->fd != -1;
@@ -359,6 +358,7 @@ print_version (int with_help)
        "  --force       delete an already existing socket file\n"
        "  --verbose     enable extra informational output\n"
        "  --time-only   print only the time; not a full timestamp\n"
+       "  --output FILE append to FILE; reopen it on SIGHUP\n"
        "  --homedir DIR use DIR for gpgconf's --homedir option\n"
        "  --version     print version of the program and exit\n"
        "  --help        display this help and exit\n"
@@ -367,6 +367,14 @@ print_version (int with_help)
   exit (0);
 }
 
+static void
+sighup_handler (int signo)
+{
+  (void)signo;
+  reopen_output = 1;
+}
+
+
 int
 main (int argc, char **argv)
 {
@@ -384,6 +392,8 @@ main (int argc, char **argv)
   unsigned short port;
   int server_un, server_in;
   int flags;
+  struct pollfd *pfds = NULL;
+  size_t pfds_size = 0;
 
   if (argc)
     {
@@ -429,6 +439,14 @@ main (int argc, char **argv)
           argc--;
           homedir = *argv++;
         }
+      else if (!strcmp (*argv, "--output"))
+        {
+          argc--; argv++;
+          if (!argc)
+            die ("option --output requires an argument\n");
+          argc--;
+          output_name = *argv++;
+        }
     }
 
   if (!tcp && argc == 1)
@@ -462,7 +480,21 @@ main (int argc, char **argv)
   if (argc)
     logname = *argv;
 
-  setvbuf (stdout, NULL, _IOLBF, 0);
+  /* We flush the output whenever we are going to wait for new data;
+   * thus a burst of lines is written in one go but nothing is
+   * delayed.  */
+  if (output_name)
+    {
+      struct sigaction sa;
+
+      if (!freopen (output_name, "a", stdout))
+        die ("can't open '%s': %s\n", output_name, strerror (errno));
+      memset (&sa, 0, sizeof sa);
+      sa.sa_handler = sighup_handler;
+      sigemptyset (&sa.sa_mask);
+      sigaction (SIGHUP, &sa, NULL);
+    }
+  setvbuf (stdout, NULL, _IOFBF, 65536);
 
   if (tcp)
     {
@@ -548,53 +580,56 @@ main (int argc, char **argv)
         die ("bind to '%s' failed: %s\n", logname, strerror (errno));
     }
 
-  if (server_in != -1 && listen (server_in, 5))
+  if (server_in != -1 && listen (server_in, SOMAXCONN))
     die ("listen on inet failed: %s\n", strerror (errno));
-  if (server_un != -1 && listen (server_un, 5))
+  if (server_un != -1 && listen (server_un, SOMAXCONN))
     die ("listen on local failed: %s\n", strerror (errno));
 
   for (;;)
     {
-      fd_set rfds;
-      int max_fd;
+      size_t npfds, idx;
       client_t client;
 
-      /* Usually we don't have that many connections, thus it is okay
-         to set them always from scratch and don't maintain an active
-         fd_set. */
-      FD_ZERO (&rfds);
-      max_fd = -1;
-      if (server_in != -1)
+      if (reopen_output)
         {
-          FD_SET (server_in, &rfds);
-          max_fd = server_in;
+          reopen_output = 0;
+          if (!freopen (output_name, "a", stdout))
+            die ("can't reopen '%s': %s\n", output_name, strerror (errno));
+          setvbuf (stdout, NULL, _IOFBF, 65536);
         }
-      if (server_un != -1)
+
+      /* The poll set is built from scratch each time.  Slot 0 and 1
+         are used for the listening sockets; disabled slots are
+         ignored by poll.  */
+      npfds = 2;
+      for (client = client_list; client; client = client->next)
+        npfds++;
+      if (npfds > pfds_size)
         {
-          FD_SET (server_un, &rfds);
-          if (server_un > max_fd)
-            max_fd = server_un;
+          pfds_size = npfds + 64;
+          pfds = pfds? xrealloc (pfds, pfds_size * sizeof *pfds)
+            /**/   : xmalloc (pfds_size * sizeof *pfds);
+        }
+      pfds[0].fd = server_in;
+      pfds[1].fd = server_un;
+      for (idx = 2, client = client_list; client; client = client->next)
+        pfds[idx++].fd = client->fd;
+      for (idx = 0; idx < npfds; idx++)
+        {
+          pfds[idx].events = POLLIN;
+          pfds[idx].revents = 0;
         }
-      for (client = client_list; client; client = client->next)
-        if (client->fd != -1)
-          {
-            FD_SET (client->fd, &rfds);
-            if (client->fd > max_fd)
-              max_fd = client->fd;
-          }
 
-      if (select (max_fd + 1, &rfds, NULL, NULL, NULL) <= 0)
+      fflush (stdout);
+      if (poll (pfds, npfds, -1) <= 0)
         continue;  /* Ignore any errors. */
 
-      if (server_in != -1 && FD_ISSET (server_in, &rfds))
-        setup_client (server_in, 0);
-      if (server_un != -1 && FD_ISSET (server_un, &rfds))
-        setup_client (server_un, 1);
-
-      for (client = client_list; client; client = client->next)
-        if (client->fd != -1 && FD_ISSET (client->fd, &rfds))
+      for (idx = 2, client = client_list; client;
+           idx++, client = client->next)
+        if (client->fd != -1 && pfds[idx].fd == client->fd
+            && (pfds[idx].revents & (POLLIN|POLLHUP|POLLERR)))
           {
-            char line[256];
+            char line[4096];
             int n;
 
             n = read (client->fd, line, sizeof line - 1);
@@ -620,6 +655,13 @@ main (int argc, char **argv)
                 print_line (client, line);
               }
           }
+
+      /* Accept new clients last so that the client list matches the
+         poll set in the loop above.  */
+      if (server_in != -1 && (pfds[0].revents & POLLIN))
+        setup_client (server_in, 0);
+      if (server_un != -1 && (pfds[1].revents & POLLIN))
+        setup_client (server_un, 1);
     }
 
   return 0;